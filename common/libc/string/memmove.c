@@ -39,6 +39,17 @@
 #include <stdint.h>
 #include <string.h>
 #endif
+#include <kern/endian.h>
+
+/* See memcpy.c. */
+#define WSIZE	sizeof(unsigned long)
+#define WMASK	(WSIZE - 1)
+#define WBITS	(WSIZE * 8)
+#if _BYTE_ORDER == _BIG_ENDIAN
+#define MERGE(a, b, shift) (((a) << (shift)) | ((b) >> (WBITS - (shift))))
+#else
+#define MERGE(a, b, shift) (((a) >> (shift)) | ((b) << (WBITS - (shift))))
+#endif
 
 /*
  * C standard function - copy a block of memory, handling overlapping
@@ -48,7 +59,11 @@
 void *
 memmove(void *dst, const void *src, size_t len)
 {
-	size_t i;
+	unsigned char *d;
+	const unsigned char *s;
+	unsigned long *wd, wa, wb;
+	const unsigned long *ws;
+	unsigned shift;
 
 	/*
 	 * If the buffers don't overlap, it doesn't matter what direction
@@ -84,33 +99,63 @@ memmove(void *dst, const void *src, size_t len)
 	}
 
 	/*
-	 * Copy by words in the common case. Look in memcpy.c for more
-	 * information.
+	 * Copy back to front, the way memcpy copies front to back (look
+	 * in memcpy.c for more information): bytes down to a word
+	 * boundary at the end of the destination, then words, eight at
+	 * a time or each put together from two source words, then the
+	 * bytes left at the start.
 	 */
 
-	if ((uintptr_t)dst % sizeof(long) == 0 &&
-	    (uintptr_t)src % sizeof(long) == 0 &&
-	    len % sizeof(long) == 0) {
+	d = (unsigned char *)dst + len;
+	s = (const unsigned char *)src + len;
 
-		long *d = dst;
-		const long *s = src;
-
-		/*
-		 * The reason we copy index i-1 and test i>0 is that
-		 * i is unsigned -- so testing i>=0 doesn't work.
-		 */
+	if (len >= 2 * WSIZE) {
+		while ((uintptr_t)d & WMASK) {
+			*--d = *--s;
+			len--;
+		}
+		wd = (unsigned long *)d;
 
-		for (i=len/sizeof(long); i>0; i--) {
-			d[i-1] = s[i-1];
+		if (((uintptr_t)s & WMASK) == 0) {
+			ws = (const unsigned long *)s;
+			while (len >= 8 * WSIZE) {
+				wd -= 8;
+				ws -= 8;
+				wd[7] = ws[7];
+				wd[6] = ws[6];
+				wd[5] = ws[5];
+				wd[4] = ws[4];
+				wd[3] = ws[3];
+				wd[2] = ws[2];
+				wd[1] = ws[1];
+				wd[0] = ws[0];
+				len -= 8 * WSIZE;
+			}
+			while (len >= WSIZE) {
+				*--wd = *--ws;
+				len -= WSIZE;
+			}
+			s = (const unsigned char *)ws;
 		}
+		else {
+			/* the word ending at s is the end of wa, start of wb */
+			shift = ((uintptr_t)s & WMASK) * 8;
+			ws = (const unsigned long *)((uintptr_t)s & ~WMASK);
+			wb = *ws;
+			while (len >= WSIZE) {
+				wa = *--ws;
+				*--wd = MERGE(wa, wb, shift);
+				wb = wa;
+				s -= WSIZE;
+				len -= WSIZE;
+			}
+		}
+		d = (unsigned char *)wd;
 	}
-	else {
-		char *d = dst;
-		const char *s = src;
 
-		for (i=len; i>0; i--) {
-			d[i-1] = s[i-1];
-		}
+	while (len > 0) {
+		*--d = *--s;
+		len--;
 	}
 
 	return dst;
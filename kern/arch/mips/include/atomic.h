@@ -0,0 +1,156 @@
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * Atomic operations, with LL/SC. See <atomic.h>.
+ */
+
+bool atomic_cas_ptr(void *volatile *p, void *old, void *new);
+bool atomic_cas(volatile unsigned *p, unsigned old, unsigned new);
+void atomic_inc(volatile unsigned *p);
+unsigned atomic_add(volatile unsigned *p, int delta);
+unsigned atomic_next(volatile unsigned *p);
+void membar_sync(void);
+
+////////////////////////////////////////////////////////////
+
+ATOMIC_INLINE
+bool
+atomic_cas_ptr(void *volatile *p, void *old, void *new)
+{
+	void *x;
+	unsigned y;
+
+	/*
+	 * Load the existing value into X; if it is OLD, try to store
+	 * NEW. After the SC, Y contains 1 if the store succeeded, 0 if
+	 * it failed, in which case try again, since someone may have
+	 * stored OLD again meanwhile.
+	 */
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			".set noreorder;"	/* we fill the delay slot */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"bne %0, %3, 1f;"	/*   if (x != old) fail */
+			" li %1, 0;"		/*   y = 0 (delay slot) */
+			"move %1, %4;"		/*   y = new */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (p), "r" (old), "r" (new)
+			: "memory");
+		if (x != old) {
+			return false;
+		}
+	} while (y == 0);
+	return true;
+}
+
+ATOMIC_INLINE
+bool
+atomic_cas(volatile unsigned *p, unsigned old, unsigned new)
+{
+	unsigned x, y;
+
+	/* As atomic_cas_ptr. */
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			".set noreorder;"	/* we fill the delay slot */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"bne %0, %3, 1f;"	/*   if (x != old) fail */
+			" li %1, 0;"		/*   y = 0 (delay slot) */
+			"move %1, %4;"		/*   y = new */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			"1:"
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y)
+			: "r" (p), "r" (old), "r" (new)
+			: "memory");
+		if (x != old) {
+			return false;
+		}
+	} while (y == 0);
+	return true;
+}
+
+ATOMIC_INLINE
+void
+atomic_inc(volatile unsigned *p)
+{
+	unsigned y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%1);"		/*   y = *p */
+			"addiu %0, %0, 1;"	/*   y++ */
+			"sc %0, 0(%1);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (y) : "r" (p) : "memory");
+	} while (y == 0);
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_next(volatile unsigned *p)
+{
+	unsigned x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addiu %1, %0, 1;"	/*   y = x + 1 */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p) : "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_add(volatile unsigned *p, int delta)
+{
+	unsigned x, y;
+
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addu %1, %0, %3;"	/*   y = x + delta */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (delta)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+void
+membar_sync(void)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		"sync;"			/*   all loads and stores so far */
+		".set pop"		/* restore assembler mode */
+		: : : "memory");
+}
+
+#endif /* _MIPS_ATOMIC_H_ */
@@ -36,6 +36,7 @@
 
 #define PAGE_SIZE 4096		  /* size of VM page */
 #define PAGE_FRAME 0xfffff000 /* mask for getting page number from addr */
+#define CACHELINE_SIZE 64	  /* keep data of different cpus this far apart */
 
 /*
  * MIPS-I hardwired memory layout:
@@ -99,7 +100,6 @@
  */
 
 void ram_bootstrap(void);
-paddr_t coremap_stealmem(unsigned long npages);
 paddr_t ram_stealmem(unsigned long npages);
 void ram_getsize(paddr_t *lo, paddr_t *hi);
 
@@ -116,6 +116,7 @@ struct tlbshootdown
 	 */
 	struct addrspace *ts_addrspace;
 	vaddr_t ts_vaddr;
+	struct semaphore *ts_done;	/* if not NULL, V'd once done */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -129,41 +129,7 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 #if OPT_A3
 	if (sig == SIGSEGV)
 	{
-		struct addrspace *as;
-		struct proc *p = curproc;
-
-		KASSERT(curproc->p_addrspace != NULL);
-		as_deactivate();
-		/*
-		 * clear p_addrspace before calling as_destroy. Otherwise if
-		 * as_destroy sleeps (which is quite possible) when we
-		 * come back we'll be calling as_activate on a
-		 * half-destroyed address space. This tends to be
-		 * messily fatal.
-		 */
-		as = curproc_setas(NULL);
-		as_destroy(as);
-
-		/* detach this thread from its process */
-		/* note: curproc cannot be used after this call */
-		proc_remthread(curthread);
-
-		if (p->parent == NULL || p->parent->status == Zombie)
-		{
-			proc_destroy(p);
-		}
-		else
-		{
-			lock_acquire(p->p_Lock);
-			p->status = Zombie;
-			p->exitcode = _MKWAIT_SIG(code);
-			cv_broadcast(p->p_cv, p->parent->p_Lock);
-			lock_release(p->p_Lock);
-		}
-
-		thread_exit();
-		/* thread_exit() does not return, so we should never get here */
-		panic("return from thread_exit in sys_exit\n");
+		proc_exitself(_MKWAIT_SIG(sig));
 	}
 #endif
 
@@ -181,7 +147,6 @@ void mips_trap(struct trapframe *tf)
 {
 	uint32_t code;
 	bool isutlb, iskern;
-	int spl;
 
 	/* The trap frame is supposed to be 37 registers long. */
 	KASSERT(sizeof(struct trapframe) == (37 * 4));
@@ -202,6 +167,29 @@ void mips_trap(struct trapframe *tf)
 		KASSERT((vaddr_t)tf < (vaddr_t)(curthread->t_stack + STACK_SIZE));
 	}
 
+	/*
+	 * Syscall? Call the syscall handler and return.
+	 *
+	 * This is the commonest trap, so it is checked first and skips
+	 * the general interrupt-state fixup below: a syscall only comes
+	 * from user mode, where interrupts are on and nothing can be
+	 * held, so the previous state is always spl 0 and all the
+	 * fixup would do is turn them back on.
+	 */
+	if (__predict_true(code == EX_SYS))
+	{
+		/* Interrupts should have been on while in user mode. */
+		KASSERT(curthread->t_curspl == 0);
+		KASSERT(curthread->t_iplhigh_count == 0);
+		cpu_irqon();
+
+		DEBUG(DB_SYSCALL, "syscall: #%d, args %x %x %x %x\n",
+			  tf->tf_v0, tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3);
+
+		syscall(tf);
+		goto done;
+	}
+
 	/* Interrupt? Call the interrupt handler and return. */
 	if (code == EX_IRQ)
 	{
@@ -241,6 +229,10 @@ void mips_trap(struct trapframe *tf)
 			doadjust = false;
 		}
 
+		/* For the profiler (see prof.c). */
+		curcpu->c_intrpc = tf->tf_epc;
+		curcpu->c_intruser = !iskern;
+
 		mainbus_interrupt(tf);
 
 		if (doadjust)
@@ -252,6 +244,13 @@ void mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+#if OPT_A3
+		/* A thread spinning in user mode only comes in this way. */
+		if (!iskern)
+		{
+			proc_checkexit();
+		}
+#endif
 		goto done2;
 	}
 
@@ -262,25 +261,16 @@ void mips_trap(struct trapframe *tf)
 	 * interrupt, restore the interrupt state to where it was in
 	 * the previous context, which may be low (interrupts on).
 	 *
-	 * Do this by forcing splhigh(), which may do a redundant
-	 * cpu_irqoff() but forces the stored MI interrupt state into
-	 * sync, then restoring the previous state.
+	 * Forcing splhigh() and then restoring the previous state
+	 * with splx() would do it, but comes down to this: interrupts
+	 * go back on if the previous context was at spl 0 and held no
+	 * spinlock, and the stored state is left as it was. So do just
+	 * that, without the two calls, as TLB faults come through here
+	 * often.
 	 */
-	spl = splhigh();
-	splx(spl);
-
-	/* Syscall? Call the syscall handler and return. */
-	if (code == EX_SYS)
+	if (curthread->t_curspl == 0 && curthread->t_iplhigh_count == 0)
 	{
-		/* Interrupts should have been on while in user mode. */
-		KASSERT(curthread->t_curspl == 0);
-		KASSERT(curthread->t_iplhigh_count == 0);
-
-		DEBUG(DB_SYSCALL, "syscall: #%d, args %x %x %x %x\n",
-			  tf->tf_v0, tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3);
-
-		syscall(tf);
-		goto done;
+		cpu_irqon();
 	}
 
 	/*
@@ -379,6 +369,13 @@ void mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
 done:
+#if OPT_A3
+	/* Another thread may be ending the process; if so, go too. */
+	if (!iskern)
+	{
+		proc_checkexit();
+	}
+#endif
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -30,12 +30,428 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/syscall.h>
+#include <kern/syscallstat.h>
+#include <kern/syscallbatch.h>
 #include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <copyinout.h>
+#include <platform/maxcpus.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include <ktrace.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
+
+/*
+ * The system calls, by number. Each says how to call its sys_
+ * function: how many register arguments (a0-a3) it takes, and whether
+ * it also wants the trapframe (before them), the user stack pointer
+ * (after them, for calls that fetch more arguments off the stack
+ * themselves), and a place for the return value (last). Everything is
+ * passed as a 32-bit word, which the MIPS calling convention makes
+ * the same as passing the int, pointer, or size_t the function takes.
+ * A 64-bit argument takes an aligned register pair, in the kernel as in
+ * user code, so passing on all the registers up to it as words lines
+ * it up too; NARGS counts registers, not arguments. Calls that return
+ * 64 bits get a place for an off_t instead (SC_RETVAL64), which goes
+ * back in v0 and v1. Calls that could not be made from syscall_batch
+ * are marked SC_NOBATCH, or are SC_TF or SC_NORETURN.
+ */
+
+#define SC_TF		0x1	/* pass the trapframe first */
+#define SC_USP		0x2	/* pass the user stack pointer */
+#define SC_RETVAL	0x4	/* pass &retval last */
+#define SC_NORETURN	0x8	/* does not return */
+#define SC_RETVAL64	0x10	/* pass &retval64 last */
+#define SC_NOBATCH	0x20	/* not in syscall_batch */
+
+#define SC_MAXARGS	6
+
+typedef void (*sc_func_t)(void);	/* really any of them */
+
+struct syscall_desc
+{
+	const char *sd_name;
+	sc_func_t sd_func;
+	unsigned sd_nargs;	/* in a0-a3 */
+	unsigned sd_flags;
+};
+
+#define SC(name, nargs, flags) \
+	[SYS_##name] = {#name, (sc_func_t)sys_##name, (nargs), (flags)}
+
+static const struct syscall_desc syscalls[] = {
+	SC(reboot, 1, 0),
+	SC(__time, 2, 0),
+	SC(clock_monotonic, 0, SC_RETVAL64),
+	SC(getsyscallstat, 2, 0),
+	SC(syscall_batch, 3, SC_RETVAL | SC_NOBATCH),
+#ifdef UW
+	SC(open, 3, SC_RETVAL),
+	SC(openat, 4, SC_RETVAL),
+	SC(close, 1, 0),
+	SC(pipe, 1, 0),
+	SC(dup2, 2, SC_RETVAL),
+	SC(read, 3, SC_RETVAL),
+	SC(write, 3, SC_RETVAL),
+	SC(pread, 3, SC_USP | SC_RETVAL),
+	SC(pwrite, 3, SC_USP | SC_RETVAL),
+	SC(readv, 3, SC_RETVAL),
+	SC(writev, 3, SC_RETVAL),
+	SC(lseek, 4, SC_USP | SC_RETVAL64),
+	SC(fstat, 2, 0),
+	SC(fstatat, 3, 0),
+	SC(fsync, 1, 0),
+	SC(fdatasync, 1, 0),
+	SC(stat, 2, 0),
+	SC(lstat, 2, 0),
+	SC(copy_file_range, 3, SC_RETVAL),
+	SC(getdirentry, 3, SC_RETVAL),
+	SC(getdirentries, 3, SC_RETVAL),
+	SC(ioctl, 3, 0),
+	SC(poll, 3, SC_RETVAL),
+	SC(_exit, 1, SC_NORETURN),
+	SC(getpid, 0, SC_RETVAL),
+	SC(getschedstat, 2, 0),
+	SC(getkstat, 2, 0),
+	SC(getiostat, 2, 0),
+	SC(getrusage, 2, 0),
+	SC(setpriority, 3, 0),
+	SC(getpriority, 2, SC_RETVAL),
+	SC(getpgid, 1, SC_RETVAL),
+	SC(setpgid, 2, 0),
+	SC(sched_setaffinity, 2, 0),
+	SC(sched_getaffinity, 2, 0),
+	SC(ktrace, 4, SC_RETVAL),
+	SC(waitpid, 3, SC_RETVAL),
+#endif // UW
+#if OPT_A2
+	SC(fork, 0, SC_TF | SC_RETVAL),
+	SC(execv, 2, SC_NOBATCH),
+	SC(spawn, 2, SC_RETVAL),
+#endif
+#if OPT_A3
+	SC(mmap, 4, SC_USP | SC_RETVAL),
+	SC(munmap, 2, 0),
+	SC(sbrk, 1, SC_RETVAL),
+	SC(shmget, 3, SC_RETVAL),
+	SC(shmat, 3, SC_RETVAL),
+	SC(shmdt, 1, 0),
+	SC(shmctl, 3, 0),
+	SC(getmemstat, 2, 0),
+	SC(__thread_create, 3, SC_RETVAL),
+	SC(thread_join, 2, 0),
+	SC(thread_exit, 1, SC_NORETURN),
+	SC(futex_wait, 2, 0),
+	SC(futex_wake, 2, SC_RETVAL),
+	SC(upcall_register, 1, 0),
+	SC(upcall_wait, 1, SC_RETVAL),
+	SC(aio_setup, 1, 0),
+	SC(aio_enter, 1, SC_RETVAL),
+#endif
+};
+
+#define NSYSCALLS (sizeof(syscalls) / sizeof(syscalls[0]))
+
+/*
+ * Counts for each system call, kept by each cpu for the calls it sees:
+ * calls when they start, and errors and time taken when they return.
+ * Allocated by syscall_bootstrap once all the cpus are up; until then
+ * nothing is counted. A cpu only touches its own, with interrupts off.
+ */
+struct syscall_cpustat
+{
+	unsigned scs_calls;
+	unsigned scs_errors;
+	unsigned scs_hist[SYSCALLSTAT_NBUCKETS];
+};
+
+static struct syscall_cpustat *syscall_stats[MAXCPUS];
+
+void syscall_bootstrap(void)
+{
+	unsigned i;
+
+	for (i = 0; i < cpu_count(); i++)
+	{
+		syscall_stats[i] = kmalloc_aligned(
+			NSYSCALLS * sizeof(struct syscall_cpustat), CACHELINE_SIZE);
+		if (syscall_stats[i] == NULL)
+		{
+			panic("syscall_bootstrap: Out of memory\n");
+		}
+		bzero(syscall_stats[i], NSYSCALLS * sizeof(struct syscall_cpustat));
+	}
+}
+
+static void syscall_count(int callno)
+{
+	struct syscall_cpustat *stats;
+	int spl;
+
+	KTRACE(KT_SYSCALL, callno, 0);
+
+	spl = splhigh();
+	stats = syscall_stats[curcpu->c_number];
+	if (stats != NULL)
+	{
+		stats[callno].scs_calls++;
+	}
+	splx(spl);
+}
+
+static void syscall_record(int callno, uint32_t start, int err)
+{
+	struct syscall_cpustat *stats;
+	uint32_t c;
+	unsigned b;
+	int spl;
+
+	KTRACE(KT_SYSRET, callno, err);
+
+	c = (cpu_cycles() - start) >> SYSCALLSTAT_MINSHIFT;
+	for (b = 0; c > 1 && b < SYSCALLSTAT_NBUCKETS - 1; b++)
+	{
+		c >>= 1;
+	}
+
+	spl = splhigh();
+	stats = syscall_stats[curcpu->c_number];
+	if (stats != NULL)
+	{
+		if (err)
+		{
+			stats[callno].scs_errors++;
+		}
+		stats[callno].scs_hist[b]++;
+	}
+	splx(spl);
+}
+
+/*
+ * Add up the counts for CALLNO over all cpus.
+ */
+static void syscall_sumstats(int callno, struct syscallstat *ss)
+{
+	unsigned i, b;
+
+	bzero(ss, sizeof(*ss));
+	ss->ss_nsyscalls = NSYSCALLS;
+	snprintf(ss->ss_name, sizeof(ss->ss_name), "%s",
+			 syscalls[callno].sd_name);
+	for (i = 0; i < MAXCPUS; i++)
+	{
+		if (syscall_stats[i] == NULL)
+		{
+			continue;
+		}
+		ss->ss_calls += syscall_stats[i][callno].scs_calls;
+		ss->ss_errors += syscall_stats[i][callno].scs_errors;
+		for (b = 0; b < SYSCALLSTAT_NBUCKETS; b++)
+		{
+			ss->ss_hist[b] += syscall_stats[i][callno].scs_hist[b];
+		}
+	}
+}
+
+void syscall_printstats(void)
+{
+	struct syscallstat ss;
+	unsigned callno, b;
+
+	kprintf("System calls (time in cycles, by log2 bucket):\n");
+	kprintf("    %-16s %8s %8s\n", "name", "calls", "errors");
+	for (callno = 0; callno < NSYSCALLS; callno++)
+	{
+		if (syscalls[callno].sd_func == NULL)
+		{
+			continue;
+		}
+		syscall_sumstats(callno, &ss);
+		if (ss.ss_calls == 0)
+		{
+			continue;
+		}
+		kprintf("    %-16s %8u %8u ", ss.ss_name, ss.ss_calls, ss.ss_errors);
+		for (b = 0; b < SYSCALLSTAT_NBUCKETS; b++)
+		{
+			if (ss.ss_hist[b] != 0)
+			{
+				kprintf(" %s2^%u:%u", b == 0 ? "<" : "",
+						b + SYSCALLSTAT_MINSHIFT + (b == 0), ss.ss_hist[b]);
+			}
+		}
+		kprintf("\n");
+	}
+}
+
+/*
+ * getsyscallstat(callno, ss): the counts for system call CALLNO.
+ * Loop over CALLNO up to ss_nsyscalls to see them all; those that do
+ * not exist fail with ENOSYS.
+ */
+int sys_getsyscallstat(int callno, userptr_t ss)
+{
+	struct syscallstat st;
+
+	if (callno < 0 || (unsigned)callno >= NSYSCALLS ||
+		syscalls[callno].sd_func == NULL)
+	{
+		return ENOSYS;
+	}
+	syscall_sumstats(callno, &st);
+	return copyout(&st, ss, sizeof(st));
+}
+
+/*
+ * Call SD's function with the N argument words in A.
+ */
+static int syscall_call(const struct syscall_desc *sd, uint32_t *a,
+						unsigned n)
+{
+	typedef uint32_t w;
+
+	switch (n)
+	{
+	case 0:
+		return ((int (*)(void))sd->sd_func)();
+	case 1:
+		return ((int (*)(w))sd->sd_func)(a[0]);
+	case 2:
+		return ((int (*)(w, w))sd->sd_func)(a[0], a[1]);
+	case 3:
+		return ((int (*)(w, w, w))sd->sd_func)(a[0], a[1], a[2]);
+	case 4:
+		return ((int (*)(w, w, w, w))sd->sd_func)(a[0], a[1], a[2],
+												  a[3]);
+	case 5:
+		return ((int (*)(w, w, w, w, w))sd->sd_func)(a[0], a[1], a[2],
+													 a[3], a[4]);
+	case 6:
+		return ((int (*)(w, w, w, w, w, w))sd->sd_func)(a[0], a[1], a[2],
+														a[3], a[4], a[5]);
+	}
+	panic("syscall %s: %u arguments\n", sd->sd_name, n);
+}
+
+/*
+ * Make system call CALLNO, which exists, with the register arguments A
+ * (a0-a3) and the user stack pointer USP, and count it. TF is for
+ * SC_TF calls.
+ */
+static int syscall_run(int callno, struct trapframe *tf, const uint32_t *a,
+					   uint32_t usp, int32_t *retval, off_t *retval64)
+{
+	const struct syscall_desc *sd = &syscalls[callno];
+	uint32_t args[SC_MAXARGS];
+	uint32_t start;
+	unsigned i, n;
+	int err;
+
+	start = cpu_cycles();
+	syscall_count(callno);
+
+	n = 0;
+	if (sd->sd_flags & SC_TF)
+	{
+		args[n++] = (uint32_t)tf;
+	}
+	for (i = 0; i < sd->sd_nargs; i++)
+	{
+		args[n++] = a[i];
+	}
+	if (sd->sd_flags & SC_USP)
+	{
+		args[n++] = usp;
+	}
+	if (sd->sd_flags & SC_RETVAL)
+	{
+		args[n++] = (uint32_t)retval;
+	}
+	if (sd->sd_flags & SC_RETVAL64)
+	{
+		args[n++] = (uint32_t)retval64;
+	}
+
+	err = syscall_call(sd, args, n);
+	if (sd->sd_flags & SC_NORETURN)
+	{
+		panic("unexpected return from sys_%s\n", sd->sd_name);
+	}
+	syscall_record(callno, start, err);
+	return err;
+}
+
+/*
+ * syscall_batch(recs, n, flags): make the N calls in RECS in order,
+ * each as if with a trap of its own, and copy the records back with
+ * their results in one go once they are all made, or just those up to
+ * the first that failed with SYSCALLBATCH_STOP. Hands back how many
+ * were made. A call's stack arguments are found through a user stack
+ * pointer 16 bytes before sr_args[4], that is, at sr_args itself.
+ */
+int sys_syscall_batch(userptr_t urecs, unsigned n, int flags, int *retval)
+{
+	struct syscall_rec *recs, *r;
+	unsigned i;
+	int err;
+
+	if (n == 0 || n > SYSCALLBATCH_MAX || (flags & ~SYSCALLBATCH_STOP) != 0)
+	{
+		return EINVAL;
+	}
+	recs = kmalloc(n * sizeof(*recs));
+	if (recs == NULL)
+	{
+		return ENOMEM;
+	}
+	err = copyin(urecs, recs, n * sizeof(*recs));
+	if (err)
+	{
+		kfree(recs);
+		return err;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		r = &recs[i];
+		r->sr_retval = 0;
+		r->sr_retval64 = 0;
+		if (r->sr_callno < 0 || (unsigned)r->sr_callno >= NSYSCALLS ||
+			syscalls[r->sr_callno].sd_func == NULL)
+		{
+			r->sr_err = ENOSYS;
+		}
+		else if (syscalls[r->sr_callno].sd_flags &
+				 (SC_TF | SC_NORETURN | SC_NOBATCH))
+		{
+			r->sr_err = EINVAL;
+		}
+		else
+		{
+			r->sr_err = syscall_run(r->sr_callno, NULL, r->sr_args,
+				(uint32_t)((struct syscall_rec *)urecs)[i].sr_args,
+				&r->sr_retval, &r->sr_retval64);
+		}
+		if (r->sr_err && (flags & SYSCALLBATCH_STOP))
+		{
+			i++;
+			break;
+		}
+	}
+
+	err = copyout(recs, urecs, i * sizeof(*recs));
+	kfree(recs);
+	if (err)
+	{
+		return err;
+	}
+	*retval = i;
+	return 0;
+}
 
 /*
  * System call dispatcher.
@@ -77,8 +493,11 @@
  */
 void syscall(struct trapframe *tf)
 {
+	const struct syscall_desc *sd;
+	uint32_t regs[4];
 	int callno;
 	int32_t retval;
+	off_t retval64;
 	int err;
 
 	KASSERT(curthread != NULL);
@@ -97,54 +516,27 @@ void syscall(struct trapframe *tf)
 	 */
 
 	retval = 0;
+	retval64 = 0;
 
-	switch (callno)
+	sd = NULL;
+	if (callno >= 0 && (unsigned)callno < NSYSCALLS &&
+		syscalls[callno].sd_func != NULL)
 	{
-	case SYS_reboot:
-		err = sys_reboot(tf->tf_a0);
-		break;
-
-	case SYS___time:
-		err = sys___time((userptr_t)tf->tf_a0,
-						 (userptr_t)tf->tf_a1);
-		break;
-#ifdef UW
-	case SYS_write:
-		err = sys_write((int)tf->tf_a0,
-						(userptr_t)tf->tf_a1,
-						(int)tf->tf_a2,
-						(int *)(&retval));
-		break;
-	case SYS__exit:
-		sys__exit((int)tf->tf_a0);
-		/* sys__exit does not return, execution should not get here */
-		panic("unexpected return from sys__exit");
-		break;
-	case SYS_getpid:
-		err = sys_getpid((pid_t *)&retval);
-		break;
-	case SYS_waitpid:
-		err = sys_waitpid((pid_t)tf->tf_a0,
-						  (userptr_t)tf->tf_a1,
-						  (int)tf->tf_a2,
-						  (pid_t *)&retval);
-		break;
-#endif // UW
-
-#if OPT_A2
-	case SYS_fork:
-		err = sys_fork(tf, (pid_t *)&retval);
-		break;
-	case SYS_execv:
-		err = sys_execv((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
-		break;
-
-#endif
+		sd = &syscalls[callno];
+	}
 
-	default:
+	if (sd == NULL)
+	{
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
-		break;
+	}
+	else
+	{
+		regs[0] = tf->tf_a0;
+		regs[1] = tf->tf_a1;
+		regs[2] = tf->tf_a2;
+		regs[3] = tf->tf_a3;
+		err = syscall_run(callno, tf, regs, tf->tf_sp, &retval, &retval64);
 	}
 
 	if (err)
@@ -160,7 +552,16 @@ void syscall(struct trapframe *tf)
 	else
 	{
 		/* Success. */
-		tf->tf_v0 = retval;
+		if (sd->sd_flags & SC_RETVAL64)
+		{
+			/* high word first; we are big-endian */
+			tf->tf_v0 = (uint32_t)(retval64 >> 32);
+			tf->tf_v1 = (uint32_t)retval64;
+		}
+		else
+		{
+			tf->tf_v0 = retval;
+		}
 		tf->tf_a3 = 0; /* signal no error */
 	}
 
@@ -103,6 +103,24 @@ cpu_identify(void)
 	return "MIPS r3000";
 }
 
+/*
+ * Read the cycle counter, coprocessor 0 register 9 (c0_count), which
+ * counts up once every cycle.
+ */
+uint32_t
+cpu_cycles(void)
+{
+	uint32_t x;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (x));
+	return x;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -29,6 +29,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/timepage.h>
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
@@ -37,11 +38,29 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <clock.h>
+#include <ktrace.h>
 #include "opt-A3.h"
+#include "opt-vmcluster.h"
+#if OPT_A3
+#include <platform/maxcpus.h>
+#include <cpu.h>
+#include <synch.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <execcache.h>
+#include <shm.h>
+#include <uw-vmstats.h>
+#endif
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
  * enough to struggle off the ground.
+ *
+ * With OPT_A3 only the MIPS-specific parts live here (TLB handling and
+ * as_activate); address spaces are paged on demand by vm/addrspace.c.
+ * Most TLB misses on resident pages never get here: the refill handler
+ * in exception-mips1.S walks the page table itself.
  */
 
 /* under dumbvm, always have 48k of user stack */
@@ -51,100 +70,114 @@
  * Wrap rma_stealmem in a spinlock.
  */
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
 #if OPT_A3
-static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
-static int *coremap;
-static unsigned long frame_num;
-static paddr_t frame_start;
-static bool ram_finished = false;
+/*
+ * Only one batch of vm_tlbshootdown_pages is in flight at a time, and
+ * a batch is at most TLBSHOOTDOWN_MAX pages, so a CPU's queue never
+ * overflows and none of them are lost to TLBSHOOTDOWN_ALL.
+ */
+static struct lock *shootdown_lock;
+static struct semaphore *shootdown_sem;
+
+/* ts_vaddr of a shootdown from vm_tlbshootdown_as; never a user page. */
+#define TS_WHOLEAS ((vaddr_t)-1)
+
+/*
+ * Address space IDs. Each cpu hands out the TLBHI_NPID values of the
+ * EntryHi PID field to the address spaces that run on it, round robin,
+ * so that switching back to one that ran recently finds its TLB
+ * entries still loaded. Handing a PID to a new address space flushes
+ * whatever the TLB still holds under it. The tables of all cpus are
+ * protected by asid_lock, because vm_tlbshootdown_as clears entries on
+ * every cpu; at_cur is only touched by its own cpu, interrupts off.
+ *
+ * Since an address space can only have TLB entries on a cpu where it
+ * holds a PID, these tables are also what decides which cpus a
+ * shootdown is sent to.
+ */
+struct asidtable
+{
+	struct cpu *at_cpu; /* the cpu, once it has run a process */
+	struct addrspace *at_owner[TLBHI_NPID];
+	unsigned at_next; /* next PID to hand out */
+	unsigned at_cur;  /* PID now loaded in EntryHi */
+};
+
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static struct asidtable asidtables[MAXCPUS];
+
+/*
+ * Page table of the address space each cpu is running, for the refill
+ * handler in exception-mips1.S; 0 if none.
+ */
+vaddr_t tlbrefill_pagetables[MAXCPUS];
+
+/*
+ * Most pages vm_fault loads into the TLB ahead of a run of sequential
+ * faults (see vm_fault).
+ */
+#define VM_PREFILL_MAX 8
+
+/*
+ * MIPS-I has only 4K TLB entries, so big arrays cannot be covered by
+ * larger ones. With "options vmcluster" vm_fault does the next best
+ * thing: a fault brings in and maps the whole naturally aligned
+ * cluster of VM_CLUSTER pages around the faulting page, so a matrix
+ * takes one fault per cluster instead of one per page. VM_CLUSTER must
+ * be a power of two; 1 turns clustering off.
+ */
+#if OPT_VMCLUSTER
+#define VM_CLUSTER 8
 #else
+#define VM_CLUSTER 1
 #endif
 
-void vm_bootstrap(void)
-{
-#if OPT_A3
-	paddr_t lo, hi;
-	ram_getsize(&lo, &hi);
-	KASSERT(lo != 0);
-	KASSERT(hi != 0);
+/* Most pages vm_fault loads besides the faulting one. */
+#define VM_EXTRA_MAX (VM_PREFILL_MAX + VM_CLUSTER - 1)
 
-	frame_num = DIVROUNDUP(hi - lo, PAGE_SIZE);
-	coremap = (int *)PADDR_TO_KVADDR(lo);
-	for (unsigned long i = 0; i < frame_num; i++)
-	{
-		coremap[i] = 0;
-	}
-	int start = (int)(lo + frame_num * sizeof(int));
-	frame_start = (paddr_t)ROUNDUP(start, PAGE_SIZE);
-	ram_finished = true;
+/*
+ * Per-cpu clock hand over TLB slots for vm_fault's replacements (see
+ * tlb_pickslot). Only touched by its own cpu, interrupts off.
+ */
+static unsigned tlb_hands[MAXCPUS];
 #endif
-}
 
-#if OPT_A3
-paddr_t
-coremap_stealmem(unsigned long npages)
+void vm_bootstrap(void)
 {
-	for (unsigned long i = 0; i < frame_num; i++)
+#if OPT_A3
+	coremap_bootstrap();
+	coremap_start_zeroer();
+	pagecache_bootstrap();
+	shm_bootstrap();
+	execcache_bootstrap();
+	vmstats_init();
+
+	shootdown_lock = lock_create("shootdown");
+	shootdown_sem = sem_create("shootdown", 0);
+	if (shootdown_lock == NULL || shootdown_sem == NULL)
 	{
-		if (coremap[i] != 0)
-		{
-			continue;
-		}
-		unsigned long length = 0;
-		while (length < npages)
-		{
-			if (coremap[i + length] == 0)
-			{
-				length++;
-			}
-			else
-			{
-				break;
-			}
-		}
-		if (length != npages)
-		{
-			continue;
-		}
-		for (length = 0; length < npages; length++)
-		{
-			coremap[i + length] = length + 1;
-		}
-		return frame_start + i * PAGE_SIZE;
+		panic("vm_bootstrap: Out of memory\n");
 	}
-	return 0;
-}
+	coremap_start_ager();
 #endif
+}
 
 static paddr_t
 getppages(unsigned long npages)
 {
 	paddr_t addr;
 #if OPT_A3
-	if (ram_finished)
+	if (coremap_ready())
 	{
-		spinlock_acquire(&coremap_lock);
-
-		addr = coremap_stealmem(npages);
-
-		spinlock_release(&coremap_lock);
-	}
-	else
-	{
-		spinlock_acquire(&stealmem_lock);
-
-		addr = ram_stealmem(npages);
-
-		spinlock_release(&stealmem_lock);
+		return coremap_alloc(npages);
 	}
-
-#else
+#endif
 	spinlock_acquire(&stealmem_lock);
 
 	addr = ram_stealmem(npages);
 
 	spinlock_release(&stealmem_lock);
-#endif
 	return addr;
 }
 
@@ -165,21 +198,12 @@ void free_kpages(vaddr_t addr)
 {
 #if OPT_A3
 	paddr_t paddr = KVADDR_TO_PADDR(addr);
-	KASSERT(paddr >= frame_start);
-	unsigned long index = DIVROUNDUP(paddr - frame_start, PAGE_SIZE);
-	KASSERT(coremap[index] > 0);
 
-	spinlock_acquire(&coremap_lock);
-	for (unsigned long i = index - coremap[index] + 1;; i++)
+	/* Pages stolen before vm_bootstrap are not ours to free. */
+	if (coremap_owns(paddr))
 	{
-		int old = coremap[i];
-		coremap[i] = 0;
-		if (coremap[i + 1] != old + 1)
-		{
-			break;
-		}
+		coremap_free(paddr);
 	}
-	spinlock_release(&coremap_lock);
 #else
 	/* nothing - leak the memory. */
 
@@ -187,6 +211,341 @@ void free_kpages(vaddr_t addr)
 #endif
 }
 
+bool grow_kpages(vaddr_t addr, int npages)
+{
+#if OPT_A3
+	paddr_t paddr = KVADDR_TO_PADDR(addr);
+
+	if (!coremap_owns(paddr))
+	{
+		return false;
+	}
+	return coremap_grow(paddr, npages);
+#else
+	/* stealmem cannot tell what comes after the run. */
+	(void)addr;
+	(void)npages;
+	return false;
+#endif
+}
+
+#if OPT_A3
+/*
+ * Find the PID AS has on the cpu owning AT, or -1 if it has none.
+ * asid_lock held.
+ */
+static int
+asid_lookup(struct asidtable *at, struct addrspace *as)
+{
+	int pid;
+
+	for (pid = 0; pid < TLBHI_NPID; pid++)
+	{
+		if (at->at_owner[pid] == as)
+		{
+			return pid;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Invalidate every entry in this cpu's TLB tagged with PID. Interrupts
+ * off. Leaves EntryHi for the caller to restore.
+ */
+static void
+tlb_flushpid(unsigned pid)
+{
+	uint32_t ehi, elo;
+	int i;
+
+	for (i = 0; i < NUM_TLB; i++)
+	{
+		tlb_read(&ehi, &elo, i);
+		if (((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT) == pid)
+		{
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+}
+
+/*
+ * Number of entries for PID in this cpu's TLB, with interrupts off.
+ * Leaves EntryHi for the caller to restore.
+ */
+static unsigned
+tlb_countpid(unsigned pid)
+{
+	uint32_t ehi, elo;
+	unsigned n;
+	int i;
+
+	n = 0;
+	for (i = 0; i < NUM_TLB; i++)
+	{
+		tlb_read(&ehi, &elo, i);
+		if ((elo & TLBLO_VALID) &&
+			((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT) == pid)
+		{
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * Choose the TLB slot for a new entry on this cpu, with interrupts off.
+ * Starting from the clock hand, an invalid slot is used if there is
+ * one. Otherwise, the first slot holding an entry for some other PID (an
+ * address space that is not running) is taken, and failing that the
+ * slot under the hand. Entries we replace are thus the oldest ones
+ * vm_fault loaded, rather than tlb_random's pick, which may well be
+ * the stack or text page we are about to touch again. Returns true if
+ * a valid entry is being replaced. Leaves EntryHi for the caller to
+ * restore.
+ */
+static bool
+tlb_pickslot(int *ret)
+{
+	uint32_t ehi, elo, curpid;
+	unsigned hand, slot, n;
+	int other;
+
+	hand = tlb_hands[curcpu->c_number];
+	curpid = asidtables[curcpu->c_number].at_cur;
+	other = -1;
+
+	for (n = 0; n < NUM_TLB; n++)
+	{
+		slot = (hand + n) % NUM_TLB;
+		tlb_read(&ehi, &elo, slot);
+		if (!(elo & TLBLO_VALID))
+		{
+			tlb_hands[curcpu->c_number] = (slot + 1) % NUM_TLB;
+			*ret = slot;
+			return false;
+		}
+		if (other < 0 &&
+		    ((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT) != curpid)
+		{
+			other = slot;
+		}
+	}
+
+	if (other < 0)
+	{
+		other = hand;
+	}
+	tlb_hands[curcpu->c_number] = (other + 1) % NUM_TLB;
+	*ret = other;
+	return true;
+}
+
+/*
+ * Remove this cpu's mapping of VADDR in AS, if it has one.
+ */
+static void
+tlb_unmap(struct addrspace *as, vaddr_t vaddr)
+{
+	struct asidtable *at;
+	int i, pid, spl;
+
+	spl = splhigh();
+	at = &asidtables[curcpu->c_number];
+
+	spinlock_acquire(&asid_lock);
+	pid = asid_lookup(at, as);
+	if (pid >= 0)
+	{
+		i = tlb_probe((vaddr & PAGE_FRAME) | (pid << TLBHI_PIDSHIFT), 0);
+		if (i >= 0)
+		{
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+		tlb_setpid(at->at_cur);
+	}
+	spinlock_release(&asid_lock);
+
+	splx(spl);
+}
+
+/*
+ * This cpu's part in vm_tlbshootdown_as: if the PID loaded here has
+ * been taken away from its address space, flush what it has mapped.
+ * Until that address space is next activated here, its faults go the
+ * slow way and load under the orphaned PID, which is flushed again
+ * before it is handed out.
+ */
+static void
+tlb_flushrevoked(void)
+{
+	struct asidtable *at;
+	int spl;
+
+	spl = splhigh();
+	at = &asidtables[curcpu->c_number];
+
+	spinlock_acquire(&asid_lock);
+	if (at->at_owner[at->at_cur] == NULL)
+	{
+		tlb_flushpid(at->at_cur);
+		tlb_setpid(at->at_cur);
+	}
+	spinlock_release(&asid_lock);
+
+	splx(spl);
+}
+
+void vm_tlbshootdown_all(void)
+{
+	int i, spl;
+
+	spl = splhigh();
+	for (i = 0; i < NUM_TLB; i++)
+	{
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setpid(asidtables[curcpu->c_number].at_cur);
+	splx(spl);
+}
+
+void vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	if (ts->ts_vaddr == TS_WHOLEAS)
+	{
+		tlb_flushrevoked();
+	}
+	else
+	{
+		tlb_unmap(ts->ts_addrspace, ts->ts_vaddr);
+	}
+	if (ts->ts_done != NULL)
+	{
+		V(ts->ts_done);
+	}
+}
+
+void vm_tlbshootdown_pages(struct addrspace *as, const vaddr_t *vaddrs,
+						   unsigned n)
+{
+	struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+	struct cpu *targets[MAXCPUS];
+	unsigned ntargets, c, t, i, k, chunk;
+	int spl;
+
+	lock_acquire(shootdown_lock);
+
+	/*
+	 * Only cpus where AS holds a PID can have entries for it. One
+	 * that gives AS a PID after we look has flushed that PID, and
+	 * can only load what the page table says now.
+	 */
+	ntargets = 0;
+	spl = splhigh();
+	spinlock_acquire(&asid_lock);
+	for (c = 0; c < MAXCPUS; c++)
+	{
+		if (c != curcpu->c_number && asidtables[c].at_cpu != NULL &&
+			asid_lookup(&asidtables[c], as) >= 0)
+		{
+			targets[ntargets++] = asidtables[c].at_cpu;
+		}
+	}
+	spinlock_release(&asid_lock);
+	splx(spl);
+
+	for (i = 0; i < n; i += chunk)
+	{
+		chunk = n - i;
+		if (chunk > TLBSHOOTDOWN_MAX)
+		{
+			chunk = TLBSHOOTDOWN_MAX;
+		}
+
+		/* One IPI per cpu per chunk; only the last entry signals. */
+		for (k = 0; k < chunk; k++)
+		{
+			ts[k].ts_addrspace = as;
+			ts[k].ts_vaddr = vaddrs[i + k];
+			ts[k].ts_done = (k == chunk - 1) ? shootdown_sem : NULL;
+		}
+		for (t = 0; t < ntargets; t++)
+		{
+			ipi_tlbshootdown_multi(targets[t], ts, chunk);
+		}
+
+		for (k = 0; k < chunk; k++)
+		{
+			tlb_unmap(as, vaddrs[i + k]);
+		}
+
+		for (t = 0; t < ntargets; t++)
+		{
+			P(shootdown_sem);
+		}
+	}
+
+	lock_release(shootdown_lock);
+}
+
+void vm_tlbshootdown_page(struct addrspace *as, vaddr_t vaddr)
+{
+	vm_tlbshootdown_pages(as, &vaddr, 1);
+}
+
+void vm_tlbshootdown_as(struct addrspace *as)
+{
+	struct tlbshootdown ts;
+	struct cpu *targets[MAXCPUS];
+	unsigned ntargets, c, t;
+	int pid, spl;
+
+	lock_acquire(shootdown_lock);
+
+	/*
+	 * Taking away its PIDs is enough where AS is not running: the
+	 * entries left behind can no longer match, and are flushed
+	 * before their PID is reused. Where another of its threads is
+	 * running, the PID is still loaded, so that cpu has to flush it
+	 * too (tlb_flushrevoked), and we wait for it to.
+	 */
+	ntargets = 0;
+	spl = splhigh();
+	spinlock_acquire(&asid_lock);
+	for (c = 0; c < MAXCPUS; c++)
+	{
+		pid = asid_lookup(&asidtables[c], as);
+		if (pid >= 0)
+		{
+			asidtables[c].at_owner[pid] = NULL;
+		}
+		if (tlbrefill_pagetables[c] == (vaddr_t)as->as_pt)
+		{
+			tlbrefill_pagetables[c] = 0;
+			if (c != curcpu->c_number && pid >= 0)
+			{
+				targets[ntargets++] = asidtables[c].at_cpu;
+			}
+		}
+	}
+	spinlock_release(&asid_lock);
+	splx(spl);
+
+	ts.ts_addrspace = as;
+	ts.ts_vaddr = TS_WHOLEAS;
+	ts.ts_done = shootdown_sem;
+	for (t = 0; t < ntargets; t++)
+	{
+		ipi_tlbshootdown(targets[t], &ts);
+	}
+	for (t = 0; t < ntargets; t++)
+	{
+		P(shootdown_sem);
+	}
+
+	lock_release(shootdown_lock);
+}
+#else
 void vm_tlbshootdown_all(void)
 {
 	panic("dumbvm tried to do tlb shootdown?!\n");
@@ -197,16 +556,240 @@ void vm_tlbshootdown(const struct tlbshootdown *ts)
 	(void)ts;
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
+#endif /* OPT_A3 */
+
+#if OPT_A3
+/*
+ * A fault on the time page, which is the same in every address space
+ * and is not in any of them: map it read-only. Writing it is an error.
+ */
+static int vm_timepage_fault(int faulttype)
+{
+	uint32_t ehi, elo, pid;
+	bool replaced;
+	int i, spl;
+
+	if (faulttype != VM_FAULT_READ)
+	{
+		return EFAULT;
+	}
+
+	spl = splhigh();
+	pid = asidtables[curcpu->c_number].at_cur;
+	ehi = TIMEPAGE_VADDR | (pid << TLBHI_PIDSHIFT);
+	elo = timepage_paddr() | TLBLO_VALID;
+	replaced = false;
+	i = tlb_probe(ehi, 0);
+	if (i < 0)
+	{
+		replaced = tlb_pickslot(&i);
+	}
+	tlb_write(ehi, elo, i);
+	tlb_setpid(pid);
+	splx(spl);
+
+	vmstats_inc(VMSTAT_TLB_FAULT);
+	vmstats_inc(replaced ? VMSTAT_TLB_FAULT_REPLACE : VMSTAT_TLB_FAULT_FREE);
+	return 0;
+}
 
+int vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	paddr_t paddr, extra_paddr[VM_EXTRA_MAX];
+	vaddr_t va, cluster, extra_vaddr[VM_EXTRA_MAX];
+	bool writeable, extra_writeable[VM_EXTRA_MAX];
+	bool replaced[VM_EXTRA_MAX + 1];
+	unsigned nextra, nprefill, nmiss, reach, k;
+	int i, result;
+	uint32_t ehi, elo, pid;
+	struct addrspace *as;
+	int spl;
+
+	KTRACE(KT_FAULT, faulttype, faultaddress);
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype)
+	{
+	case VM_FAULT_READONLY:
+		/* A write to a copy-on-write page; as_fault copies it. */
+	case VM_FAULT_READ:
+	case VM_FAULT_WRITE:
+		break;
+	default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL)
+	{
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL)
+	{
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	if (faultaddress == TIMEPAGE_VADDR)
+	{
+		return vm_timepage_fault(faulttype);
+	}
+
+	result = as_fault(as, faulttype, faultaddress, &paddr, &writeable);
+	if (result)
+	{
+		return result;
+	}
+
+	/* make sure it's page-aligned */
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	/*
+	 * as_fault left as_lock held. Bring in the rest of the cluster
+	 * the page belongs to; as_prefault skips pages that are
+	 * resident already, which the refill handler takes care of.
+	 */
+	nextra = 0;
+	if (faulttype != VM_FAULT_READONLY)
+	{
+		cluster = faultaddress & ~(vaddr_t)(VM_CLUSTER * PAGE_SIZE - 1);
+		for (k = 0; k < VM_CLUSTER; k++)
+		{
+			va = cluster + k * PAGE_SIZE;
+			if (va != faultaddress &&
+				as_prefault(as, faultaddress, va,
+							&extra_paddr[nextra],
+							&extra_writeable[nextra]) == 0)
+			{
+				extra_vaddr[nextra++] = va;
+			}
+		}
+	}
+
+	/*
+	 * If this fault is on the page right after the last ones, load
+	 * some more pages ahead, doubling the distance each time the
+	 * pattern holds.
+	 */
+	if (faultaddress == as->as_nextfault && faulttype != VM_FAULT_READONLY)
+	{
+		as->as_prefill = as->as_prefill == 0 ? 1 : as->as_prefill * 2;
+		if (as->as_prefill > VM_PREFILL_MAX)
+		{
+			as->as_prefill = VM_PREFILL_MAX;
+		}
+	}
+	else
+	{
+		as->as_prefill = 0;
+	}
+	/* Start after the cluster; with no clustering that's the next page. */
+	va = (faultaddress | (VM_CLUSTER * PAGE_SIZE - 1)) + 1;
+	for (nprefill = 0; nprefill < as->as_prefill; nprefill++)
+	{
+		if (as_prefault(as, faultaddress, va,
+						&extra_paddr[nextra],
+						&extra_writeable[nextra]))
+		{
+			break;
+		}
+		extra_vaddr[nextra++] = va;
+		va += PAGE_SIZE;
+	}
+	as->as_nextfault = va;
+
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x (+%u)\n", faultaddress, paddr,
+		  nextra);
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	/* tlb_read clobbers EntryHi; tlb_setpid puts the PID back. */
+	pid = asidtables[curcpu->c_number].at_cur;
+
+	for (k = 0; k < nextra; k++)
+	{
+		ehi = extra_vaddr[k] | (pid << TLBHI_PIDSHIFT);
+		elo = extra_paddr[k] | TLBLO_VALID |
+			  (extra_writeable[k] ? TLBLO_DIRTY : 0);
+		/* The page wasn't resident, so this should never hit. */
+		i = tlb_probe(ehi, 0);
+		if (i >= 0)
+		{
+			replaced[k] = false;
+		}
+		else
+		{
+			replaced[k] = tlb_pickslot(&i);
+		}
+		tlb_write(ehi, elo, i);
+	}
+	nmiss = nextra;
+
+	/*
+	 * The faulting page goes in last, so that loading the others
+	 * can't push it out again.
+	 */
+	ehi = faultaddress | (pid << TLBHI_PIDSHIFT);
+	elo = paddr | TLBLO_VALID | (writeable ? TLBLO_DIRTY : 0);
+	i = tlb_probe(ehi, 0);
+	if (i < 0)
+	{
+		replaced[nmiss++] = tlb_pickslot(&i);
+	}
+	/*
+	 * Otherwise it was already mapped, so this was not a TLB miss;
+	 * just update the entry (e.g. after a copy-on-write).
+	 */
+
+	tlb_write(ehi, elo, i);
+
+	/* Sample how much of the address space the TLB covers now. */
+	reach = tlb_countpid(pid);
+	tlb_setpid(pid);
+
+	splx(spl);
+
+	as->as_tlbloads++;
+	as->as_tlbpages += nextra + 1;
+	if (reach > as->as_tlbreach)
+	{
+		as->as_tlbreach = reach;
+	}
+	lock_release(as->as_lock);
+
+	/* Each page loaded ahead counts as the fault it saves. */
+	for (k = 0; k < nmiss; k++)
+	{
+		vmstats_inc(VMSTAT_TLB_FAULT);
+		vmstats_inc(replaced[k] ? VMSTAT_TLB_FAULT_REPLACE
+								: VMSTAT_TLB_FAULT_FREE);
+	}
+	return 0;
+}
+#else
 int vm_fault(int faulttype, vaddr_t faultaddress)
 {
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
+	uint32_t dirty;
 	int i;
 	uint32_t ehi, elo;
 	struct addrspace *as;
 	int spl;
 
+	KTRACE(KT_FAULT, faulttype, faultaddress);
 	faultaddress &= PAGE_FRAME;
 
 	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
@@ -214,12 +797,13 @@ int vm_fault(int faulttype, vaddr_t faultaddress)
 	switch (faulttype)
 	{
 	case VM_FAULT_READONLY:
-#if OPT_A3
-		return EROFS;
-#else
+		/* Only the time page is read-only; no writing it. */
+		if (faultaddress == TIMEPAGE_VADDR)
+		{
+			return EFAULT;
+		}
 		/* We always create pages read-write, so we can't get this */
 		panic("dumbvm: got VM_FAULT_READONLY\n");
-#endif
 	case VM_FAULT_READ:
 	case VM_FAULT_WRITE:
 		break;
@@ -268,16 +852,15 @@ int vm_fault(int faulttype, vaddr_t faultaddress)
 	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
 	stacktop = USERSTACK;
 
-#if OPT_A3
-	bool isText = false;
-#endif
-
-	if (faultaddress >= vbase1 && faultaddress < vtop1)
+	dirty = TLBLO_DIRTY;
+	if (faultaddress == TIMEPAGE_VADDR)
+	{
+		paddr = timepage_paddr();
+		dirty = 0;
+	}
+	else if (faultaddress >= vbase1 && faultaddress < vtop1)
 	{
 		paddr = (faultaddress - vbase1) + as->as_pbase1;
-#if OPT_A3
-		isText = true;
-#endif
 	}
 	else if (faultaddress >= vbase2 && faultaddress < vtop2)
 	{
@@ -306,68 +889,66 @@ int vm_fault(int faulttype, vaddr_t faultaddress)
 			continue;
 		}
 		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-#if OPT_A3
-		if (as->loaded && isText)
-		{
-			elo &= ~TLBLO_DIRTY;
-		}
-#endif
+		elo = paddr | dirty | TLBLO_VALID;
 		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
 		tlb_write(ehi, elo, i);
 		splx(spl);
 		return 0;
 	}
-#if OPT_A3
-	ehi = faultaddress;
-	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-	if (as->loaded && isText)
-	{
-		elo &= ~TLBLO_DIRTY;
-	}
-	tlb_random(ehi, elo);
-	splx(spl);
-	return 0;
-#else
+
 	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
 	splx(spl);
 	return EFAULT;
-#endif
 }
+#endif /* OPT_A3 */
 
-struct addrspace *
-as_create(void)
+#if OPT_A3
+void as_activate(void)
 {
-	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	struct asidtable *at;
+	struct addrspace *as;
+	bool flushed;
+	int pid, spl;
+
+	as = curproc_getas();
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	at = &asidtables[curcpu->c_number];
+
 	if (as == NULL)
 	{
-		return NULL;
+		/* Kernel threads don't have an address spaces to activate */
+		tlbrefill_pagetables[curcpu->c_number] = 0;
+		splx(spl);
+		return;
 	}
 
-	as->as_vbase1 = 0;
-	as->as_pbase1 = 0;
-	as->as_npages1 = 0;
-	as->as_vbase2 = 0;
-	as->as_pbase2 = 0;
-	as->as_npages2 = 0;
-	as->as_stackpbase = 0;
-#if OPT_A3
-	as->loaded = false;
-#endif
+	spinlock_acquire(&asid_lock);
+	at->at_cpu = curcpu->c_self;
+	flushed = false;
+	pid = asid_lookup(at, as);
+	if (pid < 0)
+	{
+		pid = at->at_next;
+		at->at_next = (pid + 1) % TLBHI_NPID;
+		at->at_owner[pid] = as;
+		tlb_flushpid(pid);
+		flushed = true;
+	}
+	at->at_cur = pid;
+	tlb_setpid(pid);
+	tlbrefill_pagetables[curcpu->c_number] = (vaddr_t)as->as_pt;
+	spinlock_release(&asid_lock);
 
-	return as;
-}
+	splx(spl);
 
-void as_destroy(struct addrspace *as)
-{
-	#ifdef OPT_A3
-	free_kpages(PADDR_TO_KVADDR(as->as_pbase1));
-	free_kpages(PADDR_TO_KVADDR(as->as_pbase2));
-	free_kpages(PADDR_TO_KVADDR(as->as_stackpbase));
-	#endif
-	kfree(as);
+	if (flushed)
+	{
+		vmstats_inc(VMSTAT_TLB_INVALIDATE);
+	}
 }
-
+#else
 void as_activate(void)
 {
 	int i, spl;
@@ -392,12 +973,42 @@ void as_activate(void)
 
 	splx(spl);
 }
+#endif /* OPT_A3 */
 
 void as_deactivate(void)
 {
 	/* nothing */
 }
 
+#if !OPT_A3
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	if (as == NULL)
+	{
+		return NULL;
+	}
+
+	as->as_vbase1 = 0;
+	as->as_pbase1 = 0;
+	as->as_npages1 = 0;
+	as->as_vbase2 = 0;
+	as->as_pbase2 = 0;
+	as->as_npages2 = 0;
+	as->as_stackpbase = 0;
+#if OPT_A2
+	as->loaded = false;
+#endif
+
+	return as;
+}
+
+void as_destroy(struct addrspace *as)
+{
+	kfree(as);
+}
+
 int as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 					 int readable, int writeable, int executable)
 {
@@ -535,3 +1146,4 @@ int as_copy(struct addrspace *old, struct addrspace **ret)
 	*ret = new;
 	return 0;
 }
+#endif /* !OPT_A3 */
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <kern/unistd.h>
 #include <lib.h>
 #include <mips/trapframe.h>
@@ -73,6 +74,13 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Written to c0_compare to stop the timer. This is 2^32 cycles, about
+ * 171 seconds, away; for an idle cpu that is as good as never, and if
+ * nothing else has woken it by then it takes one tick and stops again.
+ */
+#define MIPS_TIMER_OFF 0xffffffff
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -233,6 +241,16 @@ mainbus_ramsize(void)
 	return lamebus_ramsize();
 }
 
+/*
+ * Restart the on-chip timer on the current cpu.
+ */
+void
+mainbus_hardclock_start(void)
+{
+	KASSERT(curthread->t_curspl > 0);
+	mips_timer_set(CPU_FREQUENCY / HZ);
+}
+
 /*
  * Send IPI.
  */
@@ -242,6 +260,33 @@ mainbus_send_ipi(struct cpu *target)
 	lamebus_assert_ipi(lamebus, target);
 }
 
+/*
+ * Interrupt statistics.
+ */
+void
+mainbus_printirqstats(void)
+{
+	lamebus_printirqstats(lamebus);
+}
+
+/*
+ * Interrupt routing. Device interrupts are LAMEbus slot numbers.
+ */
+int
+mainbus_route_irq(unsigned irq, uint32_t cpus)
+{
+	if (irq >= LB_NSLOTS) {
+		return EINVAL;
+	}
+	return lamebus_route_interrupt(lamebus, irq, cpus);
+}
+
+void
+mainbus_spread_irqs(void)
+{
+	lamebus_spread_interrupts(lamebus);
+}
+
 /*
  * Interrupt dispatcher.
  */
@@ -268,12 +313,23 @@ mainbus_interrupt(struct trapframe *tf)
 		lamebus_clear_ipi(lamebus, curcpu);
 	}
 	else if (cause & MIPS_TIMER_BIT) {
-		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
-		/* and call hardclock */
+		/* Call hardclock */
 		hardclock();
+		/*
+		 * and reset the timer (this clears the interrupt),
+		 * unless hardclock asked for it to stay off.
+		 */
+		if (curcpu->c_tickless) {
+			mips_timer_set(MIPS_TIMER_OFF);
+		}
+		else {
+			mips_timer_set(CPU_FREQUENCY / HZ);
+		}
 	}
 	else {
 		panic("Unknown interrupt; cause register is %08x\n", cause);
 	}
+
+	/* A wakeup done by the handler, or by another cpu, may want us. */
+	thread_preempt();
 }
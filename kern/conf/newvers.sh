@@ -4,7 +4,10 @@
 #              and emit vers.c.
 #              The build number is kept in the file "version".
 #
-# Usage: newvers.sh CONFIGNAME
+# Usage: newvers.sh CONFIGNAME [FLAVOUR]
+#
+# FLAVOUR is debug, opt, or perf, as the config script found; vers.c
+# records it as buildflavour.
 
 #
 # Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
@@ -44,11 +47,12 @@ if [ ! -f autoconf.c ]; then
 fi
 
 if [ "x$1" = x ]; then
-    echo "Usage: $0 CONFIGNAME"
+    echo "Usage: $0 CONFIGNAME [FLAVOUR]"
     exit 1
 fi
 
 CONFIG="$1"
+FLAVOUR="${2:-unknown}"
 
 #
 # Get and increment the version number
@@ -65,9 +69,10 @@ echo "$VERS" > version
 echo '/* This file is automatically generated. Edits will be lost.*/' > vers.c
 echo "const int buildversion = $VERS;" >> vers.c
 echo 'const char buildconfig[] = "'"$CONFIG"'";' >> vers.c
+echo 'const char buildflavour[] = "'"$FLAVOUR"'";' >> vers.c
 
 #
 # Announce it in the hopes that it'll still be visible when the build
 # finishes.
 #
-echo "*** This is $CONFIG build "'#'"$VERS ***"
+echo "*** This is $CONFIG build "'#'"$VERS ($FLAVOUR) ***"
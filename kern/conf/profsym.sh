@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+# profsym.sh - add up the kernel samples of a profile by function.
+#
+# Usage: profsym.sh KERNEL [LOGFILE]
+#
+# LOGFILE (or the standard input) is console output holding what the
+# menu's "prof dump" printed; KERNEL is the kernel binary that ran.
+# Prints, busiest first, each function's samples and its share of the
+# kernel ones; pcs outside every function are counted under their
+# address. NM names the symbol dumper (default os161-nm).
+#
+
+if [ $# -lt 1 ] || [ $# -gt 2 ]; then
+    echo "Usage: $0 KERNEL [LOGFILE]" 1>&2
+    exit 1
+fi
+
+KERNEL="$1"
+shift
+: ${NM:=os161-nm}
+
+SYMS=`mktemp /tmp/profsym.XXXXXX` || exit 1
+trap 'rm -f "$SYMS"' 0 1 2 15
+
+# Code symbols only, sorted by address.
+"$NM" -n "$KERNEL" | awk '$2 ~ /^[Tt]$/ { print $1, $3 }' > "$SYMS" || exit 1
+
+tr -d '\r' < "${1:-/dev/stdin}" | awk -v syms="$SYMS" '
+    function hex(s,    i, c, v) {
+	v = 0
+	s = tolower(s)
+	sub(/^0x/, "", s)
+	for (i = 1; i <= length(s); i++) {
+	    c = index("0123456789abcdef", substr(s, i, 1))
+	    if (c == 0) {
+		break
+	    }
+	    v = v * 16 + c - 1
+	}
+	return v
+    }
+
+    # Name of the last symbol at or below pc, by binary search.
+    function lookup(pc,    lo, hi, mid) {
+	if (nsyms == 0 || pc < addr[1]) {
+	    return ""
+	}
+	lo = 1
+	hi = nsyms
+	while (lo < hi) {
+	    mid = int((lo + hi + 1) / 2)
+	    if (addr[mid] <= pc) {
+		lo = mid
+	    }
+	    else {
+		hi = mid - 1
+	    }
+	}
+	return name[lo]
+    }
+
+    BEGIN {
+	while ((getline line < syms) > 0) {
+	    split(line, f, " ")
+	    nsyms++
+	    addr[nsyms] = hex(f[1])
+	    name[nsyms] = f[2]
+	}
+    }
+
+    $1 == "prof" && $2 == "k" && NF == 4 {
+	fn = lookup(hex($3))
+	if (fn == "") {
+	    fn = $3
+	}
+	count[fn] += $4
+	total += $4
+    }
+
+    END {
+	if (total == 0) {
+	    print "profsym: no kernel samples found" > "/dev/stderr"
+	    exit 1
+	}
+	for (fn in count) {
+	    printf "%8d %6.2f%% %s\n", count[fn], 100 * count[fn] / total, fn
+	}
+    }
+' | sort -rn
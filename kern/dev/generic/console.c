@@ -48,15 +48,31 @@
  *
  * Note that we have no input buffering; characters typed too rapidly
  * will be lost.
+ *
+ * User reads are raw by default. In cooked mode (see kern/ioctl.h)
+ * con_getline edits a line, echoing as it goes, and reads are served
+ * from the finished line, so a read returns a whole line at once.
+ * kgets, and so the kernel menu, always reads raw.
+ *
+ * Output, on the other hand, goes through a ring of
+ * CONSOLE_OUTPUT_BUFFER_SIZE chars: writers copy into it and return,
+ * and each write-done interrupt sends the next char, so a thread only
+ * waits for the device when the ring is full. A user write goes into
+ * the ring whole (under con_userlock_write), so writes do not come out
+ * mixed up with each other. Polled output (from interrupt handlers,
+ * with interrupts off, and so panics) sends what is in the ring first,
+ * to keep things in order.
  */
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/ioctl.h>
 #include <lib.h>
 #include <uio.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -119,6 +135,23 @@ static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	unsigned tail;
+
+	/*
+	 * If this is a panic or a KASSERT in the middle of con_enqueue
+	 * or con_start, leave the ring alone.
+	 */
+	if (!spinlock_do_i_hold(&cs->cs_outlock)) {
+		spinlock_acquire(&cs->cs_outlock);
+		while (cs->cs_outchars_count > 0) {
+			tail = (cs->cs_outchars_head + CONSOLE_OUTPUT_BUFFER_SIZE
+				- cs->cs_outchars_count)
+				% CONSOLE_OUTPUT_BUFFER_SIZE;
+			cs->cs_outchars_count--;
+			cs->cs_sendpolled(cs->cs_devdata, cs->cs_outchars[tail]);
+		}
+		spinlock_release(&cs->cs_outlock);
+	}
 	cs->cs_sendpolled(cs->cs_devdata, ch);
 }
 
@@ -142,6 +175,88 @@ putch_complete_polled(struct con_softc *cs)
 
 //////////////////////////////////////////////////
 
+/*
+ * Start sending the oldest chars in the ring, as many as the device
+ * will take: one if it is idle, as many as it has room for if it
+ * queues them itself (cs_sendready), or all of them if it takes them
+ * in runs (cs_sendbuf). Call with cs_outlock held.
+ */
+static
+void
+con_kick(struct con_softc *cs)
+{
+	unsigned tail, n;
+
+	KASSERT(spinlock_do_i_hold(&cs->cs_outlock));
+	while (cs->cs_sendbuf != NULL && cs->cs_outchars_count > 0) {
+		tail = (cs->cs_outchars_head + CONSOLE_OUTPUT_BUFFER_SIZE
+			- cs->cs_outchars_count) % CONSOLE_OUTPUT_BUFFER_SIZE;
+		/* up to the end of the ring; the rest next time round */
+		n = CONSOLE_OUTPUT_BUFFER_SIZE - tail;
+		if (n > cs->cs_outchars_count) {
+			n = cs->cs_outchars_count;
+		}
+		cs->cs_outchars_count -= n;
+		cs->cs_sendbuf(cs->cs_devdata,
+			       (const char *)&cs->cs_outchars[tail], n);
+	}
+	while (cs->cs_outchars_count > 0) {
+		if (cs->cs_sendready != NULL ?
+		    !cs->cs_sendready(cs->cs_devdata) : cs->cs_outbusy) {
+			break;
+		}
+		tail = (cs->cs_outchars_head + CONSOLE_OUTPUT_BUFFER_SIZE
+			- cs->cs_outchars_count) % CONSOLE_OUTPUT_BUFFER_SIZE;
+		cs->cs_outchars_count--;
+		cs->cs_outbusy = true;
+		cs->cs_send(cs->cs_devdata, cs->cs_outchars[tail]);
+	}
+}
+
+/*
+ * Put the LEN chars of BUF in the output ring, turning newlines into
+ * CR/LF, and sleeping while it is full. All of them go in under one
+ * hold of cs_outlock except for those sleeps.
+ */
+static
+void
+con_enqueue(struct con_softc *cs, const char *buf, size_t len)
+{
+	size_t i;
+	bool cr;
+
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&cs->cs_outlock);
+	cr = false;
+	for (i=0; i<len; ) {
+		while (cs->cs_outchars_count == CONSOLE_OUTPUT_BUFFER_SIZE) {
+			con_kick(cs);
+			if (cs->cs_outchars_count < CONSOLE_OUTPUT_BUFFER_SIZE) {
+				/* it took some, and may not interrupt */
+				break;
+			}
+			wchan_lock(cs->cs_outwchan);
+			spinlock_release(&cs->cs_outlock);
+			wchan_sleep(cs->cs_outwchan);
+			spinlock_acquire(&cs->cs_outlock);
+		}
+		if (buf[i] == '\n' && !cr) {
+			cs->cs_outchars[cs->cs_outchars_head] = '\r';
+			cr = true;
+		}
+		else {
+			cs->cs_outchars[cs->cs_outchars_head] = buf[i++];
+			cr = false;
+		}
+		cs->cs_outchars_head =
+			(cs->cs_outchars_head + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+		cs->cs_outchars_count++;
+	}
+	con_kick(cs);
+	spinlock_release(&cs->cs_outlock);
+}
+
 /*
  * Print a character, using interrupts to wait for I/O completion.
  */
@@ -149,8 +264,9 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	char c = ch;
+
+	con_enqueue(cs, &c, 1);
 }
 
 /*
@@ -194,17 +310,28 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 		
 	V(cs->cs_rsem);
+	pollq_wake(&cs->cs_inpq);
 }
 
 /*
- * Called from underlying device when a write-done interrupt occurs.
+ * Called from underlying device when a write-done interrupt occurs,
+ * or, for one with its own queue, when that has room again. Send the
+ * next chars, and once the ring has drained to half full let the
+ * writers waiting for room go.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	spinlock_acquire(&cs->cs_outlock);
+	cs->cs_outbusy = false;
+	con_kick(cs);
+	if (cs->cs_outchars_count <= CONSOLE_OUTPUT_BUFFER_SIZE/2) {
+		wchan_wakeall(cs->cs_outwchan);
+		pollq_wake(&cs->cs_outpq);
+	}
+	spinlock_release(&cs->cs_outlock);
 }
 
 //////////////////////////////////////////////////
@@ -298,16 +425,94 @@ con_close(struct device *dev)
 	return 0;
 }
 
+/*
+ * Erase N chars of the line being edited, on the screen too. We
+ * overwrite them with spaces in case backspace is nondestructive.
+ */
+static
+void
+con_erase(struct con_softc *cs, unsigned n)
+{
+	KASSERT(n <= cs->cs_line_len);
+	while (n-- > 0) {
+		con_enqueue(cs, "\b \b", 3);
+		cs->cs_line_len--;
+	}
+}
+
+/*
+ * Read and edit a line for cooked mode, into cs_line. It ends with a
+ * newline, which is kept, or with ^D, which is not, so an empty line
+ * is end of file. Printable chars past the end of the buffer are
+ * dropped, with a beep.
+ */
+static
+void
+con_getline(struct con_softc *cs)
+{
+	int ch;
+	char c;
+
+	cs->cs_line_len = 0;
+	cs->cs_line_pos = 0;
+	while (1) {
+		ch = getch_intr(cs);
+		if (ch=='\r' || ch=='\n') {
+			cs->cs_line[cs->cs_line_len++] = '\n';
+			con_enqueue(cs, "\n", 1);
+			break;
+		}
+		else if (ch==4) {
+			/* ^D */
+			break;
+		}
+		else if (ch>=32 && ch<127 &&
+			 cs->cs_line_len < CONSOLE_LINE_SIZE - 1) {
+			c = ch;
+			cs->cs_line[cs->cs_line_len++] = c;
+			con_enqueue(cs, &c, 1);
+		}
+		else if ((ch=='\b' || ch==127) && cs->cs_line_len > 0) {
+			con_erase(cs, 1);
+		}
+		else if (ch==21) {
+			/* ^U - kill line */
+			con_erase(cs, cs->cs_line_len);
+		}
+		else if (ch==23) {
+			/* ^W - erase word */
+			while (cs->cs_line_len > 0 &&
+			       cs->cs_line[cs->cs_line_len-1]==' ') {
+				con_erase(cs, 1);
+			}
+			while (cs->cs_line_len > 0 &&
+			       cs->cs_line[cs->cs_line_len-1]!=' ') {
+				con_erase(cs, 1);
+			}
+		}
+		else {
+			beep();
+		}
+	}
+}
+
+/*
+ * Writes are copied in CON_CHUNK chars at a time, outside cs_outlock,
+ * since uiomove may fault.
+ */
+#define CON_CHUNK 128
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
 	int result;
 	char ch;
+	char buf[CON_CHUNK];
+	size_t len;
+	struct con_softc *cs;
 	struct lock *lk;
 
-	(void)dev;  // unused
-
 	if (uio->uio_rw==UIO_READ) {
 		lk = con_userlock_read;
 	}
@@ -318,6 +523,32 @@ con_io(struct device *dev, struct uio *uio)
 	KASSERT(lk != NULL);
 	lock_acquire(lk);
 
+	if (uio->uio_rw==UIO_READ) {
+		cs = dev->d_data;
+		if (cs->cs_line_pos == cs->cs_line_len && cs->cs_cooked) {
+			con_getline(cs);
+		}
+		if (cs->cs_line_pos < cs->cs_line_len) {
+			/* serve the line, possibly left from before */
+			len = cs->cs_line_len - cs->cs_line_pos;
+			if (len > uio->uio_resid) {
+				len = uio->uio_resid;
+			}
+			result = uiomove(cs->cs_line + cs->cs_line_pos, len,
+					 uio);
+			if (result == 0) {
+				cs->cs_line_pos += len;
+			}
+			lock_release(lk);
+			return result;
+		}
+		if (cs->cs_cooked) {
+			/* ^D on an empty line */
+			lock_release(lk);
+			return 0;
+		}
+	}
+
 	while (uio->uio_resid > 0) {
 		if (uio->uio_rw==UIO_READ) {
 			ch = getch();
@@ -334,30 +565,68 @@ con_io(struct device *dev, struct uio *uio)
 			}
 		}
 		else {
-			result = uiomove(&ch, 1, uio);
+			len = uio->uio_resid < CON_CHUNK
+				? uio->uio_resid : CON_CHUNK;
+			result = uiomove(buf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
+			con_enqueue(dev->d_data, buf, len);
 		}
 	}
 	lock_release(lk);
 	return 0;
 }
 
+/*
+ * Input is ready if anything has been typed, or a cooked line is not
+ * all read yet. In cooked mode a read may still wait for the rest of
+ * the line; the editing happens in the reader.
+ */
+static
+int
+con_poll(struct device *dev, int events, struct poller *poller)
+{
+	struct con_softc *cs = dev->d_data;
+	int ready = 0;
+
+	if (poller != NULL && (events & POLLIN)) {
+		poller_register(poller, &cs->cs_inpq);
+	}
+	if (poller != NULL && (events & POLLOUT)) {
+		poller_register(poller, &cs->cs_outpq);
+	}
+
+	if (cs->cs_gotchars_head != cs->cs_gotchars_tail ||
+	    cs->cs_line_pos < cs->cs_line_len) {
+		ready |= POLLIN;
+	}
+	if (cs->cs_outchars_count < CONSOLE_OUTPUT_BUFFER_SIZE) {
+		ready |= POLLOUT;
+	}
+	return ready & events;
+}
+
+/*
+ * Switching modes takes the read lock so as not to change it under a
+ * read. A line already finished is still read out in raw mode.
+ */
 static
 int
 con_ioctl(struct device *dev, int op, userptr_t data)
 {
-	/* No ioctls. */
-	(void)dev;
-	(void)op;
+	struct con_softc *cs = dev->d_data;
+
 	(void)data;
-	return EINVAL;
+
+	if (op != IOCTL_CONRAW && op != IOCTL_CONCOOKED) {
+		return EIOCTL;
+	}
+	lock_acquire(con_userlock_read);
+	cs->cs_cooked = (op == IOCTL_CONCOOKED);
+	lock_release(con_userlock_read);
+	return 0;
 }
 
 static
@@ -376,6 +645,8 @@ attach_console_to_vfs(struct con_softc *cs)
 	dev->d_close = con_close;
 	dev->d_io = con_io;
 	dev->d_ioctl = con_ioctl;
+	dev->d_poll = con_poll;
+	dev->d_strategy = NULL;
 	dev->d_blocks = 0;
 	dev->d_blocksize = 1;
 	dev->d_data = cs;
@@ -398,7 +669,8 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct semaphore *rsem;
+	struct wchan *wc;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -418,29 +690,38 @@ config_con(struct con_softc *cs, int unit)
 	if (rsem == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
+	wc = wchan_create("console write");
+	if (wc == NULL) {
 		sem_destroy(rsem);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(wc);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
 		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(wc);
 		return ENOMEM;
 	}
 
 	cs->cs_rsem = rsem; 
-	cs->cs_wsem = wsem; 
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	cs->cs_cooked = false;
+	cs->cs_line_len = 0;
+	cs->cs_line_pos = 0;
+	spinlock_init(&cs->cs_outlock);
+	cs->cs_outwchan = wc;
+	cs->cs_outchars_head = 0;
+	cs->cs_outchars_count = 0;
+	cs->cs_outbusy = false;
+	pollq_init(&cs->cs_inpq);
+	pollq_init(&cs->cs_outpq);
 
 	the_console = cs;
 	con_userlock_read = rlk;
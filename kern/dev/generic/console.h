@@ -35,24 +35,58 @@
  *
  * devdata, send, and sendpolled are provided by the underlying
  * device, and are to be initialized by the attach routine.
+ *
+ * sendready, if not NULL, says whether the device can take another
+ * char now, for a device with its own transmit queue: send is then
+ * called for as long as it says yes, not once per write-done. With
+ * NULL, one char is sent per write-done.
+ *
+ * sendbuf, if not NULL, is for a device that is always ready and has
+ * no write-done, like a memory-mapped screen: it is handed everything
+ * in the ring at once (in two runs if the ring wraps), in place of
+ * send. sendpolled is still used for polled output.
  */
 
+#include <spinlock.h>
+#include <poll.h>
+
 #define CONSOLE_INPUT_BUFFER_SIZE 32
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024
+#define CONSOLE_LINE_SIZE 256
 
 struct con_softc {
 	/* initialized by attach routine */
 	void *cs_devdata;
 	void (*cs_send)(void *devdata, int ch);
+	void (*cs_sendbuf)(void *devdata, const char *buf, size_t len);
 	void (*cs_sendpolled)(void *devdata, int ch);
+	bool (*cs_sendready)(void *devdata);
 	void (*cs_startpolling)(void *devdata);
 	void (*cs_endpolling)(void *devdata);
 
 	/* initialized by config routine */
 	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+
+	/* cooked mode line; under the console's user read lock */
+	bool cs_cooked;
+	char cs_line[CONSOLE_LINE_SIZE];
+	unsigned cs_line_len;		/* chars in the finished line */
+	unsigned cs_line_pos;		/* next char of it to read */
+
+	/* output ring, drained by write-done interrupts; under cs_outlock */
+	struct spinlock cs_outlock;
+	struct wchan *cs_outwchan;	/* writers waiting for room */
+	unsigned char cs_outchars[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_outchars_head;	/* next slot to put a char in */
+	unsigned cs_outchars_count;	/* chars in the ring */
+	bool cs_outbusy;		/* a char is on its way out */
+
+	/* pollers waiting for input, and for room in the output ring */
+	struct pollq cs_inpq;
+	struct pollq cs_outpq;
 };
 
 /*
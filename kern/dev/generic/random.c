@@ -32,6 +32,7 @@
 #include <kern/fcntl.h>
 #include <lib.h>
 #include <uio.h>
+#include <spinlock.h>
 #include <vfs.h>
 #include <generic/random.h>
 #include "autoconf.h"
@@ -45,10 +46,146 @@
  * The kernel config mechanism can be used to explicitly choose which
  * of the available random sources to use, if more than one is
  * available.
+ *
+ * The source is not read for each number. It seeds a ChaCha20
+ * keystream generator, which is what random() and reads of random:
+ * are served from, RANDOM_BLOCKWORDS words at a time, so that reading
+ * a lot of randomness costs no device access per word. Each block
+ * generated also gives the key for the next ("fast key erasure"), so
+ * what was handed out cannot be worked out again from the state; and
+ * every RANDOM_RESEED blocks fresh words from the source are mixed
+ * into the key.
  */
 
+#define RANDOM_KEYWORDS		8
+#define RANDOM_BLOCKWORDS	16
+#define RANDOM_RESEED		4096	/* blocks; 128K handed out */
+
 static struct random_softc *the_random = NULL;
 
+/* The generator's state; under random_lock */
+static struct spinlock random_lock = SPINLOCK_INITIALIZER;
+static uint32_t random_key[RANDOM_KEYWORDS];
+static uint64_t random_counter;
+static uint32_t random_out[RANDOM_BLOCKWORDS - RANDOM_KEYWORDS];
+static unsigned random_outpos;		/* next word of random_out */
+static unsigned random_blocks;		/* since the last reseed */
+
+#define ROTL32(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define CHACHA_QR(a, b, c, d) do {			\
+	a += b; d ^= a; d = ROTL32(d, 16);		\
+	c += d; b ^= c; b = ROTL32(b, 12);		\
+	a += b; d ^= a; d = ROTL32(d, 8);		\
+	c += d; b ^= c; b = ROTL32(b, 7);		\
+} while (0)
+
+/*
+ * The ChaCha20 block function: OUT is block COUNTER of the keystream
+ * for KEY, with a zero nonce.
+ */
+static
+void
+chacha20_block(const uint32_t *key, uint64_t counter, uint32_t *out)
+{
+	uint32_t in[RANDOM_BLOCKWORDS];
+	unsigned i;
+
+	in[0] = 0x61707865;	/* "expand 32-byte k" */
+	in[1] = 0x3320646e;
+	in[2] = 0x79622d32;
+	in[3] = 0x6b206574;
+	for (i=0; i<RANDOM_KEYWORDS; i++) {
+		in[4 + i] = key[i];
+	}
+	in[12] = (uint32_t)counter;
+	in[13] = (uint32_t)(counter >> 32);
+	in[14] = 0;
+	in[15] = 0;
+
+	for (i=0; i<RANDOM_BLOCKWORDS; i++) {
+		out[i] = in[i];
+	}
+	for (i=0; i<10; i++) {
+		CHACHA_QR(out[0], out[4], out[8], out[12]);
+		CHACHA_QR(out[1], out[5], out[9], out[13]);
+		CHACHA_QR(out[2], out[6], out[10], out[14]);
+		CHACHA_QR(out[3], out[7], out[11], out[15]);
+		CHACHA_QR(out[0], out[5], out[10], out[15]);
+		CHACHA_QR(out[1], out[6], out[11], out[12]);
+		CHACHA_QR(out[2], out[7], out[8], out[13]);
+		CHACHA_QR(out[3], out[4], out[9], out[14]);
+	}
+	for (i=0; i<RANDOM_BLOCKWORDS; i++) {
+		out[i] += in[i];
+	}
+}
+
+/*
+ * Mix words from the source into the key. random_lock held.
+ */
+static
+void
+random_reseed(void)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&random_lock));
+
+	for (i=0; i<RANDOM_KEYWORDS; i++) {
+		random_key[i] ^= the_random->rs_random(the_random->rs_devdata);
+	}
+	random_blocks = 0;
+}
+
+/*
+ * Generate the next block: the first half is the next key, the second
+ * half what is handed out. random_lock held.
+ */
+static
+void
+random_refill(void)
+{
+	uint32_t block[RANDOM_BLOCKWORDS];
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&random_lock));
+
+	if (random_blocks >= RANDOM_RESEED) {
+		random_reseed();
+	}
+	chacha20_block(random_key, random_counter++, block);
+	random_blocks++;
+
+	for (i=0; i<RANDOM_KEYWORDS; i++) {
+		random_key[i] = block[i];
+	}
+	for (i=0; i<RANDOM_BLOCKWORDS - RANDOM_KEYWORDS; i++) {
+		random_out[i] = block[RANDOM_KEYWORDS + i];
+		block[RANDOM_KEYWORDS + i] = 0;
+	}
+	random_outpos = 0;
+}
+
+/*
+ * Fill BUF with NWORDS words from the generator. random_lock held.
+ */
+static
+void
+random_words(uint32_t *buf, unsigned nwords)
+{
+	unsigned i;
+
+	for (i=0; i<nwords; i++) {
+		if (random_outpos == RANDOM_BLOCKWORDS - RANDOM_KEYWORDS) {
+			random_refill();
+		}
+		buf[i] = random_out[random_outpos];
+		/* once handed out, not kept */
+		random_out[random_outpos++] = 0;
+	}
+}
+
 /*
  * VFS device functions.
  * open: allow reading only.
@@ -78,19 +215,36 @@ randclose(struct device *dev)
 }
 
 /*
- * VFS I/O function. Hand off to implementation.
+ * VFS I/O function. A few words at a time are taken from the
+ * generator under the lock, and copied out without it.
  */
 static
 int
 randio(struct device *dev, struct uio *uio)
 {
-	struct random_softc *rs = dev->d_data;
+	uint32_t buf[RANDOM_BLOCKWORDS];
+	size_t len;
+	int result;
+
+	(void)dev;
 
 	if (uio->uio_rw != UIO_READ) {
 		return EIO;
 	}
 
-	return rs->rs_read(rs->rs_devdata, uio);
+	result = 0;
+	while (result == 0 && uio->uio_resid > 0) {
+		len = uio->uio_resid < sizeof(buf) ? uio->uio_resid
+			: sizeof(buf);
+		spinlock_acquire(&random_lock);
+		random_words(buf, (len + sizeof(uint32_t) - 1)
+			     / sizeof(uint32_t));
+		spinlock_release(&random_lock);
+		result = uiomove(buf, len, uio);
+	}
+	bzero(buf, sizeof(buf));
+
+	return result;
 }
 
 /*
@@ -125,10 +279,19 @@ config_random(struct random_softc *rs, int unit)
 	KASSERT(the_random==NULL);
 	the_random = rs;
 
+	/* Seed the generator. */
+	spinlock_acquire(&random_lock);
+	random_reseed();
+	random_counter = 0;
+	random_outpos = RANDOM_BLOCKWORDS - RANDOM_KEYWORDS;
+	spinlock_release(&random_lock);
+
 	rs->rs_dev.d_open = randopen;
 	rs->rs_dev.d_close = randclose;
 	rs->rs_dev.d_io = randio;
 	rs->rs_dev.d_ioctl = randioctl;
+	rs->rs_dev.d_poll = NULL;
+	rs->rs_dev.d_strategy = NULL;
 	rs->rs_dev.d_blocks = 0;
 	rs->rs_dev.d_blocksize = 1;
 	rs->rs_dev.d_data = rs;
@@ -150,10 +313,15 @@ config_random(struct random_softc *rs, int unit)
 uint32_t
 random(void)
 {
+	uint32_t val;
+
 	if (the_random==NULL) {
 		panic("No random device\n");
 	}
-	return the_random->rs_random(the_random->rs_devdata);
+	spinlock_acquire(&random_lock);
+	random_words(&val, 1);
+	spinlock_release(&random_lock);
+	return val;
 }
 
 uint32_t
@@ -162,5 +330,5 @@ randmax(void)
 	if (the_random==NULL) {
 		panic("No random device\n");
 	}
-	return the_random->rs_randmax(the_random->rs_devdata);
+	return 0xffffffff;
 }
@@ -31,14 +31,16 @@
 #define _GENERIC_RANDOM_H_
 
 #include <device.h>
-struct uio;
 
+/*
+ * The source gives 32 random bits per call to rs_random. It is used
+ * only to seed (and now and then reseed) a generator in random.c,
+ * which produces what the rest of the kernel and random: get.
+ */
 struct random_softc {
 	/* Initialized by lower-level attach routine */
 	void *rs_devdata;
 	uint32_t (*rs_random)(void *devdata);
-	uint32_t (*rs_randmax)(void *devdata);
-	int (*rs_read)(void *devdata, struct uio *uio);
 
 	struct device rs_dev;
 };
@@ -48,7 +48,9 @@ attach_con_to_lscreen(int consno, struct lscreen_softc *ls)
 
 	cs->cs_devdata = ls;
 	cs->cs_send = lscreen_write;
+	cs->cs_sendbuf = lscreen_writebuf;
 	cs->cs_sendpolled = lscreen_write;
+	cs->cs_sendready = NULL;
 	cs->cs_startpolling = NULL;
 	cs->cs_endpolling = NULL;
 
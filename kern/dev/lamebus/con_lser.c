@@ -50,7 +50,9 @@ attach_con_to_lser(int consno, struct lser_softc *ls)
 
 	cs->cs_devdata = ls;
 	cs->cs_send = lser_write;
+	cs->cs_sendbuf = NULL;
 	cs->cs_sendpolled = lser_writepolled;
+	cs->cs_sendready = lser_canwrite;
 	cs->cs_startpolling = lser_startpolling;
 	cs->cs_endpolling = lser_endpolling;
 
@@ -45,13 +45,13 @@
 #include <kern/fcntl.h>
 #include <stat.h>
 #include <lib.h>
-#include <array.h>
 #include <uio.h>
 #include <synch.h>
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <emufs.h>
+#include <pagecache.h>
 #include "autoconf.h"
 
 /* Register offsets */
@@ -160,14 +160,40 @@ translate_err(struct emu_softc *sc, uint32_t code)
 }
 
 /*
- * Wait for an operation to complete, and return an errno for the result.
+ * Start operation OP, its other registers set up already, wait for it
+ * to complete, and return an errno for the result. It is counted in
+ * the device's iostat: a write as LEN bytes, a read as what the device
+ * says it read, and anything else as neither. e_lock held.
  */
 static
 int
-emu_waitdone(struct emu_softc *sc)
+emu_run(struct emu_softc *sc, uint32_t op, uint32_t len)
 {
+	uint64_t start;
+	int result, kind;
+
+	start = iostat_start(&sc->e_iostat);
+	emu_wreg(sc, REG_OPER, op);
 	P(sc->e_sem);
-	return translate_err(sc, sc->e_result);
+	result = translate_err(sc, sc->e_result);
+
+	switch (op) {
+	    case EMU_OP_READ:
+	    case EMU_OP_READDIR:
+		kind = IOSTAT_READ;
+		len = result ? 0 : emu_rreg(sc, REG_IOLEN);
+		break;
+	    case EMU_OP_WRITE:
+		kind = IOSTAT_WRITE;
+		len = result ? 0 : len;
+		break;
+	    default:
+		kind = IOSTAT_OTHER;
+		len = 0;
+		break;
+	}
+	iostat_done(&sc->e_iostat, start, kind, len, result);
+	return result;
 }
 
 /*
@@ -207,8 +233,7 @@ emu_open(struct emu_softc *sc, uint32_t handle, const char *name,
 	strcpy(sc->e_iobuf, name);
 	emu_wreg(sc, REG_IOLEN, strlen(name));
 	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_OPER, op);
-	result = emu_waitdone(sc);
+	result = emu_run(sc, op, 0);
 
 	if (result==0) {
 		*newhandle = emu_rreg(sc, REG_HANDLE);
@@ -241,8 +266,7 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 		/* Retry operation up to 10 times */
 
 		emu_wreg(sc, REG_HANDLE, handle);
-		emu_wreg(sc, REG_OPER, EMU_OP_CLOSE);
-		result = emu_waitdone(sc);
+		result = emu_run(sc, EMU_OP_CLOSE, 0);
 
 		if (result==EIO && retries < 10) {
 			kprintf("emu%d: I/O error on close, retrying\n", 
@@ -260,7 +284,25 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 }
 
 /*
- * Common code for read and readdir.
+ * Do a read or readdir of up to LEN bytes at OFFSET, leaving the data
+ * in e_iobuf, and the length read in REG_IOLEN. e_lock held.
+ */
+static
+int
+emu_rawread(struct emu_softc *sc, uint32_t handle, uint32_t len,
+	    uint32_t op, off_t offset)
+{
+	KASSERT(lock_do_i_hold(sc->e_lock));
+
+	emu_wreg(sc, REG_HANDLE, handle);
+	emu_wreg(sc, REG_IOLEN, len);
+	emu_wreg(sc, REG_OFFSET, offset);
+	return emu_run(sc, op, 0);
+}
+
+/*
+ * Common code for read and readdir. The caller holds e_lock, so that
+ * the chunks of a large transfer go to the device back to back.
  */
 static
 int
@@ -271,23 +313,15 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 
 	KASSERT(uio->uio_rw == UIO_READ);
 
-	lock_acquire(sc->e_lock);
-
-	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
-	emu_wreg(sc, REG_OPER, op);
-	result = emu_waitdone(sc);
+	result = emu_rawread(sc, handle, len, op, uio->uio_offset);
 	if (result) {
-		goto out;
+		return result;
 	}
 	
 	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
 
 	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
 
- out:
-	lock_release(sc->e_lock);
 	return result;
 }
 
@@ -314,7 +348,8 @@ emu_readdir(struct emu_softc *sc, uint32_t handle, uint32_t len,
 }
 
 /*
- * Write to a hardware-level file handle.
+ * Write to a hardware-level file handle. The caller holds e_lock, as
+ * for emu_doread.
  */
 static
 int
@@ -324,8 +359,7 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_WRITE);
-
-	lock_acquire(sc->e_lock);
+	KASSERT(lock_do_i_hold(sc->e_lock));
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
@@ -333,57 +367,282 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 
 	result = uiomove(sc->e_iobuf, len, uio);
 	if (result) {
-		goto out;
+		return result;
 	}
 
-	emu_wreg(sc, REG_OPER, EMU_OP_WRITE);
-	result = emu_waitdone(sc);
-
- out:
-	lock_release(sc->e_lock);
-	return result;
+	return emu_run(sc, EMU_OP_WRITE, len);
 }
 
 /*
  * Get the file size associated with a hardware-level file handle.
+ * Like emu_close, may be called with e_lock held or not.
  */
 static
 int
 emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 {
 	int result;
+	bool mine;
 
-	lock_acquire(sc->e_lock);
+	mine = lock_do_i_hold(sc->e_lock);
+	if (!mine) {
+		lock_acquire(sc->e_lock);
+	}
 
 	emu_wreg(sc, REG_HANDLE, handle);
-	emu_wreg(sc, REG_OPER, EMU_OP_GETSIZE);
-	result = emu_waitdone(sc);
+	result = emu_run(sc, EMU_OP_GETSIZE, 0);
 	if (result==0) {
 		*retval = emu_rreg(sc, REG_IOLEN);
 	}
 
-	lock_release(sc->e_lock);
+	if (!mine) {
+		lock_release(sc->e_lock);
+	}
 	return result;
 }
 
 /*
- * Truncate a hardware-level file handle.
+ * Truncate a hardware-level file handle. e_lock held.
  */
 static
 int
 emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 {
-	int result;
-
-	lock_acquire(sc->e_lock);
+	KASSERT(lock_do_i_hold(sc->e_lock));
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OPER, EMU_OP_TRUNC);
-	result = emu_waitdone(sc);
+	return emu_run(sc, EMU_OP_TRUNC, 0);
+}
 
-	lock_release(sc->e_lock);
-	return result;
+//
+////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+//
+// Page cache (see emufs.h); everything here needs e_lock
+//
+
+static
+void
+emufs_lru_remove(struct emufs_fs *ef, struct emufs_page *ep)
+{
+	if (ep->ep_lruprev != NULL) {
+		ep->ep_lruprev->ep_lrunext = ep->ep_lrunext;
+	}
+	else {
+		ef->ef_lru = ep->ep_lrunext;
+	}
+	if (ep->ep_lrunext != NULL) {
+		ep->ep_lrunext->ep_lruprev = ep->ep_lruprev;
+	}
+	else {
+		ef->ef_lrutail = ep->ep_lruprev;
+	}
+	ep->ep_lrunext = ep->ep_lruprev = NULL;
+}
+
+static
+void
+emufs_lru_addhead(struct emufs_fs *ef, struct emufs_page *ep)
+{
+	ep->ep_lruprev = NULL;
+	ep->ep_lrunext = ef->ef_lru;
+	if (ef->ef_lru != NULL) {
+		ef->ef_lru->ep_lruprev = ep;
+	}
+	else {
+		ef->ef_lrutail = ep;
+	}
+	ef->ef_lru = ep;
+}
+
+static
+void
+emufs_lru_addtail(struct emufs_fs *ef, struct emufs_page *ep)
+{
+	ep->ep_lrunext = NULL;
+	ep->ep_lruprev = ef->ef_lrutail;
+	if (ef->ef_lrutail != NULL) {
+		ef->ef_lrutail->ep_lrunext = ep;
+	}
+	else {
+		ef->ef_lru = ep;
+	}
+	ef->ef_lrutail = ep;
+}
+
+static
+unsigned
+emufs_pagehashfn(uint32_t handle, uint32_t pageno)
+{
+	return (handle * 31 + pageno) & (EMUFS_PAGEHASH - 1);
+}
+
+static
+struct emufs_page *
+emufs_findpage(struct emufs_fs *ef, uint32_t handle, uint32_t pageno)
+{
+	struct emufs_page *ep;
+
+	KASSERT(lock_do_i_hold(ef->ef_emu->e_lock));
+
+	ep = ef->ef_pagehash[emufs_pagehashfn(handle, pageno)];
+	for (; ep != NULL; ep = ep->ep_hashnext) {
+		if (ep->ep_handle == handle && ep->ep_pageno == pageno) {
+			return ep;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take EP out of the cache, leaving it to be reused first.
+ */
+static
+void
+emufs_unusepage(struct emufs_fs *ef, struct emufs_page *ep)
+{
+	struct emufs_page **epp;
+
+	KASSERT(ep->ep_used);
+
+	epp = &ef->ef_pagehash[emufs_pagehashfn(ep->ep_handle,
+						ep->ep_pageno)];
+	while (*epp != ep) {
+		KASSERT(*epp != NULL);
+		epp = &(*epp)->ep_hashnext;
+	}
+	*epp = ep->ep_hashnext;
+	ep->ep_hashnext = NULL;
+	ep->ep_used = false;
+
+	emufs_lru_remove(ef, ep);
+	emufs_lru_addtail(ef, ep);
+}
+
+/*
+ * Get a page to fill: a new one while there are fewer than
+ * EMUFS_MAXPAGES, and otherwise the least recently used. NULL only if
+ * there are none and there is no memory for one.
+ */
+static
+struct emufs_page *
+emufs_getpage(struct emufs_fs *ef)
+{
+	struct emufs_page *ep = NULL;
+
+	if (ef->ef_npages < EMUFS_MAXPAGES) {
+		ep = kmalloc(sizeof(*ep));
+		if (ep != NULL) {
+			ep->ep_data = kmalloc(EMUFS_PAGESIZE);
+			if (ep->ep_data == NULL) {
+				kfree(ep);
+				ep = NULL;
+			}
+		}
+		if (ep != NULL) {
+			ep->ep_used = false;
+			ep->ep_hashnext = NULL;
+			emufs_lru_addtail(ef, ep);
+			ef->ef_npages++;
+		}
+	}
+	if (ep == NULL) {
+		ep = ef->ef_lrutail;
+		if (ep == NULL) {
+			return NULL;
+		}
+	}
+	if (ep->ep_used) {
+		emufs_unusepage(ef, ep);
+	}
+	return ep;
+}
+
+/*
+ * Forget all pages of HANDLE.
+ */
+static
+void
+emufs_dropcache(struct emufs_fs *ef, uint32_t handle)
+{
+	struct emufs_page *ep, *next;
+
+	KASSERT(lock_do_i_hold(ef->ef_emu->e_lock));
+
+	/* (pages dropped go to the tail, and are passed over again there) */
+	for (ep = ef->ef_lru; ep != NULL; ep = next) {
+		next = ep->ep_lrunext;
+		if (ep->ep_used && ep->ep_handle == handle) {
+			emufs_unusepage(ef, ep);
+		}
+	}
+}
+
+/*
+ * Find page PAGENO of EV in the cache, reading it in if it is not
+ * there, along with as many of the pages after it as one read from the
+ * device brings. NULL, with *ERR 0, if the cache has no page to spare.
+ */
+static
+struct emufs_page *
+emufs_cachedpage(struct emufs_fs *ef, struct emufs_vnode *ev, uint32_t pageno,
+		 int *err)
+{
+	struct emu_softc *sc = ef->ef_emu;
+	struct emufs_page *ep;
+	uint32_t got, len, k;
+	unsigned h;
+
+	*err = 0;
+
+	ep = emufs_findpage(ef, ev->ev_handle, pageno);
+	if (ep != NULL) {
+		emufs_lru_remove(ef, ep);
+		emufs_lru_addhead(ef, ep);
+		return ep;
+	}
+
+	*err = emu_rawread(sc, ev->ev_handle, EMU_MAXIO, EMU_OP_READ,
+			   (off_t)pageno * EMUFS_PAGESIZE);
+	if (*err) {
+		return NULL;
+	}
+	got = emu_rreg(sc, REG_IOLEN);
+
+	for (k=0; k < EMU_MAXIO / EMUFS_PAGESIZE; k++) {
+		if (k > 0 && k * EMUFS_PAGESIZE >= got) {
+			break;
+		}
+		if (emufs_findpage(ef, ev->ev_handle, pageno + k) != NULL) {
+			continue;
+		}
+		ep = emufs_getpage(ef);
+		if (ep == NULL) {
+			break;
+		}
+
+		len = got > k * EMUFS_PAGESIZE ? got - k * EMUFS_PAGESIZE : 0;
+		if (len > EMUFS_PAGESIZE) {
+			len = EMUFS_PAGESIZE;
+		}
+		memcpy(ep->ep_data, (char *)sc->e_iobuf + k * EMUFS_PAGESIZE,
+		       len);
+		ep->ep_used = true;
+		ep->ep_handle = ev->ev_handle;
+		ep->ep_pageno = pageno + k;
+		ep->ep_len = len;
+
+		h = emufs_pagehashfn(ep->ep_handle, ep->ep_pageno);
+		ep->ep_hashnext = ef->ef_pagehash[h];
+		ef->ef_pagehash[h] = ep;
+		emufs_lru_remove(ef, ep);
+		emufs_lru_addhead(ef, ep);
+	}
+
+	/* (one of the later pages may have reused it, if the cache is tiny) */
+	return emufs_findpage(ef, ev->ev_handle, pageno);
 }
 
 //
@@ -468,52 +727,54 @@ emufs_reclaim(struct vnode *v)
 {
 	struct emufs_vnode *ev = v->vn_data;
 	struct emufs_fs *ef = v->vn_fs->fs_data;
-	unsigned ix, i, num;
+	struct emufs_vnode **evp;
 	int result;
 
 	/*
-	 * Need both of these locks, e_lock to protect the device
-	 * and vfs_biglock to protect the fs-related material.
+	 * ef_vnlock protects the vnode table; emu_close takes e_lock
+	 * for the device itself.
 	 */
 
-	vfs_biglock_acquire();
-	lock_acquire(ef->ef_emu->e_lock);
+	lock_acquire(ef->ef_vnlock);
 
-	if (ev->ev_v.vn_refcount != 1) {
-		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
+	/*
+	 * Someone may have picked it up again since VOP_DECREF decided
+	 * to reclaim it; if so, drop the reference we were handed.
+	 * emufs_loadvnode takes the same lock, so nobody else can now.
+	 */
+	if (!vnode_lastref(&ev->ev_v)) {
+		lock_release(ef->ef_vnlock);
 		return EBUSY;
 	}
 
-	/* emu_close retries on I/O error */
+	/*
+	 * emu_close retries on I/O error. Once the handle is closed the
+	 * host may give out the same number for another file, so its
+	 * pages go too.
+	 */
+	lock_acquire(ef->ef_emu->e_lock);
 	result = emu_close(ev->ev_emu, ev->ev_handle);
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
+		lock_release(ef->ef_vnlock);
 		return result;
 	}
+	emufs_dropcache(ef, ev->ev_handle);
+	lock_release(ef->ef_emu->e_lock);
 
-	num = vnodearray_num(ef->ef_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *vx;
-
-		vx = vnodearray_get(ef->ef_vnodes, i);
-		if (vx == v) {
-			ix = i;
-			break;
-		}
+	evp = &ef->ef_vnhash[ev->ev_handle % EMUFS_VNHASH];
+	while (*evp != NULL && *evp != ev) {
+		evp = &(*evp)->ev_hashnext;
 	}
-	if (ix == num) {
+	if (*evp == NULL) {
 		panic("emu%d: reclaim vnode %u not in vnode pool\n",
 		      ef->ef_emu->e_unit, ev->ev_handle);
 	}
 
-	vnodearray_remove(ef->ef_vnodes, ix);
+	*evp = ev->ev_hashnext;
 	VOP_CLEANUP(&ev->ev_v);
 
-	lock_release(ef->ef_emu->e_lock);
-	vfs_biglock_release();
+	lock_release(ef->ef_vnlock);
 
 	kfree(ev);
 	return 0;
@@ -527,32 +788,75 @@ int
 emufs_read(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	uint32_t amt;
+	struct emufs_fs *ef = v->vn_fs->fs_data;
+	struct emufs_page *ep;
+	uint32_t amt, pageoff;
 	size_t oldresid;
+	off_t size;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	while (uio->uio_resid > 0) {
-		amt = uio->uio_resid;
-		if (amt > EMU_MAXIO) {
-			amt = EMU_MAXIO;
-		}
+	/*
+	 * Hold the device for the whole read, so its chunks follow one
+	 * another without other operations going in between.
+	 */
+	lock_acquire(ev->ev_emu->e_lock);
 
-		oldresid = uio->uio_resid;
+	/*
+	 * The cached pages are good as long as the file is the size it
+	 * was when they were read; that costs one operation, not one
+	 * per EMU_MAXIO bytes.
+	 */
+	result = emu_getsize(ev->ev_emu, ev->ev_handle, &size);
+	if (result) {
+		goto out;
+	}
+	if (size != ev->ev_cachesize) {
+		emufs_dropcache(ef, ev->ev_handle);
+		ev->ev_cachesize = size;
+	}
 
-		result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
+	while (uio->uio_resid > 0 && uio->uio_offset < size) {
+		ep = emufs_cachedpage(ef, ev, uio->uio_offset / EMUFS_PAGESIZE,
+				      &result);
 		if (result) {
-			return result;
+			break;
 		}
-		
-		if (uio->uio_resid == oldresid) {
-			/* nothing read - EOF */
+
+		if (ep == NULL) {
+			/* no memory to cache it in; read it directly */
+			amt = uio->uio_resid;
+			if (amt > EMU_MAXIO) {
+				amt = EMU_MAXIO;
+			}
+			oldresid = uio->uio_resid;
+			result = emu_read(ev->ev_emu, ev->ev_handle, amt, uio);
+			if (result || oldresid - uio->uio_resid < amt) {
+				/* error, or the host file ended */
+				break;
+			}
+			continue;
+		}
+
+		pageoff = uio->uio_offset % EMUFS_PAGESIZE;
+		if (pageoff >= ep->ep_len) {
+			/* the file ended in this page */
+			break;
+		}
+		amt = ep->ep_len - pageoff;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+		result = uiomove(ep->ep_data + pageoff, amt, uio);
+		if (result) {
 			break;
 		}
 	}
 
-	return 0;
+ out:
+	lock_release(ev->ev_emu->e_lock);
+	return result;
 }
 
 /*
@@ -564,6 +868,7 @@ emufs_getdirentry(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
+	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
@@ -572,7 +877,10 @@ emufs_getdirentry(struct vnode *v, struct uio *uio)
 		amt = EMU_MAXIO;
 	}
 
-	return emu_readdir(ev->ev_emu, ev->ev_handle, amt, uio);
+	lock_acquire(ev->ev_emu->e_lock);
+	result = emu_readdir(ev->ev_emu, ev->ev_handle, amt, uio);
+	lock_release(ev->ev_emu->e_lock);
+	return result;
 }
 
 /*
@@ -585,10 +893,19 @@ emufs_write(struct vnode *v, struct uio *uio)
 	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
 	size_t oldresid;
+	off_t start;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
+	/* as in emufs_read */
+	lock_acquire(ev->ev_emu->e_lock);
+	start = uio->uio_offset;
+
+	emufs_dropcache(v->vn_fs->fs_data, ev->ev_handle);
+	ev->ev_cachesize = -1;
+
+	result = 0;
 	while (uio->uio_resid > 0) {
 		amt = uio->uio_resid;
 		if (amt > EMU_MAXIO) {
@@ -599,7 +916,7 @@ emufs_write(struct vnode *v, struct uio *uio)
 
 		result = emu_write(ev->ev_emu, ev->ev_handle, amt, uio);
 		if (result) {
-			return result;
+			break;
 		}
 
 		if (uio->uio_resid == oldresid) {
@@ -608,7 +925,9 @@ emufs_write(struct vnode *v, struct uio *uio)
 		}
 	}
 
-	return 0;
+	lock_release(ev->ev_emu->e_lock);
+	pagecache_invalidate(v, start, uio->uio_offset);
+	return result;
 }
 
 /*
@@ -703,9 +1022,10 @@ emufs_tryseek(struct vnode *v, off_t pos)
  */
 static
 int
-emufs_fsync(struct vnode *v)
+emufs_fsync(struct vnode *v, bool datasync)
 {
 	(void)v;
+	(void)datasync;
 	return 0;
 }
 
@@ -717,7 +1037,15 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
-	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	int result;
+
+	lock_acquire(ev->ev_emu->e_lock);
+	result = emu_trunc(ev->ev_emu, ev->ev_handle, len);
+	emufs_dropcache(v->vn_fs->fs_data, ev->ev_handle);
+	ev->ev_cachesize = -1;
+	lock_release(ev->ev_emu->e_lock);
+	pagecache_purge(v);
+	return result;
 }
 
 /*
@@ -836,14 +1164,16 @@ emufs_namefile(struct vnode *v, struct uio *uio)
 }
 
 /*
- * VOP_MMAP
+ * VOP_MMAP: files are paged with VOP_READ and VOP_WRITE, which is
+ * all mapping one takes.
  */
 static
 int
-emufs_mmap(struct vnode *v)
+emufs_mmap(struct vnode *v, bool writeable)
 {
 	(void)v;
-	return EUNIMP;
+	(void)writeable;
+	return 0;
 }
 
 //////////////////////////////
@@ -938,9 +1268,10 @@ emufs_rename(struct vnode *v1, const char *n1,
 
 static
 int
-emufs_void_op_isdir(struct vnode *v)
+emufs_bool_op_isdir(struct vnode *v, bool b)
 {
 	(void)v;
+	(void)b;
 	return EISDIR;
 }
 
@@ -1068,6 +1399,15 @@ emufs_truncate_isdir(struct vnode *v, off_t len)
 	return ENOTDIR;
 }
 
+static
+int
+emufs_mmap_isdir(struct vnode *v, bool writeable)
+{
+	(void)v;
+	(void)writeable;
+	return EISDIR;
+}
+
 //////////////////////////////
 
 /*
@@ -1085,6 +1425,7 @@ static const struct vnode_ops emufs_fileops = {
 	emufs_uio_op_notdir, /* getdirentry */
 	emufs_write,
 	emufs_ioctl,
+	vnode_pollready,
 	emufs_stat,
 	emufs_file_gettype,
 	emufs_tryseek,
@@ -1120,11 +1461,12 @@ static const struct vnode_ops emufs_dirops = {
 	emufs_getdirentry,
 	emufs_uio_op_isdir,   /* write */
 	emufs_ioctl,
+	vnode_pollready,
 	emufs_stat,
 	emufs_dir_gettype,
 	emufs_dir_tryseek,
-	emufs_void_op_isdir,  /* fsync */
-	emufs_void_op_isdir,  /* mmap */
+	emufs_bool_op_isdir,  /* fsync */
+	emufs_mmap_isdir,
 	emufs_truncate_isdir,
 	emufs_namefile,
 
@@ -1142,31 +1484,29 @@ static const struct vnode_ops emufs_dirops = {
 
 /*
  * Function to load a vnode into memory.
+ *
+ * The table is hashed by handle and has its own lock, so looking a
+ * vnode up neither scans every loaded vnode nor holds up the device
+ * or the rest of the VFS while doing it.
  */
 static
 int
 emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 		struct emufs_vnode **ret)
 {
-	struct vnode *v;
 	struct emufs_vnode *ev;
-	unsigned i, num;
+	unsigned h = handle % EMUFS_VNHASH;
 	int result;
 
-	vfs_biglock_acquire();
-	lock_acquire(ef->ef_emu->e_lock);
+	lock_acquire(ef->ef_vnlock);
 
-	num = vnodearray_num(ef->ef_vnodes);
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(ef->ef_vnodes, i);
-		ev = v->vn_data;
+	for (ev = ef->ef_vnhash[h]; ev != NULL; ev = ev->ev_hashnext) {
 		if (ev->ev_handle == handle) {
 			/* Found */
 
 			VOP_INCREF(&ev->ev_v);
 
-			lock_release(ef->ef_emu->e_lock);
-			vfs_biglock_release();
+			lock_release(ef->ef_vnlock);
 			*ret = ev;
 			return 0;
 		}
@@ -1176,34 +1516,26 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev = kmalloc(sizeof(struct emufs_vnode));
 	if (ev==NULL) {
-		lock_release(ef->ef_emu->e_lock);
+		lock_release(ef->ef_vnlock);
 		return ENOMEM;
 	}
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+	ev->ev_cachesize = -1;
 
 	result = VOP_INIT(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			   &ef->ef_fs, ev);
 	if (result) {
-		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
+		lock_release(ef->ef_vnlock);
 		kfree(ev);
 		return result;
 	}
 
-	result = vnodearray_add(ef->ef_vnodes, &ev->ev_v, NULL);
-	if (result) {
-		/* note: VOP_CLEANUP undoes VOP_INIT - it does not kfree */
-		VOP_CLEANUP(&ev->ev_v);
-		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
-		kfree(ev);
-		return result;
-	}
+	ev->ev_hashnext = ef->ef_vnhash[h];
+	ef->ef_vnhash[h] = ev;
 
-	lock_release(ef->ef_emu->e_lock);
-	vfs_biglock_release();
+	lock_release(ef->ef_vnlock);
 
 	*ret = ev;
 	return 0;
@@ -1284,6 +1616,7 @@ int
 emufs_addtovfs(struct emu_softc *sc, const char *devname)
 {
 	struct emufs_fs *ef;
+	unsigned i;
 	int result;
 
 	ef = kmalloc(sizeof(struct emufs_fs));
@@ -1299,14 +1632,23 @@ emufs_addtovfs(struct emu_softc *sc, const char *devname)
 
 	ef->ef_emu = sc;
 	ef->ef_root = NULL;
-	ef->ef_vnodes = vnodearray_create();
-	if (ef->ef_vnodes == NULL) {
+	ef->ef_vnlock = lock_create("emufs-vnodes");
+	if (ef->ef_vnlock == NULL) {
 		kfree(ef);
 		return ENOMEM;
 	}
+	for (i=0; i<EMUFS_VNHASH; i++) {
+		ef->ef_vnhash[i] = NULL;
+	}
+	for (i=0; i<EMUFS_PAGEHASH; i++) {
+		ef->ef_pagehash[i] = NULL;
+	}
+	ef->ef_lru = ef->ef_lrutail = NULL;
+	ef->ef_npages = 0;
 
 	result = emufs_loadvnode(ef, EMU_ROOTHANDLE, 1, &ef->ef_root);
 	if (result) {
+		lock_destroy(ef->ef_vnlock);
 		kfree(ef);
 		return result;
 	}
@@ -1347,6 +1689,7 @@ config_emu(struct emu_softc *sc, int emuno)
 	sc->e_iobuf = bus_map_area(sc->e_busdata, sc->e_buspos, EMU_BUFFER);
 
 	snprintf(name, sizeof(name), "emu%d", emuno);
+	iostat_register(&sc->e_iostat, name);
 
 	return emufs_addtovfs(sc, name);
 }
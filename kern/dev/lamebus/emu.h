@@ -30,6 +30,7 @@
 #ifndef _LAMEBUS_EMU_H_
 #define _LAMEBUS_EMU_H_
 
+#include <iostat.h>
 
 #define EMU_MAXIO       16384
 #define EMU_ROOTHANDLE  0
@@ -50,6 +51,7 @@ struct emu_softc {
 	struct lock *e_lock;
 	struct semaphore *e_sem;
 	void *e_iobuf;
+	struct iostat e_iostat;
 
 	/* Written by the interrupt handler */
 	uint32_t e_result;
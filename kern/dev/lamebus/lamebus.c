@@ -32,10 +32,12 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <cpu.h>
 #include <spinlock.h>
 #include <current.h>
+#include <atomic.h>
 #include <lamebus/lamebus.h>
 
 /* Register offsets within each config region */
@@ -154,9 +156,9 @@ lamebus_find_cpus(struct lamebus_softc *lamebus)
 	}
 
 	/*
-	 * By default, route all interrupts only to the boot cpu. We
-	 * could be arbitrarily more elaborate, up to things like
-	 * dynamic load balancing.
+	 * By default, route all interrupts only to the boot cpu (as
+	 * ls_irqroute, from lamebus_init, says). lamebus_route_interrupt
+	 * and lamebus_spread_interrupts can send them elsewhere.
 	 */
 
 	for (i=0; i<numcpus; i++) {
@@ -170,6 +172,70 @@ lamebus_find_cpus(struct lamebus_softc *lamebus)
 	}
 }
 
+/*
+ * Set each cpu's interrupt enable register from ls_irqroute. Called
+ * holding ls_lock.
+ */
+static
+void
+lamebus_setroutes(struct lamebus_softc *lamebus)
+{
+	unsigned i;
+	int slot;
+	uint32_t val;
+
+	for (i=0; i<cpu_count(); i++) {
+		val = 0;
+		for (slot=0; slot<LB_NSLOTS; slot++) {
+			if (lamebus->ls_irqroute[slot] & ((uint32_t)1 << i)) {
+				val |= (uint32_t)1 << slot;
+			}
+		}
+		write_ctlcpu_register(lamebus, cpu_get(i)->c_hardware_number,
+				      CTLCPU_CIRQE, val);
+	}
+}
+
+int
+lamebus_route_interrupt(struct lamebus_softc *lamebus, int slot,
+			uint32_t cpus)
+{
+	uint32_t allcpus;
+
+	if (slot < 0 || slot >= LB_NSLOTS) {
+		return EINVAL;
+	}
+	allcpus = cpu_count() >= 32 ? 0xffffffff :
+		((uint32_t)1 << cpu_count()) - 1;
+	if (cpus == 0 || (cpus & ~allcpus) != 0) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&lamebus->ls_lock);
+	lamebus->ls_irqroute[slot] = cpus;
+	lamebus_setroutes(lamebus);
+	spinlock_release(&lamebus->ls_lock);
+	return 0;
+}
+
+void
+lamebus_spread_interrupts(struct lamebus_softc *lamebus)
+{
+	unsigned next = 0;
+	int slot;
+
+	spinlock_acquire(&lamebus->ls_lock);
+	for (slot=0; slot<LB_NSLOTS; slot++) {
+		if ((lamebus->ls_irqready & ((uint32_t)1 << slot)) == 0) {
+			continue;
+		}
+		lamebus->ls_irqroute[slot] = (uint32_t)1 << next;
+		next = (next + 1) % cpu_count();
+	}
+	lamebus_setroutes(lamebus);
+	spinlock_release(&lamebus->ls_lock);
+}
+
 /*
  * Start up secondary CPUs.
  *
@@ -341,6 +407,8 @@ lamebus_attach_interrupt(struct lamebus_softc *sc, int slot,
 
 	sc->ls_devdata[slot] = devdata;
 	sc->ls_irqfuncs[slot] = irqfunc;
+	membar_sync();
+	sc->ls_irqready |= mask;
 	
 	spinlock_release(&sc->ls_lock);
 }
@@ -364,6 +432,8 @@ lamebus_detach_interrupt(struct lamebus_softc *sc, int slot)
 
 	KASSERT(sc->ls_irqfuncs[slot]!=NULL);
 
+	sc->ls_irqready &= ~mask;
+	membar_sync();
 	sc->ls_devdata[slot] = NULL;
 	sc->ls_irqfuncs[slot] = NULL;
 	
@@ -409,19 +479,25 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 	/*
 	 * Note that despite the fact that "spl" stands for "set
 	 * priority level", we don't actually support interrupt
-	 * priorities. When an interrupt happens, we look through the
-	 * slots to find the first interrupting device and call its
-	 * interrupt routine, no matter what that device is.
+	 * priorities. When an interrupt happens, we call the handler
+	 * of every interrupting slot in turn, lowest first, no matter
+	 * what the devices are.
 	 *
 	 * Note that the entire LAMEbus uses only one on-cpu interrupt line. 
 	 * Thus, we do not use any on-cpu interrupt priority system either.
+	 *
+	 * The handlers are looked up without ls_lock (see lamebus.h),
+	 * so interrupts on different devices are taken on different
+	 * cpus without meeting here, and the pending slots are found
+	 * with a find-first-set on the mask rather than a slot by slot
+	 * scan. ls_lock is only for the dud count.
 	 */
 
 	int slot;
-	uint32_t mask;
-	uint32_t irqs;
-	void (*handler)(void *);
-	void *data;
+	uint32_t irqs, duds_mask;
+	uint32_t start, cycles;
+	unsigned bucket;
+	struct lamebus_irqstat *li;
 
 	/* For keeping track of how many bogus things happen in a row. */
 	static int duds = 0;
@@ -430,9 +506,6 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 	/* and we better have a valid bus instance. */
 	KASSERT(lamebus != NULL);
 
-	/* Lock the softc */
-	spinlock_acquire(&lamebus->ls_lock);
-
 	/*
 	 * Read the LAMEbus controller register that tells us which
 	 * slots are asserting an interrupt condition.
@@ -441,80 +514,55 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 
 	if (irqs == 0) {
 		/*
-		 * Huh? None of them? Must be a glitch.
+		 * Huh? None of them? Must be a glitch. Count it, and
+		 * go on to the code after the loop that checks how
+		 * many duds we've seen. This is important, because we
+		 * just might get a stray interrupt that latches itself
+		 * on. If that happens, we're pretty much toast, but
+		 * it's better to panic and hopefully reset the system
+		 * than to loop forever printing "stray interrupt".
 		 */
 		kprintf("lamebus: stray interrupt on cpu %u\n",
 			curcpu->c_number);
-		duds++;
 		duds_this_time++;
-
-		/*
-		 * We could just return now, but instead we'll
-		 * continue ahead. Because irqs == 0, nothing in the
-		 * loop will execute, and passing through it gets us
-		 * to the code that checks how many duds we've
-		 * seen. This is important, because we just might get
-		 * a stray interrupt that latches itself on. If that
-		 * happens, we're pretty much toast, but it's better
-		 * to panic and hopefully reset the system than to
-		 * loop forever printing "stray interrupt".
-		 */
 	}
 
 	/*
-	 * Go through the bits in the value we got back to see which
-	 * ones are set.
+	 * Slots signalling an interrupt with no driver or no handler
+	 * are duds.
 	 */
+	duds_mask = irqs & ~lamebus->ls_irqready;
+	while (duds_mask != 0) {
+		duds_mask &= duds_mask - 1;
+		duds_this_time++;
+	}
+	irqs &= lamebus->ls_irqready;
 
-	for (mask=1, slot=0; slot<LB_NSLOTS; mask<<=1, slot++) {
-		if ((irqs & mask) == 0) {
-			/* Nope. */
-			continue;
-		}
+	while (irqs != 0) {
+		slot = __builtin_ctz(irqs);
 
-		/*
-		 * This slot is signalling an interrupt.
-		 */
-			
-		if ((lamebus->ls_slotsinuse & mask)==0) {
-			/*
-			 * No device driver is using this slot.
-			 */
-			duds++;
-			duds_this_time++;
-			continue;
-		}
+		start = cpu_cycles();
+		lamebus->ls_irqfuncs[slot](lamebus->ls_devdata[slot]);
+		cycles = cpu_cycles() - start;
 
-		if (lamebus->ls_irqfuncs[slot]==NULL) {
-			/*
-			 * The device driver hasn't installed an interrupt
-			 * handler.
-			 */
-			duds++;
-			duds_this_time++;
-			continue;
+		li = &lamebus->ls_irqstats[slot];
+		atomic_inc(&li->li_count);
+		cycles >>= LB_IRQHIST_SHIFT;
+		for (bucket = 0; cycles != 0 && bucket < LB_IRQHIST - 1;
+		     bucket++) {
+			cycles >>= 1;
 		}
+		atomic_inc(&li->li_hist[bucket]);
 
 		/*
-		 * Call the interrupt handler. Release the spinlock
-		 * while we do so, in case other CPUs are handling
-		 * interrupts on other devices.
+		 * Reload the mask of pending IRQs, for the slots after
+		 * this one - if we just called hardclock, we might not
+		 * have come back to this context for some time, and it
+		 * might have changed.
 		 */
-		handler = lamebus->ls_irqfuncs[slot];
-		data = lamebus->ls_devdata[slot];
-		spinlock_release(&lamebus->ls_lock);
-
-		handler(data);
-
-		spinlock_acquire(&lamebus->ls_lock);
-
-		/*
-		 * Reload the mask of pending IRQs - if we just called
-		 * hardclock, we might not have come back to this
-		 * context for some time, and it might have changed.
-		 */
-
-		irqs = read_ctl_register(lamebus, CTLREG_IRQS);
+		irqs = read_ctl_register(lamebus, CTLREG_IRQS) &
+			lamebus->ls_irqready &
+			~((((uint32_t)2) << slot) - 1);
 	}
 
 
@@ -534,8 +582,18 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 	 * some stupid device we don't have a driver for, or it might
 	 * have been an electrical transient. In any case, warn and
 	 * clear the dud count.
+	 *
+	 * (duds is only read without the lock to see if there is
+	 * anything to do.)
 	 */
 
+	if (duds_this_time == 0 && duds == 0) {
+		return;
+	}
+
+	spinlock_acquire(&lamebus->ls_lock);
+	duds += duds_this_time;
+
 	if (duds_this_time == 0 && duds > 0) {
 		kprintf("lamebus: %d dud interrupts\n", duds);
 		duds = 0;
@@ -545,10 +603,55 @@ lamebus_interrupt(struct lamebus_softc *lamebus)
 		panic("lamebus: too many (%d) dud interrupts\n", duds);
 	}
 
-	/* Unlock the softc */
 	spinlock_release(&lamebus->ls_lock);
 }
 
+/*
+ * Names for the devices we know, for lamebus_printirqstats.
+ */
+static const char *const lamebus_devnames[] = {
+	NULL, "busctl", "timer", "disk", "serial", "screen", "net",
+	"emufs", "trace", "random",
+};
+
+void
+lamebus_printirqstats(struct lamebus_softc *lamebus)
+{
+	struct lamebus_irqstat *li;
+	uint32_t vid, did;
+	const char *name;
+	int slot;
+	unsigned i;
+
+	kprintf("slot device     cpus       interrupts  handler cycles: "
+		"<%u, then doubling\n", 1U << LB_IRQHIST_SHIFT);
+	for (slot=0; slot<LB_NSLOTS; slot++) {
+		li = &lamebus->ls_irqstats[slot];
+		if (li->li_count == 0) {
+			continue;
+		}
+		vid = read_cfg_register(lamebus, slot, CFGREG_VID);
+		did = read_cfg_register(lamebus, slot, CFGREG_DID);
+		name = NULL;
+		if (vid == LB_VENDOR_CS161 && did < sizeof(lamebus_devnames) /
+		    sizeof(lamebus_devnames[0])) {
+			name = lamebus_devnames[did];
+		}
+		if (name != NULL) {
+			kprintf("%4d %-10s", slot, name);
+		}
+		else {
+			kprintf("%4d %4u/%-5u", slot, vid, did);
+		}
+		kprintf(" 0x%08x %10u ", lamebus->ls_irqroute[slot],
+			li->li_count);
+		for (i=0; i<LB_IRQHIST; i++) {
+			kprintf(" %u", li->li_hist[i]);
+		}
+		kprintf("\n");
+	}
+}
+
 /*
  * Have the bus controller power the system off.
  */
@@ -621,11 +724,14 @@ lamebus_init(void)
 	 * Initialize the LAMEbus data structure.
 	 */
 	lamebus->ls_slotsinuse = 1 << LB_CONTROLLER_SLOT;
+	lamebus->ls_irqready = 0;
 
 	for (i=0; i<LB_NSLOTS; i++) {
 		lamebus->ls_devdata[i] = NULL;
 		lamebus->ls_irqfuncs[i] = NULL;
+		lamebus->ls_irqroute[i] = 1;	/* the boot cpu */
 	}
+	bzero(lamebus->ls_irqstats, sizeof(lamebus->ls_irqstats));
 
 	return lamebus;
 }
@@ -78,13 +78,39 @@ typedef void (*lb_irqfunc)(void *devdata);
 /*
  * Driver data
  */
+/*
+ * Interrupt statistics for one slot: how many interrupts its handler
+ * took, and how long each took, in LB_IRQHIST buckets of cycles: the
+ * first under 1 << LB_IRQHIST_SHIFT, each after twice as wide, the
+ * last for anything longer. Counted with atomic_inc, as more than one
+ * cpu can take the same slot's interrupts.
+ */
+#define LB_IRQHIST		12
+#define LB_IRQHIST_SHIFT	8
+
+struct lamebus_irqstat {
+	volatile unsigned li_count;
+	volatile unsigned li_hist[LB_IRQHIST];
+};
+
 struct lamebus_softc {
 	struct spinlock ls_lock;
 
-	/* Accessed from interrupts; synchronized with ls_lock */ 
+	/*
+	 * Written under ls_lock. The handler table (ls_devdata,
+	 * ls_irqfuncs, and ls_irqready, the slots that have a handler)
+	 * is read by lamebus_interrupt without it: a slot's bit is set
+	 * only once its handler is in, and cleared before it goes.
+	 */
 	uint32_t     ls_slotsinuse;
+	uint32_t     ls_irqready;
 	void        *ls_devdata[LB_NSLOTS];
 	lb_irqfunc   ls_irqfuncs[LB_NSLOTS];
+
+	/* The cpus (bit N for cpu N) each slot interrupts; ls_lock */
+	uint32_t     ls_irqroute[LB_NSLOTS];
+
+	struct lamebus_irqstat ls_irqstats[LB_NSLOTS];
 };
 
 /*
@@ -143,6 +169,22 @@ void lamebus_unmask_interrupt(struct lamebus_softc *, int slot);
  */
 void lamebus_interrupt(struct lamebus_softc *);
 
+/*
+ * Send a slot's interrupts to the cpus in CPUS (bit N for cpu N,
+ * which must exist), through each cpu's interrupt enable register in
+ * the bus controller; or send those of the slots with handlers to one
+ * cpu each, in turn. A slot interrupting more than one cpu is taken by
+ * whichever gets there first.
+ */
+int lamebus_route_interrupt(struct lamebus_softc *, int slot, uint32_t cpus);
+void lamebus_spread_interrupts(struct lamebus_softc *);
+
+/*
+ * Print the interrupt statistics (and routes) of each slot that has
+ * had any interrupts.
+ */
+void lamebus_printirqstats(struct lamebus_softc *);
+
 /*
  * Have the LAMEbus controller power the system off.
  */
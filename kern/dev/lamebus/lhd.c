@@ -35,10 +35,13 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
-#include <synch.h>
+#include <spinlock.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <bio.h>
 #include <lamebus/lhd.h>
+#include <ktrace.h>
+#include <kstat.h>
 #include "autoconf.h"
 
 /* Registers (offsets within slot) */
@@ -56,9 +59,19 @@
 #define LHD_ISWRITE     2   /* OR with above: I/O is a write */
 #define LHD_STATEMASK   0x1d  /* mask for masking out LHD_ISWRITE */
 
+/* Sectors moved, over all disks */
+static struct kstat lhd_reads = KSTAT_INITIALIZER("lhd.sectors_read");
+static struct kstat lhd_writes = KSTAT_INITIALIZER("lhd.sectors_written");
+
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/* Bios lhd_io keeps in progress at once for a uio of several iovecs. */
+#define LHD_MAXBIOS     16
+
+/* Sectors lhd_io moves to or from user space per request: a page. */
+#define LHD_BOUNCE      8
+
 /*
  * Shortcut for reading a register.
  */
@@ -95,28 +108,91 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the next sector of the request in progress; if there is none,
+ * let the scheduler choose one from the queue, if there is one. The
+ * device has one sector's buffer and does a sector at a time. lh_lock
+ * held.
  */
 static
 void
-lhd_iodone(struct lhd_softc *lh, int err)
+lhd_start(struct lhd_softc *lh)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct bio *bio;
+	uint32_t statval = LHD_WORKING;
+	char *data;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	if (lh->lh_cur == NULL) {
+		lh->lh_cur = bioq_next(&lh->lh_queue);
+		lh->lh_curdone = 0;
+	}
+	bio = lh->lh_cur;
+	if (bio == NULL) {
+		return;
+	}
+	data = (char *)bio->bio_data + lh->lh_curdone * LHD_SECTSIZE;
+	if (bio->bio_rw == UIO_WRITE) {
+		memcpy(lh->lh_buf, data, LHD_SECTSIZE);
+		statval |= LHD_ISWRITE;
+	}
+	lhd_wreg(lh, LHD_REG_SECT, bio->bio_block + lh->lh_curdone);
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * A sector of the request in progress has finished with ERR. Take its
+ * data, if it was a read; when the request is over, hand it back in
+ * *DONE. Start the next sector either way, so the
+ * disk does not wait for the requester to wake up. lh_lock held.
+ */
+static
+void
+lhd_iodone(struct lhd_softc *lh, int err, struct bio **done)
+{
+	struct bio *bio = lh->lh_cur;
+	char *data;
+
+	KASSERT(spinlock_do_i_hold(&lh->lh_lock));
+
+	*done = NULL;
+	if (bio == NULL) {
+		/* nothing asked for; a stray completion */
+		return;
+	}
+	if (err == 0 && bio->bio_rw == UIO_READ) {
+		data = (char *)bio->bio_data + lh->lh_curdone * LHD_SECTSIZE;
+		memcpy(data, lh->lh_buf, LHD_SECTSIZE);
+	}
+	if (err == 0) {
+		kstat_inc(bio->bio_rw == UIO_READ ? &lhd_reads : &lhd_writes);
+	}
+	lh->lh_curdone++;
+	if (err || lh->lh_curdone == bio->bio_nblocks) {
+		lh->lh_cur = NULL;
+		bio->bio_error = err;
+		iostat_done(&lh->lh_iostat, bio->bio_issued,
+			    bio->bio_rw == UIO_READ ? IOSTAT_READ : IOSTAT_WRITE,
+			    (lh->lh_curdone - (err != 0)) * LHD_SECTSIZE, err);
+		*done = bio;
+	}
+	lhd_start(lh);
 }
 
 /*
  * Interrupt handler for lhd.
  * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ * register, finish the sector, and start the next one. A request that
+ * is over is reported once the queue is let go of.
  */
 void
 lhd_irq(void *vlh)
 {
 	struct lhd_softc *lh = vlh;
+	struct bio *done = NULL;
 	uint32_t val;
-	
+
+	spinlock_acquire(&lh->lh_lock);
 	val = lhd_rdreg(lh, LHD_REG_STAT);
 
 	switch (val & LHD_STATEMASK) {
@@ -127,9 +203,38 @@ lhd_irq(void *vlh)
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		KTRACE(KT_DISKIO, lhd_rdreg(lh, LHD_REG_SECT),
+		       lh->lh_unit << 16 | (val & LHD_STATEMASK));
+		lhd_iodone(lh, lhd_code_to_errno(lh, val), &done);
 		break;
 	}
+	spinlock_release(&lh->lh_lock);
+
+	if (done != NULL) {
+		bio_finish(done, done->bio_error);
+	}
+}
+
+/*
+ * Queue a request (d_strategy). It is started at once if the disk is
+ * idle, and otherwise from lhd_irq when the scheduler gets to it.
+ * bio_submit has checked it is on the disk. It is timed from here to
+ * when lhd_iodone hands it back.
+ */
+static
+int
+lhd_strategy(struct device *d, struct bio *bio)
+{
+	struct lhd_softc *lh = d->d_data;
+
+	spinlock_acquire(&lh->lh_lock);
+	bio->bio_issued = iostat_start(&lh->lh_iostat);
+	bioq_add(&lh->lh_queue, bio);
+	if (lh->lh_cur == NULL) {
+		lhd_start(lh);
+	}
+	spinlock_release(&lh->lh_lock);
+	return 0;
 }
 
 /*
@@ -194,20 +299,82 @@ lhd_reset(struct lhd_softc *lh)
 #endif
 
 /*
- * I/O function (for both reads and writes)
+ * Do the kernel-space UIO, every iovec of which is a whole number of
+ * sectors, from SECTOR on, with a bio per iovec, up to LHD_MAXBIOS of
+ * them in progress at once. They are for adjacent blocks, so the queue
+ * takes them back to back, as if they were one request.
+ */
+static
+int
+lhd_iovio(struct device *d, struct uio *uio, uint32_t sector)
+{
+	struct bio bios[LHD_MAXBIOS];
+	struct iovec *iov;
+	unsigned i, n;
+	int result, err;
+
+	result = 0;
+	while (uio->uio_resid > 0 && uio->uio_iovcnt > 0 && result == 0) {
+		for (n = 0; n < LHD_MAXBIOS && n < uio->uio_iovcnt; n++) {
+			iov = &uio->uio_iov[n];
+			bio_init(&bios[n], uio->uio_rw, sector,
+				 iov->iov_len / LHD_SECTSIZE, iov->iov_kbase);
+			sector += iov->iov_len / LHD_SECTSIZE;
+			if (iov->iov_len == 0) {
+				/* Nothing to do; it is done already. */
+				bios[n].bio_error = 0;
+				continue;
+			}
+			err = bio_start(d, &bios[n]);
+			if (err) {
+				bios[n].bio_nblocks = 0;
+				bios[n].bio_error = err;
+			}
+		}
+		for (i = 0; i < n; i++) {
+			iov = &uio->uio_iov[i];
+			err = iov->iov_len == 0 || bios[i].bio_nblocks == 0 ?
+				bios[i].bio_error : bio_await(&bios[i]);
+			if (err && result == 0) {
+				result = err;
+			}
+		}
+		/* Account for the iovecs in order, up to any failure. */
+		for (i = 0; i < n && bios[i].bio_error == 0; i++) {
+			iov = uio->uio_iov;
+			uio->uio_offset += iov->iov_len;
+			uio->uio_resid -= iov->iov_len;
+			iov->iov_kbase = (char *)iov->iov_kbase + iov->iov_len;
+			iov->iov_len = 0;
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+		}
+	}
+	return result;
+}
+
+/*
+ * I/O function (for both reads and writes), as a bio, waited for. A
+ * transfer to or from one kernel buffer, as the buffer cache does, is
+ * done in place in one request; one of several whole-sector kernel
+ * buffers by lhd_iovio; and anything else a few sectors at a time
+ * through a buffer here.
  */
 static
 int
 lhd_io(struct device *d, struct uio *uio)
 {
 	struct lhd_softc *lh = d->d_data;
+	struct iovec *iov = uio->uio_iov;
+	struct bio bio;
+	char buf[LHD_SECTSIZE];
+	char *bounce;
 
 	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	uint32_t i;
-	uint32_t statval = LHD_WORKING;
+	uint32_t i, n, chunk;
 	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
@@ -219,60 +386,69 @@ lhd_io(struct device *d, struct uio *uio)
 	if (sector+len > lh->lh_dev.d_blocks) {
 		return EINVAL;
 	}
-
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1 &&
+	    iov->iov_len == uio->uio_resid) {
+		bio_init(&bio, uio->uio_rw, sector, len, iov->iov_kbase);
+		result = bio_wait(d, &bio);
+		if (result == 0) {
+			iov->iov_kbase = (char *)iov->iov_kbase + uio->uio_resid;
+			iov->iov_len = 0;
+			uio->uio_offset += uio->uio_resid;
+			uio->uio_resid = 0;
+		}
+		return result;
+	}
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		for (i=0; i<uio->uio_iovcnt; i++) {
+			if (iov[i].iov_len % LHD_SECTSIZE != 0) {
+				break;
+			}
+		}
+		if (i == uio->uio_iovcnt) {
+			/* For instance a cluster of pages (see swap.c). */
+			return lhd_iovio(d, uio, sector);
+		}
+	}
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
+	/*
+	 * Otherwise (user memory, as for O_DIRECT, cannot be touched
+	 * from the interrupt handler) go through a bounce buffer,
+	 * LHD_BOUNCE sectors to a request, or one if there is no memory
+	 * for that.
+	 */
+	chunk = LHD_BOUNCE;
+	bounce = kmalloc(chunk * LHD_SECTSIZE);
+	if (bounce == NULL) {
+		chunk = 1;
+		bounce = buf;
+	}
+	result = 0;
+	for (i=0; i<len; i+=n) {
+		n = len - i < chunk ? len - i : chunk;
 		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+			result = uiomove(bounce, n * LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
-
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
-
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
-
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		bio_init(&bio, uio->uio_rw, sector+i, n, bounce);
+		result = bio_wait(d, &bio);
+		if (result == 0 && uio->uio_rw == UIO_READ) {
+			result = uiomove(bounce, n * LHD_SECTSIZE, uio);
 		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
 		if (result) {
-			return result;
+			break;
 		}
 	}
 
-	return 0;
+	if (bounce != buf) {
+		kfree(bounce);
+	}
+	return result;
 }
 
 /*
@@ -289,23 +465,20 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
-	}
+	/* Nothing queued yet. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_cur = NULL;
+	lh->lh_curdone = 0;
+	bioq_init(&lh->lh_queue);
+	iostat_register(&lh->lh_iostat, name);
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_open = lhd_open;
 	lh->lh_dev.d_close = lhd_close;
 	lh->lh_dev.d_io = lhd_io;
 	lh->lh_dev.d_ioctl = lhd_ioctl;
+	lh->lh_dev.d_poll = NULL;
+	lh->lh_dev.d_strategy = lhd_strategy;
 	lh->lh_dev.d_blocks = bus_read_register(lh->lh_busdata, lh->lh_buspos,
 						LHD_REG_NSECT);
 	lh->lh_dev.d_blocksize = LHD_SECTSIZE;
@@ -30,7 +30,10 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include <spinlock.h>
 #include <device.h>
+#include <bio.h>
+#include <iostat.h>
 
 /*
  * Our sector size
@@ -51,9 +54,11 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct spinlock lh_lock;	/* for the queue and the registers */
+	struct bio *lh_cur;		/* request in progress, or NULL */
+	uint32_t lh_curdone;		/* sectors of lh_cur done */
+	struct bioq lh_queue;		/* requests waiting */
+	struct iostat lh_iostat;
 
 	struct device lh_dev;		/* VFS device structure */
 };
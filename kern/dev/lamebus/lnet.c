@@ -27,20 +27,379 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * LAMEbus network card (lnet) driver.
+ *
+ * The card is seen as the character device "lnetN:", one packet per
+ * read or write (see <kern/lnet.h>). A write waits for the card to be
+ * idle and then copies the caller's data straight into the card's
+ * transmit buffer, with no buffer in between, and starts it going; it
+ * does not wait for the frame to be sent. A frame received is copied
+ * at once by the interrupt handler into one of the preallocated packet
+ * buffers, so that the card can take the next, and queued for a
+ * reader, which copies it out and gives the buffer back.
+ */
+
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/ioctl.h>
+#include <kern/lnet.h>
 #include <lib.h>
-/*#include <lamebus/lnet.h>*/ /* not yet */
+#include <uio.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <wchan.h>
+#include <platform/bus.h>
+#include <vfs.h>
+#include <lamebus/lnet.h>
 #include "autoconf.h"
 
+/* Registers (offsets within slot) */
+#define LNET_REG_RIRQ	0	/* Receive interrupt status */
+#define LNET_REG_WIRQ	4	/* Transmit interrupt status */
+#define LNET_REG_CTL	8	/* Control */
+#define LNET_REG_STAT	12	/* Status: our hardware address */
+
+/* Bits in the interrupt registers */
+#define LNET_IRQ_DONE	1
+
+/* Bits in the control register */
+#define LNET_CTL_PROMISC 1	/* receive frames for any address */
+#define LNET_CTL_START	2	/* send the transmit buffer */
+
+/* Buffers (offsets within slot) */
+#define LNET_RXBUF	32768
+#define LNET_TXBUF	(32768 + LNET_BUFSIZE)
+
+/*
+ * The card's header on each frame.
+ */
+struct lnet_linkhdr {
+	uint16_t lh_frame;		/* LNET_FRAME */
+	uint16_t lh_from;
+	uint16_t lh_packetlen;		/* header included */
+	uint16_t lh_to;
+};
+#define LNET_FRAME	0xa4b3
+
+static
+inline
+uint32_t
+lnet_rdreg(struct lnet_softc *ln, uint32_t reg)
+{
+	return bus_read_register(ln->ln_busdata, ln->ln_buspos, reg);
+}
+
+static
+inline
+void
+lnet_wreg(struct lnet_softc *ln, uint32_t reg, uint32_t val)
+{
+	bus_write_register(ln->ln_busdata, ln->ln_buspos, reg, val);
+}
+
+/*
+ * Take the frame in the receive buffer. ln_lock held.
+ */
+static
+void
+lnet_receive(struct lnet_softc *ln)
+{
+	struct lnet_linkhdr lh;
+	struct lnet_pkt *pkt;
+
+	KASSERT(spinlock_do_i_hold(&ln->ln_lock));
+
+	memcpy(&lh, ln->ln_rxbuf, sizeof(lh));
+	if (lh.lh_frame != LNET_FRAME || lh.lh_packetlen < sizeof(lh) ||
+	    lh.lh_packetlen > LNET_BUFSIZE) {
+		kprintf("lnet%d: Garbled frame\n", ln->ln_unit);
+		return;
+	}
+
+	pkt = ln->ln_free;
+	if (pkt == NULL) {
+		ln->ln_dropped++;
+		return;
+	}
+	ln->ln_free = pkt->lp_next;
+
+	pkt->lp_next = NULL;
+	pkt->lp_from = lh.lh_from;
+	pkt->lp_len = lh.lh_packetlen - sizeof(lh);
+	memcpy(pkt->lp_data, ln->ln_rxbuf + sizeof(lh), pkt->lp_len);
+
+	if (ln->ln_rxtail == NULL) {
+		ln->ln_rxhead = pkt;
+	}
+	else {
+		ln->ln_rxtail->lp_next = pkt;
+	}
+	ln->ln_rxtail = pkt;
+
+	wchan_wakeone(ln->ln_rxwchan);
+	pollq_wake(&ln->ln_inpq);
+}
+
+/*
+ * Interrupt handler for lnet.
+ * A frame has come in, or one has gone out, or both.
+ */
+void
+lnet_irq(void *vln)
+{
+	struct lnet_softc *ln = vln;
+
+	spinlock_acquire(&ln->ln_lock);
+
+	if (lnet_rdreg(ln, LNET_REG_RIRQ) & LNET_IRQ_DONE) {
+		lnet_receive(ln);
+		/* let the card have its buffer back */
+		lnet_wreg(ln, LNET_REG_RIRQ, 0);
+	}
+
+	if (lnet_rdreg(ln, LNET_REG_WIRQ) & LNET_IRQ_DONE) {
+		lnet_wreg(ln, LNET_REG_WIRQ, 0);
+		ln->ln_txbusy = false;
+		wchan_wakeone(ln->ln_txwchan);
+		pollq_wake(&ln->ln_outpq);
+	}
+
+	spinlock_release(&ln->ln_lock);
+}
+
+static
+int
+lnet_open(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+	return 0;
+}
+
+static
+int
+lnet_close(struct device *d)
+{
+	(void)d;
+	return 0;
+}
+
+/*
+ * Read one packet, waiting for it.
+ */
+static
+int
+lnet_read(struct lnet_softc *ln, struct uio *uio)
+{
+	struct lnet_pkthdr ph;
+	struct lnet_pkt *pkt;
+	size_t len;
+	int result;
+
+	if (uio->uio_resid < sizeof(ph)) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&ln->ln_lock);
+	while (ln->ln_rxhead == NULL) {
+		wchan_lock(ln->ln_rxwchan);
+		spinlock_release(&ln->ln_lock);
+		wchan_sleep(ln->ln_rxwchan);
+		spinlock_acquire(&ln->ln_lock);
+	}
+	pkt = ln->ln_rxhead;
+	ln->ln_rxhead = pkt->lp_next;
+	if (ln->ln_rxhead == NULL) {
+		ln->ln_rxtail = NULL;
+	}
+	spinlock_release(&ln->ln_lock);
+
+	/* it is ours now; copy it out without the lock */
+	ph.lph_addr = pkt->lp_from;
+	ph.lph_len = pkt->lp_len;
+	result = uiomove(&ph, sizeof(ph), uio);
+	if (result == 0) {
+		len = pkt->lp_len;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(pkt->lp_data, len, uio);
+	}
+
+	spinlock_acquire(&ln->ln_lock);
+	pkt->lp_next = ln->ln_free;
+	ln->ln_free = pkt;
+	spinlock_release(&ln->ln_lock);
+
+	return result;
+}
+
+/*
+ * Send one packet. The data goes from the caller straight into the
+ * card's buffer, which is ours once the card is idle.
+ */
+static
+int
+lnet_write(struct lnet_softc *ln, struct uio *uio)
+{
+	struct lnet_pkthdr ph;
+	struct lnet_linkhdr lh;
+	size_t len;
+	int result;
+
+	if (uio->uio_resid < sizeof(ph) ||
+	    uio->uio_resid - sizeof(ph) > LNET_MTU) {
+		return EMSGSIZE;
+	}
+
+	lock_acquire(ln->ln_txlock);
+
+	spinlock_acquire(&ln->ln_lock);
+	while (ln->ln_txbusy) {
+		wchan_lock(ln->ln_txwchan);
+		spinlock_release(&ln->ln_lock);
+		wchan_sleep(ln->ln_txwchan);
+		spinlock_acquire(&ln->ln_lock);
+	}
+	spinlock_release(&ln->ln_lock);
+
+	result = uiomove(&ph, sizeof(ph), uio);
+	if (result) {
+		goto out;
+	}
+	len = uio->uio_resid;
+	result = uiomove(ln->ln_txbuf + sizeof(lh), len, uio);
+	if (result) {
+		goto out;
+	}
+
+	lh.lh_frame = LNET_FRAME;
+	lh.lh_from = ln->ln_addr;
+	lh.lh_packetlen = sizeof(lh) + len;
+	lh.lh_to = ph.lph_addr;
+	memcpy(ln->ln_txbuf, &lh, sizeof(lh));
+
+	spinlock_acquire(&ln->ln_lock);
+	ln->ln_txbusy = true;
+	lnet_wreg(ln, LNET_REG_CTL, LNET_CTL_START);
+	spinlock_release(&ln->ln_lock);
+
+ out:
+	lock_release(ln->ln_txlock);
+	return result;
+}
+
+static
 int
-config_lnet(struct lnet_softc *sc, int lnetno)
+lnet_io(struct device *d, struct uio *uio)
 {
-	(void)sc;
-	
-	kprintf("lnet%d: No network support in system\n", lnetno);
+	struct lnet_softc *ln = d->d_data;
 
-	return ENODEV;
+	if (uio->uio_rw == UIO_READ) {
+		return lnet_read(ln, uio);
+	}
+	return lnet_write(ln, uio);
 }
 
+static
+int
+lnet_ioctl(struct device *d, int op, userptr_t data)
+{
+	struct lnet_softc *ln = d->d_data;
+	uint32_t addr;
+
+	switch (op) {
+	    case IOCTL_LNETADDR:
+		addr = ln->ln_addr;
+		return copyout(&addr, data, sizeof(addr));
+	}
+	return EIOCTL;
+}
+
+static
+int
+lnet_poll(struct device *d, int events, struct poller *poller)
+{
+	struct lnet_softc *ln = d->d_data;
+	int ready = 0;
+
+	if (poller != NULL && (events & POLLIN)) {
+		poller_register(poller, &ln->ln_inpq);
+	}
+	if (poller != NULL && (events & POLLOUT)) {
+		poller_register(poller, &ln->ln_outpq);
+	}
+
+	if (ln->ln_rxhead != NULL) {
+		ready |= POLLIN;
+	}
+	if (!ln->ln_txbusy) {
+		ready |= POLLOUT;
+	}
+	return ready & events;
+}
 
+/*
+ * Setup routine called by autoconf.c when an lnet is found.
+ */
+int
+config_lnet(struct lnet_softc *ln, int lnetno)
+{
+	struct lnet_pkt *pkt;
+	char name[32];
+	unsigned i;
+
+	snprintf(name, sizeof(name), "lnet%d", lnetno);
+
+	ln->ln_rxbuf = bus_map_area(ln->ln_busdata, ln->ln_buspos, LNET_RXBUF);
+	ln->ln_txbuf = bus_map_area(ln->ln_busdata, ln->ln_buspos, LNET_TXBUF);
+	ln->ln_addr = lnet_rdreg(ln, LNET_REG_STAT) & 0xffff;
+
+	spinlock_init(&ln->ln_lock);
+	ln->ln_free = NULL;
+	ln->ln_rxhead = ln->ln_rxtail = NULL;
+	ln->ln_txbusy = false;
+	ln->ln_dropped = 0;
+	pollq_init(&ln->ln_inpq);
+	pollq_init(&ln->ln_outpq);
+
+	ln->ln_rxwchan = wchan_create("lnet rx");
+	ln->ln_txwchan = wchan_create("lnet tx");
+	ln->ln_txlock = lock_create("lnet tx");
+	if (ln->ln_rxwchan == NULL || ln->ln_txwchan == NULL ||
+	    ln->ln_txlock == NULL) {
+		kprintf("%s: Out of memory\n", name);
+		return ENOMEM;
+	}
+	for (i=0; i<LNET_NRXBUF; i++) {
+		pkt = kmalloc(sizeof(*pkt));
+		if (pkt == NULL) {
+			break;
+		}
+		pkt->lp_next = ln->ln_free;
+		ln->ln_free = pkt;
+	}
+	if (ln->ln_free == NULL) {
+		kprintf("%s: Out of memory\n", name);
+		return ENOMEM;
+	}
+
+	ln->ln_dev.d_open = lnet_open;
+	ln->ln_dev.d_close = lnet_close;
+	ln->ln_dev.d_io = lnet_io;
+	ln->ln_dev.d_ioctl = lnet_ioctl;
+	ln->ln_dev.d_poll = lnet_poll;
+	ln->ln_dev.d_strategy = NULL;
+	ln->ln_dev.d_blocks = 0;
+	ln->ln_dev.d_blocksize = 1;
+	ln->ln_dev.d_data = ln;
+
+	/* anything that came in before now is stale */
+	lnet_wreg(ln, LNET_REG_RIRQ, 0);
+	lnet_wreg(ln, LNET_REG_WIRQ, 0);
+
+	kprintf("%s: address %u\n", name, ln->ln_addr);
+
+	return vfs_adddev(name, &ln->ln_dev, 0);
+}
@@ -0,0 +1,62 @@
+#ifndef _LAMEBUS_LNET_H_
+#define _LAMEBUS_LNET_H_
+
+#include <spinlock.h>
+#include <poll.h>
+#include <device.h>
+
+/*
+ * The card's receive and transmit buffers each hold one frame, its
+ * own header included.
+ */
+#define LNET_BUFSIZE	4096
+
+/*
+ * Received packets waiting for a reader are kept in a pool of
+ * LNET_NRXBUF buffers set aside at attach time, so the interrupt
+ * handler never allocates; a packet that arrives when they are all
+ * full is dropped.
+ */
+#define LNET_NRXBUF	8
+
+struct lnet_pkt {
+	struct lnet_pkt *lp_next;	/* in ln_free or the receive queue */
+	uint16_t lp_from;
+	uint32_t lp_len;		/* bytes of data */
+	char lp_data[LNET_BUFSIZE];
+};
+
+/*
+ * Hardware device data associated with lnet (LAMEbus network card)
+ */
+struct lnet_softc {
+	/* Initialized by lower-level attach code */
+	void *ln_busdata;		/* The bus we're on */
+	uint32_t ln_buspos;		/* Our slot on that bus */
+	int ln_unit;			/* What number lnet we are */
+
+	/* Initialized by config_lnet */
+	char *ln_rxbuf;			/* on-card receive buffer */
+	char *ln_txbuf;			/* on-card transmit buffer */
+	uint16_t ln_addr;		/* our address on the network */
+
+	struct spinlock ln_lock;	/* for what follows, and the registers */
+	struct lnet_pkt *ln_free;	/* unused packet buffers */
+	struct lnet_pkt *ln_rxhead;	/* received, oldest first */
+	struct lnet_pkt *ln_rxtail;
+	struct wchan *ln_rxwchan;	/* readers waiting for a packet */
+	bool ln_txbusy;			/* a frame is going out */
+	struct wchan *ln_txwchan;	/* writers waiting for the card */
+	unsigned ln_dropped;		/* packets lost for want of room */
+	struct pollq ln_inpq;		/* pollers waiting for a packet */
+	struct pollq ln_outpq;		/* ... and for the card */
+
+	struct lock *ln_txlock;		/* one writer at a time */
+
+	struct device ln_dev;		/* VFS device structure */
+};
+
+/* Functions called by lower-level drivers */
+void lnet_irq(/*struct lnet_softc*/ void *);	/* Interrupt handler */
+
+#endif /* _LAMEBUS_LNET_H_ */
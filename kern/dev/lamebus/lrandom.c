@@ -32,16 +32,12 @@
  */
 #include <types.h>
 #include <lib.h>
-#include <uio.h>
 #include <platform/bus.h>
 #include <lamebus/lrandom.h>
 #include "autoconf.h"
 
 /* Registers (offsets within slot) */
-#define LR_REG_RAND   0     /* random register */
-
-/* Constants */
-#define LR_RANDMAX  0xffffffff
+#define LR_REG_RAND   0     /* random register, 32 random bits */
 
 int
 config_lrandom(struct lrandom_softc *lr, int lrandomno)
@@ -57,29 +53,3 @@ lrandom_random(void *devdata)
 	struct lrandom_softc *lr = devdata;
 	return bus_read_register(lr->lr_bus, lr->lr_buspos, LR_REG_RAND);
 }
-
-uint32_t
-lrandom_randmax(void *devdata)
-{
-	(void)devdata;
-	return LR_RANDMAX;
-}
-
-int
-lrandom_read(void *devdata, struct uio *uio)
-{
-	struct lrandom_softc *lr = devdata;
-	uint32_t val;
-	int result;
-
-	while (uio->uio_resid > 0) {
-		val = bus_read_register(lr->lr_bus, lr->lr_buspos, 
-					  LR_REG_RAND);
-		result = uiomove(&val, sizeof(val), uio);
-		if (result) {
-			return result;
-		}
-	}
-	
-	return 0;
-}
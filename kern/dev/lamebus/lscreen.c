@@ -107,78 +107,107 @@ lscreen_irq(void *vsc)
 ////////////////////////////////////////////////////////////
 
 /*
- * Handle a newline on the screen.
+ * Move the cursor for CH. *CX is the column, and *LINE the row counted
+ * from the top of the screen as it was, going past the bottom when the
+ * output will scroll it. Returns true if CH is to be drawn at *CX, *LINE
+ * (after which the caller moves *CX on).
  */
 static
-void
-lscreen_newline(struct lscreen_softc *sc)
+bool
+lscreen_step(struct lscreen_softc *sc, int ch, unsigned *cx, unsigned *line)
 {
-	if (sc->ls_cy >= sc->ls_height-1) {
-		/*
-		 * Scroll
-		 */
-
-		memmove(sc->ls_screen, sc->ls_screen + sc->ls_width,
-			sc->ls_width * (sc->ls_height-1));
-		bzero(sc->ls_screen + sc->ls_width * (sc->ls_height-1),
-		      sc->ls_width);
-	}
-	else {
-		sc->ls_cy++;
+	switch (ch) {
+	    case '\n': (*line)++; *cx = 0; return false;
+	    case '\r': *cx = 0; return false;
+	    case '\b': if (*cx > 0) (*cx)--; return false;
 	}
-	sc->ls_cx=0;
-}
-
-/*
- * Handle a printable character being written to the screen.
- */
-static
-void
-lscreen_char(struct lscreen_softc *sc, int ch)
-{
-	if (sc->ls_cx >= sc->ls_width) {
-		lscreen_newline(sc);
+	if (*cx >= sc->ls_width) {
+		(*line)++;
+		*cx = 0;
 	}
-
-	sc->ls_screen[sc->ls_cy*sc->ls_width + sc->ls_cx] = ch;
-	sc->ls_cx++;
+	return true;
 }
 
 /*
- * Send a character to the screen.
- * This should probably know about backspace and tab.
+ * Send LEN characters to the screen, under one hold of the lock.
+ *
+ * Stepping through them once first says how many lines they scroll
+ * the screen by, so that what stays is moved up in one block move
+ * rather than a row at a time per newline, and only the characters
+ * that will still be on the screen are then written to it. The cursor
+ * register is set once, at the end.
  */
 void
-lscreen_write(void *vsc, int ch)
+lscreen_writebuf(void *vsc, const char *buf, size_t len)
 {
 	struct lscreen_softc *sc = vsc;
-	int ccx, ccy;
+	unsigned w = sc->ls_width, h = sc->ls_height;
+	unsigned cx, line, scroll, ccx;
+	size_t i;
 
 	spinlock_acquire(&sc->ls_lock);
 
-	switch (ch) {
-	    case '\n': lscreen_newline(sc); break;
-	    default: lscreen_char(sc, ch); break;
+	cx = sc->ls_cx;
+	line = sc->ls_cy;
+	for (i=0; i<len; i++) {
+		if (lscreen_step(sc, buf[i], &cx, &line)) {
+			cx++;
+		}
+	}
+	scroll = line > h-1 ? line - (h-1) : 0;
+
+	/* Scroll, clearing the lines that come in at the bottom */
+	if (scroll >= h) {
+		bzero(sc->ls_screen, w * h);
+	}
+	else if (scroll > 0) {
+		memmove(sc->ls_screen, sc->ls_screen + w * scroll,
+			w * (h - scroll));
+		bzero(sc->ls_screen + w * (h - scroll), w * scroll);
 	}
 
+	cx = sc->ls_cx;
+	line = sc->ls_cy;
+	for (i=0; i<len; i++) {
+		if (lscreen_step(sc, buf[i], &cx, &line)) {
+			if (line >= scroll) {
+				sc->ls_screen[(line - scroll) * w + cx] = buf[i];
+			}
+			cx++;
+		}
+	}
+	sc->ls_cx = cx;
+	sc->ls_cy = line - scroll;
+
 	/*
-	 * ccx/ccy = corrected cursor position
+	 * ccx = corrected cursor position
 	 * (The cursor marks the next space text will appear in. But
 	 * at the very end of the line, it should not move off the edge.)
 	 */
 	ccx = sc->ls_cx;
-	ccy = sc->ls_cy;
-	if (ccx==sc->ls_width) {
+	if (ccx==w) {
 		ccx--;
 	}
 
 	/* Set the cursor position */
 	bus_write_register(sc->ls_busdata, sc->ls_buspos,
-			   LSCR_REG_POSN, mergexy(ccx, ccy));
+			   LSCR_REG_POSN, mergexy(ccx, sc->ls_cy));
 
 	spinlock_release(&sc->ls_lock);
 }
 
+/*
+ * Send a character to the screen.
+ * This should probably know about tab.
+ */
+void
+lscreen_write(void *vsc, int ch)
+{
+	char c = ch;
+
+	lscreen_writebuf(vsc, &c, 1);
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
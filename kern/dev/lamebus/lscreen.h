@@ -55,5 +55,7 @@ void lscreen_irq(/*struct lser_softc*/ void *sc);  // interrupt handler
 
 /* Functions called by higher-level drivers */
 void lscreen_write(/*struct lser_softc*/ void *sc, int ch); // output function
+void lscreen_writebuf(/*struct lser_softc*/ void *sc,
+		      const char *buf, size_t len);         // many at once
 
 #endif /* _LAMEBUS_LSCREEN_H_ */
@@ -43,6 +43,23 @@
 #define LSER_IRQ_ENABLE  1
 #define LSER_IRQ_ACTIVE  2
 
+/*
+ * Take the oldest waiting char off the queue. ls_lock held.
+ */
+static
+unsigned char
+lser_txtake(struct lser_softc *sc)
+{
+	unsigned tail;
+
+	KASSERT(spinlock_do_i_hold(&sc->ls_lock));
+	KASSERT(sc->ls_txcount > 0);
+
+	tail = (sc->ls_txhead + LSER_TXSIZE - sc->ls_txcount) % LSER_TXSIZE;
+	sc->ls_txcount--;
+	return sc->ls_txq[tail];
+}
+
 void
 lser_irq(void *vsc)
 {
@@ -57,10 +74,18 @@ lser_irq(void *vsc)
 	x = bus_read_register(sc->ls_busdata, sc->ls_buspos, LSER_REG_WIRQ);
 	if (x & LSER_IRQ_ACTIVE) {
 		x = LSER_IRQ_ENABLE;
-		sc->ls_wbusy = 0;
-		clear_to_write = true;
 		bus_write_register(sc->ls_busdata, sc->ls_buspos,
 				   LSER_REG_WIRQ, x);
+		if (sc->ls_txcount > 0) {
+			/* keep going, and ask for more at half empty */
+			bus_write_register(sc->ls_busdata, sc->ls_buspos,
+					   LSER_REG_CHAR, lser_txtake(sc));
+			clear_to_write = sc->ls_txcount == LSER_TXSIZE/2;
+		}
+		else {
+			sc->ls_wbusy = false;
+			clear_to_write = true;
+		}
 	}
 
 	x = bus_read_register(sc->ls_busdata, sc->ls_buspos, LSER_REG_RIRQ);
@@ -83,6 +108,9 @@ lser_irq(void *vsc)
 	}
 }
 
+/*
+ * Send CH, or queue it behind the one being sent.
+ */
 void
 lser_write(void *vls, int ch)
 {
@@ -90,13 +118,23 @@ lser_write(void *vls, int ch)
 
 	spinlock_acquire(&ls->ls_lock);
 
-	if (ls->ls_wbusy) {
+	if (!ls->ls_wbusy) {
+		ls->ls_wbusy = true;
+		bus_write_register(ls->ls_busdata, ls->ls_buspos,
+				   LSER_REG_CHAR, ch);
+	}
+	else if (ls->ls_txcount < LSER_TXSIZE) {
+		ls->ls_txq[ls->ls_txhead] = ch;
+		ls->ls_txhead = (ls->ls_txhead + 1) % LSER_TXSIZE;
+		ls->ls_txcount++;
+	}
+	else {
 		/*
 		 * We're not clear to write.
 		 *
 		 * This should not happen. It's the job of the driver
-		 * attached to us to not write until we call
-		 * ls->ls_start.
+		 * attached to us to not write while lser_canwrite says
+		 * no, until we call ls->ls_start.
 		 *
 		 * (Note: if we're the console, the panic will go to
 		 * lser_writepolled for printing, because we hold a
@@ -104,11 +142,23 @@ lser_write(void *vls, int ch)
 		 */
 		panic("lser: Not clear to write\n");
 	}
-	ls->ls_wbusy = true;
 
-	bus_write_register(ls->ls_busdata, ls->ls_buspos, LSER_REG_CHAR, ch);
+	spinlock_release(&ls->ls_lock);
+}
 
+/*
+ * Whether lser_write can take another char now.
+ */
+bool
+lser_canwrite(void *vls)
+{
+	struct lser_softc *ls = vls;
+	bool ret;
+
+	spinlock_acquire(&ls->ls_lock);
+	ret = !ls->ls_wbusy || ls->ls_txcount < LSER_TXSIZE;
 	spinlock_release(&ls->ls_lock);
+	return ret;
 }
 
 static
@@ -140,6 +190,15 @@ lser_writepolled(void *vsc, int ch)
 		/* Clear the ready condition */
 		bus_write_register(sc->ls_busdata, sc->ls_buspos,
 				   LSER_REG_WIRQ, LSER_IRQ_ENABLE);
+
+		/* Send what was queued, so things come out in order. */
+		while (sc->ls_txcount > 0) {
+			bus_write_register(sc->ls_busdata, sc->ls_buspos,
+					   LSER_REG_CHAR, lser_txtake(sc));
+			lser_poll_until_write(sc);
+			bus_write_register(sc->ls_busdata, sc->ls_buspos,
+					   LSER_REG_WIRQ, LSER_IRQ_ENABLE);
+		}
 	}
 
 	/* Send the character. */
@@ -191,6 +250,8 @@ config_lser(struct lser_softc *sc, int lserno)
 
 	spinlock_init(&sc->ls_lock);
 	sc->ls_wbusy = false;
+	sc->ls_txhead = 0;
+	sc->ls_txcount = 0;
 
 	bus_write_register(sc->ls_busdata, sc->ls_buspos,
 			   LSER_REG_RIRQ, LSER_IRQ_ENABLE);
@@ -32,10 +32,20 @@
 
 #include <spinlock.h>
 
+/*
+ * Chars waiting to be sent, after the one being sent. Each write-done
+ * interrupt sends the next at once; the driver above is called back
+ * (ls_start) to refill only when half of them have gone.
+ */
+#define LSER_TXSIZE 64
+
 struct lser_softc {
 	/* Initialized by config function */
-	struct spinlock ls_lock;    /* protects ls_wbusy and device regs */
+	struct spinlock ls_lock;    /* protects ls_wbusy, ls_tx*, and regs */
 	volatile bool ls_wbusy;     /* true if write in progress */
+	unsigned char ls_txq[LSER_TXSIZE];
+	unsigned ls_txhead;         /* next slot to put a char in */
+	unsigned ls_txcount;        /* chars waiting */
 
 	/* Initialized by lower-level attachment function */
 	void *ls_busdata;
@@ -54,6 +64,7 @@ void lser_irq(/*struct lser_softc*/ void *sc);
 
 /* Functions called by higher-level drivers */
 void lser_write(/*struct lser_softc*/ void *sc, int ch);
+bool lser_canwrite(/*struct lser_softc*/ void *sc);
 void lser_startpolling(/*struct lser_softc*/ void *sc);
 void lser_writepolled(/*struct lser_softc*/ void *sc, int ch);
 void lser_endpolling(/*struct lser_softc*/ void *sc);
@@ -46,7 +46,7 @@
 #define LT_REG_COUNT  16    /* Time for countdown timer (usec) */
 #define LT_REG_SPKR   20    /* Beep control */
 
-static bool havetimerclock;
+static struct ltimer_softc *timerclock_lt;
 
 /*
  * Setup routine called by autoconf stuff when an ltimer is found.
@@ -84,15 +84,14 @@ config_ltimer(struct ltimer_softc *lt, int ltimerno)
 	 * We do, however, use ltimer for the timer clock, since the
 	 * on-chip timer can't do that.
 	 */
-	if (!havetimerclock) {
-		havetimerclock = true;
+	if (timerclock_lt == NULL) {
+		timerclock_lt = lt;
 		lt->lt_timerclock = 1;
 
-		/* Wire it to go off once every 10 ms */
-		/* KMS: reduced this from 1s to 10ms */
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, 1);
-		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
-				   LT_GRANULARITY);
+		/*
+		 * It is left stopped; the clock code turns it on with
+		 * ltimer_timerclock_run when there are timeouts.
+		 */
 	}
 	
 	return 0;
@@ -125,6 +124,27 @@ ltimer_irq(void *vlt)
 	}
 }
 
+/*
+ * Start or stop the countdown timer used for timerclock. Running, it
+ * goes off once every LT_GRANULARITY usec (10 ms; KMS: reduced this
+ * from 1s). Starting it restarts the countdown. Stopping it lets the
+ * current countdown finish, so there may be one more tick.
+ */
+void
+ltimer_timerclock_run(bool run)
+{
+	struct ltimer_softc *lt = timerclock_lt;
+
+	if (lt == NULL) {
+		return;
+	}
+	bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_ROE, run ? 1 : 0);
+	if (run) {
+		bus_write_register(lt->lt_bus, lt->lt_buspos, LT_REG_COUNT,
+				   LT_GRANULARITY);
+	}
+}
+
 /*
  * The timer device will beep if you write to the beep register. It
  * doesn't matter what value you write. This function is called if
@@ -51,6 +51,9 @@ struct ltimer_softc {
 /* Functions called by lower-level drivers */
 void ltimer_irq(/*struct ltimer_softc*/ void *lt);  // interrupt handler
 
+/* Called by the clock code to turn timerclock() calls on and off */
+void ltimer_timerclock_run(bool run);
+
 /* Functions called by higher-level devices */
 void ltimer_beep(/*struct ltimer_softc*/ void *devdata);   // for beep device
 void ltimer_gettime(/*struct ltimer_softc*/ void *devdata,
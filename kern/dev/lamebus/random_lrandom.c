@@ -50,8 +50,6 @@ attach_random_to_lrandom(int randomno, struct lrandom_softc *ls)
 
 	rs->rs_devdata = ls;
 	rs->rs_random = lrandom_random;
-	rs->rs_randmax = lrandom_randmax;
-	rs->rs_read = lrandom_read;
 
 	return rs;
 }
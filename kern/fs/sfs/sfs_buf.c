@@ -0,0 +1,979 @@
+/*
+ * SFS buffer cache.
+ *
+ * One pool of SFS_NBUF block buffers, shared by every mounted SFS and
+ * keyed by (device, block). A buffer is found through a small hash
+ * table; the ones nobody holds are on an LRU list, least recently
+ * used first, and a miss takes the head of that list. Writes only
+ * dirty the buffer, which goes on a dirty list until sfs_bflush (from
+ * sync and fsync) or eviction writes it out.
+ *
+ * sfs_buflock, a spinlock, covers the hash table, both lists, and each
+ * buffer's key, reference count and dirty flag; it is never held
+ * across I/O. Each buffer's sb_lock is held by whoever has it from
+ * sfs_bget, and covers its contents and sb_valid, and so any I/O to
+ * it. A buffer is only given a new key while nobody holds it, so one
+ * found in the table under sfs_buflock stays that block until let go.
+ *
+ * The pool is made at the first mount, which is under vfs_biglock.
+ *
+ * Readahead (sfs_bprefetch) is a small ring of blocks to load, under
+ * sfs_buflock too, and a kernel thread that takes them off and does
+ * sfs_bget on each. It is only a hint: when the ring is full, or the
+ * thread could not be made, blocks are not read ahead.
+ *
+ * Another thread, the syncer, wakes every sfs_syncdelay seconds and
+ * writes out the buffers that have been dirty for sfs_syncage seconds
+ * or more, in order of device and block, so that small writes are
+ * gathered up for a while and then go out in one sweep of the disk
+ * instead of waiting for sync or eviction. Before that it copies each
+ * mounted volume's changed inodes into their buffers, so that they go
+ * out the same way. Once sfs_dirtybg percent of the buffers are dirty
+ * it is woken early, for a round that writes every dirty buffer
+ * whatever its age; and a writer that finds sfs_dirtymax percent dirty
+ * (sfs_bthrottle) waits for such a round before it adds more, so that
+ * a burst of writes does not leave the whole cache to be written at
+ * once by eviction or unmount. All four can be changed while running
+ * (sfs_bsyncset).
+ *
+ * On a volume with a journal, a dirty metadata buffer is pinned
+ * (sb_meta): only the journal's commit writes it back. Eviction passes
+ * over pinned buffers, unless every one it could take is pinned, when
+ * it writes the first in place anyway rather than wait; that only
+ * loses the journal's protection for the one block until the next
+ * commit, and sfs_jbegin commits early to keep it from coming to
+ * that. The syncer leaves pinned buffers alone too, and commits
+ * instead each volume with some that have been pinned long enough.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <thread.h>
+#include <clock.h>
+#include <lamebus/ltimer.h>
+#include <uio.h>
+#include <device.h>
+#include <sfs.h>
+
+#define SFS_NBUFHASH	64	/* hash chains; a power of 2 */
+#define SFS_NPREFETCH	64	/* readahead blocks queued at once */
+#define SFS_SYNCDELAY	5	/* seconds between the syncer's rounds */
+#define SFS_SYNCAGE	5	/* seconds dirty before it writes a buffer */
+#define SFS_DIRTYBG	25	/* percent dirty to start a round early */
+#define SFS_DIRTYMAX	50	/* percent dirty to hold writers back */
+#define SFS_SYNCNFS	8	/* volumes the syncer commits in one round */
+
+/* timer ticks per second, for the syncer's naps */
+#define SFS_TICKS	(1000000 / LT_GRANULARITY)
+
+struct sfs_buf {
+	struct device *sb_dev;		/* key, with sb_block */
+	uint32_t sb_block;
+	unsigned sb_refcount;
+	bool sb_dirty;
+	bool sb_meta;			/* dirty and pinned; see above */
+	time_t sb_dirtytime;		/* when it last became dirty */
+	bool sb_valid;			/* holds the block; under sb_lock */
+	struct lock *sb_lock;
+	void *sb_data;
+	struct sfs_fs *sb_sfs;		/* for writing it back */
+	struct sfs_buf *sb_hashnext;
+	struct sfs_buf *sb_lrunext;	/* on the LRU list iff unheld */
+	struct sfs_buf *sb_lruprev;
+	struct sfs_buf *sb_dirtynext;	/* on the dirty list iff sb_dirty */
+	struct sfs_buf *sb_dirtyprev;
+};
+
+static struct spinlock sfs_buflock = SPINLOCK_INITIALIZER;
+static struct wchan *sfs_bufwchan;	/* a buffer went on the LRU list */
+static struct sfs_buf *sfs_bufs;
+static unsigned sfs_nbuf;		/* as many of SFS_NBUF as were made */
+static struct sfs_buf *sfs_bufhash[SFS_NBUFHASH];
+static struct sfs_buf *sfs_lruhead, *sfs_lrutail;
+static struct sfs_buf *sfs_dirtyhead;
+static unsigned sfs_ndirty;		/* on the dirty list */
+
+struct sfs_prefetch {
+	struct sfs_fs *pf_sfs;
+	uint32_t pf_block;
+};
+
+static struct sfs_prefetch sfs_pfring[SFS_NPREFETCH];
+static unsigned sfs_pfhead, sfs_pfcount;
+static bool sfs_pfthread;		/* the readahead thread is running */
+static struct sfs_fs *sfs_pfbusy;	/* whose block it is reading now */
+static struct wchan *sfs_pfwchan;	/* it waits for blocks to load */
+
+static struct sfs_buf *sfs_syncbufs[SFS_NBUF];	/* the syncer's round */
+static struct sfs_fs *sfs_syncfs[SFS_SYNCNFS];	/* and its commits */
+static bool sfs_syncing;		/* it holds sfs_syncbufs */
+static bool sfs_syncer;			/* the syncer is running */
+static bool sfs_synckick;		/* start a full round now */
+static struct wchan *sfs_syncwchan;	/* it naps here between rounds */
+static struct wchan *sfs_throttlewchan;	/* sfs_bthrottle waits here */
+static struct sfs_fs *sfs_syncvols;	/* mounted, for their inodes */
+
+/* The syncer's settings, from the defaults above */
+static unsigned sfs_syncdelay = SFS_SYNCDELAY;
+static unsigned sfs_syncage = SFS_SYNCAGE;
+static unsigned sfs_dirtybg = SFS_DIRTYBG;
+static unsigned sfs_dirtymax = SFS_DIRTYMAX;
+
+/* sfs_bdrop waits here for sfs_pfbusy and sfs_syncing */
+static struct wchan *sfs_bgdonewchan;
+
+static
+unsigned
+sfs_bhash(struct device *dev, uint32_t block)
+{
+	return ((uintptr_t)dev / sizeof(void *) + block) & (SFS_NBUFHASH - 1);
+}
+
+/*
+ * Find BLOCK's buffer, if it has one. sfs_buflock held.
+ */
+static
+struct sfs_buf *
+sfs_blookup(struct device *dev, uint32_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = sfs_bufhash[sfs_bhash(dev, block)]; b != NULL;
+	     b = b->sb_hashnext) {
+		if (b->sb_dev == dev && b->sb_block == block) {
+			break;
+		}
+	}
+	return b;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Lists; sfs_buflock held
+
+static
+void
+sfs_lru_remove(struct sfs_buf *b)
+{
+	if (b->sb_lruprev != NULL) {
+		b->sb_lruprev->sb_lrunext = b->sb_lrunext;
+	}
+	else {
+		sfs_lruhead = b->sb_lrunext;
+	}
+	if (b->sb_lrunext != NULL) {
+		b->sb_lrunext->sb_lruprev = b->sb_lruprev;
+	}
+	else {
+		sfs_lrutail = b->sb_lruprev;
+	}
+	b->sb_lrunext = b->sb_lruprev = NULL;
+}
+
+static
+void
+sfs_lru_append(struct sfs_buf *b)
+{
+	b->sb_lrunext = NULL;
+	b->sb_lruprev = sfs_lrutail;
+	if (sfs_lrutail != NULL) {
+		sfs_lrutail->sb_lrunext = b;
+	}
+	else {
+		sfs_lruhead = b;
+	}
+	sfs_lrutail = b;
+}
+
+static
+void
+sfs_dirty_remove(struct sfs_buf *b)
+{
+	KASSERT(b->sb_dirty);
+	if (b->sb_dirtyprev != NULL) {
+		b->sb_dirtyprev->sb_dirtynext = b->sb_dirtynext;
+	}
+	else {
+		sfs_dirtyhead = b->sb_dirtynext;
+	}
+	if (b->sb_dirtynext != NULL) {
+		b->sb_dirtynext->sb_dirtyprev = b->sb_dirtyprev;
+	}
+	b->sb_dirtynext = b->sb_dirtyprev = NULL;
+	b->sb_dirty = false;
+	if (b->sb_meta) {
+		b->sb_meta = false;
+		b->sb_sfs->sfs_jnmeta--;
+	}
+	KASSERT(sfs_ndirty > 0);
+	sfs_ndirty--;
+	if (sfs_syncer && sfs_ndirty * 100 < sfs_nbuf * sfs_dirtymax) {
+		wchan_wakeall(sfs_throttlewchan);
+	}
+}
+
+static
+void
+sfs_hash_remove(struct sfs_buf *b)
+{
+	struct sfs_buf **pp;
+
+	pp = &sfs_bufhash[sfs_bhash(b->sb_dev, b->sb_block)];
+	while (*pp != b) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->sb_hashnext;
+	}
+	*pp = b->sb_hashnext;
+	b->sb_hashnext = NULL;
+	b->sb_dev = NULL;
+}
+
+static void sfs_prefetchthread(void *data1, unsigned long data2);
+static void sfs_syncthread(void *data1, unsigned long data2);
+
+/*
+ * Make the pool, at the first mount. If memory runs short partway
+ * through, make do with the buffers made so far; likewise go without
+ * readahead or the syncer if their threads cannot be started.
+ */
+int
+sfs_bufinit(void)
+{
+	struct sfs_buf *b;
+	unsigned i;
+
+	if (sfs_bufs != NULL) {
+		return 0;
+	}
+
+	sfs_bufwchan = wchan_create("sfs_buf");
+	if (sfs_bufwchan == NULL) {
+		return ENOMEM;
+	}
+	sfs_bufs = kmalloc(SFS_NBUF * sizeof(*sfs_bufs));
+	if (sfs_bufs == NULL) {
+		wchan_destroy(sfs_bufwchan);
+		return ENOMEM;
+	}
+	for (i=0; i<SFS_NBUF; i++) {
+		b = &sfs_bufs[i];
+		b->sb_lock = lock_create("sfs_buf");
+		if (b->sb_lock == NULL) {
+			break;
+		}
+		b->sb_data = kmalloc(SFS_BLOCKSIZE);
+		if (b->sb_data == NULL) {
+			lock_destroy(b->sb_lock);
+			break;
+		}
+		b->sb_dev = NULL;
+		b->sb_block = 0;
+		b->sb_refcount = 0;
+		b->sb_dirty = false;
+		b->sb_meta = false;
+		b->sb_valid = false;
+		b->sb_sfs = NULL;
+		b->sb_hashnext = NULL;
+		b->sb_dirtynext = b->sb_dirtyprev = NULL;
+		sfs_lru_append(b);
+	}
+	sfs_nbuf = i;
+	if (sfs_nbuf == 0) {
+		kfree(sfs_bufs);
+		sfs_bufs = NULL;
+		wchan_destroy(sfs_bufwchan);
+		return ENOMEM;
+	}
+
+	sfs_pfwchan = wchan_create("sfs_prefetch");
+	sfs_bgdonewchan = wchan_create("sfs_bgdone");
+	sfs_syncwchan = wchan_create("sfs_syncer");
+	sfs_throttlewchan = wchan_create("sfs_throttle");
+	if (sfs_bgdonewchan == NULL || sfs_throttlewchan == NULL) {
+		kprintf("sfs: no readahead or syncer\n");
+		return 0;
+	}
+	if (sfs_pfwchan != NULL &&
+	    thread_fork("sfs_prefetch", NULL, sfs_prefetchthread,
+			NULL, 0) == 0) {
+		sfs_pfthread = true;
+	}
+	else {
+		kprintf("sfs: no readahead\n");
+	}
+	if (sfs_syncwchan != NULL &&
+	    thread_fork("sfs_syncer", NULL, sfs_syncthread, NULL, 0) == 0) {
+		sfs_syncer = true;
+	}
+	else {
+		kprintf("sfs: no syncer\n");
+	}
+	return 0;
+}
+
+/*
+ * Take a reference to B, which is in the table or just taken off the
+ * LRU list to be reused.
+ */
+static
+void
+sfs_bhold(struct sfs_buf *b)
+{
+	if (b->sb_refcount++ == 0) {
+		sfs_lru_remove(b);
+	}
+}
+
+static
+void
+sfs_bunhold(struct sfs_buf *b)
+{
+	KASSERT(b->sb_refcount > 0);
+	if (--b->sb_refcount == 0) {
+		sfs_lru_append(b);
+		wchan_wakeone(sfs_bufwchan);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// I/O; sb_lock held
+
+static
+int
+sfs_bwrite(struct sfs_buf *b)
+{
+	int result;
+
+	result = sfs_wblock(b->sb_sfs, b->sb_data, b->sb_block);
+	if (result == 0) {
+		spinlock_acquire(&sfs_buflock);
+		if (b->sb_dirty) {
+			sfs_dirty_remove(b);
+		}
+		spinlock_release(&sfs_buflock);
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// The interface
+
+int
+sfs_bget(struct sfs_fs *sfs, uint32_t block, bool fill, struct sfs_buf **ret)
+{
+	struct device *dev = sfs->sfs_device;
+	unsigned h = sfs_bhash(dev, block);
+	struct sfs_buf *b;
+	int result;
+
+	KASSERT(block < sfs->sfs_super.sp_nblocks);
+
+	spinlock_acquire(&sfs_buflock);
+ again:
+	b = sfs_blookup(dev, block);
+	if (b == NULL) {
+		/*
+		 * A miss; reuse the least recently used buffer that is
+		 * not pinned, or failing that the least recently used.
+		 */
+		for (b = sfs_lruhead; b != NULL && b->sb_meta;
+		     b = b->sb_lrunext) {
+			/* nothing */
+		}
+		if (b == NULL) {
+			b = sfs_lruhead;
+		}
+		if (b == NULL) {
+			wchan_lock(sfs_bufwchan);
+			spinlock_release(&sfs_buflock);
+			wchan_sleep(sfs_bufwchan);
+			spinlock_acquire(&sfs_buflock);
+			goto again;
+		}
+		if (b->sb_dirty) {
+			/*
+			 * Write it out first, and look again, since the
+			 * block may have been loaded meanwhile. If the
+			 * write fails it stays dirty, and goes to the end
+			 * of the list to be tried again later.
+			 */
+			sfs_bhold(b);
+			spinlock_release(&sfs_buflock);
+			lock_acquire(b->sb_lock);
+			(void)sfs_bwrite(b);
+			lock_release(b->sb_lock);
+			spinlock_acquire(&sfs_buflock);
+			sfs_bunhold(b);
+			goto again;
+		}
+		if (b->sb_dev != NULL) {
+			sfs_hash_remove(b);
+		}
+		sfs_bhold(b);
+		b->sb_dev = dev;
+		b->sb_block = block;
+		b->sb_sfs = sfs;
+		b->sb_hashnext = sfs_bufhash[h];
+		sfs_bufhash[h] = b;
+		/* nobody held it, so nobody is in its lock to see this */
+		b->sb_valid = false;
+	}
+	else {
+		sfs_bhold(b);
+	}
+	spinlock_release(&sfs_buflock);
+
+	lock_acquire(b->sb_lock);
+	if (!b->sb_valid) {
+		if (fill) {
+			result = sfs_rblock(sfs, b->sb_data, block);
+			if (result) {
+				sfs_bput(b);
+				return result;
+			}
+		}
+		/* without FILL the caller is to write the whole block */
+		b->sb_valid = true;
+	}
+	*ret = b;
+	return 0;
+}
+
+void *
+sfs_bdata(struct sfs_buf *b)
+{
+	KASSERT(lock_do_i_hold(b->sb_lock));
+	return b->sb_data;
+}
+
+/*
+ * Start a round of the syncer now, one that writes everything dirty.
+ * sfs_buflock held.
+ */
+static
+void
+sfs_bkick(void)
+{
+	if (sfs_syncer && !sfs_synckick) {
+		sfs_synckick = true;
+		wchan_wakeone(sfs_syncwchan);
+	}
+}
+
+static
+void
+sfs_dodirty(struct sfs_buf *b, bool meta)
+{
+	time_t now;
+	uint32_t nsecs;
+
+	KASSERT(lock_do_i_hold(b->sb_lock));
+	KASSERT(b->sb_valid);
+
+	gettime(&now, &nsecs);
+
+	spinlock_acquire(&sfs_buflock);
+	if (!b->sb_dirty) {
+		b->sb_dirty = true;
+		b->sb_dirtytime = now;
+		b->sb_dirtyprev = NULL;
+		b->sb_dirtynext = sfs_dirtyhead;
+		if (sfs_dirtyhead != NULL) {
+			sfs_dirtyhead->sb_dirtyprev = b;
+		}
+		sfs_dirtyhead = b;
+		sfs_ndirty++;
+		if (sfs_ndirty * 100 >= sfs_nbuf * sfs_dirtybg) {
+			sfs_bkick();
+		}
+	}
+	if (meta && !b->sb_meta && b->sb_sfs->sfs_jblocks > 0) {
+		b->sb_meta = true;
+		b->sb_sfs->sfs_jnmeta++;
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+void
+sfs_bdirty(struct sfs_buf *b)
+{
+	sfs_dodirty(b, false);
+}
+
+void
+sfs_bdirtymeta(struct sfs_buf *b)
+{
+	sfs_dodirty(b, true);
+}
+
+void
+sfs_binval(struct sfs_buf *b)
+{
+	KASSERT(lock_do_i_hold(b->sb_lock));
+
+	spinlock_acquire(&sfs_buflock);
+	if (b->sb_dirty) {
+		sfs_dirty_remove(b);
+	}
+	spinlock_release(&sfs_buflock);
+	b->sb_valid = false;
+}
+
+void
+sfs_bput(struct sfs_buf *b)
+{
+	lock_release(b->sb_lock);
+	spinlock_acquire(&sfs_buflock);
+	sfs_bunhold(b);
+	spinlock_release(&sfs_buflock);
+}
+
+bool
+sfs_bcached(struct sfs_fs *sfs, uint32_t block)
+{
+	bool ret;
+
+	spinlock_acquire(&sfs_buflock);
+	ret = sfs_blookup(sfs->sfs_device, block) != NULL;
+	spinlock_release(&sfs_buflock);
+	return ret;
+}
+
+void
+sfs_bforget(struct sfs_fs *sfs, uint32_t block)
+{
+	struct sfs_buf *b;
+
+	spinlock_acquire(&sfs_buflock);
+	b = sfs_blookup(sfs->sfs_device, block);
+	if (b == NULL) {
+		spinlock_release(&sfs_buflock);
+		return;
+	}
+	sfs_bhold(b);
+	spinlock_release(&sfs_buflock);
+
+	/* waits out a write-back of it that is under way */
+	lock_acquire(b->sb_lock);
+	sfs_binval(b);
+	sfs_bput(b);
+}
+
+int
+sfs_bclean(struct sfs_fs *sfs, uint32_t block)
+{
+	struct sfs_buf *b;
+	int result;
+
+	spinlock_acquire(&sfs_buflock);
+	b = sfs_blookup(sfs->sfs_device, block);
+	if (b == NULL || !b->sb_dirty) {
+		spinlock_release(&sfs_buflock);
+		return 0;
+	}
+	sfs_bhold(b);
+	spinlock_release(&sfs_buflock);
+
+	lock_acquire(b->sb_lock);
+	result = sfs_bwriteout(b);
+	sfs_bput(b);
+	return result;
+}
+
+/*
+ * The readahead thread: load each block queued, unless it is cached
+ * already. Never exits.
+ */
+static
+void
+sfs_prefetchthread(void *data1, unsigned long data2)
+{
+	struct sfs_prefetch pf;
+	struct sfs_buf *b;
+
+	(void)data1;
+	(void)data2;
+
+	spinlock_acquire(&sfs_buflock);
+	while (1) {
+		if (sfs_pfcount == 0) {
+			wchan_lock(sfs_pfwchan);
+			spinlock_release(&sfs_buflock);
+			wchan_sleep(sfs_pfwchan);
+			spinlock_acquire(&sfs_buflock);
+			continue;
+		}
+		pf = sfs_pfring[sfs_pfhead];
+		sfs_pfhead = (sfs_pfhead + 1) % SFS_NPREFETCH;
+		sfs_pfcount--;
+
+		if (sfs_blookup(pf.pf_sfs->sfs_device, pf.pf_block) == NULL) {
+			sfs_pfbusy = pf.pf_sfs;
+			spinlock_release(&sfs_buflock);
+			if (sfs_bget(pf.pf_sfs, pf.pf_block, true, &b) == 0) {
+				sfs_bput(b);
+			}
+			spinlock_acquire(&sfs_buflock);
+			sfs_pfbusy = NULL;
+			wchan_wakeall(sfs_bgdonewchan);
+		}
+	}
+}
+
+/*
+ * Whether A goes before B on the way across the disks.
+ */
+static
+bool
+sfs_bbefore(struct sfs_buf *a, struct sfs_buf *b)
+{
+	if (a->sb_dev != b->sb_dev) {
+		return (uintptr_t)a->sb_dev < (uintptr_t)b->sb_dev;
+	}
+	return a->sb_block < b->sb_block;
+}
+
+/*
+ * Nap until it is time for the syncer's next round, or it is kicked.
+ */
+static
+void
+sfs_syncwait(void)
+{
+	struct timeout to;
+	unsigned ticks;
+
+	spinlock_acquire(&sfs_buflock);
+	ticks = sfs_syncdelay * SFS_TICKS;
+	spinlock_release(&sfs_buflock);
+
+	timeout_start(&to, ticks, sfs_syncwchan);
+	spinlock_acquire(&sfs_buflock);
+	while (!sfs_synckick) {
+		wchan_lock(sfs_syncwchan);
+		if (to.to_fired) {
+			wchan_unlock(sfs_syncwchan);
+			break;
+		}
+		spinlock_release(&sfs_buflock);
+		wchan_sleep(sfs_syncwchan);
+		spinlock_acquire(&sfs_buflock);
+	}
+	spinlock_release(&sfs_buflock);
+	timeout_stop(&to);
+}
+
+/*
+ * The syncer. Each round it first writes the inodes of each mounted
+ * volume to their buffers, in a journal handle so as not to land in
+ * the middle of a commit. Then it takes a hold on each buffer dirty
+ * long enough (any, if it was kicked), sorting them as it goes, and
+ * writes them out in that order. One that will not write stays dirty
+ * for the next round. Pinned ones are not written; their volumes are
+ * committed once the rest are out, up to SFS_SYNCNFS of them, and any
+ * more the next round. sfs_syncing, set for the whole round, keeps
+ * every volume from being unmounted meanwhile. Never exits.
+ */
+static
+void
+sfs_syncthread(void *data1, unsigned long data2)
+{
+	struct sfs_buf *b;
+	struct sfs_fs *sfs;
+	time_t now, age;
+	uint32_t nsecs;
+	unsigned n, nfs, i;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		sfs_syncwait();
+
+		spinlock_acquire(&sfs_buflock);
+		age = sfs_synckick ? 0 : sfs_syncage;
+		sfs_synckick = false;
+		sfs_syncing = true;
+		sfs = sfs_syncvols;
+		spinlock_release(&sfs_buflock);
+
+		/* (volumes mounted meanwhile go at the head; not seen) */
+		for (; sfs != NULL; sfs = sfs->sfs_syncnext) {
+			sfs_jbegin(sfs);
+			(void)sfs_syncinodes(sfs);
+			sfs_jend(sfs);
+		}
+
+		gettime(&now, &nsecs);
+		n = nfs = 0;
+		spinlock_acquire(&sfs_buflock);
+		for (b = sfs_dirtyhead; b != NULL; b = b->sb_dirtynext) {
+			if (now - b->sb_dirtytime < age) {
+				continue;
+			}
+			if (b->sb_meta) {
+				for (i=0; i<nfs && sfs_syncfs[i]!=b->sb_sfs;
+				     i++) {
+					/* nothing */
+				}
+				if (i == nfs && nfs < SFS_SYNCNFS) {
+					sfs_syncfs[nfs++] = b->sb_sfs;
+				}
+				continue;
+			}
+			KASSERT(n < SFS_NBUF);
+			sfs_bhold(b);
+			for (i = n; i > 0 && sfs_bbefore(b, sfs_syncbufs[i-1]);
+			     i--) {
+				sfs_syncbufs[i] = sfs_syncbufs[i-1];
+			}
+			sfs_syncbufs[i] = b;
+			n++;
+		}
+		spinlock_release(&sfs_buflock);
+
+		for (i=0; i<n; i++) {
+			b = sfs_syncbufs[i];
+			lock_acquire(b->sb_lock);
+			if (b->sb_dirty) {
+				(void)sfs_bwrite(b);
+			}
+			lock_release(b->sb_lock);
+		}
+
+		spinlock_acquire(&sfs_buflock);
+		for (i=0; i<n; i++) {
+			sfs_bunhold(sfs_syncbufs[i]);
+		}
+		spinlock_release(&sfs_buflock);
+
+		for (i=0; i<nfs; i++) {
+			(void)sfs_jcommit(sfs_syncfs[i]);
+		}
+
+		spinlock_acquire(&sfs_buflock);
+		sfs_syncing = false;
+		wchan_wakeall(sfs_bgdonewchan);
+		wchan_wakeall(sfs_throttlewchan);
+		spinlock_release(&sfs_buflock);
+	}
+}
+
+void
+sfs_bthrottle(void)
+{
+	spinlock_acquire(&sfs_buflock);
+	if (sfs_syncer && sfs_ndirty * 100 >= sfs_nbuf * sfs_dirtymax) {
+		/*
+		 * Wait once, until enough are written or the round
+		 * ends, so a round that cannot clean much (the disk
+		 * failing, say) does not hold the writer forever.
+		 */
+		sfs_bkick();
+		wchan_lock(sfs_throttlewchan);
+		spinlock_release(&sfs_buflock);
+		wchan_sleep(sfs_throttlewchan);
+		return;
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+void
+sfs_bmount(struct sfs_fs *sfs)
+{
+	spinlock_acquire(&sfs_buflock);
+	sfs->sfs_syncnext = sfs_syncvols;
+	sfs_syncvols = sfs;
+	spinlock_release(&sfs_buflock);
+}
+
+int
+sfs_bsyncset(unsigned delay, unsigned age, unsigned bg, unsigned max)
+{
+	if (delay == 0 || bg == 0 || bg > max || max > 100) {
+		return EINVAL;
+	}
+	spinlock_acquire(&sfs_buflock);
+	sfs_syncdelay = delay;
+	sfs_syncage = age;
+	sfs_dirtybg = bg;
+	sfs_dirtymax = max;
+	spinlock_release(&sfs_buflock);
+	return 0;
+}
+
+void
+sfs_bsyncprint(void)
+{
+	unsigned delay, age, bg, max, ndirty, nbuf;
+
+	spinlock_acquire(&sfs_buflock);
+	delay = sfs_syncdelay;
+	age = sfs_syncage;
+	bg = sfs_dirtybg;
+	max = sfs_dirtymax;
+	ndirty = sfs_ndirty;
+	nbuf = sfs_nbuf;
+	spinlock_release(&sfs_buflock);
+
+	kprintf("SFS syncer: every %u s, buffers dirty %u s or more\n",
+		delay, age);
+	kprintf("    full round at %u%% dirty, writers wait at %u%%\n",
+		bg, max);
+	kprintf("    %u of %u buffers dirty\n", ndirty, nbuf);
+}
+
+void
+sfs_bprefetch(struct sfs_fs *sfs, uint32_t block)
+{
+	KASSERT(block < sfs->sfs_super.sp_nblocks);
+
+	spinlock_acquire(&sfs_buflock);
+	if (sfs_pfthread && sfs_pfcount < SFS_NPREFETCH &&
+	    sfs_blookup(sfs->sfs_device, block) == NULL) {
+		sfs_pfring[(sfs_pfhead + sfs_pfcount) % SFS_NPREFETCH] =
+			(struct sfs_prefetch){ sfs, block };
+		sfs_pfcount++;
+		wchan_wakeone(sfs_pfwchan);
+	}
+	spinlock_release(&sfs_buflock);
+}
+
+int
+sfs_bflush(struct sfs_fs *sfs)
+{
+	struct device *dev = sfs->sfs_device;
+	struct sfs_buf *b, *lowest, *pick;
+	uint32_t next = 0;
+	int result, err = 0;
+
+	/*
+	 * Write out one dirty buffer of ours each time round, so that
+	 * the list can change while we sleep in I/O: the one with the
+	 * lowest block from NEXT on, or if there is none the lowest of
+	 * all, so that the writes (the inodes sfs_syncinodes has just
+	 * put in their buffers among them) go out in one sweep across
+	 * the disk rather than in the order they were dirtied. A block
+	 * that will not write even after sfs_rwblock's retries is given
+	 * up on, so that the loop ends. Pinned buffers are the journal's.
+	 */
+	spinlock_acquire(&sfs_buflock);
+	while (1) {
+		lowest = pick = NULL;
+		for (b = sfs_dirtyhead; b != NULL; b = b->sb_dirtynext) {
+			if (b->sb_dev != dev || b->sb_meta) {
+				continue;
+			}
+			if (lowest == NULL || b->sb_block < lowest->sb_block) {
+				lowest = b;
+			}
+			if (b->sb_block >= next &&
+			    (pick == NULL || b->sb_block < pick->sb_block)) {
+				pick = b;
+			}
+		}
+		b = pick != NULL ? pick : lowest;
+		if (b == NULL) {
+			break;
+		}
+		next = b->sb_block + 1;
+		sfs_bhold(b);
+		spinlock_release(&sfs_buflock);
+
+		lock_acquire(b->sb_lock);
+		result = b->sb_dirty && !b->sb_meta ? sfs_bwrite(b) : 0;
+		if (result) {
+			kprintf("sfs: %s: block %u lost on write-back\n",
+				sfs->sfs_super.sp_volname, b->sb_block);
+			sfs_binval(b);
+			err = result;
+		}
+		lock_release(b->sb_lock);
+
+		spinlock_acquire(&sfs_buflock);
+		sfs_bunhold(b);
+	}
+	spinlock_release(&sfs_buflock);
+	return err;
+}
+
+unsigned
+sfs_bmetablocks(struct sfs_fs *sfs, uint32_t *blocks, unsigned max)
+{
+	struct device *dev = sfs->sfs_device;
+	struct sfs_buf *b;
+	unsigned n = 0;
+
+	spinlock_acquire(&sfs_buflock);
+	for (b = sfs_dirtyhead; b != NULL; b = b->sb_dirtynext) {
+		if (b->sb_dev == dev && b->sb_meta) {
+			if (n < max) {
+				blocks[n] = b->sb_block;
+			}
+			n++;
+		}
+	}
+	spinlock_release(&sfs_buflock);
+	return n;
+}
+
+int
+sfs_bwriteout(struct sfs_buf *b)
+{
+	KASSERT(lock_do_i_hold(b->sb_lock));
+	return b->sb_dirty ? sfs_bwrite(b) : 0;
+}
+
+void
+sfs_bdrop(struct sfs_fs *sfs)
+{
+	struct device *dev = sfs->sfs_device;
+	struct sfs_fs **pp;
+	unsigned i, j, n;
+
+	spinlock_acquire(&sfs_buflock);
+
+	/*
+	 * Take our readahead off the ring, and wait out any under way,
+	 * and any round of the syncer, which may hold our buffers.
+	 */
+	n = sfs_pfcount;
+	sfs_pfcount = 0;
+	for (i=0; i<n; i++) {
+		j = (sfs_pfhead + i) % SFS_NPREFETCH;
+		if (sfs_pfring[j].pf_sfs != sfs) {
+			sfs_pfring[(sfs_pfhead + sfs_pfcount) % SFS_NPREFETCH]
+				= sfs_pfring[j];
+			sfs_pfcount++;
+		}
+	}
+	while (sfs_pfbusy == sfs || sfs_syncing) {
+		wchan_lock(sfs_bgdonewchan);
+		spinlock_release(&sfs_buflock);
+		wchan_sleep(sfs_bgdonewchan);
+		spinlock_acquire(&sfs_buflock);
+	}
+
+	/* and off the syncer's list, if sfs_bmount put it there */
+	for (pp = &sfs_syncvols; *pp != NULL; pp = &(*pp)->sfs_syncnext) {
+		if (*pp == sfs) {
+			*pp = sfs->sfs_syncnext;
+			break;
+		}
+	}
+
+	for (i=0; i<sfs_nbuf; i++) {
+		if (sfs_bufs[i].sb_dev == dev) {
+			KASSERT(sfs_bufs[i].sb_refcount == 0);
+			KASSERT(!sfs_bufs[i].sb_dirty);
+			sfs_hash_remove(&sfs_bufs[i]);
+		}
+	}
+	spinlock_release(&sfs_buflock);
+}
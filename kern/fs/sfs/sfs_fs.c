@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <array.h>
 #include <bitmap.h>
+#include <synch.h>
 #include <uio.h>
 #include <vfs.h>
 #include <device.h>
@@ -49,8 +50,9 @@
 
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * Reading does the whole bitmap at once; writing does only the blocks
+ * marked in sfs_mapdirty, each unmarked once it is out, so a sync
+ * after a few allocations costs a write or two and not the whole map.
  *
  * The free block bitmap consists of SFS_BITBLOCKS 512-byte sectors of
  * bits, one bit for each sector on the filesystem. The number of
@@ -65,7 +67,6 @@
  * likewise marked in use by mksfs.
  */
 
-static
 int
 sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 {
@@ -89,8 +90,14 @@ sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 		if (rw == UIO_READ) {
 			result = sfs_rblock(sfs, ptr, SFS_MAP_LOCATION+j);
 		}
-		else {
+		else if (bitmap_isset(sfs->sfs_mapdirty, j)) {
 			result = sfs_wblock(sfs, ptr, SFS_MAP_LOCATION+j);
+			if (result == 0) {
+				bitmap_unmark(sfs->sfs_mapdirty, j);
+			}
+		}
+		else {
+			result = 0;
 		}
 
 		/* If we failed, stop. */
@@ -111,11 +118,8 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs; 
-	unsigned i, num;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -148,18 +152,45 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+	if (sfs->sfs_jblocks > 0) {
+		/*
+		 * Data first, so that no committed inode points at
+		 * blocks not yet written, and then the metadata, the
+		 * freemap included, as one commit.
+		 */
+		result = sfs_bflush(sfs);
+		if (result) {
+			return result;
+		}
+		result = sfs_jcommit(sfs);
+		if (result) {
+			return result;
+		}
 	}
+	else {
+		/* Write the loaded inodes to their buffers */
+		result = sfs_syncinodes(sfs);
+		if (result) {
+			return result;
+		}
 
-	/* If the free block map needs to be written, write it. */
-	if (sfs->sfs_freemapdirty) {
+		/* and flush those, and whatever else is dirty */
+		result = sfs_bflush(sfs);
+		if (result) {
+			return result;
+		}
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
+
+	/*
+	 * If the free block map needs to be written, write it. (With
+	 * a journal, only a commit writes it.)
+	 */
+	if (sfs->sfs_jblocks == 0 && sfs->sfs_freemapdirty) {
 		result = sfs_mapio(sfs, UIO_WRITE);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
@@ -169,13 +200,13 @@ sfs_sync(struct fs *fs)
 	if (sfs->sfs_superdirty) {
 		result = sfs_wblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
 
-	vfs_biglock_release();
+	lock_release(sfs->sfs_freemaplock);
 	return 0;
 }
 
@@ -189,13 +220,9 @@ const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
 
-	vfs_biglock_acquire();
-	ret = sfs->sfs_super.sp_volname;
-	vfs_biglock_release();
-
-	return ret;
+	/* The superblock is read-only once mounted. */
+	return sfs->sfs_super.sp_volname;
 }
 
 /*
@@ -209,21 +236,31 @@ sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
 
-	vfs_biglock_acquire();
-	
-	/* Do we have any files open? If so, can't unmount. */
-	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
-		vfs_biglock_release();
+	/*
+	 * Do we have any files open? If so, can't unmount. The VFS
+	 * layer holds vfs_biglock, so nobody can find the filesystem
+	 * to open anything new while we tear it down.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	sfs_vnevict(sfs, 0);
+	if (sfs->sfs_nvnodes > 0) {
+		lock_release(sfs->sfs_vnlock);
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
+	shrinker_unregister(&sfs->sfs_shrinker);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
 	/* Once we start nuking stuff we can't fail. */
-	vnodearray_destroy(sfs->sfs_vnodes);
+	sfs_bdrop(sfs);
+	sfs_jdestroy(sfs);
+	bitmap_destroy(sfs->sfs_mapdirty);
 	bitmap_destroy(sfs->sfs_freemap);
+	lock_destroy(sfs->sfs_freemaplock);
+	lock_destroy(sfs->sfs_vnlock);
 	
 	/* The vfs layer takes care of the device for us */
 	(void)sfs->sfs_device;
@@ -232,7 +269,6 @@ sfs_unmount(struct fs *fs)
 	kfree(sfs);
 
 	/* nothing else to do */
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -256,8 +292,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
 	struct sfs_fs *sfs;
-
-	vfs_biglock_acquire();
+	unsigned i;
 
 	/* We don't pass any options through mount */
 	(void)options;
@@ -278,24 +313,28 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	 * don't do that in sfs.)
 	 */
 	if (dev->d_blocksize != SFS_BLOCKSIZE) {
-		vfs_biglock_release();
 		return ENXIO;
 	}
 
+	/* The buffer cache is made at the first mount. */
+	result = sfs_bufinit();
+	if (result) {
+		return result;
+	}
+
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
 	if (sfs==NULL) {
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 
-	/* Allocate array */
-	sfs->sfs_vnodes = vnodearray_create();
-	if (sfs->sfs_vnodes == NULL) {
-		kfree(sfs);
-		vfs_biglock_release();
-		return ENOMEM;
+	/* No vnodes loaded */
+	for (i=0; i<SFS_VNHASH; i++) {
+		sfs->sfs_vnhash[i] = NULL;
 	}
+	sfs->sfs_nvnodes = 0;
+	sfs->sfs_vnlru = sfs->sfs_vnlrutail = NULL;
+	sfs->sfs_nparked = 0;
 
 	/* Set the device so we can use sfs_rblock() */
 	sfs->sfs_device = dev;
@@ -303,9 +342,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Load superblock */
 	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 	if (result) {
-		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -316,9 +353,15 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			"(0x%x, should be 0x%x)\n", 
 			sfs->sfs_super.sp_magic,
 			SFS_MAGIC);
-		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
-		vfs_biglock_release();
+		return EINVAL;
+	}
+
+	if (sfs->sfs_super.sp_version > SFS_VERSION) {
+		kprintf("sfs: Unknown version %u in superblock "
+			"(the newest known is %u)\n",
+			sfs->sfs_super.sp_version, SFS_VERSION);
+		kfree(sfs);
 		return EINVAL;
 	}
 	
@@ -330,22 +373,53 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_super.sp_volname[sizeof(sfs->sfs_super.sp_volname)-1] = 0;
 
+	/* Set up the journal, replaying it if need be, before reading on */
+	result = sfs_jmount(sfs);
+	if (result) {
+		kfree(sfs);
+		return result;
+	}
+
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
-		vnodearray_destroy(sfs->sfs_vnodes);
+		sfs_jdestroy(sfs);
 		kfree(sfs);
-		vfs_biglock_release();
 		return ENOMEM;
 	}
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
 		bitmap_destroy(sfs->sfs_freemap);
-		vnodearray_destroy(sfs->sfs_vnodes);
+		sfs_jdestroy(sfs);
 		kfree(sfs);
-		vfs_biglock_release();
 		return result;
 	}
+	sfs->sfs_mapdirty = bitmap_create(SFS_FS_BITBLOCKS(sfs));
+	if (sfs->sfs_mapdirty == NULL) {
+		bitmap_destroy(sfs->sfs_freemap);
+		sfs_jdestroy(sfs);
+		kfree(sfs);
+		return ENOMEM;
+	}
+
+	/* Nobody can see the filesystem yet, so these can come last. */
+	sfs->sfs_vnlock = lock_create("sfs_vnlock");
+	if (sfs->sfs_vnlock == NULL) {
+		bitmap_destroy(sfs->sfs_mapdirty);
+		bitmap_destroy(sfs->sfs_freemap);
+		sfs_jdestroy(sfs);
+		kfree(sfs);
+		return ENOMEM;
+	}
+	sfs->sfs_freemaplock = lock_create("sfs_freemaplock");
+	if (sfs->sfs_freemaplock == NULL) {
+		lock_destroy(sfs->sfs_vnlock);
+		bitmap_destroy(sfs->sfs_mapdirty);
+		bitmap_destroy(sfs->sfs_freemap);
+		sfs_jdestroy(sfs);
+		kfree(sfs);
+		return ENOMEM;
+	}
 
 	/* Set up abstract fs calls */
 	sfs->sfs_absfs.fs_sync = sfs_sync;
@@ -358,10 +432,16 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	sfs->sfs_superdirty = false;
 	sfs->sfs_freemapdirty = false;
 
+	/* Let the syncer at it, and give back memory when short */
+	sfs_bmount(sfs);
+	sfs->sfs_shrinker.sh_name = "sfs_vnodes";
+	sfs->sfs_shrinker.sh_shrink = sfs_vnshrink;
+	sfs->sfs_shrinker.sh_data = sfs;
+	shrinker_register(&sfs->sfs_shrinker);
+
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -374,3 +454,12 @@ sfs_mount(const char *device)
 {
 	return vfs_mount(device, NULL, sfs_domount);
 }
+
+/*
+ * The same, but not until the volume is first used.
+ */
+int
+sfs_mountlazy(const char *device)
+{
+	return vfs_mountlazy(device, NULL, sfs_domount);
+}
@@ -50,7 +50,7 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	int result;
 	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	/* No lock here; the device serializes its own requests. */
 
 	DEBUG(DB_SFS, "sfs: %s %llu\n", 
 	      uio->uio_rw == UIO_READ ? "read" : "write",
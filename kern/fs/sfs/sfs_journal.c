@@ -0,0 +1,546 @@
+/*
+ * SFS metadata journal.
+ *
+ * The on-disk format is in kern/sfs.h and the interface in sfs.h.
+ *
+ * Between commits, metadata changes only dirty (and pin) buffers in
+ * the cache, and freed blocks are collected in sfs_jfreed rather than
+ * cleared in the freemap. A commit:
+ *
+ *     1. waits for the handles open to be closed, and keeps new ones
+ *        waiting until it is done;
+ *     2. copies each loaded inode into its buffer (sfs_syncinodes) and
+ *        clears in the freemap the blocks freed since the last commit;
+ *     3. makes a record of the pinned buffers and the changed freemap
+ *        blocks, and writes the copies and then the rest of the header
+ *        to the journal, and block 0 of the header last: once that is
+ *        out, the record is what replay will find;
+ *     4. writes each block in place, and then the header again, with
+ *        no blocks, so nothing is replayed over later changes.
+ * A failure before the end of 4 leaves the buffers and freemap blocks
+ * not written still dirty, so the next commit has them all again.
+ *
+ * The superblock does not change while mounted except for its volume
+ * name being fixed up, so it is not journaled; it is written in place
+ * after the commit, as before.
+ *
+ * Commits are numbered, sfs_jgen counting those that have got past
+ * step 1, so a change made inside a handle goes in commit sfs_jgen+1;
+ * a vnode notes which one its size and block pointers last did, so
+ * that fdatasync can tell if it needs one at all. Whoever wants a
+ * commit that is not done yet waits while another is being written,
+ * and all those who were waiting then share the next one, done by
+ * whichever of them gets there first; so however many threads fsync
+ * at once, they cost about two commits rather than one each.
+ *
+ * sfs_jlock covers sfs_jactive, sfs_jcommitting, sfs_jgen and
+ * sfs_jdone; the rest of the journal state belongs to the one commit
+ * under way. A thread inside
+ * a handle, or doing a commit, has curthread->t_jnest set, so that a
+ * vnode reclaimed along the way (which takes a handle of its own) does
+ * not wait for a commit that is waiting for it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <uio.h>
+#include <sfs.h>
+
+/* Pinned buffers on one volume before sfs_jbegin commits first */
+#define SFS_JHIGH	(SFS_NBUF / 4)
+
+/*
+ * Add WORDS to SUM as the checksum in kern/sfs.h does.
+ */
+static
+uint32_t
+sfs_jsum(uint32_t sum, const uint32_t *words, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		sum = ((sum << 1) | (sum >> 31)) + words[i];
+	}
+	return sum;
+}
+
+/*
+ * Write the header, HDRBLOCKS blocks long: the blocks after the first,
+ * and then the first.
+ */
+static
+int
+sfs_jwritehdr(struct sfs_fs *sfs, unsigned hdrblocks)
+{
+	char *hdr = (char *)sfs->sfs_jhdr;
+	unsigned i;
+	int result;
+
+	for (i=hdrblocks; i-- > 0; ) {
+		result = sfs_wblock(sfs, hdr + i*SFS_BLOCKSIZE,
+				    sfs->sfs_jstart + i);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Mark the journal empty.
+ */
+static
+int
+sfs_jclear(struct sfs_fs *sfs)
+{
+	struct sfs_jheader *jh = (struct sfs_jheader *)sfs->sfs_jhdr;
+
+	bzero(jh, SFS_BLOCKSIZE);
+	jh->jh_magic = SFS_JMAGIC;
+	jh->jh_seq = sfs->sfs_jseq;
+	jh->jh_nblocks = 0;
+	return sfs_wblock(sfs, jh, sfs->sfs_jstart);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Mount and unmount
+
+/*
+ * Replay the record in the journal, if there is a whole one. One that
+ * is not (a commit cut off partway) is thrown away: none of it has
+ * been put in place yet.
+ */
+static
+int
+sfs_jreplay(struct sfs_fs *sfs)
+{
+	struct sfs_jheader *jh = (struct sfs_jheader *)sfs->sfs_jhdr;
+	uint32_t *list = (uint32_t *)(jh + 1);
+	const char *volname = sfs->sfs_super.sp_volname;
+	uint32_t n, hdrblocks, sum, i;
+	int result;
+
+	result = sfs_rblock(sfs, jh, sfs->sfs_jstart);
+	if (result) {
+		return result;
+	}
+	if (jh->jh_magic != SFS_JMAGIC) {
+		kprintf("sfs: %s: journal header is bad; ignoring it\n",
+			volname);
+		sfs->sfs_jseq = 0;
+		return sfs_jclear(sfs);
+	}
+	sfs->sfs_jseq = jh->jh_seq + 1;
+	n = jh->jh_nblocks;
+	if (n == 0) {
+		return 0;
+	}
+
+	hdrblocks = SFS_JHDRBLOCKS(n);
+	if (n > sfs->sfs_jblocks || hdrblocks + n > sfs->sfs_jblocks) {
+		goto discard;
+	}
+	for (i=1; i<hdrblocks; i++) {
+		result = sfs_rblock(sfs, (char *)jh + i*SFS_BLOCKSIZE,
+				    sfs->sfs_jstart + i);
+		if (result) {
+			return result;
+		}
+	}
+	for (i=0; i<n; i++) {
+		/* only blocks a commit would have put there */
+		if (list[i] == SFS_SB_LOCATION ||
+		    list[i] >= sfs->sfs_super.sp_nblocks ||
+		    (list[i] >= sfs->sfs_jstart &&
+		     list[i] < sfs->sfs_jstart + sfs->sfs_jblocks)) {
+			goto discard;
+		}
+	}
+
+	/* check all of it before writing any of it */
+	sum = sfs_jsum(0, &jh->jh_seq, 2);
+	sum = sfs_jsum(sum, list, n);
+	for (i=0; i<n; i++) {
+		result = sfs_rblock(sfs, sfs->sfs_jbuf,
+				    sfs->sfs_jstart + hdrblocks + i);
+		if (result) {
+			return result;
+		}
+		sum = sfs_jsum(sum, sfs->sfs_jbuf,
+			       SFS_BLOCKSIZE / sizeof(uint32_t));
+	}
+	if (sum != jh->jh_checksum) {
+		goto discard;
+	}
+
+	for (i=0; i<n; i++) {
+		result = sfs_rblock(sfs, sfs->sfs_jbuf,
+				    sfs->sfs_jstart + hdrblocks + i);
+		if (result == 0) {
+			result = sfs_wblock(sfs, sfs->sfs_jbuf, list[i]);
+		}
+		if (result) {
+			return result;
+		}
+	}
+	kprintf("sfs: %s: replayed %u blocks from the journal\n",
+		volname, n);
+	return sfs_jclear(sfs);
+
+ discard:
+	kprintf("sfs: %s: discarding an incomplete journal record\n",
+		volname);
+	return sfs_jclear(sfs);
+}
+
+void
+sfs_jdestroy(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_jfreed != NULL) {
+		KASSERT(sfs->sfs_jnfreed == 0);
+		bitmap_destroy(sfs->sfs_jfreed);
+		sfs->sfs_jfreed = NULL;
+	}
+	if (sfs->sfs_jcv != NULL) {
+		cv_destroy(sfs->sfs_jcv);
+		sfs->sfs_jcv = NULL;
+	}
+	if (sfs->sfs_jlock != NULL) {
+		lock_destroy(sfs->sfs_jlock);
+		sfs->sfs_jlock = NULL;
+	}
+	kfree(sfs->sfs_jbuf);
+	kfree(sfs->sfs_jhdr);
+	sfs->sfs_jbuf = NULL;
+	sfs->sfs_jhdr = NULL;
+	sfs->sfs_jblocks = 0;
+}
+
+int
+sfs_jmount(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	uint32_t bitblocks = SFS_BITBLOCKS(sp->sp_nblocks);
+	uint32_t maxrecord;
+	int result;
+
+	sfs->sfs_jstart = sfs->sfs_jblocks = 0;
+	sfs->sfs_jseq = 0;
+	sfs->sfs_jhdr = NULL;
+	sfs->sfs_jbuf = NULL;
+	sfs->sfs_jnmeta = 0;
+	sfs->sfs_jfreed = NULL;
+	sfs->sfs_jnfreed = 0;
+	sfs->sfs_jlock = NULL;
+	sfs->sfs_jcv = NULL;
+	sfs->sfs_jactive = 0;
+	sfs->sfs_jcommitting = false;
+	sfs->sfs_jgen = sfs->sfs_jdone = 0;
+
+	if (sp->sp_version < 2 || sp->sp_jblocks == 0) {
+		return 0;
+	}
+	if (sp->sp_jstart < SFS_MAP_LOCATION + bitblocks ||
+	    sp->sp_jblocks < 2 || sp->sp_jblocks > sp->sp_nblocks ||
+	    sp->sp_jstart > sp->sp_nblocks - sp->sp_jblocks) {
+		kprintf("sfs: %s: journal at %u (%u blocks) is out of "
+			"place\n", sp->sp_volname, sp->sp_jstart,
+			sp->sp_jblocks);
+		return EINVAL;
+	}
+	sfs->sfs_jstart = sp->sp_jstart;
+	sfs->sfs_jblocks = sp->sp_jblocks;
+
+	sfs->sfs_jhdr = kmalloc(SFS_JHDRBLOCKS(sfs->sfs_jblocks) *
+				SFS_BLOCKSIZE);
+	sfs->sfs_jbuf = kmalloc(SFS_BLOCKSIZE);
+	if (sfs->sfs_jhdr == NULL || sfs->sfs_jbuf == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+
+	result = sfs_jreplay(sfs);
+	if (result) {
+		goto fail;
+	}
+
+	/*
+	 * The biggest record is every buffer pinned and every freemap
+	 * block changed. If that would not fit, go without.
+	 */
+	maxrecord = SFS_NBUF + bitblocks;
+	if (SFS_JHDRBLOCKS(maxrecord) + maxrecord > sfs->sfs_jblocks) {
+		kprintf("sfs: %s: journal of %u blocks is too small; "
+			"not using it\n", sp->sp_volname, sfs->sfs_jblocks);
+		sfs_jdestroy(sfs);
+		return 0;
+	}
+
+	sfs->sfs_jfreed = bitmap_create(SFS_BITMAPSIZE(sp->sp_nblocks));
+	sfs->sfs_jlock = lock_create("sfs_jlock");
+	sfs->sfs_jcv = cv_create("sfs_jcv");
+	if (sfs->sfs_jfreed == NULL || sfs->sfs_jlock == NULL ||
+	    sfs->sfs_jcv == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+	return 0;
+
+ fail:
+	sfs_jdestroy(sfs);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Handles
+
+void
+sfs_jbegin(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_jblocks == 0) {
+		return;
+	}
+	if (curthread->t_jnest > 0) {
+		curthread->t_jnest++;
+		return;
+	}
+
+	/* (errors are left for the next commit to have another go at) */
+	if (sfs->sfs_jnmeta >= SFS_JHIGH) {
+		(void)sfs_jcommit(sfs);
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	while (sfs->sfs_jcommitting) {
+		cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	sfs->sfs_jactive++;
+	lock_release(sfs->sfs_jlock);
+	curthread->t_jnest = 1;
+}
+
+void
+sfs_jend(struct sfs_fs *sfs)
+{
+	if (sfs->sfs_jblocks == 0) {
+		return;
+	}
+	KASSERT(curthread->t_jnest > 0);
+	if (--curthread->t_jnest > 0) {
+		return;
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	KASSERT(sfs->sfs_jactive > 0);
+	if (--sfs->sfs_jactive == 0) {
+		cv_broadcast(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	lock_release(sfs->sfs_jlock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Commit
+
+/*
+ * Steps 2 through 4 above, with the handles held off.
+ */
+static
+int
+sfs_jdocommit(struct sfs_fs *sfs)
+{
+	struct sfs_jheader *jh = (struct sfs_jheader *)sfs->sfs_jhdr;
+	uint32_t *list = (uint32_t *)(jh + 1);
+	uint32_t bitblocks = SFS_BITBLOCKS(sfs->sfs_super.sp_nblocks);
+	char *mapdata;
+	struct sfs_buf *b;
+	uint32_t sum, block, hdrblocks;
+	unsigned nmeta, n, i, j;
+	int result, err;
+
+	result = sfs_syncinodes(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* What goes in the record: the pinned buffers, in block order */
+	nmeta = sfs_bmetablocks(sfs, list, SFS_NBUF);
+	KASSERT(nmeta <= SFS_NBUF);
+	for (i=1; i<nmeta; i++) {
+		block = list[i];
+		for (j=i; j>0 && list[j-1] > block; j--) {
+			list[j] = list[j-1];
+		}
+		list[j] = block;
+	}
+
+	/* and the freemap blocks changed, with the frees put in */
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs_bfreeheld(sfs);
+	n = nmeta;
+	if (sfs->sfs_freemapdirty) {
+		for (j=0; j<bitblocks; j++) {
+			if (bitmap_isset(sfs->sfs_mapdirty, j)) {
+				list[n++] = SFS_MAP_LOCATION + j;
+			}
+		}
+	}
+	lock_release(sfs->sfs_freemaplock);
+
+	if (n == 0) {
+		return 0;
+	}
+	hdrblocks = SFS_JHDRBLOCKS(n);
+	KASSERT(hdrblocks + n <= sfs->sfs_jblocks);
+
+	jh->jh_magic = SFS_JMAGIC;
+	jh->jh_seq = sfs->sfs_jseq;
+	jh->jh_nblocks = n;
+	sum = sfs_jsum(0, &jh->jh_seq, 2);
+	sum = sfs_jsum(sum, list, n);
+
+	/* Step 3: the copies, from the cache and the freemap */
+	for (i=0; i<nmeta; i++) {
+		result = sfs_bget(sfs, list[i], true, &b);
+		if (result) {
+			return result;
+		}
+		sum = sfs_jsum(sum, sfs_bdata(b),
+			       SFS_BLOCKSIZE / sizeof(uint32_t));
+		result = sfs_wblock(sfs, sfs_bdata(b),
+				    sfs->sfs_jstart + hdrblocks + i);
+		sfs_bput(b);
+		if (result) {
+			return result;
+		}
+	}
+	lock_acquire(sfs->sfs_freemaplock);
+	mapdata = bitmap_getdata(sfs->sfs_freemap);
+	for (; i<n; i++) {
+		j = list[i] - SFS_MAP_LOCATION;
+		sum = sfs_jsum(sum, (uint32_t *)(mapdata + j*SFS_BLOCKSIZE),
+			       SFS_BLOCKSIZE / sizeof(uint32_t));
+		result = sfs_wblock(sfs, mapdata + j*SFS_BLOCKSIZE,
+				    sfs->sfs_jstart + hdrblocks + i);
+		if (result) {
+			lock_release(sfs->sfs_freemaplock);
+			return result;
+		}
+	}
+	lock_release(sfs->sfs_freemaplock);
+
+	jh->jh_checksum = sum;
+	result = sfs_jwritehdr(sfs, hdrblocks);
+	if (result) {
+		return result;
+	}
+	sfs->sfs_jseq++;
+
+	/*
+	 * Step 4. If any of it fails, the record stays, for the next
+	 * mount to replay if need be, until a later commit replaces it.
+	 */
+	err = 0;
+	for (i=0; i<nmeta; i++) {
+		result = sfs_bget(sfs, list[i], true, &b);
+		if (result == 0) {
+			result = sfs_bwriteout(b);
+			sfs_bput(b);
+		}
+		if (result) {
+			err = result;
+		}
+	}
+	lock_acquire(sfs->sfs_freemaplock);
+	result = sfs_mapio(sfs, UIO_WRITE);
+	if (result) {
+		err = result;
+	}
+	else {
+		sfs->sfs_freemapdirty = false;
+	}
+	lock_release(sfs->sfs_freemaplock);
+	if (err) {
+		return err;
+	}
+
+	return sfs_jclear(sfs);
+}
+
+unsigned
+sfs_jnext(struct sfs_fs *sfs)
+{
+	/* No commit gets past step 1 while we are in a handle. */
+	KASSERT(sfs->sfs_jblocks == 0 || curthread->t_jnest > 0);
+	return sfs->sfs_jgen + 1;
+}
+
+int
+sfs_jcommitto(struct sfs_fs *sfs, unsigned gen)
+{
+	unsigned mygen;
+	int result;
+
+	if (sfs->sfs_jblocks == 0) {
+		return 0;
+	}
+	KASSERT(curthread->t_jnest == 0);
+
+	/* Step 1, unless someone else does it for us */
+	lock_acquire(sfs->sfs_jlock);
+	while (1) {
+		if ((int)(sfs->sfs_jdone - gen) >= 0) {
+			lock_release(sfs->sfs_jlock);
+			return 0;
+		}
+		if (!sfs->sfs_jcommitting) {
+			break;
+		}
+		cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	sfs->sfs_jcommitting = true;
+	while (sfs->sfs_jactive > 0) {
+		cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	mygen = ++sfs->sfs_jgen;
+	KASSERT((int)(mygen - gen) >= 0);
+	lock_release(sfs->sfs_jlock);
+
+	curthread->t_jnest = 1;
+	result = sfs_jdocommit(sfs);
+	curthread->t_jnest = 0;
+
+	/* (if it failed, those waiting for it each have another go) */
+	lock_acquire(sfs->sfs_jlock);
+	if (result == 0) {
+		sfs->sfs_jdone = mygen;
+	}
+	sfs->sfs_jcommitting = false;
+	cv_broadcast(sfs->sfs_jcv, sfs->sfs_jlock);
+	lock_release(sfs->sfs_jlock);
+	return result;
+}
+
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	unsigned gen;
+
+	if (sfs->sfs_jblocks == 0) {
+		return 0;
+	}
+
+	/* The next commit to get past step 1 has all that is done so far. */
+	lock_acquire(sfs->sfs_jlock);
+	gen = sfs->sfs_jgen + 1;
+	lock_release(sfs->sfs_jlock);
+
+	return sfs_jcommitto(sfs, gen);
+}
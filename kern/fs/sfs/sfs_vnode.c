@@ -35,20 +35,36 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/ioctl.h>
 #include <stat.h>
 #include <lib.h>
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
+#include <copyinout.h>
 #include <synch.h>
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
+#include <pagecache.h>
+#include <kstat.h>
+
+/* Inodes found in memory, and read in, by sfs_loadvnode */
+static struct kstat sfs_vnhits = KSTAT_INITIALIZER("sfs.vnode_hits");
+static struct kstat sfs_vnloads = KSTAT_INITIALIZER("sfs.vnode_loads");
 
 /* At bottom of file */
 static int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int type,
 			 struct sfs_vnode **ret);
 
+/* With the vnode ops */
+static int sfs_dotruncate(struct sfs_vnode *sv, off_t len);
+
+/* With the directory I/O */
+static void sfs_dirhash_update(struct sfs_vnode *sv, int slot,
+			       const struct sfs_dir *sd);
+static void sfs_dirhash_destroy(struct sfs_vnode *sv);
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
@@ -58,54 +74,264 @@ static
 int
 sfs_clearblock(struct sfs_fs *sfs, uint32_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
-	return sfs_wblock(sfs, zeros, block);
+	struct sfs_buf *b;
+	int result;
+
+	result = sfs_bget(sfs, block, false, &b);
+	if (result) {
+		return result;
+	}
+	bzero(sfs_bdata(b), SFS_BLOCKSIZE);
+	sfs_bdirty(b);
+	sfs_bput(b);
+	return 0;
 }
 
-/* Write an on-disk inode structure back out to disk. */
+/*
+ * Write an on-disk inode structure back out to its buffer, from
+ * which the next flush writes it to disk. sv_lock held.
+ */
 static
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	if (sv->sv_dirty) {
 		struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-		int result = sfs_wblock(sfs, &sv->sv_i, sv->sv_ino);
+		struct sfs_buf *b;
+		int result;
+
+		result = sfs_bget(sfs, sv->sv_ino, false, &b);
 		if (result) {
 			return result;
 		}
+		memcpy(sfs_bdata(b), &sv->sv_i, sizeof(sv->sv_i));
+		sfs_bdirtymeta(b);
+		sfs_bput(b);
 		sv->sv_dirty = false;
 	}
 	return 0;
 }
 
+/*
+ * Note that SV's size, block pointers or inline data changed, in its
+ * inode if INODE is set, and so which commit fdatasync must wait for.
+ * sv_lock held, inside a journal handle on a volume with one.
+ */
+static
+void
+sfs_datachanged(struct sfs_vnode *sv, bool inode)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (inode) {
+		sv->sv_dirty = true;
+	}
+	sv->sv_jgen = sfs_jnext(sfs);
+}
+
+/*
+ * Write every loaded inode back to its buffer, as sfs_sync_inode.
+ * Syncing takes each vnode's sv_lock, which comes before sfs_vnlock,
+ * so take a referenced copy of the table and work from that. Stops at
+ * the first error, though the references are all dropped.
+ */
+int
+sfs_syncinodes(struct sfs_fs *sfs)
+{
+	struct vnodearray *snap;
+	struct sfs_vnode *sv;
+	unsigned i, j, num;
+	int result, err;
+
+	snap = vnodearray_create();
+	if (snap == NULL) {
+		return ENOMEM;
+	}
+	lock_acquire(sfs->sfs_vnlock);
+	num = sfs->sfs_nvnodes;
+	result = vnodearray_setsize(snap, num);
+	if (result) {
+		lock_release(sfs->sfs_vnlock);
+		vnodearray_destroy(snap);
+		return result;
+	}
+	j = 0;
+	for (i=0; i<SFS_VNHASH; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL; sv = sv->sv_hashnext) {
+			VOP_INCREF(&sv->sv_v);
+			vnodearray_set(snap, j++, &sv->sv_v);
+		}
+	}
+	KASSERT(j == num);
+	lock_release(sfs->sfs_vnlock);
+
+	err = 0;
+	for (i=0; i<num; i++) {
+		struct vnode *v = vnodearray_get(snap, i);
+
+		sv = v->vn_data;
+		if (err == 0) {
+			lock_acquire(sv->sv_lock);
+			err = sfs_sync_inode(sv);
+			lock_release(sv->sv_lock);
+		}
+		VOP_DECREF(v);
+	}
+	vnodearray_setsize(snap, 0);
+	vnodearray_destroy(snap);
+	return err;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Space allocation
 
 /*
- * Allocate a block.
+ * Note that the bit for DISKBLOCK has changed, so the block of the
+ * freemap it is in needs writing. sfs_freemaplock held.
+ */
+static
+void
+sfs_mapchanged(struct sfs_fs *sfs, uint32_t diskblock)
+{
+	unsigned mapblock = diskblock / SFS_BLOCKBITS;
+
+	if (!bitmap_isset(sfs->sfs_mapdirty, mapblock)) {
+		bitmap_mark(sfs->sfs_mapdirty, mapblock);
+	}
+	sfs->sfs_freemapdirty = true;
+}
+
+/*
+ * Allocate a block. If GOAL is not 0, prefer it, or the block after
+ * it or the start of a free run, so a file grows contiguously; GOAL is
+ * then usually one past the file's last block, or for a new inode the
+ * directory it goes in.
+ *
+ * The disk is divided into groups of SFS_BLOCKBITS blocks, those whose
+ * bits share a block of the freemap, and the goal's group is used up
+ * before looking past it. So an inode lands near its directory and
+ * its data near it, and a scan of a directory's files, or reading a
+ * small one, keeps the disk head in one place.
  */
 static
 int
-sfs_balloc(struct sfs_fs *sfs, uint32_t *diskblock)
+sfs_balloc(struct sfs_fs *sfs, uint32_t goal, uint32_t *diskblock)
 {
+	uint32_t lo;
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	if (goal != 0) {
+		/* (the map is a whole number of groups) */
+		lo = goal - goal % SFS_BLOCKBITS;
+		result = ENOSPC;
+		if (lo < SFS_BITMAPSIZE(sfs->sfs_super.sp_nblocks)) {
+			result = bitmap_alloc_range(sfs->sfs_freemap, lo,
+						    lo + SFS_BLOCKBITS,
+						    goal, diskblock);
+		}
+		if (result) {
+			result = bitmap_alloc_near(sfs->sfs_freemap, goal,
+						   diskblock);
+		}
+	}
+	else {
+		result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	}
 	if (result) {
+		lock_release(sfs->sfs_freemaplock);
 		return result;
 	}
-	sfs->sfs_freemapdirty = true;
+	sfs_mapchanged(sfs, *diskblock);
+	lock_release(sfs->sfs_freemaplock);
 
 	if (*diskblock >= sfs->sfs_super.sp_nblocks) {
 		panic("sfs: balloc: invalid block %u\n", *diskblock);
 	}
 
-	/* Clear block before returning it */
+	/* Clear block before returning it; nobody else can see it yet */
 	return sfs_clearblock(sfs, *diskblock);
 }
 
+/*
+ * Allocate a run of N blocks, for the defragmenter: from GOAL if they
+ * are all free there, or else the first free run long enough. Unlike
+ * sfs_balloc, the blocks are not cleared, as the caller writes every
+ * one of them before anything points to them.
+ */
+static
+int
+sfs_ballocrun(struct sfs_fs *sfs, uint32_t goal, uint32_t n,
+	      uint32_t *diskblock)
+{
+	uint32_t nblocks = sfs->sfs_super.sp_nblocks;
+	uint32_t i, mapblock;
+	int result = 0;
+
+	KASSERT(n > 0);
+
+	lock_acquire(sfs->sfs_freemaplock);
+	i = 0;
+	if (goal != 0 && goal + n <= nblocks) {
+		while (i < n && !bitmap_isset(sfs->sfs_freemap, goal + i)) {
+			i++;
+		}
+	}
+	if (i == n) {
+		bitmap_mark_run(sfs->sfs_freemap, goal, n);
+		*diskblock = goal;
+	}
+	else {
+		result = bitmap_alloc_run(sfs->sfs_freemap, n, diskblock);
+	}
+	if (result == 0 && *diskblock + n > nblocks) {
+		/* (the bits past the end are set, so this is not expected) */
+		bitmap_unmark_run(sfs->sfs_freemap, *diskblock, n);
+		result = ENOSPC;
+	}
+	if (result == 0) {
+		for (mapblock = *diskblock / SFS_BLOCKBITS;
+		     mapblock <= (*diskblock + n - 1) / SFS_BLOCKBITS;
+		     mapblock++) {
+			sfs_mapchanged(sfs, mapblock * SFS_BLOCKBITS);
+		}
+	}
+	lock_release(sfs->sfs_freemaplock);
+	return result;
+}
+
+/*
+ * Free the N blocks from DISKBLOCK. With a journal, they stay in use
+ * until the next commit (sfs_bfreeheld), so that they are not given
+ * out again, and written to, while what is on disk may still point to
+ * them. sfs_freemaplock held.
+ */
+static
+void
+sfs_bfreerun(struct sfs_fs *sfs, uint32_t diskblock, uint32_t n)
+{
+	uint32_t mapblock;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+	KASSERT(n > 0);
+
+	if (sfs->sfs_jfreed != NULL) {
+		bitmap_mark_run(sfs->sfs_jfreed, diskblock, n);
+		sfs->sfs_jnfreed += n;
+		return;
+	}
+	bitmap_unmark_run(sfs->sfs_freemap, diskblock, n);
+	for (mapblock = diskblock / SFS_BLOCKBITS;
+	     mapblock <= (diskblock + n - 1) / SFS_BLOCKBITS; mapblock++) {
+		sfs_mapchanged(sfs, mapblock * SFS_BLOCKBITS);
+	}
+}
+
 /*
  * Free a block.
  */
@@ -113,8 +339,90 @@ static
 void
 sfs_bfree(struct sfs_fs *sfs, uint32_t diskblock)
 {
-	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs_bfreerun(sfs, diskblock, 1);
+	lock_release(sfs->sfs_freemaplock);
+}
+
+/*
+ * Blocks a truncate is freeing, gathered up so that the freemap is
+ * locked once for many of them and each run of them is freed at once.
+ * None may be in a buffer the truncate holds.
+ */
+#define SFS_FREEBATCH	64
+
+struct sfs_freebatch {
+	uint32_t fb_blocks[SFS_FREEBATCH];
+	unsigned fb_n;
+};
+
+/*
+ * Free the blocks in FB. Their buffers, if any, are thrown away first:
+ * whatever was written to them since is dead and need not go to disk.
+ */
+static
+void
+sfs_fbflush(struct sfs_fs *sfs, struct sfs_freebatch *fb)
+{
+	uint32_t block;
+	unsigned i, j;
+
+	for (i=0; i<fb->fb_n; i++) {
+		sfs_bforget(sfs, fb->fb_blocks[i]);
+	}
+
+	/* in order, so runs are next to each other */
+	for (i=1; i<fb->fb_n; i++) {
+		block = fb->fb_blocks[i];
+		for (j=i; j>0 && fb->fb_blocks[j-1] > block; j--) {
+			fb->fb_blocks[j] = fb->fb_blocks[j-1];
+		}
+		fb->fb_blocks[j] = block;
+	}
+
+	lock_acquire(sfs->sfs_freemaplock);
+	for (i=0; i<fb->fb_n; i=j) {
+		for (j=i+1; j<fb->fb_n &&
+			     fb->fb_blocks[j] == fb->fb_blocks[j-1] + 1; j++) {
+			/* nothing */
+		}
+		sfs_bfreerun(sfs, fb->fb_blocks[i], j - i);
+	}
+	lock_release(sfs->sfs_freemaplock);
+	fb->fb_n = 0;
+}
+
+static
+void
+sfs_fbadd(struct sfs_fs *sfs, struct sfs_freebatch *fb, uint32_t block)
+{
+	if (fb->fb_n == SFS_FREEBATCH) {
+		sfs_fbflush(sfs, fb);
+	}
+	fb->fb_blocks[fb->fb_n++] = block;
+}
+
+/*
+ * Free the blocks sfs_bfree has held back, for a commit.
+ * sfs_freemaplock held.
+ */
+void
+sfs_bfreeheld(struct sfs_fs *sfs)
+{
+	uint32_t i;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	for (i=0; sfs->sfs_jnfreed > 0 && i < sfs->sfs_super.sp_nblocks;
+	     i++) {
+		if (bitmap_isset(sfs->sfs_jfreed, i)) {
+			bitmap_unmark(sfs->sfs_jfreed, i);
+			bitmap_unmark(sfs->sfs_freemap, i);
+			sfs_mapchanged(sfs, i);
+			sfs->sfs_jnfreed--;
+		}
+	}
+	KASSERT(sfs->sfs_jnfreed == 0);
 }
 
 /*
@@ -124,44 +432,68 @@ static
 int
 sfs_bused(struct sfs_fs *sfs, uint32_t diskblock)
 {
+	int result;
+
 	if (diskblock >= sfs->sfs_super.sp_nblocks) {
 		panic("sfs: sfs_bused called on out of range block %u\n", 
 		      diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	result = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return result;
 }
 
 ////////////////////////////////////////////////////////////
 //
 // Block mapping/inode maintenance
 
+/*
+ * The number of data blocks under an indirect block LEVELS deep: one
+ * for 0 (a data block itself), SFS_DBPERIDB for an indirect block,
+ * and so on.
+ */
+static
+uint32_t
+sfs_ispan(unsigned levels)
+{
+	uint32_t span = 1;
+
+	while (levels-- > 0) {
+		span *= SFS_DBPERIDB;
+	}
+	return span;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * allocated. If NEWBLOCK is not 0 and there is a block, the file is
+ * pointed at NEWBLOCK there instead, for the defragmenter, and the
+ * old one is handed back for the caller to free. sv_lock held.
  */
 static
 int
-sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
-	 uint32_t *diskblock)
+sfs_bmapset(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
+	    uint32_t newblock, uint32_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	/* The indirect block being looked in, in its buffer. */
+	struct sfs_buf *idb, *next;
+	uint32_t *idbuf;
 
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t origblock = fileblock;
 	uint32_t block;
 	uint32_t idblock;
-	uint32_t idnum, idoff;
+	uint32_t *root, *ptr;
+	uint32_t span, goal;
+	unsigned levels;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(SFS_DBPERIDB * sizeof(*idbuf) == SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+	KASSERT((sv->sv_i.sfi_flags & SFS_INODE_INLINE) == 0);
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -176,14 +508,23 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			/* Right after the block before, or the inode */
+			goal = sv->sv_ino;
+			if (fileblock > 0 && sv->sv_i.sfi_direct[fileblock-1]) {
+				goal = sv->sv_i.sfi_direct[fileblock-1];
+			}
+			result = sfs_balloc(sfs, goal + 1, &block);
 			if (result) {
 				return result;
 			}
 
 			/* Remember what we allocated; mark inode dirty */
 			sv->sv_i.sfi_direct[fileblock] = block;
-			sv->sv_dirty = true;
+			sfs_datachanged(sv, true);
+		}
+		else if (block != 0 && newblock != 0) {
+			sv->sv_i.sfi_direct[fileblock] = newblock;
+			sfs_datachanged(sv, true);
 		}
 
 		/*
@@ -198,95 +539,145 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * It's not a direct block; it must be under one of the indirect
+	 * blocks. Subtract off the number of direct blocks, and those
+	 * under each indirect block it is past, so FILEBLOCK is the
+	 * offset into the space under the one it is in.
 	 */
-
 	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+	for (levels=1; levels<=3; levels++) {
+		span = sfs_ispan(levels);
+		if (fileblock < span) {
+			break;
+		}
+		fileblock -= span;
+	}
 
 	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
+	 * Volumes from before double and triple indirect blocks keep
+	 * to the one indirect block. Past that, we can't handle it, so
+	 * fail.
 	 */
-	if (idnum > 0) {
+	if (levels > 3 ||
+	    (levels > 1 && sfs->sfs_super.sp_version == 0)) {
 		return EFBIG;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	root = levels == 1 ? &sv->sv_i.sfi_indirect :
+		levels == 2 ? &sv->sv_i.sfi_dindirect :
+		&sv->sv_i.sfi_tindirect;
 
-	if (idblock==0 && !doalloc) {
-		/*
-		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
-		 */
-		*diskblock = 0;
-		return 0;
-	}
-	else if (idblock==0) {
-		/*
-		 * There's no indirect block allocated, but we need to
-		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
-		 */
-		result = sfs_balloc(sfs, &idblock);
-		if (result) {
-			return result;
+	/*
+	 * Walk down from the inode, one indirect block at a time, each
+	 * held until the next is in hand; PTR is the entry in the one
+	 * above (or the inode) that points to the next one down. A
+	 * missing indirect block is as good as a block of zeros unless
+	 * we are to allocate, in which case it is made (sfs_balloc
+	 * clears it).
+	 *
+	 * Anything allocated goes after the block of the entry before
+	 * PTR, if there is one, else after the indirect block it is in
+	 * (or for the first, anything before it, the last direct block).
+	 */
+	ptr = root;
+	idb = NULL;
+	goal = sv->sv_i.sfi_direct[SFS_NDIRECT-1];
+	if (goal == 0) {
+		goal = sv->sv_ino;
+	}
+	for (; levels > 0; levels--) {
+		idblock = *ptr;
+		if (idblock == 0) {
+			if (!doalloc) {
+				if (idb != NULL) {
+					sfs_bput(idb);
+				}
+				*diskblock = 0;
+				return 0;
+			}
+			if (idb != NULL && ptr != idbuf && ptr[-1] != 0) {
+				goal = ptr[-1];
+			}
+			result = sfs_balloc(sfs, goal + 1, &idblock);
+			if (result) {
+				goto fail;
+			}
+			*ptr = idblock;
+			if (idb != NULL) {
+				sfs_bdirtymeta(idb);
+				sfs_datachanged(sv, false);
+			}
+			else {
+				sfs_datachanged(sv, true);
+			}
 		}
 
-		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
-
-		/* Mark the inode dirty */
-		sv->sv_dirty = true;
-
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
-	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_rblock(sfs, idbuf, idblock);
+		/* Load the indirect block, usually from the cache. */
+		result = sfs_bget(sfs, idblock, true, &next);
+		if (idb != NULL) {
+			sfs_bput(idb);
+		}
 		if (result) {
 			return result;
 		}
+		idb = next;
+		idbuf = sfs_bdata(idb);
+		goal = idblock;
+
+		/* and on to the entry under it that covers FILEBLOCK */
+		span = sfs_ispan(levels - 1);
+		ptr = &idbuf[fileblock / span];
+		fileblock %= span;
 	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	/* Get the block out of the last indirect block */
+	block = *ptr;
 
 	/* If there's no block there, allocate one */
 	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+		if (ptr != idbuf && ptr[-1] != 0) {
+			goal = ptr[-1];
+		}
+		result = sfs_balloc(sfs, goal + 1, &block);
 		if (result) {
-			return result;
+			goto fail;
 		}
 
 		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+		*ptr = block;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
-		}
+		/* The indirect block is now dirty */
+		sfs_bdirtymeta(idb);
+		sfs_datachanged(sv, false);
 	}
+	else if (block != 0 && newblock != 0) {
+		*ptr = newblock;
+		sfs_bdirtymeta(idb);
+		sfs_datachanged(sv, false);
+	}
+	sfs_bput(idb);
 
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
 		panic("sfs: Data block %u (block %u of file %u) marked free\n",
-		      block, fileblock, sv->sv_ino);
+		      block, origblock, sv->sv_ino);
 	}
 	*diskblock = block;
 	return 0;
+
+ fail:
+	if (idb != NULL) {
+		sfs_bput(idb);
+	}
+	return result;
+}
+
+static
+int
+sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
+	 uint32_t *diskblock)
+{
+	return sfs_bmapset(sv, fileblock, doalloc, 0, diskblock);
 }
 
 ////////////////////////////////////////////////////////////
@@ -308,16 +699,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *b;
 	uint32_t diskblock;
 	uint32_t fileblock;
 	int result;
@@ -339,58 +722,85 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * It reads as zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_rblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block, and perform the requested operation into/out
+	 * of its buffer.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = sfs_bget(sfs, diskblock, true, &b);
 	if (result) {
 		return result;
 	}
+	result = uiomove((char *)sfs_bdata(b) + skipstart, len, uio);
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * If it was a write, the buffer is dirty. Even if the move
+	 * failed partway, whatever got copied is in the file now.
+	 * A directory's blocks are metadata, for the journal.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_wblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
+		if (sv->sv_i.sfi_type == SFS_TYPE_DIR) {
+			sfs_bdirtymeta(b);
+		}
+		else {
+			sfs_bdirty(b);
 		}
 	}
-
-	return 0;
+	sfs_bput(b);
+	return result;
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * The most blocks sent to the device at once by sfs_blockio.
+ */
+#define SFS_MAXCLUSTER	64
+
+/*
+ * Readahead window, in blocks: where it starts, and how far it opens.
+ */
+#define SFS_RAMIN	2
+#define SFS_RAMAX	32
+
+/*
+ * Do I/O (either read or write) of whole blocks, up to MAXBLOCKS of
+ * them; put the number done in *DONE. sv_lock held.
+ *
+ * A single block goes through its buffer. A run of blocks that are
+ * next to each other on disk goes straight between the device and the
+ * caller's memory in one request, so long sequential transfers are
+ * not one block (and one pass through the cache) at a time. Such a
+ * read stops at a block that is cached, as the buffer may be newer
+ * than the disk; such a write throws away any buffers of the blocks
+ * first, and leaves them to be read again.
+ *
+ * For a file open with O_DIRECT (uio_direct) every run goes around
+ * the cache, a single block too, so that streaming through a big file
+ * does not push everything else out of it. A read writes out any
+ * dirty buffers of the run first instead of stopping at them.
  */
 static
 int
-sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
+sfs_blockio(struct sfs_vnode *sv, struct uio *uio, uint32_t maxblocks,
+	    uint32_t *done)
 {
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-	uint32_t diskblock;
+	struct sfs_buf *b;
+	uint32_t diskblock, nextblock;
 	uint32_t fileblock;
+	uint32_t n, i;
+	off_t saveoff;
+	size_t saveresid, len, moved;
 	int result;
 	int doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
+	bool direct = uio->uio_direct && sv->sv_i.sfi_type == SFS_TYPE_FILE;
+
+	KASSERT(maxblocks > 0);
+	*done = 0;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -409,49 +819,182 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		 * allocated a block for us.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
+		*done = 1;
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
-	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	/* See how far the run goes on. */
+	n = 1;
+	if (direct || uio->uio_rw == UIO_WRITE ||
+	    !sfs_bcached(sfs, diskblock)) {
+		if (maxblocks > SFS_MAXCLUSTER) {
+			maxblocks = SFS_MAXCLUSTER;
+		}
+		while (n < maxblocks) {
+			/* an error here is left for the next call to meet */
+			if (sfs_bmap(sv, fileblock + n, doalloc, &nextblock)) {
+				break;
+			}
+			if (nextblock != diskblock + n ||
+			    (uio->uio_rw == UIO_READ && !direct &&
+			     sfs_bcached(sfs, nextblock))) {
+				break;
+			}
+			n++;
+		}
+	}
+
+	if (n > 1 || direct) {
+		for (i=0; i<n; i++) {
+			if (uio->uio_rw == UIO_WRITE) {
+				sfs_bforget(sfs, diskblock + i);
+			}
+			else if (direct) {
+				result = sfs_bclean(sfs, diskblock + i);
+				if (result) {
+					return result;
+				}
+			}
+		}
+
+		/* Temporarily point the uio at the run on disk */
+		len = n * SFS_BLOCKSIZE;
+		saveoff = uio->uio_offset;
+		saveresid = uio->uio_resid;
+		KASSERT(saveresid >= len);
+		uio->uio_offset = (off_t)diskblock * SFS_BLOCKSIZE;
+		uio->uio_resid = len;
+
+		result = sfs_rwblock(sfs, uio);
+
+		/* and anything readahead loaded meanwhile is old */
+		if (uio->uio_rw == UIO_WRITE) {
+			for (i=0; i<n; i++) {
+				sfs_bforget(sfs, diskblock + i);
+			}
+		}
+
+		moved = len - uio->uio_resid;
+		uio->uio_offset = saveoff + moved;
+		uio->uio_resid = saveresid - moved;
+		*done = moved / SFS_BLOCKSIZE;
+		return result;
+	}
 
 	/*
-	 * Temporarily set the residue to be one block size.
+	 * Go through the block's buffer, so that the cache never holds
+	 * an older copy than the disk. A whole-block write replaces the
+	 * contents, so there is nothing to read first; if it fails
+	 * partway the buffer is thrown away, since the rest of it is
+	 * garbage.
 	 */
 	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
-	
-	result = sfs_rwblock(sfs, uio);
+	result = sfs_bget(sfs, diskblock, uio->uio_rw == UIO_READ, &b);
+	if (result) {
+		return result;
+	}
+	result = uiomove(sfs_bdata(b), SFS_BLOCKSIZE, uio);
+	if (uio->uio_rw == UIO_WRITE) {
+		if (result) {
+			sfs_binval(b);
+		}
+		else {
+			sfs_bdirty(b);
+		}
+	}
+	sfs_bput(b);
+	*done = 1;
+	return result;
+}
 
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update 
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+/*
+ * Whether new files, and files emptied, on SFS keep their data inline
+ * (see kern/sfs.h).
+ */
+static
+bool
+sfs_caninline(struct sfs_fs *sfs, int type)
+{
+	return sfs->sfs_super.sp_version >= 3 && type == SFS_TYPE_FILE;
+}
 
+/*
+ * Do I/O on the data of a file kept inline. A write must stay within
+ * SFS_INLINESIZE; a read is already cut off at EOF. sv_lock held.
+ */
+static
+int
+sfs_inlineio(struct sfs_vnode *sv, struct uio *uio)
+{
+	char *data = SFS_INLINEDATA(&sv->sv_i);
+	int result;
+
+	KASSERT(sv->sv_i.sfi_flags & SFS_INODE_INLINE);
+	KASSERT(uio->uio_offset + uio->uio_resid <= SFS_INLINESIZE);
+
+	result = uiomove(data + uio->uio_offset, uio->uio_resid, uio);
+	if (uio->uio_rw == UIO_WRITE) {
+		sfs_datachanged(sv, true);
+	}
 	return result;
 }
 
+/*
+ * Move the data of a file kept inline out to a block of its own, as
+ * it grows past SFS_INLINESIZE. The inode space goes back to being
+ * block pointers. sv_lock held.
+ */
+static
+int
+sfs_uninline(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	char *data = SFS_INLINEDATA(&sv->sv_i);
+	struct sfs_buf *b;
+	uint32_t block = 0;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+	KASSERT(sv->sv_i.sfi_flags & SFS_INODE_INLINE);
+
+	if (sv->sv_i.sfi_size > 0) {
+		/* sfs_balloc hands it back zeroed, and in the cache */
+		result = sfs_balloc(sfs, sv->sv_ino + 1, &block);
+		if (result) {
+			return result;
+		}
+		result = sfs_bget(sfs, block, true, &b);
+		if (result) {
+			sfs_bfree(sfs, block);
+			return result;
+		}
+		memcpy(sfs_bdata(b), data, sv->sv_i.sfi_size);
+		sfs_bdirty(b);
+		sfs_bput(b);
+	}
+
+	bzero(data, SFS_INLINESIZE);
+	sv->sv_i.sfi_direct[0] = block;
+	sv->sv_i.sfi_flags &= ~SFS_INODE_INLINE;
+	sfs_datachanged(sv, true);
+	return 0;
+}
+
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
+ * sv_lock held.
  */
 static
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	uint32_t blkoff;
-	uint32_t nblocks, i;
+	uint32_t nblocks, done;
 	int result = 0;
 	uint32_t extraresid = 0;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
 	/*
 	 * If reading, check for EOF. If we can read a partial area,
 	 * remember how much extra there was in EXTRARESID so we can
@@ -473,6 +1016,19 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 		}
 	}
 
+	/* A file kept inline stays so while what is written fits */
+	if (sv->sv_i.sfi_flags & SFS_INODE_INLINE) {
+		if (uio->uio_rw == UIO_READ ||
+		    uio->uio_offset + uio->uio_resid <= SFS_INLINESIZE) {
+			result = sfs_inlineio(sv, uio);
+			goto out;
+		}
+		result = sfs_uninline(sv);
+		if (result) {
+			goto out;
+		}
+	}
+
 	/*
 	 * First, do any leading partial block.
 	 */
@@ -489,55 +1045,231 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			len = uio->uio_resid;
 		}
 
-		/* Call sfs_partialio() to do it. */
-		result = sfs_partialio(sv, uio, skip, len);
+		/* Call sfs_partialio() to do it. */
+		result = sfs_partialio(sv, uio, skip, len);
+		if (result) {
+			goto out;
+		}
+	}
+
+	/* If we're done, quit. */
+	if (uio->uio_resid==0) {
+		goto out;
+	}
+
+	/*
+	 * Now we should be block-aligned. Do the remaining whole blocks.
+	 */
+	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
+	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
+	while (nblocks > 0) {
+		result = sfs_blockio(sv, uio, nblocks, &done);
+		if (result) {
+			goto out;
+		}
+		nblocks -= done;
+	}
+
+	/*
+	 * Now do any remaining partial block at the end.
+	 */
+	KASSERT(uio->uio_resid < SFS_BLOCKSIZE);
+
+	if (uio->uio_resid > 0) {
+		result = sfs_partialio(sv, uio, 0, uio->uio_resid);
+		if (result) {
+			goto out;
+		}
+	}
+
+ out:
+
+	/* If writing, adjust file length */
+	if (uio->uio_rw == UIO_WRITE && 
+	    uio->uio_offset > (off_t)sv->sv_i.sfi_size) {
+		sv->sv_i.sfi_size = uio->uio_offset;
+		sfs_datachanged(sv, true);
+	}
+
+	/* Add in any extra amount we couldn't read because of EOF */
+	uio->uio_resid += extraresid;
+
+	/* Done */
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Defragmenting
+
+/*
+ * The most blocks the defragmenter moves at once, and so the longest
+ * run it makes: as many as sfs_blockio reads in one request.
+ */
+#define SFS_DEFRAGRUN	SFS_MAXCLUSTER
+
+/*
+ * Move the N blocks of SV from FILEBLOCK, every one of them mapped, to
+ * the run from NEWBLOCK, which is allocated and unused. The data comes
+ * through BUF, from a block's buffer if it has one, which may be newer
+ * than the disk; it is written out to the run before anything points
+ * there, so no pointer (on disk, or in the journal) ever leads to a
+ * block not yet written. The old blocks are then freed, with a journal
+ * once the new pointers are committed. What of the run is not used in
+ * the end is freed again too. sv_lock held.
+ */
+static
+int
+sfs_moveblocks(struct sfs_vnode *sv, uint32_t fileblock, uint32_t n,
+	       uint32_t newblock, char *buf)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_freebatch fb;
+	struct sfs_buf *b;
+	struct iovec iov;
+	struct uio ku;
+	uint32_t i, old;
+	uint32_t moved = 0;
+	int result;
+
+	KASSERT(n > 0 && n <= SFS_FREEBATCH);
+	fb.fb_n = 0;
+
+	for (i=0; i<n; i++) {
+		result = sfs_bmap(sv, fileblock + i, 0, &old);
 		if (result) {
-			goto out;
+			goto fail;
+		}
+		KASSERT(old != 0);
+		if (sfs_bcached(sfs, old)) {
+			result = sfs_bget(sfs, old, true, &b);
+			if (result) {
+				goto fail;
+			}
+			memcpy(buf + i * SFS_BLOCKSIZE, sfs_bdata(b),
+			       SFS_BLOCKSIZE);
+			sfs_bput(b);
+		}
+		else {
+			result = sfs_rblock(sfs, buf + i * SFS_BLOCKSIZE, old);
+			if (result) {
+				goto fail;
+			}
 		}
 	}
 
-	/* If we're done, quit. */
-	if (uio->uio_resid==0) {
-		goto out;
+	/* Any buffers of the run are from before it was freed */
+	for (i=0; i<n; i++) {
+		sfs_bforget(sfs, newblock + i);
+	}
+	uio_kinit(&iov, &ku, buf, n * SFS_BLOCKSIZE,
+		  (off_t)newblock * SFS_BLOCKSIZE, UIO_WRITE);
+	result = sfs_rwblock(sfs, &ku);
+	if (result) {
+		goto fail;
 	}
 
-	/*
-	 * Now we should be block-aligned. Do the remaining whole blocks.
-	 */
-	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
-	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	for (; moved < n; moved++) {
+		result = sfs_bmapset(sv, fileblock + moved, 0,
+				     newblock + moved, &old);
 		if (result) {
-			goto out;
+			break;
 		}
+		sfs_fbadd(sfs, &fb, old);
+	}
+	sfs_fbflush(sfs, &fb);
+	if (result == 0) {
+		return 0;
 	}
 
-	/*
-	 * Now do any remaining partial block at the end.
-	 */
-	KASSERT(uio->uio_resid < SFS_BLOCKSIZE);
+ fail:
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs_bfreerun(sfs, newblock + moved, n - moved);
+	lock_release(sfs->sfs_freemaplock);
+	return result;
+}
 
-	if (uio->uio_resid > 0) {
-		result = sfs_partialio(sv, uio, 0, uio->uio_resid);
-		if (result) {
-			goto out;
-		}
+/*
+ * Defragment SV while it is in use: wherever SFS_DEFRAGRUN blocks of
+ * it in a row are not one run on disk, move them to a free run, right
+ * after the blocks before them if there is room there. Runs with holes
+ * in them are left alone, as are the indirect blocks, which are few
+ * and mostly read through the cache. Each run is moved in a journal
+ * handle of its own, with sv_lock let go of in between, so the file
+ * can be used meanwhile. *MOVED is how many blocks were moved, even on
+ * failure; ENOSPC means there was no free run long enough.
+ */
+static
+int
+sfs_defrag(struct sfs_vnode *sv, uint32_t *moved)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t fileblock, nblocks, n, i;
+	uint32_t block, first, newblock, goal;
+	bool hole, contig;
+	char *buf;
+	int result = 0;
+
+	*moved = 0;
+	buf = kmalloc(SFS_DEFRAGRUN * SFS_BLOCKSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
 	}
 
- out:
+	goal = 0;
+	for (fileblock = 0; result == 0; fileblock += n) {
+		sfs_bthrottle();
+		sfs_jbegin(sfs);
+		lock_acquire(sv->sv_lock);
 
-	/* If writing, adjust file length */
-	if (uio->uio_rw == UIO_WRITE && 
-	    uio->uio_offset > (off_t)sv->sv_i.sfi_size) {
-		sv->sv_i.sfi_size = uio->uio_offset;
-		sv->sv_dirty = true;
-	}
+		nblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+		if ((sv->sv_i.sfi_flags & SFS_INODE_INLINE) ||
+		    fileblock >= nblocks) {
+			lock_release(sv->sv_lock);
+			sfs_jend(sfs);
+			break;
+		}
+		n = nblocks - fileblock;
+		if (n > SFS_DEFRAGRUN) {
+			n = SFS_DEFRAGRUN;
+		}
 
-	/* Add in any extra amount we couldn't read because of EOF */
-	uio->uio_resid += extraresid;
+		first = 0;
+		hole = false;
+		contig = true;
+		for (i=0; i<n; i++) {
+			result = sfs_bmap(sv, fileblock + i, 0, &block);
+			if (result) {
+				break;
+			}
+			if (i == 0) {
+				first = block;
+			}
+			if (block == 0) {
+				hole = true;
+			}
+			else if (block != first + i) {
+				contig = false;
+			}
+		}
+		if (result == 0 && !hole && !contig) {
+			result = sfs_ballocrun(sfs, goal, n, &newblock);
+			if (result == 0) {
+				result = sfs_moveblocks(sv, fileblock, n,
+							newblock, buf);
+			}
+			if (result == 0) {
+				*moved += n;
+				first = newblock;
+			}
+		}
+		goal = hole ? 0 : first + n;
 
-	/* Done */
+		lock_release(sv->sv_lock);
+		sfs_jend(sfs);
+	}
+
+	kfree(buf);
 	return result;
 }
 
@@ -602,6 +1334,8 @@ sfs_writedir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
 	/* do it */
 	result = sfs_io(sv, &ku);
 	if (result) {
+		/* the slot may or may not have changed; forget the index */
+		sfs_dirhash_destroy(sv);
 		return result;
 	}
 
@@ -610,6 +1344,8 @@ sfs_writedir(struct sfs_vnode *sv, struct sfs_dir *sd, int slot)
 		panic("sfs: writedir: Short write (ino %u)\n", sv->sv_ino);
 	}
 
+	sfs_dirhash_update(sv, slot, sd);
+
 	/* Done */
 	return 0;
 }
@@ -636,10 +1372,274 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_dir);
 }
 
+/*
+ * In-memory name index of a directory, so that finding a name in a
+ * big one does not read every slot. It is made from the entries the
+ * first time a directory of at least SFS_DIRHASH_MIN slots is
+ * searched, and sfs_writedir keeps it up to date; it goes with the
+ * vnode. If memory runs out while adding to it, or a write to the
+ * directory fails, it is thrown away, and searches go back to reading
+ * the slots. sv_lock covers it.
+ *
+ * Entries are on hash chains by name, and also in an array by slot
+ * (NULL for an empty one), so that a slot being overwritten can be
+ * found and an empty one handed out without going to the disk.
+ */
+
+#define SFS_DIRHASH_MIN		32	/* slots; smaller ones are read */
+#define SFS_DIRHASH_CHAINS	16	/* to start with; a power of 2 */
+
+struct sfs_dhent {
+	struct sfs_dhent *de_next;	/* on the chain */
+	uint32_t de_ino;
+	int de_slot;
+	char de_name[SFS_NAMELEN];
+};
+
+struct sfs_dirhash {
+	struct sfs_dhent **dh_chains;
+	unsigned dh_nchains;
+	unsigned dh_count;		/* entries */
+	struct sfs_dhent **dh_slots;	/* by slot */
+	unsigned dh_maxslots;		/* room in dh_slots */
+	unsigned dh_nslots;		/* slots of the directory */
+	unsigned dh_nfree;		/* of those, the empty ones */
+};
+
+static
+unsigned
+sfs_dirhash_name(const char *name)
+{
+	unsigned h = 5381;
+
+	while (*name) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+static
+void
+sfs_dirhash_destroy(struct sfs_vnode *sv)
+{
+	struct sfs_dirhash *dh = sv->sv_dirhash;
+	unsigned i;
+
+	if (dh == NULL) {
+		return;
+	}
+	for (i=0; i<dh->dh_nslots; i++) {
+		if (dh->dh_slots[i] != NULL) {
+			kfree(dh->dh_slots[i]);
+		}
+	}
+	kfree(dh->dh_slots);
+	kfree(dh->dh_chains);
+	kfree(dh);
+	sv->sv_dirhash = NULL;
+}
+
+/*
+ * Double the number of chains once they average more than two
+ * entries. If that cannot be done, stay as is.
+ */
+static
+void
+sfs_dirhash_grow(struct sfs_dirhash *dh)
+{
+	struct sfs_dhent **chains, *de;
+	unsigned n, i, h;
+
+	if (dh->dh_count <= 2 * dh->dh_nchains) {
+		return;
+	}
+	n = dh->dh_nchains * 2;
+	chains = kmalloc(n * sizeof(*chains));
+	if (chains == NULL) {
+		return;
+	}
+	for (i=0; i<n; i++) {
+		chains[i] = NULL;
+	}
+	for (i=0; i<dh->dh_nslots; i++) {
+		de = dh->dh_slots[i];
+		if (de != NULL) {
+			h = sfs_dirhash_name(de->de_name) & (n - 1);
+			de->de_next = chains[h];
+			chains[h] = de;
+		}
+	}
+	kfree(dh->dh_chains);
+	dh->dh_chains = chains;
+	dh->dh_nchains = n;
+}
+
+/*
+ * Record that slot SLOT now holds SD. Throws the index away if there
+ * is no memory for it.
+ */
+static
+void
+sfs_dirhash_update(struct sfs_vnode *sv, int slot, const struct sfs_dir *sd)
+{
+	struct sfs_dirhash *dh = sv->sv_dirhash;
+	struct sfs_dhent **slots, **pp, *de;
+	unsigned n;
+
+	if (dh == NULL) {
+		return;
+	}
+	KASSERT(slot >= 0);
+
+	/* Make room for the slot if it is past the end */
+	if ((unsigned)slot >= dh->dh_maxslots) {
+		n = dh->dh_maxslots * 2;
+		while (n <= (unsigned)slot) {
+			n *= 2;
+		}
+		slots = kmalloc(n * sizeof(*slots));
+		if (slots == NULL) {
+			sfs_dirhash_destroy(sv);
+			return;
+		}
+		memcpy(slots, dh->dh_slots, dh->dh_nslots * sizeof(*slots));
+		kfree(dh->dh_slots);
+		dh->dh_slots = slots;
+		dh->dh_maxslots = n;
+	}
+	while (dh->dh_nslots <= (unsigned)slot) {
+		dh->dh_slots[dh->dh_nslots++] = NULL;
+		dh->dh_nfree++;
+	}
+
+	/* Take out what was there */
+	de = dh->dh_slots[slot];
+	if (de != NULL) {
+		pp = &dh->dh_chains[sfs_dirhash_name(de->de_name) &
+				    (dh->dh_nchains - 1)];
+		while (*pp != de) {
+			pp = &(*pp)->de_next;
+		}
+		*pp = de->de_next;
+		kfree(de);
+		dh->dh_slots[slot] = NULL;
+		dh->dh_count--;
+		dh->dh_nfree++;
+	}
+
+	/* and put in what is there now */
+	if (sd->sfd_ino != SFS_NOINO) {
+		de = kmalloc(sizeof(*de));
+		if (de == NULL) {
+			sfs_dirhash_destroy(sv);
+			return;
+		}
+		de->de_ino = sd->sfd_ino;
+		de->de_slot = slot;
+		memcpy(de->de_name, sd->sfd_name, sizeof(de->de_name));
+		de->de_name[sizeof(de->de_name)-1] = 0;
+		pp = &dh->dh_chains[sfs_dirhash_name(de->de_name) &
+				    (dh->dh_nchains - 1)];
+		de->de_next = *pp;
+		*pp = de;
+		dh->dh_slots[slot] = de;
+		dh->dh_count++;
+		dh->dh_nfree--;
+		sfs_dirhash_grow(dh);
+	}
+}
+
+/*
+ * Make the index of a directory by reading all its slots. On failure
+ * there is just no index.
+ */
+static
+void
+sfs_dirhash_build(struct sfs_vnode *sv)
+{
+	struct sfs_dirhash *dh;
+	struct sfs_dir tsd;
+	int nentries = sfs_dir_nentries(sv);
+	int i;
+
+	KASSERT(sv->sv_dirhash == NULL);
+
+	dh = kmalloc(sizeof(*dh));
+	if (dh == NULL) {
+		return;
+	}
+	dh->dh_nchains = SFS_DIRHASH_CHAINS;
+	dh->dh_chains = kmalloc(dh->dh_nchains * sizeof(*dh->dh_chains));
+	dh->dh_maxslots = nentries;
+	dh->dh_slots = kmalloc(dh->dh_maxslots * sizeof(*dh->dh_slots));
+	if (dh->dh_chains == NULL || dh->dh_slots == NULL) {
+		if (dh->dh_chains != NULL) {
+			kfree(dh->dh_chains);
+		}
+		if (dh->dh_slots != NULL) {
+			kfree(dh->dh_slots);
+		}
+		kfree(dh);
+		return;
+	}
+	for (i=0; i<(int)dh->dh_nchains; i++) {
+		dh->dh_chains[i] = NULL;
+	}
+	dh->dh_count = 0;
+	dh->dh_nslots = 0;
+	dh->dh_nfree = 0;
+	sv->sv_dirhash = dh;
+
+	for (i=0; i<nentries && sv->sv_dirhash != NULL; i++) {
+		if (sfs_readdir(sv, &tsd, i)) {
+			sfs_dirhash_destroy(sv);
+			break;
+		}
+		sfs_dirhash_update(sv, i, &tsd);
+	}
+}
+
+/*
+ * Find NAME in the index: its inode number, its slot, and/or an empty
+ * slot, as sfs_dir_findname.
+ */
+static
+int
+sfs_dirhash_find(struct sfs_dirhash *dh, const char *name,
+		 uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dhent *de;
+	unsigned i;
+
+	if (emptyslot != NULL && dh->dh_nfree > 0) {
+		for (i=0; i<dh->dh_nslots; i++) {
+			if (dh->dh_slots[i] == NULL) {
+				*emptyslot = i;
+				break;
+			}
+		}
+	}
+
+	de = dh->dh_chains[sfs_dirhash_name(name) & (dh->dh_nchains - 1)];
+	for (; de != NULL; de = de->de_next) {
+		if (!strcmp(de->de_name, name)) {
+			if (slot != NULL) {
+				*slot = de->de_slot;
+			}
+			if (ino != NULL) {
+				*ino = de->de_ino;
+			}
+			return 0;
+		}
+	}
+	return ENOENT;
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
- * empty directory slot if one is found.
+ * empty directory slot if one is found. Big directories are looked
+ * up in their index.
  */
 
 static
@@ -652,6 +1652,14 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	int nentries = sfs_dir_nentries(sv);
 	int i, result;
 
+	if (sv->sv_dirhash == NULL && nentries >= SFS_DIRHASH_MIN) {
+		sfs_dirhash_build(sv);
+	}
+	if (sv->sv_dirhash != NULL) {
+		return sfs_dirhash_find(sv->sv_dirhash, name, ino, slot,
+					emptyslot);
+	}
+
 	/* For each slot... */
 	for (i=0; i<nentries; i++) {
 
@@ -752,7 +1760,7 @@ sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 
 /*
  * Look for a name in a directory and hand back a vnode for the
- * file, if there is one.
+ * file, if there is one. The directory's sv_lock held.
  */
 static
 int
@@ -774,6 +1782,7 @@ sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		return result;
 	}
 
+	/* Its linkcount cannot drop while the directory is locked. */
 	if ((*ret)->sv_i.sfi_linkcount == 0) {
 		panic("sfs: Link count of file %u found in dir %u is 0\n",
 		      (*ret)->sv_ino, sv->sv_ino);
@@ -787,11 +1796,13 @@ sfs_lookonce(struct sfs_vnode *sv, const char *name,
 // Object creation
 
 /*
- * Create a new filesystem object and hand back its vnode.
+ * Create a new filesystem object and hand back its vnode. It goes near
+ * the inode of DIR, the directory it is to be linked into.
  */
 static
 int
-sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
+sfs_makeobj(struct sfs_fs *sfs, struct sfs_vnode *dir, int type,
+	    struct sfs_vnode **ret)
 {
 	uint32_t ino;
 	int result;
@@ -801,7 +1812,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, dir->sv_ino + 1, &ino);
 	if (result) {
 		return result;
 	}
@@ -876,7 +1887,140 @@ int
 sfs_close(struct vnode *v)
 {
 	/* Sync it. */
-	return VOP_FSYNC(v);
+	return VOP_FSYNC(v, false);
+}
+
+////////////////////////////////////////////////////////////
+//
+// The table of loaded vnodes; sfs_vnlock held
+//
+// Vnodes are on hash chains by inode number. When the last reference
+// to one whose file still has links goes away, sfs_reclaim keeps it
+// loaded ("parked") with that reference, on a list of up to SFS_NVNLRU
+// of them, least recently used first, so that using the file again
+// soon does not read the inode again. A parked vnode has been synced
+// and is clean, and nobody else has a reference to it unless sfs_sync
+// took one.
+
+#define SFS_NVNLRU	32	/* unused vnodes kept loaded */
+
+static
+unsigned
+sfs_vnhashfn(uint32_t ino)
+{
+	return ino & (SFS_VNHASH - 1);
+}
+
+static
+void
+sfs_vnadd(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned h = sfs_vnhashfn(sv->sv_ino);
+
+	sv->sv_hashnext = sfs->sfs_vnhash[h];
+	sfs->sfs_vnhash[h] = sv;
+	sfs->sfs_nvnodes++;
+}
+
+static
+void
+sfs_vnremove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **pp;
+
+	pp = &sfs->sfs_vnhash[sfs_vnhashfn(sv->sv_ino)];
+	while (*pp != sv) {
+		if (*pp == NULL) {
+			panic("sfs: reclaim vnode %u not in vnode pool\n",
+			      sv->sv_ino);
+		}
+		pp = &(*pp)->sv_hashnext;
+	}
+	*pp = sv->sv_hashnext;
+	sv->sv_hashnext = NULL;
+	sfs->sfs_nvnodes--;
+}
+
+static
+void
+sfs_vnpark(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(!sv->sv_parked);
+	sv->sv_parked = true;
+	sv->sv_lrunext = NULL;
+	sv->sv_lruprev = sfs->sfs_vnlrutail;
+	if (sfs->sfs_vnlrutail != NULL) {
+		sfs->sfs_vnlrutail->sv_lrunext = sv;
+	}
+	else {
+		sfs->sfs_vnlru = sv;
+	}
+	sfs->sfs_vnlrutail = sv;
+	sfs->sfs_nparked++;
+}
+
+static
+void
+sfs_vnunpark(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(sv->sv_parked);
+	if (sv->sv_lruprev != NULL) {
+		sv->sv_lruprev->sv_lrunext = sv->sv_lrunext;
+	}
+	else {
+		sfs->sfs_vnlru = sv->sv_lrunext;
+	}
+	if (sv->sv_lrunext != NULL) {
+		sv->sv_lrunext->sv_lruprev = sv->sv_lruprev;
+	}
+	else {
+		sfs->sfs_vnlrutail = sv->sv_lruprev;
+	}
+	sv->sv_lrunext = sv->sv_lruprev = NULL;
+	sv->sv_parked = false;
+	sfs->sfs_nparked--;
+}
+
+/*
+ * Unload parked vnodes, oldest first, until no more than KEEP are
+ * left. One sfs_sync has a reference to is skipped.
+ */
+void
+sfs_vnevict(struct sfs_fs *sfs, unsigned keep)
+{
+	struct sfs_vnode *sv, *next;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	for (sv = sfs->sfs_vnlru; sv != NULL && sfs->sfs_nparked > keep;
+	     sv = next) {
+		next = sv->sv_lrunext;
+
+		if (sv->sv_v.vn_refcount != 1) {
+			continue;
+		}
+
+		KASSERT(!sv->sv_dirty);
+		sfs_vnunpark(sfs, sv);
+		sfs_vnremove(sfs, sv);
+		VOP_CLEANUP(&sv->sv_v);
+		sfs_dirhash_destroy(sv);
+		lock_destroy(sv->sv_lock);
+		kfree(sv);
+	}
+}
+
+/*
+ * Shrinker: unload the older half of the parked vnodes.
+ */
+void
+sfs_vnshrink(void *data)
+{
+	struct sfs_fs *sfs = data;
+
+	lock_acquire(sfs->sfs_vnlock);
+	sfs_vnevict(sfs, sfs->sfs_nparked / 2);
+	lock_release(sfs->sfs_vnlock);
 }
 
 /*
@@ -886,35 +2030,34 @@ sfs_close(struct vnode *v)
  */
 static
 int
-sfs_reclaim(struct vnode *v)
+sfs_doreclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
+	lock_acquire(sfs->sfs_vnlock);
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. sfs_loadvnode only does that
+	 * with sfs_vnlock held, so once we have it and see a count of
+	 * one, nobody else can.
 	 */
-	if (v->vn_refcount != 1) {
-
-		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
-
-		vfs_biglock_release();
+	if (!vnode_lastref(v)) {
+		/* it consumed the reference VOP_DECREF gave us */
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
 		return EBUSY;
 	}
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount==0) {
-		result = VOP_TRUNCATE(&sv->sv_v, 0);
+		result = sfs_dotruncate(sv, 0);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sfs->sfs_vnlock);
+			lock_release(sv->sv_lock);
 			return result;
 		}
 	}
@@ -922,58 +2065,131 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
-	/* If there are no on-disk references, discard the inode */
-	if (sv->sv_i.sfi_linkcount==0) {
-		sfs_bfree(sfs, sv->sv_ino);
+	/*
+	 * If the file is still there, keep the vnode loaded for a while,
+	 * with the reference we were given, in case it is used again.
+	 */
+	if (sv->sv_i.sfi_linkcount > 0) {
+		sfs_vnevict(sfs, SFS_NVNLRU - 1);
+		sfs_vnpark(sfs, sv);
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
+		return 0;
+	}
+
+	/* There are no on-disk references, so discard the inode */
+	sfs_bfree(sfs, sv->sv_ino);
+
+	/* Remove the vnode structure from the table in the struct sfs_fs. */
+	sfs_vnremove(sfs, sv);
+
+	VOP_CLEANUP(&sv->sv_v);
+
+	lock_release(sfs->sfs_vnlock);
+	lock_release(sv->sv_lock);
+
+	/* Release the storage for the vnode structure itself. */
+	sfs_dirhash_destroy(sv);
+	lock_destroy(sv->sv_lock);
+	kfree(sv);
+
+	/* Done */
+	return 0;
+}
+
+/*
+ * After a read from START up to END, read ahead if it went on from
+ * where the last one stopped: twice as far each time it does, up to
+ * SFS_RAMAX blocks past END, and none after a seek. Blocks already
+ * asked for are not asked for again. sv_lock held.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, off_t start, off_t end)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t fileblock, endblock, last, diskblock;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_i.sfi_flags & SFS_INODE_INLINE) {
+		/* it all came in with the inode */
+		return;
+	}
+
+	if (start / SFS_BLOCKSIZE != sv->sv_ranext) {
+		/* not sequential; start over */
+		sv->sv_rawindow = 0;
+		sv->sv_raend = 0;
+	}
+	else if (sv->sv_rawindow == 0) {
+		sv->sv_rawindow = SFS_RAMIN;
+	}
+	else if (sv->sv_rawindow < SFS_RAMAX) {
+		sv->sv_rawindow *= 2;
+		if (sv->sv_rawindow > SFS_RAMAX) {
+			sv->sv_rawindow = SFS_RAMAX;
+		}
+	}
+
+	/* a read that stops partway into a block will go on in it */
+	endblock = end / SFS_BLOCKSIZE;
+	sv->sv_ranext = endblock;
+
+	/* no further than the end of the file */
+	last = endblock + sv->sv_rawindow;
+	if (last > DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE)) {
+		last = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
 	}
 
-	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
+	fileblock = endblock > sv->sv_raend ? endblock : sv->sv_raend;
+	for (; fileblock < last; fileblock++) {
+		if (sfs_bmap(sv, fileblock, 0, &diskblock)) {
 			break;
 		}
+		if (diskblock != 0) {
+			sfs_bprefetch(sfs, diskblock);
+		}
 	}
-	if (ix == num) {
-		panic("sfs: reclaim vnode %u not in vnode pool\n",
-		      sv->sv_ino);
+	if (fileblock > sv->sv_raend) {
+		sv->sv_raend = fileblock;
 	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
-
-	VOP_CLEANUP(&sv->sv_v);
-
-	vfs_biglock_release();
-
-	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
-
-	/* Done */
-	return 0;
 }
 
 /*
- * Called for read(). sfs_io() does the work.
+ * Called for read(). Whatever the page cache has from the offset on
+ * comes from there; sfs_io() does the rest. With O_DIRECT, neither the
+ * page cache nor readahead is used, as the data is not wanted again.
  */
 static
 int
 sfs_read(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	off_t start;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
+	if (!uio->uio_direct) {
+		result = pagecache_read(v, uio);
+		if (result || uio->uio_resid == 0) {
+			return result;
+		}
+	}
+
+	lock_acquire(sv->sv_lock);
+	start = uio->uio_offset;
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	if (result == 0 && !uio->uio_direct) {
+		sfs_readahead(sv, start, uio->uio_offset);
+	}
+	lock_release(sv->sv_lock);
 
 	return result;
 }
@@ -986,32 +2202,144 @@ int
 sfs_write(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	off_t start;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
-	vfs_biglock_acquire();
+	/* (before the handle, which a commit the syncer does waits for) */
+	sfs_bthrottle();
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
+	start = uio->uio_offset;
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	pagecache_invalidate(v, start, uio->uio_offset);
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
 
 	return result;
 }
 
 /*
- * Called for ioctl()
+ * Prefetch the inodes named by the N entries at SDS.
+ */
+static
+void
+sfs_dir_prefetch(struct sfs_fs *sfs, const struct sfs_dir *sds, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		if (sds[i].sfd_ino != SFS_NOINO &&
+		    sds[i].sfd_ino < sfs->sfs_super.sp_nblocks) {
+			sfs_bprefetch(sfs, sds[i].sfd_ino);
+		}
+	}
+}
+
+/*
+ * Called for getdirentry(). The offset is a slot number: hand back the
+ * name in the first slot in use at or after it, and move the offset
+ * past that slot; at the end of the directory, nothing, leaving the
+ * offset there. The slots are looked at in place in the directory's
+ * buffers, a block of them at a time, so that a series of calls, as
+ * getdirentries makes, costs a lookup per name and a read per block.
+ *
+ * Coming to a block, the inodes its entries name are prefetched, in
+ * directory order: a listing usually goes on to stat each of them.
  */
 static
 int
-sfs_ioctl(struct vnode *v, int op, userptr_t data)
+sfs_getdirentry(struct vnode *v, struct uio *uio)
 {
-	/*
-	 * No ioctls.
-	 */
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	const unsigned perblock = SFS_BLOCKSIZE / sizeof(struct sfs_dir);
+	char name[SFS_NAMELEN];
+	struct sfs_dir *sds;
+	struct sfs_buf *b;
+	uint32_t diskblock;
+	off_t slot;
+	int nentries, found, result;
 
-	(void)v;
-	(void)op;
-	(void)data;
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	if (uio->uio_offset < 0) {
+		return EINVAL;
+	}
+
+	lock_acquire(sv->sv_lock);
+	nentries = sfs_dir_nentries(sv);
+	slot = uio->uio_offset;
+	found = 0;
+	result = 0;
+	while (!found && slot < nentries) {
+		result = sfs_bmap(sv, slot / perblock, 0, &diskblock);
+		if (result) {
+			break;
+		}
+		if (diskblock == 0) {
+			/* a hole reads as empty slots */
+			slot += perblock - slot % perblock;
+			continue;
+		}
+		result = sfs_bget(sfs, diskblock, true, &b);
+		if (result) {
+			break;
+		}
+		sds = sfs_bdata(b);
+		if (slot % perblock == 0) {
+			sfs_dir_prefetch(sfs, sds, perblock);
+		}
+		do {
+			if (sds[slot % perblock].sfd_ino != SFS_NOINO) {
+				memcpy(name, sds[slot % perblock].sfd_name,
+				       sizeof(name));
+				found = 1;
+			}
+			slot++;
+		} while (!found && slot < nentries && slot % perblock != 0);
+		sfs_bput(b);
+	}
+	if (result == 0) {
+		uio->uio_offset = slot;
+		if (found) {
+			/* (uiomove moves the offset too; put it back) */
+			name[sizeof(name) - 1] = 0;
+			result = uiomove(name, strlen(name), uio);
+			uio->uio_offset = slot;
+		}
+	}
+	lock_release(sv->sv_lock);
+
+	return result;
+}
+
+/*
+ * Called for ioctl(). IOCTL_SFSDEFRAG defragments a file (see
+ * sfs_defrag), and stores how many blocks it moved through DATA, if
+ * DATA is not NULL.
+ */
+static
+int
+sfs_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	uint32_t moved;
+	int result;
 
+	switch (op) {
+	    case IOCTL_SFSDEFRAG:
+		if (sv->sv_i.sfi_type != SFS_TYPE_FILE) {
+			return EISDIR;
+		}
+		result = sfs_defrag(sv, &moved);
+		if (result == 0 && data != NULL) {
+			result = copyout(&moved, data, sizeof(moved));
+		}
+		return result;
+	}
 	return EINVAL;
 }
 
@@ -1033,7 +2361,9 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	lock_acquire(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
+	lock_release(sv->sv_lock);
 
 	/* We don't support these yet; you get to implement them */
 	statbuf->st_nlink = 0;
@@ -1053,16 +2383,13 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
+	/* The type never changes, so no lock is needed. */
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -1093,63 +2420,191 @@ sfs_tryseek(struct vnode *v, off_t pos)
 
 /*
  * Called for fsync(), and also on filesystem unmount, global sync(),
- * and some other cases.
+ * and some other cases. With DATASYNC (fdatasync), a file whose size
+ * and blocks have not changed since they were last committed needs
+ * only its data written, not a commit of its own.
  */
 static
 int
-sfs_fsync(struct vnode *v)
+sfs_fsync(struct vnode *v, bool datasync)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	unsigned gen;
 	int result;
 
-	vfs_biglock_acquire();
+	if (sfs->sfs_jblocks > 0) {
+		/* The data, and then everything else, in one commit. */
+		result = sfs_bflush(sfs);
+		if (result) {
+			return result;
+		}
+		if (datasync && sv->sv_i.sfi_type == SFS_TYPE_FILE) {
+			lock_acquire(sv->sv_lock);
+			gen = sv->sv_jgen;
+			lock_release(sv->sv_lock);
+			return sfs_jcommitto(sfs, gen);
+		}
+		return sfs_jcommit(sfs);
+	}
+
+	/* (an inode that has not changed is not written anyway) */
+	lock_acquire(sv->sv_lock);
 	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
+	if (result) {
+		return result;
+	}
 
-	return result;
+	/* The file's blocks are not kept track of apart from the rest. */
+	return sfs_bflush(sfs);
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Pages are read and written back through sfs_io
+ * by way of VOP_READ and VOP_WRITE, so any regular file will do.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v, bool writeable)
 {
 	(void)v;
-	return EUNIMP;
+	(void)writeable;
+	return 0;
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Free the blocks under the indirect block *BLOCKP, LEVELS deep, past
+ * the first KEEP of them, by way of FB. If that leaves it empty it is
+ * freed too, its buffer let go of without being written, and *BLOCKP
+ * cleared and *DIRTYP set, so the caller writes that back.
  */
 static
 int
-sfs_truncate(struct vnode *v, off_t len)
+sfs_trunc_indirect(struct sfs_fs *sfs, struct sfs_freebatch *fb,
+		   uint32_t *blockp, unsigned levels, uint32_t keep,
+		   bool *dirtyp)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
+	struct sfs_buf *idb;
+	uint32_t *idbuf;
+	uint32_t j, span, base;
+	bool hasnonzero, iddirty;
+	int result;
 
-	struct sfs_vnode *sv = v->vn_data;
+	KASSERT(levels >= 1);
+	if (*blockp == 0 || keep >= sfs_ispan(levels)) {
+		/* Nothing there, or nothing under it to free */
+		return 0;
+	}
+
+	/* Read the indirect block */
+	result = sfs_bget(sfs, *blockp, true, &idb);
+	if (result) {
+		return result;
+	}
+	idbuf = sfs_bdata(idb);
+
+	span = sfs_ispan(levels - 1);
+	hasnonzero = false;
+	iddirty = false;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		base = j * span;
+		if (idbuf[j] != 0 && base + span > keep) {
+			/* Discard whatever of this entry is past the new EOF */
+			if (levels == 1) {
+				sfs_fbadd(sfs, fb, idbuf[j]);
+				idbuf[j] = 0;
+				iddirty = true;
+			}
+			else {
+				result = sfs_trunc_indirect(sfs, fb, &idbuf[j],
+					levels - 1,
+					keep > base ? keep - base : 0,
+					&iddirty);
+				if (result) {
+					if (iddirty) {
+						sfs_bdirtymeta(idb);
+					}
+					sfs_bput(idb);
+					return result;
+				}
+			}
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j] != 0) {
+			hasnonzero = true;
+		}
+	}
+
+	if (!hasnonzero) {
+		/*
+		 * The whole indirect block is empty now; free it, once
+		 * we have let go of it. Nothing points at it any more,
+		 * so there is no need to write its cleared entries.
+		 */
+		sfs_binval(idb);
+		sfs_bput(idb);
+		sfs_fbadd(sfs, fb, *blockp);
+		*blockp = 0;
+		*dirtyp = true;
+		return 0;
+	}
+	if (iddirty) {
+		sfs_bdirtymeta(idb);
+	}
+	sfs_bput(idb);
+	return 0;
+}
+
+/*
+ * Truncate a file to LEN bytes. sv_lock held. Used by sfs_truncate,
+ * for ftruncate(), and by sfs_reclaim. The blocks freed are given back
+ * in batches (struct sfs_freebatch), and the indirect blocks kept and
+ * the inode are only dirtied, to be written back once.
+ */
+static
+int
+sfs_dotruncate(struct sfs_vnode *sv, off_t len)
+{
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 
+	/* The indirect blocks, in order, as in sfs_bmap */
+	uint32_t *roots[3] = {
+		&sv->sv_i.sfi_indirect,
+		&sv->sv_i.sfi_dindirect,
+		&sv->sv_i.sfi_tindirect,
+	};
+
 	/* Length in blocks (divide rounding up) */
 	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	uint32_t i, j, block;
-	uint32_t idblock, baseblock, highblock;
+	uint32_t i, block;
+
+	/* The lowest block under the indirect block being looked at */
+	uint32_t baseblock;
+	struct sfs_freebatch fb;
 	int result;
-	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	if (sv->sv_i.sfi_flags & SFS_INODE_INLINE) {
+		if (len <= SFS_INLINESIZE) {
+			/* past EOF is kept zero, for later growth */
+			if (len < sv->sv_i.sfi_size) {
+				bzero(SFS_INLINEDATA(&sv->sv_i) + len,
+				      sv->sv_i.sfi_size - len);
+			}
+			sv->sv_i.sfi_size = len;
+			sfs_datachanged(sv, true);
+			return 0;
+		}
+		result = sfs_uninline(sv);
+		if (result) {
+			return result;
+		}
+	}
 
-	vfs_biglock_acquire();
+	fb.fb_n = 0;
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -1158,72 +2613,65 @@ sfs_truncate(struct vnode *v, off_t len)
 	for (i=0; i<SFS_NDIRECT; i++) {
 		block = sv->sv_i.sfi_direct[i];
 		if (i >= blocklen && block != 0) {
-			sfs_bfree(sfs, block);
+			sfs_fbadd(sfs, &fb, block);
 			sv->sv_i.sfi_direct[i] = 0;
-			sv->sv_dirty = true;
+			sfs_datachanged(sv, true);
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
+	/*
+	 * Then each indirect block, keeping the part of what is under
+	 * it that is before the new EOF.
+	 */
 	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
+	for (i=0; i<3; i++) {
+		result = sfs_trunc_indirect(sfs, &fb, roots[i], i + 1,
+			blocklen > baseblock ? blocklen - baseblock : 0,
+			&sv->sv_dirty);
 		if (result) {
-			vfs_biglock_release();
+			/* what was unhooked before the error still goes */
+			sfs_fbflush(sfs, &fb);
 			return result;
 		}
-		
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
+		baseblock += sfs_ispan(i + 1);
+	}
+	sfs_fbflush(sfs, &fb);
 
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = true;
-		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
+	/* Emptied, a file goes back to keeping its data inline */
+	if (len == 0 && sfs_caninline(sfs, sv->sv_i.sfi_type)) {
+		sv->sv_i.sfi_flags |= SFS_INODE_INLINE;
 	}
 
 	/* Set the file size */
 	sv->sv_i.sfi_size = len;
 
 	/* Mark the inode dirty */
-	sv->sv_dirty = true;
+	sfs_datachanged(sv, true);
 
-	vfs_biglock_release();
 	return 0;
 }
 
+/*
+ * Called for ftruncate().
+ */
+static
+int
+sfs_truncate(struct vnode *v, off_t len)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
+	result = sfs_dotruncate(sv, len);
+	pagecache_purge(v);
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
+
+	return result;
+}
+
 /*
  * Get the full pathname for a file. This only needs to work on directories.
  * Since we don't support subdirectories, assume it's the root directory
@@ -1250,8 +2698,8 @@ sfs_namefile(struct vnode *vv, struct uio *uio)
  */
 static
 int
-sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
-	  struct vnode **ret)
+sfs_docreat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	    struct vnode **ret)
 {
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
@@ -1259,18 +2707,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return EEXIST;
 	}
 
@@ -1278,18 +2726,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got a file; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
 			return result;
 		}
 		*ret = &newguy->sv_v;
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return 0;
 	}
 
 	/* Didn't exist - create it */
-	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
+	result = sfs_makeobj(sfs, sv, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -1300,19 +2748,19 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
 		VOP_DECREF(&newguy->sv_v);
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
-	/* Update the linkcount of the new file */
+	/* Update the linkcount of the new file, and mark it dirty. */
+	lock_acquire(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
-
-	/* and consequently mark it dirty. */
 	newguy->sv_dirty = true;
+	lock_release(newguy->sv_lock);
 
 	*ret = &newguy->sv_v;
 	
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -1323,7 +2771,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
  */
 static
 int
-sfs_link(struct vnode *dir, const char *name, struct vnode *file)
+sfs_dolink(struct vnode *dir, const char *name, struct vnode *file)
 {
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *f = file->vn_data;
@@ -1331,20 +2779,22 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Just create a link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
+	lock_acquire(f->sv_lock);
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
+	lock_release(f->sv_lock);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -1353,19 +2803,20 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
  */
 static
 int
-sfs_remove(struct vnode *dir, const char *name)
+sfs_doremove(struct vnode *dir, const char *name)
 {
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *victim;
+	bool gone = false;
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -1373,15 +2824,23 @@ sfs_remove(struct vnode *dir, const char *name)
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
+		lock_acquire(victim->sv_lock);
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
+		gone = victim->sv_i.sfi_linkcount == 0;
+		lock_release(victim->sv_lock);
+	}
+
+	/* Its cached pages would keep it from being freed. */
+	if (gone) {
+		pagecache_purge(&victim->sv_v);
 	}
 
 	/* Discard the reference that sfs_lookonce got us */
 	VOP_DECREF(&victim->sv_v);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return result;
 }
 
@@ -1393,23 +2852,23 @@ sfs_remove(struct vnode *dir, const char *name)
  */
 static
 int
-sfs_rename(struct vnode *d1, const char *n1, 
-	   struct vnode *d2, const char *n2)
+sfs_dorename(struct vnode *d1, const char *n1, 
+	     struct vnode *d2, const char *n2)
 {
 	struct sfs_vnode *sv = d1->vn_data;
 	struct sfs_vnode *g1;
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
-
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOT_LOCATION);
 
+	lock_acquire(sv->sv_lock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -1430,8 +2889,10 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 	
 	/* Increment the link count, and mark inode dirty */
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -1443,14 +2904,16 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * Decrement the link count again, and mark the inode dirty again,
 	 * in case it's been synced behind our back.
 	 */
+	lock_acquire(g1->sv_lock);
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 
  puke_harder:
@@ -1464,11 +2927,13 @@ sfs_rename(struct vnode *d1, const char *n1,
 			strerror(result2));
 		panic("sfs: rename: Cannot recover\n");
 	}
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount--;
+	lock_release(g1->sv_lock);
  puke:
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return result;
 }
 
@@ -1486,15 +2951,12 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
-
+	/* Only the (unchanging) type is looked at; no lock needed. */
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -1502,7 +2964,6 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_v);
 	*ret = &sv->sv_v;
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -1520,25 +2981,93 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 	struct sfs_vnode *final;
 	int result;
 
-	vfs_biglock_acquire();
-
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
-	
+
+	lock_acquire(sv->sv_lock);
 	result = sfs_lookonce(sv, path, &final, NULL);
+	lock_release(sv->sv_lock);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	*ret = &final->sv_v;
-
-	vfs_biglock_release();
 	return 0;
 }
 
+/*
+ * The operations above that change metadata, each in a journal handle
+ * (see sfs_journal.c), taken before any vnode lock.
+ */
+
+static
+int
+sfs_reclaim(struct vnode *v)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	result = sfs_doreclaim(v);
+	sfs_jend(sfs);
+	return result;
+}
+
+static
+int
+sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	  struct vnode **ret)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	result = sfs_docreat(v, name, excl, mode, ret);
+	sfs_jend(sfs);
+	return result;
+}
+
+static
+int
+sfs_link(struct vnode *dir, const char *name, struct vnode *file)
+{
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	result = sfs_dolink(dir, name, file);
+	sfs_jend(sfs);
+	return result;
+}
+
+static
+int
+sfs_remove(struct vnode *dir, const char *name)
+{
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	result = sfs_doremove(dir, name);
+	sfs_jend(sfs);
+	return result;
+}
+
+static
+int
+sfs_rename(struct vnode *d1, const char *n1,
+	   struct vnode *d2, const char *n2)
+{
+	struct sfs_fs *sfs = d1->vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	result = sfs_dorename(d1, n1, d2, n2);
+	sfs_jend(sfs);
+	return result;
+}
+
 //////////////////////////////////////////////////
 
 static
@@ -1587,6 +3116,7 @@ static const struct vnode_ops sfs_fileops = {
 	NOTDIR,  /* getdirentry */
 	sfs_write,
 	sfs_ioctl,
+	vnode_pollready,
 	sfs_stat,
 	sfs_gettype,
 	sfs_tryseek,
@@ -1619,9 +3149,10 @@ static const struct vnode_ops sfs_dirops = {
 	
 	ISDIR,   /* read */
 	ISDIR,   /* readlink */
-	UNIMP,   /* getdirentry */
+	sfs_getdirentry,
 	ISDIR,   /* write */
 	sfs_ioctl,
+	vnode_pollready,
 	sfs_stat,
 	sfs_gettype,
 	UNIMP,   /* tryseek */
@@ -1644,40 +3175,44 @@ static const struct vnode_ops sfs_dirops = {
 
 /*
  * Function to load a inode into memory as a vnode, or dig up one
- * that's already resident.
+ * that's already resident. Takes sfs_vnlock.
  */
 static
 int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
+	struct sfs_buf *b;
 	const struct vnode_ops *ops = NULL;
-	unsigned i, num;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
-
-		/* Every inode in memory must be in an allocated block */
-		if (!sfs_bused(sfs, sv->sv_ino)) {
-			panic("sfs: Found inode %u in unallocated block\n",
-			      sv->sv_ino);
-		}
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	for (sv = sfs->sfs_vnhash[sfs_vnhashfn(ino)]; sv != NULL;
+	     sv = sv->sv_hashnext) {
 		if (sv->sv_ino==ino) {
 			/* Found */
 
+			/* Every inode in memory must be in an allocated block */
+			if (!sfs_bused(sfs, sv->sv_ino)) {
+				panic("sfs: Found inode %u in unallocated "
+				      "block\n", sv->sv_ino);
+			}
+
 			/* May only be set when creating new objects */
 			KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			VOP_INCREF(&sv->sv_v);
+			/* A parked one already has a reference for us */
+			if (sv->sv_parked) {
+				sfs_vnunpark(sfs, sv);
+			}
+			else {
+				VOP_INCREF(&sv->sv_v);
+			}
+			lock_release(sfs->sfs_vnlock);
+			kstat_inc(&sfs_vnhits);
 			*ret = sv;
 			return 0;
 		}
@@ -1687,6 +3222,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -1697,14 +3233,38 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	}
 
 	/* Read the block the inode is in */
-	result = sfs_rblock(sfs, &sv->sv_i, ino);
+	result = sfs_bget(sfs, ino, true, &b);
 	if (result) {
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
+	memcpy(&sv->sv_i, sfs_bdata(b), sizeof(sv->sv_i));
+	sfs_bput(b);
+	kstat_inc(&sfs_vnloads);
+
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
+	sv->sv_jgen = 0;
+
+	/* Nothing read yet; a read from the beginning is sequential */
+	sv->sv_ranext = 0;
+	sv->sv_rawindow = 0;
+	sv->sv_raend = 0;
+
+	/* A directory's index is made when it is first needed */
+	sv->sv_dirhash = NULL;
+
+	/* In use, so not parked */
+	sv->sv_parked = false;
+	sv->sv_lrunext = sv->sv_lruprev = NULL;
 
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
@@ -1714,6 +3274,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	if (forcetype != SFS_TYPE_INVAL) {
 		KASSERT(sv->sv_i.sfi_type == SFS_TYPE_INVAL);
 		sv->sv_i.sfi_type = forcetype;
+		if (sfs_caninline(sfs, forcetype)) {
+			sv->sv_i.sfi_flags |= SFS_INODE_INLINE;
+		}
 		sv->sv_dirty = true;
 	}
 
@@ -1736,7 +3299,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -1744,12 +3309,9 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	sv->sv_ino = ino;
 
 	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
-	if (result) {
-		VOP_CLEANUP(&sv->sv_v);
-		kfree(sv);
-		return result;
-	}
+	sfs_vnadd(sfs, sv);
+
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
@@ -1767,14 +3329,10 @@ sfs_getroot(struct fs *fs)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOT_LOCATION, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		panic("sfs: getroot: Cannot load root vnode\n");
 	}
 
-	vfs_biglock_release();
-
 	return &sv->sv_v;
 }
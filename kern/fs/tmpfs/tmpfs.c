@@ -0,0 +1,1578 @@
+/*
+ * tmpfs, a filesystem kept in kernel memory. See tmpfs.h.
+ *
+ * Locking. Each node has tn_lock, for its link count and: for a file,
+ * its data and size, held across the copy in or out; for a directory,
+ * its entries and its parent. So operations on names in different
+ * directories do not wait for each other, and I/O to a file waits on
+ * nothing but other I/O to it. A directory's lock comes before the
+ * locks of the nodes named in it, and lookups hold one directory's at
+ * a time, with a reference to the next before letting go of the last.
+ *
+ * Rename and rmdir, which change directories' parents, also hold the
+ * filesystem's tf_renamelock, first; so with it held each directory's
+ * ancestors stay put, and rename can lock both its directories, the
+ * higher one first. They are the only operations that hold two
+ * directories' locks. tf_pagelock, a spinlock, covers the count of
+ * pages in use and the next inode number, and is taken last.
+ *
+ * Releasing a vnode can reclaim it, which takes its tn_lock, so
+ * VOP_DECREF is only called without that. A node left without names
+ * cannot be looked up again, so reclaiming one needs no other lock.
+ *
+ * References. While a node has any names, the names together hold one
+ * reference to its vnode; that is the one vnode_init makes. Removing
+ * the last name drops it, and the node is freed when the last user
+ * lets go. The root always has its name.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <limits.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <vm.h>
+#include <vfs.h>
+#include <fs.h>
+#include <vnode.h>
+#include <pagecache.h>
+#include <tmpfs.h>
+
+#define TMPFS_MINBUCKETS	8	/* a new directory's; a power of 2 */
+#define TMPFS_MAXSIZE		((off_t)1 << 30)	/* of a file */
+#define TMPFS_FIRSTCOOKIE	2	/* after "." and ".." */
+
+struct tmpfs_node;
+
+/* One name in a directory. */
+struct tmpfs_dirent {
+	char *td_name;
+	struct tmpfs_node *td_node;
+	off_t td_cookie;		/* its getdirentry offset */
+	struct tmpfs_dirent *td_hashnext;
+	struct tmpfs_dirent *td_next;	/* in the order made */
+	struct tmpfs_dirent *td_prev;
+};
+
+struct tmpfs_node {
+	struct vnode tn_v;
+	mode_t tn_type;			/* S_IFREG, S_IFDIR or S_IFLNK */
+	ino_t tn_ino;
+	struct lock *tn_lock;		/* see above */
+	unsigned tn_nlink;		/* names */
+
+	/* Files: data. */
+	off_t tn_size;
+	vaddr_t *tn_pages;		/* 0 for a page never written */
+	unsigned tn_npages;		/* slots in tn_pages */
+
+	/* Directories: entries. */
+	struct tmpfs_node *tn_parent;	/* NULL once removed; see above */
+	struct tmpfs_dirent **tn_hash;
+	unsigned tn_nbuckets;
+	unsigned tn_nentries;
+	struct tmpfs_dirent *tn_first;
+	struct tmpfs_dirent *tn_last;
+	off_t tn_nextcookie;
+
+	/* Symlinks: what they say; never changes. */
+	char *tn_link;
+};
+
+struct tmpfs {
+	struct fs tf_fs;
+	struct tmpfs_node *tf_root;
+	struct lock *tf_renamelock;	/* see above */
+	struct spinlock tf_pagelock;
+	ino_t tf_nextino;		/* tf_pagelock */
+	unsigned tf_npages;		/* of file data; tf_pagelock */
+	unsigned tf_maxpages;		/* 0 for no limit */
+};
+
+static const struct vnode_ops tmpfs_fileops;
+static const struct vnode_ops tmpfs_dirops;
+static const struct vnode_ops tmpfs_linkops;
+
+////////////////////////////////////////////////////////////
+//
+// Pages
+
+/*
+ * Get a zeroed page for file data, if the limit and memory allow.
+ */
+static
+vaddr_t
+tmpfs_getpage(struct tmpfs *tf)
+{
+	vaddr_t kva;
+
+	spinlock_acquire(&tf->tf_pagelock);
+	if (tf->tf_maxpages != 0 && tf->tf_npages >= tf->tf_maxpages) {
+		spinlock_release(&tf->tf_pagelock);
+		return 0;
+	}
+	tf->tf_npages++;
+	spinlock_release(&tf->tf_pagelock);
+
+	kva = alloc_kpages(1);
+	if (kva == 0) {
+		spinlock_acquire(&tf->tf_pagelock);
+		tf->tf_npages--;
+		spinlock_release(&tf->tf_pagelock);
+		return 0;
+	}
+	bzero((void *)kva, PAGE_SIZE);
+	return kva;
+}
+
+static
+void
+tmpfs_putpage(struct tmpfs *tf, vaddr_t kva)
+{
+	free_kpages(kva);
+	spinlock_acquire(&tf->tf_pagelock);
+	KASSERT(tf->tf_npages > 0);
+	tf->tf_npages--;
+	spinlock_release(&tf->tf_pagelock);
+}
+
+/*
+ * Make room in TN's table for NPAGES pages. tn_lock held.
+ */
+static
+int
+tmpfs_growpages(struct tmpfs_node *tn, unsigned npages)
+{
+	vaddr_t *pages;
+	unsigned n, i;
+
+	if (npages <= tn->tn_npages) {
+		return 0;
+	}
+	n = tn->tn_npages * 2;
+	if (n < npages) {
+		n = npages;
+	}
+	pages = kmalloc(n * sizeof(vaddr_t));
+	if (pages == NULL) {
+		return ENOSPC;
+	}
+	for (i=0; i<tn->tn_npages; i++) {
+		pages[i] = tn->tn_pages[i];
+	}
+	for (; i<n; i++) {
+		pages[i] = 0;
+	}
+	kfree(tn->tn_pages);
+	tn->tn_pages = pages;
+	tn->tn_npages = n;
+	return 0;
+}
+
+/*
+ * Cut TN's data to LEN bytes, giving back the pages past that and
+ * zeroing the end of the last one kept: past tn_size, pages are
+ * always zero. tn_lock held.
+ */
+static
+void
+tmpfs_cutpages(struct tmpfs *tf, struct tmpfs_node *tn, off_t len)
+{
+	unsigned first, i;
+	size_t off;
+
+	first = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+	for (i=first; i<tn->tn_npages; i++) {
+		if (tn->tn_pages[i] != 0) {
+			tmpfs_putpage(tf, tn->tn_pages[i]);
+			tn->tn_pages[i] = 0;
+		}
+	}
+	off = len % PAGE_SIZE;
+	i = len / PAGE_SIZE;
+	if (off != 0 && i < tn->tn_npages && tn->tn_pages[i] != 0) {
+		bzero((char *)tn->tn_pages[i] + off, PAGE_SIZE - off);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Nodes
+
+/*
+ * Make a node of type TYPE, with the one reference its names will
+ * hold, but no names yet.
+ */
+static
+int
+tmpfs_newnode(struct tmpfs *tf, mode_t type, struct tmpfs_node **ret)
+{
+	const struct vnode_ops *ops;
+	struct tmpfs_node *tn;
+	unsigned i;
+
+	tn = kmalloc(sizeof(*tn));
+	if (tn == NULL) {
+		return ENOMEM;
+	}
+	tn->tn_type = type;
+	spinlock_acquire(&tf->tf_pagelock);
+	tn->tn_ino = tf->tf_nextino++;
+	spinlock_release(&tf->tf_pagelock);
+	tn->tn_nlink = 0;
+	tn->tn_size = 0;
+	tn->tn_pages = NULL;
+	tn->tn_npages = 0;
+	tn->tn_parent = NULL;
+	tn->tn_hash = NULL;
+	tn->tn_nbuckets = 0;
+	tn->tn_nentries = 0;
+	tn->tn_first = tn->tn_last = NULL;
+	tn->tn_nextcookie = TMPFS_FIRSTCOOKIE;
+	tn->tn_link = NULL;
+
+	tn->tn_lock = lock_create("tmpfs");
+	if (tn->tn_lock == NULL) {
+		kfree(tn);
+		return ENOMEM;
+	}
+
+	switch (type) {
+	    case S_IFDIR:
+		ops = &tmpfs_dirops;
+		tn->tn_hash = kmalloc(TMPFS_MINBUCKETS * sizeof(tn->tn_hash[0]));
+		if (tn->tn_hash == NULL) {
+			lock_destroy(tn->tn_lock);
+			kfree(tn);
+			return ENOMEM;
+		}
+		tn->tn_nbuckets = TMPFS_MINBUCKETS;
+		for (i=0; i<tn->tn_nbuckets; i++) {
+			tn->tn_hash[i] = NULL;
+		}
+		break;
+	    case S_IFLNK:
+		ops = &tmpfs_linkops;
+		break;
+	    default:
+		KASSERT(type == S_IFREG);
+		ops = &tmpfs_fileops;
+		break;
+	}
+
+	VOP_INIT(&tn->tn_v, ops, &tf->tf_fs, tn);
+	*ret = tn;
+	return 0;
+}
+
+/*
+ * Free a node nothing refers to any more.
+ */
+static
+void
+tmpfs_freenode(struct tmpfs *tf, struct tmpfs_node *tn)
+{
+	KASSERT(tn->tn_nlink == 0);
+	KASSERT(tn->tn_nentries == 0);
+
+	tmpfs_cutpages(tf, tn, 0);
+	kfree(tn->tn_pages);
+	kfree(tn->tn_hash);
+	kfree(tn->tn_link);
+	lock_destroy(tn->tn_lock);
+	VOP_CLEANUP(&tn->tn_v);
+	kfree(tn);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Directory entries; the directory's tn_lock held
+
+static
+unsigned
+tmpfs_hashname(const char *name)
+{
+	unsigned h = 5381;
+
+	while (*name) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+static
+struct tmpfs_dirent *
+tmpfs_dirfind(struct tmpfs_node *dir, const char *name)
+{
+	struct tmpfs_dirent *de;
+
+	KASSERT(dir->tn_type == S_IFDIR);
+	de = dir->tn_hash[tmpfs_hashname(name) & (dir->tn_nbuckets - 1)];
+	while (de != NULL && strcmp(de->td_name, name) != 0) {
+		de = de->td_hashnext;
+	}
+	return de;
+}
+
+/*
+ * Double DIR's hash table, if there is the memory; if not, the chains
+ * just get longer.
+ */
+static
+void
+tmpfs_dirgrow(struct tmpfs_node *dir)
+{
+	struct tmpfs_dirent **hash;
+	struct tmpfs_dirent *de;
+	unsigned n, i, b;
+
+	n = dir->tn_nbuckets * 2;
+	hash = kmalloc(n * sizeof(hash[0]));
+	if (hash == NULL) {
+		return;
+	}
+	for (i=0; i<n; i++) {
+		hash[i] = NULL;
+	}
+	for (de = dir->tn_first; de != NULL; de = de->td_next) {
+		b = tmpfs_hashname(de->td_name) & (n - 1);
+		de->td_hashnext = hash[b];
+		hash[b] = de;
+	}
+	kfree(dir->tn_hash);
+	dir->tn_hash = hash;
+	dir->tn_nbuckets = n;
+}
+
+/*
+ * Give TN the name NAME in DIR, which must not have it already. TN's
+ * lock held too, unless nobody else can see it yet.
+ */
+static
+int
+tmpfs_diradd(struct tmpfs_node *dir, const char *name, struct tmpfs_node *tn)
+{
+	struct tmpfs_dirent *de;
+	unsigned b;
+
+	if (strlen(name) > NAME_MAX) {
+		return ENAMETOOLONG;
+	}
+
+	de = kmalloc(sizeof(*de));
+	if (de == NULL) {
+		return ENOMEM;
+	}
+	de->td_name = kstrdup(name);
+	if (de->td_name == NULL) {
+		kfree(de);
+		return ENOMEM;
+	}
+	de->td_node = tn;
+	de->td_cookie = dir->tn_nextcookie++;
+
+	if (dir->tn_nentries >= 2 * dir->tn_nbuckets) {
+		tmpfs_dirgrow(dir);
+	}
+	b = tmpfs_hashname(name) & (dir->tn_nbuckets - 1);
+	de->td_hashnext = dir->tn_hash[b];
+	dir->tn_hash[b] = de;
+
+	de->td_next = NULL;
+	de->td_prev = dir->tn_last;
+	if (dir->tn_last != NULL) {
+		dir->tn_last->td_next = de;
+	}
+	else {
+		dir->tn_first = de;
+	}
+	dir->tn_last = de;
+	dir->tn_nentries++;
+
+	tn->tn_nlink++;
+	return 0;
+}
+
+/*
+ * Take the entry DE out of DIR. The named node's lock held too, and
+ * tf_renamelock if it is a directory. Returns the node if that was
+ * its last name, for the caller to VOP_DECREF once the locks are let
+ * go.
+ */
+static
+struct tmpfs_node *
+tmpfs_dirdel(struct tmpfs_node *dir, struct tmpfs_dirent *de)
+{
+	struct tmpfs_dirent **dep;
+	struct tmpfs_node *tn;
+
+	dep = &dir->tn_hash[tmpfs_hashname(de->td_name) &
+			     (dir->tn_nbuckets - 1)];
+	while (*dep != de) {
+		KASSERT(*dep != NULL);
+		dep = &(*dep)->td_hashnext;
+	}
+	*dep = de->td_hashnext;
+
+	if (de->td_prev != NULL) {
+		de->td_prev->td_next = de->td_next;
+	}
+	else {
+		dir->tn_first = de->td_next;
+	}
+	if (de->td_next != NULL) {
+		de->td_next->td_prev = de->td_prev;
+	}
+	else {
+		dir->tn_last = de->td_prev;
+	}
+	dir->tn_nentries--;
+
+	tn = de->td_node;
+	kfree(de->td_name);
+	kfree(de);
+
+	KASSERT(tn->tn_nlink > 0);
+	tn->tn_nlink--;
+	if (tn->tn_type == S_IFDIR) {
+		tn->tn_parent = NULL;
+	}
+	return tn->tn_nlink == 0 ? tn : NULL;
+}
+
+/* "." and "..", which are not entries. */
+static
+bool
+tmpfs_isdot(const char *name)
+{
+	return !strcmp(name, ".") || !strcmp(name, "..");
+}
+
+/*
+ * Follow PATH (which is destroyed) from TN, a component at a time:
+ * "." and empty components stay put, ".." goes up, and stays put at
+ * the root. Hands back a reference to where it ends up. Each
+ * directory is locked only while its component is looked up in it.
+ */
+static
+int
+tmpfs_walk(struct tmpfs *tf, struct tmpfs_node *tn, char *path,
+	   struct tmpfs_node **ret)
+{
+	struct tmpfs_dirent *de;
+	struct tmpfs_node *next;
+	char *comp, *nextcomp;
+	int result = 0;
+
+	VOP_INCREF(&tn->tn_v);
+	for (comp = path; comp != NULL; comp = nextcomp) {
+		nextcomp = strchr(comp, '/');
+		if (nextcomp != NULL) {
+			*nextcomp++ = 0;
+		}
+		if (tn->tn_type != S_IFDIR) {
+			result = ENOTDIR;
+			break;
+		}
+
+		lock_acquire(tn->tn_lock);
+		if (tn->tn_nlink == 0) {
+			/* removed; nothing is there any more */
+			lock_release(tn->tn_lock);
+			result = ENOENT;
+			break;
+		}
+		if (*comp == 0 || !strcmp(comp, ".") ||
+		    (!strcmp(comp, "..") && tn == tf->tf_root)) {
+			lock_release(tn->tn_lock);
+			continue;
+		}
+		if (!strcmp(comp, "..")) {
+			next = tn->tn_parent;
+		}
+		else {
+			de = tmpfs_dirfind(tn, comp);
+			if (de == NULL) {
+				lock_release(tn->tn_lock);
+				result = ENOENT;
+				break;
+			}
+			next = de->td_node;
+		}
+		VOP_INCREF(&next->tn_v);
+		lock_release(tn->tn_lock);
+
+		VOP_DECREF(&tn->tn_v);
+		tn = next;
+	}
+	if (result) {
+		VOP_DECREF(&tn->tn_v);
+		return result;
+	}
+	*ret = tn;
+	return 0;
+}
+
+/*
+ * Whether A is D or one of its ancestors. tf_renamelock held.
+ */
+static
+bool
+tmpfs_isancestor(struct tmpfs *tf, struct tmpfs_node *a, struct tmpfs_node *d)
+{
+	struct tmpfs_node *p;
+
+	KASSERT(lock_do_i_hold(tf->tf_renamelock));
+
+	for (p = d; p != NULL; p = p->tn_parent) {
+		if (p == a) {
+			return true;
+		}
+		if (p == tf->tf_root) {
+			break;
+		}
+	}
+	return false;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Vnode operations
+
+static
+int
+tmpfs_open(struct vnode *v, int openflags)
+{
+	/* O_APPEND is handled above us. */
+	(void)v;
+	(void)openflags;
+	return 0;
+}
+
+static
+int
+tmpfs_opendir(struct vnode *v, int openflags)
+{
+	(void)v;
+
+	if ((openflags & O_ACCMODE) != O_RDONLY || (openflags & O_APPEND)) {
+		return EISDIR;
+	}
+	return 0;
+}
+
+static
+int
+tmpfs_close(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+/*
+ * VOP_RECLAIM: the last reference to a node with no names is going.
+ */
+static
+int
+tmpfs_reclaim(struct vnode *v)
+{
+	struct tmpfs *tf = v->vn_fs->fs_data;
+	struct tmpfs_node *tn = v->vn_data;
+
+	/*
+	 * Somebody that already had a reference may have taken another
+	 * since VOP_DECREF decided to reclaim it; if so, drop the one we
+	 * were handed. With no names left, nobody can find it to take a
+	 * new one.
+	 */
+	lock_acquire(tn->tn_lock);
+	if (!vnode_lastref(v)) {
+		lock_release(tn->tn_lock);
+		return EBUSY;
+	}
+	KASSERT(tn->tn_nlink == 0);
+	lock_release(tn->tn_lock);
+
+	tmpfs_freenode(tf, tn);
+	return 0;
+}
+
+static
+int
+tmpfs_read(struct vnode *v, struct uio *uio)
+{
+	struct tmpfs_node *tn = v->vn_data;
+	unsigned page;
+	size_t pageoff, amt;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	lock_acquire(tn->tn_lock);
+	while (result == 0 && uio->uio_resid > 0 &&
+	       uio->uio_offset < tn->tn_size) {
+		page = uio->uio_offset / PAGE_SIZE;
+		pageoff = uio->uio_offset % PAGE_SIZE;
+		amt = PAGE_SIZE - pageoff;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+		if ((off_t)amt > tn->tn_size - uio->uio_offset) {
+			amt = tn->tn_size - uio->uio_offset;
+		}
+
+		if (page < tn->tn_npages && tn->tn_pages[page] != 0) {
+			result = uiomove((char *)tn->tn_pages[page] + pageoff,
+					 amt, uio);
+		}
+		else {
+			result = uiomovezeros(amt, uio);
+		}
+	}
+	lock_release(tn->tn_lock);
+	return result;
+}
+
+static
+int
+tmpfs_write(struct vnode *v, struct uio *uio)
+{
+	struct tmpfs *tf = v->vn_fs->fs_data;
+	struct tmpfs_node *tn = v->vn_data;
+	unsigned page;
+	size_t pageoff, amt;
+	off_t start;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	if (uio->uio_offset + (off_t)uio->uio_resid > TMPFS_MAXSIZE) {
+		return EFBIG;
+	}
+
+	lock_acquire(tn->tn_lock);
+	start = uio->uio_offset;
+	while (result == 0 && uio->uio_resid > 0) {
+		page = uio->uio_offset / PAGE_SIZE;
+		pageoff = uio->uio_offset % PAGE_SIZE;
+		amt = PAGE_SIZE - pageoff;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+
+		result = tmpfs_growpages(tn, page + 1);
+		if (result) {
+			break;
+		}
+		if (tn->tn_pages[page] == 0) {
+			tn->tn_pages[page] = tmpfs_getpage(tf);
+			if (tn->tn_pages[page] == 0) {
+				result = ENOSPC;
+				break;
+			}
+		}
+		result = uiomove((char *)tn->tn_pages[page] + pageoff,
+				 amt, uio);
+		if (uio->uio_offset > tn->tn_size) {
+			tn->tn_size = uio->uio_offset;
+		}
+	}
+	pagecache_invalidate(v, start, uio->uio_offset);
+	lock_release(tn->tn_lock);
+	return result;
+}
+
+static
+int
+tmpfs_readlink(struct vnode *v, struct uio *uio)
+{
+	struct tmpfs_node *tn = v->vn_data;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+	return uiomove(tn->tn_link, strlen(tn->tn_link), uio);
+}
+
+/*
+ * VOP_GETDIRENTRY: offsets 0 and 1 are "." and ".."; past those, the
+ * offset is the cookie of the next entry to hand out.
+ */
+static
+int
+tmpfs_getdirentry(struct vnode *v, struct uio *uio)
+{
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs_dirent *de;
+	const char *name;
+	off_t next;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	if (uio->uio_offset < 0) {
+		return EINVAL;
+	}
+
+	lock_acquire(dir->tn_lock);
+	if (uio->uio_offset < TMPFS_FIRSTCOOKIE) {
+		name = uio->uio_offset == 0 ? "." : "..";
+		next = uio->uio_offset + 1;
+	}
+	else {
+		for (de = dir->tn_first;
+		     de != NULL && de->td_cookie < uio->uio_offset;
+		     de = de->td_next);
+		if (de == NULL) {
+			/* end of directory */
+			lock_release(dir->tn_lock);
+			return 0;
+		}
+		name = de->td_name;
+		next = de->td_cookie + 1;
+	}
+
+	/* (uiomove moves the offset too; put it right) */
+	result = uiomove((char *)name, strlen(name), uio);
+	uio->uio_offset = next;
+	lock_release(dir->tn_lock);
+	return result;
+}
+
+static
+int
+tmpfs_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+tmpfs_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct tmpfs_node *tn = v->vn_data;
+	unsigned i, n = 0;
+
+	bzero(statbuf, sizeof(struct stat));
+
+	lock_acquire(tn->tn_lock);
+	statbuf->st_nlink = tn->tn_nlink;
+	if (tn->tn_type == S_IFDIR) {
+		statbuf->st_size = tn->tn_nentries;
+	}
+	else if (tn->tn_type == S_IFREG) {
+		statbuf->st_size = tn->tn_size;
+		for (i=0; i<tn->tn_npages; i++) {
+			n += tn->tn_pages[i] != 0;
+		}
+	}
+	else {
+		statbuf->st_size = strlen(tn->tn_link);
+	}
+	lock_release(tn->tn_lock);
+
+	statbuf->st_mode = tn->tn_type | (tn->tn_type == S_IFDIR ? 0755 : 0644);
+	statbuf->st_blocks = n * (PAGE_SIZE / 512);
+	statbuf->st_ino = tn->tn_ino;
+	statbuf->st_blksize = PAGE_SIZE;
+	return 0;
+}
+
+static
+int
+tmpfs_gettype(struct vnode *v, mode_t *ret)
+{
+	struct tmpfs_node *tn = v->vn_data;
+
+	/* The type never changes, so no lock is needed. */
+	*ret = tn->tn_type;
+	return 0;
+}
+
+static
+int
+tmpfs_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	return pos < 0 ? EINVAL : 0;
+}
+
+static
+int
+tmpfs_fsync(struct vnode *v, bool datasync)
+{
+	(void)v;
+	(void)datasync;
+	return 0;
+}
+
+/*
+ * VOP_MMAP: files are paged with VOP_READ and VOP_WRITE, which is
+ * all mapping one takes.
+ */
+static
+int
+tmpfs_mmap(struct vnode *v, bool writeable)
+{
+	(void)v;
+	(void)writeable;
+	return 0;
+}
+
+static
+int
+tmpfs_truncate(struct vnode *v, off_t len)
+{
+	struct tmpfs *tf = v->vn_fs->fs_data;
+	struct tmpfs_node *tn = v->vn_data;
+
+	if (len < 0) {
+		return EINVAL;
+	}
+	if (len > TMPFS_MAXSIZE) {
+		return EFBIG;
+	}
+
+	lock_acquire(tn->tn_lock);
+	if (len < tn->tn_size) {
+		tmpfs_cutpages(tf, tn, len);
+		pagecache_purge(v);
+	}
+	tn->tn_size = len;
+	lock_release(tn->tn_lock);
+	return 0;
+}
+
+/*
+ * VOP_NAMEFILE: the path from the root to directory V, built from the
+ * end back, since each directory knows only its parent. tf_renamelock
+ * keeps the parents put; each is locked while its entries are looked
+ * through for the name.
+ */
+static
+int
+tmpfs_namefile(struct vnode *v, struct uio *uio)
+{
+	struct tmpfs *tf = v->vn_fs->fs_data;
+	struct tmpfs_node *tn, *dir;
+	struct tmpfs_dirent *de;
+	char *buf;
+	size_t pos, len;
+	int result = 0;
+
+	buf = kmalloc(PATH_MAX);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	pos = PATH_MAX;
+
+	lock_acquire(tf->tf_renamelock);
+	for (tn = v->vn_data; result == 0 && tn != tf->tf_root; tn = dir) {
+		dir = tn->tn_parent;
+		if (dir == NULL) {
+			/* removed */
+			result = ENOENT;
+			break;
+		}
+		lock_acquire(dir->tn_lock);
+		for (de = dir->tn_first; de->td_node != tn; de = de->td_next) {
+			KASSERT(de->td_next != NULL);
+		}
+		len = strlen(de->td_name);
+		if (len + 1 > pos) {
+			result = ENAMETOOLONG;
+		}
+		else {
+			if (pos < PATH_MAX) {
+				buf[--pos] = '/';
+			}
+			pos -= len;
+			memcpy(buf + pos, de->td_name, len);
+		}
+		lock_release(dir->tn_lock);
+	}
+	lock_release(tf->tf_renamelock);
+
+	if (result == 0) {
+		if (PATH_MAX - pos > uio->uio_resid) {
+			result = ENAMETOOLONG;
+		}
+		else {
+			result = uiomove(buf + pos, PATH_MAX - pos, uio);
+		}
+	}
+	kfree(buf);
+	return result;
+}
+
+/*
+ * A directory that has been removed takes no new names. Its lock
+ * held.
+ */
+static
+int
+tmpfs_checkdir(struct tmpfs_node *dir)
+{
+	return dir->tn_nlink == 0 ? ENOENT : 0;
+}
+
+/*
+ * Add the new node of type TYPE named NAME to DIR, handing back a new
+ * reference to it in RET if that is not NULL. DIR's lock held.
+ */
+static
+int
+tmpfs_make(struct tmpfs *tf, struct tmpfs_node *dir, const char *name,
+	   mode_t type, struct tmpfs_node **ret)
+{
+	struct tmpfs_node *tn;
+	int result;
+
+	result = tmpfs_newnode(tf, type, &tn);
+	if (result) {
+		return result;
+	}
+	result = tmpfs_diradd(dir, name, tn);
+	if (result) {
+		tmpfs_freenode(tf, tn);
+		return result;
+	}
+	if (type == S_IFDIR) {
+		tn->tn_parent = dir;
+	}
+	if (ret != NULL) {
+		VOP_INCREF(&tn->tn_v);
+		*ret = tn;
+	}
+	return 0;
+}
+
+static
+int
+tmpfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	    struct vnode **ret)
+{
+	struct tmpfs *tf = v->vn_fs->fs_data;
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs_dirent *de;
+	struct tmpfs_node *tn;
+	int result;
+
+	(void)mode;
+
+	if (tmpfs_isdot(name)) {
+		return excl ? EEXIST : EISDIR;
+	}
+
+	lock_acquire(dir->tn_lock);
+	result = tmpfs_checkdir(dir);
+	if (result) {
+		goto out;
+	}
+	de = tmpfs_dirfind(dir, name);
+	if (de != NULL) {
+		if (excl) {
+			result = EEXIST;
+			goto out;
+		}
+		tn = de->td_node;
+		VOP_INCREF(&tn->tn_v);
+	}
+	else {
+		result = tmpfs_make(tf, dir, name, S_IFREG, &tn);
+		if (result) {
+			goto out;
+		}
+	}
+	*ret = &tn->tn_v;
+ out:
+	lock_release(dir->tn_lock);
+	return result;
+}
+
+static
+int
+tmpfs_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	struct tmpfs *tf = v->vn_fs->fs_data;
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs_node *tn;
+	char *link;
+	int result;
+
+	if (tmpfs_isdot(name)) {
+		return EEXIST;
+	}
+	link = kstrdup(contents);
+	if (link == NULL) {
+		return ENOMEM;
+	}
+
+	lock_acquire(dir->tn_lock);
+	result = tmpfs_checkdir(dir);
+	if (result == 0 && tmpfs_dirfind(dir, name) != NULL) {
+		result = EEXIST;
+	}
+	if (result == 0) {
+		result = tmpfs_make(tf, dir, name, S_IFLNK, &tn);
+	}
+	if (result == 0) {
+		/* (nobody can look it up until DIR is let go of) */
+		tn->tn_link = link;
+		link = NULL;
+	}
+	lock_release(dir->tn_lock);
+
+	kfree(link);
+	if (result == 0) {
+		VOP_DECREF(&tn->tn_v);
+	}
+	return result;
+}
+
+static
+int
+tmpfs_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	struct tmpfs *tf = v->vn_fs->fs_data;
+	struct tmpfs_node *dir = v->vn_data;
+	int result;
+
+	(void)mode;
+
+	if (tmpfs_isdot(name)) {
+		return EEXIST;
+	}
+
+	lock_acquire(dir->tn_lock);
+	result = tmpfs_checkdir(dir);
+	if (result == 0 && tmpfs_dirfind(dir, name) != NULL) {
+		result = EEXIST;
+	}
+	if (result == 0) {
+		result = tmpfs_make(tf, dir, name, S_IFDIR, NULL);
+	}
+	lock_release(dir->tn_lock);
+	return result;
+}
+
+static
+int
+tmpfs_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs_node *tn = file->vn_data;
+	int result;
+
+	if (tn->tn_type == S_IFDIR) {
+		return EPERM;
+	}
+	if (tmpfs_isdot(name)) {
+		return EEXIST;
+	}
+
+	lock_acquire(dir->tn_lock);
+	lock_acquire(tn->tn_lock);
+	result = tmpfs_checkdir(dir);
+	if (result == 0 && tn->tn_nlink == 0) {
+		/* removed since it was looked up */
+		result = ENOENT;
+	}
+	if (result == 0 && tmpfs_dirfind(dir, name) != NULL) {
+		result = EEXIST;
+	}
+	if (result == 0) {
+		result = tmpfs_diradd(dir, name, tn);
+	}
+	lock_release(tn->tn_lock);
+	lock_release(dir->tn_lock);
+	return result;
+}
+
+/*
+ * VOP_REMOVE and VOP_RMDIR: take NAME out of V, which must be a
+ * directory (and empty) or must not, as ISDIR says.
+ */
+static
+int
+tmpfs_unlink(struct vnode *v, const char *name, bool isdir)
+{
+	struct tmpfs *tf = v->vn_fs->fs_data;
+	struct tmpfs_node *dir = v->vn_data;
+	struct tmpfs_node *tn, *drop = NULL;
+	struct tmpfs_dirent *de;
+	int result = 0;
+
+	if (!strcmp(name, ".")) {
+		return EINVAL;
+	}
+	if (!strcmp(name, "..")) {
+		return isdir ? ENOTEMPTY : EINVAL;
+	}
+
+	if (isdir) {
+		lock_acquire(tf->tf_renamelock);
+	}
+	lock_acquire(dir->tn_lock);
+	de = tmpfs_dirfind(dir, name);
+	if (de == NULL) {
+		result = ENOENT;
+	}
+	else if (isdir && de->td_node->tn_type != S_IFDIR) {
+		result = ENOTDIR;
+	}
+	else if (!isdir && de->td_node->tn_type == S_IFDIR) {
+		result = EISDIR;
+	}
+	else {
+		tn = de->td_node;
+		lock_acquire(tn->tn_lock);
+		if (isdir && tn->tn_nentries > 0) {
+			result = ENOTEMPTY;
+		}
+		else {
+			drop = tmpfs_dirdel(dir, de);
+		}
+		lock_release(tn->tn_lock);
+	}
+	lock_release(dir->tn_lock);
+	if (isdir) {
+		lock_release(tf->tf_renamelock);
+	}
+
+	if (drop != NULL) {
+		pagecache_purge(&drop->tn_v);
+		VOP_DECREF(&drop->tn_v);
+	}
+	return result;
+}
+
+static
+int
+tmpfs_remove(struct vnode *v, const char *name)
+{
+	return tmpfs_unlink(v, name, false);
+}
+
+static
+int
+tmpfs_rmdir(struct vnode *v, const char *name)
+{
+	return tmpfs_unlink(v, name, true);
+}
+
+/*
+ * VOP_RENAME. An existing N2 is replaced, if it is of the same kind
+ * (and an empty directory, if a directory); a directory cannot be
+ * moved into itself.
+ *
+ * With tf_renamelock held, the two directories are locked the higher
+ * first (either, if neither is above the other), then the node that
+ * moves, then the one it replaces.
+ */
+static
+int
+tmpfs_rename(struct vnode *v1, const char *n1,
+	     struct vnode *v2, const char *n2)
+{
+	struct tmpfs *tf = v1->vn_fs->fs_data;
+	struct tmpfs_node *d1 = v1->vn_data, *d2 = v2->vn_data;
+	struct tmpfs_node *first, *second;
+	struct tmpfs_node *tn = NULL, *old = NULL, *drop = NULL;
+	struct tmpfs_dirent *de1, *de2;
+	int result = 0;
+
+	if (tmpfs_isdot(n1) || tmpfs_isdot(n2)) {
+		return EINVAL;
+	}
+
+	lock_acquire(tf->tf_renamelock);
+	if (d1 != d2 && tmpfs_isancestor(tf, d2, d1)) {
+		first = d2;
+		second = d1;
+	}
+	else {
+		first = d1;
+		second = d1 != d2 ? d2 : NULL;
+	}
+	lock_acquire(first->tn_lock);
+	if (second != NULL) {
+		lock_acquire(second->tn_lock);
+	}
+
+	result = tmpfs_checkdir(d2);
+	if (result) {
+		goto out;
+	}
+	de1 = tmpfs_dirfind(d1, n1);
+	if (de1 == NULL) {
+		result = ENOENT;
+		goto out;
+	}
+	if (de1->td_node->tn_type == S_IFDIR &&
+	    tmpfs_isancestor(tf, de1->td_node, d2)) {
+		result = EINVAL;
+		goto out;
+	}
+
+	de2 = tmpfs_dirfind(d2, n2);
+	if (de2 != NULL && de2->td_node == de1->td_node) {
+		/* the same file already */
+		goto out;
+	}
+	if (de2 != NULL && de2->td_node == d1) {
+		/* D1 has N1 in it, so is not empty */
+		result = de1->td_node->tn_type == S_IFDIR ? ENOTEMPTY : EISDIR;
+		goto out;
+	}
+
+	tn = de1->td_node;
+	lock_acquire(tn->tn_lock);
+
+	if (de2 != NULL) {
+		old = de2->td_node;
+		lock_acquire(old->tn_lock);
+		if (tn->tn_type == S_IFDIR && old->tn_type != S_IFDIR) {
+			result = ENOTDIR;
+			goto out;
+		}
+		if (tn->tn_type != S_IFDIR && old->tn_type == S_IFDIR) {
+			result = EISDIR;
+			goto out;
+		}
+		if (old->tn_type == S_IFDIR && old->tn_nentries > 0) {
+			result = ENOTEMPTY;
+			goto out;
+		}
+
+		/* Point the entry at TN instead; OLD loses the name. */
+		de2->td_node = tn;
+		tn->tn_nlink++;
+		KASSERT(old->tn_nlink > 0);
+		old->tn_nlink--;
+		if (old->tn_type == S_IFDIR) {
+			old->tn_parent = NULL;
+		}
+		if (old->tn_nlink == 0) {
+			drop = old;
+		}
+	}
+	else {
+		result = tmpfs_diradd(d2, n2, tn);
+		if (result) {
+			goto out;
+		}
+	}
+
+	/* Still its own name while TN has the new one. */
+	KASSERT(tn->tn_nlink > 1);
+	tmpfs_dirdel(d1, tmpfs_dirfind(d1, n1));
+	if (tn->tn_type == S_IFDIR) {
+		tn->tn_parent = d2;
+	}
+
+ out:
+	if (old != NULL) {
+		lock_release(old->tn_lock);
+	}
+	if (tn != NULL) {
+		lock_release(tn->tn_lock);
+	}
+	if (second != NULL) {
+		lock_release(second->tn_lock);
+	}
+	lock_release(first->tn_lock);
+	lock_release(tf->tf_renamelock);
+	if (drop != NULL) {
+		pagecache_purge(&drop->tn_v);
+		VOP_DECREF(&drop->tn_v);
+	}
+	return result;
+}
+
+static
+int
+tmpfs_lookup(struct vnode *v, char *path, struct vnode **ret)
+{
+	struct tmpfs *tf = v->vn_fs->fs_data;
+	struct tmpfs_node *tn;
+	int result;
+
+	result = tmpfs_walk(tf, v->vn_data, path, &tn);
+	if (result == 0) {
+		*ret = &tn->tn_v;
+	}
+	return result;
+}
+
+static
+int
+tmpfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
+		 char *buf, size_t len)
+{
+	struct tmpfs *tf = v->vn_fs->fs_data;
+	struct tmpfs_node *tn;
+	char *name;
+	size_t n;
+	int result;
+
+	/* Trailing slashes name the same thing as none. */
+	n = strlen(path);
+	while (n > 1 && path[n - 1] == '/') {
+		path[--n] = 0;
+	}
+
+	name = strrchr(path, '/');
+	if (name != NULL) {
+		*name++ = 0;
+	}
+	else {
+		name = path;
+		path = NULL;
+	}
+	if (strlen(name) + 1 > len) {
+		return ENAMETOOLONG;
+	}
+	strcpy(buf, name);
+
+	if (path == NULL) {
+		tn = v->vn_data;
+		VOP_INCREF(&tn->tn_v);
+	}
+	else {
+		result = tmpfs_walk(tf, v->vn_data, path, &tn);
+		if (result) {
+			return result;
+		}
+	}
+	/* The type never changes, so no lock is needed. */
+	if (tn->tn_type != S_IFDIR) {
+		VOP_DECREF(&tn->tn_v);
+		return ENOTDIR;
+	}
+	*ret = &tn->tn_v;
+	return 0;
+}
+
+//////////////////////////////////////////////////
+
+static
+int
+tmpfs_notdir(void)
+{
+	return ENOTDIR;
+}
+
+static
+int
+tmpfs_isdir(void)
+{
+	return EISDIR;
+}
+
+static
+int
+tmpfs_inval(void)
+{
+	return EINVAL;
+}
+
+/*
+ * Casting through void * prevents warnings.
+ * All of the vnode ops return int, and it's ok to cast functions that
+ * take args to functions that take no args.
+ */
+
+#define ISDIR ((void *)tmpfs_isdir)
+#define NOTDIR ((void *)tmpfs_notdir)
+#define INVAL ((void *)tmpfs_inval)
+
+static const struct vnode_ops tmpfs_fileops = {
+	VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	tmpfs_open,
+	tmpfs_close,
+	tmpfs_reclaim,
+
+	tmpfs_read,
+	INVAL,   /* readlink */
+	NOTDIR,  /* getdirentry */
+	tmpfs_write,
+	tmpfs_ioctl,
+	vnode_pollready,
+	tmpfs_stat,
+	tmpfs_gettype,
+	tmpfs_tryseek,
+	tmpfs_fsync,
+	tmpfs_mmap,
+	tmpfs_truncate,
+	NOTDIR,  /* namefile */
+
+	NOTDIR,  /* creat */
+	NOTDIR,  /* symlink */
+	NOTDIR,  /* mkdir */
+	NOTDIR,  /* link */
+	NOTDIR,  /* remove */
+	NOTDIR,  /* rmdir */
+	NOTDIR,  /* rename */
+
+	NOTDIR,  /* lookup */
+	NOTDIR,  /* lookparent */
+};
+
+static const struct vnode_ops tmpfs_dirops = {
+	VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	tmpfs_opendir,
+	tmpfs_close,
+	tmpfs_reclaim,
+
+	ISDIR,   /* read */
+	INVAL,   /* readlink */
+	tmpfs_getdirentry,
+	ISDIR,   /* write */
+	tmpfs_ioctl,
+	vnode_pollready,
+	tmpfs_stat,
+	tmpfs_gettype,
+	tmpfs_tryseek,
+	tmpfs_fsync,
+	ISDIR,   /* mmap */
+	ISDIR,   /* truncate */
+	tmpfs_namefile,
+
+	tmpfs_creat,
+	tmpfs_symlink,
+	tmpfs_mkdir,
+	tmpfs_link,
+	tmpfs_remove,
+	tmpfs_rmdir,
+	tmpfs_rename,
+
+	tmpfs_lookup,
+	tmpfs_lookparent,
+};
+
+static const struct vnode_ops tmpfs_linkops = {
+	VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	tmpfs_open,
+	tmpfs_close,
+	tmpfs_reclaim,
+
+	INVAL,   /* read */
+	tmpfs_readlink,
+	NOTDIR,  /* getdirentry */
+	INVAL,   /* write */
+	tmpfs_ioctl,
+	vnode_pollready,
+	tmpfs_stat,
+	tmpfs_gettype,
+	tmpfs_tryseek,
+	tmpfs_fsync,
+	INVAL,   /* mmap */
+	INVAL,   /* truncate */
+	NOTDIR,  /* namefile */
+
+	NOTDIR,  /* creat */
+	NOTDIR,  /* symlink */
+	NOTDIR,  /* mkdir */
+	NOTDIR,  /* link */
+	NOTDIR,  /* remove */
+	NOTDIR,  /* rmdir */
+	NOTDIR,  /* rename */
+
+	NOTDIR,  /* lookup */
+	NOTDIR,  /* lookparent */
+};
+
+////////////////////////////////////////////////////////////
+//
+// Filesystem operations
+
+static
+int
+tmpfs_sync(struct fs *fs)
+{
+	(void)fs;
+	return 0;
+}
+
+static
+const char *
+tmpfs_getvolname(struct fs *fs)
+{
+	/* No volume name beyond the one it was added under */
+	(void)fs;
+	return NULL;
+}
+
+static
+struct vnode *
+tmpfs_getroot(struct fs *fs)
+{
+	struct tmpfs *tf = fs->fs_data;
+
+	VOP_INCREF(&tf->tf_root->tn_v);
+	return &tf->tf_root->tn_v;
+}
+
+static
+int
+tmpfs_unmount(struct fs *fs)
+{
+	/* Not really mounted, as with emufs */
+	(void)fs;
+	return EBUSY;
+}
+
+int
+tmpfs_create(const char *name, unsigned maxpages)
+{
+	struct tmpfs *tf;
+	int result;
+
+	tf = kmalloc(sizeof(*tf));
+	if (tf == NULL) {
+		return ENOMEM;
+	}
+	tf->tf_fs.fs_sync = tmpfs_sync;
+	tf->tf_fs.fs_getvolname = tmpfs_getvolname;
+	tf->tf_fs.fs_getroot = tmpfs_getroot;
+	tf->tf_fs.fs_unmount = tmpfs_unmount;
+	tf->tf_fs.fs_data = tf;
+
+	tf->tf_nextino = 1;
+	spinlock_init(&tf->tf_pagelock);
+	tf->tf_npages = 0;
+	tf->tf_maxpages = maxpages;
+	tf->tf_renamelock = lock_create(name);
+	if (tf->tf_renamelock == NULL) {
+		kfree(tf);
+		return ENOMEM;
+	}
+
+	/* The root has its one "name" from the start, and keeps it. */
+	result = tmpfs_newnode(tf, S_IFDIR, &tf->tf_root);
+	if (result) {
+		lock_destroy(tf->tf_renamelock);
+		kfree(tf);
+		return result;
+	}
+	tf->tf_root->tn_nlink = 1;
+
+	result = vfs_addfs(name, &tf->tf_fs);
+	if (result) {
+		tf->tf_root->tn_nlink = 0;
+		tmpfs_freenode(tf, tf->tf_root);
+		lock_destroy(tf->tf_renamelock);
+		kfree(tf);
+		return result;
+	}
+	return 0;
+}
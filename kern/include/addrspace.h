@@ -36,8 +36,15 @@
 
 #include <vm.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 struct vnode;
+#if OPT_A3
+struct array;
+struct lock;
+struct pagetable;
+struct shmseg;
+#endif
 
 /* 
  * Address space - data structure associated with the virtual memory
@@ -46,6 +53,66 @@ struct vnode;
  * You write this.
  */
 
+#if OPT_A3
+
+/*
+ * The user stack region starts out VM_STACKINIT pages long and grows
+ * down on demand, up to VM_STACKPAGES below USERSTACK. The lowest of
+ * those is a guard page that is never mapped, so a runaway stack
+ * faults instead of running into whatever is below it.
+ */
+#define VM_STACKINIT 4
+#define VM_STACKPAGES 256
+
+/*
+ * A region is a page-aligned range of user addresses with uniform
+ * permissions. Pages are allocated on first touch. If rg_filesize is
+ * nonzero, the bytes from rg_fvaddr up to rg_fvaddr + rg_filesize come
+ * from rg_vnode starting at rg_foffset (an ELF segment, or a file
+ * mapped with mmap); everything else in the region reads as zero. The
+ * dirty pages of an rg_shared region are written back to rg_vnode. The
+ * pages of a read-only region with a file behind it are shared with
+ * everything else mapping them through the page cache. The pages of
+ * an rg_shm region are those of a shared memory segment (see shm.h).
+ */
+struct region
+{
+  vaddr_t rg_vbase;
+  size_t rg_npages;
+  bool rg_writeable;
+  vaddr_t rg_fvaddr;
+  off_t rg_foffset;
+  size_t rg_filesize;
+  struct vnode *rg_vnode;      /* backing file, if any */
+  bool rg_shared;              /* MAP_SHARED file mapping */
+  bool rg_mmap;                /* made by mmap, so munmap may remove it */
+  bool rg_stack;               /* the user stack, which grows down */
+  bool rg_heap;                /* the sbrk heap, which grows up */
+  struct shmseg *rg_shm;       /* attached segment, if any */
+};
+
+struct addrspace
+{
+  struct lock *as_lock;        /* held while faulting or evicting */
+  struct array *as_regions;    /* struct region *, by address */
+  struct region *as_lasthit;   /* last one looked up, or NULL */
+  struct pagetable *as_pt;
+  vaddr_t as_nextfault;        /* where a sequential fault would be */
+  unsigned as_prefill;         /* pages to load ahead on one */
+  unsigned as_tlbloads;        /* vm_fault TLB loads */
+  unsigned as_tlbpages;        /* pages mapped by those loads */
+  unsigned as_tlbreach;        /* most TLB entries seen at once */
+  vaddr_t as_heapbase;         /* start of the heap, page-aligned */
+  vaddr_t as_brk;              /* current break; end of the heap */
+  unsigned as_rss;             /* resident pages, shared ones included */
+  unsigned as_minflt;          /* faults served without I/O */
+  unsigned as_majflt;          /* faults that read from file or swap */
+  unsigned as_wsgen;           /* ager sweep as_wscur is counting */
+  unsigned as_wscur;           /* pages seen in use so far in it */
+  unsigned as_wsprev;          /* pages seen in use in the one before */
+};
+
+#else
 struct addrspace
 {
   vaddr_t as_vbase1;
@@ -59,6 +126,7 @@ struct addrspace
   bool loaded;
 #endif
 };
+#endif /* OPT_A3 */
 
 /*
  * Functions in addrspace.c:
@@ -89,11 +157,102 @@ struct addrspace
  *                executable into the address space.
  *
  *    as_complete_load - this is called when loading from an executable
- *                is complete.
+ *                is complete. (With OPT_A3, puts the heap right after
+ *                the last region loaded.)
  *
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_load_segment - record that part of a region is backed by the
+ *                ELF file V, so its pages are read in on first touch
+ *                instead of at load time. (OPT_A3 only.)
+ *
+ *    as_prefill - read in every page of AS that has bytes from its file,
+ *                without counting faults, so that copies made with
+ *                as_copy share them instead of each reading its own.
+ *                Fails with E2BIG, having read nothing, if there are
+ *                more than MAXPAGES of them. Used by the exec cache.
+ *                (OPT_A3 only.)
+ *
+ *    as_fault  - make the page containing VADDR resident, reading or
+ *                zero-filling it as needed, and hand back its frame
+ *                and whether it may be mapped writeable. A fault just
+ *                below the stack grows the stack to cover it. A write to a
+ *                copy-on-write page gets it a private copy first.
+ *                On success as_lock is left held, so that the page
+ *                cannot be evicted before the caller has loaded the
+ *                mapping into the TLB; the caller releases it.
+ *                Called by vm_fault. (OPT_A3 only.)
+ *
+ *    as_prefault - like as_fault for a read of VADDR, made while
+ *                handling a fault at FAULTVADDR with as_lock still
+ *                held: used to load the following pages ahead of time.
+ *                Fails with EFAULT unless VADDR is in the same region as
+ *                FAULTVADDR, and with EEXIST if it is already resident.
+ *                (OPT_A3 only.)
+ *
+ *    as_evict  - take the N pages at VADDRS, resident in frames PADDRS,
+ *                out of the address space, writing them to swap unless
+ *                they can be read back from their file. They follow on
+ *                from each other in one region (see as_evict_next),
+ *                and those written go out together to slots in a row.
+ *                Either all go or, on error, none. Called by the
+ *                coremap with as_lock held; the frames are not freed.
+ *                (OPT_A3 only.)
+ *
+ *    as_evict_next - whether the page after VADDR could go out with it
+ *                in one as_evict: it is in the same region, resident
+ *                and not shared. If so hands back its frame. as_lock
+ *                held. (OPT_A3 only.)
+ *
+ *    as_migrate - move the page at VADDR from frame OLDPADDR to NEWPADDR,
+ *                copying it. Called by the coremap with as_lock held,
+ *                to compact memory; OLDPADDR is not freed. (OPT_A3 only.)
+ *
+ *    as_age    - mark the page at VADDR, resident in frame PADDR,
+ *                PTE_AGED, so that the next touch of it faults, and
+ *                return whether it was in use (not aged) until now,
+ *                counting it toward the working set if so. The caller
+ *                removes it from the TLB if it was. Called by the
+ *                coremap's ager with as_lock held. (OPT_A3 only.)
+ *
+ *    as_wss    - the working set of AS: how many of its private pages
+ *                were in use during the ager's last full sweep.
+ *                (OPT_A3 only.)
+ *
+ *    as_copypage - copy LEN bytes between KBUF and user address UADDR,
+ *                which lie within one page, through the page's frame
+ *                instead of the TLB, faulting it in (or getting it a
+ *                private copy) first as need be. A whole page copied
+ *                TOUSER is not read in or zero-filled beforehand.
+ *                Fails with EFAULT where copyin/copyout would. Used by
+ *                uiomove. (OPT_A3 only.)
+ *
+ *    as_mmap   - add a region of LEN bytes somewhere below the stack and
+ *                hand back its address, which is a multiple of ALIGN (a
+ *                power of two; 0 for any page). If V is not NULL the region maps
+ *                V from OFFSET, which must be page-aligned; with SHARED,
+ *                changes are written back to V. (OPT_A3 only.)
+ *
+ *    as_munmap - remove a region made by as_mmap, writing back any
+ *                changes to a shared one. Only whole regions can be
+ *                removed. (OPT_A3 only.)
+ *
+ *    as_shmat  - map the shared memory segment SEG somewhere below the
+ *                stack, read-only unless WRITEABLE, and hand back its
+ *                address. The region takes over the caller's
+ *                attachment to SEG. (OPT_A3 only.)
+ *
+ *    as_shmdt  - unmap the segment attached at VADDR, dropping the
+ *                attachment. (OPT_A3 only.)
+ *
+ *    as_sbrk   - move the break by AMOUNT bytes, either way, and hand
+ *                back the old one. Pages the heap grows into are zero-
+ *                filled on first touch; pages it shrinks out of are
+ *                freed. Fails with EINVAL below the start of the heap
+ *                and ENOMEM if it would run into another region.
+ *                (OPT_A3 only.)
  */
 
 struct addrspace *as_create(void);
@@ -110,14 +269,45 @@ int as_define_region(struct addrspace *as,
 int as_prepare_load(struct addrspace *as);
 int as_complete_load(struct addrspace *as);
 int as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if OPT_A3
+int as_load_segment(struct addrspace *as, struct vnode *v,
+                    off_t offset, vaddr_t vaddr,
+                    size_t memsize, size_t filesize);
+int as_prefill(struct addrspace *as, unsigned maxpages);
+int as_fault(struct addrspace *as, int faulttype, vaddr_t vaddr,
+             paddr_t *ret_paddr, bool *ret_writeable);
+int as_prefault(struct addrspace *as, vaddr_t faultvaddr, vaddr_t vaddr,
+                paddr_t *ret_paddr, bool *ret_writeable);
+int as_evict(struct addrspace *as, const vaddr_t *vaddrs,
+             const paddr_t *paddrs, unsigned n);
+bool as_evict_next(struct addrspace *as, vaddr_t vaddr, paddr_t *ret_paddr);
+void as_migrate(struct addrspace *as, vaddr_t vaddr, paddr_t oldpaddr,
+                paddr_t newpaddr);
+bool as_age(struct addrspace *as, vaddr_t vaddr, paddr_t paddr);
+unsigned as_wss(struct addrspace *as);
+int as_copypage(struct addrspace *as, vaddr_t uaddr, void *kbuf, size_t len,
+                bool touser);
+int as_mmap(struct addrspace *as, size_t len, vaddr_t align, bool writeable,
+            struct vnode *v, off_t offset, bool shared, vaddr_t *ret);
+int as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int as_shmat(struct addrspace *as, struct shmseg *seg, bool writeable,
+             vaddr_t *ret);
+int as_shmdt(struct addrspace *as, vaddr_t vaddr);
+int as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *ret);
+#endif
 
 /*
  * Functions in loadelf.c
  *    load_elf - load an ELF user program executable into the current
  *               address space. Returns the entry point (initial PC)
  *               in the space pointed to by ENTRYPOINT.
+ *
+ *    load_elf_as - the same, into AS, which with OPT_A3 need not be
+ *               the current address space (nothing is read into it
+ *               then, only recorded); without OPT_A3 it must be.
  */
 
 int load_elf(struct vnode *v, vaddr_t *entrypoint);
+int load_elf_as(struct addrspace *as, struct vnode *v, vaddr_t *entrypoint);
 
 #endif /* _ADDRSPACE_H_ */
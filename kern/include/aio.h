@@ -0,0 +1,18 @@
+#ifndef _AIO_H_
+#define _AIO_H_
+
+/*
+ * Asynchronous I/O (see aio_syscalls.c and kern/aio.h).
+ *
+ * Functions:
+ *     aio_destroy - free a process's aio state, once none of its
+ *                   threads are left to use it (proc_destroy), or at
+ *                   execv, whose check for other threads means no
+ *                   I/O is in progress.
+ */
+
+struct aio_ctx;
+
+void aio_destroy(struct aio_ctx *ac);
+
+#endif /* _AIO_H_ */
@@ -0,0 +1,47 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+/*
+ * Arenas: scratch memory that is freed all at once.
+ *
+ * An arena hands out memory by bumping a pointer through chunks got
+ * from kmalloc. Nothing is freed piece by piece; instead the caller
+ * takes a mark before allocating and releases back to it afterwards,
+ * which frees everything allocated since. Marks nest, so a function
+ * can use an arena its caller is already using.
+ *
+ * Each thread has one, t_arena, for temporaries that do not outlive a
+ * system call. Chunks are a page unless a bigger one is needed; after a
+ * release, one page-sized chunk is kept for next time, so a syscall
+ * that needs less than a page does not go to kmalloc at all after the
+ * first.
+ *
+ * Functions:
+ *     arena_init    - set up an empty arena.
+ *     arena_cleanup - free everything, including the spare chunk.
+ *     arena_alloc   - get SIZE bytes, aligned for any type. Returns
+ *                     NULL on out-of-memory.
+ *     arena_mark    - remember the current position in MARK.
+ *     arena_release - free everything allocated since MARK was taken.
+ */
+
+struct arena_chunk;
+
+struct arena {
+	struct arena_chunk *a_chunk;	/* newest chunk */
+	size_t a_used;			/* bytes used of it */
+	struct arena_chunk *a_spare;	/* kept from the last release */
+};
+
+struct arena_mark {
+	struct arena_chunk *am_chunk;
+	size_t am_used;
+};
+
+void arena_init(struct arena *a);
+void arena_cleanup(struct arena *a);
+void *arena_alloc(struct arena *a, size_t size);
+void arena_mark(struct arena *a, struct arena_mark *mark);
+void arena_release(struct arena *a, const struct arena_mark *mark);
+
+#endif /* _ARENA_H_ */
@@ -53,6 +53,8 @@
  * get - return element no. INDEX.
  * set - set element no. INDEX to VAL.
  * setsize - change size to NUM elements; may fail and return error.
+ * preallocate - make room for NUM elements without changing the size,
+ *       so adding up to that many cannot fail; may fail and return error.
  * add - append VAL to end of array; return its index in INDEX_RET if
  *       INDEX_RET isn't null; may fail and return error.
  * remove - excise entry INDEX and slide following entries down to
@@ -75,6 +77,7 @@ unsigned array_num(const struct array *);
 void *array_get(const struct array *, unsigned index);
 void array_set(const struct array *, unsigned index, void *val);
 int array_setsize(struct array *, unsigned num);
+int array_preallocate(struct array *, unsigned num);
 int array_add(struct array *, void *val, unsigned *index_ret);
 void array_remove(struct array *, unsigned index);
 
@@ -176,6 +179,7 @@ array_add(struct array *a, void *val, unsigned *index_ret)
 	T *ARRAY##_get(const struct ARRAY *a, unsigned index);	\
 	void ARRAY##_set(struct ARRAY *a, unsigned index, T *val); \
 	int ARRAY##_setsize(struct ARRAY *a, unsigned num);	\
+	int ARRAY##_preallocate(struct ARRAY *a, unsigned num);	\
 	int ARRAY##_add(struct ARRAY *a, T *val, unsigned *index_ret); \
 	void ARRAY##_remove(struct ARRAY *a, unsigned index)
 
@@ -235,6 +239,12 @@ array_add(struct array *a, void *val, unsigned *index_ret)
 	}							\
 								\
 	INLINE int						\
+	ARRAY##_preallocate(struct ARRAY *a, unsigned num)	\
+	{							\
+		return array_preallocate(&a->arr, num);		\
+	}							\
+								\
+	INLINE int						\
 	ARRAY##_add(struct ARRAY *a, T *val, unsigned *index_ret) \
 	{							\
 		return array_add(&a->arr, (void *)val, index_ret); \
@@ -0,0 +1,30 @@
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on memory words, for the few places that share
+ * data between cpus without a lock. As with spinlocks, the guts are
+ * machine-dependent.
+ *
+ * Functions:
+ *     atomic_cas_ptr - if *P is OLD, make it NEW; returns true if it
+ *                      did.
+ *     atomic_cas     - the same, for an unsigned.
+ *     atomic_inc     - add one to *P.
+ *     atomic_next    - add one to *P, and return what it was before.
+ *     atomic_add     - add DELTA (which may be negative) to *P, and
+ *                      return what it was before.
+ *     membar_sync    - finish all loads and stores before this before
+ *                      doing any after it.
+ */
+
+#include <cdefs.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+#include <machine/atomic.h>
+
+#endif /* _ATOMIC_H_ */
@@ -0,0 +1,49 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/*
+ * Kernel benchmarks: a uniform way to time an operation.
+ *
+ * A benchmark is an operation, b_op, called with the argument its
+ * b_setup (if any) made, which b_cleanup (if any) is given at the end.
+ * bench_run does b_op some number of times untimed, to warm up the
+ * caches, and then times a number of samples of b_batch calls each
+ * with clock_monotonic_ns. A batch should be long enough (a few
+ * microseconds) that reading the clock is lost in it. It prints one
+ * line, the same for every benchmark so scripts can read it:
+ *
+ *   bench <name> samples=<n> batch=<b> min=<ns> median=<ns> p99=<ns> max=<ns>
+ *
+ * with the nanoseconds per call. b_setup returns an error code, which
+ * bench_run passes on without running anything.
+ *
+ * A benchmark is defined with BENCH (usually next to what it measures)
+ * and listed in the table in test/bench.c; the bench menu command
+ * runs one or all of them.
+ *
+ * Functions:
+ *     bench_run   - warm up WARMUP calls, then time SAMPLES batches.
+ *     bench_find  - the listed benchmark named NAME, or NULL.
+ *     bench_print - print the list, for the menu.
+ */
+
+struct bench {
+	const char *b_name;
+	const char *b_desc;
+	int (*b_setup)(void **ret);
+	void (*b_op)(void *arg);
+	void (*b_cleanup)(void *arg);
+	unsigned b_batch;		/* calls per timed sample */
+};
+
+#define BENCH(sym, name, desc, setup, op, cleanup, batch) \
+	const struct bench bench_##sym = { name, desc, setup, op, cleanup, batch }
+
+#define BENCH_WARMUP	100		/* default calls to warm up with */
+#define BENCH_SAMPLES	200		/* default samples */
+
+int bench_run(const struct bench *b, unsigned warmup, unsigned samples);
+const struct bench *bench_find(const char *name);
+void bench_print(void);
+
+#endif /* _BENCH_H_ */
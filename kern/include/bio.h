@@ -0,0 +1,108 @@
+#ifndef _BIO_H_
+#define _BIO_H_
+
+/*
+ * Block I/O requests.
+ *
+ * A bio asks a block device to move BIO_NBLOCKS of its blocks, from
+ * BIO_BLOCK on, to or from the kernel buffer BIO_DATA. The device's
+ * d_strategy queues it and returns at once; the device works through
+ * its queue, from its interrupt handler, starting the next request
+ * (chosen as described below) as soon as one finishes, and when a bio is over sets
+ * bio_error and calls bio_done. That is in interrupt context, so it
+ * must not sleep; it may wake a thread, or submit another bio. Until
+ * then the bio and its buffer belong to the device.
+ *
+ * The blocks of one bio are done together, so a multi-block transfer
+ * is not interleaved with others.
+ *
+ * Functions:
+ *     bio_init   - set up BIO to move NBLOCKS blocks from BLOCK on
+ *                  between the device and DATA, with no callback.
+ *     bio_submit - hand BIO to device D. Fails with EINVAL, without
+ *                  calling bio_done, if the blocks are not all on D,
+ *                  and with ENOTSUP if D does not take bios.
+ *     bio_wait   - submit BIO to D and sleep until it is over. Returns
+ *                  its bio_error. Sets bio_done itself.
+ *     bio_start  - the first half of bio_wait: submit BIO to D, for
+ *                  bio_await. Fails as bio_submit does.
+ *     bio_await  - the second half: sleep until BIO, started with
+ *                  bio_start, is over, and return its bio_error. Useful
+ *                  to have several bios in progress at once.
+ *     bio_finish - for drivers: the bio is over with error ERR.
+ *
+ * A driver keeps the bios waiting for it in a bioq, which decides what
+ * to do next, by the policy in bioq_policy (all queues share it):
+ *     BIOQ_FIFO     - in the order they came.
+ *     BIOQ_CLOOK    - in one sweep up the disk: the lowest block at or
+ *                     past where the last request ended, and back to
+ *                     the lowest of all when there is none. A request
+ *                     that starts where the one before ended, as the
+ *                     blocks of a file usually do, is always taken
+ *                     next, so adjacent requests go back to back as if
+ *                     merged, with no seek between.
+ *     BIOQ_DEADLINE - C-LOOK, except that a request passed over by
+ *                     bioq_readmax (reads) or bioq_writemax (writes)
+ *                     later ones is taken first, oldest first, so that
+ *                     a sweep elsewhere cannot starve it; reads, which
+ *                     someone is usually waiting for, wait less.
+ *
+ *     bioq_init     - set up an empty queue.
+ *     bioq_add      - add BIO.
+ *     bioq_next     - take the next bio to do off the queue, or NULL.
+ *     bioq_setpolicy - change the policy, and the deadline limits if not
+ *                     0. EINVAL for an unknown policy.
+ *     bioq_print    - print the settings.
+ * The caller provides the locking.
+ */
+
+#include <kern/iovec.h>
+#include <uio.h>
+
+struct device;
+
+struct bio {
+	enum uio_rw bio_rw;
+	uint32_t bio_block;		/* first device block */
+	uint32_t bio_nblocks;
+	void *bio_data;			/* bio_nblocks blocks */
+	int bio_error;			/* set when done */
+	void (*bio_done)(struct bio *);	/* called when done, or NULL */
+	void *bio_arg;			/* for bio_done */
+	struct bio *bio_next;		/* in the device's queue */
+	unsigned bio_seq;		/* bq_taken when queued */
+	uint64_t bio_issued;		/* for the driver's iostat_done */
+	volatile bool bio_over;		/* for bio_await */
+};
+
+#define BIOQ_FIFO	0
+#define BIOQ_CLOOK	1
+#define BIOQ_DEADLINE	2
+
+struct bioq {
+	struct bio *bq_first;		/* in arrival order */
+	struct bio *bq_last;
+	uint32_t bq_pos;		/* block after the last one taken */
+	unsigned bq_taken;		/* how many have been taken */
+};
+
+extern int bioq_policy;
+extern unsigned bioq_readmax, bioq_writemax;
+
+void bio_bootstrap(void);
+
+void bio_init(struct bio *bio, enum uio_rw rw, uint32_t block,
+	      uint32_t nblocks, void *data);
+int bio_submit(struct device *d, struct bio *bio);
+int bio_wait(struct device *d, struct bio *bio);
+int bio_start(struct device *d, struct bio *bio);
+int bio_await(struct bio *bio);
+void bio_finish(struct bio *bio, int err);
+
+void bioq_init(struct bioq *bq);
+void bioq_add(struct bioq *bq, struct bio *bio);
+struct bio *bioq_next(struct bioq *bq);
+int bioq_setpolicy(int policy, unsigned readmax, unsigned writemax);
+void bioq_print(void);
+
+#endif /* _BIO_H_ */
@@ -38,8 +38,15 @@
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *     bitmap_alloc_near - the same, preferring bits at or just after GOAL,
+ *                      then the start of a clear run.
+ *     bitmap_alloc_range - bitmap_alloc_near, within bits LO to HI-1.
+ *     bitmap_alloc_run - locate the first N consecutive cleared bits, set
+ *                      them, and return the index of the first.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
+ *     bitmap_mark_run - set the N clear bits from INDEX.
+ *     bitmap_unmark_run - clear the N set bits from INDEX.
  *     bitmap_isset   - return whether a particular bit is set or not.
  *     bitmap_destroy - destroy bitmap.
  */
@@ -50,8 +57,15 @@ struct bitmap;  /* Opaque. */
 struct bitmap *bitmap_create(unsigned nbits);
 void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, unsigned *index);
+int            bitmap_alloc_near(struct bitmap *, unsigned goal,
+                                 unsigned *index);
+int            bitmap_alloc_range(struct bitmap *, unsigned lo, unsigned hi,
+                                  unsigned goal, unsigned *index);
+int            bitmap_alloc_run(struct bitmap *, unsigned n, unsigned *index);
 void           bitmap_mark(struct bitmap *, unsigned index);
 void           bitmap_unmark(struct bitmap *, unsigned index);
+void           bitmap_mark_run(struct bitmap *, unsigned index, unsigned n);
+void           bitmap_unmark_run(struct bitmap *, unsigned index, unsigned n);
 int            bitmap_isset(struct bitmap *, unsigned index);
 void           bitmap_destroy(struct bitmap *);
 
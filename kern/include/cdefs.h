@@ -52,6 +52,28 @@
 #endif
 
 
+/*
+ * Tell GCC which way a test almost always comes out.
+ */
+#ifdef __GNUC__
+#define __predict_true(x) __builtin_expect(!!(x), 1)
+#define __predict_false(x) __builtin_expect(!!(x), 0)
+#else
+#define __predict_true(x) (x)
+#define __predict_false(x) (x)
+#endif
+
+
+/*
+ * Tell GCC to align a type or field to N bytes.
+ */
+#ifdef __GNUC__
+#define __ALIGNED(n) __attribute__((__aligned__(n)))
+#else
+#define __ALIGNED(n)
+#endif
+
+
 /*
  * Material for supporting inline functions.
  *
@@ -35,15 +35,25 @@
 /*
  * Time-related definitions.
  *
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU HZ times a second, for
+ * scheduling. It stops when the CPU goes idle and starts again when
+ * it has something to run.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on one CPU every timer tick (LT_GRANULARITY
+ * usec) to run timeouts, while there are any; see below.
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
  *
+ * clock_monotonic_ns() gives the nanoseconds since boot, from the cpu
+ * cycle counter: fine-grained enough to time a few instructions, and
+ * much cheaper to read than the rtclock, which is only consulted to
+ * calibrate it (clock_monotonic_bootstrap, once the rtclock is
+ * attached) and now and then to keep it in step (clock_anchor, from
+ * the hardclock). It never goes backwards. Before calibration it is 0.
+ * clock_cycles_ns() turns a count of cpu cycles into nanoseconds at
+ * the calibrated rate, for what was timed with cpu_cycles() alone.
+ *
  * XXX we have struct timespec now, let's use it.
  */
 
@@ -56,6 +66,9 @@
 #define HZ  100
 #endif
 
+/* Reschedule every 4 hardclocks; this is also the scheduler's quantum. */
+#define SCHEDULE_HARDCLOCKS	4
+
 void hardclock_bootstrap(void);
 
 void hardclock(void);
@@ -63,15 +76,55 @@ void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
 
+void clock_monotonic_bootstrap(void);
+void clock_anchor(void);
+uint64_t clock_monotonic_ns(void);
+uint64_t clock_cycles_ns(uint32_t cycles);
+
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
                  time_t *rsecs, uint32_t *rnsecs);
 
+/*
+ * Timeouts, for sleeping until a deadline in timer ticks.
+ *
+ * A timeout is armed for a thread that is about to sleep on a wait
+ * channel; once its deadline passes, timerclock() sets to_fired and
+ * wakes that thread alone (wchan_wakethread) if it is on the channel.
+ * Pending timeouts are kept sorted, so each tick only looks at the
+ * ones that are due.
+ *
+ * The protocol, for a caller that has its own reasons to wake too:
+ *     timeout_start(&to, ticks, wc);
+ *     wchan_lock(wc);
+ *     ...release whatever the wakers use...
+ *     if (to.to_fired) wchan_unlock(wc); else wchan_sleep(wc);
+ *     fired = timeout_stop(&to);
+ * to_fired must be looked at with the wchan locked, which closes the
+ * gap between deciding to sleep and being on the channel. The struct
+ * timeout can be on the stack; after timeout_stop the timer is done
+ * with it. timeout_stop returns true if the deadline passed.
+ */
+struct thread;
+struct wchan;
+
+struct timeout {
+	unsigned to_deadline;		/* tick to fire at */
+	struct thread *to_thread;	/* who to wake */
+	struct wchan *to_wchan;		/* where they sleep */
+	volatile bool to_fired;
+	bool to_pending;		/* on the queue */
+	struct timeout *to_next;
+};
+
+void timeout_start(struct timeout *to, unsigned ticks, struct wchan *wc);
+bool timeout_stop(struct timeout *to);
+
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
  *
- *  this will be more efficient than clocknap() for longer sleeps
+ * (It is clocknap() with the ticks in a second.)
  */
 void clocksleep(int seconds);
 
@@ -83,5 +136,16 @@ void clocksleep(int seconds);
  */
 void clocknap(int ticks);
 
+/*
+ * The time page (see <kern/timepage.h>). timepage_bootstrap allocates
+ * it, once the VM system is up; after that hardclock keeps it current,
+ * and timepage_update brings it up to date at other times, like when a
+ * cpu's hardclock starts again after it was idle. timepage_paddr is
+ * where it is, for vm_fault to map.
+ */
+void timepage_bootstrap(void);
+void timepage_update(void);
+paddr_t timepage_paddr(void);
+
 
 #endif /* _CLOCK_H_ */
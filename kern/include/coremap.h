@@ -0,0 +1,108 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical frame allocator (coremap).
+ *
+ * The coremap keeps one entry per physical page frame managed by the
+ * VM system. Free frames are kept on binary-buddy free lists, one per
+ * block order, so allocating or freeing a run of frames costs
+ * O(log n) in the size of physical memory instead of a scan over the
+ * whole map.
+ *
+ * Requests for a number of pages that is not a power of two are
+ * carved out of the next larger block; the unused tail is returned to
+ * the free lists straight away, so nothing is wasted. The length of
+ * each allocation is remembered in the coremap so that coremap_free
+ * only needs the base address.
+ *
+ * Functions:
+ *     coremap_bootstrap - take over the physical memory reported by
+ *                         ram_getsize. Called once from vm_bootstrap.
+ *     coremap_ready     - true once coremap_bootstrap has run. Before
+ *                         that, pages must come from ram_stealmem.
+ *     coremap_alloc     - allocate NPAGES physically contiguous frames.
+ *                         Returns the physical address of the first
+ *                         one, or 0 if no run of that size is free.
+ *                         A single frame may be made free by evicting
+ *                         a user page to swap, and a longer run by
+ *                         moving user pages out of it, if the caller
+ *                         can sleep.
+ *     coremap_tryalloc  - allocate a single frame, but only if memory
+ *                         is plentiful: never evicts anything, and
+ *                         leaves a reserve free. For speculative use.
+ *                         Returns 0 otherwise.
+ *     coremap_alloc_zeroed - allocate a single zero-filled frame, from
+ *                         the pool kept by the zeroer thread if it
+ *                         has any. Returns 0 if out of memory.
+ *     coremap_zeropage  - the shared zero page. Map it only read-only
+ *                         and copy-on-write, and take a reference
+ *                         (coremap_tryincref) for each mapping.
+ *     coremap_start_zeroer - start the thread that keeps the zeroed
+ *                         pool filled. Called once from vm_bootstrap.
+ *     coremap_start_ager - start the thread that ages user pages to
+ *                         find which are in use. Called once from
+ *                         vm_bootstrap, once TLB shootdowns work.
+ *     coremap_agegen    - number of sweeps the ager has finished.
+ *     coremap_free      - release a run returned by coremap_alloc. If
+ *                         the run is shared, only drops one reference.
+ *     coremap_grow      - extend the unshared run at PADDR to NPAGES in
+ *                         place. Returns false if the frames after it
+ *                         are not all free on the buddy lists.
+ *     coremap_owns      - true if PADDR lies in memory managed by the
+ *                         coremap (as opposed to stolen at boot).
+ *     coremap_incref    - add an owner to a single-frame run, for
+ *                         sharing it copy-on-write.
+ *     coremap_tryincref - the same, but returns false instead of
+ *                         panicking if the run already has CM_MAXREFS
+ *                         owners.
+ *     coremap_refcount  - number of owners of the run at PADDR.
+ *     coremap_stats     - count how the managed frames are used: free
+ *                         (including the zeroed pool and the per-cpu
+ *                         caches), mapped into user space, or used by
+ *                         the kernel. A frame counts as a user frame
+ *                         once it has been mapped by any address space.
+ *     coremap_set_owner - record that the unshared frame at PADDR is
+ *                         mapped at VADDR in AS, making it evictable,
+ *                         and mark it recently used. AS's as_lock
+ *                         must be held. The record goes away when the
+ *                         frame is freed, shared or evicted.
+ */
+
+#include <machine/vm.h>
+
+struct addrspace;
+
+/* Largest buddy block is 2^CM_MAXORDER pages (4M with 4k pages). */
+#define CM_MAXORDER 10
+
+/* Most owners a single frame can have. */
+#define CM_MAXREFS 0xffff
+
+struct coremap_stats {
+	unsigned cs_total;	/* frames managed by the coremap */
+	unsigned cs_free;	/* of which free */
+	unsigned cs_zeroed;	/* of the free ones, in the zeroed pool */
+	unsigned cs_user;	/* holding user pages */
+	unsigned cs_kernel;	/* used by the kernel */
+};
+
+void coremap_bootstrap(void);
+bool coremap_ready(void);
+paddr_t coremap_alloc(unsigned long npages);
+paddr_t coremap_tryalloc(void);
+paddr_t coremap_alloc_zeroed(void);
+paddr_t coremap_zeropage(void);
+void coremap_start_zeroer(void);
+void coremap_start_ager(void);
+unsigned coremap_agegen(void);
+void coremap_free(paddr_t paddr);
+bool coremap_grow(paddr_t paddr, unsigned long npages);
+bool coremap_owns(paddr_t paddr);
+void coremap_incref(paddr_t paddr);
+bool coremap_tryincref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+void coremap_stats(struct coremap_stats *cs);
+void coremap_set_owner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+
+#endif /* _COREMAP_H_ */
@@ -34,6 +34,13 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <kern/schedstat.h>  /* for SCHEDSTAT_RQHIST */
+#include "opt-A3.h"
+
+#if OPT_A3
+/* Size of the per-cpu cache of free page frames (see coremap.c). */
+#define CPU_PAGECACHE_MAX 16
+#endif
 
 
 /*
@@ -55,20 +62,59 @@ struct cpu {
 	unsigned c_hardware_number;	/* Hardware-defined cpu number */
 
 	/*
-	 * Accessed only by this cpu.
+	 * Accessed only by this cpu. Each group that is touched by a
+	 * different set of cpus starts a new cache line, as does the
+	 * structure itself (see cpu_create), so no cpu's writes cause
+	 * cache traffic for another cpu's data.
 	 */
-	struct thread *c_curthread;	/* Current thread on cpu */
+	struct thread *c_curthread __ALIGNED(CACHELINE_SIZE);
+					/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_spares;	/* Destroyed threads, for reuse */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	bool c_tickless;		/* hardclock stopped while idle */
+	uint64_t c_idlecycles;		/* Cycles spent in cpu_idle */
+	bool c_clockset;		/* the clock anchor has been set */
+	uint32_t c_clockcycles;		/* cpu_cycles() at the anchor */
+	uint64_t c_clockns;		/* clock time at the anchor */
+	uint64_t c_clocklast;		/* clock_monotonic_ns last gave */
+	unsigned c_rqhist[SCHEDSTAT_RQHIST];
+					/* Hardclocks that found N waiting */
+	vaddr_t c_intrpc;		/* Where the interrupt came in */
+	bool c_intruser;		/* ... and if it was in user mode */
+	bool c_preempt;			/* switch at the next chance; see
+					   thread_preempt */
+#if OPT_A3
+	/* Free frames held back from the coremap; interrupts off. */
+	paddr_t c_pagecache[CPU_PAGECACHE_MAX];
+	unsigned c_pagecache_count;
+#endif
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
-	bool c_isidle;			/* True if this cpu is idle */
+	bool c_isidle __ALIGNED(CACHELINE_SIZE);
+					/* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Accessed by other cpus without locking.
+	 *
+	 * Threads made runnable on this cpu by other cpus are pushed
+	 * onto c_inbox (linked through t_inboxnext, newest first) with
+	 * atomic_cas_ptr, and moved to the run queue by this cpu the
+	 * next time it takes its runqueue lock. c_inboxin counts the
+	 * pushes and c_inboxout, written only by this cpu, the drained
+	 * ones, so the difference is how many are waiting.
+	 */
+	struct thread *volatile c_inbox __ALIGNED(CACHELINE_SIZE);
+	volatile unsigned c_inboxin;
+	unsigned c_inboxout;
+	volatile unsigned c_curprio;	/* c_curthread's, when it came on */
+	volatile unsigned c_rcugen;	/* quiescent states passed (rcu.h) */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -83,7 +129,8 @@ struct cpu {
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
 	 */
-	uint32_t c_ipi_pending;		/* One bit for each IPI number */
+	uint32_t c_ipi_pending __ALIGNED(CACHELINE_SIZE);
+					/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
 	struct spinlock c_ipi_lock;
@@ -109,11 +156,26 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * cpu_count returns how many cpus there are; cpu_get returns cpu
+ * number NUM (0 to cpu_count()-1). cpu_count is only a load, as loops
+ * over the cpus test it every time round.
+ */
+extern unsigned cpu_ncpus;
+#define cpu_count() (cpu_ncpus)
+struct cpu *cpu_get(unsigned num);
+
 /*
  * Return a string describing the CPU type.
  */
 const char *cpu_identify(void);
 
+/*
+ * Read the current CPU's cycle counter. It wraps, so only differences
+ * are meaningful, and only between readings on the same CPU.
+ */
+uint32_t cpu_cycles(void);
+
 /*
  * Hardware-level interrupt on/off, for the current CPU.
  *
@@ -152,6 +214,12 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_multi queues N shootdowns for one CPU and sends it
+ * a single IPI for all of them.
+ *
+ * Requests coalesce: while a CPU has IPIs pending that it has not yet
+ * taken, more are only added to its pending bits and shootdown list,
+ * without interrupting it again, and one interrupt handles them all.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -162,10 +230,13 @@ void cpu_halt(void);
 #define IPI_OFFLINE		1	/* CPU is requested to go offline */
 #define IPI_UNIDLE		2	/* Runnable threads are available */
 #define IPI_TLBSHOOTDOWN	3	/* MMU mapping(s) need invalidation */
+#define IPI_PREEMPT		4	/* A better thread has been posted */
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_multi(struct cpu *target,
+			    const struct tlbshootdown *mappings, unsigned n);
 
 void interprocessor_interrupt(void);
 
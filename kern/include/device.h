@@ -36,16 +36,23 @@
 
 
 struct uio;  /* in <uio.h> */
+struct poller;  /* in <poll.h> */
+struct bio;  /* in <bio.h> */
 
 /*
  * Filesystem-namespace-accessible device.
  * d_io is for both reads and writes; the uio indicates the direction.
+ * d_poll is as vop_poll, and may be NULL for a device that never blocks.
+ * d_strategy queues a struct bio (see bio.h) on a block device, to be
+ * done asynchronously; it is NULL for devices that are not disks.
  */
 struct device {
 	int (*d_open)(struct device *, int flags_from_open);
 	int (*d_close)(struct device *);
 	int (*d_io)(struct device *, struct uio *);
 	int (*d_ioctl)(struct device *, int op, userptr_t data);
+	int (*d_poll)(struct device *, int events, struct poller *);
+	int (*d_strategy)(struct device *, struct bio *);
 
 	blkcnt_t d_blocks;
 	blksize_t d_blocksize;
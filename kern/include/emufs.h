@@ -41,17 +41,50 @@
  * Our structures
  */
 
+/* Hash chains for the table of loaded vnodes, by handle; a power of 2 */
+#define EMUFS_VNHASH	64
+
+/*
+ * File contents read from the host are kept in pages, by handle and
+ * page number, up to EMUFS_MAXPAGES of them, reused least recently
+ * used first. They are dropped when the file is written or truncated
+ * through emufs, and when its size on the host is seen to have changed.
+ */
+#define EMUFS_PAGESIZE	4096
+#define EMUFS_MAXPAGES	32
+#define EMUFS_PAGEHASH	16	/* a power of 2 */
+
+struct emufs_page {
+	bool ep_used;			/* holds data for ep_handle */
+	uint32_t ep_handle;
+	uint32_t ep_pageno;		/* offset / EMUFS_PAGESIZE */
+	uint32_t ep_len;		/* bytes valid; short at EOF */
+	char *ep_data;
+	struct emufs_page *ep_hashnext;
+	struct emufs_page *ep_lrunext;
+	struct emufs_page *ep_lruprev;
+};
+
 struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+	struct emufs_vnode *ev_hashnext; /* in ef_vnhash */
+	off_t ev_cachesize;		/* size its pages were read at, or -1 */
 };
 
 struct emufs_fs {
 	struct fs ef_fs;		/* abstract filesystem structure */
 	struct emu_softc *ef_emu;	/* device */
 	struct emufs_vnode *ef_root;	/* root vnode */
-	struct vnodearray *ef_vnodes;	/* table of loaded vnodes */
+	struct lock *ef_vnlock;		/* for ef_vnhash */
+	struct emufs_vnode *ef_vnhash[EMUFS_VNHASH]; /* loaded vnodes */
+
+	/* The page cache; protected by the device's e_lock */
+	struct emufs_page *ef_pagehash[EMUFS_PAGEHASH];
+	struct emufs_page *ef_lru;	/* most recently used first */
+	struct emufs_page *ef_lrutail;
+	unsigned ef_npages;
 };
 
 
@@ -0,0 +1,68 @@
+#ifndef _EXECCACHE_H_
+#define _EXECCACHE_H_
+
+/*
+ * The exec cache: ready-made images of recently run programs, so that
+ * running one again is a copy of an address space instead of a load.
+ *
+ * The first exec of a file loads it into an address space of its own,
+ * the template, which never runs: its segments are laid out as
+ * load_elf leaves them and every page with bytes from the file is
+ * read in. Each exec of the same file is then an as_copy of the
+ * template, which shares all of those pages copy-on-write, so the new
+ * process starts with its text and data resident and mapped, with no
+ * ELF headers to read and no faults to take on them; only the stack
+ * and the rest of its private pages are its own. Programs bigger than
+ * EXECCACHE_MAXPAGES are loaded as usual and not kept.
+ *
+ * Templates are found by vnode and checked against the file's size.
+ * Filesystems keep no modification times, so a template is dropped
+ * when the file changes instead: pagecache_invalidate, pagecache_purge
+ * and pagecache_purgefs, which the filesystems call after a write, a
+ * truncate, the last name going or an unmount, call execcache_forget
+ * or execcache_forgetfs. At most EXECCACHE_SIZE templates are kept;
+ * the least recently used goes to make room, and the shrinker lets go
+ * of every template when memory runs short. A template holds a
+ * reference to its vnode, so the vnode it is found by stays the same
+ * one while it lasts.
+ *
+ * execcache_forget is called with filesystem locks held, and building
+ * a template reads the file, so the table is covered by a spinlock and
+ * templates are never made or destroyed while it is held: those let go
+ * of are unhooked under it and destroyed after it, except that one
+ * still being copied is destroyed when the copy is done.
+ *
+ * The cache is part of the paging VM; without OPT_A3 exec loads every
+ * program itself.
+ *
+ * Functions:
+ *     execcache_bootstrap - set up. Called once from vm_bootstrap.
+ *     execcache_load      - hand back a new address space holding the
+ *                           program in V, ready for as_define_stack,
+ *                           and its entry point, making a template of
+ *                           it if there is none. Fails as load_elf
+ *                           does if V is not a program.
+ *     execcache_forget    - drop any template of V; V has changed.
+ *     execcache_forgetfs  - drop every template of a file on FS.
+ */
+
+#include "opt-A3.h"
+
+#if OPT_A3
+
+struct addrspace;
+struct vnode;
+struct fs;
+
+#define EXECCACHE_SIZE 8
+#define EXECCACHE_MAXPAGES 256
+
+void execcache_bootstrap(void);
+int execcache_load(struct vnode *v, struct addrspace **ret,
+		   vaddr_t *entrypoint);
+void execcache_forget(struct vnode *v);
+void execcache_forgetfs(struct fs *fs);
+
+#endif /* OPT_A3 */
+
+#endif /* _EXECCACHE_H_ */
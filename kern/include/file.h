@@ -0,0 +1,100 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+/*
+ * Open files and file descriptor tables.
+ *
+ * An open file is what open() makes: a vnode, the flags it was opened
+ * with, and the seek position. It is shared by every descriptor that
+ * refers to it, in this process (dup2) or in others (fork, spawn), and
+ * goes away, closing the vnode, with the last of them. of_lock is held
+ * across each read, write or seek, so that descriptors sharing the
+ * offset do not step on each other's position. pread and pwrite leave
+ * the offset alone and do not take it.
+ *
+ * A file table is an array of OPEN_MAX descriptors plus a bitmap of
+ * the ones in use, so that finding a descriptor is an index and giving
+ * out the lowest free one is a scan of a few words. Threads of one
+ * process share its table, so it has a spinlock; it is only held to
+ * look at or change the slots, never across I/O.
+ *
+ * Functions:
+ *     openfile_open    - open PATH with FLAGS and MODE, as vfs_open.
+ *     openfile_openat  - the same, with relative names starting at
+ *                        directory DIR if it is not NULL.
+ *     openfile_create  - make an open file of VN, which the caller has
+ *                        opened (as vfs_open does), with FLAGS; it
+ *                        takes over that open. Returns ENOMEM.
+ *     openfile_incref  - add a reference to an open file.
+ *     openfile_decref  - drop one, closing it if it was the last.
+ *
+ *     filetable_create - make an empty table. Returns NULL on
+ *                        out-of-memory.
+ *     filetable_copy   - make a copy of a table, for fork: the new one
+ *                        shares the old one's open files.
+ *     filetable_destroy - drop all of a table's open files and free it.
+ *     filetable_stdio  - open the console on descriptors 0, 1 and 2 of
+ *                        an empty table.
+ *     filetable_add    - put an open file in the lowest free
+ *                        descriptor, taking over the caller's
+ *                        reference. Fails with EMFILE if there is none.
+ *     filetable_get    - look up descriptor FD, with a reference the
+ *                        caller must drop with openfile_decref. Fails
+ *                        with EBADF.
+ *     filetable_place  - put an open file in descriptor FD, as dup2,
+ *                        adding a reference; whatever was there is
+ *                        closed.
+ *     filetable_remove - take the open file out of descriptor FD and
+ *                        drop the table's reference, as close. Fails
+ *                        with EBADF.
+ *
+ *     file_io          - read or write (RW) LEN bytes at BUF, in the
+ *                        current process's address space, on its
+ *                        descriptor FD, as read and write, or as pread
+ *                        and pwrite at *POS if POS is not NULL. For
+ *                        I/O started other than by those calls (aio);
+ *                        in file_syscalls.c.
+ */
+
+#include <spinlock.h>
+#include <limits.h>
+#include <uio.h>
+
+struct vnode;
+struct lock;
+struct bitmap;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_flags;			/* from open; O_ACCMODE and O_APPEND */
+	off_t of_offset;		/* under of_lock */
+	struct lock *of_lock;
+	volatile unsigned of_refcount;	/* atomic */
+};
+
+struct filetable {
+	struct spinlock ft_lock;
+	struct bitmap *ft_used;		/* descriptors in use */
+	struct openfile *ft_files[OPEN_MAX];
+};
+
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+int openfile_openat(struct vnode *dir, char *path, int flags, mode_t mode,
+		    struct openfile **ret);
+int openfile_create(struct vnode *vn, int flags, struct openfile **ret);
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+struct filetable *filetable_create(void);
+int filetable_copy(struct filetable *old, struct filetable **ret);
+void filetable_destroy(struct filetable *ft);
+int filetable_stdio(struct filetable *ft);
+int filetable_add(struct filetable *ft, struct openfile *of, int *fd);
+int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
+int filetable_place(struct filetable *ft, int fd, struct openfile *of);
+int filetable_remove(struct filetable *ft, int fd);
+
+int file_io(int fd, userptr_t buf, size_t len, const off_t *pos,
+	    enum uio_rw rw, int *retval);
+
+#endif /* _FILE_H_ */
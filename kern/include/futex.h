@@ -0,0 +1,35 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+/*
+ * Futexes: letting user threads sleep on a word of their memory.
+ *
+ * A user lock only calls into the kernel when it is contended:
+ * futex_wait sleeps if the word at UADDR still holds VAL (checked
+ * against a wake racing with it), and futex_wake wakes up to N
+ * threads sleeping on UADDR. Waiters are keyed on the address space
+ * and the address, hashed into a fixed table of buckets, each with a
+ * lock for its list of waiters and a wchan they sleep on; a wake
+ * picks out its own waiters with wchan_wakethread, so addresses that
+ * share a bucket do not wake each other.
+ *
+ * Functions:
+ *     futex_bootstrap - set up the buckets.
+ *     futex_wait      - as above. Fails with EAGAIN if the word is not
+ *                       VAL, EINVAL if UADDR is not word-aligned, and
+ *                       EINTR if woken by futex_wakeas or if the
+ *                       process is being ended.
+ *     futex_wake      - as above; hands back how many were woken.
+ *     futex_wakeas    - wake everything waiting in AS, which is about to
+ *                       lose its threads.
+ */
+
+struct addrspace;
+
+void futex_bootstrap(void);
+int futex_wait(struct addrspace *as, userptr_t uaddr, int val);
+int futex_wake(struct addrspace *as, userptr_t uaddr, unsigned n,
+	       unsigned *ret);
+void futex_wakeas(struct addrspace *as);
+
+#endif /* _FUTEX_H_ */
@@ -0,0 +1,53 @@
+#ifndef _IOSTAT_H_
+#define _IOSTAT_H_
+
+/*
+ * Per-device I/O statistics.
+ *
+ * A driver keeps a struct iostat for each device and registers it
+ * under the device's name when it attaches, at most IOSTAT_MAX of
+ * them. It calls iostat_start as it takes each request, keeping the
+ * start time it gets back with the request, and iostat_done with that
+ * time when the device finishes it, which may be in its interrupt
+ * handler. Each iostat has a spinlock of its own, the innermost of
+ * all, so the driver may hold its own locks, spinlocks included.
+ *
+ * The menu's "io" command prints them all; user programs, like
+ * /sbin/iostat, read them with getiostat (see <kern/iostat.h>).
+ *
+ * Functions:
+ *     iostat_register - set up IOS and make it the next device
+ *                       getiostat knows about, as NAME.
+ *     iostat_start    - a request has been handed to the device; hand
+ *                       back the time, for iostat_done.
+ *     iostat_done     - the request begun at START is over, having
+ *                       moved BYTES as KIND says, with error ERR.
+ *     iostat_get      - the INDEX'th registered device, or ENOENT past
+ *                       the last, for getiostat.
+ *     iostat_print    - print every registered device.
+ */
+
+#include <kern/iostat.h>
+#include <spinlock.h>
+
+#define IOSTAT_MAX	16
+
+/* Kinds of request, for iostat_done */
+#define IOSTAT_READ	0
+#define IOSTAT_WRITE	1
+#define IOSTAT_OTHER	2
+
+struct iostat {
+	struct spinlock ios_lock;
+	uint64_t ios_busysince;		/* when is_inflight went above 0 */
+	struct iostatinfo ios_info;	/* the counts, is_ndevs aside */
+};
+
+void iostat_register(struct iostat *ios, const char *name);
+uint64_t iostat_start(struct iostat *ios);
+void iostat_done(struct iostat *ios, uint64_t start, int kind, size_t bytes,
+		 int err);
+int iostat_get(unsigned index, struct iostatinfo *is);
+void iostat_print(void);
+
+#endif /* _IOSTAT_H_ */
@@ -0,0 +1,52 @@
+#ifndef _KERN_AIO_H_
+#define _KERN_AIO_H_
+
+/*
+ * Asynchronous I/O rings, for aio_setup and aio_enter.
+ *
+ * A process hands the kernel one struct aio_rings in its own memory.
+ * To start I/O it fills in ar_sq[ar_sqtail % AIO_RINGSIZE], bumps
+ * ar_sqtail, and calls aio_enter, which takes the new entries and
+ * advances ar_sqhead past them. Kernel threads of the process do the
+ * I/O, and each posts an aio_cqe at ar_cq[ar_cqtail % AIO_RINGSIZE]
+ * and bumps ar_cqtail as it finishes. The process reads completions
+ * up to ar_cqtail and advances ar_cqhead past them.
+ *
+ * The kernel takes no more submissions than there is room for their
+ * completions, so the completion ring never overflows; entries it
+ * leaves in the submission ring are taken by a later aio_enter.
+ *
+ * A negative sqe_offset means the file's own offset, as read and
+ * write; otherwise the I/O is at sqe_offset, as pread and pwrite.
+ * cqe_result is the byte count, or minus the error code.
+ */
+
+#define AIO_RINGSIZE	64	/* entries in each ring; a power of 2 */
+
+#define AIO_READ	1
+#define AIO_WRITE	2
+
+struct aio_sqe {
+	off_t sqe_offset;
+	int sqe_op;		/* AIO_READ or AIO_WRITE */
+	int sqe_fd;
+	void *sqe_buf;
+	size_t sqe_len;
+	unsigned sqe_tag;	/* handed back in the completion */
+};
+
+struct aio_cqe {
+	unsigned cqe_tag;
+	int cqe_result;
+};
+
+struct aio_rings {
+	volatile unsigned ar_sqhead;	/* moved by the kernel */
+	volatile unsigned ar_sqtail;	/* moved by the process */
+	volatile unsigned ar_cqhead;	/* moved by the process */
+	volatile unsigned ar_cqtail;	/* moved by the kernel */
+	struct aio_sqe ar_sq[AIO_RINGSIZE];
+	struct aio_cqe ar_cq[AIO_RINGSIZE];
+};
+
+#endif /* _KERN_AIO_H_ */
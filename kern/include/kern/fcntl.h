@@ -49,10 +49,14 @@
 #define O_TRUNC      16      /* Truncate file upon open */
 #define O_APPEND     32      /* All writes happen at EOF (optional feature) */
 #define O_NOCTTY     64      /* Required by POSIX, != 0, but does nothing */
+#define O_DIRECT    128      /* Whole blocks skip the buffer cache (a hint) */
 
 /* Additional related definition */
 #define O_ACCMODE     3      /* mask for O_RDONLY/O_WRONLY/O_RDWR */
 
+/* openat: start relative names at the current directory */
+#define AT_FDCWD   (-100)
+
 /*
  * Not so important
  */
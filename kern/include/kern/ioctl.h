@@ -34,6 +34,29 @@
  * ioctl operation codes
  */
 
-/* (none yet) */
+/*
+ * Console input modes. In raw mode (the default) a read gets the chars
+ * as they are typed, with no echo. In cooked mode the console driver
+ * echoes and edits a line (backspace, ^U to kill it, ^W to erase a
+ * word) and a read returns once it is finished with a newline, or ^D.
+ * Neither takes an argument.
+ */
+#define IOCTL_CONRAW     1
+#define IOCTL_CONCOOKED  2
+
+/*
+ * Network devices (see <kern/lnet.h>). IOCTL_LNETADDR stores the
+ * device's own address, as a uint32_t, through the argument.
+ */
+#define IOCTL_LNETADDR   3
+
+/*
+ * SFS files. IOCTL_SFSDEFRAG moves the file's blocks on disk into runs
+ * next to each other, so that it reads sequentially, and stores how
+ * many blocks it moved, as a uint32_t, through the argument if that
+ * is not NULL. It fails with ENOSPC if there is no free space in runs
+ * long enough, having moved what it could.
+ */
+#define IOCTL_SFSDEFRAG  4
 
 #endif /* _KERN_IOCTL_H_*/
@@ -0,0 +1,38 @@
+#ifndef _KERN_IOSTAT_H_
+#define _KERN_IOSTAT_H_
+
+/*
+ * What getiostat() reports: what one storage device has done since
+ * boot. Reads and writes move data; other requests are the rest of
+ * what a device like emu does (opens, closes, and so on). A request
+ * is timed from when the driver is handed it to when the device says
+ * it is done, so the time includes any spent queued behind others;
+ * the histogram is of those times in microseconds: bucket N counts
+ * requests that took from 2^(N+IOSTAT_MINSHIFT) up to twice that,
+ * except that the first bucket also counts anything shorter and the
+ * last anything longer. is_busyns is how long the device has had at
+ * least one request, so that is_busyns over the time elapsed is how
+ * busy it was.
+ */
+
+#define IOSTAT_MINSHIFT		4
+#define IOSTAT_NBUCKETS		16
+#define IOSTAT_NAMELEN		16
+
+struct iostatinfo {
+	unsigned is_ndevs;	/* devices there are to ask about */
+	char is_name[IOSTAT_NAMELEN];
+	unsigned is_reads;
+	unsigned is_writes;
+	unsigned is_others;
+	unsigned is_errors;
+	__u64 is_rbytes;
+	__u64 is_wbytes;
+	unsigned is_inflight;	/* requests in progress or queued now */
+	unsigned is_maxinflight;
+	__u64 is_busyns;
+	__u64 is_totalns;	/* of all requests, for the mean */
+	unsigned is_hist[IOSTAT_NBUCKETS];
+};
+
+#endif /* _KERN_IOSTAT_H_ */
@@ -0,0 +1,18 @@
+#ifndef _KERN_KSTAT_H_
+#define _KERN_KSTAT_H_
+
+/*
+ * What getkstat() reports: one of the kernel's named counters (see
+ * kstat.h in the kernel), summed over all cpus. Names are
+ * "subsystem.what", e.g. "vm.tlb_faults".
+ */
+
+#define KSTAT_NAMELEN	32
+
+struct kstatinfo {
+	unsigned ki_nstats;	/* counters there are to ask about */
+	char ki_name[KSTAT_NAMELEN];
+	__u64 ki_value;
+};
+
+#endif /* _KERN_KSTAT_H_ */
@@ -0,0 +1,32 @@
+#ifndef _KERN_KTRACE_H_
+#define _KERN_KTRACE_H_
+
+/*
+ * Kernel event trace records, as read with ktrace(KTRACE_READ, ...).
+ *
+ * Each cpu numbers its records from 0; a gap in kr_seq means records
+ * were overwritten before they could be read. kr_time is that cpu's
+ * cycle counter.
+ */
+
+struct ktrace_rec {
+	unsigned kr_seq;
+	unsigned kr_time;
+	unsigned kr_type;	/* KT_* */
+	unsigned kr_a, kr_b;	/* as below */
+};
+
+/* Event types, and what kr_a and kr_b hold */
+#define KT_SWITCH	1	/* thread switched out, thread switched in */
+#define KT_SYSCALL	2	/* call number, 0 (call made) */
+#define KT_SYSRET	3	/* call number, error */
+#define KT_FAULT	4	/* fault type, faulting address */
+#define KT_DISKIO	5	/* sector, unit << 16 | error (done) */
+#define KT_LOCKWAIT	6	/* lock, 0 (about to sleep for it) */
+
+/* ktrace() operations */
+#define KTRACE_OFF	0	/* stop recording */
+#define KTRACE_ON	1	/* start recording */
+#define KTRACE_READ	2	/* take records not yet read */
+
+#endif /* _KERN_KTRACE_H_ */
@@ -0,0 +1,23 @@
+#ifndef _KERN_LNET_H_
+#define _KERN_LNET_H_
+
+/*
+ * Packets on a network device, such as lnet0:.
+ *
+ * Each write sends one packet and each read returns one: a struct
+ * lnet_pkthdr, then up to LNET_MTU bytes of data. On a write lph_addr
+ * says where the packet goes (LNET_BROADCAST for every machine on the
+ * network); on a read it says where it came from. A read into a
+ * buffer too small for the packet gets as much as fits, and the rest
+ * is lost. Reads wait for a packet; delivery is not guaranteed.
+ */
+
+#define LNET_BROADCAST	0xffff
+#define LNET_MTU	(4096 - 8)	/* less the card's own header */
+
+struct lnet_pkthdr {
+	__u16 lph_addr;
+	__u16 lph_len;		/* bytes of data; ignored on write */
+};
+
+#endif /* _KERN_LNET_H_ */
@@ -0,0 +1,24 @@
+#ifndef _KERN_MEMSTAT_H_
+#define _KERN_MEMSTAT_H_
+
+/*
+ * What getmemstat() reports: how physical memory is being used, and
+ * the memory use of one process. Sizes are in pages.
+ */
+struct memstat {
+	unsigned ms_pagesize;	/* bytes per page */
+
+	/* Whole system */
+	unsigned ms_total;	/* pages of physical memory managed */
+	unsigned ms_free;	/* of which free */
+	unsigned ms_user;	/* holding user pages */
+	unsigned ms_kernel;	/* used by the kernel */
+
+	/* The process asked about */
+	unsigned ms_rss;	/* resident pages, shared ones included */
+	unsigned ms_wss;	/* working set: private pages in use lately */
+	unsigned ms_minflt;	/* page faults served without I/O */
+	unsigned ms_majflt;	/* page faults that read from disk */
+};
+
+#endif /* _KERN_MEMSTAT_H_ */
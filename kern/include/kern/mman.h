@@ -0,0 +1,19 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap().
+ */
+
+/* Protections (the prot argument) */
+#define PROT_NONE     0      /* No access */
+#define PROT_READ     1      /* Readable */
+#define PROT_WRITE    2      /* Writeable */
+#define PROT_EXEC     4      /* Executable */
+
+/* Flags (the flags argument); one of MAP_SHARED and MAP_PRIVATE */
+#define MAP_SHARED    0x0001 /* Changes go back to the file */
+#define MAP_PRIVATE   0x0002 /* Changes stay in this process */
+#define MAP_ANON      0x1000 /* Not backed by a file (fd is ignored) */
+
+#endif /* _KERN_MMAN_H_ */
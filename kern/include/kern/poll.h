@@ -0,0 +1,24 @@
+#ifndef _KERN_POLL_H_
+#define _KERN_POLL_H_
+
+/*
+ * Definitions for poll().
+ *
+ * For each pollfd the caller says which EVENTS it is after, and gets
+ * back in REVENTS which of them are ready, plus POLLERR, POLLHUP or
+ * POLLNVAL, which need not be asked for. A negative FD is skipped.
+ */
+
+struct pollfd {
+	int fd;
+	short events;
+	short revents;
+};
+
+#define POLLIN    0x0001	/* reading would not block */
+#define POLLOUT   0x0004	/* writing would not block */
+#define POLLERR   0x0008	/* error; for a pipe, nobody to read */
+#define POLLHUP   0x0010	/* hung up; for a pipe, nobody to write */
+#define POLLNVAL  0x0020	/* FD is not open */
+
+#endif /* _KERN_POLL_H_ */
@@ -0,0 +1,31 @@
+#ifndef _KERN_SCHEDSTAT_H_
+#define _KERN_SCHEDSTAT_H_
+
+/*
+ * What getschedstat() reports: scheduling counts for the calling
+ * thread and for one cpu. Times are in units of 1024 cpu cycles
+ * (SCHEDSTAT_CYCLESHIFT).
+ */
+
+#define SCHEDSTAT_CYCLESHIFT	10
+#define SCHEDSTAT_RQHIST	8	/* last bucket is that many or more */
+
+struct schedstat {
+	/* The calling thread */
+	unsigned ss_runticks;	/* hardclocks it has run for */
+	unsigned ss_vswitches;	/* times it gave up the cpu */
+	unsigned ss_ivswitches;	/* times it was preempted */
+	unsigned ss_wakeups;	/* times made runnable, at fork or wakeup */
+	unsigned ss_wakelat;	/* total time from then to running */
+	unsigned ss_maxwakelat;	/* longest of those */
+	unsigned ss_migrations;	/* times it ran on a different cpu */
+
+	/* The cpu asked about */
+	unsigned ss_ncpus;	/* how many there are to ask about */
+	unsigned ss_hardclocks;	/* hardclocks while busy */
+	unsigned ss_idle;	/* time idle */
+	unsigned ss_rqhist[SCHEDSTAT_RQHIST]; /* hardclocks that found N
+						 threads waiting */
+};
+
+#endif /* _KERN_SCHEDSTAT_H_ */
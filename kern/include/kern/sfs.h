@@ -37,6 +37,7 @@
  */
 
 #define SFS_MAGIC         0xabadf001    /* magic number identifying us */
+#define SFS_VERSION       3             /* current sp_version; see below */
 #define SFS_BLOCKSIZE     512           /* size of our blocks */
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
@@ -59,6 +60,57 @@
 /* Size of bitmap (in blocks) */
 #define SFS_BITBLOCKS(nblocks)  (SFS_BITMAPSIZE(nblocks)/SFS_BLOCKBITS)
 
+/*
+ * Inodes have a double and a triple indirect block after the indirect
+ * one, in what was unused space. Volumes made before that have version
+ * 0, and files on them are kept to the direct and indirect blocks, so
+ * that they stay readable by anything that only knows those.
+ */
+#define HAS_DIDIRECT
+#define HAS_TIDIRECT
+
+/*
+ * Volumes from version 2 on may have a metadata journal: the SP_JBLOCKS
+ * blocks from SP_JSTART, right after the freemap and marked in use in
+ * it, or none if SP_JBLOCKS is 0.
+ *
+ * The journal holds at most one record, starting at its first block:
+ * a header, the NBLOCKS block numbers running on from it into as many
+ * following blocks as they need (SFS_JHDRBLOCKS), and then a copy of
+ * each of those blocks, in the same order. A record counts only if
+ * the magic number is right, NBLOCKS is not 0, and the checksum is:
+ * starting from 0, each 32-bit word of jh_seq, jh_nblocks, the block
+ * numbers and then the copies, in that order, is added to the sum
+ * rotated left by one bit. Replaying it writes each copy to its block.
+ * Once the blocks are in place the header is rewritten with NBLOCKS 0.
+ */
+#define SFS_JMAGIC        0x6a726e6c    /* "jrnl" */
+
+struct sfs_jheader {
+	uint32_t jh_magic;			/* SFS_JMAGIC */
+	uint32_t jh_seq;			/* one more each record */
+	uint32_t jh_nblocks;			/* blocks in the record */
+	uint32_t jh_checksum;			/* see above */
+	/* jh_nblocks uint32_t block numbers follow */
+};
+
+/* Blocks for the header of a record of N blocks */
+#define SFS_JHDRBLOCKS(n) \
+	((sizeof(struct sfs_jheader) + (n)*sizeof(uint32_t) + \
+	  SFS_BLOCKSIZE - 1) / SFS_BLOCKSIZE)
+
+/*
+ * On version 3 volumes a file with no more than SFS_INLINESIZE bytes
+ * in it may keep them in its inode, where the block pointers and the
+ * unused space after them would be (SFS_INLINEDATA), rather than in
+ * blocks of their own; SFS_INODE_INLINE in sfi_flags says so. Such a
+ * file is read with one block read and takes up no data blocks. The
+ * bytes past its size are 0.
+ */
+#define SFS_INODE_INLINE  0x1
+#define SFS_INLINESIZE    ((128-3) * sizeof(uint32_t))
+#define SFS_INLINEDATA(sfi) ((char *)(sfi)->sfi_direct)
+
 /* File types for sfi_type */
 #define SFS_TYPE_INVAL    0       /* Should not appear on disk */
 #define SFS_TYPE_FILE     1
@@ -71,7 +123,10 @@ struct sfs_super {
 	uint32_t sp_magic;		/* Magic number, should be SFS_MAGIC */
 	uint32_t sp_nblocks;			/* Number of blocks in fs */
 	char sp_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];
+	uint32_t sp_version;			/* SFS_VERSION, or 0 */
+	uint32_t sp_jstart;			/* journal; version 2 */
+	uint32_t sp_jblocks;			/* its size, or 0 */
+	uint32_t reserved[115];
 };
 
 /*
@@ -83,7 +138,10 @@ struct sfs_inode {
 	uint16_t sfi_linkcount;			/* # hard links to this file */
 	uint32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	uint32_t sfi_indirect;			/* Indirect block */
-	uint32_t sfi_waste[128-3-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_dindirect;			/* Double indirect block */
+	uint32_t sfi_tindirect;			/* Triple indirect block */
+	uint32_t sfi_waste[128-6-SFS_NDIRECT];	/* unused space, set to 0 */
+	uint32_t sfi_flags;			/* SFS_INODE_*; version 3 */
 };
 
 /*
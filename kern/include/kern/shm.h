@@ -0,0 +1,37 @@
+#ifndef _KERN_SHM_H_
+#define _KERN_SHM_H_
+
+/*
+ * Constants for the shared memory calls, shmget(), shmat(), shmdt()
+ * and shmctl().
+ */
+
+/* Key for shmget() that always makes a new segment */
+#define IPC_PRIVATE   0
+
+/* Flags for shmget(), or'd with permission bits (which are ignored) */
+#define IPC_CREAT     0x0200 /* Make the segment if the key has none */
+#define IPC_EXCL      0x0400 /* With IPC_CREAT, fail if it has one */
+
+/* Flags for shmat() */
+#define SHM_RDONLY    0x1000 /* Attach read-only */
+
+/* Commands for shmctl() */
+#define IPC_RMID      0      /* Remove once nobody has it attached */
+#define IPC_STAT      2      /* Fill in the struct shmid_ds */
+
+/* Limits */
+#define SHMMAX        (16 * 1024 * 1024) /* bytes in one segment */
+#define SHMMNI        64     /* segments in the system */
+
+/*
+ * What IPC_STAT reports.
+ */
+struct shmid_ds {
+	int shm_key;		/* the key it was made with */
+	unsigned shm_segsz;	/* size in bytes, as asked for */
+	unsigned shm_nattch;	/* number of attachments */
+	unsigned shm_resident;	/* pages touched so far */
+};
+
+#endif /* _KERN_SHM_H_ */
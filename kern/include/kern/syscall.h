@@ -86,7 +86,7 @@
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
 //#define SYS_wait4      34
-//#define SYS_getrusage  35
+#define SYS_getrusage  35
 //                              (resource limits)
 //#define SYS_getrlimit  36
 //#define SYS_setrlimit  37
@@ -94,8 +94,8 @@
 //#define SYS_getpriority 38
 //#define SYS_setpriority 39
 //                              (process groups, sessions, and job control)
-//#define SYS_getpgid    40
-//#define SYS_setpgid    41
+#define SYS_getpgid      40
+#define SYS_setpgid      41
 //#define SYS_getsid     42
 //#define SYS_setsid     43
 //                              (userlevel debugging)
@@ -109,12 +109,12 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
+#define SYS_readv        52
 //#define SYS_preadv     53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
+#define SYS_writev       57
 //#define SYS_pwritev    58
 #define SYS_lseek        59
 #define SYS_flock        60
@@ -196,6 +196,37 @@
 #define SYS_sync         118
 #define SYS_reboot       119
 //#define SYS___sysctl   120
+#define SYS_getmemstat   121
+#define SYS_getschedstat 122
+#define SYS___thread_create 123
+#define SYS_thread_join  124
+#define SYS_thread_exit  125
+#define SYS_futex_wait   126
+#define SYS_futex_wake   127
+#define SYS_spawn        128
+#define SYS_getsyscallstat 129
+#define SYS_ktrace       130
+#define SYS_copy_file_range 131
+#define SYS_aio_setup    132
+#define SYS_aio_enter    133
+#define SYS_openat       134
+#define SYS_getdirentries 135
+#define SYS_fstatat      136
+#define SYS_clock_monotonic 137
+#define SYS_getkstat     138
+#define SYS_setpriority  139
+#define SYS_getpriority  140
+#define SYS_sched_setaffinity 141
+#define SYS_sched_getaffinity 142
+#define SYS_fdatasync    143
+#define SYS_shmget       144
+#define SYS_shmat        145
+#define SYS_shmdt        146
+#define SYS_shmctl       147
+#define SYS_syscall_batch 148
+#define SYS_getiostat    149
+#define SYS_upcall_register 150
+#define SYS_upcall_wait  151
 
 /*CALLEND*/
 
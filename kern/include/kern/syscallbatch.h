@@ -0,0 +1,36 @@
+#ifndef _KERN_SYSCALLBATCH_H_
+#define _KERN_SYSCALLBATCH_H_
+
+/*
+ * Records for syscall_batch(), which makes a run of system calls with
+ * one trap.
+ *
+ * sr_args holds the argument words as they would be for the call made
+ * on its own: the first four as in registers a0-a3 (a 64-bit argument
+ * in an aligned pair of them), and the rest as at sp+16 on the user
+ * stack, so sr_args[4] where the call would look at sp+16. The kernel
+ * fills in sr_err (0 or the error code) and, on success, sr_retval or,
+ * for calls that return 64 bits (lseek), sr_retval64.
+ *
+ * The calls are made in order, but no call's arguments can depend on
+ * what an earlier one returned. Calls that replace or end the process
+ * or need the whole trapframe (fork, execv, _exit, thread_exit,
+ * syscall_batch itself) fail with EINVAL in a batch.
+ */
+
+#define SYSCALLBATCH_NARGS	8	/* argument words per call */
+#define SYSCALLBATCH_MAX	64	/* calls per batch */
+
+/* Flags for syscall_batch() */
+#define SYSCALLBATCH_STOP	0x1	/* stop after the first failure */
+
+struct syscall_rec {
+	int sr_callno;
+	int sr_err;
+	unsigned sr_args[SYSCALLBATCH_NARGS];
+	int sr_retval;
+	int sr_pad;
+	off_t sr_retval64;
+};
+
+#endif /* _KERN_SYSCALLBATCH_H_ */
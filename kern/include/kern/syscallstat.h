@@ -0,0 +1,25 @@
+#ifndef _KERN_SYSCALLSTAT_H_
+#define _KERN_SYSCALLSTAT_H_
+
+/*
+ * What getsyscallstat() reports: counts for one system call, summed
+ * over all cpus. The histogram is of cpu cycles from entry to return:
+ * bucket N counts calls that took from 2^(N+SYSCALLSTAT_MINSHIFT) up
+ * to twice that, except that the first bucket also counts anything
+ * shorter and the last anything longer. Calls that never return, like
+ * _exit or an execv that works, count in ss_calls only.
+ */
+
+#define SYSCALLSTAT_MINSHIFT	8
+#define SYSCALLSTAT_NBUCKETS	16
+#define SYSCALLSTAT_NAMELEN	16
+
+struct syscallstat {
+	unsigned ss_nsyscalls;	/* call numbers there are to ask about */
+	char ss_name[SYSCALLSTAT_NAMELEN];
+	unsigned ss_calls;
+	unsigned ss_errors;
+	unsigned ss_hist[SYSCALLSTAT_NBUCKETS];
+};
+
+#endif /* _KERN_SYSCALLSTAT_H_ */
@@ -0,0 +1,24 @@
+#ifndef _KERN_TIMEPAGE_H_
+#define _KERN_TIMEPAGE_H_
+
+/*
+ * The time page: one page the kernel maps read-only into every
+ * address space at TIMEPAGE_VADDR, holding the time of day as of the
+ * last hardclock on any busy cpu. Reading it costs no system call, but
+ * it is only as fine-grained as the hardclock (1/HZ second).
+ *
+ * tp_seq is odd while the kernel is changing the time. A reader takes
+ * tp_seq, waiting for it to be even, reads the time, and starts over
+ * if tp_seq has changed since.
+ */
+
+/* Just below the stack's room to grow; see VM_MMAPTOP. */
+#define TIMEPAGE_VADDR	0x7feff000
+
+struct timepage {
+	unsigned tp_seq;
+	__u32 tp_nsec;
+	__time_t tp_sec;
+};
+
+#endif /* _KERN_TIMEPAGE_H_ */
@@ -35,5 +35,12 @@
 #define STDOUT_FILENO 1      /* Standard output */
 #define STDERR_FILENO 2      /* Standard error */
 
+/*
+ * The size of the stack of a thread made by thread_create. The stack
+ * is aligned to it, so a thread's stack pointer rounded down to it is
+ * the bottom of the stack, the bottom of which libc keeps for itself.
+ */
+#define UTHREAD_STACKSIZE (64*1024)
+
 
 #endif /* _KERN_UNISTD_H_ */
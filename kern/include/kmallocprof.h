@@ -0,0 +1,42 @@
+#ifndef _KMALLOCPROF_H_
+#define _KMALLOCPROF_H_
+
+/*
+ * Kernel heap profiling, with "options kmallocprof".
+ *
+ * Every kmalloc is charged to its call site, the return address kmalloc
+ * was called with, and every kfree to the site that made the block.
+ * For each site this keeps the number of allocations and frees and the
+ * bytes (as asked for) still allocated and at their most. Allocations
+ * made through a wrapper such as kstrdup are charged to the wrapper.
+ *
+ * All tables are fixed in size, so the profiler never allocates
+ * memory. Blocks made when the table of live blocks is full are counted
+ * against their site as untracked, and their frees are not seen.
+ *
+ * For finding leaks, each block is also tagged with the epoch it was
+ * made in. The epoch starts at 0 and is only moved on by hand, so: move
+ * it on, run the workload, move it on again, and whatever the workload
+ * left behind is still live from its epoch.
+ *
+ * Functions:
+ *     kmallocprof_alloc - record that SITE got PTR, of SIZE bytes.
+ *     kmallocprof_free  - record that PTR was freed.
+ *     kmallocprof_print - print the table, busiest sites first.
+ *     kmallocprof_newepoch - start a new epoch; returns its number.
+ *     kmallocprof_curepoch - the current epoch.
+ *     kmallocprof_printlive - print, by site, the blocks still live
+ *                         from epochs FROM up to but not including the
+ *                         current one.
+ */
+
+#include <machine/vm.h>
+
+void kmallocprof_alloc(vaddr_t site, void *ptr, size_t size);
+void kmallocprof_free(void *ptr);
+void kmallocprof_print(void);
+unsigned kmallocprof_newepoch(void);
+unsigned kmallocprof_curepoch(void);
+void kmallocprof_printlive(unsigned from);
+
+#endif /* _KMALLOCPROF_H_ */
@@ -0,0 +1,79 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches for fixed-size kernel objects.
+ *
+ * A cache hands out objects of one size from slabs, pages carved up
+ * into objects of that size, instead of going through kmalloc. Each
+ * cpu keeps a magazine of up to KMEM_MAGSIZE free objects of its own,
+ * so most allocations and frees take neither the cache's lock nor
+ * kmalloc's; the magazine is refilled from and emptied into the slabs
+ * half a magazine at a time. Before the cpu structures exist (early
+ * boot) everything goes straight to the slabs.
+ *
+ * If the cache has a constructor, it is run on each object once, when
+ * its slab is made, not on every allocation: objects must go back to
+ * kmem_cache_free in the state the constructor left them in.
+ *
+ * A cache can be defined statically with KMEM_CACHE_INITIALIZER, which
+ * works before kmalloc does, or made with kmem_cache_create.
+ *
+ * Functions:
+ *     kmem_cache_create - make a cache of objects of SIZE bytes, with
+ *                         optional constructor CTOR. Returns NULL on
+ *                         out-of-memory.
+ *     kmem_cache_alloc  - get an object. Returns NULL on out-of-memory.
+ *     kmem_cache_free   - give one back.
+ *     kmem_cache_printstats - print the counts of every cache that has
+ *                         been used.
+ *     kmem_cache_bootstrap - let the caches give back their spare slabs
+ *                         when memory runs short (see shrink.h).
+ */
+
+#include <spinlock.h>
+#include <machine/vm.h>
+#include <platform/maxcpus.h>
+
+/* Free objects a cpu keeps for itself, per cache. */
+#define KMEM_MAGSIZE 8
+
+struct kmem_slab;
+
+/* Each on its own cache line, since each is used by its own cpu. */
+struct kmem_magazine {
+	unsigned km_count;
+	void *km_objs[KMEM_MAGSIZE];
+	unsigned km_allocs;	/* served from here, for stats */
+	unsigned km_frees;
+} __ALIGNED(CACHELINE_SIZE);
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			/* object and link word, rounded */
+	void (*kc_ctor)(void *obj);
+	struct spinlock kc_lock;	/* for the slab lists and counts */
+	struct kmem_slab *kc_partial;	/* slabs with free objects */
+	unsigned kc_perslab;		/* objects per slab, once known */
+	unsigned kc_nslabs;
+	unsigned kc_nempty;		/* slabs with nothing allocated */
+	unsigned kc_inuse;		/* objects out of the slabs */
+	unsigned kc_slaballocs;		/* allocations that took kc_lock */
+	struct kmem_cache *kc_next;	/* all caches, once used */
+	struct kmem_magazine kc_mags[MAXCPUS];
+};
+
+#define KMEM_ROUNDUP(size) (((size) + 7) & ~(size_t)7)
+#define KMEM_CACHE_INITIALIZER(name, size, ctor) \
+	{ (name), KMEM_ROUNDUP((size) + sizeof(void *)), (ctor), \
+	  SPINLOCK_INITIALIZER, NULL, 0, 0, 0, 0, 0, NULL, \
+	  { { 0, { NULL }, 0, 0 } } }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     void (*ctor)(void *obj));
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void kmem_cache_printstats(void);
+void kmem_cache_bootstrap(void);
+
+#endif /* _KMEM_CACHE_H_ */
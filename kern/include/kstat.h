@@ -0,0 +1,52 @@
+#ifndef _KSTAT_H_
+#define _KSTAT_H_
+
+/*
+ * Kernel statistics: named event counters any part of the kernel can
+ * keep.
+ *
+ * A counter is a struct kstat, usually static, made with
+ * KSTAT_INITIALIZER. It is registered, and given its slot in every
+ * cpu's array of counts, by kstat_register or else the first time it
+ * is counted; at most KSTAT_MAX can be. Counting adds to the current
+ * cpu's count with interrupts off, so it takes no lock and touches no
+ * shared cache line; reading adds up the cpus' counts. Counts made
+ * before kstat_bootstrap are lost.
+ *
+ * The menu's "kst" command prints them all; user programs read them
+ * with getkstat (see <kern/kstat.h>).
+ *
+ * Functions:
+ *     kstat_bootstrap - make each cpu's counts. Call once all cpus
+ *                       are up.
+ *     kstat_register  - give KS its slot, if it has none yet.
+ *     kstat_inc       - count one for KS.
+ *     kstat_add       - count N.
+ *     kstat_read      - KS's total over all cpus.
+ *     kstat_zero      - set it back to 0.
+ *     kstat_get       - the INDEX'th registered counter, or ENOENT
+ *                       past the last, for getkstat.
+ *     kstat_print     - print every registered counter.
+ */
+
+#include <kern/kstat.h>
+
+#define KSTAT_MAX	128
+
+struct kstat {
+	const char *ks_name;
+	unsigned ks_slot;		/* 1 + index in the counts; 0 if none */
+};
+
+#define KSTAT_INITIALIZER(name) { name, 0 }
+
+void kstat_bootstrap(void);
+void kstat_register(struct kstat *ks);
+void kstat_add(struct kstat *ks, uint32_t n);
+#define kstat_inc(ks) kstat_add(ks, 1)
+uint64_t kstat_read(struct kstat *ks);
+void kstat_zero(struct kstat *ks);
+int kstat_get(unsigned index, struct kstatinfo *ki);
+void kstat_print(void);
+
+#endif /* _KSTAT_H_ */
@@ -0,0 +1,45 @@
+#ifndef _KTRACE_H_
+#define _KTRACE_H_
+
+/*
+ * Kernel event tracing.
+ *
+ * While tracing is on, KTRACE() puts a fixed-size record (see
+ * <kern/ktrace.h>) in the ring of the cpu it runs on, taking no locks
+ * and printing nothing, so it can be used anywhere, interrupt handlers
+ * and spinlock holders included. Each ring keeps the last KTRACE_NRECS
+ * records; a reader that falls further behind than that loses the
+ * oldest. When tracing is off, KTRACE costs a test and a branch and
+ * does not evaluate its arguments.
+ *
+ * Unlike the ltrace device, which asks System/161 to trace what the
+ * simulated hardware does, this records what the kernel does, and can
+ * be read back from the running system.
+ *
+ * Functions:
+ *     ktrace_bootstrap - allocate the rings; call once all the cpus
+ *                        are up. Until then nothing is recorded.
+ *     ktrace_enable    - turn recording on or off.
+ *     ktrace_read      - copy out up to N unread records of cpu CPU to
+ *                        user buffer BUF, setting *COUNT to how many.
+ */
+
+#include <kern/ktrace.h>
+
+#define KTRACE_NRECS 512
+
+extern volatile bool ktrace_enabled;
+
+#define KTRACE(type, a, b) \
+	do { \
+		if (ktrace_enabled) { \
+			ktrace_record((type), (uint32_t)(a), (uint32_t)(b)); \
+		} \
+	} while (0)
+
+void ktrace_bootstrap(void);
+void ktrace_enable(bool on);
+void ktrace_record(uint32_t type, uint32_t a, uint32_t b);
+int ktrace_read(unsigned cpu, userptr_t buf, unsigned n, unsigned *count);
+
+#endif /* _KTRACE_H_ */
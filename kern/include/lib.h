@@ -89,6 +89,30 @@
 #define DB_NETFS       0x0400
 #define DB_KMALLOC     0x0800
 #define DB_SYNCPROB    0x1000
+#define DB_NCATS       13
+#define DB_ALL         0x1fff
+
+/*
+ * The categories built in. Kernel config option "nodebug" leaves out
+ * every DEBUG message, and "nodebugvm", "nodebugsfs", "nodebugsyscall"
+ * and "nodebugthreads" those of the categories used on hot paths; a
+ * DEBUG of a category left out compiles to nothing at all.
+ */
+#include "opt-nodebug.h"
+#include "opt-nodebugvm.h"
+#include "opt-nodebugsfs.h"
+#include "opt-nodebugsyscall.h"
+#include "opt-nodebugthreads.h"
+
+#if OPT_NODEBUG
+#define DB_COMPILED    0
+#else
+#define DB_COMPILED    (DB_ALL \
+			& (OPT_NODEBUGVM ? ~DB_VM : DB_ALL) \
+			& (OPT_NODEBUGSFS ? ~DB_SFS : DB_ALL) \
+			& (OPT_NODEBUGSYSCALL ? ~DB_SYSCALL : DB_ALL) \
+			& (OPT_NODEBUGTHREADS ? ~DB_THREADS : DB_ALL))
+#endif
 
 extern uint32_t dbflags;
 
@@ -101,14 +125,32 @@ extern uint32_t dbflags;
  *
  * throughout the kernel; then you can toggle whether these messages
  * are printed or not at runtime by setting the value of dbflags with
- * the debugger.
+ * the debugger, or with the menu's "db" command.
+ *
+ * A DEBUG of a category that is built in but off costs one load of
+ * dbflags, which is only ever read, and one branch predicted not
+ * taken; the printing is out of line, in debug_printf. Each category
+ * prints at most DEBUG_RATE messages a second, and says how many it
+ * held back once it may print again.
  *
  * Unfortunately, as of this writing, there are only a very few such
  * messages actually present in the system yet. Feel free to add more.
  *
  * DEBUG is a varargs macro. These were added to the language in C99.
  */
-#define DEBUG(d, ...) ((dbflags & (d)) ? kprintf(__VA_ARGS__) : 0)
+#define DEBUG_RATE     20
+
+#define DEBUG(d, ...) \
+	((void)((DB_COMPILED & (d)) && __predict_false(dbflags & (d)) ? \
+		debug_printf(d, __VA_ARGS__) : 0))
+
+int debug_printf(uint32_t cat, const char *format, ...) __PF(2,3);
+
+/*
+ * debug_catname gives the name of the category with bit number BIT
+ * (0 for DB_LOCORE), or NULL past the last.
+ */
+const char *debug_catname(unsigned bit);
 
 /*
  * Random number generator, using the random device.
@@ -120,11 +162,23 @@ uint32_t randmax(void);
 uint32_t random(void);
 
 /*
- * Kernel heap memory allocation. Like malloc/free.
- * If out of memory, kmalloc returns NULL.
+ * Kernel heap memory allocation. Like malloc/free/realloc.
+ * If out of memory, kmalloc and krealloc return NULL (and krealloc
+ * leaves the old block alone). krealloc extends a large block in place
+ * when the pages after it are free.
+ *
+ * ksize returns the size a block really has, which may be more than
+ * was asked for; all of it may be used.
+ *
+ * kmalloc_aligned is like kmalloc, but the block starts at a multiple
+ * of ALIGN, a power of two no bigger than a page. Free it with kfree.
+ * krealloc does not keep the alignment.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
+void *krealloc(void *ptr, size_t size);
+void *kmalloc_aligned(size_t size, size_t align);
+size_t ksize(void *ptr);
 void kheap_printstats(void);
 
 /*
@@ -176,6 +230,16 @@ void beep(void);
  * kprintf_bootstrap sets up a lock for kprintf and should be called
  * during boot once malloc is available and before any additional
  * threads are created.
+ *
+ * Once the cpus are up, klog_bootstrap makes kprintf log instead, to
+ * a ring per cpu that a thread of its own prints from (see kprintf.c);
+ * until then, and in a panic, it prints as it goes.
+ *     klog_flush  - print everything logged so far before returning.
+ *                   Does nothing in an interrupt or holding spinlocks.
+ *     klog_stop   - go back to printing as kprintf goes, for shutdown.
+ *     klog_dmesg  - print again the last of what has been printed.
+ *     klog_tick   - for hardclock; wakes the printing thread for
+ *                   kprintfs made where that could not be done.
  */
 int kprintf(const char *format, ...) __PF(1,2);
 void panic(const char *format, ...) __PF(1,2);
@@ -184,6 +248,11 @@ void badassert(const char *expr, const char *file, int line, const char *func);
 void kgets(char *buf, size_t maxbuflen);
 
 void kprintf_bootstrap(void);
+void klog_bootstrap(void);
+void klog_flush(void);
+void klog_stop(void);
+void klog_dmesg(void);
+void klog_tick(void);
 
 /*
  * Other miscellaneous stuff
@@ -0,0 +1,37 @@
+#ifndef _LOCKPROF_H_
+#define _LOCKPROF_H_
+
+/*
+ * Lock contention profiling, with "options lockprof".
+ *
+ * Every release of a spinlock or sleep lock is recorded against the
+ * lock: sleep locks by lk_name, so all the locks of one kind (say,
+ * every SFS vnode's) add up together, and spinlocks, which have no
+ * names, by the place spinlock_acquire was called from. Locks taken
+ * through a wrapper such as wchan_lock are charged to the wrapper.
+ *
+ * For each this keeps the number of acquisitions, how many of those
+ * found the lock already held, the total time spent waiting for it,
+ * and the longest it was held, in cycles (cpu_cycles). The wait time of
+ * a sleep lock includes time asleep.
+ *
+ * The table is fixed in size, so the profiler never allocates memory
+ * while recording. Locks that do not fit are only counted.
+ *
+ * Functions:
+ *     lockprof_spinlock - record a spinlock acquired at SITE.
+ *     lockprof_lock     - record a sleep lock called NAME.
+ *     lockprof_print    - print the N locks waited for longest.
+ *     lockprof_reset    - forget everything recorded so far.
+ */
+
+#include <machine/vm.h>
+
+void lockprof_spinlock(vaddr_t site, bool contended, uint32_t wait,
+		       uint32_t hold);
+void lockprof_lock(const char *name, bool contended, uint32_t wait,
+		   uint32_t hold);
+void lockprof_print(unsigned n);
+void lockprof_reset(void);
+
+#endif /* _LOCKPROF_H_ */
@@ -0,0 +1,38 @@
+#ifndef _LZ_H_
+#define _LZ_H_
+
+/*
+ * A small, fast LZ77 compressor, for pages of memory.
+ *
+ * The output is a run of sequences, each a token byte, some literal
+ * bytes and then a match: a two-byte offset back into what has been
+ * decompressed so far and a length of at least LZ_MINMATCH. The top
+ * half of the token is the number of literals and the bottom half the
+ * match length less LZ_MINMATCH; a half of 15 is followed by bytes
+ * that add to it, the last of which is less than 255. The last
+ * sequence has literals only. This is much the LZ4 block format, and
+ * like LZ4 goes for speed rather than the best ratio: matches are found
+ * through a hash table of the last place each 4-byte string was seen.
+ *
+ * Functions:
+ *     lz_compress   - compress the SRCLEN bytes at SRC (at most
+ *                     LZ_MAXLEN) into DST, using WORK (LZ_WORKSIZE
+ *                     bytes) as scratch space. Returns the compressed
+ *                     length, or 0 if it would not fit in DSTMAX.
+ *     lz_decompress - decompress SRCLEN bytes at SRC into DST, which
+ *                     has room for DSTLEN, and hand back the length.
+ *                     Returns EINVAL if SRC is not valid compressed
+ *                     data or does not fit.
+ */
+
+#define LZ_MINMATCH	4
+#define LZ_MAXLEN	32768
+#define LZ_HASHBITS	10
+#define LZ_WORKSIZE	(sizeof(uint16_t) << LZ_HASHBITS)
+
+size_t lz_compress(const void *src, size_t srclen, void *dst, size_t dstmax,
+		   void *work);
+int lz_decompress(const void *src, size_t srclen, void *dst, size_t dstlen,
+		  size_t *ret);
+
+#endif /* _LZ_H_ */
@@ -48,10 +48,27 @@ void mainbus_start_cpus(void);
 /* Bus-level interrupt handler, called from cpu-level trap/interrupt code */
 void mainbus_interrupt(struct trapframe *);
 
+/* Print how many interrupts each device has had, and how long they took. */
+void mainbus_printirqstats(void);
+
+/*
+ * Send device interrupt IRQ to the cpus in the mask CPUS (bit N for
+ * cpu N), or spread the devices' interrupts over all the cpus, one cpu
+ * each. By default they all go to the boot cpu.
+ */
+int mainbus_route_irq(unsigned irq, uint32_t cpus);
+void mainbus_spread_irqs(void);
+
 /* Find the size of main memory. */
 /* XXX this interface is not adequately MI */
 size_t mainbus_ramsize(void);
 
+/*
+ * Restart the current cpu's periodic hardclock after hardclock() set
+ * c_tickless to have it stopped. (Interrupts off.)
+ */
+void mainbus_hardclock_start(void);
+
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
@@ -0,0 +1,33 @@
+#ifndef _OOM_H_
+#define _OOM_H_
+
+/*
+ * Running out of memory.
+ *
+ * When an allocation that may sleep finds no frames, even after
+ * evicting, the coremap calls oom_wait before it gives up. That wakes
+ * the page reclaim thread, so the kernel's caches give back what they
+ * can (see shrink.h), and picks a victim: the user process with the
+ * most resident pages, which is killed as if by SIGKILL the next time
+ * one of its threads leaves the kernel. Then the caller naps for a
+ * timer tick while that happens and tries again, OOM_TRIES times in
+ * all; a victim that has not gone after OOM_PATIENCE of them (it may
+ * be asleep in the kernel) has another picked beside it. So under
+ * fork bombs and memory hogs allocations mostly wait a little rather
+ * than fail, and the biggest process goes instead of whichever one
+ * happened to ask.
+ *
+ * If the caller's own process is the one picked, the allocation fails
+ * at once and the process dies on its way out of the kernel.
+ *
+ * Functions:
+ *     oom_wait - as above, for the coremap's TRIES'th attempt (from 0).
+ *                Returns true if it is worth trying again.
+ */
+
+#define OOM_TRIES	50	/* timer ticks */
+#define OOM_PATIENCE	10
+
+bool oom_wait(unsigned tries);
+
+#endif /* _OOM_H_ */
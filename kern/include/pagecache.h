@@ -0,0 +1,88 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * The page cache: pages of files, by vnode and page-aligned offset.
+ *
+ * A page is cached by the fault path when it is read in for a
+ * read-only mapping of a file, an ELF text segment or a read-only
+ * mmap, and every other mapping of the same page of the same file
+ * maps the cached frame instead, copy-on-write like a page shared by
+ * fork; so N copies of a program share one copy of its text, and
+ * running it again costs no I/O while its pages are still cached.
+ * read() on an SFS file is served from the cached pages it starts in
+ * before going to the filesystem's buffers, so a file that is both
+ * read and mapped is only in memory once.
+ *
+ * Each page remembers how many bytes of it came from the file (a
+ * segment can end partway through a page; the rest is zeros) and is
+ * only handed to a mapping that wants the same number. The cache holds
+ * a reference to each frame and to each page's vnode. Pages nobody
+ * maps any more stay until memory runs short, when the cache's
+ * shrinker lets the oldest half of them go, or until the file is
+ * written, truncated or removed, or its filesystem unmounted; the
+ * filesystems call pagecache_invalidate and pagecache_purge once the
+ * file has changed (which also drop the exec cache's image of it; see
+ * execcache.h). A page being read in while its file is written
+ * may still be cached from before the write.
+ *
+ * The cache is part of the paging VM, so without it (no OPT_A3) the
+ * calls the filesystems make are no-ops.
+ *
+ * Functions:
+ *     pagecache_bootstrap  - set up. Called once from vm_bootstrap.
+ *     pagecache_lookup     - if the page of V at OFFSET is cached with
+ *                            LEN bytes from the file, take a reference
+ *                            to its frame for the caller and return
+ *                            true.
+ *     pagecache_insert     - offer the caller's freshly read frame at
+ *                            PADDR as that page. Hands back the frame
+ *                            the caller should map, with a reference
+ *                            for the caller: PADDR itself, now also
+ *                            referenced by the cache, or the one
+ *                            somebody else put there first, in which
+ *                            case the caller frees PADDR. Returns
+ *                            false, leaving PADDR the caller's alone,
+ *                            if it could not be shared.
+ *     pagecache_read       - copy to UIO what the cache has of V from
+ *                            UIO's offset on, up to the first byte it
+ *                            does not have; the caller reads the rest.
+ *     pagecache_invalidate - forget the pages of V with file bytes
+ *                            between START and END; after a write.
+ *     pagecache_purge      - forget every page of V; after a truncate,
+ *                            or once it has no names left.
+ *     pagecache_purgefs    - forget every page on FS, before it is
+ *                            unmounted.
+ */
+
+#include "opt-A3.h"
+
+struct vnode;
+struct uio;
+struct fs;
+
+#if OPT_A3
+
+#include <machine/vm.h>
+
+void pagecache_bootstrap(void);
+bool pagecache_lookup(struct vnode *v, off_t offset, size_t len,
+		      paddr_t *ret);
+bool pagecache_insert(struct vnode *v, off_t offset, size_t len,
+		      paddr_t paddr, paddr_t *ret);
+int pagecache_read(struct vnode *v, struct uio *uio);
+void pagecache_invalidate(struct vnode *v, off_t start, off_t end);
+void pagecache_purge(struct vnode *v);
+void pagecache_purgefs(struct fs *fs);
+
+#else
+
+#define pagecache_read(v, uio)             ((void)(v), (void)(uio), 0)
+#define pagecache_invalidate(v, start, end) \
+	((void)(v), (void)(start), (void)(end))
+#define pagecache_purge(v)                 ((void)(v))
+#define pagecache_purgefs(fs)              ((void)(fs))
+
+#endif /* OPT_A3 */
+
+#endif /* _PAGECACHE_H_ */
@@ -0,0 +1,74 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table for user address spaces.
+ *
+ * The top 10 bits of a virtual address index the directory, the next
+ * 10 bits index a second-level table, and the bottom 12 bits are the
+ * offset within the page. Second-level tables are allocated the first
+ * time something in their 4M of address space is touched, so a sparse
+ * address space costs one page of directory plus one page per 4M
+ * actually in use.
+ *
+ * A page table entry holds the physical frame in its top bits and
+ * flags in its bottom bits. An entry of 0 means the page has never
+ * been touched. PTE_COW marks a frame shared with another address
+ * space by as_copy, or the shared zero page; it is mapped read-only
+ * until written, and then copied. A page that has been evicted has
+ * PTE_SWAPPED instead of PTE_VALID and its swap slot where the frame
+ * would be. PTE_DIRTY is only kept for shared file mappings, and marks
+ * pages that have to be written back to the file; it survives a trip
+ * through swap. PTE_AGED is set on resident pages by the page ager
+ * (see coremap.c) and cleared by the next fault on them: the refill
+ * handler will not load an aged entry, so that touch comes through
+ * vm_fault and the page is seen to be in use.
+ *
+ * PTE_VALID and PTE_WRITE sit where the MIPS TLB wants its valid and
+ * dirty (write enable) bits, so that the refill handler in
+ * exception-mips1.S can load a resident entry into the TLB with just
+ * the software bits masked off. PTE_WRITE is only set on pages that
+ * are writeable and not copy-on-write. The low byte of an entry is
+ * for software only.
+ *
+ * Functions:
+ *     pt_create  - allocate an empty page table. Returns NULL on
+ *                  out-of-memory.
+ *     pt_destroy - free a page table, releasing every resident frame
+ *                  and swap slot it maps.
+ *     pt_lookup  - return a pointer to the entry for VADDR. If the
+ *                  second-level table does not exist, it is created
+ *                  when CREATE is set (returning NULL on out-of-memory)
+ *                  and NULL is returned otherwise.
+ */
+
+#include <machine/vm.h>
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME     0xfffff000	/* physical frame, if PTE_VALID */
+#define PTE_WRITE     0x00000400	/* may be mapped writeable */
+#define PTE_VALID     0x00000200	/* page is resident in PTE_FRAME */
+#define PTE_COW       0x00000002	/* frame is shared copy-on-write */
+#define PTE_SWAPPED   0x00000004	/* page is in swap slot PTE_SLOT */
+#define PTE_DIRTY     0x00000008	/* written since read from the file */
+#define PTE_AGED      0x00000010	/* not touched since the ager passed */
+#define PTE_SOFTBITS  0x000000ff	/* not seen by the TLB */
+
+#define PTE_SLOTSHIFT 12		/* slot number lives in PTE_FRAME */
+#define PTE_SLOT(pte)   ((pte) >> PTE_SLOTSHIFT)
+#define PTE_MKSWAP(slot) (((pte_t)(slot) << PTE_SLOTSHIFT) | PTE_SWAPPED)
+
+#define PT_ENTRIES    1024
+#define PT_L1_INDEX(va) (((va) >> 22) & (PT_ENTRIES - 1))
+#define PT_L2_INDEX(va) (((va) >> 12) & (PT_ENTRIES - 1))
+
+struct pagetable {
+	pte_t *pt_dir[PT_ENTRIES];
+};
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+
+#endif /* _PAGETABLE_H_ */
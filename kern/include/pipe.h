@@ -0,0 +1,22 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Pipes: a read end and a write end, each a vnode, sharing a ring of
+ * PIPE_SIZE bytes. See vfs/pipe.c.
+ *
+ * Functions:
+ *     pipe_create - make a pipe, returning its ends in *RVN and *WVN,
+ *                   each open as if by vfs_open, so that vfs_close
+ *                   closes it. Returns ENOMEM.
+ */
+
+#include <vm.h>
+
+#define PIPE_SIZE PAGE_SIZE
+
+struct vnode;
+
+int pipe_create(struct vnode **rvn, struct vnode **wvn);
+
+#endif /* _PIPE_H_ */
@@ -0,0 +1,69 @@
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Waiting in poll.
+ *
+ * Everything a poll can wait for (the console, each end of a pipe)
+ * has a pollq per kind of event, and calls pollq_wake on it when that
+ * event may have happened: input arrived, room appeared, the other end
+ * went away. A poll has a poller. VOP_POLL on each of its files puts
+ * the poller on the pollqs that matter to the events asked for, with
+ * poller_register, and then says what is ready now; if nothing is,
+ * poller_sleep waits until one of those pollqs is woken. Only the
+ * polls interested in an object are woken, not every poll there is.
+ *
+ * Registering before looking means a wakeup cannot fall between the
+ * look and the sleep. The entries come from the polling thread's
+ * arena, and poller_cleanup takes them all off their pollqs before the
+ * arena is released; the caller keeps the files open until then, so
+ * the pollqs are still there.
+ *
+ * pollq_wake only takes a lock if some poller is on the queue, so the
+ * objects can call it freely, including from interrupt handlers.
+ *
+ * Functions:
+ *     pollq_init      - set up an empty pollq.
+ *     pollq_cleanup   - tear one down; nobody may be on it.
+ *     pollq_wake      - wake the pollers on PQ.
+ *     poller_init     - set up a poller. Returns ENOMEM.
+ *     poller_cleanup  - take the poller off every pollq and tear it
+ *                       down.
+ *     poller_register - put PL on PQ, from VOP_POLL. If there is no
+ *                       memory for it, pl_nomem is set, and the poll
+ *                       must not sleep.
+ *     poller_sleep    - sleep until a pollq PL is on is woken, or TO
+ *                       fires (if not NULL), unless that has happened
+ *                       since the last poller_sleep.
+ */
+
+#include <spinlock.h>
+#include <kern/poll.h>
+
+struct wchan;
+struct timeout;
+struct pollent;
+
+struct pollq {
+	struct spinlock pq_lock;
+	struct pollent *volatile pq_ents;	/* pollers waiting */
+};
+
+struct poller {
+	struct spinlock pl_lock;
+	struct wchan *pl_wchan;
+	bool pl_woken;			/* under pl_lock */
+	struct pollent *pl_ents;	/* where we are registered */
+	bool pl_nomem;			/* a registration failed */
+};
+
+void pollq_init(struct pollq *pq);
+void pollq_cleanup(struct pollq *pq);
+void pollq_wake(struct pollq *pq);
+
+int poller_init(struct poller *pl);
+void poller_cleanup(struct poller *pl);
+void poller_register(struct poller *pl, struct pollq *pq);
+void poller_sleep(struct poller *pl, struct timeout *to);
+
+#endif /* _POLL_H_ */
@@ -41,6 +41,7 @@
 #include <array.h>
 #include <synch.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 #if OPT_A2
 typedef bool status_t;
@@ -50,10 +51,27 @@ typedef bool status_t;
 
 struct addrspace;
 struct vnode;
+struct filetable;
+struct rusage;
+struct aio_ctx;
 #ifdef UW
 struct semaphore;
 #endif // UW
 
+/*
+ * Resource usage, for getrusage: what a process's threads and address
+ * spaces used, counted as they go, or what its reaped children used.
+ */
+struct proc_usage
+{
+	unsigned pu_runticks;		/* hardclocks run */
+	unsigned pu_minflt;		/* faults served without I/O */
+	unsigned pu_majflt;		/* faults that read from file or swap */
+	unsigned pu_oublock;		/* 512-byte blocks written */
+	unsigned pu_nvcsw;		/* gave up the cpu */
+	unsigned pu_nivcsw;		/* preempted */
+};
+
 /*
  * Process structure.
  */
@@ -64,6 +82,7 @@ struct proc
 	struct spinlock p_lock; /* Lock for this structure */
 
 	struct threadarray p_threads; /* Threads in this process */
+	volatile unsigned p_nthreads; /* how many; see curproc_single */
 
 	/* VM */
 	struct addrspace *p_addrspace; /* virtual address space */
@@ -71,28 +90,64 @@ struct proc
 	/* VFS */
 	struct vnode *p_cwd; /* current working directory */
 
+	/* Accounting; under p_lock */
+	struct proc_usage p_usage;	/* threads and address spaces gone */
 #if OPT_A2
-	pid_t pid;
+	struct proc_usage p_cusage;	/* children waited for */
+#endif
+
+#if OPT_A2
+	pid_t pid;			/* 0 until it has one; kproc never does */
+	struct schedgroup *p_group;	/* its process group; under p_lock */
+	struct proc *p_pidnext;		/* in its pid hash chain */
 	struct lock *p_Lock;
-	struct proc *parent;
-	struct array *children;
-	status_t status;
-	struct cv *p_cv;
-	int exitcode;
+	struct proc *parent;		/* under our p_Lock; see proc_exit */
+	struct array *children;		/* not yet waited for; under p_Lock */
+	status_t status;		/* under our and parent's p_Lock */
+	struct cv *p_waitcv;		/* a child exited; with p_Lock */
+	int exitcode;			/* wait status, once Zombie */
 #endif
 
-#ifdef UW
-	/* a vnode to refer to the console device */
-	/* this is a quick-and-dirty way to get console writes working */
-	/* you will probably need to change this when implementing file-related
-     system calls, since each process will need to keep track of all files
-     it has opened, not just the console. */
-	struct vnode *console; /* a vnode for the console device */
+#if OPT_A3
+	/*
+	 * User threads (see thread_syscalls.c). All of these, and adding
+	 * threads to p_threads or taking them off while the process has
+	 * more than one, are under p_tlock.
+	 */
+	struct lock *p_tlock;
+	struct cv *p_tcv;		/* a thread finished, or p_exiting */
+	struct array *p_uthreads;	/* struct uthread *, until joined */
+	int p_nexttid;
+	volatile bool p_exiting;	/* being ended; other threads must go */
+	volatile bool p_oomkill;	/* picked by proc_oomvictim */
+	struct aio_ctx *p_aio;		/* from aio_setup; set under p_tlock */
+	struct upcall *p_upcall;	/* see upcall.h; set under p_tlock */
 #endif
 
+	/* File descriptors; NULL for kproc, which has none */
+	struct filetable *p_files;
+
 	/* add more material here as needed */
 };
 
+#if OPT_A3
+/*
+ * A thread made by thread_create, from then until it is joined. The
+ * process's first thread has none.
+ */
+struct uthread
+{
+	int ut_tid;
+	struct thread *ut_thread;	/* once started; NULL once done */
+	vaddr_t ut_stack;		/* base of its stack region */
+	vaddr_t ut_start;		/* where it enters user mode */
+	vaddr_t ut_func, ut_arg;	/* passed to ut_start */
+	bool ut_done;
+	bool ut_joining;		/* someone is in thread_join for it */
+	userptr_t ut_retval;		/* from thread_exit */
+};
+#endif
+
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
@@ -116,6 +171,104 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/*
+ * Accounting. proc_chargeas adds the faults of address space AS, which
+ * P is done with, to P's usage; proc_getrusage fills in RU with P's
+ * own usage so far (WHO is RUSAGE_SELF) or that of its children that
+ * have been waited for (RUSAGE_CHILDREN), and returns EINVAL for any
+ * other WHO.
+ */
+void proc_chargeas(struct proc *p, struct addrspace *as);
+int proc_getrusage(struct proc *p, int who, struct rusage *ru);
+
+/*
+ * Scheduling. A process's nice value and cpu affinity are those of
+ * each of its threads (see thread_setnice and thread_setaffinity);
+ * the set functions apply them to all of them, and the get ones
+ * return ESRCH if P has no threads left to ask.
+ */
+void proc_setnice(struct proc *p, int nice);
+int proc_getnice(struct proc *p, int *ret);
+void proc_setaffinity(struct proc *p, uint32_t mask);
+int proc_getaffinity(struct proc *p, uint32_t *ret);
+
+#if OPT_A2
+/*
+ * Find the process with pid PID, or return NULL. If PARENT is not
+ * NULL, only a child of PARENT is found; a child cannot be destroyed
+ * while its parent is in a system call, so that one is safe to use.
+ * Any other process may be destroyed as soon as this returns.
+ */
+struct proc *proc_lookup(pid_t pid, struct proc *parent);
+
+/*
+ * Finish off process P, whose threads are all gone: let go of its
+ * children, then make it a zombie with wait status STATUS for its
+ * parent to collect with waitpid, or destroy it if it has no parent.
+ */
+void proc_exit(struct proc *p, int status);
+
+/* Add the usage of CHILD, once waited for, to PARENT's children's. */
+void proc_chargechild(struct proc *parent, struct proc *child);
+
+/*
+ * Process groups, which the scheduler shares the cpu out between (see
+ * schedule() in thread.c). A process run from the menu leads a group
+ * of its own, whose id is its pid, and a child starts in its parent's.
+ * proc_setpgid moves P to group PGID, making it if PGID is P's own pid;
+ * EPERM if there is no such group, ENOMEM if it cannot be made.
+ * proc_getpgid returns P's group id.
+ */
+int proc_setpgid(struct proc *p, pid_t pgid);
+pid_t proc_getpgid(struct proc *p);
+#endif
+
+#if OPT_A3
+/*
+ * Ending threads of multithreaded processes.
+ *
+ * proc_exitthreads is called by a thread about to end its process: it
+ * sets p_exiting and waits until the process's other threads are gone.
+ * If another thread got there first, it ends the caller instead.
+ *
+ * proc_checkexit is called on the way back to user mode, and ends the
+ * calling thread if its process is being ended.
+ *
+ * proc_thread_exit ends the calling thread, which must not be the last
+ * in its process, leaving RETVAL for thread_join. Called with p_tlock
+ * held.
+ *
+ * None of them return if they end the thread.
+ */
+void proc_exitthreads(void);
+void proc_checkexit(void);
+void proc_thread_exit(userptr_t retval);
+
+/*
+ * proc_exitself ends the calling thread's process as _exit does, with
+ * wait status STATUS (e.g. _MKWAIT_SIG(SIGKILL)). It does not return.
+ *
+ * proc_oomvictim picks a process to kill for memory (see oom.h), the
+ * user process with the most resident pages, sets its p_oomkill, and
+ * says so on the console; proc_checkexit then ends it with SIGKILL.
+ * While one picked before still has its address space, that one's pid
+ * is handed back instead, unless ANOTHER is set. Returns 0 if there is
+ * nothing left to pick.
+ */
+void proc_exitself(int status);
+pid_t proc_oomvictim(bool another);
+#endif
+
+/*
+ * Whether the calling thread is the current process's only one. Then
+ * p_addrspace and p_cwd, which only a process's own threads change, can
+ * be read without p_lock: others that read them take it, and no other
+ * thread of ours can be changing them. Only the calling thread can add
+ * a second thread to its process, so it stays true until it does
+ * (kproc is left out, as any thread may add one to that).
+ */
+#define curproc_single() (curproc != kproc && curproc->p_nthreads == 1)
+
 /* Fetch the address space of the current process. */
 struct addrspace *curproc_getas(void);
 
@@ -0,0 +1,40 @@
+#ifndef _PROF_H_
+#define _PROF_H_
+
+/*
+ * Sampling CPU profiler.
+ *
+ * While it runs, each hardclock on a busy cpu takes a sample: the pc
+ * the timer interrupt came in at, whether that was in user mode, and
+ * the pid of the process the interrupted thread belongs to (0 for
+ * kernel threads). A kernel sample for a process is time spent in the
+ * kernel on its behalf, in a system call or a fault. A tick that finds
+ * its cpu idle is counted but not sampled (and the idle cpu's clock
+ * then stops; see hardclock). Each cpu keeps its own PROF_NSAMPLES
+ * samples, at HZ a second, and counts as dropped what does not fit.
+ *
+ * The menu's "prof" command runs it. prof_dump prints one line per
+ * distinct pc:
+ *     prof k 0x80012345 57        (kernel pc, samples)
+ *     prof u 12 0x00400abc 3      (pid, user pc, samples)
+ * after a line per process of its kernel and user samples. Saving the
+ * console output to a file and running conf/profsym.sh on it with the
+ * kernel binary adds the kernel samples up by function.
+ *
+ * Functions:
+ *     prof_start - throw away the samples so far and start taking
+ *                  them. Returns ENOMEM if the buffers cannot be had.
+ *     prof_stop  - stop taking them.
+ *     prof_tick  - take one on this cpu; called by hardclock.
+ *     prof_dump  - print them. Returns EBUSY if the profile is
+ *                  running, ENOMEM if there is no room to sort.
+ */
+
+#define PROF_NSAMPLES	4096	/* per cpu */
+
+int prof_start(void);
+void prof_stop(void);
+void prof_tick(void);
+int prof_dump(void);
+
+#endif /* _PROF_H_ */
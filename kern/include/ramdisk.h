@@ -0,0 +1,26 @@
+#ifndef _RAMDISK_H_
+#define _RAMDISK_H_
+
+/*
+ * RAM disks.
+ *
+ * A ramdisk is a mountable device, like lhd0, whose blocks are kept in
+ * kernel memory. A page of it gets a frame from the coremap the first
+ * time anything is written there; until then it reads as zeros, so an
+ * empty disk of any size costs only its table of pages. Formatted with
+ * mksfs (on NAMEraw:) and mounted like any disk, it gives SFS that
+ * never waits for the disk. What it holds is gone at reboot.
+ *
+ * It is reached only through d_io, and is never taken apart again;
+ * its memory comes back only at reboot.
+ *
+ * Functions:
+ *     ramdisk_create - make the ramdisk NAME of NBLOCKS blocks of
+ *                      RAMDISK_BLOCKSIZE bytes.
+ */
+
+#define RAMDISK_BLOCKSIZE	512
+
+int ramdisk_create(const char *name, uint32_t nblocks);
+
+#endif /* _RAMDISK_H_ */
@@ -0,0 +1,50 @@
+#ifndef _RCU_H_
+#define _RCU_H_
+
+/*
+ * Read-copy-update, for data that is read all the time and changed
+ * hardly ever, so that readers need take no lock and write nothing
+ * another cpu reads.
+ *
+ * A reader brackets its look with rcu_read_lock and rcu_read_unlock
+ * and loads the published pointers with rcu_deref. The bracket is the
+ * same spl raise a spinlock does, which writes only the thread's own
+ * counts, and inside it the reader must not sleep, so it must be
+ * short. A writer, serialized with other writers by whatever lock it
+ * likes, builds the new version aside, publishes it with rcu_assign,
+ * and calls rcu_synchronize before freeing anything a reader might
+ * still have been looking at.
+ *
+ * rcu_synchronize is quiescent-state based: each cpu counts, in
+ * c_rcugen, the points at which it certainly is not inside a reader
+ * (each context switch, and each hardclock, which cannot come in while
+ * a reader has interrupts off), and the writer waits until every other
+ * cpu's count has moved, or the cpu is idle.
+ *
+ * Functions:
+ *     rcu_read_lock   - start reading. Nests.
+ *     rcu_read_unlock - stop.
+ *     rcu_deref       - load pointer P, inside a reader.
+ *     rcu_assign      - make pointer P point to V, once everything V
+ *                       points to is filled in.
+ *     rcu_synchronize - wait until every reader that could have seen
+ *                       the version before this was called is done.
+ *                       Sleeps, for a tick or two.
+ *     rcu_quiescent   - count a quiescent state on the current cpu.
+ *                       Interrupts off; for thread_switch and
+ *                       hardclock.
+ */
+
+#include <spl.h>
+#include <atomic.h>
+
+#define rcu_read_lock()   splraise(IPL_NONE, IPL_HIGH)
+#define rcu_read_unlock() spllower(IPL_HIGH, IPL_NONE)
+
+#define rcu_deref(p)      (*(__typeof__(p) volatile *)&(p))
+#define rcu_assign(p, v)  (membar_sync(), rcu_deref(p) = (v))
+
+void rcu_synchronize(void);
+void rcu_quiescent(void);
+
+#endif /* _RCU_H_ */
@@ -0,0 +1,58 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+/*
+ * Fixed-size rings of pointers, with no locks.
+ *
+ * A ring holds up to its size (a power of two) pointers, which may not
+ * be NULL, and hands them out in the order they went in. Nothing is
+ * allocated after it is made, and neither end ever waits: a put to a
+ * full ring fails and a get from an empty one returns NULL, so both
+ * are safe in interrupt handlers and with spinlocks held. Those who
+ * need to sleep for room or for something to take put a semaphore or
+ * wchan on top. Unlike a queue (queue.h) neither needs a lock around
+ * it or can run out of memory.
+ *
+ * struct ring takes any number of producers and consumers on any cpus.
+ * Each slot has a sequence number that says which lap of the ring it
+ * is ready to be filled or emptied in, and a producer (consumer) takes
+ * its turn by moving the tail (head) on with atomic_cas, then fills
+ * (empties) the slot and hands it on by bumping the number. So a get
+ * can find the ring empty while a put that moved the tail first is
+ * still filling its slot; the get after it finishes will not.
+ *
+ * struct spscring is for one producer and one consumer at a time (for
+ * instance each always on its own cpu, or under a lock of its own),
+ * and does no atomic operations, only barriers.
+ *
+ * In both, the head and tail are on cache lines of their own, so the
+ * two ends do not fight over a line.
+ *
+ * Functions:
+ *     ring_create      - a ring of at least SIZE slots (rounded up to a
+ *                        power of two, and at least 2). NULL if out of
+ *                        memory.
+ *     ring_destroy     - free it; it should be empty.
+ *     ring_put         - add PTR at the tail. False if the ring is full.
+ *     ring_get         - take the pointer at the head, or NULL if empty.
+ *     ring_count       - how many pointers are in it; only a snapshot
+ *                        while others are using it.
+ *     spscring_*       - the same, for one producer and one consumer.
+ */
+
+struct ring;
+struct spscring;
+
+struct ring *ring_create(unsigned size);
+void ring_destroy(struct ring *r);
+bool ring_put(struct ring *r, void *ptr);
+void *ring_get(struct ring *r);
+unsigned ring_count(struct ring *r);
+
+struct spscring *spscring_create(unsigned size);
+void spscring_destroy(struct spscring *r);
+bool spscring_put(struct spscring *r, void *ptr);
+void *spscring_get(struct spscring *r);
+unsigned spscring_count(struct spscring *r);
+
+#endif /* _RING_H_ */
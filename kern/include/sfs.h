@@ -41,6 +41,7 @@
  */
 #include <fs.h>
 #include <vnode.h>
+#include <shrink.h>
 
 /*
  * Get on-disk structures and constants that are made available to 
@@ -48,27 +49,108 @@
  */
 #include <kern/sfs.h>
 
+/*
+ * Locking.
+ *
+ * Each filesystem has two locks of its own:
+ *     sfs_vnlock      - the table of loaded vnodes, sfs_vnhash, and
+ *                       the list of unused ones kept loaded,
+ *                       sfs_vnlru. Held while finding or loading a
+ *                       vnode and while reclaiming one, so the two
+ *                       cannot cross.
+ *     sfs_freemaplock - the free block bitmap, sfs_freemapdirty and
+ *                       sfs_mapdirty, and sfs_superdirty.
+ * and each vnode one:
+ *     sv_lock         - the in-memory inode sv_i, sv_dirty and sv_jgen, the
+ *                       readahead state, and for a directory, its
+ *                       entries and their index sv_dirhash. Held
+ *                       across I/O to the file's blocks, so writers of
+ *                       one file do not interleave; other files are
+ *                       not held up.
+ * An inode's type and number never change once it is loaded, and nor
+ * does the superblock, so reading those needs no lock.
+ *
+ * Order, first to last:
+ *     vfs_biglock (see vfs.h)
+ *     shrink's lock, while sfs_vnshrink runs (see shrink.h)
+ *     a journal handle (sfs_jbegin), and sfs_jlock inside that
+ *     sv_lock of the directory
+ *     sv_lock of a file in it
+ *     sfs_vnlock
+ *     buffer locks (see sfs_buf.c), an indirect block's before the
+ *         blocks it points to; otherwise only one at a time
+ *     sfs_freemaplock
+ * Releasing a vnode can reclaim it, which takes its sv_lock and then
+ * sfs_vnlock, so VOP_DECREF may be called with a directory's sv_lock
+ * held but not with sfs_vnlock or the vnode's own sv_lock held.
+ *
+ * The block device does its own locking, so disk I/O needs no lock
+ * from here, only whichever ones cover the data being moved; for the
+ * cache, that is the buffer's lock.
+ */
+
+struct sfs_dirhash;			/* in sfs_vnode.c */
+
 struct sfs_vnode {
 	struct vnode sv_v;              /* abstract vnode structure */
 	struct sfs_inode sv_i;		/* on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	unsigned sv_jgen;               /* commit its size or blocks go in */
+	uint32_t sv_ranext;             /* block a sequential read is at */
+	uint32_t sv_rawindow;           /* blocks to read ahead; 0 if none */
+	uint32_t sv_raend;              /* read ahead up to here already */
+	struct sfs_dirhash *sv_dirhash; /* names of a big directory */
+	struct lock *sv_lock;           /* see above */
+	struct sfs_vnode *sv_hashnext;  /* in sfs_vnhash; under sfs_vnlock */
+	bool sv_parked;                 /* unused, on sfs_vnlru */
+	struct sfs_vnode *sv_lrunext;   /* on sfs_vnlru iff sv_parked */
+	struct sfs_vnode *sv_lruprev;
 };
 
+#define SFS_VNHASH	64	/* chains of loaded vnodes; a power of 2 */
+
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
 	struct sfs_super sfs_super;	/* on-disk superblock */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode *sfs_vnhash[SFS_VNHASH]; /* loaded, by inode */
+	unsigned sfs_nvnodes;           /* in sfs_vnhash */
+	struct sfs_vnode *sfs_vnlru;    /* parked, least recently used first */
+	struct sfs_vnode *sfs_vnlrutail;
+	unsigned sfs_nparked;           /* on sfs_vnlru */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct bitmap *sfs_mapdirty;    /* which blocks of it, 1 each */
+	struct lock *sfs_vnlock;        /* see above */
+	struct lock *sfs_freemaplock;
+
+	/* The journal (sfs_journal.c); not used if sfs_jblocks is 0 */
+	uint32_t sfs_jstart;            /* from the superblock */
+	uint32_t sfs_jblocks;
+	uint32_t sfs_jseq;              /* of the next record */
+	uint32_t *sfs_jhdr;             /* a record's header, being built */
+	void *sfs_jbuf;                 /* a block, for replay */
+	unsigned sfs_jnmeta;            /* buffers pinned; in sfs_buf.c */
+	struct bitmap *sfs_jfreed;      /* freed since the last commit */
+	unsigned sfs_jnfreed;           /* and how many; sfs_freemaplock */
+	struct lock *sfs_jlock;
+	struct cv *sfs_jcv;             /* handles gone, or commit done */
+	unsigned sfs_jactive;           /* handles open; under sfs_jlock */
+	bool sfs_jcommitting;
+	unsigned sfs_jgen;              /* commits begun; under sfs_jlock */
+	unsigned sfs_jdone;             /* the last to succeed; ditto */
+
+	struct sfs_fs *sfs_syncnext;    /* the syncer's list; sfs_buf.c */
+	struct shrinker sfs_shrinker;   /* sheds parked vnodes */
 };
 
 /*
- * Function for mounting a sfs (calls vfs_mount)
+ * Functions for mounting a sfs (call vfs_mount and vfs_mountlazy)
  */
 int sfs_mount(const char *device);
+int sfs_mountlazy(const char *device);
 
 
 /*
@@ -79,11 +161,141 @@ int sfs_mount(const char *device);
 #define SFSUIO(iov, uio, ptr, block, rw) \
     uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
+/* Loaded vnodes (sfs_vnode.c); sfs_vnlock held, but not for the shrinker */
+void sfs_vnevict(struct sfs_fs *sfs, unsigned keep);
+void sfs_vnshrink(void *data);
+
+/* For the journal's commit (sfs_vnode.c, sfs_fs.c) */
+int sfs_syncinodes(struct sfs_fs *sfs);
+void sfs_bfreeheld(struct sfs_fs *sfs);
+int sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw);
+
 /* Convenience functions for block I/O */
 int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, uint32_t block);
 
+/*
+ * Buffer cache (sfs_buf.c). Everything but the superblock and the
+ * free block bitmap, which are kept in memory anyway, is read and
+ * written through it.
+ *
+ * On a volume with a journal, metadata (inodes, indirect blocks and
+ * directories) is dirtied with sfs_bdirtymeta instead of sfs_bdirty.
+ * Such a buffer is pinned: it is written back only by the journal's
+ * commit, after a copy of it is in the journal, never by sync,
+ * eviction or the syncer.
+ *
+ *     sfs_bufinit - make the buffers, at mount; does nothing after the
+ *                   first time.
+ *     sfs_bget    - get BLOCK's buffer, locked, reading the block in if
+ *                   it is not cached and FILL is set; without FILL the
+ *                   caller must write the whole of it.
+ *     sfs_bdata   - the buffer's SFS_BLOCKSIZE bytes.
+ *     sfs_bdirty  - the caller changed it; write it back later.
+ *     sfs_bdirtymeta - the same, for metadata.
+ *     sfs_binval  - the contents are no good (a failed write into it
+ *                   without FILL); read it again next time.
+ *     sfs_bput    - unlock and let go of a buffer from sfs_bget.
+ *     sfs_bcached - whether BLOCK has a buffer; for I/O that goes around
+ *                   the cache, which must use it instead if so.
+ *     sfs_bforget - throw away BLOCK's buffer, dirty or not, if it has
+ *                   one, before writing the block around the cache.
+ *     sfs_bclean  - write out BLOCK's buffer if it has one that is
+ *                   dirty, before reading the block around the cache.
+ *     sfs_bflush  - write out the filesystem's dirty buffers, but for
+ *                   pinned ones, in one sweep up the disk.
+ *     sfs_bmetablocks - put the blocks of the filesystem's pinned
+ *                   buffers, up to MAX of them, in BLOCKS, and return
+ *                   how many there are.
+ *     sfs_bwriteout - write back a buffer from sfs_bget if it is dirty,
+ *                   pinned or not; for the journal's commit.
+ *     sfs_bprefetch - start reading BLOCK into the cache in the
+ *                   background, if it is not there; may do nothing.
+ *     sfs_bdrop   - forget the filesystem's buffers, and any readahead
+ *                   queued, at unmount, after sfs_bflush; none may be
+ *                   held.
+ *     sfs_bmount  - at the end of a mount, put the filesystem on the
+ *                   syncer's list, so its inodes are synced too;
+ *                   sfs_bdrop takes it off.
+ *     sfs_bthrottle - for a writer, before it takes any lock: if too
+ *                   many buffers are dirty, start the syncer and wait
+ *                   for it to write some.
+ *     sfs_bsyncset - change the syncer's settings: the seconds between
+ *                   rounds, the seconds a buffer is left dirty, and
+ *                   the percentages of buffers dirty at which a round
+ *                   starts early and at which writers wait. Fails
+ *                   with EINVAL unless 0 < BG <= MAX <= 100 and DELAY
+ *                   is not 0.
+ *     sfs_bsyncprint - print them, and how many buffers are dirty.
+ */
+struct sfs_buf;
+
+#define SFS_NBUF	128	/* buffers in the pool */
+
+int sfs_bufinit(void);
+int sfs_bget(struct sfs_fs *sfs, uint32_t block, bool fill,
+	     struct sfs_buf **ret);
+void *sfs_bdata(struct sfs_buf *b);
+void sfs_bdirty(struct sfs_buf *b);
+void sfs_bdirtymeta(struct sfs_buf *b);
+void sfs_binval(struct sfs_buf *b);
+void sfs_bput(struct sfs_buf *b);
+bool sfs_bcached(struct sfs_fs *sfs, uint32_t block);
+void sfs_bforget(struct sfs_fs *sfs, uint32_t block);
+int sfs_bclean(struct sfs_fs *sfs, uint32_t block);
+void sfs_bprefetch(struct sfs_fs *sfs, uint32_t block);
+int sfs_bflush(struct sfs_fs *sfs);
+unsigned sfs_bmetablocks(struct sfs_fs *sfs, uint32_t *blocks, unsigned max);
+int sfs_bwriteout(struct sfs_buf *b);
+void sfs_bdrop(struct sfs_fs *sfs);
+void sfs_bmount(struct sfs_fs *sfs);
+void sfs_bthrottle(void);
+int sfs_bsyncset(unsigned delay, unsigned age, unsigned bg, unsigned max);
+void sfs_bsyncprint(void);
+
+/*
+ * Metadata journal (sfs_journal.c); see kern/sfs.h for the format.
+ *
+ * Each change to the filesystem is made inside a handle, from
+ * sfs_jbegin to sfs_jend, taken before any of its locks. A commit
+ * waits for the handles open to finish and holds off new ones, so
+ * that what it writes is a state between whole operations; it writes
+ * every pinned buffer and changed freemap block to the journal as one
+ * record with a header, and only then puts them in place, so the
+ * operations since the last commit, however many, go together in one
+ * sequential write. Blocks freed meanwhile are not reused until the
+ * commit that frees them on disk. Handles nest; a thread has handles
+ * on one volume at a time.
+ *
+ *     sfs_jmount   - at mount: check the journal, replay a record left
+ *                    in it, and set up. Called before the freemap is
+ *                    loaded.
+ *     sfs_jdestroy - at unmount, or a failed mount after sfs_jmount.
+ *     sfs_jbegin   - open a handle; may commit first if many buffers
+ *                    are pinned.
+ *     sfs_jend     - close it.
+ *     sfs_jcommit  - commit now (sync, fsync, the syncer): the
+ *                    next commit to begin, which has every handle
+ *                    closed so far. One thread does it for all those
+ *                    waiting for it; those that come along while a
+ *                    commit is being written wait for the one after,
+ *                    and share it.
+ *     sfs_jnext    - inside a handle, the number of the commit its
+ *                    changes go in.
+ *     sfs_jcommitto - make sure commit GEN (from sfs_jnext) is done,
+ *                    sharing or starting it as sfs_jcommit does;
+ *                    nothing if it already is.
+ * None does anything on a volume without a journal.
+ */
+int sfs_jmount(struct sfs_fs *sfs);
+void sfs_jdestroy(struct sfs_fs *sfs);
+void sfs_jbegin(struct sfs_fs *sfs);
+void sfs_jend(struct sfs_fs *sfs);
+int sfs_jcommit(struct sfs_fs *sfs);
+unsigned sfs_jnext(struct sfs_fs *sfs);
+int sfs_jcommitto(struct sfs_fs *sfs, unsigned gen);
+
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
 
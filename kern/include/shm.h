@@ -0,0 +1,60 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+/*
+ * Shared memory segments: anonymous memory that several address
+ * spaces map at once, so that processes can hand each other large
+ * buffers without copying them through the kernel as a pipe does.
+ *
+ * A segment is a run of pages, each given a zero-filled frame the
+ * first time any of its attachers touches it. The segment holds one
+ * reference to each such frame and every page table mapping it
+ * another, as for pages shared copy-on-write; but these are mapped
+ * writeable and never copied, so a store by one process is seen by
+ * all the others at once. The frames are never made evictable (see
+ * coremap_set_owner), so they are not paged out or moved while the
+ * segment lasts. Which segment a region maps is in its rg_shm; fork
+ * shares the attachment, exec and exit drop it.
+ *
+ * Segments are found by key, or made without one (IPC_PRIVATE) for
+ * passing to children by id. A segment lasts, attached or not, until
+ * IPC_RMID; after that its id and key are gone and it goes away when
+ * the last attachment does.
+ *
+ * The table of segments is covered by shm_lock, which is taken with
+ * no as_lock held except to add an attachment in as_copy. Each
+ * segment's pages are covered by its own lock, taken with its
+ * attacher's as_lock held on a fault.
+ *
+ * Functions:
+ *     shm_bootstrap - set up. Called once from vm_bootstrap.
+ *     shm_get       - find the segment for KEY, or make one of SIZE
+ *                     bytes as FLAGS (IPC_CREAT, IPC_EXCL) say, and
+ *                     hand back its id.
+ *     shm_attach    - add an attachment to the segment with id ID and
+ *                     hand it back.
+ *     shm_incref    - add an attachment to SEG, for fork.
+ *     shm_detach    - drop an attachment to SEG; the last one after
+ *                     IPC_RMID frees it.
+ *     shm_npages    - how many pages SEG is.
+ *     shm_getpage   - hand back the frame for page INDEX of SEG, with
+ *                     a reference for the caller's mapping, setting
+ *                     *FRESH if it was made just now.
+ *     shm_ctl       - IPC_RMID or IPC_STAT, for shmctl. The statistics
+ *                     go in DS.
+ */
+
+struct shmseg;
+struct shmid_ds;
+
+void shm_bootstrap(void);
+int shm_get(int key, size_t size, int flags, int *ret);
+int shm_attach(int id, struct shmseg **ret);
+void shm_incref(struct shmseg *seg);
+void shm_detach(struct shmseg *seg);
+size_t shm_npages(struct shmseg *seg);
+int shm_getpage(struct shmseg *seg, size_t index, paddr_t *ret,
+		bool *fresh);
+int shm_ctl(int id, int cmd, struct shmid_ds *ds);
+
+#endif /* _SHM_H_ */
@@ -0,0 +1,49 @@
+#ifndef _SHRINK_H_
+#define _SHRINK_H_
+
+/*
+ * Giving memory back from kernel caches.
+ *
+ * A cache that holds memory it could do without (objects nobody is
+ * using, kept in case they are wanted again) registers a shrinker.
+ * When the frame allocator finds free frames below its low watermark
+ * it calls shrink_wake, and the page reclaim thread calls every
+ * shrinker in turn; each gives back about half of what it could. The
+ * allocator wakes the thread again with every further allocation made
+ * while memory stays low, so caches shrink as far as they need to and
+ * are otherwise free to grow into memory nobody else wants.
+ *
+ * Shrinkers run in the reclaim thread, holding no locks but shrink's
+ * own: they may sleep and take their cache's locks, but must not
+ * register or unregister a shrinker.
+ *
+ * Functions:
+ *     shrink_bootstrap   - start the reclaim thread. Called once, early.
+ *     shrinker_register  - add SH to those called.
+ *     shrinker_unregister - take it out again, waiting for it to
+ *                          finish if it is being called.
+ *     shrink_wake        - ask for memory back soon. For the frame
+ *                          allocator; safe anywhere, even with
+ *                          interrupts off.
+ *     shrink_now         - call every shrinker once, here and now
+ *                          (the menu's "shrink"). The caller must hold
+ *                          no locks a shrinker might take.
+ */
+
+struct shrinker {
+	const char *sh_name;
+	void (*sh_shrink)(void *data);
+	void *sh_data;
+	struct shrinker *sh_next;	/* registered; shrink.c */
+};
+
+#define SHRINKER_INITIALIZER(name, func, data) \
+	{ (name), (func), (data), NULL }
+
+void shrink_bootstrap(void);
+void shrinker_register(struct shrinker *sh);
+void shrinker_unregister(struct shrinker *sh);
+void shrink_wake(void);
+void shrink_now(void);
+
+#endif /* _SHRINK_H_ */
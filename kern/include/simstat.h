@@ -0,0 +1,59 @@
+#ifndef _SIMSTAT_H_
+#define _SIMSTAT_H_
+
+/*
+ * Measurements for the synchronization problem drivers (catmouse,
+ * traffic), so that solutions can be compared by more than whether
+ * they are safe.
+ *
+ * A waitstat keeps every wait, in microseconds, with the actor (a cat,
+ * a mouse, a vehicle thread) that waited and its class (cats or mice;
+ * the direction a vehicle came from). Its report gives each class's
+ * count, mean, median, 90th and 99th percentiles and max, and the
+ * actors that waited longest once and longest on average against the
+ * one that waited least on average, which shows up starvation.
+ *
+ * An occstat keeps each change in how many are using the resource (the
+ * bowls, the intersection), with when it happened. Its report gives
+ * the mean and peak occupancy weighted by time, the share of the run
+ * spent at each occupancy, and the mean over each tenth of the run.
+ *
+ * Both are sized for the whole run when they are made, and neither
+ * does any locking: the driver records under a lock of its own. The
+ * reports print lines starting "STATS:", as the drivers already do.
+ *
+ * Functions:
+ *     waitstat_create  - room for MAX waits by NACTORS actors in NCLASSES
+ *                        classes, named by CLASSNAMES. NULL if out of
+ *                        memory.
+ *     waitstat_record  - ACTOR of CLASS waited USECS.
+ *     waitstat_report  - print, for actors called ACTORNAME.
+ *     waitstat_destroy - free.
+ *     occstat_create   - room for MAX changes, to occupancies of up to
+ *                        CAPACITY; starts the clock, at 0. NULL if out
+ *                        of memory.
+ *     occstat_record   - the occupancy is now LEVEL.
+ *     occstat_stop     - stop the clock, at the end of the run.
+ *     occstat_report   - print, for a resource called WHAT; stops the
+ *                        clock first if need be.
+ *     occstat_destroy  - free.
+ */
+
+struct waitstat;
+struct occstat;
+
+struct waitstat *waitstat_create(unsigned max, unsigned nactors,
+				 unsigned nclasses,
+				 const char *const *classnames);
+void waitstat_record(struct waitstat *ws, unsigned actor, unsigned class,
+		     uint32_t usecs);
+void waitstat_report(struct waitstat *ws, const char *actorname);
+void waitstat_destroy(struct waitstat *ws);
+
+struct occstat *occstat_create(unsigned max, unsigned capacity);
+void occstat_record(struct occstat *os, unsigned level);
+void occstat_stop(struct occstat *os);
+void occstat_report(struct occstat *os, const char *what);
+void occstat_destroy(struct occstat *os);
+
+#endif /* _SIMSTAT_H_ */
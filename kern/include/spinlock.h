@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockprof.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -50,6 +51,15 @@
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * A spinlock is one of two kinds, chosen when it is set up. A plain
+ * one is a test-and-set word: cheap when uncontended, but every waiter
+ * hammers the same word and whoever's test-and-set lands first wins. A
+ * ticket lock hands out numbers instead: each waiter takes the next
+ * ticket with one atomic increment and then only reads lk_serving
+ * until it comes up, and the lock goes to waiters in arrival order.
+ * Uncontended the two cost about the same; the ticket lock is for
+ * locks that are fought over by several CPUs at once.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
@@ -57,17 +67,38 @@
 struct spinlock {
 	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+	bool lk_isticket;		/* Ticket lock, not test-and-set. */
+	volatile spinlock_data_t lk_ticket;  /* Next ticket to hand out. */
+	volatile spinlock_data_t lk_serving; /* Ticket that may have it. */
+#if OPT_LOCKPROF
+	vaddr_t lk_site;		/* Where it was acquired. */
+	uint32_t lk_acquired;		/* cpu_cycles() when it was. */
+	uint32_t lk_wait;		/* Cycles spent spinning for it. */
+	bool lk_contended;		/* Found held when acquiring. */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKPROF
+#define SPINLOCK_KIND_INITIALIZER(ticket) \
+	{ SPINLOCK_DATA_INITIALIZER, NULL, (ticket), \
+	  SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, \
+	  0, 0, 0, false }
+#else
+#define SPINLOCK_KIND_INITIALIZER(ticket) \
+	{ SPINLOCK_DATA_INITIALIZER, NULL, (ticket), \
+	  SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER }
+#endif
+#define SPINLOCK_INITIALIZER		SPINLOCK_KIND_INITIALIZER(false)
+#define SPINLOCK_TICKET_INITIALIZER	SPINLOCK_KIND_INITIALIZER(true)
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_ticket	Likewise, making it a ticket lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -77,6 +108,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
@@ -0,0 +1,29 @@
+#ifndef _STATWATCH_H_
+#define _STATWATCH_H_
+
+/*
+ * Watching the system's counters as they go, for long tests like
+ * parallelvm and triplesort.
+ *
+ * While it is on, a kernel thread prints one line every so many
+ * seconds of what happened since the line before, and where things
+ * stand:
+ *     stat 42s flt 130 tlb 5210 free 212 rq 2/0 cs 911 io 40r/12w
+ * the seconds since it was turned on, page faults (zero-filled and from disk), TLB faults, free frames
+ * (with OPT_A3), each cpu's run queue length, context switches, and
+ * requests done by all the storage devices. The lines go to the
+ * console through kprintf, so they are also in the kernel log for
+ * dmesg. The menu's "stat" command turns it on and off.
+ *
+ * Functions:
+ *     statwatch_start - print every SECS seconds, starting the thread
+ *                       if it is not already going. ENOMEM if it
+ *                       cannot be.
+ *     statwatch_stop  - stop printing; the thread is gone by the end
+ *                       of the interval it is sleeping in.
+ */
+
+int statwatch_start(unsigned secs);
+void statwatch_stop(void);
+
+#endif /* _STATWATCH_H_ */
@@ -0,0 +1,59 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * Pages evicted from memory are written to the raw disk SWAP_DEVICE,
+ * one page per slot. Slots are handed out from a bitmap. Pages that
+ * sit together in an address space are given slots that sit together
+ * on the disk, up to SWAP_CLUSTER at a time, and are written and read
+ * back in one request.
+ *
+ * In front of the disk is a pool of memory holding pages compressed
+ * (see lz.h). A page written to a slot goes there if it compresses to
+ * 3/4 of a page or less and there is room, and to the disk otherwise;
+ * either way it keeps its slot number, so the page table never knows
+ * the difference. Only reads from the disk cost I/O.
+ *
+ * Functions:
+ *     swap_bootstrap - open the swap device. If it is missing the
+ *                      system runs without swap. Called once at boot,
+ *                      after the devices are attached.
+ *     swap_ready     - true if swap is available.
+ *     swap_alloc     - reserve a slot. Returns ENOSPC if swap is full
+ *                      (or there is no swap).
+ *     swap_alloc_run - reserve N slots in a row, N at most
+ *                      SWAP_CLUSTER, and hand back the first. Returns
+ *                      ENOSPC if there is no run that long free.
+ *     swap_free      - release a slot.
+ *     swap_ondisk    - true if what was written to slot SLOT went to
+ *                      the disk, and so reading it back is I/O.
+ *     swap_read      - read slot SLOT into the frame at PADDR.
+ *     swap_write     - write the frame at PADDR to slot SLOT.
+ *     swap_read_run  - read the N slots from FIRST on into the frames
+ *                      at PADDRS, each run of them on the disk with one
+ *                      request.
+ *     swap_write_run - write the frames at PADDRS to the N slots from
+ *                      FIRST on, likewise.
+ */
+
+#include <machine/vm.h>
+
+#define SWAP_DEVICE "lhd1raw:"
+
+/* Most pages moved to or from swap in one request. */
+#define SWAP_CLUSTER 8
+
+void swap_bootstrap(void);
+bool swap_ready(void);
+int swap_alloc(unsigned *ret_slot);
+int swap_alloc_run(unsigned n, unsigned *ret_first);
+void swap_free(unsigned slot);
+bool swap_ondisk(unsigned slot);
+int swap_read(unsigned slot, paddr_t paddr);
+int swap_write(unsigned slot, paddr_t paddr);
+int swap_read_run(unsigned first, const paddr_t *paddrs, unsigned n);
+int swap_write_run(unsigned first, const paddr_t *paddrs, unsigned n);
+
+#endif /* _SWAP_H_ */
@@ -58,9 +58,12 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *     P_timed:      as P, but give up after TICKS timer ticks. Returns
+ *                   0, or ETIMEDOUT without decrementing.
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
+int P_timed(struct semaphore *, unsigned ticks);
 
 /*
  * Simple lock for mutual exclusion.
@@ -70,32 +73,59 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * A lock made with lock_create_handoff is given by lock_release
+ * straight to the thread it wakes, rather than left for whoever gets
+ * to it first. That keeps a running thread from taking it back again
+ * and again while the woken one finds it held and goes back to sleep,
+ * at the cost of the lock standing idle until the new owner runs.
  */
 struct lock
 {
         char *lk_name;
         struct spinlock lk_spin;
         struct wchan *lk_wchan;
-        struct thread *lk_owner;
+        struct thread *volatile lk_owner;
         volatile bool lk_held;
+        bool lk_handoff;                /* see lock_create_handoff */
+#if OPT_LOCKPROF
+        uint32_t lk_acquired;           /* cpu_cycles() when acquired */
+        uint32_t lk_wait;               /* cycles spent getting it */
+        bool lk_contended;              /* found held when acquiring */
+#endif
 };
 
+/* Most times lock_acquire checks on a running holder before sleeping. */
+#define LOCK_MAXSPIN 1000
+
 struct lock *lock_create(const char *name);
+struct lock *lock_create_handoff(const char *name);
 void lock_acquire(struct lock *);
 
 /*
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
- *                   same time.
+ *                   same time. While the holder is running on another
+ *                   cpu, waits by spinning (up to LOCK_MAXSPIN times
+ *                   round), since it will likely be done before a
+ *                   sleep and wakeup would be; otherwise lends the
+ *                   holder its priority (see thread_lendprio) and
+ *                   sleeps.
  *    lock_release - Free the lock. Only the thread holding the lock may do
- *                   this.
+ *                   this. A handoff lock with a waiter goes to it.
+ *                   Releasing the last lock held gives back any
+ *                   priority lent while holding them.
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
  *                   false otherwise.
+ *    lock_tryacquire - Get the lock if it is free and return true;
+ *                   return false without waiting if it is not. Does
+ *                   not sleep, so it may be used with spinlocks held.
  *
  * These operations must be atomic. You get to write them.
  */
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
+bool lock_tryacquire(struct lock *);
 void lock_destroy(struct lock *);
 
 /*
@@ -125,6 +155,9 @@ void cv_destroy(struct cv *);
  * Operations:
  *    cv_wait      - Release the supplied lock, go to sleep, and, after
  *                   waking up again, re-acquire the lock.
+ *    cv_timedwait - As cv_wait, but wake up anyway after TICKS timer
+ *                   ticks. Returns 0, or ETIMEDOUT if it was the
+ *                   time running out that woke it.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
  *
@@ -135,7 +168,51 @@ void cv_destroy(struct cv *);
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
+
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, no new reader gets
+ * in, so a steady stream of readers cannot keep writers out forever
+ * (though a steady stream of writers can keep readers out).
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock
+{
+        char *rw_name;
+        struct spinlock rw_spin;
+        struct wchan *rw_readwchan;	/* readers waiting */
+        struct wchan *rw_writewchan;	/* writers waiting */
+        unsigned rw_readers;		/* readers holding it */
+        unsigned rw_waitingwriters;
+        struct thread *rw_writer;	/* writer holding it, if any */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing, by itself.
+ *    rwlock_release_write - Give up the write hold. Only the thread
+ *                           holding it may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing. (Read holds are not
+ *                           tracked per thread.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
 #endif /* _SYNCH_H_ */
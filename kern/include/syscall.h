@@ -38,6 +38,13 @@ struct trapframe; /* from <machine/trapframe.h> */
 
 void syscall(struct trapframe *tf);
 
+/*
+ * Per-syscall counts: syscall_bootstrap sets them up once the cpus are
+ * all running, and syscall_printstats prints them.
+ */
+void syscall_bootstrap(void);
+void syscall_printstats(void);
+
 /*
  * Support functions.
  */
@@ -55,14 +62,73 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_clock_monotonic(off_t *retval);
+int sys_getsyscallstat(int callno, userptr_t ss);
+int sys_syscall_batch(userptr_t recs, unsigned n, int flags, int *retval);
 
 #ifdef UW
-int sys_write(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval);
+int sys_open(userptr_t path, int flags, mode_t mode, int *retval);
+int sys_openat(int dirfd, userptr_t path, int flags, mode_t mode,
+               int *retval);
+int sys_close(int fd);
+int sys_pipe(userptr_t fds);
+int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_read(int fd, userptr_t buf, size_t buflen, int *retval);
+int sys_write(int fd, userptr_t buf, size_t nbytes, int *retval);
+int sys_pread(int fd, userptr_t buf, size_t len, userptr_t usp, int *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t len, userptr_t usp,
+               int *retval);
+int sys_readv(int fd, userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, userptr_t iov, int iovcnt, int *retval);
+int sys_lseek(int fd, off_t pos, userptr_t usp, off_t *retval);
+int sys_fstat(int fd, userptr_t buf);
+int sys_fstatat(int dirfd, userptr_t path, userptr_t buf);
+int sys_fsync(int fd);
+int sys_fdatasync(int fd);
+int sys_stat(userptr_t path, userptr_t buf);
+int sys_lstat(userptr_t path, userptr_t buf);
+int sys_copy_file_range(int fdin, int fdout, size_t len, int *retval);
+int sys_getdirentry(int fd, userptr_t buf, size_t buflen, int *retval);
+int sys_getdirentries(int fd, userptr_t buf, size_t buflen, int *retval);
+int sys_ioctl(int fd, int code, userptr_t data);
+int sys_poll(userptr_t fds, unsigned nfds, int timeout, int *retval);
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
+int sys_getschedstat(unsigned cpu, userptr_t ss);
+int sys_getkstat(unsigned index, userptr_t ki);
+int sys_getiostat(unsigned index, userptr_t is);
+int sys_getrusage(int who, userptr_t ru);
+int sys_setpriority(int which, pid_t who, int prio);
+int sys_getpriority(int which, pid_t who, int *retval);
+int sys_getpgid(pid_t pid, pid_t *retval);
+int sys_setpgid(pid_t pid, pid_t pgid);
+int sys_sched_setaffinity(pid_t pid, unsigned mask);
+int sys_sched_getaffinity(pid_t pid, userptr_t mask);
+int sys_ktrace(int op, unsigned cpu, userptr_t buf, unsigned n,
+               int *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 int sys_fork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t program, userptr_t args);
+int sys_spawn(userptr_t program, userptr_t args, pid_t *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags,
+             userptr_t usp, vaddr_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_shmget(int key, size_t size, int flags, int *retval);
+int sys_shmat(int shmid, userptr_t shmaddr, int flags, vaddr_t *retval);
+int sys_shmdt(userptr_t shmaddr);
+int sys_shmctl(int shmid, int cmd, userptr_t buf);
+int sys_getmemstat(pid_t pid, userptr_t ms);
+int sys___thread_create(userptr_t start, userptr_t func, userptr_t arg,
+                        int *retval);
+int sys_thread_join(int tid, userptr_t retval);
+void sys_thread_exit(userptr_t retval);
+int sys_futex_wait(userptr_t uaddr, int val);
+int sys_futex_wake(userptr_t uaddr, unsigned n, int *retval);
+int sys_upcall_register(int on);
+int sys_upcall_wait(unsigned blocked, int *retval);
+int sys_aio_setup(userptr_t rings);
+int sys_aio_enter(unsigned min_complete, int *retval);
 
 #endif // UW
 
@@ -53,14 +53,23 @@ int traffic_simulation(int, char **);
 int arraytest(int, char **);
 int bitmaptest(int, char **);
 int queuetest(int, char **);
+int ringtest(int, char **);
+int lztest(int, char **);
 
 /* thread tests */
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadbench(int, char **);
+int schedtest(int, char **);
+int spinlocktest(int, char **);
+int workqtest(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwtest(int, char **);
+int timedtest(int, char **);
+int synchbench(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
@@ -80,8 +89,12 @@ int printfile(int, char **);
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
+int mallocbench(int, char **);
 int nettest(int, char **);
 
+/* the benchmark harness (see bench.h) */
+int benchcmd(int, char **);
+
 /* Routine for running a user-level program. */
 #if OPT_A2
 int runprogram(char *progname, char **args, unsigned long argc);
@@ -39,6 +39,7 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <arena.h>
 
 struct cpu;
 
@@ -55,6 +56,9 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/* Names shorter than this are kept in the thread, not kmalloc'd. */
+#define THREAD_NAMEBUF 16
+
 
 /* States a thread can be in. */
 typedef enum {
@@ -64,6 +68,19 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/*
+ * A scheduling group: the threads of a process group, which share one
+ * count of the cpu they have had, so that the scheduler can divide the
+ * cpu between groups before it looks at threads (see schedule() in
+ * thread.c). Held by the processes in it; see schedgroup_get.
+ */
+struct schedgroup {
+	pid_t sg_id;			/* the process group id */
+	unsigned sg_refcount;		/* processes in it; under schedgroup_lock */
+	volatile unsigned sg_usage;	/* hardclocks run, decaying; atomic */
+	struct schedgroup *sg_next;	/* on the list of all of them */
+};
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -73,6 +90,7 @@ struct thread {
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
+	char t_namebuf[THREAD_NAMEBUF];	/* t_name, if it fits */
 
 	/*
 	 * Thread subsystem internal fields.
@@ -83,6 +101,7 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	struct arena t_arena;		/* Scratch memory for syscalls */
 
 	/*
 	 * Interrupt state fields.
@@ -101,6 +120,46 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Scheduler fields, under the runqueue lock of t_cpu.
+	 */
+	unsigned t_priority;		/* 0 (best) to SCHED_NPRIO-1 */
+	unsigned t_usage;		/* hardclocks run at this priority */
+	unsigned t_runstart;		/* c_hardclocks when last put on or off */
+	unsigned t_lentprio;		/* lent by lock waiters; SCHED_NPRIO if none */
+	int t_nice;			/* PRIO_MIN to PRIO_MAX; see thread_setnice */
+	uint32_t t_affinity;		/* cpus it may run on, by c_number */
+	struct schedgroup *t_group;	/* its process's; NULL for kernel ones */
+
+	/*
+	 * Scheduling statistics (see getschedstat), also under the
+	 * runqueue lock of t_cpu.
+	 */
+	unsigned t_runticks;		/* hardclocks run, all told */
+	unsigned t_vswitches;		/* gave up the cpu */
+	unsigned t_ivswitches;		/* preempted */
+	unsigned t_wakeups;		/* made runnable by someone else */
+	uint64_t t_wakelat;		/* cycles from then until running */
+	uint32_t t_maxwakelat;
+	uint32_t t_wokeat;		/* cpu_cycles() when last made runnable */
+	bool t_waking;			/* made runnable, not yet running */
+	unsigned t_migrations;		/* ran on a different cpu from before */
+	struct cpu *t_lastcpu;		/* cpu it last ran on */
+	struct thread *t_inboxnext;	/* on a cpu's c_inbox */
+	bool t_bound;			/* never moved off t_cpu */
+
+	/* For getrusage; only the thread itself touches it */
+	unsigned t_oublock;		/* 512-byte blocks written */
+
+	/* If a user scheduler's worker, its process's; see upcall.h */
+	struct upcall *t_upcall;
+
+	/* SFS journal handles held (sfs_journal.c); only by the thread */
+	unsigned t_jnest;
+
+	/* Sleep locks held (synch.c); only the thread itself touches it */
+	unsigned t_nlocks;
+
 	/*
 	 * Public fields
 	 */
@@ -121,8 +180,20 @@ DEFARRAY(thread, THREADINLINE);
 /* Call once during system startup to allocate data structures. */
 void thread_bootstrap(void);
 
-/* Call late in system startup to get secondary CPUs running. */
+/*
+ * Call late in system startup to get secondary CPUs running, and
+ * later still to wait until they all are.
+ */
 void thread_start_cpus(void);
+void thread_wait_cpus(void);
+
+/*
+ * Scheduling statistics: fill in SS with curthread's and cpu CPU's
+ * (EINVAL if there is no such cpu), or print everyone's.
+ */
+struct schedstat;
+int thread_getschedstat(unsigned cpu, struct schedstat *ss);
+void thread_printschedstats(void);
 
 /* Call during panic to stop other threads in their tracks */
 void thread_panic(void);
@@ -144,6 +215,14 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * As thread_fork, but the new thread runs on CPU and only there:
+ * placement, migration and work stealing all leave it alone.
+ */
+int thread_fork_bound(const char *name, struct proc *proc, struct cpu *cpu,
+                      void (*func)(void *, unsigned long),
+                      void *data1, unsigned long data2);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -157,11 +236,69 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Switch if a wakeup has asked this cpu to (see thread.c). Called
+ * where preemption is safe: at the end of interrupt dispatch and when
+ * the spl drops to IPL_NONE.
+ */
+void thread_preempt(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
+/* Number of scheduling priorities; see schedule() in thread.c. */
+#define SCHED_NPRIO 4
+
+/*
+ * Lend the current thread's priority to T, which holds a lock it is
+ * about to sleep on, so T runs as if it were at least that urgent
+ * until it has let go of all its locks. Moves T up its run queue if it
+ * is waiting there. No spinlocks but the lock's own may be held.
+ */
+void thread_lendprio(struct thread *t);
+
+/*
+ * Drop any priority lent to the current thread. Called once it holds
+ * no locks.
+ */
+void thread_unlendprio(void);
+
+/*
+ * Set how nice T is to other threads, from PRIO_MIN (not at all) to
+ * PRIO_MAX; 0 is the default. A positive NICE keeps T from rising to
+ * the top of the scheduler's priorities, and a negative one from
+ * sinking to the bottom (see schedule() in thread.c).
+ */
+void thread_setnice(struct thread *t, int nice);
+
+/*
+ * Let T run only on the cpus whose c_number bits are set in MASK,
+ * which must name at least one cpu that exists (see thread_cpumask).
+ * T moves off a cpu it may no longer use the next time it is made
+ * runnable, or is picked to run there, whichever is first.
+ */
+void thread_setaffinity(struct thread *t, uint32_t mask);
+
+/* The mask of all the cpus there are. */
+uint32_t thread_cpumask(void);
+
+/*
+ * Scheduling groups. schedgroup_get returns group ID with a reference
+ * added, making it first if CREATE is set; NULL if there is none and
+ * CREATE is not set, or if it is and memory is short. schedgroup_ref
+ * adds a reference to G, and schedgroup_put drops one; the group goes
+ * with the last.
+ *
+ * thread_setgroup puts T in group G, or in none if G is NULL; the
+ * caller sees that G outlasts it there (proc_addthread and friends).
+ */
+struct schedgroup *schedgroup_get(pid_t id, bool create);
+void schedgroup_ref(struct schedgroup *g);
+void schedgroup_put(struct schedgroup *g);
+void thread_setgroup(struct thread *t, struct schedgroup *g);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
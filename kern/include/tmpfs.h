@@ -0,0 +1,26 @@
+#ifndef _TMPFS_H_
+#define _TMPFS_H_
+
+/*
+ * tmpfs, a filesystem kept in kernel memory.
+ *
+ * Files, directories and symlinks exist only as structures in kernel
+ * memory; a file's data is in whole pages from the coremap, got the
+ * first time each is written (a page never written reads as zeros).
+ * Directories keep their names in a hash table that grows with them,
+ * and hand them out in the order they were made. Like emu0, a tmpfs
+ * is not mounted on a device but added to the VFS under its own name,
+ * "NAME:", with vfs_addfs, and cannot be unmounted; what it holds is
+ * gone at reboot. Nothing it does waits for a disk.
+ *
+ * Lookups do not follow symlinks, as elsewhere in the VFS.
+ *
+ * Functions:
+ *     tmpfs_create - make the tmpfs NAME, which may hold up to
+ *                    MAXPAGES pages of file data (0 for as many as
+ *                    memory allows). ENOSPC once they are used up.
+ */
+
+int tmpfs_create(const char *name, unsigned maxpages);
+
+#endif /* _TMPFS_H_ */
@@ -60,6 +60,7 @@ struct uio {
 	enum uio_seg      uio_segflg;	/* What kind of pointer we have */
 	enum uio_rw       uio_rw;	/* Whether op is a read or write */
 	struct addrspace *uio_space;	/* Address space for user pointer */
+	bool              uio_direct;	/* Around any cache, if it can be */
 };
 
 
@@ -77,14 +78,16 @@ struct uio {
  *   (4) set up uio_seg and uio_rw correctly;
  *   (5) if uio_seg is UIO_SYSSPACE, set uio_space to NULL; otherwise,
  *       initialize uio_space to the address space in which the buffer
- *       should be found.
+ *       should be found;
+ *   (6) set uio_direct if the transfer is for a file open with O_DIRECT,
+ *       and false otherwise.
  *
  * After calling, 
  *   (1) the contents of uio_iov and uio_iovcnt may be altered and
  *       should not be interpreted;
  *   (2) uio_offset will have been incremented by the amount transferred;
  *   (3) uio_resid will have been decremented by the amount transferred;
- *   (4) uio_segflg, uio_rw, and uio_space will be unchanged.
+ *   (4) uio_segflg, uio_rw, uio_space, and uio_direct will be unchanged.
  *
  * uiomove() may be called repeatedly on the same uio to transfer
  * additional data until the available buffer space the uio refers to
@@ -99,6 +102,22 @@ struct uio {
  */
 int uiomove(void *kbuffer, size_t len, struct uio *uio);
 
+/*
+ * uiomove for a uio whose buffers are in the kernel (UIO_SYSSPACE),
+ * which it must be: straight memcpys with no checks on the way, which
+ * cannot fail. uiomove uses it for such uios itself; callers that only
+ * ever see them can call it directly. The buffers must not overlap.
+ */
+void uiomove_kernel(void *kbuffer, size_t len, struct uio *uio);
+
+/*
+ * uiomove for kernel data in KIOVCNT pieces, KIOV, gathered into the
+ * uio (UIO_READ) or scattered from it (UIO_WRITE) in order, as far as
+ * uio_resid goes, in one call: for instance both halves of a ring that
+ * wraps around. KIOV itself is not changed.
+ */
+int uiomove_iov(const struct iovec *kiov, unsigned kiovcnt, struct uio *uio);
+
 /*
  * Like uiomove, but sends zeros.
  */
@@ -0,0 +1,60 @@
+#ifndef _UPCALL_H_
+#define _UPCALL_H_
+
+/*
+ * Telling a user-level thread scheduler when its workers block.
+ *
+ * An M:N runtime (see <green.h> in userland) runs its lightweight
+ * threads on a few kernel threads, its workers. When one of them
+ * sleeps in the kernel, in a system call or a fault, its cpu would
+ * sit idle while other lightweight threads are ready, unless the
+ * runtime hears about it and puts another worker in its place.
+ *
+ * A thread says it is a worker with upcall_register(true), and that
+ * it is no longer one with upcall_register(false), as a worker the
+ * runtime parks for want of work should be. While it is one, each
+ * time it goes to sleep on a wait channel, and each time it comes back
+ * from one, the count of its process's workers asleep changes, and
+ * whoever is in upcall_wait for the process hears of it. upcall_wait
+ * sleeps while the count is still what the caller last saw, as
+ * futex_wait does with a word, so no change can be missed, and hands
+ * back the new count. Called by a thread that is not a worker (the
+ * runtime's one watcher), since a worker waiting there would count
+ * itself.
+ *
+ * The count is kept in the kernel, in a struct upcall per process made
+ * the first time either call is used; the hooks in wchan_sleep only
+ * take its spinlock, which comes after the spinlock of the wchan being
+ * slept on.
+ *
+ * Functions:
+ *     upcall_register - make the current thread a worker (ON) or not.
+ *                       ENOMEM if the process's struct upcall cannot
+ *                       be made.
+ *     upcall_wait     - as above. EINVAL if the caller is a worker,
+ *                       EINTR if the process is being ended, ENOMEM as
+ *                       for upcall_register.
+ *     upcall_sleeping - from wchan_sleep: a worker using U is going to
+ *                       sleep (ASLEEP) or has woken up again.
+ *     upcall_wakeexit - the process is being ended; send whoever is in
+ *                       upcall_wait back with EINTR.
+ *     upcall_destroy  - free U, along with the process.
+ */
+
+#include <spinlock.h>
+
+struct proc;
+
+struct upcall {
+	struct spinlock u_lock;
+	struct wchan *u_wchan;		/* the watcher sleeps here */
+	unsigned u_blocked;		/* workers asleep now */
+};
+
+int upcall_register(bool on);
+int upcall_wait(unsigned blocked, unsigned *ret);
+void upcall_sleeping(struct upcall *u, bool asleep);
+void upcall_wakeexit(struct proc *p);
+void upcall_destroy(struct upcall *u);
+
+#endif /* _UPCALL_H_ */
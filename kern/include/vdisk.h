@@ -0,0 +1,39 @@
+#ifndef _VDISK_H_
+#define _VDISK_H_
+
+/*
+ * Virtual disks made of several real ones.
+ *
+ * A vdisk is a mountable device, like lhd0, whose blocks are kept on
+ * other disks (its members), which are claimed for it (vfs_claimdev)
+ * and so can no longer be mounted themselves. It holds them:
+ *     VDISK_STRIPE - in turn, VD_UNIT blocks on each (RAID-0): block B
+ *                    is in chunk B / unit, on member chunk % n. The
+ *                    size is the smallest member's times the number.
+ *     VDISK_MIRROR - all on each (RAID-1). Writes go to every member;
+ *                    reads of consecutive chunks are spread over them,
+ *                    and one that fails is tried on the others. The
+ *                    size is the smallest member's.
+ * The pieces of one transfer that fall on different members are done
+ * at once, each in its own member's queue.
+ *
+ * The members must take bios (d_strategy) and have the same block
+ * size. A vdisk itself is reached only through d_io, and cannot be
+ * taken apart again.
+ *
+ * Functions:
+ *     vdisk_create - make the vdisk NAME of mode MODE, with stripe or
+ *                    spread unit UNIT (0 for VDISK_DEFUNIT), from the
+ *                    NDISKS mountable devices named in DISKNAMES.
+ */
+
+#define VDISK_STRIPE	0
+#define VDISK_MIRROR	1
+
+#define VDISK_MAXDISKS	8	/* members of one vdisk */
+#define VDISK_DEFUNIT	8	/* blocks */
+
+int vdisk_create(const char *name, int mode, uint32_t unit,
+		 unsigned ndisks, char **disknames);
+
+#endif /* _VDISK_H_ */
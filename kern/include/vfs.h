@@ -56,7 +56,10 @@ struct vnode;  /* abstract structure for an on-disk file (vnode.h) */
  *    vfs_getcurdir - retrieve vnode of current directory of current thread
  *    vfs_sync      - force all dirty buffers to disk
  *    vfs_getroot   - get root vnode for the filesystem named DEVNAME
- *    vfs_getdevname - get mounted device name for the filesystem passed in
+ *    vfs_getcachedroot - the same, without the biglock, if DEVNAME is a
+ *                    device name whose root is at hand; false if not
+ *    vfs_getdevname - get mounted device name for the filesystem passed in;
+ *                     takes no lock
  */
 
 int vfs_setcurdir(struct vnode *dir);
@@ -64,6 +67,7 @@ int vfs_clearcurdir(void);
 int vfs_getcurdir(struct vnode **retdir);
 int vfs_sync(void);
 int vfs_getroot(const char *devname, struct vnode **result);
+bool vfs_getcachedroot(const char *devname, struct vnode **result);
 const char *vfs_getdevname(struct fs *fs);
 
 /*
@@ -73,19 +77,55 @@ const char *vfs_getdevname(struct fs *fs);
  *                     or a name relative to the current directory, and
  *                     goes to the correct filesystem.
  *    vfs_lookparent - Likewise, for VOP_LOOKPARENT.
+ *    vfs_lookupat, vfs_lookparentat
+ *                   - The same, but relative names start at DIR, if not
+ *                     NULL, instead of the current directory.
  *
- * Both of these may destroy the path passed in.
+ * All of these may destroy the path passed in.
  */
 
 int vfs_lookup(char *path, struct vnode **result);
 int vfs_lookparent(char *path, struct vnode **result,
 		   char *buf, size_t buflen);
+int vfs_lookupat(struct vnode *dir, char *path, struct vnode **result);
+int vfs_lookparentat(struct vnode *dir, char *path, struct vnode **result,
+		     char *buf, size_t buflen);
+
+/*
+ * Name lookup cache (vfscache.c), used by vfs_lookupat.
+ *
+ *    vfs_namehash   - Hash NAME, for the cache and the device list,
+ *                     and hand back its length, in the one pass.
+ *    vfs_nclookup   - If the answer to looking up NAME, whose hash is
+ *                     HASH, from DIR is cached, hand back the vnode,
+ *                     with a reference, or NULL if there is no such
+ *                     file, and return true.
+ *    vfs_ncgen      - The current generation; take it before a lookup
+ *                     whose answer might be entered.
+ *    vfs_ncenter    - Remember the answer (VN, or NULL for ENOENT) to
+ *                     looking up NAME (hash HASH) from DIR, unless a
+ *                     purge has been since GEN.
+ *    vfs_ncpurge    - Forget what may no longer hold now that NAME in
+ *                     DIR has been created, removed, or renamed.
+ *    vfs_ncpurgefs  - Forget everything on FS, before it is unmounted.
+ */
+
+void vfs_ncbootstrap(void);
+unsigned vfs_namehash(const char *name, size_t *lenret);
+bool vfs_nclookup(struct vnode *dir, const char *name, unsigned hash,
+		  struct vnode **ret);
+unsigned vfs_ncgen(void);
+void vfs_ncenter(struct vnode *dir, const char *name, unsigned hash,
+		 struct vnode *vn, unsigned gen);
+void vfs_ncpurge(struct vnode *dir, const char *name);
+void vfs_ncpurgefs(struct fs *fs);
 
 /*
  * VFS layer high-level operations on pathnames
  * Because namei may destroy pathnames, these all may too.
  *
  *    vfs_open         - Open or create a file. FLAGS/MODE per the syscall. 
+ *    vfs_openat       - The same, relative to DIR as vfs_lookupat.
  *    vfs_readlink     - Read contents of a symlink into a uio.
  *    vfs_symlink      - Create a symlink PATH containing contents CONTENTS.
  *    vfs_mkdir        - Create a directory. MODE per the syscall.
@@ -102,6 +142,8 @@ int vfs_lookparent(char *path, struct vnode **result,
  */
 
 int vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret);
+int vfs_openat(struct vnode *dir, char *path, int openflags, mode_t mode,
+	       struct vnode **ret);
 void vfs_close(struct vnode *vn);
 int vfs_readlink(char *path, struct uio *data);
 int vfs_symlink(const char *contents, char *path);
@@ -118,7 +160,8 @@ int vfs_getcwd(struct uio *buf);
  * Misc
  *
  *    vfs_bootstrap - Call during system initialization to allocate 
- *                    structures.
+ *                    structures, including the name cache's
+ *                    (vfs_ncbootstrap).
  *
  *    vfs_setbootfs - Set the filesystem that paths beginning with a
  *                    slash are sent to. If not set, these paths fail
@@ -153,10 +196,22 @@ int vfs_getcwd(struct uio *buf);
  *                    MOUNTFUNC, which should create a struct fs and
  *                    return it in RESULT.
  *
+ *    vfs_mountlazy - Like vfs_mount, but put off until the device
+ *                    name is first looked up. If mounting then
+ *                    fails, the lookup fails with the error, and
+ *                    the device is left unmounted.
+ *
  *    vfs_unmount   - Unmount the filesystem presently mounted on the
  *                    specified device.
  *
  *    vfs_unmountall - Unmount all mounted filesystems.
+ *
+ *    vfs_claimdev  - Hand back the mountable device DEVNAME, and mark it
+ *                    as in use by another device (such as a vdisk), so
+ *                    that it cannot be mounted. EBUSY if it is mounted
+ *                    or already claimed.
+ *
+ *    vfs_releasedev - Undo vfs_claimdev on DEVNAME.
  */
 
 void vfs_bootstrap(void);
@@ -171,8 +226,14 @@ int vfs_mount(const char *devname, void *data,
 	      int (*mountfunc)(void *data,
 			       struct device *dev, 
 			       struct fs **result));
+int vfs_mountlazy(const char *devname, void *data,
+		  int (*mountfunc)(void *data,
+				   struct device *dev,
+				   struct fs **result));
 int vfs_unmount(const char *devname);
 int vfs_unmountall(void);
+int vfs_claimdev(const char *devname, struct device **ret);
+void vfs_releasedev(const char *devname);
 
 /*
  * Array of vnodes.
@@ -185,8 +246,15 @@ DECLARRAY(vnode);
 DEFARRAY(vnode, VFSINLINE);
 
 /*
- * Global one-big-lock for all filesystem operations.
- * You must remove this for the filesystem assignment.
+ * Global lock for the VFS layer's own tables: the list of known
+ * devices and what is mounted on them, and the boot filesystem. It
+ * is recursive. File operations do not take it; each filesystem
+ * locks itself (see sfs.h for SFS's locks). A filesystem may be
+ * entered with vfs_biglock held, by mount, unmount, sync and the
+ * boot-time chdir, so vfs_biglock comes before any filesystem lock.
+ * Looking up names that begin with a slash, and vfs_getdevname, do not
+ * take it either: they read the bootfs and device list under
+ * rcu_read_lock (see rcu.h), and changes wait for them.
  */
 void vfs_biglock_acquire(void);
 void vfs_biglock_release(void);
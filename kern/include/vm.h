@@ -39,6 +39,8 @@
 
 #include <machine/vm.h>
 
+struct addrspace;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
@@ -55,9 +57,29 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
+/* Extend a run from alloc_kpages to NPAGES in place, if possible */
+bool grow_kpages(vaddr_t addr, int npages);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Remove any TLB mapping of the N pages VADDRS (or of the one page
+ * VADDR) in address space AS, on every CPU that may hold one, waiting
+ * until all of them are done. The page table must already have been
+ * changed. May sleep.
+ */
+void vm_tlbshootdown_pages(struct addrspace *as, const vaddr_t *vaddrs,
+			   unsigned n);
+void vm_tlbshootdown_page(struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * Forget every TLB mapping loaded for address space AS, on every CPU.
+ * Used when many of its mappings change at once, and before it is
+ * destroyed.
+ */
+void vm_tlbshootdown_as(struct addrspace *as);
+
 
 #endif /* _VM_H_ */
@@ -30,6 +30,7 @@
 #ifndef _VNODE_H_
 #define _VNODE_H_
 
+#include "opt-perf.h"
 
 struct uio;
 struct stat;
@@ -50,10 +51,23 @@ struct stat;
  * vn_opencount is managed using VOP_INCOPEN and VOP_DECOPEN by
  * vfs_open() and vfs_close(). Code above the VFS layer should not
  * need to worry about it.
+ *
+ * Both counts are changed with atomic operations, so taking and
+ * dropping references needs no lock. When the refcount would drop to
+ * zero, vnode_decref hands its reference to VOP_RECLAIM instead; the
+ * filesystem must check again with vnode_lastref, under whatever lock
+ * it uses to find vnodes, that nobody has picked the vnode back up,
+ * and if someone has, return EBUSY (vnode_lastref has then dropped
+ * the reference).
+ *
+ * vn_cachedpages belongs to the page cache (see pagecache.h), and
+ * vn_execcached to the exec cache (see execcache.h).
  */
 struct vnode {
-	int vn_refcount;                /* Reference count */
-	int vn_opencount;
+	volatile unsigned vn_refcount;  /* Reference count */
+	volatile unsigned vn_opencount;
+	unsigned vn_cachedpages;        /* Pages in the page cache */
+	bool vn_execcached;             /* Has an exec cache template */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -120,6 +134,13 @@ struct vnode {
  *                      DATA. The interpretation of the data is specific
  *                      to each ioctl.
  *
+ *    vop_poll        - Return which of the poll events EVENTS (see
+ *                      kern/poll.h) are ready on the object now. If
+ *                      POLLER is not NULL, first register it, with
+ *                      poller_register, on whatever wakes it when those
+ *                      events may become ready. Objects that never
+ *                      block can use vnode_pollready.
+ *
  *    vop_stat        - Return info about a file. The pointer is a 
  *                      pointer to struct stat; see kern/stat.h.
  *
@@ -133,11 +154,15 @@ struct vnode {
  *                      as well.)
  *
  *    vop_fsync       - Force any dirty buffers associated with this file
- *                      to stable storage.
+ *                      to stable storage. If DATASYNC is set, only
+ *                      the data and what is needed to read it back
+ *                      (its size, and where its blocks are) need be;
+ *                      other changes to the file's metadata may wait.
  *
- *    vop_mmap        - Map file into memory. If you implement this
- *                      feature, you're responsible for choosing the
- *                      arguments for this operation.
+ *    vop_mmap        - Check that the object may be mapped into
+ *                      memory, and written back to if WRITEABLE is
+ *                      set. The VM system then pages it in and out
+ *                      with VOP_READ and VOP_WRITE.
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
@@ -190,6 +215,8 @@ struct vnode {
  *                      vnode handed back.
  */
 
+struct poller;
+
 #define VOP_MAGIC	0xa2b3c4d5
 
 struct vnode_ops {
@@ -205,11 +232,13 @@ struct vnode_ops {
 	int (*vop_getdirentry)(struct vnode *dir, struct uio *uio);
 	int (*vop_write)(struct vnode *file, struct uio *uio);
 	int (*vop_ioctl)(struct vnode *object, int op, userptr_t data);
+	int (*vop_poll)(struct vnode *object, int events,
+			struct poller *poller);
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
 	int (*vop_gettype)(struct vnode *object, mode_t *result);
 	int (*vop_tryseek)(struct vnode *object, off_t pos);
-	int (*vop_fsync)(struct vnode *object);
-	int (*vop_mmap)(struct vnode *file /* add stuff */);
+	int (*vop_fsync)(struct vnode *object, bool datasync);
+	int (*vop_mmap)(struct vnode *file, bool writeable);
 	int (*vop_truncate)(struct vnode *file, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
 
@@ -239,7 +268,12 @@ struct vnode_ops {
 			      char *buf, size_t len);
 };
 
+/* Performance builds call through without vnode_check. */
+#if OPT_PERF
+#define __VOP(vn, sym) ((vn)->vn_ops->vop_##sym)
+#else
 #define __VOP(vn, sym) (vnode_check(vn, #sym), (vn)->vn_ops->vop_##sym)
+#endif
 
 #define VOP_OPEN(vn, flags)             (__VOP(vn, open)(vn, flags))
 #define VOP_CLOSE(vn)                   (__VOP(vn, close)(vn))
@@ -250,11 +284,12 @@ struct vnode_ops {
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
 #define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
+#define VOP_POLL(vn, events, pl)        (__VOP(vn, poll)(vn, events, pl))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_TRYSEEK(vn, pos)            (__VOP(vn, tryseek)(vn, pos))
-#define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
-#define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
+#define VOP_FSYNC(vn, ds)               (__VOP(vn, fsync)(vn, ds))
+#define VOP_MMAP(vn, writeable)         (__VOP(vn, mmap)(vn, writeable))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
@@ -283,6 +318,12 @@ void vnode_decref(struct vnode *);
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
 
+/*
+ * For VOP_RECLAIM (intended for use by filesystem code): true if the
+ * reference it was handed is the only one; if not, drops it.
+ */
+bool vnode_lastref(struct vnode *);
+
 /*
  * Open count manipulation (handled above filesystem level)
  *
@@ -295,6 +336,12 @@ void vnode_decopen(struct vnode *);
 #define VOP_INCOPEN(vn) 		vnode_incopen(vn)
 #define VOP_DECOPEN(vn) 		vnode_decopen(vn)
 
+/*
+ * vop_poll for objects that never block (intended for use by
+ * filesystem code): reading and writing are always ready.
+ */
+int vnode_pollready(struct vnode *v, int events, struct poller *poller);
+
 /*
  * Vnode initialization (intended for use by filesystem code)
  * The reference count is initialized to 1.
@@ -73,13 +73,21 @@ void wchan_sleep(struct wchan *wc);
 
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
- * The queue should not already be locked.
+ * The queue should not already be locked. wchan_wakeone returns the
+ * thread it woke, or NULL if there was none.
  *
  * The current implementation is FIFO but this is not promised by the
  * interface.
  */
-void wchan_wakeone(struct wchan *wc);
+struct thread;
+struct thread *wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Wake up thread T if it is sleeping on the wait channel, and do
+ * nothing if it is not. The queue should not already be locked.
+ */
+void wchan_wakethread(struct wchan *wc, struct thread *t);
+
 
 #endif /* _WCHAN_H_ */
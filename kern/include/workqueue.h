@@ -0,0 +1,32 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Work queues: deferring work out of interrupt handlers.
+ *
+ * Each cpu has a queue of up to WORKQUEUE_SIZE pending calls, served
+ * by a kernel thread bound to that cpu, so an interrupt handler can
+ * leave the expensive part of its job (anything that might sleep, or
+ * that is cheaper done for several interrupts at once) to run later in
+ * thread context on the same cpu, in the order it was queued. The queue
+ * is a fixed ring, so enqueueing never allocates and is safe anywhere.
+ *
+ * Work queued before workqueue_bootstrap waits until the workers start.
+ *
+ * Functions:
+ *     workqueue_bootstrap - start a worker on each cpu. Call once all
+ *                           cpus are up.
+ *     workqueue_enqueue   - arrange for FUNC(ARG) to be called by this
+ *                           cpu's worker. Returns ENOSPC if the queue
+ *                           is full, in which case the caller must do
+ *                           the work itself.
+ *     workqueue_printstats - print each queue's counts.
+ */
+
+#define WORKQUEUE_SIZE 32
+
+void workqueue_bootstrap(void);
+int workqueue_enqueue(void (*func)(void *arg), void *arg);
+void workqueue_printstats(void);
+
+#endif /* _WORKQUEUE_H_ */
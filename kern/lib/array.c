@@ -76,7 +76,7 @@ array_cleanup(struct array *a)
 }
 
 int
-array_setsize(struct array *a, unsigned num)
+array_preallocate(struct array *a, unsigned num)
 {
 	void **newptr;
 	unsigned newmax;
@@ -89,20 +89,31 @@ array_setsize(struct array *a, unsigned num)
 		}
 
 		/*
-		 * We don't have krealloc, and it wouldn't be
-		 * worthwhile to implement just for this. So just
-		 * allocate a new block and copy. (Exercise: what
-		 * about this and/or kmalloc makes it not worthwhile?)
+		 * krealloc copies only if it cannot grow the block
+		 * where it is. Use all of what we get, so growing
+		 * into the rest of a bucket or page costs nothing.
 		 */
 
-		newptr = kmalloc(newmax*sizeof(*a->v));
+		newptr = krealloc(a->v, newmax*sizeof(*a->v));
 		if (newptr == NULL) {
 			return ENOMEM;
 		}
-		memcpy(newptr, a->v, a->num*sizeof(*a->v));
-		kfree(a->v);
 		a->v = newptr;
-		a->max = newmax;
+		a->max = ksize(newptr) / sizeof(*a->v);
+		ARRAYASSERT(a->max >= newmax);
+	}
+
+	return 0;
+}
+
+int
+array_setsize(struct array *a, unsigned num)
+{
+	int ret;
+
+	ret = array_preallocate(a, num);
+	if (ret) {
+		return ret;
 	}
 	a->num = num;
 
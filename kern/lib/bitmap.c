@@ -47,11 +47,33 @@
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+/*
+ * Every word before hint is known to be full, so first-fit searches
+ * start there rather than at word 0; allocating moves it up past the
+ * words found full, and clearing a bit pulls it back down. Setting
+ * bits through bitmap_getdata (loading a map from disk) leaves it a
+ * correct lower bound; clearing them that way would not.
+ */
 struct bitmap {
         unsigned nbits;
+        unsigned hint;
         WORD_TYPE *v;
 };
 
+/*
+ * The lowest clear bit of a word that is not full: ~w & (w+1) has only
+ * that bit set, and counting the zeros below it is one instruction on
+ * most machines.
+ */
+static
+inline
+unsigned
+bitmap_ffz(WORD_TYPE w)
+{
+        KASSERT(w != WORD_ALLBITS);
+        return __builtin_ctz((unsigned)(WORD_TYPE)(~w & (w+1)));
+}
+
 
 struct bitmap *
 bitmap_create(unsigned nbits)
@@ -72,6 +94,7 @@ bitmap_create(unsigned nbits)
 
         bzero(b->v, words*sizeof(WORD_TYPE));
         b->nbits = nbits;
+        b->hint = 0;
 
         /* Mark any leftover bits at the end in use */
         if (words > nbits / BITS_PER_WORD) {
@@ -102,22 +125,144 @@ bitmap_alloc(struct bitmap *b, unsigned *index)
         unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
         unsigned offset;
 
-        for (ix=0; ix<maxix; ix++) {
+        for (ix=b->hint; ix<maxix; ix++) {
                 if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
+                        offset = bitmap_ffz(b->v[ix]);
+                        b->v[ix] |= ((WORD_TYPE)1) << offset;
+                        b->hint = ix;
+                        *index = (ix*BITS_PER_WORD)+offset;
+                        KASSERT(*index < b->nbits);
+                        return 0;
+                }
+        }
+        b->hint = maxix;
+        return ENOSPC;
+}
+
+/*
+ * Like bitmap_alloc, but for growing something contiguous: take GOAL
+ * if it is clear, or the next clear bit in the same word; failing
+ * that, the first of a wholly clear word, so that there is room to go
+ * on, at or after GOAL (wrapping around to the beginning); failing
+ * that, any clear bit, again looking from GOAL on.
+ */
+int
+bitmap_alloc_near(struct bitmap *b, unsigned goal, unsigned *index)
+{
+        return bitmap_alloc_range(b, 0, b->nbits, goal, index);
+}
+
+/*
+ * bitmap_alloc_near, looking only at bits LO through HI-1 and wrapping
+ * around within them. LO must start a word, and HI must too unless it
+ * is the end of the map, so no word is partly outside.
+ */
+int
+bitmap_alloc_range(struct bitmap *b, unsigned lo, unsigned hi,
+                   unsigned goal, unsigned *index)
+{
+        unsigned loix, nix, gix, ix, i, offset;
+        WORD_TYPE w;
+
+        KASSERT(lo < hi && hi <= b->nbits);
+        KASSERT(lo % BITS_PER_WORD == 0);
+        KASSERT(hi % BITS_PER_WORD == 0 || hi == b->nbits);
+
+        loix = lo / BITS_PER_WORD;
+        nix = DIVROUNDUP(hi, BITS_PER_WORD) - loix;
+        if (goal < lo || goal >= hi) {
+                goal = lo;
+        }
+        gix = goal / BITS_PER_WORD;
+
+        /* the goal itself, or just after it (bits below it count as set) */
+        w = b->v[gix] | (((WORD_TYPE)1 << (goal % BITS_PER_WORD)) - 1);
+        if (w != WORD_ALLBITS) {
+                offset = bitmap_ffz(w);
+                goto found;
+        }
+
+        /* the start of a free run */
+        for (i=1; i<=nix; i++) {
+                ix = loix + (gix - loix + i) % nix;
+                if (b->v[ix] == 0) {
+                        gix = ix;
+                        offset = 0;
+                        goto found;
+                }
+        }
+
+        /* anything at all */
+        for (i=1; i<=nix; i++) {
+                ix = loix + (gix - loix + i) % nix;
+                if (b->v[ix] != WORD_ALLBITS) {
+                        gix = ix;
+                        offset = bitmap_ffz(b->v[ix]);
+                        goto found;
+                }
+        }
+        return ENOSPC;
+
+ found:
+        b->v[gix] |= (WORD_TYPE)1 << offset;
+        *index = (gix*BITS_PER_WORD)+offset;
+        KASSERT(*index >= lo && *index < hi);
+        return 0;
+}
+
+/*
+ * Find the first run of N clear bits, set them all, and return the
+ * index of the first. Whole words are stepped over at a time when
+ * they are full or empty.
+ */
+int
+bitmap_alloc_run(struct bitmap *b, unsigned n, unsigned *index)
+{
+        unsigned i, start, len;
+        WORD_TYPE w;
+
+        KASSERT(n > 0);
+
+        start = len = 0;
+        i = b->hint * BITS_PER_WORD;
+        while (i < b->nbits && len < n) {
+                w = b->v[i / BITS_PER_WORD];
+                if (i % BITS_PER_WORD == 0 &&
+                    (w == 0 || w == WORD_ALLBITS)) {
+                        if (w == WORD_ALLBITS) {
+                                len = 0;
+                        }
+                        else {
+                                if (len == 0) {
+                                        start = i;
                                 }
+                                len += BITS_PER_WORD;
+                        }
+                        i += BITS_PER_WORD;
+                        continue;
+                }
+                if (w & ((WORD_TYPE)1 << (i % BITS_PER_WORD))) {
+                        len = 0;
+                }
+                else {
+                        if (len == 0) {
+                                start = i;
                         }
-                        KASSERT(0);
+                        len++;
                 }
+                i++;
         }
-        return ENOSPC;
+        if (len < n) {
+                return ENOSPC;
+        }
+
+        /* (the bits past nbits are set, so an empty word is all real) */
+        for (i=start; i<start+n; i++) {
+                b->v[i / BITS_PER_WORD] |= (WORD_TYPE)1 << (i % BITS_PER_WORD);
+        }
+        *index = start;
+        KASSERT(start + n <= b->nbits);
+        return 0;
 }
 
 static
@@ -155,8 +300,62 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+        if (ix < b->hint) {
+                b->hint = ix;
+        }
+}
+
+/*
+ * Set (if SET) or clear the N bits from INDEX, each of which must be
+ * the other way: whole words at once, and the odd bits at either end
+ * one by one.
+ */
+static
+void
+bitmap_setrun(struct bitmap *b, unsigned index, unsigned n, bool set)
+{
+        unsigned i, ix;
+        WORD_TYPE mask;
+
+        KASSERT(index <= b->nbits && n <= b->nbits - index);
+
+        i = index;
+        while (i < index + n) {
+                ix = i / BITS_PER_WORD;
+                if (i % BITS_PER_WORD == 0 &&
+                    index + n - i >= BITS_PER_WORD) {
+                        mask = WORD_ALLBITS;
+                        i += BITS_PER_WORD;
+                }
+                else {
+                        mask = (WORD_TYPE)1 << (i % BITS_PER_WORD);
+                        i++;
+                }
+                if (set) {
+                        KASSERT((b->v[ix] & mask)==0);
+                        b->v[ix] |= mask;
+                }
+                else {
+                        KASSERT((b->v[ix] & mask)==mask);
+                        b->v[ix] &= ~mask;
+                }
+        }
+}
+
+void
+bitmap_mark_run(struct bitmap *b, unsigned index, unsigned n)
+{
+        bitmap_setrun(b, index, n, true);
 }
 
+void
+bitmap_unmark_run(struct bitmap *b, unsigned index, unsigned n)
+{
+        bitmap_setrun(b, index, n, false);
+        if (n > 0 && index / BITS_PER_WORD < b->hint) {
+                b->hint = index / BITS_PER_WORD;
+        }
+}
 
 int
 bitmap_isset(struct bitmap *b, unsigned index) 
@@ -36,13 +36,17 @@
 #include <current.h>
 #include <synch.h>
 #include <mainbus.h>
+#include <clock.h>
+#include <cpu.h>
+#include <atomic.h>
+#include <platform/maxcpus.h>
 #include <vfs.h>          // for vfs_sync()
 
 
-/* Flags word for DEBUG() macro. */
-uint32_t dbflags = 0;
+/* Flags word for DEBUG() macro; read on hot paths, so kept apart. */
+uint32_t dbflags __ALIGNED(CACHELINE_SIZE) = 0;
 
-/* Lock for non-polled kprintfs */
+/* Lock for non-polled kprintfs, and for draining the log */
 static struct lock *kprintf_lock;
 
 /* Lock for polled kprintfs */
@@ -54,6 +58,66 @@ static struct spinlock kprintf_spinlock;
  * interrupts are disabled.
  */
 
+/*
+ * The kernel log.
+ *
+ * Once klog_bootstrap has run, kprintf does not print: it formats,
+ * with interrupts off, into a buffer of this cpu's, and copies what
+ * it made as a record into this cpu's ring, and the klog thread
+ * prints the records later. Nothing is shared between cpus but the
+ * sequence number each record takes, so a kprintf costs the same from
+ * any cpu however slow the console is or however many others log; the
+ * thread puts the records of all the rings back in sequence order.
+ * A record that does not fit is dropped, and the drops are reported.
+ *
+ * A ring is written only by its own cpu (at kc_head) and read only by
+ * the drainer (at kc_tail), holding kprintf_lock, so it needs no lock
+ * either; each side moves its own end only once the bytes are copied.
+ *
+ * A kprintf made where it is safe to wake a thread (not in an
+ * interrupt, no spinlocks held) wakes the klog thread. Others, which
+ * might hold the very locks the wakeup needs, only leave a note for
+ * the next hardclock to deliver (klog_tick); the thread also looks
+ * every KLOG_IDLETICKS in case no clock is running.
+ *
+ * Printing is synchronous, as it always was, before klog_bootstrap,
+ * from klog_stop on (shutdown), and in a panic, which first prints
+ * whatever the rings hold.
+ */
+#define KLOG_RINGSIZE	16384	/* bytes of records per cpu; a power of 2 */
+#define KLOG_LINEMAX	256	/* most bytes one record holds */
+#define KLOG_HISTSIZE	16384	/* bytes of printed log kept for dmesg */
+#define KLOG_IDLETICKS	HZ
+#define KLOG_SPINS	100000	/* how long to wait for a record mid-copy */
+
+struct klog_rec {
+	uint32_t kr_seq;
+	uint32_t kr_len;
+	/* followed by kr_len bytes, padded to a multiple of 4 */
+};
+
+struct klog_cpu {
+	char *kc_ring;			/* KLOG_RINGSIZE bytes */
+	volatile unsigned kc_head;	/* bytes ever written; this cpu */
+	volatile unsigned kc_tail;	/* bytes ever drained; the drainer */
+	unsigned kc_dropped;		/* records lost; this cpu */
+	unsigned kc_reported;		/* ... and told of; the drainer */
+	unsigned kc_linelen;
+	char kc_line[KLOG_LINEMAX];	/* the record being formatted */
+};
+
+static struct klog_cpu *klog_cpus[MAXCPUS];
+static volatile bool klog_async;	/* kprintf logs to the rings */
+static volatile unsigned klog_seq __ALIGNED(CACHELINE_SIZE);
+					/* the next record's number */
+static unsigned klog_nextseq;		/* the next to print */
+static struct semaphore *klog_sem;
+static volatile bool klog_waiting;	/* the klog thread is asleep */
+static volatile bool klog_kicked;	/* ... and should not be */
+
+/* What has been printed, for dmesg; under kprintf_lock. */
+static char klog_hist[KLOG_HISTSIZE];
+static unsigned klog_histlen;		/* bytes ever */
 
 /*
  * Create the kprintf lock. Must be called before creating a second
@@ -88,13 +152,13 @@ console_send(void *junk, const char *data, size_t len)
 }
 
 /*
- * Printf to the console.
+ * Printf straight to the console.
  */
+static
 int
-kprintf(const char *fmt, ...)
+console_vprintf(const char *fmt, va_list ap)
 {
 	int chars;
-	va_list ap;
 	bool dolock;
 
 	dolock = kprintf_lock != NULL
@@ -109,9 +173,7 @@ kprintf(const char *fmt, ...)
 	}
 	putch_prepare();
 
-	va_start(ap, fmt);
 	chars = __vprintf(console_send, NULL, fmt, ap);
-	va_end(ap);
 
 	putch_complete();
 	if (dolock) {
@@ -124,6 +186,411 @@ kprintf(const char *fmt, ...)
 	return chars;
 }
 
+/*
+ * Copy LEN bytes between BUF and KC's ring at byte POS (ever).
+ */
+static
+void
+klog_put(struct klog_cpu *kc, unsigned pos, const void *buf, size_t len)
+{
+	const char *src = buf;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		kc->kc_ring[(pos + i) & (KLOG_RINGSIZE - 1)] = src[i];
+	}
+}
+
+static
+void
+klog_get(struct klog_cpu *kc, unsigned pos, void *buf, size_t len)
+{
+	char *dst = buf;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		dst[i] = kc->kc_ring[(pos + i) & (KLOG_RINGSIZE - 1)];
+	}
+}
+
+/*
+ * Move what KC has formatted into its ring as a record. Interrupts
+ * are off.
+ */
+static
+void
+klog_commit(struct klog_cpu *kc)
+{
+	struct klog_rec kr;
+	unsigned size;
+
+	if (kc->kc_linelen == 0) {
+		return;
+	}
+	size = sizeof(kr) + ROUNDUP(kc->kc_linelen, 4);
+	if (KLOG_RINGSIZE - (kc->kc_head - kc->kc_tail) < size) {
+		kc->kc_dropped++;
+	}
+	else {
+		kr.kr_seq = atomic_next(&klog_seq);
+		kr.kr_len = kc->kc_linelen;
+		klog_put(kc, kc->kc_head, &kr, sizeof(kr));
+		klog_put(kc, kc->kc_head + sizeof(kr), kc->kc_line, kr.kr_len);
+		membar_sync();
+		kc->kc_head += size;
+	}
+	kc->kc_linelen = 0;
+}
+
+/*
+ * Backend for __printf into a cpu's record.
+ */
+static
+void
+klog_send(void *kcv, const char *data, size_t len)
+{
+	struct klog_cpu *kc = kcv;
+	size_t n;
+
+	while (len > 0) {
+		n = KLOG_LINEMAX - kc->kc_linelen;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(kc->kc_line + kc->kc_linelen, data, n);
+		kc->kc_linelen += n;
+		data += n;
+		len -= n;
+		if (kc->kc_linelen == KLOG_LINEMAX) {
+			klog_commit(kc);
+		}
+	}
+}
+
+/*
+ * Wake the klog thread if it is asleep.
+ */
+static
+void
+klog_wake(void)
+{
+	if (klog_waiting) {
+		klog_waiting = false;
+		V(klog_sem);
+	}
+}
+
+void
+klog_tick(void)
+{
+	if (klog_kicked) {
+		klog_kicked = false;
+		klog_wake();
+	}
+}
+
+/*
+ * Print LEN bytes of the log, and keep them for dmesg.
+ */
+static
+void
+klog_out(const char *data, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		putch(data[i]);
+		klog_hist[klog_histlen++ % KLOG_HISTSIZE] = data[i];
+	}
+}
+
+/*
+ * Print every record in the rings, in sequence order. Called holding
+ * kprintf_lock, or in a panic with the other cpus stopped.
+ *
+ * The lowest-numbered record waiting may not be the next: that one
+ * can have its number and still be on its way into its ring on
+ * another cpu, which has interrupts off until it is done, so wait a
+ * little for it. (In a panic it may never come.)
+ */
+static
+void
+klog_drain(void)
+{
+	struct klog_cpu *kc, *best;
+	struct klog_rec kr, bestkr;
+	char buf[64];
+	unsigned i, n, spins = 0;
+
+	putch_prepare();
+	while (1) {
+		best = NULL;
+		for (i=0; i<cpu_count(); i++) {
+			kc = klog_cpus[i];
+			if (kc->kc_dropped != kc->kc_reported) {
+				snprintf(buf, sizeof(buf),
+					 "[klog: %u messages lost on cpu %u]\n",
+					 kc->kc_dropped - kc->kc_reported, i);
+				kc->kc_reported = kc->kc_dropped;
+				klog_out(buf, strlen(buf));
+			}
+			if (kc->kc_tail == kc->kc_head) {
+				continue;
+			}
+			membar_sync();
+			klog_get(kc, kc->kc_tail, &kr, sizeof(kr));
+			if (best == NULL || kr.kr_seq - klog_nextseq <
+			    bestkr.kr_seq - klog_nextseq) {
+				best = kc;
+				bestkr = kr;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		if (bestkr.kr_seq != klog_nextseq && ++spins < KLOG_SPINS) {
+			continue;
+		}
+		spins = 0;
+
+		for (i=0; i<bestkr.kr_len; i+=sizeof(buf)) {
+			n = bestkr.kr_len - i < sizeof(buf) ?
+				bestkr.kr_len - i : sizeof(buf);
+			klog_get(best, best->kc_tail + sizeof(kr) + i, buf, n);
+			klog_out(buf, n);
+		}
+		membar_sync();
+		best->kc_tail += sizeof(kr) + ROUNDUP(bestkr.kr_len, 4);
+		klog_nextseq = bestkr.kr_seq + 1;
+	}
+	putch_complete();
+}
+
+/*
+ * Whether any ring has records in it.
+ */
+static
+bool
+klog_pending(void)
+{
+	unsigned i;
+
+	for (i=0; i<cpu_count(); i++) {
+		if (klog_cpus[i]->kc_tail != klog_cpus[i]->kc_head) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * The klog thread.
+ */
+static
+void
+klog_thread(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	while (1) {
+		lock_acquire(kprintf_lock);
+		klog_drain();
+		lock_release(kprintf_lock);
+
+		/* (See klog_wake: one of us sees the other.) */
+		klog_waiting = true;
+		membar_sync();
+		if (!klog_pending()) {
+			P_timed(klog_sem, KLOG_IDLETICKS);
+		}
+		klog_waiting = false;
+	}
+}
+
+void
+klog_bootstrap(void)
+{
+	unsigned i;
+	int result;
+
+	KASSERT(kprintf_lock != NULL);
+
+	for (i=0; i<cpu_count(); i++) {
+		klog_cpus[i] = kmalloc_aligned(sizeof(struct klog_cpu),
+					       CACHELINE_SIZE);
+		if (klog_cpus[i] == NULL) {
+			panic("klog_bootstrap: Out of memory\n");
+		}
+		bzero(klog_cpus[i], sizeof(struct klog_cpu));
+		klog_cpus[i]->kc_ring = kmalloc(KLOG_RINGSIZE);
+		if (klog_cpus[i]->kc_ring == NULL) {
+			panic("klog_bootstrap: Out of memory\n");
+		}
+	}
+	klog_sem = sem_create("klog", 0);
+	if (klog_sem == NULL) {
+		panic("klog_bootstrap: Out of memory\n");
+	}
+
+	result = thread_fork("klog", NULL, klog_thread, NULL, 0);
+	if (result) {
+		panic("klog_bootstrap: thread_fork: %s\n", strerror(result));
+	}
+
+	membar_sync();
+	klog_async = true;
+}
+
+void
+klog_flush(void)
+{
+	if (klog_cpus[0] == NULL || curthread->t_in_interrupt ||
+	    curthread->t_iplhigh_count > 0) {
+		return;
+	}
+	lock_acquire(kprintf_lock);
+	klog_drain();
+	lock_release(kprintf_lock);
+}
+
+void
+klog_stop(void)
+{
+	klog_async = false;
+	membar_sync();
+	klog_flush();
+}
+
+void
+klog_dmesg(void)
+{
+	unsigned i, start;
+
+	if (klog_cpus[0] == NULL) {
+		return;
+	}
+	lock_acquire(kprintf_lock);
+	klog_drain();
+	start = klog_histlen > KLOG_HISTSIZE ? klog_histlen - KLOG_HISTSIZE : 0;
+	putch_prepare();
+	for (i=start; i<klog_histlen; i++) {
+		putch(klog_hist[i % KLOG_HISTSIZE]);
+	}
+	putch_complete();
+	lock_release(kprintf_lock);
+}
+
+/*
+ * Printf to the console, by way of the log once there is one.
+ */
+static
+int
+kvprintf(const char *fmt, va_list ap)
+{
+	struct klog_cpu *kc;
+	int chars, spl;
+
+	if (!klog_async) {
+		return console_vprintf(fmt, ap);
+	}
+
+	spl = splhigh();
+	kc = klog_cpus[curcpu->c_number];
+	chars = __vprintf(klog_send, kc, fmt, ap);
+	klog_commit(kc);
+	splx(spl);
+
+	if (curthread->t_in_interrupt == false &&
+	    curthread->t_iplhigh_count == 0) {
+		klog_wake();
+	}
+	else {
+		klog_kicked = true;
+	}
+
+	return chars;
+}
+
+int
+kprintf(const char *fmt, ...)
+{
+	int chars;
+	va_list ap;
+
+	va_start(ap, fmt);
+	chars = kvprintf(fmt, ap);
+	va_end(ap);
+	return chars;
+}
+
+/*
+ * DEBUG's rate limit: for each category, the second it last printed
+ * in, how many it has printed then, and how many it has held back.
+ */
+static const char *const debug_names[DB_NCATS] = {
+	"locore", "syscall", "interrupt", "device", "threads", "vm",
+	"exec", "vfs", "sfs", "net", "netfs", "kmalloc", "syncprob",
+};
+
+static struct spinlock debug_lock = SPINLOCK_INITIALIZER;
+static uint64_t debug_second[DB_NCATS];
+static unsigned debug_count[DB_NCATS];
+static unsigned debug_held[DB_NCATS];
+
+const char *
+debug_catname(unsigned bit)
+{
+	return bit < DB_NCATS ? debug_names[bit] : NULL;
+}
+
+/*
+ * Print a DEBUG message of category CAT (the lowest one, if several),
+ * unless it has used up its DEBUG_RATE for this second.
+ */
+int
+debug_printf(uint32_t cat, const char *fmt, ...)
+{
+	unsigned bit, held;
+	uint64_t second;
+	bool print;
+	va_list ap;
+	int chars;
+
+	for (bit = 0; bit < DB_NCATS - 1 && (cat & (1U << bit)) == 0; bit++);
+
+	second = clock_monotonic_ns() / 1000000000ULL;
+	spinlock_acquire(&debug_lock);
+	held = 0;
+	if (debug_second[bit] != second) {
+		debug_second[bit] = second;
+		debug_count[bit] = 0;
+		held = debug_held[bit];
+		debug_held[bit] = 0;
+	}
+	print = debug_count[bit] < DEBUG_RATE;
+	if (print) {
+		debug_count[bit]++;
+	}
+	else {
+		debug_held[bit]++;
+	}
+	spinlock_release(&debug_lock);
+
+	if (held > 0) {
+		kprintf("[debug: %u %s messages held back]\n", held,
+			debug_names[bit]);
+	}
+	if (!print) {
+		return 0;
+	}
+
+	va_start(ap, fmt);
+	chars = kvprintf(fmt, ap);
+	va_end(ap);
+	return chars;
+}
+
 /*
  * panic() is for fatal errors. It prints the printf arguments it's
  * passed and then halts the system.
@@ -164,6 +631,12 @@ panic(const char *fmt, ...)
 
 		/* Kill off other threads and halt other CPUs. */
 		thread_panic();
+
+		/* Print what was logged before, and what follows now. */
+		klog_async = false;
+		if (klog_cpus[0] != NULL) {
+			klog_drain();
+		}
 	}
 
 	if (evil == 2) {
@@ -0,0 +1,210 @@
+/*
+ * LZ compression. See lz.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <lz.h>
+
+/*
+ * Hash of the 4 bytes at P, read a byte at a time since P need not be
+ * aligned.
+ */
+static
+unsigned
+lz_hash(const uint8_t *p)
+{
+	uint32_t x;
+
+	x = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	return (x * 2654435761U) >> (32 - LZ_HASHBITS);
+}
+
+/*
+ * Write the extra bytes of a length whose token half is 15: LEN is
+ * what is left over past the 15. Returns NULL if out of room.
+ */
+static
+uint8_t *
+lz_putlen(uint8_t *op, uint8_t *oend, size_t len)
+{
+	while (len >= 255) {
+		if (op == oend) {
+			return NULL;
+		}
+		*op++ = 255;
+		len -= 255;
+	}
+	if (op == oend) {
+		return NULL;
+	}
+	*op++ = len;
+	return op;
+}
+
+/*
+ * Write a sequence: LITLEN bytes at LIT, then a match of MLEN bytes at
+ * OFFSET back, or no match if MLEN is 0. Returns where the next one
+ * goes, or NULL if out of room.
+ */
+static
+uint8_t *
+lz_emit(uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t litlen,
+	unsigned offset, size_t mlen)
+{
+	uint8_t *token;
+
+	if (op == oend) {
+		return NULL;
+	}
+	token = op++;
+	*token = (litlen < 15 ? litlen : 15) << 4;
+	if (litlen >= 15) {
+		op = lz_putlen(op, oend, litlen - 15);
+		if (op == NULL) {
+			return NULL;
+		}
+	}
+	if ((size_t)(oend - op) < litlen) {
+		return NULL;
+	}
+	memcpy(op, lit, litlen);
+	op += litlen;
+
+	if (mlen == 0) {
+		return op;
+	}
+	if (oend - op < 2) {
+		return NULL;
+	}
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	mlen -= LZ_MINMATCH;
+	*token |= mlen < 15 ? mlen : 15;
+	if (mlen >= 15) {
+		op = lz_putlen(op, oend, mlen - 15);
+	}
+	return op;
+}
+
+size_t
+lz_compress(const void *src, size_t srclen, void *dst, size_t dstmax,
+	    void *work)
+{
+	const uint8_t *in = src, *end = in + srclen;
+	const uint8_t *ip, *anchor, *ref;
+	uint8_t *op = dst, *oend = op + dstmax;
+	uint16_t *table = work;
+	size_t mlen;
+	unsigned h;
+
+	KASSERT(srclen <= LZ_MAXLEN);
+
+	/* Positions are kept plus one, so that 0 is an empty slot. */
+	bzero(table, LZ_WORKSIZE);
+
+	ip = anchor = in;
+	while (end - ip >= LZ_MINMATCH) {
+		h = lz_hash(ip);
+		ref = table[h] ? in + table[h] - 1 : NULL;
+		table[h] = ip - in + 1;
+		mlen = 0;
+		if (ref != NULL) {
+			while (ip + mlen < end && ref[mlen] == ip[mlen]) {
+				mlen++;
+			}
+		}
+		if (mlen < LZ_MINMATCH) {
+			ip++;
+			continue;
+		}
+		op = lz_emit(op, oend, anchor, ip - anchor, ip - ref, mlen);
+		if (op == NULL) {
+			return 0;
+		}
+		ip += mlen;
+		anchor = ip;
+	}
+
+	op = lz_emit(op, oend, anchor, end - anchor, 0, 0);
+	if (op == NULL) {
+		return 0;
+	}
+	return op - (uint8_t *)dst;
+}
+
+/*
+ * Add the extra bytes of a length to *LEN. EINVAL if they run off the
+ * end.
+ */
+static
+int
+lz_getlen(const uint8_t **ipp, const uint8_t *iend, size_t *len)
+{
+	uint8_t b;
+
+	do {
+		if (*ipp == iend) {
+			return EINVAL;
+		}
+		b = *(*ipp)++;
+		*len += b;
+	} while (b == 255);
+	return 0;
+}
+
+int
+lz_decompress(const void *src, size_t srclen, void *dst, size_t dstlen,
+	      size_t *ret)
+{
+	const uint8_t *ip = src, *iend = ip + srclen;
+	uint8_t *out = dst, *op = out, *oend = out + dstlen;
+	const uint8_t *ref;
+	unsigned token, offset;
+	size_t len;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		len = token >> 4;
+		if (len == 15 && lz_getlen(&ip, iend, &len)) {
+			return EINVAL;
+		}
+		if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len) {
+			return EINVAL;
+		}
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+		if (ip == iend) {
+			/* The last sequence has no match. */
+			break;
+		}
+
+		if (iend - ip < 2) {
+			return EINVAL;
+		}
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - out)) {
+			return EINVAL;
+		}
+		len = token & 15;
+		if (len == 15 && lz_getlen(&ip, iend, &len)) {
+			return EINVAL;
+		}
+		len += LZ_MINMATCH;
+		if ((size_t)(oend - op) < len) {
+			return EINVAL;
+		}
+		/* A byte at a time: the match may overlap what it makes. */
+		ref = op - offset;
+		while (len-- > 0) {
+			*op++ = *ref++;
+		}
+	}
+
+	*ret = op - out;
+	return 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * Lock-free rings. See ring.h.
+ *
+ * The multi-producer ring is Vyukov's bounded queue. Slot I starts
+ * with sequence number I. A producer whose tail position POS finds
+ * slot POS's number equal to POS may take it, by moving the tail from
+ * POS to POS+1; having filled it, it sets the number to POS+1, which
+ * is what a consumer at head position POS waits for. Having emptied
+ * it, the consumer sets it to POS+SIZE, ready for the producer on the
+ * next lap. A number behind the position means the ring is full (for
+ * a producer) or empty (for a consumer); one ahead means someone else
+ * got there first, so try again from the new tail or head. Positions
+ * wrap, so they are compared by their signed difference.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <atomic.h>
+#include <machine/vm.h>	/* for CACHELINE_SIZE */
+#include <ring.h>
+
+struct ringslot {
+	volatile unsigned rs_seq;
+	void *volatile rs_ptr;
+};
+
+struct ring {
+	unsigned r_mask;		/* size - 1; never changes */
+	struct ringslot *r_slots;
+	volatile unsigned r_tail __ALIGNED(CACHELINE_SIZE);
+	volatile unsigned r_head __ALIGNED(CACHELINE_SIZE);
+} __ALIGNED(CACHELINE_SIZE);
+
+struct spscring {
+	unsigned sr_mask;
+	void *volatile *sr_slots;
+	volatile unsigned sr_tail __ALIGNED(CACHELINE_SIZE); /* producer's */
+	volatile unsigned sr_head __ALIGNED(CACHELINE_SIZE); /* consumer's */
+} __ALIGNED(CACHELINE_SIZE);
+
+/*
+ * SIZE rounded up to a power of two, at least 2.
+ */
+static
+unsigned
+ring_roundsize(unsigned size)
+{
+	unsigned n = 2;
+
+	KASSERT(size <= 0x80000000U);
+	while (n < size) {
+		n *= 2;
+	}
+	return n;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Any number of producers and consumers
+
+struct ring *
+ring_create(unsigned size)
+{
+	struct ring *r;
+	unsigned i;
+
+	size = ring_roundsize(size);
+	r = kmalloc_aligned(sizeof(*r), CACHELINE_SIZE);
+	if (r == NULL) {
+		return NULL;
+	}
+	r->r_slots = kmalloc(size * sizeof(struct ringslot));
+	if (r->r_slots == NULL) {
+		kfree(r);
+		return NULL;
+	}
+	for (i=0; i<size; i++) {
+		r->r_slots[i].rs_seq = i;
+		r->r_slots[i].rs_ptr = NULL;
+	}
+	r->r_mask = size - 1;
+	r->r_tail = 0;
+	r->r_head = 0;
+	return r;
+}
+
+void
+ring_destroy(struct ring *r)
+{
+	KASSERT(r->r_head == r->r_tail);
+	kfree(r->r_slots);
+	kfree(r);
+}
+
+bool
+ring_put(struct ring *r, void *ptr)
+{
+	struct ringslot *s;
+	unsigned pos;
+	int diff;
+
+	KASSERT(ptr != NULL);
+
+	pos = r->r_tail;
+	while (1) {
+		s = &r->r_slots[pos & r->r_mask];
+		diff = (int)(s->rs_seq - pos);
+		if (diff == 0) {
+			if (atomic_cas(&r->r_tail, pos, pos + 1)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			/* Last lap's item is still there: full. */
+			return false;
+		}
+		pos = r->r_tail;
+	}
+
+	s->rs_ptr = ptr;
+	/* The pointer is there before a consumer can see it is. */
+	membar_sync();
+	s->rs_seq = pos + 1;
+	return true;
+}
+
+void *
+ring_get(struct ring *r)
+{
+	struct ringslot *s;
+	unsigned pos;
+	void *ptr;
+	int diff;
+
+	pos = r->r_head;
+	while (1) {
+		s = &r->r_slots[pos & r->r_mask];
+		diff = (int)(s->rs_seq - (pos + 1));
+		if (diff == 0) {
+			if (atomic_cas(&r->r_head, pos, pos + 1)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			/* Not filled in this lap yet: empty. */
+			return NULL;
+		}
+		pos = r->r_head;
+	}
+
+	/* Read the pointer after the number that says it is there, */
+	membar_sync();
+	ptr = s->rs_ptr;
+	/* and before the slot goes back to the producers. */
+	membar_sync();
+	s->rs_seq = pos + r->r_mask + 1;
+	return ptr;
+}
+
+unsigned
+ring_count(struct ring *r)
+{
+	unsigned head, tail;
+
+	head = r->r_head;
+	membar_sync();
+	tail = r->r_tail;
+	/* The head may have moved on since; don't go below 0. */
+	if ((int)(tail - head) < 0) {
+		return 0;
+	}
+	return tail - head > r->r_mask + 1 ? r->r_mask + 1 : tail - head;
+}
+
+////////////////////////////////////////////////////////////
+//
+// One producer and one consumer
+
+struct spscring *
+spscring_create(unsigned size)
+{
+	struct spscring *r;
+
+	size = ring_roundsize(size);
+	r = kmalloc_aligned(sizeof(*r), CACHELINE_SIZE);
+	if (r == NULL) {
+		return NULL;
+	}
+	r->sr_slots = kmalloc(size * sizeof(void *));
+	if (r->sr_slots == NULL) {
+		kfree(r);
+		return NULL;
+	}
+	r->sr_mask = size - 1;
+	r->sr_tail = 0;
+	r->sr_head = 0;
+	return r;
+}
+
+void
+spscring_destroy(struct spscring *r)
+{
+	KASSERT(r->sr_head == r->sr_tail);
+	kfree((void *)r->sr_slots);
+	kfree(r);
+}
+
+bool
+spscring_put(struct spscring *r, void *ptr)
+{
+	unsigned tail = r->sr_tail;
+
+	KASSERT(ptr != NULL);
+
+	if (tail - r->sr_head > r->sr_mask) {
+		return false;
+	}
+	/* The consumer is done with the slot once it has moved the head. */
+	membar_sync();
+	r->sr_slots[tail & r->sr_mask] = ptr;
+	membar_sync();
+	r->sr_tail = tail + 1;
+	return true;
+}
+
+void *
+spscring_get(struct spscring *r)
+{
+	unsigned head = r->sr_head;
+	void *ptr;
+
+	if (head == r->sr_tail) {
+		return NULL;
+	}
+	membar_sync();
+	ptr = r->sr_slots[head & r->sr_mask];
+	membar_sync();
+	r->sr_head = head + 1;
+	return ptr;
+}
+
+unsigned
+spscring_count(struct spscring *r)
+{
+	return r->sr_tail - r->sr_head;
+}
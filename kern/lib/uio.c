@@ -33,11 +33,101 @@
 #include <proc.h>
 #include <current.h>
 #include <copyinout.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <addrspace.h>
+#endif
 
 /*
  * See uio.h for a description.
  */
 
+#if OPT_A3
+/*
+ * Move SIZE bytes between PTR and the user buffer at UBASE, a page at a
+ * time, through the pages' frames instead of copyin/copyout. That saves
+ * a trap per page that isn't mapped yet, and a page that is written
+ * whole is never zero-filled or read in first. UBASE must be
+ * page-aligned and SIZE a multiple of PAGE_SIZE.
+ */
+static
+int
+uiomove_pages(void *ptr, size_t size, userptr_t ubase, bool touser)
+{
+	size_t done;
+	int result;
+
+	KASSERT(((vaddr_t)ubase & ~(vaddr_t)PAGE_FRAME) == 0);
+	KASSERT((size & ~(size_t)PAGE_FRAME) == 0);
+
+	for (done = 0; done < size; done += PAGE_SIZE) {
+		result = as_copypage(curproc_getas(),
+				     (vaddr_t)ubase + done,
+				     (char *)ptr + done, PAGE_SIZE, touser);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+#endif
+
+/*
+ * The next iovec of UIO with anything left in it, stepping past empty
+ * ones; only a uio_resid bigger than its buffers runs out.
+ */
+static
+struct iovec *
+uio_nextiov(struct uio *uio)
+{
+	while (uio->uio_iov->iov_len == 0) {
+		uio->uio_iov++;
+		uio->uio_iovcnt--;
+		if (uio->uio_iovcnt == 0) {
+			panic("uiomove: ran out of buffers\n");
+		}
+	}
+	return uio->uio_iov;
+}
+
+/*
+ * Kernel buffers on both sides: nothing to check per iovec and nothing
+ * that can fail, so each piece is one memcpy. The two sides never
+ * overlap, since a uio is never set up over the buffer it is moved to
+ * or from.
+ */
+void
+uiomove_kernel(void *ptr, size_t n, struct uio *uio)
+{
+	struct iovec *iov;
+	size_t size;
+
+	KASSERT(uio->uio_segflg == UIO_SYSSPACE);
+	KASSERT(uio->uio_space == NULL);
+	KASSERT(uio->uio_rw == UIO_READ || uio->uio_rw == UIO_WRITE);
+
+	if (n > uio->uio_resid) {
+		n = uio->uio_resid;
+	}
+	while (n > 0) {
+		iov = uio_nextiov(uio);
+		size = iov->iov_len < n ? iov->iov_len : n;
+		if (uio->uio_rw == UIO_READ) {
+			memcpy(iov->iov_kbase, ptr, size);
+		}
+		else {
+			memcpy(ptr, iov->iov_kbase, size);
+		}
+		iov->iov_kbase = (char *)iov->iov_kbase + size;
+		iov->iov_len -= size;
+		uio->uio_resid -= size;
+		uio->uio_offset += size;
+		ptr = (char *)ptr + size;
+		n -= size;
+	}
+}
+
 int
 uiomove(void *ptr, size_t n, struct uio *uio)
 {
@@ -49,11 +139,10 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 		panic("uiomove: Invalid uio_rw %d\n", (int) uio->uio_rw);
 	}
 	if (uio->uio_segflg==UIO_SYSSPACE) {
-		KASSERT(uio->uio_space == NULL);
-	}
-	else {
-		KASSERT(uio->uio_space == curproc_getas());
+		uiomove_kernel(ptr, n, uio);
+		return 0;
 	}
+	KASSERT(uio->uio_space == curproc_getas());
 
 	while (n > 0 && uio->uio_resid > 0) {
 		/* get the first iovec */
@@ -81,18 +170,20 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 		}
 
 		switch (uio->uio_segflg) {
-		    case UIO_SYSSPACE:
-			    result = 0;
-			    if (uio->uio_rw == UIO_READ) {
-				    memmove(iov->iov_kbase, ptr, size);
-			    }
-			    else {
-				    memmove(ptr, iov->iov_kbase, size);
-			    }
-			    iov->iov_kbase = ((char *)iov->iov_kbase+size);
-			    break;
 		    case UIO_USERSPACE:
 		    case UIO_USERISPACE:
+#if OPT_A3
+			    if (size >= PAGE_SIZE &&
+				((vaddr_t)iov->iov_ubase & ~(vaddr_t)PAGE_FRAME)
+				== 0) {
+				    /* Whole pages; the rest goes next time. */
+				    size &= PAGE_FRAME;
+				    result = uiomove_pages(ptr, size,
+					    iov->iov_ubase,
+					    uio->uio_rw == UIO_READ);
+			    }
+			    else
+#endif
 			    if (uio->uio_rw == UIO_READ) {
 				    result = copyout(ptr, iov->iov_ubase,size);
 			    }
@@ -119,17 +210,58 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 	return 0;
 }
 
+/*
+ * Each piece of KIOV in turn; see uio.h.
+ */
+int
+uiomove_iov(const struct iovec *kiov, unsigned kiovcnt, struct uio *uio)
+{
+	unsigned i;
+	int result;
+
+	for (i = 0; i < kiovcnt && uio->uio_resid > 0; i++) {
+		if (uio->uio_segflg == UIO_SYSSPACE) {
+			uiomove_kernel(kiov[i].iov_kbase, kiov[i].iov_len, uio);
+			continue;
+		}
+		result = uiomove(kiov[i].iov_kbase, kiov[i].iov_len, uio);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
 int
 uiomovezeros(size_t n, struct uio *uio)
 {
 	/* static, so initialized as zero */
 	static char zeros[16];
+	struct iovec *iov;
 	size_t amt;
 	int result;
 
 	/* This only makes sense when reading */
 	KASSERT(uio->uio_rw == UIO_READ);
 
+	/* Into kernel buffers, zero them where they are. */
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		while (n > 0) {
+			iov = uio_nextiov(uio);
+			amt = iov->iov_len < n ? iov->iov_len : n;
+			bzero(iov->iov_kbase, amt);
+			iov->iov_kbase = (char *)iov->iov_kbase + amt;
+			iov->iov_len -= amt;
+			uio->uio_resid -= amt;
+			uio->uio_offset += amt;
+			n -= amt;
+		}
+		return 0;
+	}
+
 	while (n > 0) {
 		amt = sizeof(zeros);
 		if (amt > n) {
@@ -162,4 +294,5 @@ uio_kinit(struct iovec *iov, struct uio *u,
 	u->uio_segflg = UIO_SYSSPACE;
 	u->uio_rw = rw;
 	u->uio_space = NULL;
+	u->uio_direct = false;
 }
@@ -45,19 +45,38 @@
 #include <types.h>
 #include <proc.h>
 #include <current.h>
+#include <cpu.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/wait.h>
+#include <signal.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <array.h>
+#include <bitmap.h>
+#include <limits.h>
+#include <clock.h>
+#include <kmem_cache.h>
+#include <futex.h>
+#include <aio.h>
+#include <upcall.h>
+#include <file.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/* Where proc structures come from. */
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc), NULL);
+
 /*
  * Mechanism for making the kernel menu thread sleep while processes are running
  */
@@ -65,11 +84,6 @@ struct proc *kproc;
 /* count of the number of processes, excluding kproc */
 static volatile unsigned int proc_count;
 
-#if OPT_A2
-/* count pid */
-static volatile unsigned int pid_count;
-#endif
-
 /* provides mutual exclusion for proc_count */
 /* it would be better to use a lock here, but we use a semaphore because locks are not implemented in the base kernel */
 static struct semaphore *proc_count_mutex;
@@ -77,6 +91,152 @@ static struct semaphore *proc_count_mutex;
 struct semaphore *no_proc_sem;
 #endif // UW
 
+#if OPT_A2
+/*
+ * The pid table. Pids in use are marked in pid_map, which covers all
+ * of pid space (so a pid is freed for reuse when its process is
+ * destroyed), and each process is on the hash chain for its pid. All
+ * under pid_lock.
+ */
+#define PID_HASHSIZE 128
+#define PID_HASH(pid) ((unsigned)(pid) % PID_HASHSIZE)
+
+static struct spinlock pid_lock = SPINLOCK_INITIALIZER;
+static struct bitmap *pid_map;
+static struct proc *pid_hash[PID_HASHSIZE];
+
+/*
+ * Give PROC a pid and enter it in the table.
+ */
+static int pid_alloc(struct proc *proc)
+{
+	unsigned pid;
+	int result;
+
+	spinlock_acquire(&pid_lock);
+	result = bitmap_alloc(pid_map, &pid);
+	if (result)
+	{
+		spinlock_release(&pid_lock);
+		return ENPROC;
+	}
+	KASSERT(pid >= PID_MIN && pid <= PID_MAX);
+	proc->pid = pid;
+	proc->p_pidnext = pid_hash[PID_HASH(pid)];
+	pid_hash[PID_HASH(pid)] = proc;
+	spinlock_release(&pid_lock);
+	return 0;
+}
+
+/*
+ * Take PROC out of the table and free its pid.
+ */
+static void pid_free(struct proc *proc)
+{
+	struct proc **pp;
+
+	spinlock_acquire(&pid_lock);
+	for (pp = &pid_hash[PID_HASH(proc->pid)]; *pp != proc;
+	     pp = &(*pp)->p_pidnext)
+	{
+		KASSERT(*pp != NULL);
+	}
+	*pp = proc->p_pidnext;
+	bitmap_unmark(pid_map, proc->pid);
+	spinlock_release(&pid_lock);
+	proc->pid = 0;
+}
+
+struct proc *proc_lookup(pid_t pid, struct proc *parent)
+{
+	struct proc *p;
+
+	if (pid < PID_MIN || pid > PID_MAX)
+	{
+		return NULL;
+	}
+	spinlock_acquire(&pid_lock);
+	for (p = pid_hash[PID_HASH(pid)]; p != NULL; p = p->p_pidnext)
+	{
+		if (p->pid == pid)
+		{
+			break;
+		}
+	}
+	if (p != NULL && parent != NULL && p->parent != parent)
+	{
+		p = NULL;
+	}
+	spinlock_release(&pid_lock);
+	return p;
+}
+
+/*
+ * Let go of PROC's children, which nobody will wait for now: destroy
+ * the ones that have exited, and leave the rest without a parent, so
+ * that they destroy themselves when they exit. Call only when PROC has
+ * no threads left to call waitpid.
+ */
+static void proc_orphan(struct proc *proc)
+{
+	struct proc *child;
+
+	for (unsigned i = 0; i < array_num(proc->children); i++)
+	{
+		child = array_get(proc->children, i);
+		lock_acquire(child->p_Lock);
+		if (child->status == Zombie)
+		{
+			lock_release(child->p_Lock);
+			proc_destroy(child);
+		}
+		else
+		{
+			child->parent = NULL;
+			lock_release(child->p_Lock);
+		}
+	}
+	array_setsize(proc->children, 0);
+}
+
+/*
+ * P's children are let go of first, rather than when P itself is
+ * destroyed, so a parent that is never waited for does not keep its
+ * exited children around. Its files are closed then too, rather than
+ * staying open until it is waited for.
+ *
+ * The child's p_Lock is held throughout, so its parent cannot finish
+ * destroying itself (which takes each child's p_Lock) until the child
+ * is done with the parent's lock and wait CV.
+ */
+void proc_exit(struct proc *p, int status)
+{
+	struct proc *parent;
+
+	proc_orphan(p);
+	if (p->p_files != NULL)
+	{
+		filetable_destroy(p->p_files);
+		p->p_files = NULL;
+	}
+
+	lock_acquire(p->p_Lock);
+	parent = p->parent;
+	if (parent == NULL)
+	{
+		lock_release(p->p_Lock);
+		proc_destroy(p);
+		return;
+	}
+	lock_acquire(parent->p_Lock);
+	p->status = Zombie;
+	p->exitcode = status;
+	cv_broadcast(parent->p_waitcv, parent->p_Lock);
+	lock_release(parent->p_Lock);
+	lock_release(p->p_Lock);
+}
+#endif
+
 /*
  * Create a proc structure.
  */
@@ -85,7 +245,7 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(&proc_cache);
 	if (proc == NULL)
 	{
 		return NULL;
@@ -93,11 +253,12 @@ proc_create(const char *name)
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL)
 	{
-		kfree(proc);
+		kmem_cache_free(&proc_cache, proc);
 		return NULL;
 	}
 
 	threadarray_init(&proc->p_threads);
+	proc->p_nthreads = 0;
 	spinlock_init(&proc->p_lock);
 
 	/* VM fields */
@@ -106,20 +267,55 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-#ifdef UW
-	proc->console = NULL;
-#endif // UW
+	bzero(&proc->p_usage, sizeof(proc->p_usage));
+#if OPT_A2
+	bzero(&proc->p_cusage, sizeof(proc->p_cusage));
+#endif
+
+	proc->p_files = NULL;
 
 #if OPT_A2
-	proc->pid = pid_count;
+	proc->pid = 0;
+	proc->p_pidnext = NULL;
+	proc->p_group = NULL;
 	proc->parent = NULL;
 	proc->children = array_create();
 	proc->status = Alive;
-	proc->p_cv = cv_create("cv");
+	proc->p_waitcv = cv_create("p_waitcv");
 	proc->p_Lock = lock_create("lock");
 	proc->exitcode = 0;
 #endif
 
+#if OPT_A3
+	proc->p_tlock = lock_create("p_tlock");
+	proc->p_tcv = cv_create("p_tcv");
+	proc->p_uthreads = array_create();
+	proc->p_nexttid = 1;
+	proc->p_exiting = false;
+	proc->p_oomkill = false;
+	proc->p_aio = NULL;
+	proc->p_upcall = NULL;
+	if (proc->p_tlock == NULL || proc->p_tcv == NULL ||
+	    proc->p_uthreads == NULL)
+	{
+		if (proc->p_tlock != NULL)
+		{
+			lock_destroy(proc->p_tlock);
+		}
+		if (proc->p_tcv != NULL)
+		{
+			cv_destroy(proc->p_tcv);
+		}
+		if (proc->p_uthreads != NULL)
+		{
+			array_destroy(proc->p_uthreads);
+		}
+		kfree(proc->p_name);
+		kmem_cache_free(&proc_cache, proc);
+		return NULL;
+	}
+#endif
+
 	return proc;
 }
 
@@ -174,45 +370,50 @@ void proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
-#ifdef UW
-	if (proc->console)
+	if (proc->p_files != NULL)
 	{
-		vfs_close(proc->console);
+		filetable_destroy(proc->p_files);
 	}
-#endif // UW
 
 	threadarray_cleanup(&proc->p_threads);
 #if OPT_A2
-
-	// destroy Zombie children
-	for (unsigned i = 0; i < array_num(proc->children); i++)
+	if (proc->pid != 0)
 	{
-		struct proc *child = (struct proc *)array_get(proc->children, i);
-		if (child != NULL)
-		{
-			lock_acquire(child->p_Lock);
-			if (child->status == Zombie)
-			{
-				lock_release(child->p_Lock);
-				proc_destroy(child);
-			}
-			else
-			{
-				child->parent = NULL;
-				lock_release(child->p_Lock);
-			}
-		}
+		pid_free(proc);
+	}
+	proc_orphan(proc);
+	if (proc->p_group != NULL)
+	{
+		schedgroup_put(proc->p_group);
 	}
 	lock_destroy(proc->p_Lock);
-	cv_destroy(proc->p_cv);
-	// clear array for array_destroy
-	array_init(proc->children);
+	cv_destroy(proc->p_waitcv);
 	array_destroy(proc->children);
 #endif
 
+#if OPT_A3
+	/* threads that finished without being joined */
+	for (unsigned i = 0; i < array_num(proc->p_uthreads); i++)
+	{
+		kfree(array_get(proc->p_uthreads, i));
+	}
+	array_setsize(proc->p_uthreads, 0);
+	array_destroy(proc->p_uthreads);
+	if (proc->p_aio != NULL)
+	{
+		aio_destroy(proc->p_aio);
+	}
+	if (proc->p_upcall != NULL)
+	{
+		upcall_destroy(proc->p_upcall);
+	}
+	cv_destroy(proc->p_tcv);
+	lock_destroy(proc->p_tlock);
+#endif
+
 	spinlock_cleanup(&proc->p_lock);
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(&proc_cache, proc);
 
 #ifdef UW
 	/* decrement the process count */
@@ -256,7 +457,16 @@ void proc_bootstrap(void)
 #endif // UW
 
 #if OPT_A2
-	pid_count++;
+	/* pids below PID_MIN are never handed out */
+	pid_map = bitmap_create(PID_MAX + 1);
+	if (pid_map == NULL)
+	{
+		panic("could not create the pid map\n");
+	}
+	for (unsigned pid = 0; pid < PID_MIN; pid++)
+	{
+		bitmap_mark(pid_map, pid);
+	}
 #endif
 }
 
@@ -270,7 +480,7 @@ struct proc *
 proc_create_runprogram(const char *name)
 {
 	struct proc *proc;
-	char *console_path;
+	int result;
 
 	proc = proc_create(name);
 	if (proc == NULL)
@@ -278,20 +488,6 @@ proc_create_runprogram(const char *name)
 		return NULL;
 	}
 
-#ifdef UW
-	/* open the console - this should always succeed */
-	console_path = kstrdup("con:");
-	if (console_path == NULL)
-	{
-		panic("unable to copy console path name during process creation\n");
-	}
-	if (vfs_open(console_path, O_WRONLY, 0, &(proc->console)))
-	{
-		panic("unable to open the console during process creation\n");
-	}
-	kfree(console_path);
-#endif // UW
-
 	/* VM fields */
 
 	proc->p_addrspace = NULL;
@@ -323,12 +519,60 @@ proc_create_runprogram(const char *name)
            are created using a call to proc_create_runprogram  */
 	P(proc_count_mutex);
 	proc_count++;
-#if OPT_A2
-	pid_count++;
-#endif
 	V(proc_count_mutex);
 #endif // UW
 
+	/*
+	 * A child of a user process shares its parent's open files; one
+	 * started from the menu gets the console.
+	 */
+	if (curproc->p_files != NULL)
+	{
+		result = filetable_copy(curproc->p_files, &proc->p_files);
+	}
+	else
+	{
+		proc->p_files = filetable_create();
+		result = proc->p_files == NULL ? ENOMEM :
+			filetable_stdio(proc->p_files);
+	}
+	if (result)
+	{
+		proc_destroy(proc);
+		return NULL;
+	}
+
+#if OPT_A2
+	if (pid_alloc(proc))
+	{
+		proc_destroy(proc);
+		return NULL;
+	}
+
+	/*
+	 * A child joins its parent's process group; a process from the
+	 * menu leads one of its own. A pid handed out again while an old
+	 * group of that id lives on joins that one, as pids are not held
+	 * back for groups.
+	 */
+	if (curproc != kproc)
+	{
+		spinlock_acquire(&curproc->p_lock);
+		proc->p_group = curproc->p_group;
+		schedgroup_ref(proc->p_group);
+		spinlock_release(&curproc->p_lock);
+	}
+	else
+	{
+		proc->p_group = schedgroup_get(proc->pid, true);
+		if (proc->p_group == NULL)
+		{
+			proc_destroy(proc);
+			return NULL;
+		}
+	}
+#endif
+
 	return proc;
 }
 
@@ -344,6 +588,19 @@ int proc_addthread(struct proc *proc, struct thread *t)
 
 	spinlock_acquire(&proc->p_lock);
 	result = threadarray_add(&proc->p_threads, t, NULL);
+	if (result == 0)
+	{
+		proc->p_nthreads++;
+	}
+	if (result == 0 && proc != kproc)
+	{
+		/* As nice and pinned as its creator; see proc_setnice. */
+		thread_setnice(t, curthread->t_nice);
+		thread_setaffinity(t, curthread->t_affinity);
+#if OPT_A2
+		thread_setgroup(t, proc->p_group);
+#endif
+	}
 	spinlock_release(&proc->p_lock);
 	if (result)
 	{
@@ -357,6 +614,24 @@ int proc_addthread(struct proc *proc, struct thread *t)
  * Remove a thread from its process. Either the thread or the process
  * might or might not be current.
  */
+/*
+ * Add what thread T has used to PU. If T is the current thread, that
+ * includes the hardclocks since it came on the cpu; any other thread's
+ * counts may be a switch behind. p_lock held, so no hardclock comes in
+ * the middle.
+ */
+static void proc_chargethread(struct proc_usage *pu, struct thread *t)
+{
+	pu->pu_runticks += t->t_runticks;
+	if (t == curthread)
+	{
+		pu->pu_runticks += curcpu->c_hardclocks - t->t_runstart;
+	}
+	pu->pu_oublock += t->t_oublock;
+	pu->pu_nvcsw += t->t_vswitches;
+	pu->pu_nivcsw += t->t_ivswitches;
+}
+
 void proc_remthread(struct thread *t)
 {
 	struct proc *proc;
@@ -373,6 +648,11 @@ void proc_remthread(struct thread *t)
 		if (threadarray_get(&proc->p_threads, i) == t)
 		{
 			threadarray_remove(&proc->p_threads, i);
+			proc->p_nthreads--;
+			proc_chargethread(&proc->p_usage, t);
+			/* the group may go with the process, before T does */
+			thread_setgroup(t, NULL);
+			t->t_upcall = NULL;
 			spinlock_release(&proc->p_lock);
 			t->t_proc = NULL;
 			return;
@@ -383,10 +663,341 @@ void proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+void proc_chargeas(struct proc *p, struct addrspace *as)
+{
+#if OPT_A3
+	spinlock_acquire(&p->p_lock);
+	p->p_usage.pu_minflt += as->as_minflt;
+	p->p_usage.pu_majflt += as->as_majflt;
+	spinlock_release(&p->p_lock);
+#else
+	/* dumbvm does not count faults */
+	(void)p;
+	(void)as;
+#endif
+}
+
+/* Hardclocks to a struct timeval, without 64-bit division. */
+static void proc_tickstotv(unsigned ticks, struct timeval *tv)
+{
+	tv->tv_sec = ticks / HZ;
+	tv->tv_usec = (ticks % HZ) * (1000000 / HZ);
+}
+
+int proc_getrusage(struct proc *p, int who, struct rusage *ru)
+{
+	struct proc_usage pu;
+	unsigned i;
+
+	spinlock_acquire(&p->p_lock);
+	switch (who)
+	{
+	case RUSAGE_SELF:
+		pu = p->p_usage;
+		for (i = 0; i < threadarray_num(&p->p_threads); i++)
+		{
+			proc_chargethread(&pu, threadarray_get(&p->p_threads, i));
+		}
+#if OPT_A3
+		if (p->p_addrspace != NULL)
+		{
+			pu.pu_minflt += p->p_addrspace->as_minflt;
+			pu.pu_majflt += p->p_addrspace->as_majflt;
+		}
+#endif
+		break;
+#if OPT_A2
+	case RUSAGE_CHILDREN:
+		pu = p->p_cusage;
+		break;
+#endif
+	default:
+		spinlock_release(&p->p_lock);
+		return EINVAL;
+	}
+	spinlock_release(&p->p_lock);
+
+	/*
+	 * Hardclocks are not told apart by whether they came in user or
+	 * kernel mode, so it is all user time.
+	 */
+	bzero(ru, sizeof(*ru));
+	proc_tickstotv(pu.pu_runticks, &ru->ru_utime);
+	ru->ru_minflt = pu.pu_minflt;
+	ru->ru_majflt = pu.pu_majflt;
+	ru->ru_oublock = pu.pu_oublock;
+	ru->ru_nvcsw = pu.pu_nvcsw;
+	ru->ru_nivcsw = pu.pu_nivcsw;
+	return 0;
+}
+
+/*
+ * Threads are added to and taken off p_threads under p_lock, and a
+ * new one copies its creator's values there (proc_addthread), so
+ * holding it, every thread gets the new value, including one being
+ * created right now.
+ */
+void proc_setnice(struct proc *p, int nice)
+{
+	unsigned i;
+
+	spinlock_acquire(&p->p_lock);
+	for (i = 0; i < threadarray_num(&p->p_threads); i++)
+	{
+		thread_setnice(threadarray_get(&p->p_threads, i), nice);
+	}
+	spinlock_release(&p->p_lock);
+}
+
+int proc_getnice(struct proc *p, int *ret)
+{
+	int err = ESRCH;
+
+	spinlock_acquire(&p->p_lock);
+	if (threadarray_num(&p->p_threads) > 0)
+	{
+		*ret = threadarray_get(&p->p_threads, 0)->t_nice;
+		err = 0;
+	}
+	spinlock_release(&p->p_lock);
+	return err;
+}
+
+void proc_setaffinity(struct proc *p, uint32_t mask)
+{
+	unsigned i;
+
+	spinlock_acquire(&p->p_lock);
+	for (i = 0; i < threadarray_num(&p->p_threads); i++)
+	{
+		thread_setaffinity(threadarray_get(&p->p_threads, i), mask);
+	}
+	spinlock_release(&p->p_lock);
+}
+
+int proc_getaffinity(struct proc *p, uint32_t *ret)
+{
+	int err = ESRCH;
+
+	spinlock_acquire(&p->p_lock);
+	if (threadarray_num(&p->p_threads) > 0)
+	{
+		*ret = threadarray_get(&p->p_threads, 0)->t_affinity;
+		err = 0;
+	}
+	spinlock_release(&p->p_lock);
+	return err;
+}
+
+#if OPT_A2
+void proc_chargechild(struct proc *parent, struct proc *child)
+{
+	struct proc_usage *pu = &parent->p_cusage;
+
+	spinlock_acquire(&parent->p_lock);
+	pu->pu_runticks += child->p_usage.pu_runticks +
+		child->p_cusage.pu_runticks;
+	pu->pu_minflt += child->p_usage.pu_minflt + child->p_cusage.pu_minflt;
+	pu->pu_majflt += child->p_usage.pu_majflt + child->p_cusage.pu_majflt;
+	pu->pu_oublock += child->p_usage.pu_oublock +
+		child->p_cusage.pu_oublock;
+	pu->pu_nvcsw += child->p_usage.pu_nvcsw + child->p_cusage.pu_nvcsw;
+	pu->pu_nivcsw += child->p_usage.pu_nivcsw + child->p_cusage.pu_nivcsw;
+	spinlock_release(&parent->p_lock);
+}
+
+/*
+ * As with proc_setnice, holding p_lock puts every thread, including
+ * one being made now, in the new group. Each thread is out of the old
+ * one before our reference to it goes.
+ */
+int proc_setpgid(struct proc *p, pid_t pgid)
+{
+	struct schedgroup *g, *old;
+	unsigned i;
+
+	g = schedgroup_get(pgid, pgid == p->pid);
+	if (g == NULL)
+	{
+		return pgid == p->pid ? ENOMEM : EPERM;
+	}
+
+	spinlock_acquire(&p->p_lock);
+	old = p->p_group;
+	p->p_group = g;
+	for (i = 0; i < threadarray_num(&p->p_threads); i++)
+	{
+		thread_setgroup(threadarray_get(&p->p_threads, i), g);
+	}
+	spinlock_release(&p->p_lock);
+
+	schedgroup_put(old);
+	return 0;
+}
+
+pid_t proc_getpgid(struct proc *p)
+{
+	pid_t pgid;
+
+	spinlock_acquire(&p->p_lock);
+	pgid = p->p_group->sg_id;
+	spinlock_release(&p->p_lock);
+	return pgid;
+}
+#endif
+
+#if OPT_A3
+void proc_thread_exit(userptr_t retval)
+{
+	struct proc *p = curproc;
+	struct uthread *ut;
+
+	KASSERT(lock_do_i_hold(p->p_tlock));
+	KASSERT(threadarray_num(&p->p_threads) > 1);
+
+	for (unsigned i = 0; i < array_num(p->p_uthreads); i++)
+	{
+		ut = array_get(p->p_uthreads, i);
+		if (ut->ut_thread == curthread)
+		{
+			ut->ut_thread = NULL;
+			ut->ut_retval = retval;
+			ut->ut_done = true;
+			break;
+		}
+	}
+
+	/* note: curproc cannot be used after this call */
+	proc_remthread(curthread);
+	cv_broadcast(p->p_tcv, p->p_tlock);
+	lock_release(p->p_tlock);
+
+	thread_exit();
+	panic("return from thread_exit in proc_thread_exit\n");
+}
+
+void proc_exitthreads(void)
+{
+	struct proc *p = curproc;
+
+	lock_acquire(p->p_tlock);
+	if (p->p_exiting)
+	{
+		/* someone else is ending the process */
+		proc_thread_exit(NULL);
+	}
+	p->p_exiting = true;
+	cv_broadcast(p->p_tcv, p->p_tlock);
+	futex_wakeas(p->p_addrspace);
+	upcall_wakeexit(p);
+	while (threadarray_num(&p->p_threads) > 1)
+	{
+		cv_wait(p->p_tcv, p->p_tlock);
+	}
+	lock_release(p->p_tlock);
+}
+
+void proc_checkexit(void)
+{
+	struct proc *p = curproc;
+
+	if (p == NULL || p == kproc)
+	{
+		return;
+	}
+	if (p->p_oomkill && !p->p_exiting)
+	{
+		proc_exitself(_MKWAIT_SIG(SIGKILL));
+	}
+	/* p_exiting never goes false again, so only the true case locks */
+	if (!p->p_exiting)
+	{
+		return;
+	}
+	lock_acquire(p->p_tlock);
+	proc_thread_exit(NULL);
+}
+
+void proc_exitself(int status)
+{
+	struct addrspace *as;
+	struct proc *p = curproc;
+
+	/* the other threads go first; they are using the address space */
+	proc_exitthreads();
+
+	KASSERT(p->p_addrspace != NULL);
+	as_deactivate();
+	/* as in sys__exit: clear p_addrspace before as_destroy */
+	as = curproc_setas(NULL);
+	proc_chargeas(p, as);
+	as_destroy(as);
+
+	/* note: curproc cannot be used after this call */
+	proc_remthread(curthread);
+	proc_exit(p, status);
+
+	thread_exit();
+	panic("return from thread_exit in proc_exitself\n");
+}
+
+/*
+ * Walks the pid table under pid_lock, which keeps each process there
+ * from being destroyed, and looks at its address space under its
+ * p_lock, which keeps that from being taken away meanwhile.
+ */
+pid_t proc_oomvictim(bool another)
+{
+	struct proc *p, *victim = NULL;
+	unsigned i, pages, most = 0;
+	pid_t pid;
+
+	spinlock_acquire(&pid_lock);
+	for (i = 0; i < PID_HASHSIZE; i++)
+	{
+		for (p = pid_hash[i]; p != NULL; p = p->p_pidnext)
+		{
+			spinlock_acquire(&p->p_lock);
+			pages = p->p_addrspace != NULL ?
+				p->p_addrspace->as_rss : 0;
+			spinlock_release(&p->p_lock);
+			if (pages == 0)
+			{
+				/* already gone, or never had any */
+				continue;
+			}
+			if (p->p_oomkill && !another)
+			{
+				pid = p->pid;
+				spinlock_release(&pid_lock);
+				return pid;
+			}
+			if (!p->p_oomkill && pages > most)
+			{
+				victim = p;
+				most = pages;
+			}
+		}
+	}
+	if (victim == NULL)
+	{
+		spinlock_release(&pid_lock);
+		return 0;
+	}
+	victim->p_oomkill = true;
+	pid = victim->pid;
+	spinlock_release(&pid_lock);
+
+	kprintf("oom: killing pid %d, %u pages resident\n", pid, most);
+	return pid;
+}
+#endif
+
 /*
  * Fetch the address space of the current process. Caution: it isn't
  * refcounted. If you implement multithreaded processes, make sure to
  * set up a refcount scheme or some other method to make this safe.
+ * A process with one thread needs no lock; see curproc_single.
  */
 struct addrspace *
 curproc_getas(void)
@@ -402,6 +1013,10 @@ curproc_getas(void)
 	}
 #endif
 
+	if (curproc_single())
+	{
+		return curproc->p_addrspace;
+	}
 	spinlock_acquire(&curproc->p_lock);
 	as = curproc->p_addrspace;
 	spinlock_release(&curproc->p_lock);
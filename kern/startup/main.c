@@ -38,23 +38,42 @@
 #include <lib.h>
 #include <spl.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
 #include <vm.h>
+#include <kmem_cache.h>
+#include <shrink.h>
 #include <mainbus.h>
+#include <uio.h>
 #include <vfs.h>
+#include <sfs.h>
+#include <tmpfs.h>
 #include <device.h>
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
+#include <workqueue.h>
+#include <ktrace.h>
+#include <kstat.h>
 #include "autoconf.h"  // for pseudoconfig
+#include "opt-A3.h"
+#include "opt-irqspread.h"
+#include "opt-sfs.h"
+#include "opt-tmpfs.h"
+#if OPT_A3
+#include <swap.h>
+#include <futex.h>
+#include <uw-vmstats.h>
+#endif
 
 
 /*
- * These two pieces of data are maintained by the makefiles and build system.
+ * These pieces of data are maintained by the makefiles and build system.
  * buildconfig is the name of the config file the kernel was configured with.
+ * buildflavour is debug, opt, or perf, from the config (see conf/PERF).
  * buildversion starts at 1 and is incremented every time you link a kernel. 
  *
  * The purpose is not to show off how many kernels you've linked, but
@@ -63,6 +82,7 @@
  */
 extern const int buildversion;
 extern const char buildconfig[];
+extern const char buildflavour[];
 
 /*
  * Copyright message for the OS/161 base code.
@@ -72,6 +92,57 @@ static const char harvard_copyright[] =
     "   President and Fellows of Harvard College.  All rights reserved.\n";
 
 
+/*
+ * The disk mounted as SFS when it is first used; see vfs_mountlazy.
+ */
+#define BOOT_LAZYSFS	"lhd0"
+
+/*
+ * Boot phase timing: boot_phase marks the end of each phase, with the
+ * cycle counter, which runs from the start; the clock that turns
+ * cycles into time is only calibrated partway through, so the times
+ * are worked out and printed at the end.
+ */
+#define BOOT_MAXPHASES	8
+
+static struct {
+	const char *bp_name;
+	uint32_t bp_cycles;
+} boot_phases[BOOT_MAXPHASES];
+static unsigned boot_nphases;
+static uint32_t boot_lastcycles;
+
+static
+void
+boot_phase(const char *name)
+{
+	uint32_t now;
+
+	now = cpu_cycles();
+	KASSERT(boot_nphases < BOOT_MAXPHASES);
+	boot_phases[boot_nphases].bp_name = name;
+	boot_phases[boot_nphases].bp_cycles = now - boot_lastcycles;
+	boot_nphases++;
+	boot_lastcycles = now;
+}
+
+static
+void
+boot_printphases(void)
+{
+	uint32_t total = 0;
+	unsigned i;
+
+	kprintf("Boot:");
+	for (i=0; i<boot_nphases; i++) {
+		kprintf(" %s %u", boot_phases[i].bp_name,
+			(unsigned)(clock_cycles_ns(boot_phases[i].bp_cycles)
+				   / 1000));
+		total += boot_phases[i].bp_cycles;
+	}
+	kprintf(", total %u us\n", (unsigned)(clock_cycles_ns(total) / 1000));
+}
+
 /*
  * Initial boot sequence.
  */
@@ -96,13 +167,15 @@ boot(void)
 	 * dev/generic/console.c).
 	 */
 
+	boot_lastcycles = cpu_cycles();
+
 	kprintf("\n");
 	kprintf("OS/161 base system version %s\n", BASE_VERSION);
 	kprintf("%s", harvard_copyright);
 	kprintf("\n");
 
-	kprintf("Guanzhao Wang's system version %s (%s #%d)\n", 
-		GROUP_VERSION, buildconfig, buildversion);
+	kprintf("Guanzhao Wang's system version %s (%s #%d, %s)\n", 
+		GROUP_VERSION, buildconfig, buildversion, buildflavour);
 	kprintf("\n");
 
 	/* Early initialization. */
@@ -110,7 +183,10 @@ boot(void)
 	proc_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
+	shrink_bootstrap();
 	vfs_bootstrap();
+	kmem_cache_bootstrap();
+	boot_phase("early");
 
 	/* Probe and initialize devices. Interrupts should come on. */
 	kprintf("Device probe...\n");
@@ -119,15 +195,51 @@ boot(void)
 	KASSERT(curthread->t_curspl == 0);
 	/* Now do pseudo-devices. */
 	pseudoconfig();
+	boot_phase("devices");
+	clock_monotonic_bootstrap();
+	boot_phase("clock");
 	kprintf("\n");
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
+	timepage_bootstrap();
 	kprintf_bootstrap();
+	boot_phase("vm");
+
+	/*
+	 * The other cpus hatch while this one gets on with the rest;
+	 * then wait for them before sending them interrupts.
+	 */
 	thread_start_cpus();
+	klog_bootstrap();
+	workqueue_bootstrap();
+	syscall_bootstrap();
+	kstat_bootstrap();
+	ktrace_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
+#if OPT_SFS
+	/* Mount the disk on first use; ignore failure likewise. */
+	sfs_mountlazy(BOOT_LAZYSFS);
+#endif
+#if OPT_TMPFS
+	/* And scratch space in memory; ignore failure likewise. */
+	tmpfs_create("tmp", 0);
+#endif
+
+#if OPT_A3
+	swap_bootstrap();
+	futex_bootstrap();
+#endif
+	boot_phase("services");
+
+	thread_wait_cpus();
+#if OPT_IRQSPREAD
+	mainbus_spread_irqs();
+#endif
+	boot_phase("cpus");
+	boot_printphases();
 
 
 	/*
@@ -146,6 +258,7 @@ shutdown(void)
 {
 
 	kprintf("Shutting down.\n");
+	klog_stop();
 	
 	vfs_clearbootfs();
 	vfs_clearcurdir();
@@ -153,6 +266,10 @@ shutdown(void)
 
 	thread_shutdown();
 
+#if OPT_A3
+	vmstats_print();
+#endif
+
 	splhigh();
 }
 
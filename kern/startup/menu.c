@@ -42,10 +42,35 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <kmem_cache.h>
+#include <shrink.h>
+#include <kmallocprof.h>
+#include <lockprof.h>
+#include <workqueue.h>
+#include <ktrace.h>
+#include <bio.h>
+#include <vdisk.h>
+#include <ramdisk.h>
+#include <tmpfs.h>
+#include <bench.h>
+#include <kstat.h>
+#include <iostat.h>
+#include <prof.h>
+#include <statwatch.h>
+#include <cpu.h>
+#include <mainbus.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
+#include "opt-tmpfs.h"
 #include "opt-net.h"
 #include "opt-A2.h"
+#include "opt-A3.h"
+#include "opt-kmallocprof.h"
+#include "opt-lockprof.h"
+#include <vm.h>
+#if OPT_A3
+#include <coremap.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -55,20 +80,6 @@
 
 #define MAXMENUARGS 16
 
-// XXX this should not be in this file
-void getinterval(time_t s1, uint32_t ns1, time_t s2, uint32_t ns2,
-				 time_t *rs, uint32_t *rns)
-{
-	if (ns2 < ns1)
-	{
-		ns2 += 1000000000;
-		s2--;
-	}
-
-	*rns = ns2 - ns1;
-	*rs = s2 - s1;
-}
-
 ////////////////////////////////////////////////////////////
 //
 // Command menu functions
@@ -266,6 +277,174 @@ cmd_sync(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_SFS
+/*
+ * Command for looking at or changing the SFS syncer's settings.
+ */
+static int
+cmd_syncer(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 5)
+	{
+		result = sfs_bsyncset(atoi(args[1]), atoi(args[2]),
+				      atoi(args[3]), atoi(args[4]));
+		if (result)
+		{
+			kprintf("syncer: %s\n", strerror(result));
+			return result;
+		}
+	}
+	else if (nargs != 1)
+	{
+		kprintf("Usage: syncer [delay age bg%% max%%]\n");
+		return EINVAL;
+	}
+	sfs_bsyncprint();
+
+	return 0;
+}
+#endif
+
+/*
+ * Command for looking at or changing the disk I/O scheduler.
+ */
+static int
+cmd_iosched(int nargs, char **args)
+{
+	static const char *const names[] = { "fifo", "clook", "deadline" };
+	unsigned readmax = 0, writemax = 0;
+	int policy, result;
+
+	if (nargs == 1)
+	{
+		bioq_print();
+		return 0;
+	}
+	if (nargs == 4)
+	{
+		readmax = atoi(args[2]);
+		writemax = atoi(args[3]);
+	}
+	else if (nargs != 2)
+	{
+		kprintf("Usage: iosched [fifo|clook|deadline [reads writes]]\n");
+		return EINVAL;
+	}
+
+	for (policy = 0; policy < 3; policy++)
+	{
+		if (!strcmp(args[1], names[policy]))
+		{
+			break;
+		}
+	}
+	result = bioq_setpolicy(policy, readmax, writemax);
+	if (result)
+	{
+		kprintf("iosched: %s: %s\n", args[1], strerror(result));
+		return result;
+	}
+	bioq_print();
+
+	return 0;
+}
+
+/*
+ * Command for making a striped or mirrored disk out of several.
+ */
+static int
+cmd_vdisk(int nargs, char **args)
+{
+	int mode, result;
+
+	if (nargs < 6)
+	{
+		kprintf("Usage: vdisk stripe|mirror name unit disk disk...\n");
+		return EINVAL;
+	}
+	if (!strcmp(args[1], "stripe"))
+	{
+		mode = VDISK_STRIPE;
+	}
+	else if (!strcmp(args[1], "mirror"))
+	{
+		mode = VDISK_MIRROR;
+	}
+	else
+	{
+		kprintf("vdisk: %s: not stripe or mirror\n", args[1]);
+		return EINVAL;
+	}
+
+	result = vdisk_create(args[2], mode, atoi(args[3]), nargs - 4,
+			      &args[4]);
+	if (result)
+	{
+		kprintf("vdisk: %s: %s\n", args[2], strerror(result));
+		return result;
+	}
+
+	return 0;
+}
+
+/*
+ * Command for making a disk out of memory.
+ */
+static int
+cmd_ramdisk(int nargs, char **args)
+{
+	int result;
+
+	if (nargs != 3)
+	{
+		kprintf("Usage: ramdisk name kbytes\n");
+		return EINVAL;
+	}
+
+	result = ramdisk_create(args[1],
+				atoi(args[2]) * (1024 / RAMDISK_BLOCKSIZE));
+	if (result)
+	{
+		kprintf("ramdisk: %s: %s\n", args[1], strerror(result));
+		return result;
+	}
+
+	return 0;
+}
+
+#if OPT_TMPFS
+/*
+ * Command for making a tmpfs, optionally of limited size.
+ */
+static int
+cmd_tmpfs(int nargs, char **args)
+{
+	unsigned maxpages = 0;
+	int result;
+
+	if (nargs != 2 && nargs != 3)
+	{
+		kprintf("Usage: tmpfs name [kbytes]\n");
+		return EINVAL;
+	}
+	if (nargs == 3)
+	{
+		maxpages = (atoi(args[2]) * 1024 + PAGE_SIZE - 1) / PAGE_SIZE;
+	}
+
+	result = tmpfs_create(args[1], maxpages);
+	if (result)
+	{
+		kprintf("tmpfs: %s: %s\n", args[1], strerror(result));
+		return result;
+	}
+
+	return 0;
+}
+#endif
+
 /*
  * Command for doing an intentional panic.
  */
@@ -401,6 +580,425 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+	kmem_cache_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for having the kernel's caches give back memory, as when it
+ * runs short.
+ */
+static int
+cmd_shrink(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	shrink_now();
+	kheap_printstats();
+	kmem_cache_printstats();
+
+	return 0;
+}
+
+#if OPT_KMALLOCPROF
+/*
+ * Command for printing the kernel heap profile.
+ */
+static int
+cmd_kheapprof(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmallocprof_print();
+
+	return 0;
+}
+
+/*
+ * Command for starting a new heap epoch.
+ */
+static int
+cmd_kheapepoch(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kprintf("Heap epoch is now %u\n", kmallocprof_newepoch());
+
+	return 0;
+}
+
+/*
+ * Command for listing blocks left over from earlier epochs: the last
+ * one, or all from the one given.
+ */
+static int
+cmd_kheapleaks(int nargs, char **args)
+{
+	unsigned epoch;
+
+	if (nargs > 2) {
+		kprintf("Usage: khl [epoch]\n");
+		return EINVAL;
+	}
+
+	epoch = kmallocprof_curepoch();
+	epoch = epoch > 0 ? epoch - 1 : 0;
+	if (nargs == 2) {
+		epoch = atoi(args[1]);
+	}
+	kmallocprof_printlive(epoch);
+
+	return 0;
+}
+#endif
+
+#if OPT_LOCKPROF
+/*
+ * Command for printing the most waited-for locks: ten, or as many as
+ * asked for.
+ */
+static int
+cmd_lockprof(int nargs, char **args)
+{
+	unsigned n;
+
+	if (nargs > 2) {
+		kprintf("Usage: lkp [count]\n");
+		return EINVAL;
+	}
+
+	n = 10;
+	if (nargs == 2) {
+		n = atoi(args[1]);
+	}
+	lockprof_print(n);
+
+	return 0;
+}
+
+/*
+ * Command for starting the lock profile over.
+ */
+static int
+cmd_lockprofreset(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lockprof_reset();
+	kprintf("Lock profile cleared\n");
+
+	return 0;
+}
+#endif
+
+#if OPT_A3
+/*
+ * Command for printing how physical memory is being used.
+ */
+static int
+cmd_memstats(int nargs, char **args)
+{
+	struct coremap_stats cs;
+
+	(void)nargs;
+	(void)args;
+
+	coremap_stats(&cs);
+	kprintf("Physical memory: %u frames (%u KB)\n", cs.cs_total,
+			cs.cs_total * PAGE_SIZE / 1024);
+	kprintf("    free   %6u (%u zeroed)\n", cs.cs_free, cs.cs_zeroed);
+	kprintf("    user   %6u\n", cs.cs_user);
+	kprintf("    kernel %6u\n", cs.cs_kernel);
+
+	return 0;
+}
+#endif
+
+/*
+ * Command for printing scheduling statistics.
+ */
+static int
+cmd_schedstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printschedstats();
+
+	return 0;
+}
+
+/*
+ * Command for printing system call statistics.
+ */
+static int
+cmd_syscallstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	syscall_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for printing interrupt statistics.
+ */
+static int
+cmd_irqstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	mainbus_printirqstats();
+
+	return 0;
+}
+
+/*
+ * Command for steering device interrupts: "irqroute IRQ CPU..." sends
+ * IRQ (or "all" of them) to the cpus named; "irqroute spread" gives
+ * each device a cpu of its own, in turn.
+ */
+static int
+cmd_irqroute(int nargs, char **args)
+{
+	uint32_t cpus = 0;
+	unsigned irq, cpu;
+	int i, result;
+
+	if (nargs == 2 && !strcmp(args[1], "spread")) {
+		mainbus_spread_irqs();
+		return 0;
+	}
+	if (nargs < 3) {
+		kprintf("Usage: irqroute irq|all cpu... | irqroute spread\n");
+		return EINVAL;
+	}
+
+	for (i=2; i<nargs; i++) {
+		cpu = atoi(args[i]);
+		if (cpu >= cpu_count()) {
+			kprintf("irqroute: no cpu %u\n", cpu);
+			return EINVAL;
+		}
+		cpus |= (uint32_t)1 << cpu;
+	}
+
+	if (!strcmp(args[1], "all")) {
+		/* (the cpus are good, so only a bad irq number stops it) */
+		for (irq=0; mainbus_route_irq(irq, cpus) == 0; irq++);
+		return 0;
+	}
+	result = mainbus_route_irq(atoi(args[1]), cpus);
+	if (result) {
+		kprintf("irqroute: %s\n", strerror(result));
+	}
+	return result;
+}
+
+/*
+ * Command for printing the kernel statistics.
+ */
+static int
+cmd_kstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kstat_print();
+
+	return 0;
+}
+
+/*
+ * Command for printing the device I/O statistics.
+ */
+static int
+cmd_iostats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	iostat_print();
+
+	return 0;
+}
+
+/*
+ * Command for watching the counters as they go: "stat SECS" prints a
+ * line every SECS seconds, "stat off" stops, and "stat" alone turns
+ * it on every second, or off if it is on.
+ */
+static int
+cmd_statwatch(int nargs, char **args)
+{
+	static bool on;
+	unsigned secs = 1;
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: stat [secs|off]\n");
+		return EINVAL;
+	}
+	if ((nargs == 1 && on) || (nargs == 2 && !strcmp(args[1], "off"))) {
+		statwatch_stop();
+		on = false;
+		return 0;
+	}
+	if (nargs == 2) {
+		secs = atoi(args[1]);
+		if (secs == 0) {
+			kprintf("Usage: stat [secs|off]\n");
+			return EINVAL;
+		}
+	}
+	result = statwatch_start(secs);
+	if (result) {
+		kprintf("stat: %s\n", strerror(result));
+		return result;
+	}
+	on = true;
+	return 0;
+}
+
+/*
+ * Command for printing the kernel log again.
+ */
+static int
+cmd_dmesg(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	klog_dmesg();
+
+	return 0;
+}
+
+/*
+ * Command for running the sampling profiler.
+ */
+static int
+cmd_prof(int nargs, char **args)
+{
+	int result;
+
+	if (nargs != 2) {
+		goto usage;
+	}
+	if (!strcmp(args[1], "start")) {
+		result = prof_start();
+		if (result) {
+			kprintf("prof: %s\n", strerror(result));
+			return result;
+		}
+		kprintf("Profiling started\n");
+	}
+	else if (!strcmp(args[1], "stop")) {
+		prof_stop();
+		kprintf("Profiling stopped\n");
+	}
+	else if (!strcmp(args[1], "dump")) {
+		result = prof_dump();
+		if (result == EBUSY) {
+			kprintf("prof: stop the profile first\n");
+		}
+		else if (result) {
+			kprintf("prof: %s\n", strerror(result));
+		}
+		return result;
+	}
+	else {
+		goto usage;
+	}
+	return 0;
+
+ usage:
+	kprintf("Usage: prof start|stop|dump\n");
+	return EINVAL;
+}
+
+/*
+ * Command for turning kernel event tracing on and off.
+ */
+static int
+cmd_ktrace(int nargs, char **args)
+{
+	if (nargs != 2 || (strcmp(args[1], "on") && strcmp(args[1], "off"))) {
+		kprintf("Usage: kt on|off\n");
+		return EINVAL;
+	}
+	ktrace_enable(!strcmp(args[1], "on"));
+	kprintf("Kernel event tracing %s\n", args[1]);
+
+	return 0;
+}
+
+/*
+ * Command for printing work queue statistics.
+ */
+static int
+cmd_workqstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	workqueue_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for choosing which DEBUG categories print: with no
+ * arguments, list them; otherwise turn on just those named ("all" and
+ * "none" do what they say).
+ */
+static int
+cmd_db(int nargs, char **args)
+{
+	const char *name;
+	uint32_t flags = 0;
+	unsigned bit;
+	int i;
+
+	if (nargs == 1) {
+		for (bit=0; (name = debug_catname(bit)) != NULL; bit++) {
+			kprintf("%-10s %s%s\n", name,
+				(dbflags & (1U << bit)) ? "on" : "off",
+				(DB_COMPILED & (1U << bit)) ? "" :
+				" (not built in)");
+		}
+		return 0;
+	}
+
+	for (i=1; i<nargs; i++) {
+		if (!strcmp(args[i], "all")) {
+			flags = DB_ALL;
+			continue;
+		}
+		if (!strcmp(args[i], "none")) {
+			flags = 0;
+			continue;
+		}
+		for (bit=0; (name = debug_catname(bit)) != NULL; bit++) {
+			if (!strcmp(args[i], name)) {
+				break;
+			}
+		}
+		if (name == NULL) {
+			kprintf("db: no category %s\n", args[i]);
+			return EINVAL;
+		}
+		flags |= 1U << bit;
+	}
+	dbflags = flags;
 
 	return 0;
 }
@@ -457,9 +1055,19 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+#if OPT_SFS
+	"[syncer]  Syncer settings [d a b m] ",
+#endif
+	"[iosched] Disk I/O scheduler        ",
+	"[vdisk]   Stripe or mirror disks    ",
+	"[ramdisk] Disk in memory [name kb]  ",
+#if OPT_TMPFS
+	"[tmpfs]   Make a tmpfs [name [kb]]  ",
+#endif
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	"[dth]     Enable DB_THREADS output  ",
+	"[db]      DEBUG categories [names]  ",
 	NULL};
 
 static int
@@ -474,18 +1082,28 @@ cmd_opsmenu(int n, char **a)
 
 static const char *testmenu[] = {
 	"[at]  Array test                    ",
-	"[bt]  Bitmap test                   ",
+	"[bt]  Bitmap test [bench]           ",
+	"[rgt] Ring test [prod] [cons] [n]   ",
+	"[lzt] LZ compression test [rounds]  ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
+	"[km3] kmalloc benchmark [pages]     ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tb] Context switch benchmark       ",
+	"[sch] Scheduler latency test [hogs] ",
+	"[slk] Spinlock test [threads] [n]   ",
+	"[wqt] Work queue test [count]       ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Reader-writer lock test       ",
+	"[sy5] Timed wait test               ",
+	"[synchbench] Synch benchmarks [n]   ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -513,9 +1131,25 @@ cmd_testmenu(int n, char **a)
 	return 0;
 }
 
+static int
+cmd_benchmenu(int n, char **a)
+{
+	(void)n;
+	(void)a;
+
+	kprintf("\n");
+	kprintf("OS/161 benchmarks menu\n");
+	kprintf("    [bench] name|all [samples] [warmup]\n");
+	kprintf("\n");
+	bench_print();
+	kprintf("\n");
+	return 0;
+}
+
 static const char *mainmenu[] = {
 	"[?o] Operations menu                ",
 	"[?t] Tests menu                     ",
+	"[?b] Benchmarks menu                ",
 #if OPT_SYNCHPROBS
 	"[sp1] Whale Mating                  ",
 #ifdef UW
@@ -523,7 +1157,31 @@ static const char *mainmenu[] = {
 	"[sp3] Traffic                       ",
 #endif /* UW */
 #endif
+	"[dmesg] Kernel log                  ",
+	"[io] Device I/O stats               ",
+	"[irq] Interrupt stats               ",
+	"[irqroute] Steer interrupts         ",
 	"[kh] Kernel heap stats              ",
+	"[kt] Kernel event tracing on|off    ",
+#if OPT_KMALLOCPROF
+	"[khp] Kernel heap profile           ",
+	"[khe] Start a new heap epoch        ",
+	"[khl] Heap blocks from old epochs   ",
+#endif
+#if OPT_LOCKPROF
+	"[lkp] Lock profile [count]          ",
+	"[lkz] Clear the lock profile        ",
+#endif
+#if OPT_A3
+	"[mem] Physical memory stats         ",
+#endif
+	"[sc] System call stats              ",
+	"[shrink] Shrink kernel caches       ",
+	"[kst] Kernel statistics             ",
+	"[prof] Profiler start|stop|dump     ",
+	"[ss] Scheduling statistics          ",
+	"[stat] Stream stats [secs|off]      ",
+	"[wq] Work queue stats               ",
 	"[q] Quit and shut down              ",
 	NULL};
 
@@ -552,6 +1210,7 @@ static struct
 	{"help", cmd_mainmenu},
 	{"?o", cmd_opsmenu},
 	{"?t", cmd_testmenu},
+	{"?b", cmd_benchmenu},
 
 	/* operations */
 	{"s", cmd_shell},
@@ -563,11 +1222,21 @@ static struct
 	{"cd", cmd_chdir},
 	{"pwd", cmd_pwd},
 	{"sync", cmd_sync},
+#if OPT_SFS
+	{"syncer", cmd_syncer},
+#endif
+	{"iosched", cmd_iosched},
+	{"vdisk", cmd_vdisk},
+	{"ramdisk", cmd_ramdisk},
+#if OPT_TMPFS
+	{"tmpfs", cmd_tmpfs},
+#endif
 	{"panic", cmd_panic},
 	{"q", cmd_quit},
 	{"exit", cmd_quit},
 	{"halt", cmd_quit},
 	{"dth", cmd_dth},
+	{"db", cmd_db},
 
 #if OPT_SYNCHPROBS
 	/* in-kernel synchronization problem(s) */
@@ -579,24 +1248,58 @@ static struct
 #endif
 
 	/* stats */
+	{"dmesg", cmd_dmesg},
+	{"irq", cmd_irqstats},
+	{"irqroute", cmd_irqroute},
 	{"kh", cmd_kheapstats},
+	{"shrink", cmd_shrink},
+	{"kt", cmd_ktrace},
+#if OPT_KMALLOCPROF
+	{"khp", cmd_kheapprof},
+	{"khe", cmd_kheapepoch},
+	{"khl", cmd_kheapleaks},
+#endif
+#if OPT_LOCKPROF
+	{"lkp", cmd_lockprof},
+	{"lkz", cmd_lockprofreset},
+#endif
+#if OPT_A3
+	{"mem", cmd_memstats},
+#endif
+	{"sc", cmd_syscallstats},
+	{"kst", cmd_kstats},
+	{"io", cmd_iostats},
+	{"prof", cmd_prof},
+	{"ss", cmd_schedstats},
+	{"stat", cmd_statwatch},
+	{"wq", cmd_workqstats},
 
 	/* base system tests */
 	{"at", arraytest},
 	{"bt", bitmaptest},
+	{"rgt", ringtest},
+	{"lzt", lztest},
 	{"km1", malloctest},
 	{"km2", mallocstress},
+	{"km3", mallocbench},
 #if OPT_NET
 	{"net", nettest},
 #endif
 	{"tt1", threadtest},
 	{"tt2", threadtest2},
 	{"tt3", threadtest3},
+	{"tb", threadbench},
+	{"sch", schedtest},
+	{"slk", spinlocktest},
+	{"wqt", workqtest},
 	{"sy1", semtest},
 
 	/* synchronization assignment tests */
 	{"sy2", locktest},
 	{"sy3", cvtest},
+	{"sy4", rwtest},
+	{"sy5", timedtest},
+	{"synchbench", synchbench},
 #ifdef UW
 	{"uw1", uwlocktest1},
 	{"uw2", uwvmstatstest},
@@ -609,6 +1312,9 @@ static struct
 	{"fs4", writestress2},
 	{"fs5", createstress},
 
+	/* benchmarks */
+	{"bench", benchcmd},
+
 	{NULL, NULL}};
 
 /*
@@ -617,8 +1323,7 @@ static struct
 static int
 cmd_dispatch(char *cmd)
 {
-	time_t beforesecs, aftersecs, secs;
-	uint32_t beforensecs, afternsecs, nsecs;
+	uint64_t before, took;
 	char *args[MAXMENUARGS];
 	int nargs = 0;
 	char *word;
@@ -649,18 +1354,15 @@ cmd_dispatch(char *cmd)
 		{
 			KASSERT(cmdtable[i].func != NULL);
 
-			gettime(&beforesecs, &beforensecs);
+			before = clock_monotonic_ns();
 
 			result = cmdtable[i].func(nargs, args);
 
-			gettime(&aftersecs, &afternsecs);
-			getinterval(beforesecs, beforensecs,
-						aftersecs, afternsecs,
-						&secs, &nsecs);
+			took = clock_monotonic_ns() - before;
 
 			kprintf("Operation took %lu.%09lu seconds\n",
-					(unsigned long)secs,
-					(unsigned long)nsecs);
+					(unsigned long)(took / 1000000000),
+					(unsigned long)(took % 1000000000));
 
 			return result;
 		}
@@ -34,6 +34,7 @@
 #include <thread.h>
 #include <synch.h>
 #include <synchprobs.h>
+#include <simstat.h>
 
 /* An animal number that won't ever be used */
 #define INVALID_ANIMAL_NUM  (999999)
@@ -44,6 +45,7 @@ static int do_print_state = 0;
 /* functions defined and used internally */
 static void initialize_bowls(void);
 static void cleanup_bowls(void);
+static void report_stats(void);
 static void cat_eat(unsigned int bowlnumber, int eat_time, unsigned int cat_num);
 static void cat_sleep(int sleep_time);
 static void mouse_eat(unsigned int bowlnumber, int eat_time, unsigned int mouse_num);
@@ -143,6 +145,14 @@ static volatile int mouse_wait_count;
 /* mutex to provide mutual exclusion to performance stats */
 static struct semaphore *perf_mutex;
 
+/* each wait, by cat and by mouse (under perf_mutex), and
+ * how many bowls are in use over time (under mutex) */
+static struct waitstat *cat_waits;
+static struct waitstat *mouse_waits;
+static struct occstat *bowl_occupancy;
+static const char *const cat_class[] = { "cat" };
+static const char *const mouse_class[] = { "mouse" };
+
 
 /*
  * initialize_bowls()
@@ -192,6 +202,13 @@ initialize_bowls()
   mouse_total_wait_secs = 0;
   mouse_total_wait_nsecs = 0;
   mouse_wait_count = 0;
+
+  cat_waits = waitstat_create(NumCats*NumLoops, NumCats, 1, cat_class);
+  mouse_waits = waitstat_create(NumMice*NumLoops, NumMice, 1, mouse_class);
+  bowl_occupancy = occstat_create(2*(NumCats+NumMice)*NumLoops, NumBowls);
+  if (cat_waits == NULL || mouse_waits == NULL || bowl_occupancy == NULL) {
+    panic("initialize_bowls: unable to allocate space for statistics\n");
+  }
   
   return;
 }
@@ -227,6 +244,32 @@ cleanup_bowls()
   }
 }
 
+/*
+ * report_stats()
+ * 
+ * Purpose:
+ *   Prints the wait time distributions, and releases
+ *   what initialize_bowls made for them.
+ *
+ * Arguments:
+ *   None
+ *
+ * Returns:
+ *   Nothing
+ */
+
+static void
+report_stats()
+{
+  waitstat_report(cat_waits, "cat");
+  waitstat_report(mouse_waits, "mouse");
+  waitstat_destroy(cat_waits);
+  waitstat_destroy(mouse_waits);
+  occstat_destroy(bowl_occupancy);
+  cat_waits = mouse_waits = NULL;
+  bowl_occupancy = NULL;
+}
+
 /*
  * print_state_on/off()
  * 
@@ -348,6 +391,7 @@ cat_eat(unsigned int bowlnumber, int eat_time, unsigned int cat_num)
 
   /* now update the state to indicate that the cat is eating */
   eating_cats_count += 1;
+  occstat_record(bowl_occupancy, eating_cats_count);
   bowls[bowlnumber-1].animal = 'c';
   bowls[bowlnumber-1].which = cat_num;
   print_state();
@@ -366,6 +410,7 @@ cat_eat(unsigned int bowlnumber, int eat_time, unsigned int cat_num)
   KASSERT(eating_cats_count > 0);
   KASSERT(bowls[bowlnumber-1].animal=='c');
   eating_cats_count -= 1;
+  occstat_record(bowl_occupancy, eating_cats_count);
   bowls[bowlnumber-1].animal='-';
   bowls[bowlnumber-1].which=INVALID_ANIMAL_NUM;
   print_state();
@@ -443,6 +488,7 @@ mouse_eat(unsigned int bowlnumber, int eat_time, unsigned int mouse_num)
 
   /* now update the state to indicate that the mouse is eating */
   eating_mice_count += 1;
+  occstat_record(bowl_occupancy, eating_mice_count);
   bowls[bowlnumber-1].animal = 'm';
   bowls[bowlnumber-1].which = mouse_num;
   print_state();
@@ -461,6 +507,7 @@ mouse_eat(unsigned int bowlnumber, int eat_time, unsigned int mouse_num)
 
   KASSERT(eating_mice_count > 0);
   eating_mice_count -= 1;
+  occstat_record(bowl_occupancy, eating_mice_count);
   KASSERT(bowls[bowlnumber-1].animal=='m');
   KASSERT(bowls[bowlnumber-1].which==mouse_num);
   bowls[bowlnumber-1].animal='-';
@@ -549,6 +596,7 @@ cat_simulation(void * unusedpointer,
       cat_total_wait_secs ++;
     }
     cat_wait_count++;
+    waitstat_record(cat_waits, catnumber, 0, wait_sec*1000000 + wait_nsec/1000);
     V(perf_mutex);
   }
 
@@ -612,6 +660,7 @@ mouse_simulation(void * unusedpointer,
       mouse_total_wait_secs ++;
     }
     mouse_wait_count++;
+    waitstat_record(mouse_waits, mousenumber, 0, wait_sec*1000000 + wait_nsec/1000);
     V(perf_mutex);
   }
 
@@ -767,6 +816,7 @@ catmouse(int nargs,
 
   /* get current time, for measuring total simulation time */
   gettime(&after_sec,&after_nsec);
+  occstat_stop(bowl_occupancy);
   /* compute total simulation time */
   getinterval(before_sec,before_nsec,after_sec,after_nsec,&wait_sec,&wait_nsec);
   /* compute and report bowl utilization */
@@ -776,6 +826,7 @@ catmouse(int nargs,
     utilization_percent = total_eating_milliseconds*100/total_bowl_milliseconds;
     kprintf("STATS: Bowl utilization: %d%%\n",utilization_percent);
   }
+  occstat_report(bowl_occupancy, "bowls");
 
   /* clean up the semaphore that we created */
   sem_destroy(CatMouseWait);
@@ -798,6 +849,7 @@ catmouse(int nargs,
     kprintf("STATS: Mean mouse waiting time: %d.%d seconds\n",
              mean_mouse_wait_usecs/1000000,mean_mouse_wait_usecs%1000000);
   }
+  report_stats();
 
   return 0;
 }
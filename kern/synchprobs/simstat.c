@@ -0,0 +1,391 @@
+/*
+ * Wait and occupancy measurements for the synchronization problem
+ * drivers. See simstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <simstat.h>
+
+#define OCC_SLICES 10		/* parts of the run for the timeline */
+
+struct waitstat {
+	unsigned ws_max;		/* room for this many waits */
+	unsigned ws_n;			/* waits kept */
+	unsigned ws_dropped;		/* waits past ws_max */
+	unsigned ws_nactors;
+	unsigned ws_nclasses;
+	const char *const *ws_classnames;
+	uint32_t *ws_usecs;		/* each wait */
+	unsigned char *ws_class;	/* and its class */
+	uint64_t *ws_actortotal;	/* by actor */
+	uint32_t *ws_actormax;
+	unsigned *ws_actorcount;
+};
+
+struct occevent {
+	uint64_t oe_ns;			/* since the start */
+	unsigned oe_level;
+};
+
+struct occstat {
+	unsigned os_max;
+	unsigned os_n;
+	unsigned os_dropped;
+	unsigned os_capacity;
+	uint64_t os_start;
+	uint64_t os_end;		/* since the start; 0 until stopped */
+	struct occevent *os_events;
+	uint64_t *os_atlevel;		/* ns spent at each, for the report */
+};
+
+/*
+ * Sort V, of N, for the percentiles; as bench.c does.
+ */
+static
+void
+simstat_sort(uint32_t *v, unsigned n)
+{
+	unsigned gap, i, j;
+	uint32_t t;
+
+	for (gap = n/2; gap > 0; gap /= 2) {
+		for (i=gap; i<n; i++) {
+			t = v[i];
+			for (j=i; j>=gap && v[j-gap] > t; j-=gap) {
+				v[j] = v[j-gap];
+			}
+			v[j] = t;
+		}
+	}
+}
+
+/*
+ * The Pth percentile of sorted V, of N > 0.
+ */
+static
+uint32_t
+simstat_pct(const uint32_t *v, unsigned n, unsigned p)
+{
+	unsigned i = (n * p) / 100;
+
+	return v[i < n ? i : n-1];
+}
+
+////////////////////////////////////////////////////////////
+//
+// Waits
+
+struct waitstat *
+waitstat_create(unsigned max, unsigned nactors, unsigned nclasses,
+		const char *const *classnames)
+{
+	struct waitstat *ws;
+
+	KASSERT(nclasses > 0 && nclasses <= 256);
+
+	ws = kmalloc(sizeof(*ws));
+	if (ws == NULL) {
+		return NULL;
+	}
+	ws->ws_max = max;
+	ws->ws_n = 0;
+	ws->ws_dropped = 0;
+	ws->ws_nactors = nactors;
+	ws->ws_nclasses = nclasses;
+	ws->ws_classnames = classnames;
+	ws->ws_usecs = kmalloc((max ? max : 1) * sizeof(uint32_t));
+	ws->ws_class = kmalloc(max ? max : 1);
+	ws->ws_actortotal = kmalloc((nactors ? nactors : 1) *
+				    sizeof(uint64_t));
+	ws->ws_actormax = kmalloc((nactors ? nactors : 1) * sizeof(uint32_t));
+	ws->ws_actorcount = kmalloc((nactors ? nactors : 1) *
+				    sizeof(unsigned));
+	if (ws->ws_usecs == NULL || ws->ws_class == NULL ||
+	    ws->ws_actortotal == NULL || ws->ws_actormax == NULL ||
+	    ws->ws_actorcount == NULL) {
+		waitstat_destroy(ws);
+		return NULL;
+	}
+	if (nactors > 0) {
+		bzero(ws->ws_actortotal, nactors * sizeof(uint64_t));
+		bzero(ws->ws_actormax, nactors * sizeof(uint32_t));
+		bzero(ws->ws_actorcount, nactors * sizeof(unsigned));
+	}
+	return ws;
+}
+
+void
+waitstat_destroy(struct waitstat *ws)
+{
+	/* (kfree(NULL) does nothing) */
+	kfree(ws->ws_usecs);
+	kfree(ws->ws_class);
+	kfree(ws->ws_actortotal);
+	kfree(ws->ws_actormax);
+	kfree(ws->ws_actorcount);
+	kfree(ws);
+}
+
+void
+waitstat_record(struct waitstat *ws, unsigned actor, unsigned class,
+		uint32_t usecs)
+{
+	KASSERT(actor < ws->ws_nactors);
+	KASSERT(class < ws->ws_nclasses);
+
+	if (ws->ws_n < ws->ws_max) {
+		ws->ws_usecs[ws->ws_n] = usecs;
+		ws->ws_class[ws->ws_n] = class;
+		ws->ws_n++;
+	}
+	else {
+		ws->ws_dropped++;
+	}
+	ws->ws_actortotal[actor] += usecs;
+	ws->ws_actorcount[actor]++;
+	if (usecs > ws->ws_actormax[actor]) {
+		ws->ws_actormax[actor] = usecs;
+	}
+}
+
+/*
+ * One line for the waits in V, of N > 0, sorted here.
+ */
+static
+void
+waitstat_line(const char *name, uint32_t *v, unsigned n)
+{
+	uint64_t total = 0;
+	uint32_t mean, p50, p90, p99, max;
+	unsigned i;
+
+	simstat_sort(v, n);
+	for (i=0; i<n; i++) {
+		total += v[i];
+	}
+	mean = total / n;
+	p50 = simstat_pct(v, n, 50);
+	p90 = simstat_pct(v, n, 90);
+	p99 = simstat_pct(v, n, 99);
+	max = v[n-1];
+	kprintf("STATS: %s waits: %u, mean %u.%03u median %u.%03u "
+		"p90 %u.%03u p99 %u.%03u max %u.%03u seconds\n", name, n,
+		mean / 1000000, mean / 1000 % 1000,
+		p50 / 1000000, p50 / 1000 % 1000,
+		p90 / 1000000, p90 / 1000 % 1000,
+		p99 / 1000000, p99 / 1000 % 1000,
+		max / 1000000, max / 1000 % 1000);
+}
+
+void
+waitstat_report(struct waitstat *ws, const char *actorname)
+{
+	uint32_t *v;
+	uint32_t mean, hi = 0, lo = 0, worst = 0;
+	unsigned c, i, n, nseen = 0;
+	unsigned hiactor = 0, loactor = 0, worstactor = 0;
+
+	if (ws->ws_dropped > 0) {
+		kprintf("STATS: %u %s waits past the first %u are only in "
+			"the per-%s figures\n", ws->ws_dropped, actorname,
+			ws->ws_max, actorname);
+	}
+	if (ws->ws_n == 0) {
+		return;
+	}
+
+	v = kmalloc(ws->ws_n * sizeof(uint32_t));
+	if (v == NULL) {
+		kprintf("STATS: no memory for the %s wait percentiles\n",
+			actorname);
+		return;
+	}
+	for (c=0; c<ws->ws_nclasses; c++) {
+		n = 0;
+		for (i=0; i<ws->ws_n; i++) {
+			if (ws->ws_class[i] == c) {
+				v[n++] = ws->ws_usecs[i];
+			}
+		}
+		if (n > 0) {
+			waitstat_line(ws->ws_classnames[c], v, n);
+		}
+	}
+	if (ws->ws_nclasses > 1) {
+		memcpy(v, ws->ws_usecs, ws->ws_n * sizeof(uint32_t));
+		waitstat_line("all", v, ws->ws_n);
+	}
+	kfree(v);
+
+	/* Starvation: who waited longest, and how unevenly */
+	for (i=0; i<ws->ws_nactors; i++) {
+		if (ws->ws_actorcount[i] == 0) {
+			continue;
+		}
+		mean = ws->ws_actortotal[i] / ws->ws_actorcount[i];
+		if (nseen == 0 || mean > hi) {
+			hi = mean;
+			hiactor = i;
+		}
+		if (nseen == 0 || mean < lo) {
+			lo = mean;
+			loactor = i;
+		}
+		if (nseen == 0 || ws->ws_actormax[i] > worst) {
+			worst = ws->ws_actormax[i];
+			worstactor = i;
+		}
+		nseen++;
+	}
+	if (nseen > 1) {
+		kprintf("STATS: longest wait %s %u, %u.%03u seconds; "
+			"mean wait by %s from %u.%03u (%s %u) to %u.%03u "
+			"(%s %u)\n", actorname, worstactor,
+			worst / 1000000, worst / 1000 % 1000, actorname,
+			lo / 1000000, lo / 1000 % 1000, actorname, loactor,
+			hi / 1000000, hi / 1000 % 1000, actorname, hiactor);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Occupancy
+
+struct occstat *
+occstat_create(unsigned max, unsigned capacity)
+{
+	struct occstat *os;
+
+	os = kmalloc(sizeof(*os));
+	if (os == NULL) {
+		return NULL;
+	}
+	os->os_max = max;
+	os->os_n = 0;
+	os->os_dropped = 0;
+	os->os_capacity = capacity;
+	os->os_events = kmalloc((max ? max : 1) * sizeof(struct occevent));
+	os->os_atlevel = kmalloc((capacity + 1) * sizeof(uint64_t));
+	if (os->os_events == NULL || os->os_atlevel == NULL) {
+		occstat_destroy(os);
+		return NULL;
+	}
+	os->os_start = clock_monotonic_ns();
+	os->os_end = 0;
+	return os;
+}
+
+void
+occstat_destroy(struct occstat *os)
+{
+	kfree(os->os_events);
+	kfree(os->os_atlevel);
+	kfree(os);
+}
+
+void
+occstat_record(struct occstat *os, unsigned level)
+{
+	KASSERT(level <= os->os_capacity);
+
+	if (os->os_n == os->os_max) {
+		os->os_dropped++;
+		return;
+	}
+	os->os_events[os->os_n].oe_ns = clock_monotonic_ns() - os->os_start;
+	os->os_events[os->os_n].oe_level = level;
+	os->os_n++;
+}
+
+void
+occstat_stop(struct occstat *os)
+{
+	if (os->os_end == 0) {
+		os->os_end = clock_monotonic_ns() - os->os_start;
+	}
+}
+
+/*
+ * Count LEVEL from time A to B into the slices of length SLICE.
+ */
+static
+void
+occstat_addspan(uint64_t *slices, uint64_t slice, uint64_t a, uint64_t b,
+		unsigned level)
+{
+	uint64_t e;
+	unsigned s;
+
+	while (a < b) {
+		s = a / slice;
+		if (s >= OCC_SLICES - 1) {
+			s = OCC_SLICES - 1;
+			e = b;
+		}
+		else {
+			e = (s + 1) * slice;
+			if (e > b) {
+				e = b;
+			}
+		}
+		slices[s] += (e - a) * level;
+		a = e;
+	}
+}
+
+void
+occstat_report(struct occstat *os, const char *what)
+{
+	uint64_t slices[OCC_SLICES];
+	uint64_t end, slice, from, to, len, total = 0;
+	unsigned i, level, peak = 0, hundredths;
+
+	occstat_stop(os);
+	end = os->os_end;
+	slice = end / OCC_SLICES;
+	if (slice == 0) {
+		return;
+	}
+	bzero(slices, sizeof(slices));
+	bzero(os->os_atlevel, (os->os_capacity + 1) * sizeof(uint64_t));
+
+	/* Each level lasts from its change to the next; 0 until the first */
+	from = 0;
+	level = 0;
+	for (i=0; i<=os->os_n; i++) {
+		to = i < os->os_n ? os->os_events[i].oe_ns : end;
+		os->os_atlevel[level] += to - from;
+		total += (to - from) * level;
+		occstat_addspan(slices, slice, from, to, level);
+		if (i < os->os_n) {
+			from = to;
+			level = os->os_events[i].oe_level;
+			if (level > peak) {
+				peak = level;
+			}
+		}
+	}
+
+	if (os->os_dropped > 0) {
+		kprintf("STATS: %s changes after the first %u not kept\n",
+			what, os->os_max);
+	}
+	hundredths = total * 100 / end;
+	kprintf("STATS: %s in use: mean %u.%02u of %u, peak %u\n", what,
+		hundredths / 100, hundredths % 100, os->os_capacity, peak);
+	kprintf("STATS: %s in use, share of time:", what);
+	for (i=0; i<=os->os_capacity; i++) {
+		kprintf(" %u:%u%%", i, (unsigned)(os->os_atlevel[i] * 100 / end));
+	}
+	kprintf("\n");
+	kprintf("STATS: %s in use, mean by tenth of the run:", what);
+	for (i=0; i<OCC_SLICES; i++) {
+		len = i < OCC_SLICES - 1 ? slice :
+			end - slice * (OCC_SLICES - 1);
+		hundredths = slices[i] * 100 / len;
+		kprintf(" %u.%02u", hundredths / 100, hundredths % 100);
+	}
+	kprintf("\n");
+}
@@ -27,6 +27,7 @@
 #include <thread.h>
 #include <synch.h>
 #include <synchprobs.h>
+#include <simstat.h>
 #include <lamebus/ltimer.h>
 #include <kern/errno.h>
 
@@ -80,6 +81,10 @@ typedef struct Vehicles
 static Vehicle * volatile vehicles[MAX_THREADS];
 /* semaphore to protect vehicles array */
 static struct semaphore *mutex;
+/* how many vehicles are in the intersection, and how many
+   have been over time; under mutex too */
+static volatile int vehicles_inside;
+static struct occstat *occupancy;
 
 /* performance statistics, one set per origin direction */
 static volatile time_t total_wait_secs[4];
@@ -87,6 +92,9 @@ static volatile uint32_t total_wait_nsecs[4];
 static volatile int wait_count[4];
 static volatile time_t max_wait_secs[4];
 static volatile uint32_t max_wait_nsecs[4];
+/* each wait, by thread and origin direction, also under perf_mutex */
+static struct waitstat *waits;
+static const char *const direction_names[4] = { "N", "E", "S", "W" };
 /* mutex to provide mutual exclusion to performance stats */
 static struct semaphore *perf_mutex;
 /* number of milliseconds per timer tick (LT_GRANULARITY is in usec) */
@@ -237,6 +245,9 @@ print_perf_stats(void) {
 	  sim_msec/1000,
 	  sim_msec%1000,
 	  total_count);
+  /* and how the waits were spread, and how busy the intersection was */
+  waitstat_report(waits, "thread");
+  occstat_report(occupancy, "intersection");
 } 
 
 
@@ -349,6 +360,13 @@ initialize_state(void)
   if (perf_mutex == NULL) {
     panic("could not create perf_mutex semaphore\n");
   }
+  vehicles_inside = 0;
+  occupancy = occstat_create(2*NumThreads*NumIterations, NumThreads);
+  waits = waitstat_create(NumThreads*NumIterations, NumThreads, 4,
+                          direction_names);
+  if (occupancy == NULL || waits == NULL) {
+    panic("could not create performance statistics\n");
+  }
   SimulationWait = sem_create("SimulationWait",0);
   if (SimulationWait == NULL) {
     panic("could not create SimulationWait semaphore\n");
@@ -379,6 +397,8 @@ cleanup_state(void)
   sem_destroy(mutex);
   sem_destroy(perf_mutex);
   sem_destroy(SimulationWait);
+  occstat_destroy(occupancy);
+  waitstat_destroy(waits);
   intersection_sync_cleanup();
 }
 
@@ -473,6 +493,8 @@ vehicle_simulation(void * unusedpointer,
     P(mutex);
     KASSERT(vehicles[thread_num] == NULL);
     vehicles[thread_num] = &v;
+    vehicles_inside++;
+    occstat_record(occupancy, vehicles_inside);
 
     /* check to make sure that the synchronization constraints have
        not been violated */
@@ -488,6 +510,8 @@ vehicle_simulation(void * unusedpointer,
     P(mutex);
     KASSERT(vehicles[thread_num] == &v);
     vehicles[thread_num] = NULL;
+    vehicles_inside--;
+    occstat_record(occupancy, vehicles_inside);
     V(mutex);
 
     /* invoke synchronization exit function */
@@ -502,6 +526,7 @@ vehicle_simulation(void * unusedpointer,
       total_wait_secs[v.origin] ++;
     }
     wait_count[v.origin]++;
+    waitstat_record(waits, thread_num, v.origin, wait_sec*1000000 + wait_nsec/1000);
     if (wait_sec > max_wait_secs[v.origin]) {
       max_wait_secs[v.origin] = wait_sec;
       max_wait_nsecs[v.origin] = wait_nsec;
@@ -600,13 +625,14 @@ traffic_simulation(int nargs,
 
   /* get simulation end time */
   gettime(&end_sec,&end_nsec);
-
-  /* clean up the simulation state */
-  cleanup_state();
+  occstat_stop(occupancy);
 
   /* display performance stats */
   print_perf_stats();
 
+  /* clean up the simulation state */
+  cleanup_state();
+
   return 0;
 }
 
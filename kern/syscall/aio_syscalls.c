@@ -0,0 +1,353 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/aio.h>
+#include <lib.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <thread.h>
+#include <synch.h>
+#include <atomic.h>
+#include <copyinout.h>
+#include <file.h>
+#include <aio.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+
+/*
+ * Asynchronous I/O (see kern/aio.h for the rings).
+ *
+ * aio_setup gives the process a context pointing at its rings, which
+ * stay in user memory and are read and written with copyin and
+ * copyout. aio_enter takes what has been submitted onto a queue of
+ * requests, and up to AIO_NWORKERS kernel threads of the process (so
+ * that they are in its address space and see its descriptors) take
+ * them off and do each one as pread/pwrite or read/write would. A
+ * worker posts each completion as it finishes and goes away when the
+ * queue is empty, so an idle process has only its own threads left
+ * and execv still works.
+ *
+ * Requests are counted in ac_inflight from when they are taken until
+ * their completion is posted; aio_enter takes no more than the room
+ * left in the completion ring after those and the completions not
+ * yet consumed.
+ *
+ * The context is not inherited by fork, and goes away at execv or
+ * when the process is destroyed.
+ */
+
+#define AIO_NWORKERS 4
+
+struct aio_req {
+  struct aio_req *ar_next;
+  struct aio_sqe ar_sqe;
+};
+
+struct aio_ctx {
+  struct aio_rings *ac_rings;  /* user address */
+  struct lock *ac_lock;
+  struct cv *ac_cv;            /* a completion, or a worker left */
+  struct aio_req *ac_head;     /* queued, not yet started */
+  struct aio_req *ac_tail;
+  unsigned ac_sqhead;          /* our copies of the kernel's counters */
+  unsigned ac_cqtail;
+  unsigned ac_inflight;
+  unsigned ac_nworkers;
+};
+
+void aio_destroy(struct aio_ctx *ac)
+{
+  struct aio_req *req;
+
+  KASSERT(ac->ac_nworkers == 0);
+  while (ac->ac_head != NULL)
+  {
+    req = ac->ac_head;
+    ac->ac_head = req->ar_next;
+    kfree(req);
+  }
+  cv_destroy(ac->ac_cv);
+  lock_destroy(ac->ac_lock);
+  kfree(ac);
+}
+
+/*
+ * aio_setup(rings): use RINGS for this process's asynchronous I/O,
+ * with all four counters starting at 0. Fails with EBUSY if it has
+ * done so already.
+ */
+int sys_aio_setup(userptr_t rings)
+{
+  struct proc *p = curproc;
+  struct aio_ctx *ac;
+  unsigned zero[4] = { 0, 0, 0, 0 };
+  int err;
+
+  if (rings == NULL)
+  {
+    return EFAULT;
+  }
+  /* the counters come first; see kern/aio.h */
+  err = copyout(zero, rings, sizeof(zero));
+  if (err)
+  {
+    return err;
+  }
+
+  ac = kmalloc(sizeof(*ac));
+  if (ac == NULL)
+  {
+    return ENOMEM;
+  }
+  ac->ac_lock = lock_create("aio");
+  ac->ac_cv = cv_create("aio");
+  if (ac->ac_lock == NULL || ac->ac_cv == NULL)
+  {
+    err = ENOMEM;
+    goto fail;
+  }
+  ac->ac_rings = (struct aio_rings *)rings;
+  ac->ac_head = ac->ac_tail = NULL;
+  ac->ac_sqhead = ac->ac_cqtail = 0;
+  ac->ac_inflight = 0;
+  ac->ac_nworkers = 0;
+
+  lock_acquire(p->p_tlock);
+  err = p->p_aio != NULL ? EBUSY : 0;
+  if (err == 0)
+  {
+    p->p_aio = ac;
+  }
+  lock_release(p->p_tlock);
+  if (err)
+  {
+    goto fail;
+  }
+  return 0;
+
+fail:
+  if (ac->ac_cv != NULL)
+  {
+    cv_destroy(ac->ac_cv);
+  }
+  if (ac->ac_lock != NULL)
+  {
+    lock_destroy(ac->ac_lock);
+  }
+  kfree(ac);
+  return err;
+}
+
+/*
+ * Post REQ's completion with RESULT (bytes, or minus the error). The
+ * entry goes out before the tail that shows it. ac_lock held.
+ */
+static void aio_complete(struct aio_ctx *ac, struct aio_req *req, int result)
+{
+  struct aio_rings *rings = ac->ac_rings;
+  struct aio_cqe cqe;
+
+  cqe.cqe_tag = req->ar_sqe.sqe_tag;
+  cqe.cqe_result = result;
+  /*
+   * If the process has unmapped its rings there is no one to tell;
+   * the request still counts as done.
+   */
+  if (copyout(&cqe, (userptr_t)&rings->ar_cq[ac->ac_cqtail % AIO_RINGSIZE],
+              sizeof(cqe)) == 0)
+  {
+    membar_sync();
+    ac->ac_cqtail++;
+    copyout(&ac->ac_cqtail, (userptr_t)&rings->ar_cqtail,
+            sizeof(ac->ac_cqtail));
+  }
+  ac->ac_inflight--;
+  cv_broadcast(ac->ac_cv, ac->ac_lock);
+}
+
+static void aio_worker(void *data1, unsigned long data2)
+{
+  struct aio_ctx *ac = data1;
+  struct proc *p = curproc;
+  struct aio_req *req;
+  struct aio_sqe *sqe;
+  int result, err;
+
+  (void)data2;
+
+  lock_acquire(ac->ac_lock);
+  while (ac->ac_head != NULL && !p->p_exiting)
+  {
+    req = ac->ac_head;
+    ac->ac_head = req->ar_next;
+    lock_release(ac->ac_lock);
+
+    sqe = &req->ar_sqe;
+    err = file_io(sqe->sqe_fd, (userptr_t)sqe->sqe_buf, sqe->sqe_len,
+                  sqe->sqe_offset < 0 ? NULL : &sqe->sqe_offset,
+                  sqe->sqe_op == AIO_READ ? UIO_READ : UIO_WRITE, &result);
+
+    lock_acquire(ac->ac_lock);
+    aio_complete(ac, req, err ? -err : result);
+    kfree(req);
+  }
+  ac->ac_nworkers--;
+  cv_broadcast(ac->ac_cv, ac->ac_lock);
+  lock_release(ac->ac_lock);
+
+  /* requests left behind by an exiting process go with the context */
+  sys_thread_exit(NULL);
+}
+
+/*
+ * Start another worker if there is work for it. ac_lock held.
+ */
+static int aio_addworker(struct aio_ctx *ac)
+{
+  struct proc *p = curproc;
+  int err;
+
+  if (ac->ac_nworkers >= AIO_NWORKERS || ac->ac_nworkers >= ac->ac_inflight)
+  {
+    return 0;
+  }
+  /* as thread_create, fork under p_tlock */
+  lock_acquire(p->p_tlock);
+  err = p->p_exiting ? EINTR : thread_fork("aio", p, aio_worker, ac, 0);
+  lock_release(p->p_tlock);
+  if (err == 0)
+  {
+    ac->ac_nworkers++;
+  }
+  return err;
+}
+
+/*
+ * Take the requests submitted since the last call, as many as there
+ * is room for; put the number taken in *TAKEN. ac_lock held.
+ */
+static int aio_submit(struct aio_ctx *ac, unsigned *taken)
+{
+  struct aio_rings *rings = ac->ac_rings;
+  struct aio_req *req;
+  unsigned sqtail, cqhead, room;
+  int err, forkerr;
+
+  *taken = 0;
+  err = copyin((const_userptr_t)&rings->ar_sqtail, &sqtail, sizeof(sqtail));
+  if (err == 0)
+  {
+    err = copyin((const_userptr_t)&rings->ar_cqhead, &cqhead, sizeof(cqhead));
+  }
+  if (err)
+  {
+    return err;
+  }
+  if (sqtail - ac->ac_sqhead > AIO_RINGSIZE ||
+      ac->ac_cqtail - cqhead + ac->ac_inflight > AIO_RINGSIZE)
+  {
+    return EINVAL;
+  }
+  room = AIO_RINGSIZE - (ac->ac_cqtail - cqhead) - ac->ac_inflight;
+
+  while (ac->ac_sqhead != sqtail && *taken < room)
+  {
+    req = kmalloc(sizeof(*req));
+    if (req == NULL)
+    {
+      err = ENOMEM;
+      break;
+    }
+    err = copyin((const_userptr_t)&rings->ar_sq[ac->ac_sqhead % AIO_RINGSIZE],
+                 &req->ar_sqe, sizeof(req->ar_sqe));
+    if (err)
+    {
+      kfree(req);
+      break;
+    }
+    ac->ac_sqhead++;
+    req->ar_next = NULL;
+    if (req->ar_sqe.sqe_op != AIO_READ && req->ar_sqe.sqe_op != AIO_WRITE)
+    {
+      /* bad requests complete at once, and count as taken */
+      ac->ac_inflight++;
+      aio_complete(ac, req, -EINVAL);
+      kfree(req);
+    }
+    else
+    {
+      if (ac->ac_head == NULL)
+      {
+        ac->ac_head = req;
+      }
+      else
+      {
+        ac->ac_tail->ar_next = req;
+      }
+      ac->ac_tail = req;
+      ac->ac_inflight++;
+      forkerr = aio_addworker(ac);
+      if (forkerr && ac->ac_nworkers == 0)
+      {
+        /* nobody to do it, so it is the only one queued; fail it */
+        ac->ac_head = ac->ac_tail = NULL;
+        aio_complete(ac, req, -forkerr);
+        kfree(req);
+      }
+    }
+    (*taken)++;
+  }
+
+  if (*taken > 0)
+  {
+    copyout(&ac->ac_sqhead, (userptr_t)&rings->ar_sqhead,
+            sizeof(ac->ac_sqhead));
+  }
+  /* if something was taken, report that, not the error */
+  return *taken > 0 ? 0 : err;
+}
+
+/*
+ * aio_enter(min_complete): take what has been submitted, then wait
+ * until at least MIN_COMPLETE completions are waiting to be consumed,
+ * or nothing more is in progress. Returns the number of requests
+ * taken. Fails with EINTR if the process is ended meanwhile.
+ */
+int sys_aio_enter(unsigned min_complete, int *retval)
+{
+  struct proc *p = curproc;
+  struct aio_ctx *ac = p->p_aio;
+  unsigned taken, cqhead;
+  int err;
+
+  if (ac == NULL)
+  {
+    return EINVAL;
+  }
+  lock_acquire(ac->ac_lock);
+  err = aio_submit(ac, &taken);
+  while (err == 0 && ac->ac_inflight > 0 && !p->p_exiting)
+  {
+    err = copyin((const_userptr_t)&ac->ac_rings->ar_cqhead, &cqhead,
+                 sizeof(cqhead));
+    if (err || ac->ac_cqtail - cqhead >= min_complete)
+    {
+      break;
+    }
+    cv_wait(ac->ac_cv, ac->ac_lock);
+  }
+  if (err == 0 && p->p_exiting)
+  {
+    err = EINTR;
+  }
+  lock_release(ac->ac_lock);
+  if (err)
+  {
+    return err;
+  }
+  *retval = taken;
+  return 0;
+}
+
+#endif /* OPT_A3 */
@@ -0,0 +1,264 @@
+/*
+ * Open files and file descriptor tables. See file.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/unistd.h>
+#include <lib.h>
+#include <atomic.h>
+#include <bitmap.h>
+#include <synch.h>
+#include <vfs.h>
+#include <file.h>
+
+////////////////////////////////////////////////////////////
+//
+// Open files
+
+int
+openfile_open(char *path, int flags, mode_t mode, struct openfile **ret)
+{
+	return openfile_openat(NULL, path, flags, mode, ret);
+}
+
+int
+openfile_openat(struct vnode *dir, char *path, int flags, mode_t mode,
+		struct openfile **ret)
+{
+	struct vnode *vn;
+	int result;
+
+	result = vfs_openat(dir, path, flags, mode, &vn);
+	if (result) {
+		return result;
+	}
+	result = openfile_create(vn, flags, ret);
+	if (result) {
+		vfs_close(vn);
+	}
+	return result;
+}
+
+int
+openfile_create(struct vnode *vn, int flags, struct openfile **ret)
+{
+	struct openfile *of;
+
+	of = kmalloc(sizeof(*of));
+	if (of == NULL) {
+		return ENOMEM;
+	}
+	of->of_lock = lock_create("openfile");
+	if (of->of_lock == NULL) {
+		kfree(of);
+		return ENOMEM;
+	}
+	of->of_vnode = vn;
+	of->of_flags = flags & (O_ACCMODE | O_APPEND | O_DIRECT);
+	of->of_offset = 0;
+	of->of_refcount = 1;
+	*ret = of;
+	return 0;
+}
+
+void
+openfile_incref(struct openfile *of)
+{
+	KASSERT(of->of_refcount > 0);
+	atomic_inc(&of->of_refcount);
+}
+
+void
+openfile_decref(struct openfile *of)
+{
+	unsigned count;
+
+	count = atomic_add(&of->of_refcount, -1);
+	KASSERT(count > 0);
+	if (count != 1) {
+		return;
+	}
+
+	vfs_close(of->of_vnode);
+	lock_destroy(of->of_lock);
+	kfree(of);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Descriptor tables
+
+struct filetable *
+filetable_create(void)
+{
+	struct filetable *ft;
+	unsigned i;
+
+	ft = kmalloc(sizeof(*ft));
+	if (ft == NULL) {
+		return NULL;
+	}
+	ft->ft_used = bitmap_create(OPEN_MAX);
+	if (ft->ft_used == NULL) {
+		kfree(ft);
+		return NULL;
+	}
+	spinlock_init(&ft->ft_lock);
+	for (i = 0; i < OPEN_MAX; i++) {
+		ft->ft_files[i] = NULL;
+	}
+	return ft;
+}
+
+int
+filetable_copy(struct filetable *old, struct filetable **ret)
+{
+	struct filetable *ft;
+	unsigned i;
+
+	ft = filetable_create();
+	if (ft == NULL) {
+		return ENOMEM;
+	}
+	spinlock_acquire(&old->ft_lock);
+	for (i = 0; i < OPEN_MAX; i++) {
+		if (old->ft_files[i] != NULL) {
+			openfile_incref(old->ft_files[i]);
+			ft->ft_files[i] = old->ft_files[i];
+			bitmap_mark(ft->ft_used, i);
+		}
+	}
+	spinlock_release(&old->ft_lock);
+	*ret = ft;
+	return 0;
+}
+
+/*
+ * Nobody else can be using FT by now, so its lock is not needed to
+ * take the files out; and closing them may sleep.
+ */
+void
+filetable_destroy(struct filetable *ft)
+{
+	unsigned i;
+
+	for (i = 0; i < OPEN_MAX; i++) {
+		if (ft->ft_files[i] != NULL) {
+			openfile_decref(ft->ft_files[i]);
+		}
+	}
+	bitmap_destroy(ft->ft_used);
+	spinlock_cleanup(&ft->ft_lock);
+	kfree(ft);
+}
+
+int
+filetable_stdio(struct filetable *ft)
+{
+	struct openfile *in, *out;
+	char path[sizeof("con:")];
+	int fd, result;
+
+	strcpy(path, "con:");
+	result = openfile_open(path, O_RDONLY, 0, &in);
+	if (result) {
+		return result;
+	}
+	strcpy(path, "con:");
+	result = openfile_open(path, O_WRONLY, 0, &out);
+	if (result) {
+		openfile_decref(in);
+		return result;
+	}
+
+	result = filetable_add(ft, in, &fd);
+	KASSERT(result == 0 && fd == STDIN_FILENO);
+	result = filetable_add(ft, out, &fd);
+	KASSERT(result == 0 && fd == STDOUT_FILENO);
+	/* stderr shares stdout's open file */
+	return filetable_place(ft, STDERR_FILENO, out);
+}
+
+int
+filetable_add(struct filetable *ft, struct openfile *of, int *fd)
+{
+	unsigned i;
+	int result;
+
+	spinlock_acquire(&ft->ft_lock);
+	result = bitmap_alloc(ft->ft_used, &i);
+	if (result == 0) {
+		KASSERT(ft->ft_files[i] == NULL);
+		ft->ft_files[i] = of;
+		*fd = i;
+	}
+	spinlock_release(&ft->ft_lock);
+	return result ? EMFILE : 0;
+}
+
+int
+filetable_get(struct filetable *ft, int fd, struct openfile **ret)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+	spinlock_acquire(&ft->ft_lock);
+	of = ft->ft_files[fd];
+	if (of != NULL) {
+		openfile_incref(of);
+	}
+	spinlock_release(&ft->ft_lock);
+	if (of == NULL) {
+		return EBADF;
+	}
+	*ret = of;
+	return 0;
+}
+
+int
+filetable_place(struct filetable *ft, int fd, struct openfile *of)
+{
+	struct openfile *old;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+	openfile_incref(of);
+	spinlock_acquire(&ft->ft_lock);
+	old = ft->ft_files[fd];
+	ft->ft_files[fd] = of;
+	if (old == NULL) {
+		bitmap_mark(ft->ft_used, fd);
+	}
+	spinlock_release(&ft->ft_lock);
+	if (old != NULL) {
+		openfile_decref(old);
+	}
+	return 0;
+}
+
+int
+filetable_remove(struct filetable *ft, int fd)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+	spinlock_acquire(&ft->ft_lock);
+	of = ft->ft_files[fd];
+	if (of != NULL) {
+		ft->ft_files[fd] = NULL;
+		bitmap_unmark(ft->ft_used, fd);
+	}
+	spinlock_release(&ft->ft_lock);
+	if (of == NULL) {
+		return EBADF;
+	}
+	openfile_decref(of);
+	return 0;
+}
@@ -1,61 +1,977 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/seek.h>
 #include <kern/unistd.h>
 #include <lib.h>
+#include <limits.h>
+#include <stat.h>
 #include <uio.h>
 #include <syscall.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include <thread.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <file.h>
+#include <pipe.h>
+#include <poll.h>
+#include <clock.h>
 
-/* handler for write() system call                  */
 /*
- * n.b.
- * This implementation handles only writes to standard output 
- * and standard error, both of which go to the console.
- * Also, it does not provide any synchronization, so writes
- * are not atomic.
+ * File system calls, on the descriptors in curproc->p_files (see
+ * file.h). Reads and writes hold the open file's of_lock throughout,
+ * so that they happen at its offset one at a time and move it along;
+ * pread and pwrite carry their own position and do not.
+ */
+
+/*
+ * open(path, flags, mode): open PATH and return the lowest free
+ * descriptor for it.
+ */
+int sys_open(userptr_t path, int flags, mode_t mode, int *retval)
+{
+  return sys_openat(AT_FDCWD, path, flags, mode, retval);
+}
+
+/*
+ * openat(dirfd, path, flags, mode): open, but with a relative PATH
+ * starting at the directory open on DIRFD, or at the current directory
+ * for AT_FDCWD. A program working through one directory can then look
+ * each name up from there instead of walking down to it every time.
+ */
+int sys_openat(int dirfd, userptr_t path, int flags, mode_t mode,
+               int *retval)
+{
+  struct openfile *of, *dof = NULL;
+  struct arena_mark mark;
+  char *kpath;
+  int result;
+
+  if (dirfd != AT_FDCWD)
+  {
+    result = filetable_get(curproc->p_files, dirfd, &dof);
+    if (result)
+    {
+      return result;
+    }
+  }
+  arena_mark(&curthread->t_arena, &mark);
+  kpath = arena_alloc(&curthread->t_arena, PATH_MAX);
+  result = kpath == NULL ? ENOMEM : copyinstr(path, kpath, PATH_MAX, NULL);
+  if (result == 0)
+  {
+    result = openfile_openat(dof == NULL ? NULL : dof->of_vnode, kpath,
+                             flags, mode, &of);
+  }
+  arena_release(&curthread->t_arena, &mark);
+  if (dof != NULL)
+  {
+    openfile_decref(dof);
+  }
+  if (result)
+  {
+    return result;
+  }
+
+  result = filetable_add(curproc->p_files, of, retval);
+  if (result)
+  {
+    openfile_decref(of);
+  }
+  return result;
+}
+
+int sys_close(int fd)
+{
+  return filetable_remove(curproc->p_files, fd);
+}
+
+/*
+ * pipe(fds): make a pipe, and put its read end in the lowest free
+ * descriptor and its write end in the next, both of which go in FDS.
+ */
+int sys_pipe(userptr_t fds)
+{
+  struct vnode *rvn, *wvn;
+  struct openfile *rof, *wof;
+  int fd[2];
+  int result;
+
+  result = pipe_create(&rvn, &wvn);
+  if (result)
+  {
+    return result;
+  }
+  result = openfile_create(rvn, O_RDONLY, &rof);
+  if (result)
+  {
+    vfs_close(rvn);
+    vfs_close(wvn);
+    return result;
+  }
+  result = openfile_create(wvn, O_WRONLY, &wof);
+  if (result)
+  {
+    openfile_decref(rof);
+    vfs_close(wvn);
+    return result;
+  }
+
+  result = filetable_add(curproc->p_files, rof, &fd[0]);
+  if (result)
+  {
+    openfile_decref(rof);
+    openfile_decref(wof);
+    return result;
+  }
+  result = filetable_add(curproc->p_files, wof, &fd[1]);
+  if (result)
+  {
+    filetable_remove(curproc->p_files, fd[0]);
+    openfile_decref(wof);
+    return result;
+  }
+  result = copyout(fd, fds, sizeof(fd));
+  if (result)
+  {
+    filetable_remove(curproc->p_files, fd[0]);
+    filetable_remove(curproc->p_files, fd[1]);
+  }
+  return result;
+}
+
+/*
+ * dup2(oldfd, newfd): make NEWFD refer to the same open file as OLDFD,
+ * closing whatever it referred to before.
+ */
+int sys_dup2(int oldfd, int newfd, int *retval)
+{
+  struct openfile *of;
+  int result;
+
+  result = filetable_get(curproc->p_files, oldfd, &of);
+  if (result)
+  {
+    return result;
+  }
+  if (oldfd != newfd)
+  {
+    result = filetable_place(curproc->p_files, newfd, of);
+  }
+  openfile_decref(of);
+  if (result)
+  {
+    return result;
+  }
+  *retval = newfd;
+  return 0;
+}
+
+/*
+ * Do the transfer for file_rw, at POS, and leave where it ended in
+ * *END if END is not NULL.
+ */
+static int file_uio(struct openfile *of, struct iovec *iov, unsigned iovcnt,
+                    size_t len, off_t pos, enum uio_rw rw, int *retval,
+                    off_t *end)
+{
+  struct uio u;
+  int result;
+
+  u.uio_iov = iov;
+  u.uio_iovcnt = iovcnt;
+  u.uio_offset = pos;
+  u.uio_resid = len;
+  u.uio_segflg = UIO_USERSPACE;
+  u.uio_rw = rw;
+  u.uio_space = curproc->p_addrspace;
+  u.uio_direct = (of->of_flags & O_DIRECT) != 0;
+
+  result = rw == UIO_READ ? VOP_READ(of->of_vnode, &u)
+                          : VOP_WRITE(of->of_vnode, &u);
+  if (result)
+  {
+    return result;
+  }
+  if (end != NULL)
+  {
+    *end = u.uio_offset;
+  }
+  *retval = len - u.uio_resid;
+  if (rw == UIO_WRITE)
+  {
+    curthread->t_oublock += DIVROUNDUP((unsigned)*retval, 512);
+  }
+  return 0;
+}
+
+/*
+ * Read or write (RW) the LEN bytes of the IOVCNT buffers in IOV,
+ * between them and the file open on FD, at its offset, and move the
+ * offset past them. *RETVAL is how many bytes were transferred.
+ *
+ * If POS is not NULL, the transfer is at *POS instead, for pread and
+ * pwrite, and the open file's offset is neither used nor changed; so
+ * of_lock is not taken, and positional I/O on a shared file goes on in
+ * parallel. That also means O_APPEND does not apply.
+ */
+static int file_rw(int fd, struct iovec *iov, unsigned iovcnt, size_t len,
+                   const off_t *pos, enum uio_rw rw, int *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  int accmode;
+  int result;
+
+  result = filetable_get(curproc->p_files, fd, &of);
+  if (result)
+  {
+    return result;
+  }
+  accmode = of->of_flags & O_ACCMODE;
+  if (accmode == (rw == UIO_READ ? O_WRONLY : O_RDONLY))
+  {
+    openfile_decref(of);
+    return EBADF;
+  }
+
+  if (pos != NULL)
+  {
+    result = *pos < 0 ? EINVAL : VOP_TRYSEEK(of->of_vnode, *pos);
+    if (result == 0)
+    {
+      result = file_uio(of, iov, iovcnt, len, *pos, rw, retval, NULL);
+    }
+    openfile_decref(of);
+    return result;
+  }
+
+  lock_acquire(of->of_lock);
+  result = 0;
+  if (rw == UIO_WRITE && (of->of_flags & O_APPEND))
+  {
+    result = VOP_STAT(of->of_vnode, &st);
+    if (result == 0)
+    {
+      of->of_offset = st.st_size;
+    }
+  }
+  if (result == 0)
+  {
+    result = file_uio(of, iov, iovcnt, len, of->of_offset, rw, retval,
+                      &of->of_offset);
+  }
+  lock_release(of->of_lock);
+  openfile_decref(of);
+  return result;
+}
+
+int file_io(int fd, userptr_t buf, size_t len, const off_t *pos,
+            enum uio_rw rw, int *retval)
+{
+  struct iovec iov;
+
+  iov.iov_ubase = buf;
+  iov.iov_len = len;
+  return file_rw(fd, &iov, 1, len, pos, rw, retval);
+}
+
+int sys_read(int fd, userptr_t buf, size_t buflen, int *retval)
+{
+  return file_io(fd, buf, buflen, NULL, UIO_READ, retval);
+}
+
+int sys_write(int fd, userptr_t buf, size_t nbytes, int *retval)
+{
+  return file_io(fd, buf, nbytes, NULL, UIO_WRITE, retval);
+}
+
+/*
+ * pread(fd, buf, len, pos) and pwrite(fd, buf, len, pos). POS does not
+ * fit in the registers left after LEN, so it is on the user stack at
+ * USP+16.
+ */
+static int file_prw(int fd, userptr_t buf, size_t len, userptr_t usp,
+                    enum uio_rw rw, int *retval)
+{
+  off_t pos;
+  int result;
+
+  result = copyin((const_userptr_t)((vaddr_t)usp + 16), &pos, sizeof(pos));
+  if (result)
+  {
+    return result;
+  }
+  return file_io(fd, buf, len, &pos, rw, retval);
+}
+
+int sys_pread(int fd, userptr_t buf, size_t len, userptr_t usp, int *retval)
+{
+  return file_prw(fd, buf, len, usp, UIO_READ, retval);
+}
+
+int sys_pwrite(int fd, userptr_t buf, size_t len, userptr_t usp,
+               int *retval)
+{
+  return file_prw(fd, buf, len, usp, UIO_WRITE, retval);
+}
+
+/*
+ * readv(fd, iov, iovcnt) and writev(fd, iov, iovcnt): copy in the
+ * user's iovec array, once, and hand the file system a uio with all of
+ * it, so the buffers go in one VOP_READ or VOP_WRITE. The total must
+ * fit in the int the call returns.
+ */
+#define FILE_RWMAX ((size_t)0x7fffffff)
+
+static int file_rwv(int fd, userptr_t uiov, int iovcnt, enum uio_rw rw,
+                    int *retval)
+{
+  struct arena_mark mark;
+  struct iovec *iov;
+  size_t len;
+  int result;
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX)
+  {
+    return EINVAL;
+  }
+
+  arena_mark(&curthread->t_arena, &mark);
+  iov = arena_alloc(&curthread->t_arena, iovcnt * sizeof(*iov));
+  if (iov == NULL)
+  {
+    return ENOMEM;
+  }
+  result = copyin(uiov, iov, iovcnt * sizeof(*iov));
+  len = 0;
+  for (int i = 0; result == 0 && i < iovcnt; i++)
+  {
+    if (iov[i].iov_len > FILE_RWMAX - len)
+    {
+      result = EINVAL;
+    }
+    len += iov[i].iov_len;
+  }
+  if (result == 0)
+  {
+    result = file_rw(fd, iov, iovcnt, len, NULL, rw, retval);
+  }
+  arena_release(&curthread->t_arena, &mark);
+  return result;
+}
+
+int sys_readv(int fd, userptr_t iov, int iovcnt, int *retval)
+{
+  return file_rwv(fd, iov, iovcnt, UIO_READ, retval);
+}
+
+int sys_writev(int fd, userptr_t iov, int iovcnt, int *retval)
+{
+  return file_rwv(fd, iov, iovcnt, UIO_WRITE, retval);
+}
+
+/*
+ * copy_file_range(fdin, fdout, len): copy up to LEN bytes from FDIN at
+ * its offset to FDOUT at its, moving both offsets, without the data
+ * going out to user space. It goes through a kernel buffer of
+ * COPY_CHUNK bytes at a time, stopping at end of file or a short
+ * write. As with read, *RETVAL is how many bytes were copied; an error
+ * after some were is not reported.
  *
- * You will need to improve this implementation
+ * Both open files' of_locks are held throughout, taken in address
+ * order so that two copies going opposite ways cannot deadlock; for
+ * the same reason copying an open file onto itself is EINVAL.
  */
+#define COPY_CHUNK 4096
 
-int sys_write(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval)
+int sys_copy_file_range(int fdin, int fdout, size_t len, int *retval)
 {
+  struct openfile *in, *out;
+  struct arena_mark mark;
   struct iovec iov;
   struct uio u;
-  int res;
+  struct stat st;
+  char *buf;
+  size_t done, n, got;
+  int result;
+
+  result = filetable_get(curproc->p_files, fdin, &in);
+  if (result)
+  {
+    return result;
+  }
+  result = filetable_get(curproc->p_files, fdout, &out);
+  if (result)
+  {
+    openfile_decref(in);
+    return result;
+  }
+  if ((in->of_flags & O_ACCMODE) == O_WRONLY ||
+      (out->of_flags & O_ACCMODE) == O_RDONLY)
+  {
+    result = EBADF;
+    goto out;
+  }
+  if (in == out)
+  {
+    result = EINVAL;
+    goto out;
+  }
+  if (len > FILE_RWMAX)
+  {
+    len = FILE_RWMAX;
+  }
 
-  // DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  arena_mark(&curthread->t_arena, &mark);
+  buf = arena_alloc(&curthread->t_arena, COPY_CHUNK);
+  if (buf == NULL)
+  {
+    result = ENOMEM;
+    goto out;
+  }
 
-  /* only stdout and stderr writes are currently implemented */
-  if (!((fdesc == STDOUT_FILENO) || (fdesc == STDERR_FILENO)))
+  lock_acquire(in < out ? in->of_lock : out->of_lock);
+  lock_acquire(in < out ? out->of_lock : in->of_lock);
+  if (out->of_flags & O_APPEND)
   {
-    return EUNIMP;
+    result = VOP_STAT(out->of_vnode, &st);
+    if (result == 0)
+    {
+      out->of_offset = st.st_size;
+    }
   }
-  KASSERT(curproc != NULL);
-  KASSERT(curproc->console != NULL);
-  KASSERT(curproc->p_addrspace != NULL);
+  done = 0;
+  while (result == 0 && done < len)
+  {
+    n = len - done < COPY_CHUNK ? len - done : COPY_CHUNK;
+    uio_kinit(&iov, &u, buf, n, in->of_offset, UIO_READ);
+    result = VOP_READ(in->of_vnode, &u);
+    if (result)
+    {
+      break;
+    }
+    got = n - u.uio_resid;
+    if (got == 0)
+    {
+      break;
+    }
+    in->of_offset = u.uio_offset;
 
-  /* set up a uio structure to refer to the user program's buffer (ubuf) */
-  iov.iov_ubase = ubuf;
-  iov.iov_len = nbytes;
-  u.uio_iov = &iov;
-  u.uio_iovcnt = 1;
-  u.uio_offset = 0; /* not needed for the console */
-  u.uio_resid = nbytes;
-  u.uio_segflg = UIO_USERSPACE;
-  u.uio_rw = UIO_WRITE;
-  u.uio_space = curproc->p_addrspace;
+    uio_kinit(&iov, &u, buf, got, out->of_offset, UIO_WRITE);
+    result = VOP_WRITE(out->of_vnode, &u);
+    if (result)
+    {
+      break;
+    }
+    out->of_offset = u.uio_offset;
+    done += got - u.uio_resid;
+    if (u.uio_resid > 0)
+    {
+      /* the rest was read, but is not written; put it back */
+      in->of_offset -= u.uio_resid;
+      break;
+    }
+  }
+  lock_release(out->of_lock);
+  lock_release(in->of_lock);
+  arena_release(&curthread->t_arena, &mark);
 
-  res = VOP_WRITE(curproc->console, &u);
-  if (res)
+  curthread->t_oublock += DIVROUNDUP((unsigned)done, 512);
+  if (done > 0)
+  {
+    result = 0;
+  }
+  if (result == 0)
   {
-    return res;
+    *retval = done;
   }
+out:
+  openfile_decref(out);
+  openfile_decref(in);
+  return result;
+}
 
-  /* pass back the number of bytes actually written */
-  *retval = nbytes - u.uio_resid;
-  KASSERT(*retval >= 0);
+/*
+ * Read the next name in the directory open as OF, at and moving its
+ * offset, into the LEN bytes at BUF, which are in user space if USER.
+ * *GOT is the name's length, with no NUL; 0 at the end. of_lock held.
+ */
+static int file_getdirentry(struct openfile *of, void *buf, size_t len,
+                            bool user, size_t *got)
+{
+  struct iovec iov;
+  struct uio u;
+  int result;
+
+  KASSERT(lock_do_i_hold(of->of_lock));
+
+  if (user)
+  {
+    iov.iov_ubase = (userptr_t)buf;
+    iov.iov_len = len;
+    u.uio_iov = &iov;
+    u.uio_iovcnt = 1;
+    u.uio_offset = of->of_offset;
+    u.uio_resid = len;
+    u.uio_segflg = UIO_USERSPACE;
+    u.uio_rw = UIO_READ;
+    u.uio_space = curproc->p_addrspace;
+    u.uio_direct = false;
+  }
+  else
+  {
+    uio_kinit(&iov, &u, buf, len, of->of_offset, UIO_READ);
+  }
+  result = VOP_GETDIRENTRY(of->of_vnode, &u);
+  if (result)
+  {
+    return result;
+  }
+  of->of_offset = u.uio_offset;
+  *got = len - u.uio_resid;
   return 0;
 }
+
+/*
+ * getdirentry(fd, buf, buflen): read the next name in the directory
+ * open on FD into BUF, without a NUL. *RETVAL is its length, 0 at the
+ * end of the directory.
+ */
+int sys_getdirentry(int fd, userptr_t buf, size_t buflen, int *retval)
+{
+  struct openfile *of;
+  size_t got;
+  int result;
+
+  result = filetable_get(curproc->p_files, fd, &of);
+  if (result)
+  {
+    return result;
+  }
+  if ((of->of_flags & O_ACCMODE) == O_WRONLY)
+  {
+    openfile_decref(of);
+    return EBADF;
+  }
+  lock_acquire(of->of_lock);
+  result = file_getdirentry(of, buf, buflen, true, &got);
+  lock_release(of->of_lock);
+  openfile_decref(of);
+  if (result == 0)
+  {
+    *retval = got;
+  }
+  return result;
+}
+
+/*
+ * getdirentries(fd, buf, buflen): read as many of the next names in
+ * the directory open on FD as fit in BUF, each followed by a NUL, in
+ * one call and one copyout. *RETVAL is how many bytes that is, 0 at
+ * the end of the directory. A name that does not fit is left for the
+ * next call, by putting the offset back where it was before it; the
+ * offset is opaque, but one getdirentry handed out can be used again.
+ * If not even the first fits, EINVAL.
+ *
+ * At most DIRENT_CHUNK bytes are read at once; the filesystem makes a
+ * run of calls cheap (sfs reads a block of slots at a time).
+ */
+#define DIRENT_CHUNK 4096
+
+int sys_getdirentries(int fd, userptr_t buf, size_t buflen, int *retval)
+{
+  struct openfile *of;
+  struct arena_mark mark;
+  char name[NAME_MAX + 1];
+  char *kbuf;
+  off_t start, pos;
+  size_t used, got;
+  bool full;
+  int result;
+
+  result = filetable_get(curproc->p_files, fd, &of);
+  if (result)
+  {
+    return result;
+  }
+  if ((of->of_flags & O_ACCMODE) == O_WRONLY)
+  {
+    openfile_decref(of);
+    return EBADF;
+  }
+  if (buflen > DIRENT_CHUNK)
+  {
+    buflen = DIRENT_CHUNK;
+  }
+
+  arena_mark(&curthread->t_arena, &mark);
+  kbuf = arena_alloc(&curthread->t_arena, buflen > 0 ? buflen : 1);
+  if (kbuf == NULL)
+  {
+    openfile_decref(of);
+    return ENOMEM;
+  }
+
+  lock_acquire(of->of_lock);
+  start = of->of_offset;
+  used = 0;
+  full = false;
+  while (used < buflen)
+  {
+    pos = of->of_offset;
+    result = file_getdirentry(of, name, sizeof(name) - 1, false, &got);
+    if (result || got == 0)
+    {
+      break;
+    }
+    if (got + 1 > buflen - used)
+    {
+      of->of_offset = pos;
+      full = true;
+      break;
+    }
+    memcpy(kbuf + used, name, got);
+    kbuf[used + got] = 0;
+    used += got + 1;
+  }
+  if (used > 0)
+  {
+    /* names already gathered are returned; the error comes next time */
+    result = copyout(kbuf, buf, used);
+  }
+  else if (result == 0 && full)
+  {
+    /* there was a name, and it did not fit */
+    result = EINVAL;
+  }
+  if (result)
+  {
+    of->of_offset = start;
+  }
+  lock_release(of->of_lock);
+  arena_release(&curthread->t_arena, &mark);
+  openfile_decref(of);
+
+  if (result == 0)
+  {
+    *retval = used;
+  }
+  return result;
+}
+
+/*
+ * poll(fds, nfds, timeout): wait until one of the NFDS files in FDS is
+ * ready for what is asked of it, or TIMEOUT milliseconds pass (never,
+ * if it is negative). *RETVAL is how many have REVENTS set.
+ *
+ * The first look at each file also registers the poller with it, so
+ * later looks, after each wakeup, need not. The files stay referenced
+ * until the poller has been taken off them again.
+ */
+int sys_poll(userptr_t ufds, unsigned nfds, int timeout, int *retval)
+{
+  struct arena_mark mark;
+  struct pollfd *fds;
+  struct openfile **ofs;
+  struct poller pl;
+  struct timeout to;
+  unsigned i, ticks;
+  int n, result;
+
+  if (nfds > OPEN_MAX)
+  {
+    return EINVAL;
+  }
+
+  arena_mark(&curthread->t_arena, &mark);
+  fds = arena_alloc(&curthread->t_arena, nfds * sizeof(*fds));
+  ofs = arena_alloc(&curthread->t_arena, nfds * sizeof(*ofs));
+  if (fds == NULL || ofs == NULL)
+  {
+    arena_release(&curthread->t_arena, &mark);
+    return ENOMEM;
+  }
+  result = copyin(ufds, fds, nfds * sizeof(*fds));
+  if (result == 0)
+  {
+    result = poller_init(&pl);
+  }
+  if (result)
+  {
+    arena_release(&curthread->t_arena, &mark);
+    return result;
+  }
+
+  for (i = 0; i < nfds; i++)
+  {
+    ofs[i] = NULL;
+    if (fds[i].fd >= 0 &&
+        filetable_get(curproc->p_files, fds[i].fd, &ofs[i]) != 0)
+    {
+      ofs[i] = NULL;
+    }
+  }
+
+  if (timeout > 0)
+  {
+    ticks = (unsigned)timeout / 1000 * HZ +
+            DIVROUNDUP((unsigned)timeout % 1000 * HZ, 1000);
+    timeout_start(&to, ticks, pl.pl_wchan);
+  }
+  for (bool first = true;; first = false)
+  {
+    n = 0;
+    for (i = 0; i < nfds; i++)
+    {
+      fds[i].revents = 0;
+      if (fds[i].fd < 0)
+      {
+        continue;
+      }
+      if (ofs[i] == NULL)
+      {
+        fds[i].revents = POLLNVAL;
+      }
+      else
+      {
+        fds[i].revents = VOP_POLL(ofs[i]->of_vnode, fds[i].events,
+                                  first ? &pl : NULL);
+      }
+      if (fds[i].revents != 0)
+      {
+        n++;
+      }
+    }
+    if (n > 0 || timeout == 0 || (timeout > 0 && to.to_fired))
+    {
+      break;
+    }
+    if (pl.pl_nomem)
+    {
+      /* not registered everywhere, so sleeping might never end */
+      result = ENOMEM;
+      break;
+    }
+    poller_sleep(&pl, timeout > 0 ? &to : NULL);
+  }
+  if (timeout > 0)
+  {
+    timeout_stop(&to);
+  }
+
+  poller_cleanup(&pl);
+  for (i = 0; i < nfds; i++)
+  {
+    if (ofs[i] != NULL)
+    {
+      openfile_decref(ofs[i]);
+    }
+  }
+  if (result == 0)
+  {
+    result = copyout(fds, ufds, nfds * sizeof(*fds));
+  }
+  arena_release(&curthread->t_arena, &mark);
+  if (result == 0)
+  {
+    *retval = n;
+  }
+  return result;
+}
+
+/*
+ * ioctl(fd, code, data): pass CODE and DATA on to whatever FD is open
+ * on; see kern/ioctl.h.
+ */
+int sys_ioctl(int fd, int code, userptr_t data)
+{
+  struct openfile *of;
+  int result;
+
+  result = filetable_get(curproc->p_files, fd, &of);
+  if (result)
+  {
+    return result;
+  }
+  result = VOP_IOCTL(of->of_vnode, code, data);
+  openfile_decref(of);
+  return result;
+}
+
+/*
+ * fstat(fd, buf): the stat of what FD is open on.
+ */
+int sys_fstat(int fd, userptr_t buf)
+{
+  struct openfile *of;
+  struct stat st;
+  int result;
+
+  result = filetable_get(curproc->p_files, fd, &of);
+  if (result)
+  {
+    return result;
+  }
+  result = VOP_STAT(of->of_vnode, &st);
+  openfile_decref(of);
+  if (result == 0)
+  {
+    result = copyout(&st, buf, sizeof(st));
+  }
+  return result;
+}
+
+/*
+ * fsync(fd) and fdatasync(fd): force what FD is open on to disk; for
+ * fdatasync, only its data and what it takes to read them back. Those
+ * who call either at about the same time share the work where the
+ * filesystem can manage it (see sfs_journal.c).
+ */
+static int file_sync(int fd, bool datasync)
+{
+  struct openfile *of;
+  int result;
+
+  result = filetable_get(curproc->p_files, fd, &of);
+  if (result)
+  {
+    return result;
+  }
+  result = VOP_FSYNC(of->of_vnode, datasync);
+  openfile_decref(of);
+  return result;
+}
+
+int sys_fsync(int fd)
+{
+  return file_sync(fd, false);
+}
+
+int sys_fdatasync(int fd)
+{
+  return file_sync(fd, true);
+}
+
+/*
+ * fstatat(dirfd, path, buf): the stat of PATH, a relative one starting
+ * at the directory open on DIRFD as with openat. The name is only
+ * looked up: no open file is made, and the object is neither opened
+ * nor closed, which is most of what an open and fstat of each name
+ * of a directory would cost. stat and lstat are this from the current
+ * directory; no lookup follows symlinks, so they are the same.
+ */
+int sys_fstatat(int dirfd, userptr_t path, userptr_t buf)
+{
+  struct openfile *dof = NULL;
+  struct arena_mark mark;
+  struct vnode *vn;
+  struct stat st;
+  char *kpath;
+  int result;
+
+  if (dirfd != AT_FDCWD)
+  {
+    result = filetable_get(curproc->p_files, dirfd, &dof);
+    if (result)
+    {
+      return result;
+    }
+  }
+  arena_mark(&curthread->t_arena, &mark);
+  kpath = arena_alloc(&curthread->t_arena, PATH_MAX);
+  result = kpath == NULL ? ENOMEM : copyinstr(path, kpath, PATH_MAX, NULL);
+  if (result == 0)
+  {
+    result = vfs_lookupat(dof == NULL ? NULL : dof->of_vnode, kpath, &vn);
+  }
+  arena_release(&curthread->t_arena, &mark);
+  if (dof != NULL)
+  {
+    openfile_decref(dof);
+  }
+  if (result)
+  {
+    return result;
+  }
+
+  result = VOP_STAT(vn, &st);
+  VOP_DECREF(vn);
+  if (result == 0)
+  {
+    result = copyout(&st, buf, sizeof(st));
+  }
+  return result;
+}
+
+int sys_stat(userptr_t path, userptr_t buf)
+{
+  return sys_fstatat(AT_FDCWD, path, buf);
+}
+
+int sys_lstat(userptr_t path, userptr_t buf)
+{
+  return sys_fstatat(AT_FDCWD, path, buf);
+}
+
+/*
+ * lseek(fd, pos, whence). POS takes the a2/a3 register pair, so
+ * WHENCE is on the user stack at USP+16.
+ */
+int sys_lseek(int fd, off_t pos, userptr_t usp, off_t *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  off_t newpos;
+  int whence;
+  int result;
+
+  result = copyin((const_userptr_t)((vaddr_t)usp + 16), &whence,
+                  sizeof(whence));
+  if (result)
+  {
+    return result;
+  }
+  result = filetable_get(curproc->p_files, fd, &of);
+  if (result)
+  {
+    return result;
+  }
+
+  lock_acquire(of->of_lock);
+  switch (whence)
+  {
+  case SEEK_SET:
+    newpos = pos;
+    break;
+  case SEEK_CUR:
+    newpos = of->of_offset + pos;
+    break;
+  case SEEK_END:
+    result = VOP_STAT(of->of_vnode, &st);
+    newpos = st.st_size + pos;
+    break;
+  default:
+    result = EINVAL;
+    break;
+  }
+  if (result == 0 && newpos < 0)
+  {
+    result = EINVAL;
+  }
+  if (result == 0)
+  {
+    result = VOP_TRYSEEK(of->of_vnode, newpos);
+  }
+  if (result == 0)
+  {
+    of->of_offset = newpos;
+    *retval = newpos;
+  }
+  lock_release(of->of_lock);
+  openfile_decref(of);
+  return result;
+}
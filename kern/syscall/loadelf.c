@@ -59,6 +59,7 @@
 #include <vnode.h>
 #include <elf.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -73,7 +74,12 @@
  * executable whose load address is in kernel space. If you should
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
+ *
+ * With OPT_A3 segments are not read here at all; as_load_segment
+ * records where each one lives in the file and the pages are read in
+ * on demand by the fault handler.
  */
+#if !OPT_A3
 static int
 load_segment(struct addrspace *as, struct vnode *v,
 			 off_t offset, vaddr_t vaddr,
@@ -102,6 +108,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
 	u.uio_rw = UIO_READ;
 	u.uio_space = as;
+	u.uio_direct = false;
 
 	result = VOP_READ(v, &u);
 	if (result)
@@ -146,6 +153,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 
 	return result;
 }
+#endif /* !OPT_A3 */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -153,15 +161,20 @@ load_segment(struct addrspace *as, struct vnode *v,
  * Returns the entry point (initial PC) for the program in ENTRYPOINT.
  */
 int load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	return load_elf_as(curproc_getas(), v, entrypoint);
+}
+
+/*
+ * Load it into AS; see addrspace.h.
+ */
+int load_elf_as(struct addrspace *as, struct vnode *v, vaddr_t *entrypoint)
 {
 	Elf_Ehdr eh; /* Executable header */
 	Elf_Phdr ph; /* "Program header" = segment header */
 	int result, i;
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
-
-	as = curproc_getas();
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -310,9 +323,14 @@ int load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_A3
+		result = as_load_segment(as, v, ph.p_offset, ph.p_vaddr,
+								 ph.p_memsz, ph.p_filesz);
+#else
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
 							  ph.p_memsz, ph.p_filesz,
 							  ph.p_flags & PF_X);
+#endif
 		if (result)
 		{
 			return result;
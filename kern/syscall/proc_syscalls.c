@@ -2,9 +2,14 @@
 #include <kern/errno.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
+#include <kern/schedstat.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <syscall.h>
 #include <current.h>
+#include <cpu.h>
+#include <clock.h>
 #include <proc.h>
 #include <thread.h>
 #include <addrspace.h>
@@ -14,14 +19,42 @@
 #include <vm.h>
 #include <vfs.h>
 #include <kern/fcntl.h>
+#include <limits.h>
+#include <ktrace.h>
+#include <kstat.h>
+#include <iostat.h>
+#include <aio.h>
+#include <execcache.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 #if OPT_A2
 
+static void waitpid_unlink(struct proc *parent, struct proc *child);
+
+/*
+ * Get rid of a child fork could not finish making. proc_destroy leaves
+ * the address space to sys__exit, so that goes first.
+ */
+static void fork_discard(struct proc *child)
+{
+  if (child->p_addrspace != NULL)
+  {
+    as_destroy(child->p_addrspace);
+    child->p_addrspace = NULL;
+  }
+  proc_destroy(child);
+}
+
+/*
+ * The child is set up, address space and all, before the parent's
+ * p_Lock is taken; all that needs the lock is putting it on the list
+ * of children, which has to happen before it can run (and exit).
+ */
 int sys_fork(struct trapframe *tf, pid_t *retval)
 {
   int err;
-  unsigned ret;
+  pid_t pid;
   struct proc *parent = curproc;
 
   struct proc *child = proc_create_runprogram("child_proc");
@@ -29,101 +62,110 @@ int sys_fork(struct trapframe *tf, pid_t *retval)
   {
     return ENOMEM;
   }
+  pid = child->pid;
 
-  lock_acquire(parent->p_Lock);
-
-  err = array_add(parent->children, (void *)child, &ret);
-  if (err)
-  {
-    proc_destroy(child);
-    lock_release(parent->p_Lock);
-    return err;
-  }
-  child->parent = parent;
-
-  spinlock_acquire(&parent->p_lock);
-  err = as_copy(parent->p_addrspace, &child->p_addrspace);
-  spinlock_release(&parent->p_lock);
+  err = as_copy(curproc_getas(), &child->p_addrspace);
   if (err)
   {
-    proc_destroy(child);
-    lock_release(parent->p_Lock);
+    fork_discard(child);
     return err;
   }
 
   struct trapframe *new_tf = kmalloc(sizeof(struct trapframe));
   if (new_tf == NULL)
   {
-    proc_destroy(child);
-    lock_release(parent->p_Lock);
+    fork_discard(child);
     return ENOMEM;
   }
   *new_tf = *tf;
 
+  lock_acquire(parent->p_Lock);
+  err = array_add(parent->children, (void *)child, NULL);
+  if (err == 0)
+  {
+    child->parent = parent;
+  }
   lock_release(parent->p_Lock);
+  if (err)
+  {
+    kfree(new_tf);
+    fork_discard(child);
+    return err;
+  }
 
-  thread_fork("child_thread", child, enter_forked_process, (void *)new_tf, 0);
+  err = thread_fork("child_thread", child, enter_forked_process,
+                    (void *)new_tf, 0);
+  if (err)
+  {
+    lock_acquire(parent->p_Lock);
+    waitpid_unlink(parent, child);
+    lock_release(parent->p_Lock);
+    kfree(new_tf);
+    fork_discard(child);
+    return err;
+  }
 
-  *retval = child->pid;
+  /* the child may be gone already */
+  *retval = pid;
 
   return 0;
 }
 
-int sys_execv(userptr_t program, userptr_t args)
+/*
+ * Copy execv's argument strings into ARENA, which is ARG_MAX bytes.
+ * The pointer vector goes at the start of the arena and the strings
+ * are packed behind it; each vector slot is left holding its string's
+ * offset from the first string, so that the vector can be rebased onto
+ * the new user stack. Sets *ARGC, and *STRS and *STRSIZE to the offset
+ * and length of the string block.
+ */
+static int execv_copyargs(userptr_t args, char *arena, unsigned *argc,
+                          size_t *strs, size_t *strsize)
 {
-  struct addrspace *as;
-  struct vnode *v;
-  vaddr_t entrypoint, stackptr;
-  int result;
-
-  unsigned argc = 0;
-  char **argv;
-
-  int err, dummy;
+  userptr_t *vec = (userptr_t *)arena;
+  size_t off, got;
+  int err;
 
-  /* copy program name */
-  char *progname = kmalloc(128 * sizeof(char));
-  if (progname == NULL)
-  {
-    return ENOMEM;
-  }
-  err = copyinstr(program, progname, 128, (size_t *)&dummy);
+  /* every argument takes a pointer and at least one byte of string */
+  err = copyinptrs(args, vec, ARG_MAX / (sizeof(userptr_t) + 1),
+                   (size_t *)argc);
   if (err)
   {
     return err;
   }
 
-  /* copy argv */
-  argv = kmalloc(128 * sizeof(char *));
-  if (argv == NULL)
-  {
-    return ENOMEM;
-  }
-
-  for (int i = 0;; i++)
+  *strs = (*argc + 1) * sizeof(userptr_t);
+  off = *strs;
+  for (unsigned i = 0; i < *argc; i++)
   {
-    argv[i] = kmalloc(128 * sizeof(char));
-    if (argv[i] == NULL)
-    {
-      return ENOMEM;
-    }
-    char *ptr;
-    err = copyin((userptr_t)(args + 4 * i), (void *)&ptr, 4);
-    if (err)
-    {
-      return err;
-    }
-    if (ptr == NULL)
-    {
-      break;
-    }
-    argc++;
-    err = copyinstr((userptr_t)ptr, argv[i], 128, (size_t *)&dummy);
+    err = copyinstr(vec[i], arena + off, ARG_MAX - off, &got);
     if (err)
     {
-      return err;
+      return err == ENAMETOOLONG ? E2BIG : err;
     }
+    vec[i] = (userptr_t)(vaddr_t)(off - *strs);
+    off += got;
   }
+  *strsize = off - *strs;
+  return 0;
+}
+
+/*
+ * Load PROGNAME into a new address space for the current process, with
+ * the ARGC arguments execv_copyargs left in ARENA laid out on its stack,
+ * and set *ENTRYPOINT and *UARGV for enter_new_process. On success the
+ * old address space, if any, is destroyed; on failure it is put back
+ * intact.
+ */
+static int execv_load(char *progname, char *arena, unsigned argc,
+                      size_t strs, size_t strsize, vaddr_t *entrypoint,
+                      userptr_t *uargv)
+{
+  struct addrspace *as, *old_as;
+  struct vnode *v;
+  vaddr_t stackptr;
+  userptr_t ustrs, *vec;
+  int result;
 
   // Copied from runprogram
   /* Open the file. */
@@ -133,6 +175,19 @@ int sys_execv(userptr_t program, userptr_t args)
     return result;
   }
 
+#if OPT_A3
+  /* A copy of the cached image of it, loaded if need be. */
+  result = execcache_load(v, &as, entrypoint);
+  vfs_close(v);
+  if (result)
+  {
+    return result;
+  }
+
+  /* Switch to it and activate it. */
+  old_as = curproc_setas(as);
+  as_activate();
+#else
   /* Create a new address space. */
   as = as_create();
   if (as == NULL)
@@ -142,82 +197,133 @@ int sys_execv(userptr_t program, userptr_t args)
   }
 
   /* Switch to it and activate it. */
-  struct addrspace *old_as = curproc_setas(as);
+  old_as = curproc_setas(as);
   as_activate();
 
   /* Load the executable. */
-  result = load_elf(v, &entrypoint);
-  if (result)
-  {
-    /* p_addrspace will go away when curproc is destroyed */
-    vfs_close(v);
-    return result;
-  }
+  result = load_elf(v, entrypoint);
 
   /* Done with the file now. */
   vfs_close(v);
+#endif
 
   /* Define the user stack in the address space */
-  result = as_define_stack(as, &stackptr);
-  if (result)
+  if (result == 0)
   {
-    /* p_addrspace will go away when curproc is destroyed */
-    return result;
+    result = as_define_stack(as, &stackptr);
   }
   // End of Copied from runprogram
 
-  struct array *stackptrs = array_create();
-  userptr_t stacktop = (userptr_t)stackptr;
-
-  // argv
-  for (unsigned i = 0; i < argc; i++)
+  /*
+   * Lay out the strings at the top of the stack and the vector below
+   * them, rebased from arena offsets to user addresses, with one
+   * copyout each.
+   */
+  if (result == 0)
   {
-    char *arg = argv[i];
-    stacktop -= strlen(arg) + 1;
-    err = array_add(stackptrs, (void *)stacktop, (unsigned *)&dummy);
-    if (err)
-    {
-      return err;
-    }
-    err = copyoutstr(arg, stacktop, 128, (size_t *)&dummy);
-    if (err)
+    ustrs = (userptr_t)(stackptr - ROUNDUP(strsize, 8));
+    result = copyout(arena + strs, ustrs, strsize);
+  }
+  if (result == 0)
+  {
+    vec = (userptr_t *)arena;
+    for (unsigned i = 0; i < argc; i++)
     {
-      return err;
+      vec[i] = (userptr_t)((vaddr_t)ustrs + (vaddr_t)vec[i]);
     }
+    *uargv = (userptr_t)((vaddr_t)ustrs - ROUNDUP(strs, 8));
+    result = copyout(vec, *uargv, strs);
+  }
+  if (result)
+  {
+    /* go back to the old image, which is still intact */
+    curproc_setas(old_as);
+    as_activate();
+    as_destroy(as);
+    return result;
   }
 
-  // pointers
-  stacktop = (userptr_t)(ROUNDUP((unsigned)stacktop, 8) - 16);
-  stacktop -= 8 * ROUNDUP(argc + 2, 2);
-  userptr_t top = stacktop;
-  for (unsigned i = 0; i < argc; i++)
+  if (old_as != NULL)
   {
-    userptr_t ptr = array_get(stackptrs, i);
-    err = copyout((void *)&ptr, (userptr_t)stacktop, 4);
-    if (err)
-    {
-      return err;
-    }
-    stacktop += 4;
+    proc_chargeas(curproc, old_as);
+    as_destroy(old_as);
   }
-  void *ptr = NULL;
-  err = copyout((void *)&ptr, (userptr_t)stacktop, 4);
-  if (err)
+#if OPT_A3
+  /* its rings were in the old image; execv's check leaves no workers */
+  if (curproc->p_aio != NULL)
   {
-    return err;
+    aio_destroy(curproc->p_aio);
+    curproc->p_aio = NULL;
+  }
+#endif
+  return 0;
+}
+
+/*
+ * Copy in execv's (or spawn's) program name and arguments, to scratch
+ * space from ARENA.
+ */
+static int execv_copyin(struct arena *arena, userptr_t program,
+                        userptr_t args, char **progname, char **argbuf,
+                        unsigned *argc, size_t *strs, size_t *strsize)
+{
+  size_t got;
+  int result;
+
+  *progname = arena_alloc(arena, PATH_MAX);
+  *argbuf = arena_alloc(arena, ARG_MAX);
+  if (*progname == NULL || *argbuf == NULL)
+  {
+    return ENOMEM;
   }
 
-  as_destroy(old_as);
-  kfree(progname);
-  for (unsigned i = 0; i <= argc; i++)
+  result = copyinstr(program, *progname, PATH_MAX, &got);
+  if (result)
   {
-    kfree(argv[i]);
+    return result;
+  }
+  return execv_copyargs(args, *argbuf, argc, strs, strsize);
+}
+
+int sys_execv(userptr_t program, userptr_t args)
+{
+  vaddr_t entrypoint;
+  userptr_t uargv;
+  size_t strs, strsize;
+  unsigned argc;
+  char *progname, *arena;
+  struct arena_mark mark;
+  int result;
+
+#if OPT_A3
+  /* Other threads would be left running in the old image. */
+  lock_acquire(curproc->p_tlock);
+  result = threadarray_num(&curproc->p_threads) > 1 ? EBUSY : 0;
+  lock_release(curproc->p_tlock);
+  if (result)
+  {
+    return result;
+  }
+#endif
+
+  /* Both buffers are scratch, gone when we return or leave the kernel. */
+  arena_mark(&curthread->t_arena, &mark);
+  result = execv_copyin(&curthread->t_arena, program, args, &progname,
+                        &arena, &argc, &strs, &strsize);
+  if (result == 0)
+  {
+    result = execv_load(progname, arena, argc, strs, strsize,
+                        &entrypoint, &uargv);
+  }
+  arena_release(&curthread->t_arena, &mark);
+  if (result)
+  {
+    return result;
   }
-  kfree(argv);
 
   /* Warp to user mode. */
-  enter_new_process(argc, top,
-                    (vaddr_t)top, entrypoint);
+  enter_new_process(argc, uargv,
+                    (vaddr_t)uargv, entrypoint);
 
   /* enter_new_process does not return. */
   panic("enter_new_process returned\n");
@@ -239,6 +345,11 @@ void sys__exit(int exitcode)
 
   DEBUG(DB_SYSCALL, "Syscall: _exit(%d)\n", exitcode);
 
+#if OPT_A3
+  /* the other threads go first; they are using the address space */
+  proc_exitthreads();
+#endif
+
   KASSERT(curproc->p_addrspace != NULL);
   as_deactivate();
   /*
@@ -249,24 +360,14 @@ void sys__exit(int exitcode)
    * messily fatal.
    */
   as = curproc_setas(NULL);
+  proc_chargeas(p, as);
   as_destroy(as);
 
   /* detach this thread from its process */
   /* note: curproc cannot be used after this call */
   proc_remthread(curthread);
 #if OPT_A2
-  if (p->parent == NULL || p->parent->status == Zombie)
-  {
-    proc_destroy(p);
-  }
-  else
-  {
-    lock_acquire(p->p_Lock);
-    p->status = Zombie;
-    p->exitcode = exitcode;
-    cv_broadcast(p->p_cv, p->parent->p_Lock);
-    lock_release(p->p_Lock);
-  }
+  proc_exit(p, _MKWAIT_EXIT(exitcode));
 #else
   /* if this is the last user process in the system, proc_destroy()
      will wake up the kernel menu thread */
@@ -292,8 +393,326 @@ int sys_getpid(pid_t *retval)
 #endif
 }
 
-/* stub handler for waitpid() system call                */
+/*
+ * ktrace(op, cpu, buf, n): turn kernel event tracing on or off, or copy
+ * up to N unread trace records of cpu number CPU into BUF and return
+ * how many. Loop over CPU until EINVAL to read them all.
+ */
+int sys_ktrace(int op, unsigned cpu, userptr_t buf, unsigned n, int *retval)
+{
+  unsigned count;
+  int err;
+
+  switch (op)
+  {
+  case KTRACE_OFF:
+  case KTRACE_ON:
+    ktrace_enable(op == KTRACE_ON);
+    return 0;
+  case KTRACE_READ:
+    err = ktrace_read(cpu, buf, n, &count);
+    *retval = count;
+    return err;
+  }
+  return EINVAL;
+}
+
+/*
+ * getschedstat(cpu, ss): the calling thread's scheduling counts and
+ * those of cpu number CPU. Loop over CPU until EINVAL, or up to
+ * ss_ncpus, to see them all.
+ */
+int sys_getschedstat(unsigned cpu, userptr_t ss)
+{
+  struct schedstat st;
+  int err;
+
+  err = thread_getschedstat(cpu, &st);
+  if (err)
+  {
+    return err;
+  }
+  return copyout(&st, ss, sizeof(st));
+}
+
+/*
+ * getkstat(index, ki): kernel statistic number INDEX, by name, summed
+ * over all cpus. Loop over INDEX until ENOENT, or up to ki_nstats, to
+ * see them all.
+ */
+int sys_getkstat(unsigned index, userptr_t ki)
+{
+  struct kstatinfo st;
+  int err;
 
+  err = kstat_get(index, &st);
+  if (err)
+  {
+    return err;
+  }
+  return copyout(&st, ki, sizeof(st));
+}
+
+/*
+ * getiostat(index, is): what storage device number INDEX has done.
+ * Loop over INDEX until ENOENT, or up to is_ndevs, to see them all.
+ */
+int sys_getiostat(unsigned index, userptr_t is)
+{
+  struct iostatinfo st;
+  int err;
+
+  err = iostat_get(index, &st);
+  if (err)
+  {
+    return err;
+  }
+  return copyout(&st, is, sizeof(st));
+}
+
+/*
+ * getrusage(who, ru): what this process has used so far, or what its
+ * children that have been waited for used, for RUSAGE_SELF or
+ * RUSAGE_CHILDREN.
+ */
+int sys_getrusage(int who, userptr_t ru)
+{
+  struct rusage r;
+  int err;
+
+  err = proc_getrusage(curproc, who, &r);
+  if (err)
+  {
+    return err;
+  }
+  return copyout(&r, ru, sizeof(r));
+}
+
+/*
+ * The process a scheduling call names: ourselves (PID 0 or our own
+ * pid) or one of our children. Anyone else could be destroyed while we
+ * looked at them.
+ */
+static struct proc *sched_getproc(pid_t pid)
+{
+  struct proc *p = curproc;
+
+  if (pid == 0)
+  {
+    return p;
+  }
+#if OPT_A2
+  return pid == p->pid ? p : proc_lookup(pid, p);
+#else
+  return NULL;
+#endif
+}
+
+/*
+ * setpriority(which, who, prio): make process WHO (see sched_getproc)
+ * as nice as PRIO, clamped to PRIO_MIN..PRIO_MAX. Only PRIO_PROCESS.
+ */
+int sys_setpriority(int which, pid_t who, int prio)
+{
+  struct proc *p;
+
+  if (which != PRIO_PROCESS)
+  {
+    return EINVAL;
+  }
+  p = sched_getproc(who);
+  if (p == NULL)
+  {
+    return ESRCH;
+  }
+  if (prio < PRIO_MIN)
+  {
+    prio = PRIO_MIN;
+  }
+  else if (prio > PRIO_MAX)
+  {
+    prio = PRIO_MAX;
+  }
+  proc_setnice(p, prio);
+  return 0;
+}
+
+/* getpriority(which, who): how nice process WHO is. */
+int sys_getpriority(int which, pid_t who, int *retval)
+{
+  struct proc *p;
+
+  if (which != PRIO_PROCESS)
+  {
+    return EINVAL;
+  }
+  p = sched_getproc(who);
+  if (p == NULL)
+  {
+    return ESRCH;
+  }
+  return proc_getnice(p, retval);
+}
+
+/* getpgid(pid): the process group of process PID (see sched_getproc). */
+int sys_getpgid(pid_t pid, pid_t *retval)
+{
+#if OPT_A2
+  struct proc *p;
+
+  p = sched_getproc(pid);
+  if (p == NULL)
+  {
+    return ESRCH;
+  }
+  *retval = proc_getpgid(p);
+  return 0;
+#else
+  (void)pid;
+  (void)retval;
+  return ENOSYS;
+#endif
+}
+
+/*
+ * setpgid(pid, pgid): move process PID (see sched_getproc) to process
+ * group PGID, which must exist unless it is PID's own pid; PGID 0 is
+ * that. A new group gets its share of the cpu apart from the old one.
+ */
+int sys_setpgid(pid_t pid, pid_t pgid)
+{
+#if OPT_A2
+  struct proc *p;
+
+  if (pgid < 0)
+  {
+    return EINVAL;
+  }
+  p = sched_getproc(pid);
+  if (p == NULL)
+  {
+    return ESRCH;
+  }
+  return proc_setpgid(p, pgid == 0 ? p->pid : pgid);
+#else
+  (void)pid;
+  (void)pgid;
+  return ENOSYS;
+#endif
+}
+
+/*
+ * sched_setaffinity(pid, mask): let process PID run only on the cpus
+ * whose bits are set in MASK, bit N for cpu N. Bits for cpus that do
+ * not exist are dropped; EINVAL if none are left. If the caller may no
+ * longer run where it is, it naps for a tick, so that its wakeup puts
+ * it on a cpu it may run on before the call returns.
+ */
+int sys_sched_setaffinity(pid_t pid, unsigned mask)
+{
+  struct proc *p;
+
+  p = sched_getproc(pid);
+  if (p == NULL)
+  {
+    return ESRCH;
+  }
+  mask &= thread_cpumask();
+  if (mask == 0)
+  {
+    return EINVAL;
+  }
+  proc_setaffinity(p, mask);
+  if (p == curproc && (mask & (1U << curcpu->c_number)) == 0)
+  {
+    clocknap(1);
+  }
+  return 0;
+}
+
+/* sched_getaffinity(pid, mask): the cpus process PID may run on. */
+int sys_sched_getaffinity(pid_t pid, userptr_t mask)
+{
+  struct proc *p;
+  uint32_t m;
+  int err;
+
+  p = sched_getproc(pid);
+  if (p == NULL)
+  {
+    return ESRCH;
+  }
+  err = proc_getaffinity(p, &m);
+  if (err)
+  {
+    return err;
+  }
+  return copyout(&m, mask, sizeof(m));
+}
+
+#if OPT_A2
+/*
+ * Find an exited child of PARENT for waitpid: child PID, or any child
+ * if PID is WAIT_ANY. Returns NULL if none has exited yet, with *ERR
+ * set to ESRCH or ECHILD if none ever will. p_Lock held.
+ */
+static struct proc *waitpid_zombie(struct proc *parent, pid_t pid, int *err)
+{
+  struct proc *child;
+
+  *err = 0;
+  if (pid != WAIT_ANY)
+  {
+    child = proc_lookup(pid, parent);
+    if (child == NULL)
+    {
+      *err = ESRCH;
+    }
+    return child != NULL && child->status == Zombie ? child : NULL;
+  }
+
+  if (array_num(parent->children) == 0)
+  {
+    *err = ECHILD;
+  }
+  for (unsigned i = 0; i < array_num(parent->children); i++)
+  {
+    child = array_get(parent->children, i);
+    if (child->status == Zombie)
+    {
+      return child;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Take CHILD, which has exited, off PARENT's children, so no other
+ * waitpid can find it. p_Lock held.
+ */
+static void waitpid_unlink(struct proc *parent, struct proc *child)
+{
+  unsigned n = array_num(parent->children);
+
+  for (unsigned i = 0; i < n; i++)
+  {
+    if (array_get(parent->children, i) == child)
+    {
+      array_set(parent->children, i, array_get(parent->children, n - 1));
+      array_setsize(parent->children, n - 1);
+      break;
+    }
+  }
+  child->parent = NULL;
+}
+#endif
+
+/*
+ * waitpid(pid, status, options). PID is a child's pid or WAIT_ANY;
+ * with WNOHANG, returns 0 instead of waiting if no such child has
+ * exited yet. The child is destroyed once its status is collected.
+ * STATUS may be NULL.
+ */
 int sys_waitpid(pid_t pid,
                 userptr_t status,
                 int options,
@@ -302,53 +721,166 @@ int sys_waitpid(pid_t pid,
   int exitstatus;
   int result;
 
-  /* this is just a stub implementation that always reports an
-     exit status of 0, regardless of the actual exit status of
-     the specified process.   
-     In fact, this will return 0 even if the specified process
-     is still running, and even if it never existed in the first place.
-
-     Fix this!
-  */
-
-  if (options != 0)
+  if ((options & ~WNOHANG) != 0)
   {
     return (EINVAL);
   }
 #if OPT_A2
-  bool hasChild = false;
   struct proc *parent = curproc;
+  struct proc *child;
+
   lock_acquire(parent->p_Lock);
-  for (unsigned i = 0; i < array_num(parent->children); i++)
+  while ((child = waitpid_zombie(parent, pid, &result)) == NULL)
   {
-    struct proc *child = (struct proc *)array_get(parent->children, i);
-    if (pid == child->pid)
+    if (result != 0 || (options & WNOHANG) != 0)
     {
-      hasChild = true;
-      while (child->status == Alive)
-      {
-        cv_wait(child->p_cv, parent->p_Lock);
-      }
-      exitstatus = _MKWAIT_EXIT(child->exitcode);
-      break;
+      lock_release(parent->p_Lock);
+      *retval = result ? -1 : 0;
+      return result;
     }
+    cv_wait(parent->p_waitcv, parent->p_Lock);
   }
+  waitpid_unlink(parent, child);
   lock_release(parent->p_Lock);
 
-  if (!hasChild)
-  {
-    *retval = -1;
-    return ESRCH;
-  }
+  pid = child->pid;
+  exitstatus = child->exitcode;
+  /* wait for proc_exit to let go of it */
+  lock_acquire(child->p_Lock);
+  lock_release(child->p_Lock);
+  proc_chargechild(parent, child);
+  proc_destroy(child);
 #else
   /* for now, just pretend the exitstatus is 0 */
   exitstatus = 0;
 #endif
-  result = copyout((void *)&exitstatus, status, sizeof(int));
-  if (result)
+  if (status != NULL)
   {
-    return (result);
+    result = copyout((void *)&exitstatus, status, sizeof(int));
+    if (result)
+    {
+      return (result);
+    }
   }
   *retval = pid;
   return (0);
 }
+
+#if OPT_A2
+/*
+ * spawn(program, args): fork and execv in one, without copying our
+ * address space only to throw the copy away. The child's first thread
+ * loads the program itself, from the name and arguments we copied in,
+ * while we wait to hear whether that worked; so a program that cannot
+ * be run fails the spawn, rather than making a child that exits.
+ */
+struct spawn_args
+{
+  char *sa_progname;
+  char *sa_arena;		/* from execv_copyin, in our t_arena */
+  unsigned sa_argc;
+  size_t sa_strs, sa_strsize;
+  struct semaphore *sa_done;
+  int sa_result;
+};
+
+static void spawn_start(void *data, unsigned long junk)
+{
+  struct spawn_args *sa = data;
+  vaddr_t entrypoint;
+  userptr_t uargv;
+  unsigned argc = sa->sa_argc;
+
+  (void)junk;
+
+  sa->sa_result = execv_load(sa->sa_progname, sa->sa_arena, argc,
+                             sa->sa_strs, sa->sa_strsize, &entrypoint,
+                             &uargv);
+  if (sa->sa_result)
+  {
+    /* the parent destroys the process */
+    proc_remthread(curthread);
+    V(sa->sa_done);
+    thread_exit();
+  }
+
+  /* after this, SA is gone */
+  V(sa->sa_done);
+  enter_new_process(argc, uargv, (vaddr_t)uargv, entrypoint);
+  panic("enter_new_process returned\n");
+}
+
+int sys_spawn(userptr_t program, userptr_t args, pid_t *retval)
+{
+  struct proc *parent = curproc;
+  struct proc *child;
+  struct spawn_args sa;
+  struct arena_mark mark;
+  pid_t pid;
+  int result;
+
+  arena_mark(&curthread->t_arena, &mark);
+  result = execv_copyin(&curthread->t_arena, program, args,
+                        &sa.sa_progname, &sa.sa_arena, &sa.sa_argc,
+                        &sa.sa_strs, &sa.sa_strsize);
+  if (result)
+  {
+    arena_release(&curthread->t_arena, &mark);
+    return result;
+  }
+
+  sa.sa_done = sem_create("spawn", 0);
+  child = proc_create_runprogram(sa.sa_progname);
+  if (sa.sa_done == NULL || child == NULL)
+  {
+    result = ENOMEM;
+    goto fail;
+  }
+
+  /* once it is running it might be gone by the time we look */
+  pid = child->pid;
+
+  lock_acquire(parent->p_Lock);
+  result = array_add(parent->children, child, NULL);
+  if (result == 0)
+  {
+    child->parent = parent;
+  }
+  lock_release(parent->p_Lock);
+  if (result)
+  {
+    goto fail;
+  }
+
+  result = thread_fork(sa.sa_progname, child, spawn_start, &sa, 0);
+  if (result == 0)
+  {
+    P(sa.sa_done);
+    result = sa.sa_result;
+  }
+  if (result)
+  {
+    lock_acquire(parent->p_Lock);
+    waitpid_unlink(parent, child);
+    lock_release(parent->p_Lock);
+    goto fail;
+  }
+
+  *retval = pid;
+  sem_destroy(sa.sa_done);
+  arena_release(&curthread->t_arena, &mark);
+  return 0;
+
+fail:
+  if (child != NULL)
+  {
+    proc_destroy(child);
+  }
+  if (sa.sa_done != NULL)
+  {
+    sem_destroy(sa.sa_done);
+  }
+  arena_release(&curthread->t_arena, &mark);
+  return result;
+}
+#endif
@@ -0,0 +1,243 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <lib.h>
+#include <array.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <thread.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <futex.h>
+#include <upcall.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+
+/*
+ * User threads. Every thread of a process shares its address space;
+ * each one made by thread_create gets a stack of its own, a region of
+ * UTHREAD_STACKSIZE bytes made as by mmap, which thread_join unmaps.
+ * It is aligned to its size, so that libc can find the bottom of a
+ * thread's stack from its stack pointer, and keep its per-thread data
+ * there (see <kern/unistd.h>).
+ * The new thread enters user mode at the START routine libc passes
+ * in, with the user's function and argument in a0 and a1; START calls
+ * the function and then thread_exit with what it returns.
+ *
+ * Ending the process from any thread (_exit, or a fatal fault) ends
+ * the others as they next come back to user mode; see
+ * proc_exitthreads. When the last thread calls thread_exit, that ends
+ * the process as _exit(0) would.
+ */
+
+static void uthread_start(void *data1, unsigned long data2)
+{
+  struct uthread *ut = data1;
+  struct proc *p = curproc;
+
+  (void)data2;
+
+  lock_acquire(p->p_tlock);
+  if (p->p_exiting)
+  {
+    proc_thread_exit(NULL);
+  }
+  ut->ut_thread = curthread;
+  lock_release(p->p_tlock);
+
+  enter_new_process((int)ut->ut_func, (userptr_t)ut->ut_arg,
+                    ut->ut_stack + UTHREAD_STACKSIZE,
+                    ut->ut_start);
+
+  /* enter_new_process does not return. */
+  panic("enter_new_process returned\n");
+}
+
+int sys___thread_create(userptr_t start, userptr_t func, userptr_t arg,
+                        int *retval)
+{
+  struct proc *p = curproc;
+  struct addrspace *as = curproc_getas();
+  struct uthread *ut;
+  unsigned index;
+  int tid, err;
+
+  ut = kmalloc(sizeof(*ut));
+  if (ut == NULL)
+  {
+    return ENOMEM;
+  }
+  err = as_mmap(as, UTHREAD_STACKSIZE, UTHREAD_STACKSIZE, true, NULL, 0,
+                false, &ut->ut_stack);
+  if (err)
+  {
+    kfree(ut);
+    return err;
+  }
+  ut->ut_thread = NULL;
+  ut->ut_start = (vaddr_t)start;
+  ut->ut_func = (vaddr_t)func;
+  ut->ut_arg = (vaddr_t)arg;
+  ut->ut_done = false;
+  ut->ut_joining = false;
+  ut->ut_retval = NULL;
+
+  /* Fork under p_tlock, so p_threads only grows under it too. */
+  lock_acquire(p->p_tlock);
+  tid = ut->ut_tid = p->p_nexttid++;
+  err = array_add(p->p_uthreads, ut, &index);
+  if (err == 0)
+  {
+    err = thread_fork("uthread", p, uthread_start, ut, 0);
+    if (err)
+    {
+      array_remove(p->p_uthreads, index);
+    }
+  }
+  lock_release(p->p_tlock);
+
+  if (err)
+  {
+    as_munmap(as, ut->ut_stack, UTHREAD_STACKSIZE);
+    kfree(ut);
+    return err;
+  }
+  *retval = tid;
+  return 0;
+}
+
+/*
+ * Find thread TID's record, and its index in p_uthreads. p_tlock held.
+ */
+static struct uthread *uthread_find(struct proc *p, int tid, unsigned *index)
+{
+  struct uthread *ut;
+
+  for (unsigned i = 0; i < array_num(p->p_uthreads); i++)
+  {
+    ut = array_get(p->p_uthreads, i);
+    if (ut->ut_tid == tid)
+    {
+      *index = i;
+      return ut;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * thread_join(tid, retval): wait for thread TID to call thread_exit,
+ * and hand back what it passed. Each thread can be joined once. Fails
+ * with EINTR if the process is ended meanwhile.
+ */
+int sys_thread_join(int tid, userptr_t retval)
+{
+  struct proc *p = curproc;
+  struct uthread *ut;
+  unsigned index;
+  int err;
+
+  lock_acquire(p->p_tlock);
+  ut = uthread_find(p, tid, &index);
+  if (ut == NULL)
+  {
+    lock_release(p->p_tlock);
+    return ESRCH;
+  }
+  if (ut->ut_thread == curthread || ut->ut_joining)
+  {
+    lock_release(p->p_tlock);
+    return EINVAL;
+  }
+  ut->ut_joining = true;
+  while (!ut->ut_done && !p->p_exiting)
+  {
+    cv_wait(p->p_tcv, p->p_tlock);
+  }
+  if (!ut->ut_done)
+  {
+    ut->ut_joining = false;
+    lock_release(p->p_tlock);
+    return EINTR;
+  }
+  /* others may have come and gone while we slept */
+  ut = uthread_find(p, tid, &index);
+  KASSERT(ut != NULL);
+  array_remove(p->p_uthreads, index);
+  lock_release(p->p_tlock);
+
+  as_munmap(curproc_getas(), ut->ut_stack, UTHREAD_STACKSIZE);
+  err = 0;
+  if (retval != NULL)
+  {
+    err = copyout(&ut->ut_retval, retval, sizeof(ut->ut_retval));
+  }
+  kfree(ut);
+  return err;
+}
+
+void sys_thread_exit(userptr_t retval)
+{
+  struct proc *p = curproc;
+
+  lock_acquire(p->p_tlock);
+  if (threadarray_num(&p->p_threads) == 1)
+  {
+    lock_release(p->p_tlock);
+    sys__exit(0);
+  }
+  proc_thread_exit(retval);
+}
+
+/*
+ * futex_wait(uaddr, val) and futex_wake(uaddr, n), for user locks to
+ * sleep on when contended; futex_wake returns how many it woke.
+ */
+int sys_futex_wait(userptr_t uaddr, int val)
+{
+  return futex_wait(curproc_getas(), uaddr, val);
+}
+
+int sys_futex_wake(userptr_t uaddr, unsigned n, int *retval)
+{
+  unsigned woken;
+  int err;
+
+  err = futex_wake(curproc_getas(), uaddr, n, &woken);
+  if (err)
+  {
+    return err;
+  }
+  *retval = woken;
+  return 0;
+}
+
+/*
+ * upcall_register(on): make the calling thread a worker of a user
+ * scheduler, or not; upcall_wait(blocked): sleep while BLOCKED of its
+ * workers are asleep in the kernel, and return how many are now. See
+ * upcall.h.
+ */
+int sys_upcall_register(int on)
+{
+  return upcall_register(on != 0);
+}
+
+int sys_upcall_wait(unsigned blocked, int *retval)
+{
+  unsigned now;
+  int err;
+
+  err = upcall_wait(blocked, &now);
+  if (err)
+  {
+    return err;
+  }
+  *retval = now;
+  return 0;
+}
+
+#endif /* OPT_A3 */
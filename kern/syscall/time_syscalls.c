@@ -56,3 +56,14 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Nanoseconds since boot, from clock_monotonic_ns. Returned in v0/v1,
+ * as lseek's off_t is, rather than copied out, to keep it cheap.
+ */
+int
+sys_clock_monotonic(off_t *retval)
+{
+	*retval = clock_monotonic_ns();
+	return 0;
+}
@@ -0,0 +1,243 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/shm.h>
+#include <kern/memstat.h>
+#include <kern/unistd.h>
+#include <lib.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <vnode.h>
+#include <coremap.h>
+#include <shm.h>
+#include <file.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+
+/*
+ * Get the open file on FD for mmap, checking that it was opened for
+ * what the mapping would do with it: reading, and writing back too if
+ * the mapping is shared and writeable.
+ */
+static int mmap_getfile(int fd, bool writeback, struct openfile **ret)
+{
+  struct openfile *of;
+  int accmode;
+  int err;
+
+  err = filetable_get(curproc->p_files, fd, &of);
+  if (err)
+  {
+    return err;
+  }
+  accmode = of->of_flags & O_ACCMODE;
+  if (accmode == O_WRONLY || (writeback && accmode == O_RDONLY))
+  {
+    openfile_decref(of);
+    return EACCES;
+  }
+  *ret = of;
+  return 0;
+}
+
+/*
+ * mmap(addr, len, prot, flags, fd, offset). The last two arguments
+ * don't fit in registers and are fetched from the user stack at USP.
+ * ADDR is only a hint, and is ignored.
+ */
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags,
+             userptr_t usp, vaddr_t *retval)
+{
+  struct openfile *of;
+  int fd;
+  off_t offset;
+  bool shared;
+  int err;
+
+  (void)addr;
+
+  if ((prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0 ||
+      (flags & ~(MAP_SHARED | MAP_PRIVATE | MAP_ANON)) != 0)
+  {
+    return EINVAL;
+  }
+  if ((flags & (MAP_SHARED | MAP_PRIVATE)) == 0 ||
+      (flags & (MAP_SHARED | MAP_PRIVATE)) == (MAP_SHARED | MAP_PRIVATE))
+  {
+    return EINVAL;
+  }
+  shared = (flags & MAP_SHARED) != 0;
+
+  of = NULL;
+  offset = 0;
+  if (flags & MAP_ANON)
+  {
+    /* Nothing could share it with us after fork, so don't pretend. */
+    if (shared)
+    {
+      return EINVAL;
+    }
+  }
+  else
+  {
+    err = copyin((const_userptr_t)((vaddr_t)usp + 16), &fd, sizeof(fd));
+    if (err)
+    {
+      return err;
+    }
+    err = copyin((const_userptr_t)((vaddr_t)usp + 24), &offset, sizeof(offset));
+    if (err)
+    {
+      return err;
+    }
+    err = mmap_getfile(fd, shared && (prot & PROT_WRITE) != 0, &of);
+    if (err)
+    {
+      return err;
+    }
+  }
+
+  /* the region takes its own reference to the vnode */
+  err = as_mmap(curproc_getas(), len, 0, (prot & PROT_WRITE) != 0,
+                of != NULL ? of->of_vnode : NULL, offset, shared, retval);
+  if (of != NULL)
+  {
+    openfile_decref(of);
+  }
+  return err;
+}
+
+int sys_munmap(userptr_t addr, size_t len)
+{
+  return as_munmap(curproc_getas(), (vaddr_t)addr, len);
+}
+
+/*
+ * sbrk(amount). Hands back the old break, which is where new memory
+ * starts when AMOUNT is positive.
+ */
+int sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+  return as_sbrk(curproc_getas(), amount, retval);
+}
+
+/*
+ * shmget(key, size, flags). The permission bits in FLAGS are ignored;
+ * there is only one user.
+ */
+int sys_shmget(int key, size_t size, int flags, int *retval)
+{
+  return shm_get(key, size, flags, retval);
+}
+
+/*
+ * shmat(shmid, shmaddr, flags). We always choose where the segment
+ * goes, so SHMADDR must be NULL.
+ */
+int sys_shmat(int shmid, userptr_t shmaddr, int flags, vaddr_t *retval)
+{
+  struct shmseg *seg;
+  int err;
+
+  if (shmaddr != NULL || (flags & ~SHM_RDONLY) != 0)
+  {
+    return EINVAL;
+  }
+  err = shm_attach(shmid, &seg);
+  if (err)
+  {
+    return err;
+  }
+  /* the region takes over the attachment */
+  err = as_shmat(curproc_getas(), seg, (flags & SHM_RDONLY) == 0, retval);
+  if (err)
+  {
+    shm_detach(seg);
+  }
+  return err;
+}
+
+int sys_shmdt(userptr_t shmaddr)
+{
+  return as_shmdt(curproc_getas(), (vaddr_t)shmaddr);
+}
+
+/*
+ * shmctl(shmid, cmd, buf). BUF is only used by IPC_STAT.
+ */
+int sys_shmctl(int shmid, int cmd, userptr_t buf)
+{
+  struct shmid_ds ds;
+  int err;
+
+  err = shm_ctl(shmid, cmd, &ds);
+  if (err || cmd != IPC_STAT)
+  {
+    return err;
+  }
+  return copyout(&ds, buf, sizeof(ds));
+}
+
+/*
+ * Find the process getmemstat asks about: ourselves (PID 0 or our own
+ * pid) or one of our children. Anyone else could be destroyed while we
+ * looked at them.
+ */
+static struct proc *memstat_getproc(pid_t pid)
+{
+  struct proc *p = curproc;
+
+  if (pid == 0 || pid == p->pid)
+  {
+    return p;
+  }
+  return proc_lookup(pid, p);
+}
+
+/*
+ * getmemstat(pid, ms). The process counts are those of its current
+ * address space, so they start over at exec, and are zero once it has
+ * exited.
+ */
+int sys_getmemstat(pid_t pid, userptr_t ms)
+{
+  struct memstat st;
+  struct coremap_stats cs;
+  struct addrspace *as;
+  struct proc *p;
+
+  p = memstat_getproc(pid);
+  if (p == NULL)
+  {
+    return ESRCH;
+  }
+
+  coremap_stats(&cs);
+  st.ms_pagesize = PAGE_SIZE;
+  st.ms_total = cs.cs_total;
+  st.ms_free = cs.cs_free;
+  st.ms_user = cs.cs_user;
+  st.ms_kernel = cs.cs_kernel;
+
+  /* Holding p_lock, its address space cannot be replaced and destroyed. */
+  st.ms_rss = st.ms_wss = st.ms_minflt = st.ms_majflt = 0;
+  spinlock_acquire(&p->p_lock);
+  as = p->p_addrspace;
+  if (as != NULL)
+  {
+    st.ms_rss = as->as_rss;
+    st.ms_wss = as_wss(as);
+    st.ms_minflt = as->as_minflt;
+    st.ms_majflt = as->as_majflt;
+  }
+  spinlock_release(&p->p_lock);
+
+  return copyout(&st, ms, sizeof(st));
+}
+
+#endif /* OPT_A3 */
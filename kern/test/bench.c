@@ -0,0 +1,293 @@
+/*
+ * The benchmark harness, and the benchmarks of the basic kernel
+ * primitives. See bench.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <vm.h>
+#include <bench.h>
+#include <test.h>
+
+/*
+ * Sort V, of N, for the percentiles. N is a few hundred, so Shell's
+ * sort will do.
+ */
+static
+void
+bench_sort(uint32_t *v, unsigned n)
+{
+	unsigned gap, i, j;
+	uint32_t t;
+
+	for (gap = n/2; gap > 0; gap /= 2) {
+		for (i=gap; i<n; i++) {
+			t = v[i];
+			for (j=i; j>=gap && v[j-gap] > t; j-=gap) {
+				v[j] = v[j-gap];
+			}
+			v[j] = t;
+		}
+	}
+}
+
+int
+bench_run(const struct bench *b, unsigned warmup, unsigned samples)
+{
+	uint32_t *ns;
+	uint64_t before, took;
+	void *arg = NULL;
+	unsigned i, j;
+	int result;
+
+	KASSERT(b->b_batch > 0);
+	if (samples == 0) {
+		samples = 1;
+	}
+
+	ns = kmalloc(samples * sizeof(*ns));
+	if (ns == NULL) {
+		return ENOMEM;
+	}
+	if (b->b_setup != NULL) {
+		result = b->b_setup(&arg);
+		if (result) {
+			kfree(ns);
+			return result;
+		}
+	}
+
+	for (i=0; i<warmup; i++) {
+		b->b_op(arg);
+	}
+	for (i=0; i<samples; i++) {
+		before = clock_monotonic_ns();
+		for (j=0; j<b->b_batch; j++) {
+			b->b_op(arg);
+		}
+		took = clock_monotonic_ns() - before;
+		ns[i] = took / b->b_batch;
+	}
+
+	if (b->b_cleanup != NULL) {
+		b->b_cleanup(arg);
+	}
+
+	bench_sort(ns, samples);
+	kprintf("bench %s samples=%u batch=%u min=%u median=%u p99=%u "
+		"max=%u\n", b->b_name, samples, b->b_batch, ns[0],
+		ns[samples/2], ns[(samples*99)/100 < samples ?
+				  (samples*99)/100 : samples-1],
+		ns[samples-1]);
+
+	kfree(ns);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// The primitives
+
+static
+void
+bench_nullop(void *arg)
+{
+	(void)arg;
+}
+
+static
+void
+bench_kmalloc32op(void *arg)
+{
+	(void)arg;
+	kfree(kmalloc(32));
+}
+
+static
+void
+bench_kmallocpageop(void *arg)
+{
+	(void)arg;
+	kfree(kmalloc(PAGE_SIZE));
+}
+
+static
+int
+bench_spinsetup(void **ret)
+{
+	struct spinlock *spin;
+
+	spin = kmalloc(sizeof(*spin));
+	if (spin == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(spin);
+	*ret = spin;
+	return 0;
+}
+
+static
+void
+bench_spinop(void *arg)
+{
+	spinlock_acquire(arg);
+	spinlock_release(arg);
+}
+
+static
+void
+bench_spincleanup(void *arg)
+{
+	spinlock_cleanup(arg);
+	kfree(arg);
+}
+
+static
+int
+bench_locksetup(void **ret)
+{
+	*ret = lock_create("bench");
+	return *ret == NULL ? ENOMEM : 0;
+}
+
+static
+void
+bench_lockop(void *arg)
+{
+	lock_acquire(arg);
+	lock_release(arg);
+}
+
+static
+void
+bench_lockcleanup(void *arg)
+{
+	lock_destroy(arg);
+}
+
+static
+int
+bench_semsetup(void **ret)
+{
+	*ret = sem_create("bench", 1);
+	return *ret == NULL ? ENOMEM : 0;
+}
+
+static
+void
+bench_semop(void *arg)
+{
+	P((struct semaphore *)arg);
+	V((struct semaphore *)arg);
+}
+
+static
+void
+bench_semcleanup(void *arg)
+{
+	sem_destroy(arg);
+}
+
+static
+void
+bench_yieldop(void *arg)
+{
+	(void)arg;
+	thread_yield();
+}
+
+BENCH(null, "null", "an empty call (the harness itself)",
+      NULL, bench_nullop, NULL, 1000);
+BENCH(kmalloc32, "kmalloc32", "kmalloc and kfree of 32 bytes",
+      NULL, bench_kmalloc32op, NULL, 100);
+BENCH(kmallocpage, "kmallocpage", "kmalloc and kfree of a page",
+      NULL, bench_kmallocpageop, NULL, 10);
+BENCH(spinlock, "spinlock", "uncontended spinlock acquire and release",
+      bench_spinsetup, bench_spinop, bench_spincleanup, 100);
+BENCH(lock, "lock", "uncontended lock acquire and release",
+      bench_locksetup, bench_lockop, bench_lockcleanup, 100);
+BENCH(sem, "sem", "uncontended P and V",
+      bench_semsetup, bench_semop, bench_semcleanup, 100);
+BENCH(yield, "yield", "thread_yield with nothing else to run",
+      NULL, bench_yieldop, NULL, 10);
+
+////////////////////////////////////////////////////////////
+//
+// The list, and the menu command
+
+static const struct bench *const benchtable[] = {
+	&bench_null,
+	&bench_kmalloc32,
+	&bench_kmallocpage,
+	&bench_spinlock,
+	&bench_lock,
+	&bench_sem,
+	&bench_yield,
+	NULL
+};
+
+const struct bench *
+bench_find(const char *name)
+{
+	unsigned i;
+
+	for (i=0; benchtable[i] != NULL; i++) {
+		if (!strcmp(benchtable[i]->b_name, name)) {
+			return benchtable[i];
+		}
+	}
+	return NULL;
+}
+
+void
+bench_print(void)
+{
+	unsigned i;
+
+	for (i=0; benchtable[i] != NULL; i++) {
+		kprintf("    %-16s %s\n", benchtable[i]->b_name,
+			benchtable[i]->b_desc);
+	}
+}
+
+/*
+ * bench name|all [samples] [warmup]
+ */
+int
+benchcmd(int nargs, char **args)
+{
+	const struct bench *b;
+	unsigned samples, warmup, i;
+	int result;
+
+	if (nargs < 2 || nargs > 4) {
+		kprintf("Usage: bench name|all [samples] [warmup]\n");
+		return EINVAL;
+	}
+	samples = nargs > 2 ? (unsigned)atoi(args[2]) : BENCH_SAMPLES;
+	warmup = nargs > 3 ? (unsigned)atoi(args[3]) : BENCH_WARMUP;
+
+	if (!strcmp(args[1], "all")) {
+		for (i=0; benchtable[i] != NULL; i++) {
+			result = bench_run(benchtable[i], warmup, samples);
+			if (result) {
+				kprintf("bench %s: %s\n",
+					benchtable[i]->b_name,
+					strerror(result));
+				return result;
+			}
+		}
+		return 0;
+	}
+
+	b = bench_find(args[1]);
+	if (b == NULL) {
+		kprintf("bench: %s: No such benchmark\n", args[1]);
+		return EINVAL;
+	}
+	return bench_run(b, warmup, samples);
+}
@@ -28,12 +28,120 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <clock.h>
 #include <test.h>
 
 #define TESTSIZE 533
 
+/* bt bench: a map the size of a 32M SFS volume, all but 1/256 full */
+#define BENCHSIZE	65536
+#define BENCHFREE	256
+#define BENCHOPS	2000
+
+/*
+ * What bitmap_alloc used to be: from word 0, one bit at a time.
+ */
+static
+int
+bt_linear(struct bitmap *b, unsigned *index)
+{
+	unsigned i;
+
+	for (i=0; i<BENCHSIZE; i++) {
+		if (!bitmap_isset(b, i)) {
+			bitmap_mark(b, i);
+			*index = i;
+			return 0;
+		}
+	}
+	return ENOSPC;
+}
+
+static
+uint32_t
+bt_nsperop(time_t s1, uint32_t ns1, time_t s2, uint32_t ns2)
+{
+	time_t rs;
+	uint32_t rns, usec;
+
+	getinterval(s1, ns1, s2, ns2, &rs, &rns);
+	usec = (uint32_t)rs * 1000000 + rns / 1000;
+	return (usec / BENCHOPS) * 1000 + ((usec % BENCHOPS) * 1000) / BENCHOPS;
+}
+
+/*
+ * Allocate and free again, BENCHOPS times, on a map whose free bits
+ * are scattered through the second half; each free puts the bit back
+ * so every round sees the same map.
+ */
+static
+void
+bitmapbench(void)
+{
+	struct bitmap *b;
+	time_t s1, s2;
+	uint32_t ns1, ns2, x;
+	unsigned i, j;
+
+	b = bitmap_create(BENCHSIZE);
+	if (b == NULL) {
+		kprintf("bitmapbench: out of memory\n");
+		return;
+	}
+	for (i=0; i<BENCHSIZE; i++) {
+		bitmap_mark(b, i);
+	}
+	for (i=0; i<BENCHFREE; i++) {
+		bitmap_unmark(b, BENCHSIZE/2 + i * (BENCHSIZE/2/BENCHFREE));
+	}
+
+	kprintf("Bitmap benchmark, %u bits, %u free:\n", BENCHSIZE, BENCHFREE);
+
+	gettime(&s1, &ns1);
+	for (i=0; i<BENCHOPS; i++) {
+		KASSERT(bt_linear(b, &x) == 0);
+		bitmap_unmark(b, x);
+	}
+	gettime(&s2, &ns2);
+	kprintf("  bit-at-a-time    %8u ns/op\n", bt_nsperop(s1, ns1, s2, ns2));
+
+	gettime(&s1, &ns1);
+	for (i=0; i<BENCHOPS; i++) {
+		KASSERT(bitmap_alloc(b, &x) == 0);
+		bitmap_unmark(b, x);
+	}
+	gettime(&s2, &ns2);
+	kprintf("  bitmap_alloc     %8u ns/op\n", bt_nsperop(s1, ns1, s2, ns2));
+
+	gettime(&s1, &ns1);
+	for (i=0; i<BENCHOPS; i++) {
+		KASSERT(bitmap_alloc_near(b, i * 32, &x) == 0);
+		bitmap_unmark(b, x);
+	}
+	gettime(&s2, &ns2);
+	kprintf("  bitmap_alloc_near %7u ns/op\n", bt_nsperop(s1, ns1, s2, ns2));
+
+	/* make one run of 16 near the end */
+	for (i=0; i<16; i++) {
+		bitmap_unmark(b, BENCHSIZE - 64 + i);
+	}
+	gettime(&s1, &ns1);
+	for (i=0; i<BENCHOPS; i++) {
+		KASSERT(bitmap_alloc_run(b, 16, &x) == 0);
+		KASSERT(x == BENCHSIZE - 64);
+		for (j=0; j<16; j++) {
+			bitmap_unmark(b, x + j);
+		}
+	}
+	gettime(&s2, &ns2);
+	kprintf("  bitmap_alloc_run %8u ns/op\n", bt_nsperop(s1, ns1, s2, ns2));
+
+	bitmap_destroy(b);
+}
+
 int
 bitmaptest(int nargs, char **args)
 {
@@ -42,8 +150,14 @@ bitmaptest(int nargs, char **args)
 	uint32_t x;
 	int i;
 
-	(void)nargs;
-	(void)args;
+	if (nargs == 2 && !strcmp(args[1], "bench")) {
+		bitmapbench();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: bt [bench]\n");
+		return EINVAL;
+	}
 
 	kprintf("Starting bitmap test...\n");
 
@@ -101,6 +215,72 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* bitmap_alloc_near: the goal, then past it, then wrapping around */
+	bitmap_unmark(b, 100);
+	bitmap_unmark(b, 101);
+	bitmap_unmark(b, 20);
+	KASSERT(bitmap_alloc_near(b, 100, &x)==0 && x == 100);
+	KASSERT(bitmap_alloc_near(b, 100, &x)==0 && x == 101);
+	KASSERT(bitmap_alloc_near(b, 102, &x)==0 && x == 20);
+	KASSERT(bitmap_alloc_near(b, 102, &x)==ENOSPC);
+
+	/* a free run is preferred to an odd bit */
+	for (i=200; i<216; i++) {
+		bitmap_unmark(b, i);
+	}
+	bitmap_unmark(b, 150);
+	KASSERT(bitmap_alloc_near(b, 120, &x)==0 && x == 200);
+	KASSERT(bitmap_alloc_near(b, 201, &x)==0 && x == 201);
+	KASSERT(bitmap_alloc_near(b, TESTSIZE, &x)==0 && x == 208);
+	KASSERT(bitmap_alloc_near(b, 202, &x)==0 && x == 202);
+
+	/* bitmap_alloc stays first-fit after freeing behind its hint */
+	while (bitmap_alloc(b, &x)==0) {
+		/* fill the rest */
+	}
+	bitmap_unmark(b, 300);
+	bitmap_unmark(b, 7);
+	KASSERT(bitmap_alloc(b, &x)==0 && x == 7);
+	KASSERT(bitmap_alloc(b, &x)==0 && x == 300);
+
+	/* the first run long enough, across word boundaries */
+	for (i=60; i<80; i++) {
+		bitmap_unmark(b, i);
+	}
+	bitmap_unmark(b, 30);
+	bitmap_unmark(b, 32);
+	KASSERT(bitmap_alloc_run(b, 3, &x)==0 && x == 60);
+	KASSERT(bitmap_alloc_run(b, 17, &x)==0 && x == 63);
+	KASSERT(bitmap_alloc_run(b, 2, &x)==ENOSPC);
+	KASSERT(bitmap_alloc_run(b, 1, &x)==0 && x == 30);
+	for (i=TESTSIZE-21; i<TESTSIZE; i++) {
+		bitmap_unmark(b, i);
+	}
+	KASSERT(bitmap_alloc_run(b, 22, &x)==ENOSPC);
+	KASSERT(bitmap_alloc_run(b, 21, &x)==0 && x == TESTSIZE-21);
+
+	/* bitmap_alloc_range keeps inside its bounds (32 is still clear) */
+	bitmap_unmark(b, 100);
+	bitmap_unmark(b, 200);
+	KASSERT(bitmap_alloc_range(b, 96, 200, 150, &x)==0 && x == 100);
+	KASSERT(bitmap_alloc_range(b, 96, 200, 0, &x)==ENOSPC);
+	KASSERT(bitmap_alloc_range(b, 200, TESTSIZE, 0, &x)==0 && x == 200);
+	KASSERT(bitmap_alloc_range(b, 0, 96, 50, &x)==0 && x == 32);
+
+	/* runs marked and unmarked at once, word-aligned or not */
+	bitmap_unmark_run(b, 5, 30);
+	for (i=0; i<TESTSIZE; i++) {
+		KASSERT(!bitmap_isset(b, i) == (i >= 5 && i < 35));
+	}
+	KASSERT(bitmap_alloc(b, &x)==0 && x == 5);
+	bitmap_mark_run(b, 6, 29);
+	KASSERT(bitmap_alloc(b, &x)==ENOSPC);
+	bitmap_unmark_run(b, 16, 8);
+	KASSERT(bitmap_alloc_run(b, 8, &x)==0 && x == 16);
+	bitmap_unmark_run(b, TESTSIZE-3, 3);
+	bitmap_mark_run(b, TESTSIZE-3, 3);
+	KASSERT(bitmap_alloc(b, &x)==ENOSPC);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
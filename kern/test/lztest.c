@@ -0,0 +1,135 @@
+/*
+ * LZ test.
+ *
+ * Compresses pages of a few kinds (zeros, a short repeating pattern,
+ * text-like bytes from a small alphabet, noise, and half of each),
+ * checks that each one decompresses to what went in and that it is
+ * refused when the output has no room, and that damaged input never
+ * decompresses past the end of its buffer. Prints how well each kind
+ * compressed and how fast.
+ *
+ * Usage: lzt [rounds]
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <lz.h>
+#include <test.h>
+
+#define LZT_LEN		4096
+#define LZT_KINDS	5
+#define LZT_ROUNDS	200
+
+static const char *const lzt_names[LZT_KINDS] = {
+	"zeros", "pattern", "text", "noise", "half noise",
+};
+
+static unsigned lzt_seed;
+
+/* A cheap random number; the kernel's random device may not exist. */
+static
+unsigned
+lzt_rand(void)
+{
+	lzt_seed = lzt_seed * 1103515245 + 12345;
+	return lzt_seed >> 16;
+}
+
+static
+void
+lzt_fill(uint8_t *buf, unsigned kind)
+{
+	unsigned i;
+
+	for (i=0; i<LZT_LEN; i++) {
+		switch (kind) {
+		    case 0: buf[i] = 0; break;
+		    case 1: buf[i] = "0123456"[i % 7]; break;
+		    case 2: buf[i] = "etaoin shrdlu"[lzt_rand() % 13]; break;
+		    case 3: buf[i] = lzt_rand(); break;
+		    default: buf[i] = i < LZT_LEN / 2 ? 0 : lzt_rand(); break;
+		}
+	}
+}
+
+static
+bool
+lzt_same(const uint8_t *a, const uint8_t *b)
+{
+	unsigned i;
+
+	for (i=0; i<LZT_LEN; i++) {
+		if (a[i] != b[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int
+lztest(int nargs, char **args)
+{
+	uint8_t *in, *out, *back, *work;
+	unsigned rounds, kind, r, bad;
+	size_t clen, len, total[LZT_KINDS];
+	uint64_t before, took;
+
+	rounds = nargs > 1 ? (unsigned)atoi(args[1]) : LZT_ROUNDS;
+	if (rounds < 1) {
+		kprintf("Usage: lzt [rounds]\n");
+		return 1;
+	}
+
+	in = kmalloc(LZT_LEN);
+	out = kmalloc(2 * LZT_LEN);
+	back = kmalloc(LZT_LEN);
+	work = kmalloc(LZ_WORKSIZE);
+	if (in == NULL || out == NULL || back == NULL || work == NULL) {
+		panic("lztest: Out of memory\n");
+	}
+
+	kprintf("Starting LZ test: %u rounds...\n", rounds);
+	lzt_seed = 1;
+	bad = 0;
+	for (kind=0; kind<LZT_KINDS; kind++) {
+		total[kind] = 0;
+	}
+	before = clock_monotonic_ns();
+	for (r=0; r<rounds; r++) {
+		for (kind=0; kind<LZT_KINDS; kind++) {
+			lzt_fill(in, kind);
+			clen = lz_compress(in, LZT_LEN, out, 2 * LZT_LEN, work);
+			if (clen == 0 ||
+			    lz_decompress(out, clen, back, LZT_LEN, &len) ||
+			    len != LZT_LEN || !lzt_same(in, back)) {
+				bad++;
+				continue;
+			}
+			total[kind] += clen;
+			if (lz_compress(in, LZT_LEN, out, clen - 1, work) != 0) {
+				bad++;
+			}
+
+			/* Damaged, it may decode to anything, but in bounds. */
+			out[lzt_rand() % clen] ^= 1 << (lzt_rand() % 8);
+			(void)lz_decompress(out, clen, back, LZT_LEN, &len);
+		}
+	}
+	took = clock_monotonic_ns() - before;
+
+	for (kind=0; kind<LZT_KINDS; kind++) {
+		kprintf("lz: %-10s %u bytes to %u on average\n",
+			lzt_names[kind], LZT_LEN,
+			(unsigned)(total[kind] / rounds));
+	}
+	kprintf("lz: %u pages in %u ms; %u wrong\n", rounds * LZT_KINDS,
+		(unsigned)(took / 1000000), bad);
+
+	kfree(work);
+	kfree(back);
+	kfree(out);
+	kfree(in);
+
+	kprintf("LZ test %s.\n", bad ? "FAILED" : "done");
+	return 0;
+}
@@ -31,7 +31,10 @@
  * Test code for kmalloc.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
+#include <vm.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -45,6 +48,8 @@
  *
  * mallocstress does the same thing, but from NTHREADS different
  * threads at once.
+ *
+ * mallocbench, further down, times kfree.
  */
 
 #define NTRIES   1200
@@ -137,3 +142,95 @@ mallocstress(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Time kmalloc/kfree of a small block with few and with many pages of
+ * kernel heap in use, to check that the cost of kfree does not grow
+ * with the size of the heap.
+ *
+ * The heap is filled with LARGESIZE blocks, each page of which the
+ * subpage allocator keeps separately; one extra small block pins the
+ * page the timed ones come from, so that page is not given back and
+ * fetched again on every round.
+ */
+
+#define BENCHROUNDS 10000
+#define BENCHSIZE   16
+#define LARGESIZE   1024
+#define BENCHPAGES  256
+
+static
+uint32_t
+mallocbench_round(void)
+{
+	time_t s1, s2, rs;
+	uint32_t ns1, ns2, rns;
+	void *ptr;
+	unsigned i;
+
+	gettime(&s1, &ns1);
+	for (i=0; i<BENCHROUNDS; i++) {
+		ptr = kmalloc(BENCHSIZE);
+		if (ptr == NULL) {
+			panic("mallocbench: Out of memory\n");
+		}
+		kfree(ptr);
+	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &rs, &rns);
+
+	/* nanoseconds per kmalloc/kfree pair */
+	return (uint32_t)rs * (1000000000 / BENCHROUNDS) + rns / BENCHROUNDS;
+}
+
+int
+mallocbench(int nargs, char **args)
+{
+	unsigned npages, nblocks, i;
+	void **blocks;
+	void *pin;
+	uint32_t before, after;
+
+	npages = BENCHPAGES;
+	if (nargs > 1) {
+		npages = atoi(args[1]);
+	}
+	nblocks = npages * (PAGE_SIZE / LARGESIZE);
+
+	pin = kmalloc(BENCHSIZE);
+	blocks = kmalloc(nblocks * sizeof(void *));
+	if (pin == NULL || blocks == NULL) {
+		kfree(pin);
+		kfree(blocks);
+		kprintf("mallocbench: Out of memory\n");
+		return ENOMEM;
+	}
+
+	kprintf("Starting kmalloc benchmark...\n");
+	before = mallocbench_round();
+
+	for (i=0; i<nblocks; i++) {
+		blocks[i] = kmalloc(LARGESIZE);
+		if (blocks[i] == NULL) {
+			kprintf("mallocbench: Out of memory after %u pages\n",
+				i / (PAGE_SIZE / LARGESIZE));
+			break;
+		}
+	}
+	nblocks = i;
+
+	after = mallocbench_round();
+
+	for (i=0; i<nblocks; i++) {
+		kfree(blocks[i]);
+	}
+	kfree(blocks);
+	kfree(pin);
+
+	kprintf("kmalloc+kfree of %u bytes: %u ns with an empty heap, "
+		"%u ns with %u more pages\n", BENCHSIZE, before, after,
+		nblocks / (PAGE_SIZE / LARGESIZE));
+	kprintf("kmalloc benchmark done\n");
+
+	return 0;
+}
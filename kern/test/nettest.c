@@ -29,16 +29,83 @@
 
 /*
  * Network test code.
+ *
+ * "net [addr]" sends a packet on lnet0 to ADDR, or to every machine
+ * if no address is given; "net -r" waits for a packet on lnet0 and
+ * says what it was. Run "net -r" on one System/161 and "net" on
+ * another attached to the same hub.
  */
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/lnet.h>
 #include <lib.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
 #include <test.h>
 
+#define NETTEST_MSG "Hello from OS/161"
+
 int
 nettest(int nargs, char **args)
 {
-	(void)nargs;
-	(void)args;
-	kprintf("No network support available\n");
-	return 1;
+	struct {
+		struct lnet_pkthdr ph;
+		char data[64];
+	} pkt;
+	struct iovec iov;
+	struct uio ku;
+	struct vnode *vn;
+	char path[16];
+	bool recv = false;
+	uint16_t addr = LNET_BROADCAST;
+	size_t len;
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: net [addr | -r]\n");
+		return EINVAL;
+	}
+	if (nargs == 2 && !strcmp(args[1], "-r")) {
+		recv = true;
+	}
+	else if (nargs == 2) {
+		addr = atoi(args[1]);
+	}
+
+	/* vfs_open destroys the string it's passed */
+	strcpy(path, "lnet0:");
+	result = vfs_open(path, O_RDWR, 0, &vn);
+	if (result) {
+		kprintf("net: lnet0: %s\n", strerror(result));
+		return result;
+	}
+
+	if (recv) {
+		uio_kinit(&iov, &ku, &pkt, sizeof(pkt) - 1, 0, UIO_READ);
+		result = VOP_READ(vn, &ku);
+		if (result == 0) {
+			len = sizeof(pkt) - 1 - ku.uio_resid - sizeof(pkt.ph);
+			pkt.data[len] = 0;
+			kprintf("net: %u bytes from %u: %s\n", pkt.ph.lph_len,
+				pkt.ph.lph_addr, pkt.data);
+		}
+	}
+	else {
+		pkt.ph.lph_addr = addr;
+		len = strlen(NETTEST_MSG) + 1;
+		memcpy(pkt.data, NETTEST_MSG, len);
+		uio_kinit(&iov, &ku, &pkt, sizeof(pkt.ph) + len, 0, UIO_WRITE);
+		result = VOP_WRITE(vn, &ku);
+		if (result == 0) {
+			kprintf("net: Sent %u bytes to %u\n", len, addr);
+		}
+	}
+	if (result) {
+		kprintf("net: %s\n", strerror(result));
+	}
+
+	vfs_close(vn);
+	return result;
 }
@@ -0,0 +1,231 @@
+/*
+ * Ring test.
+ *
+ * Runs some producer threads putting numbered items into one struct
+ * ring and some consumer threads taking them out, each backing off
+ * when the ring is full or empty, and checks that every item came out
+ * exactly once and that no consumer saw a producer's items out of
+ * order. Then does the same with one producer and one consumer on a
+ * struct spscring, where the order must be exact. The ring is small,
+ * so both ends run into its limits often.
+ *
+ * Usage: rgt [producers] [consumers] [items each]
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <atomic.h>
+#include <ring.h>
+#include <test.h>
+
+#define RGT_SIZE	16
+#define RGT_MAXTHREADS	16
+#define RGT_COUNT	10000
+
+static struct ring *rgt_ring;
+static struct spscring *rgt_spsc;
+static unsigned rgt_count;		/* items per producer */
+static volatile unsigned rgt_taken;	/* by all consumers */
+static unsigned rgt_total;
+static unsigned char *rgt_seen;		/* times each item came out */
+static volatile unsigned rgt_bad;
+static volatile unsigned rgt_full, rgt_empty;
+static struct semaphore *rgt_donesem;
+
+/* Item I of producer P, as a pointer; never NULL. */
+#define RGT_ITEM(p, i)	((void *)(uintptr_t)((p) * rgt_count + (i) + 1))
+#define RGT_NUM(ptr)	((unsigned)(uintptr_t)(ptr) - 1)
+
+static
+void
+rgt_producer(void *junk, unsigned long p)
+{
+	unsigned i;
+
+	(void)junk;
+
+	for (i=0; i<rgt_count; i++) {
+		while (!ring_put(rgt_ring, RGT_ITEM(p, i))) {
+			atomic_inc(&rgt_full);
+			thread_yield();
+		}
+	}
+	V(rgt_donesem);
+}
+
+static
+void
+rgt_consumer(void *junk, unsigned long c)
+{
+	unsigned last[RGT_MAXTHREADS];
+	unsigned i, n, p;
+	void *ptr;
+
+	(void)junk;
+	(void)c;
+
+	for (i=0; i<RGT_MAXTHREADS; i++) {
+		last[i] = 0;
+	}
+	while (rgt_taken < rgt_total) {
+		ptr = ring_get(rgt_ring);
+		if (ptr == NULL) {
+			atomic_inc(&rgt_empty);
+			thread_yield();
+			continue;
+		}
+		n = RGT_NUM(ptr);
+		if (n >= rgt_total) {
+			atomic_inc(&rgt_bad);
+			continue;
+		}
+		/* Each producer's items go in, and so come out, in order. */
+		p = n / rgt_count;
+		if (n % rgt_count + 1 <= last[p]) {
+			atomic_inc(&rgt_bad);
+		}
+		last[p] = n % rgt_count + 1;
+		rgt_seen[n]++;
+		atomic_inc(&rgt_taken);
+	}
+	V(rgt_donesem);
+}
+
+static
+void
+rgt_spscproducer(void *junk, unsigned long unused)
+{
+	unsigned i;
+
+	(void)junk;
+	(void)unused;
+
+	for (i=0; i<rgt_total; i++) {
+		while (!spscring_put(rgt_spsc, RGT_ITEM(0, i))) {
+			rgt_full++;
+			thread_yield();
+		}
+	}
+	V(rgt_donesem);
+}
+
+static
+void
+rgt_spscconsumer(void *junk, unsigned long unused)
+{
+	unsigned i;
+	void *ptr;
+
+	(void)junk;
+	(void)unused;
+
+	for (i=0; i<rgt_total; i++) {
+		while ((ptr = spscring_get(rgt_spsc)) == NULL) {
+			rgt_empty++;
+			thread_yield();
+		}
+		if (RGT_NUM(ptr) != i) {
+			rgt_bad++;
+		}
+	}
+	V(rgt_donesem);
+}
+
+static
+void
+rgt_fork(const char *name, void (*func)(void *, unsigned long),
+	 unsigned long num)
+{
+	int result;
+
+	result = thread_fork(name, NULL, func, NULL, num);
+	if (result) {
+		panic("ringtest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+ringtest(int nargs, char **args)
+{
+	unsigned nprod = 4, ncons = 4, i, lost;
+	uint64_t before, took;
+
+	rgt_count = RGT_COUNT;
+	if (nargs > 1) {
+		nprod = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		ncons = atoi(args[2]);
+	}
+	if (nargs > 3) {
+		rgt_count = atoi(args[3]);
+	}
+	if (nprod < 1 || nprod > RGT_MAXTHREADS ||
+	    ncons < 1 || ncons > RGT_MAXTHREADS || rgt_count < 1) {
+		kprintf("Usage: rgt [producers] [consumers] [items each]\n");
+		kprintf("(1 to %u threads of each)\n", RGT_MAXTHREADS);
+		return 1;
+	}
+	rgt_total = nprod * rgt_count;
+
+	rgt_ring = ring_create(RGT_SIZE);
+	rgt_spsc = spscring_create(RGT_SIZE);
+	rgt_seen = kmalloc(rgt_total);
+	rgt_donesem = sem_create("ringtest", 0);
+	if (rgt_ring == NULL || rgt_spsc == NULL || rgt_seen == NULL ||
+	    rgt_donesem == NULL) {
+		panic("ringtest: Out of memory\n");
+	}
+	bzero(rgt_seen, rgt_total);
+	rgt_taken = rgt_bad = rgt_full = rgt_empty = 0;
+
+	kprintf("Starting ring test: %u producers, %u consumers, "
+		"%u items each...\n", nprod, ncons, rgt_count);
+	before = clock_monotonic_ns();
+	for (i=0; i<ncons; i++) {
+		rgt_fork("ringtest consumer", rgt_consumer, i);
+	}
+	for (i=0; i<nprod; i++) {
+		rgt_fork("ringtest producer", rgt_producer, i);
+	}
+	for (i=0; i<nprod + ncons; i++) {
+		P(rgt_donesem);
+	}
+	took = clock_monotonic_ns() - before;
+	lost = 0;
+	for (i=0; i<rgt_total; i++) {
+		if (rgt_seen[i] != 1) {
+			lost++;
+		}
+	}
+	kprintf("ring: %u items in %u ms; %u missing or repeated, "
+		"%u out of order; %u full, %u empty\n", rgt_total,
+		(unsigned)(took / 1000000), lost, rgt_bad, rgt_full,
+		rgt_empty);
+	lost += rgt_bad;
+
+	rgt_bad = rgt_full = rgt_empty = 0;
+	before = clock_monotonic_ns();
+	rgt_fork("ringtest spsc consumer", rgt_spscconsumer, 0);
+	rgt_fork("ringtest spsc producer", rgt_spscproducer, 0);
+	P(rgt_donesem);
+	P(rgt_donesem);
+	took = clock_monotonic_ns() - before;
+	kprintf("spscring: %u items in %u ms; %u out of order; "
+		"%u full, %u empty\n", rgt_total,
+		(unsigned)(took / 1000000), rgt_bad, rgt_full, rgt_empty);
+	lost += rgt_bad;
+	while (spscring_get(rgt_spsc) != NULL || ring_get(rgt_ring) != NULL) {
+		lost++;
+	}
+
+	sem_destroy(rgt_donesem);
+	kfree(rgt_seen);
+	spscring_destroy(rgt_spsc);
+	ring_destroy(rgt_ring);
+
+	kprintf("Ring test %s.\n", lost ? "FAILED" : "done");
+	return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Scheduler latency test.
+ *
+ * Starts some cpu-bound threads that spin until told to stop, then
+ * has a thread that does nothing but clocknap(1) time each nap. A
+ * nap should last at most one timer tick, LT_GRANULARITY usec; how
+ * much longer than that it takes is how long the napping thread
+ * waited behind the hogs for the cpu once it had woken. With a
+ * scheduler that favours threads that sleep, that should stay small
+ * however many hogs there are.
+ *
+ * Usage: sch [hogs]
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define SCHED_NHOGS	4
+#define SCHED_NNAPS	200
+#define SCHED_TICKUS	10000		/* LT_GRANULARITY */
+
+static volatile bool sched_stop;
+static struct semaphore *sched_donesem;
+
+static
+void
+schedhog(void *junk, unsigned long num)
+{
+	volatile unsigned long count = 0;
+
+	(void)junk;
+	(void)num;
+
+	while (!sched_stop) {
+		count++;
+	}
+	V(sched_donesem);
+}
+
+int
+schedtest(int nargs, char **args)
+{
+	time_t s1, s2, rs;
+	uint32_t ns1, ns2, rns, nap, maxnap, total;
+	unsigned nhogs, i, late;
+	int result;
+
+	nhogs = SCHED_NHOGS;
+	if (nargs > 1) {
+		nhogs = atoi(args[1]);
+	}
+
+	sched_donesem = sem_create("schedtest", 0);
+	if (sched_donesem == NULL) {
+		panic("schedtest: sem_create failed\n");
+	}
+	sched_stop = false;
+
+	kprintf("Starting scheduler latency test with %u hogs...\n", nhogs);
+	for (i=0; i<nhogs; i++) {
+		result = thread_fork("schedhog", NULL, schedhog, NULL, i);
+		if (result) {
+			panic("schedtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	/* Give the hogs time to use up their allotments and sink. */
+	clocknap(SCHED_NPRIO * SCHEDULE_HARDCLOCKS * (nhogs + 1));
+
+	total = 0;
+	maxnap = 0;
+	late = 0;
+	for (i=0; i<SCHED_NNAPS; i++) {
+		gettime(&s1, &ns1);
+		clocknap(1);
+		gettime(&s2, &ns2);
+		getinterval(s1, ns1, s2, ns2, &rs, &rns);
+
+		/* in usec, which keeps the sums in 32 bits */
+		nap = (uint32_t)rs * 1000000 + rns / 1000;
+		total += nap;
+		if (nap > maxnap) {
+			maxnap = nap;
+		}
+		if (nap > SCHED_TICKUS + SCHED_TICKUS / 2) {
+			late++;
+		}
+	}
+
+	sched_stop = true;
+	for (i=0; i<nhogs; i++) {
+		P(sched_donesem);
+	}
+	sem_destroy(sched_donesem);
+
+	kprintf("%u naps of one tick (%u us): average %u us, max %u us, "
+		"%u late\n", SCHED_NNAPS, SCHED_TICKUS,
+		total / SCHED_NNAPS, maxnap, late);
+	kprintf("Scheduler latency test done.\n");
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Spinlock stress test and benchmark.
+ *
+ * Starts some threads that do nothing but take one spinlock, bump a
+ * shared count, and let go, until the count reaches its total; first
+ * with a plain test-and-set spinlock, then with a ticket lock. For
+ * each, prints how long that took and how evenly the acquisitions
+ * were shared out. With more than one cpu, the ticket lock should
+ * come out about even; the plain one goes to whichever cpu's
+ * test-and-set gets in first, which is often the one that just let go.
+ *
+ * Usage: slk [threads] [acquisitions]
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define SPIN_NTHREADS	8
+#define SPIN_MAXTHREADS	32
+#define SPIN_TOTAL	100000
+
+static struct spinlock spin_lock;
+static volatile unsigned spin_count;
+static unsigned spin_total;
+static unsigned spin_mine[SPIN_MAXTHREADS];
+static volatile bool spin_go;
+static struct semaphore *spin_donesem;
+
+static
+void
+spinthread(void *junk, unsigned long num)
+{
+	unsigned mine = 0;
+
+	(void)junk;
+
+	while (!spin_go) {
+		/* start together */
+	}
+	while (1) {
+		spinlock_acquire(&spin_lock);
+		if (spin_count >= spin_total) {
+			spinlock_release(&spin_lock);
+			break;
+		}
+		spin_count++;
+		spinlock_release(&spin_lock);
+		mine++;
+	}
+	spin_mine[num] = mine;
+	V(spin_donesem);
+}
+
+static
+void
+spinrun(const char *kind, bool ticket, unsigned nthreads)
+{
+	time_t s1, s2, rs;
+	uint32_t ns1, ns2, rns;
+	unsigned i, min, max;
+	int result;
+
+	if (ticket) {
+		spinlock_init_ticket(&spin_lock);
+	}
+	else {
+		spinlock_init(&spin_lock);
+	}
+	spin_count = 0;
+	spin_go = false;
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("spinthread", NULL, spinthread, NULL, i);
+		if (result) {
+			panic("spinlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	gettime(&s1, &ns1);
+	spin_go = true;
+	for (i=0; i<nthreads; i++) {
+		P(spin_donesem);
+	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &rs, &rns);
+
+	KASSERT(spin_count == spin_total);
+	spinlock_cleanup(&spin_lock);
+
+	min = max = spin_mine[0];
+	for (i=1; i<nthreads; i++) {
+		if (spin_mine[i] < min) {
+			min = spin_mine[i];
+		}
+		if (spin_mine[i] > max) {
+			max = spin_mine[i];
+		}
+	}
+	kprintf("%-7s %u acquisitions in %lu.%09lu s; "
+		"per thread min %u, max %u\n", kind, spin_total,
+		(unsigned long)rs, (unsigned long)rns, min, max);
+}
+
+int
+spinlocktest(int nargs, char **args)
+{
+	unsigned nthreads;
+
+	nthreads = SPIN_NTHREADS;
+	spin_total = SPIN_TOTAL;
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		spin_total = atoi(args[2]);
+	}
+	if (nthreads < 1 || nthreads > SPIN_MAXTHREADS) {
+		kprintf("slk: threads must be 1 to %u\n", SPIN_MAXTHREADS);
+		return 0;
+	}
+
+	spin_donesem = sem_create("spinlocktest", 0);
+	if (spin_donesem == NULL) {
+		panic("spinlocktest: sem_create failed\n");
+	}
+
+	kprintf("Starting spinlock test with %u threads...\n", nthreads);
+	spinrun("plain", false, nthreads);
+	spinrun("ticket", true, nthreads);
+
+	sem_destroy(spin_donesem);
+	kprintf("Spinlock test done.\n");
+	return 0;
+}
@@ -0,0 +1,290 @@
+/*
+ * Synchronization benchmarks.
+ *
+ * Three measurements, each printed in ns per operation so that runs
+ * can be compared across changes to synch.c:
+ *
+ *   - uncontended: one thread taking and giving back a semaphore, a
+ *     lock, a handoff lock and a spinlock, timed with the cycle
+ *     counter, which is converted to ns by timing a few clock ticks.
+ *     This runs in a thread bound to one cpu, since the counter is
+ *     per-cpu.
+ *   - contended: 1, 2, 4, ... up to the given number of threads all
+ *     taking one lock to bump a shared count, until the count reaches
+ *     its total; timed with gettime, per acquisition overall.
+ *   - ping-pong: two threads passing a turn back and forth through a
+ *     lock and two CVs; per one-way handoff.
+ *
+ * Usage: synchbench [threads]
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define SB_UNCONTENDED	10000
+#define SB_CONTENDED	20000
+#define SB_PINGPONG	2000
+#define SB_MAXTHREADS	32
+#define SB_CALTICKS	5
+
+static struct semaphore *sb_donesem;
+
+/*
+ * Usec and ns per op from a gettime interval, without 64-bit division.
+ */
+static
+uint32_t
+sb_usec(time_t s1, uint32_t ns1, time_t s2, uint32_t ns2)
+{
+	time_t rs;
+	uint32_t rns;
+
+	getinterval(s1, ns1, s2, ns2, &rs, &rns);
+	return (uint32_t)rs * 1000000 + rns / 1000;
+}
+
+static
+uint32_t
+sb_nsperop(uint32_t usec, unsigned ops)
+{
+	return (usec / ops) * 1000 + ((usec % ops) * 1000) / ops;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Uncontended
+
+static
+void
+sb_uncontended(void *junk, unsigned long junk2)
+{
+	struct semaphore *sem;
+	struct lock *lock, *hlock;
+	struct spinlock spin;
+	time_t s1, s2;
+	uint32_t ns1, ns2, c0, c1, usec, mhz;
+	unsigned i;
+
+	(void)junk;
+	(void)junk2;
+
+	sem = sem_create("sb_sem", 1);
+	lock = lock_create("sb_lock");
+	hlock = lock_create_handoff("sb_hlock");
+	if (sem == NULL || lock == NULL || hlock == NULL) {
+		panic("synchbench: out of memory\n");
+	}
+	spinlock_init(&spin);
+
+	/* Calibrate: cycles over a few clock ticks. */
+	gettime(&s1, &ns1);
+	c0 = cpu_cycles();
+	clocknap(SB_CALTICKS);
+	c1 = cpu_cycles();
+	gettime(&s2, &ns2);
+	usec = sb_usec(s1, ns1, s2, ns2);
+	mhz = (c1 - c0) / (usec ? usec : 1);
+	if (mhz == 0) {
+		mhz = 1;
+	}
+	kprintf("cpu%u: %u MHz\n", curcpu->c_number, mhz);
+
+#define SB_TIME(what, acquire, release) do {				\
+		c0 = cpu_cycles();					\
+		for (i=0; i<SB_UNCONTENDED; i++) {			\
+			acquire;					\
+			release;					\
+		}							\
+		c1 = cpu_cycles();					\
+		kprintf("  %-16s %6u ns/op\n", what,			\
+			(c1 - c0) / SB_UNCONTENDED * 1000 / mhz);	\
+	} while (0)
+
+	kprintf("Uncontended, %u acquire/release pairs:\n", SB_UNCONTENDED);
+	SB_TIME("semaphore", P(sem), V(sem));
+	SB_TIME("lock", lock_acquire(lock), lock_release(lock));
+	SB_TIME("handoff lock", lock_acquire(hlock), lock_release(hlock));
+	SB_TIME("spinlock", spinlock_acquire(&spin), spinlock_release(&spin));
+
+#undef SB_TIME
+
+	spinlock_cleanup(&spin);
+	lock_destroy(hlock);
+	lock_destroy(lock);
+	sem_destroy(sem);
+	V(sb_donesem);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Contended
+
+static struct lock *sb_lock;
+static volatile unsigned sb_count;
+static volatile bool sb_go;
+
+static
+void
+sb_contender(void *junk, unsigned long junk2)
+{
+	(void)junk;
+	(void)junk2;
+
+	while (!sb_go) {
+		thread_yield();
+	}
+	while (1) {
+		lock_acquire(sb_lock);
+		if (sb_count >= SB_CONTENDED) {
+			lock_release(sb_lock);
+			break;
+		}
+		sb_count++;
+		lock_release(sb_lock);
+	}
+	V(sb_donesem);
+}
+
+static
+void
+sb_contended(unsigned nthreads)
+{
+	time_t s1, s2;
+	uint32_t ns1, ns2;
+	unsigned i;
+	int result;
+
+	sb_count = 0;
+	sb_go = false;
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("sb_contender", NULL, sb_contender,
+				     NULL, i);
+		if (result) {
+			panic("synchbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	gettime(&s1, &ns1);
+	sb_go = true;
+	for (i=0; i<nthreads; i++) {
+		P(sb_donesem);
+	}
+	gettime(&s2, &ns2);
+
+	kprintf("  %2u threads       %6u ns/op\n", nthreads,
+		sb_nsperop(sb_usec(s1, ns1, s2, ns2), SB_CONTENDED));
+}
+
+////////////////////////////////////////////////////////////
+//
+// CV ping-pong
+
+static struct cv *sb_cvs[2];
+static volatile unsigned sb_turn;
+
+static
+void
+sb_ponger(void *junk, unsigned long me)
+{
+	unsigned i;
+
+	(void)junk;
+
+	lock_acquire(sb_lock);
+	for (i=0; i<SB_PINGPONG; i++) {
+		while (sb_turn != me) {
+			cv_wait(sb_cvs[me], sb_lock);
+		}
+		sb_turn = 1 - me;
+		cv_signal(sb_cvs[1 - me], sb_lock);
+	}
+	lock_release(sb_lock);
+	V(sb_donesem);
+}
+
+static
+void
+sb_pingpong(void)
+{
+	time_t s1, s2;
+	uint32_t ns1, ns2;
+	unsigned i;
+	int result;
+
+	sb_cvs[0] = cv_create("sb_cv0");
+	sb_cvs[1] = cv_create("sb_cv1");
+	if (sb_cvs[0] == NULL || sb_cvs[1] == NULL) {
+		panic("synchbench: cv_create failed\n");
+	}
+	sb_turn = 0;
+
+	gettime(&s1, &ns1);
+	for (i=0; i<2; i++) {
+		result = thread_fork("sb_ponger", NULL, sb_ponger, NULL, i);
+		if (result) {
+			panic("synchbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	P(sb_donesem);
+	P(sb_donesem);
+	gettime(&s2, &ns2);
+
+	kprintf("CV ping-pong, %u round trips: %u ns per handoff\n",
+		SB_PINGPONG,
+		sb_nsperop(sb_usec(s1, ns1, s2, ns2), 2 * SB_PINGPONG));
+
+	cv_destroy(sb_cvs[1]);
+	cv_destroy(sb_cvs[0]);
+}
+
+int
+synchbench(int nargs, char **args)
+{
+	unsigned maxthreads, n;
+	int result;
+
+	maxthreads = 8;
+	if (nargs > 1) {
+		maxthreads = atoi(args[1]);
+	}
+	if (maxthreads < 1 || maxthreads > SB_MAXTHREADS) {
+		kprintf("Usage: synchbench [threads], at most %u\n",
+			SB_MAXTHREADS);
+		return 0;
+	}
+
+	sb_donesem = sem_create("synchbench", 0);
+	sb_lock = lock_create("synchbench");
+	if (sb_donesem == NULL || sb_lock == NULL) {
+		panic("synchbench: out of memory\n");
+	}
+
+	kprintf("Starting synchronization benchmarks...\n");
+
+	result = thread_fork_bound("sb_uncontended", NULL, curcpu->c_self,
+				   sb_uncontended, NULL, 0);
+	if (result) {
+		panic("synchbench: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	P(sb_donesem);
+
+	kprintf("Contended lock, %u acquisitions in all:\n", SB_CONTENDED);
+	for (n = 1; n <= maxthreads; n *= 2) {
+		sb_contended(n);
+	}
+
+	sb_pingpong();
+
+	lock_destroy(sb_lock);
+	sem_destroy(sb_donesem);
+	kprintf("Synchronization benchmarks done.\n");
+	return 0;
+}
@@ -32,6 +32,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
@@ -41,6 +42,7 @@
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
 #define NCVLOOPS      5
+#define NRWLOOPS      60
 #define NTHREADS      32
 
 static volatile unsigned long testval1;
@@ -179,6 +181,16 @@ fail(unsigned long num, const char *msg)
 	thread_exit();
 }
 
+/*
+ * The lock test runs twice, with testlock and then with a handoff
+ * lock, timing each and counting how often a thread got the lock
+ * straight back after releasing it. With all the threads wanting it
+ * all the time, that is the others being passed over.
+ */
+static struct lock *locktestlock;
+static volatile unsigned long locklast;
+static unsigned lockrepeats;
+
 static
 void
 locktestthread(void *junk, unsigned long num)
@@ -187,7 +199,11 @@ locktestthread(void *junk, unsigned long num)
 	(void)junk;
 
 	for (i=0; i<NLOCKLOOPS; i++) {
-		lock_acquire(testlock);
+		lock_acquire(locktestlock);
+		if (locklast == num) {
+			lockrepeats++;
+		}
+		locklast = num;
 		testval1 = num;
 		testval2 = num*num;
 		testval3 = num%3;
@@ -216,7 +232,7 @@ locktestthread(void *junk, unsigned long num)
 			fail(num, "testval3/num");
 		}
 
-		lock_release(testlock);
+		lock_release(locktestlock);
 	}
 	V(donesem);
 #ifdef UW
@@ -225,17 +241,19 @@ locktestthread(void *junk, unsigned long num)
 }
 
 
-int
-locktest(int nargs, char **args)
+static
+void
+locktestrun(const char *kind, struct lock *lock)
 {
+	time_t s1, s2, rs;
+	uint32_t ns1, ns2, rns;
 	int i, result;
 
-	(void)nargs;
-	(void)args;
-
-	inititems();
-	kprintf("Starting lock test...\n");
+	locktestlock = lock;
+	locklast = NTHREADS;
+	lockrepeats = 0;
 
+	gettime(&s1, &ns1);
 	for (i=0; i<NTHREADS; i++) {
 		result = thread_fork("synchtest", NULL, locktestthread,
 				     NULL, i);
@@ -247,6 +265,33 @@ locktest(int nargs, char **args)
 	for (i=0; i<NTHREADS; i++) {
 		P(donesem);
 	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &rs, &rns);
+
+	kprintf("%s: %u acquisitions in %lu.%09lu s, %u by the thread "
+		"that had it last\n", kind, NTHREADS * NLOCKLOOPS,
+		(unsigned long)rs, (unsigned long)rns, lockrepeats);
+}
+
+int
+locktest(int nargs, char **args)
+{
+	struct lock *handoff;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting lock test...\n");
+
+	locktestrun("plain", testlock);
+
+	handoff = lock_create_handoff("testlock handoff");
+	if (handoff == NULL) {
+		panic("locktest: lock_create_handoff failed\n");
+	}
+	locktestrun("handoff", handoff);
+	lock_destroy(handoff);
 
 #ifdef UW
   cleanitems();
@@ -347,3 +392,184 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Reader-writer lock test. One thread in four writes: it makes the
+ * test values inconsistent, yields, and puts them right again, all
+ * with the lock held for writing. The rest read, and check that they
+ * never see the values half-written and that no writer is in at the
+ * same time. The most readers seen in at once is printed at the end;
+ * if it is 1, readers are not getting in together.
+ */
+
+static struct rwlock *testrw;
+static struct spinlock rwcount_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rwreaders, rwwriters, rwmaxreaders;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	panic("rwtest: failed\n");
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % 4 == 0) {
+			rwlock_acquire_write(testrw);
+			spinlock_acquire(&rwcount_lock);
+			if (rwreaders != 0 || rwwriters != 0) {
+				rwfail(num, "writer not alone");
+			}
+			rwwriters++;
+			spinlock_release(&rwcount_lock);
+
+			testval1 = num;
+			thread_yield();
+			testval2 = num*num;
+			testval3 = num%3;
+
+			spinlock_acquire(&rwcount_lock);
+			rwwriters--;
+			spinlock_release(&rwcount_lock);
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+			spinlock_acquire(&rwcount_lock);
+			if (rwwriters != 0) {
+				rwfail(num, "reader in with a writer");
+			}
+			rwreaders++;
+			if (rwreaders > rwmaxreaders) {
+				rwmaxreaders = rwreaders;
+			}
+			spinlock_release(&rwcount_lock);
+
+			if (testval2 != testval1*testval1 ||
+			    testval3 != testval1%3) {
+				rwfail(num, "saw a half-done write");
+			}
+			thread_yield();
+
+			spinlock_acquire(&rwcount_lock);
+			rwreaders--;
+			spinlock_release(&rwcount_lock);
+			rwlock_release_read(testrw);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	testval1 = testval2 = testval3 = 0;
+	rwreaders = rwwriters = rwmaxreaders = 0;
+
+	kprintf("Starting rwlock test...\n");
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, rwtestthread,
+				     NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	rwlock_destroy(testrw);
+	testrw = NULL;
+	kprintf("Most readers at once: %u\n", rwmaxreaders);
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+/*
+ * Timed waits: nobody will V the semaphore or signal the cv, so each
+ * wait must come back with ETIMEDOUT, and not much before its time.
+ * Then once with a V already done, which must not time out.
+ */
+#define TIMEDTICKS	5
+#define TIMEDMINNS	((TIMEDTICKS - 1) * 10000000)	/* LT_GRANULARITY */
+
+static
+void
+checktimed(const char *what, int result, int want, time_t s1, uint32_t ns1)
+{
+	time_t s2, rs;
+	uint32_t ns2, rns;
+
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &rs, &rns);
+	if (result != want) {
+		panic("timedtest: %s returned %d, expected %d\n",
+		      what, result, want);
+	}
+	if (want == ETIMEDOUT && rs == 0 && rns < TIMEDMINNS) {
+		panic("timedtest: %s timed out after only %u ns\n",
+		      what, rns);
+	}
+	kprintf("%s: %d after %lu.%09lu s\n", what, result,
+		(unsigned long)rs, (unsigned long)rns);
+}
+
+int
+timedtest(int nargs, char **args)
+{
+	struct semaphore *sem;
+	time_t s1;
+	uint32_t ns1;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	sem = sem_create("timedsem", 0);
+	if (sem == NULL) {
+		panic("timedtest: sem_create failed\n");
+	}
+
+	kprintf("Starting timed wait test...\n");
+
+	gettime(&s1, &ns1);
+	result = P_timed(sem, TIMEDTICKS);
+	checktimed("P_timed", result, ETIMEDOUT, s1, ns1);
+
+	V(sem);
+	gettime(&s1, &ns1);
+	result = P_timed(sem, TIMEDTICKS);
+	checktimed("P_timed after V", result, 0, s1, ns1);
+
+	lock_acquire(testlock);
+	gettime(&s1, &ns1);
+	result = cv_timedwait(testcv, testlock, TIMEDTICKS);
+	KASSERT(lock_do_i_hold(testlock));
+	lock_release(testlock);
+	checktimed("cv_timedwait", result, ETIMEDOUT, s1, ns1);
+
+	sem_destroy(sem);
+	kprintf("Timed wait test done.\n");
+	return 0;
+}
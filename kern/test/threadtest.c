@@ -32,6 +32,9 @@
  */
 #include <types.h>
 #include <lib.h>
+#include <clock.h>
+#include <current.h>
+#include <cpu.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -144,3 +147,86 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Context switch benchmark.
+ *
+ * Two threads bound to this cpu take turns: each yields TB_ROUNDS
+ * times, and with only the two of them runnable here every yield is a
+ * switch to the other. Then one thread yields alone, which times the
+ * fast path in thread_yield that switches to nobody.
+ */
+
+#define TB_ROUNDS  20000
+
+static
+void
+tb_yielder(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<TB_ROUNDS; i++) {
+		thread_yield();
+	}
+	V(tsem);
+}
+
+/*
+ * Fork NTHR yielders here and return how many usec they took.
+ */
+static
+uint32_t
+tb_run(unsigned nthr)
+{
+	time_t s1, s2, rs;
+	uint32_t ns1, ns2, rns;
+	unsigned i;
+	int result;
+
+	gettime(&s1, &ns1);
+	for (i=0; i<nthr; i++) {
+		result = thread_fork_bound("threadbench", NULL, curcpu->c_self,
+					   tb_yielder, NULL, i);
+		if (result) {
+			panic("threadbench: thread_fork failed %s)\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthr; i++) {
+		P(tsem);
+	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &rs, &rns);
+
+	/* in usec, which keeps the sums in 32 bits */
+	return (uint32_t)rs * 1000000 + rns / 1000;
+}
+
+int
+threadbench(int nargs, char **args)
+{
+	uint32_t usec;
+	unsigned ops;
+
+	(void)nargs;
+	(void)args;
+
+	init_sem();
+	kprintf("Starting context switch benchmark...\n");
+
+	ops = 2 * TB_ROUNDS;
+	usec = tb_run(2);
+	kprintf("ping-pong: %u switches in %u us, %u ns each\n", ops, usec,
+		(usec / ops) * 1000 + ((usec % ops) * 1000) / ops);
+
+	ops = TB_ROUNDS;
+	usec = tb_run(1);
+	kprintf("lone yield: %u yields in %u us, %u ns each\n", ops, usec,
+		(usec / ops) * 1000 + ((usec % ops) * 1000) / ops);
+
+	kprintf("Context switch benchmark done.\n");
+	return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * Work queue test.
+ *
+ * Queues a number of calls from a thread and checks that each is made
+ * exactly once, in order, from thread context. The queue is a fixed
+ * ring, so this backs off and retries when it is full, which it will
+ * be now and then if the count is larger than WORKQUEUE_SIZE.
+ *
+ * Usage: wqt [count]
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <workqueue.h>
+#include <test.h>
+
+#define WQT_COUNT	200
+
+static struct semaphore *wqt_donesem;
+static volatile unsigned wqt_next;
+static volatile unsigned wqt_bad;
+
+static
+void
+wqt_work(void *arg)
+{
+	unsigned n = (unsigned)(uintptr_t)arg;
+
+	if (curthread->t_in_interrupt || n != wqt_next) {
+		wqt_bad++;
+	}
+	wqt_next = n + 1;
+	V(wqt_donesem);
+}
+
+int
+workqtest(int nargs, char **args)
+{
+	unsigned count, i, retries;
+	int result;
+
+	count = WQT_COUNT;
+	if (nargs > 1) {
+		count = atoi(args[1]);
+	}
+
+	wqt_donesem = sem_create("workqtest", 0);
+	if (wqt_donesem == NULL) {
+		panic("workqtest: sem_create failed\n");
+	}
+	wqt_next = 0;
+	wqt_bad = 0;
+
+	kprintf("Starting work queue test with %u calls...\n", count);
+	retries = 0;
+	for (i=0; i<count; i++) {
+		while ((result = workqueue_enqueue(wqt_work,
+						   (void *)(uintptr_t)i))) {
+			KASSERT(result == ENOSPC);
+			retries++;
+			thread_yield();
+		}
+	}
+	for (i=0; i<count; i++) {
+		P(wqt_donesem);
+	}
+	sem_destroy(wqt_donesem);
+
+	kprintf("%u calls, %u out of order or in interrupt, %u retries\n",
+		count, wqt_bad, retries);
+	workqueue_printstats();
+	kprintf("Work queue test %s.\n", wqt_bad ? "FAILED" : "done");
+	return 0;
+}
@@ -28,13 +28,19 @@
  */
 
 #include <types.h>
+#include <kern/time.h>
+#include <kern/timepage.h>
 #include <lib.h>
+#include <vm.h>
 #include <cpu.h>
+#include <spl.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
 #include <lamebus/ltimer.h>
 #include <current.h>
+#include <prof.h>
+#include <rcu.h>
 
 /*
  * Time handling.
@@ -49,29 +55,52 @@
 
 /*
  * Timing constants. These should be tuned along with any work done on
- * the scheduler.
+ * the scheduler. (SCHEDULE_HARDCLOCKS is in clock.h, as the scheduler
+ * uses it too.)
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
+/* timer ticks per second */
+#define TICKS_PER_SECOND (1000000/LT_GRANULARITY)
+
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
- */
-static struct wchan *lbolt;
-/*
- * Once every LT_GRANULARITY usec, everything on minibolt is awakenened by CPU 0
+ * Pending timeouts, soonest first, and the tick count they are
+ * measured against. All under timeout_lock, which is taken before
+ * the lock of any wchan a timeout refers to.
+ *
+ * The timer only ticks while there are timeouts pending; the tick
+ * count stands still otherwise, which is fine since deadlines are
+ * only ever compared with it while it is running.
  */
-static struct wchan *minibolt;
+static struct spinlock timeout_lock = SPINLOCK_INITIALIZER;
+static struct timeout *timeout_queue;
+static unsigned timeout_ticks;
+static bool timeout_ticking;
 
-/* 
- * number of minibolts per second
+/* Where clocknap and clocksleep sleep; only ever woken one by one. */
+static struct wchan *clock_wchan;
+
+/*
+ * The time page, and who is changing it: tp_seq alone tells readers
+ * in user mode, but two cpus could tick at once.
  */
-#define MINI_PER_SECOND (1000000/LT_GRANULARITY);
+static struct timepage *timepage;
+static struct spinlock timepage_lock = SPINLOCK_INITIALIZER;
 
 /*
- * minibolt countdown
+ * The monotonic clock: nanoseconds per cycle, as a fixed-point number
+ * with CLOCK_SHIFT bits of fraction, measured against the rtclock at
+ * boot (CLOCK_CALNS ns of it); zero until then. And the rtclock time
+ * it counts from.
  */
-static int minicount;
+#define CLOCK_SHIFT	24
+#define CLOCK_CALNS	10000000
+static uint32_t clock_nspercycle;
+static time_t clock_bootsecs;
+static uint32_t clock_bootnsecs;
+
+/* True if tick A comes before tick B, allowing for wraparound. */
+#define TICK_BEFORE(a, b) ((int)((a) - (b)) < 0)
 
 /*
  * Setup.
@@ -79,54 +108,317 @@ static int minicount;
 void
 hardclock_bootstrap(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	clock_wchan = wchan_create("clocknap");
+	if (clock_wchan == NULL) {
+		panic("Couldn't create clocknap wchan\n");
 	}
-	minibolt = wchan_create("minibolt");
-	if (minibolt == NULL) {
-		panic("Couldn't create minibolt\n");
+	/* we assume TICKS_PER_SECOND > 0 */
+	KASSERT(TICKS_PER_SECOND > 0);
+}
+
+void
+timepage_bootstrap(void)
+{
+	vaddr_t page;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		panic("timepage_bootstrap: Out of memory\n");
 	}
-	minicount = MINI_PER_SECOND;
-	/* we assume MINI_PER_SECOND > 0 */
-	KASSERT(minicount > 0);
+	bzero((void *)page, PAGE_SIZE);
+	timepage = (struct timepage *)page;
+	timepage_update();
+}
+
+void
+timepage_update(void)
+{
+	volatile struct timepage *tp = timepage;
+	time_t secs;
+	uint32_t nsecs;
+
+	if (tp == NULL) {
+		return;
+	}
+	spinlock_acquire(&timepage_lock);
+	gettime(&secs, &nsecs);
+	tp->tp_seq++;
+	tp->tp_sec = secs;
+	tp->tp_nsec = nsecs;
+	tp->tp_seq++;
+	spinlock_release(&timepage_lock);
+}
+
+/*
+ * The rtclock time since clock_bootsecs/clock_bootnsecs, in ns.
+ */
+static
+uint64_t
+clock_rtns(void)
+{
+	time_t secs, rsecs;
+	uint32_t nsecs, rnsecs;
+
+	gettime(&secs, &nsecs);
+	getinterval(clock_bootsecs, clock_bootnsecs, secs, nsecs,
+		    &rsecs, &rnsecs);
+	return (uint64_t)rsecs * 1000000000 + rnsecs;
+}
+
+void
+clock_monotonic_bootstrap(void)
+{
+	time_t secs, rsecs;
+	uint32_t nsecs, rnsecs, start, cycles;
+	uint64_t ns;
+	int spl;
+
+	/* Count the cycles in CLOCK_CALNS of the rtclock. */
+	spl = splhigh();
+	gettime(&clock_bootsecs, &clock_bootnsecs);
+	start = cpu_cycles();
+	do {
+		gettime(&secs, &nsecs);
+		cycles = cpu_cycles() - start;
+		getinterval(clock_bootsecs, clock_bootnsecs, secs, nsecs,
+			    &rsecs, &rnsecs);
+	} while (rsecs == 0 && rnsecs < CLOCK_CALNS);
+	splx(spl);
+
+	ns = (uint64_t)rsecs * 1000000000 + rnsecs;
+	if (cycles == 0 || (ns << CLOCK_SHIFT) / cycles > 0xffffffff) {
+		panic("clock_monotonic_bootstrap: %u cycles in %u ns\n",
+		      cycles, (unsigned)ns);
+	}
+	clock_nspercycle = (ns << CLOCK_SHIFT) / cycles;
+	kprintf("cycle counter: %u kHz\n",
+		(unsigned)(((uint64_t)cycles * 1000000) / ns));
+
+	clock_anchor();
+}
+
+/*
+ * Pin this cpu's cycle count to the rtclock. Readings in between are
+ * the time then plus the cycles since; the cycle counter is 32 bits,
+ * so this has to happen well before it wraps, which the hardclock does
+ * (and thread_switch, when a cpu that was idle stops being so).
+ */
+void
+clock_anchor(void)
+{
+	int spl;
+
+	if (clock_nspercycle == 0) {
+		/* not calibrated yet */
+		return;
+	}
+	spl = splhigh();
+	curcpu->c_clockcycles = cpu_cycles();
+	curcpu->c_clockns = clock_rtns();
+	curcpu->c_clockset = true;
+	splx(spl);
+}
+
+/*
+ * Nanoseconds since boot (since calibration, really), from this cpu's
+ * anchor and its cycle counter: no device access, just a multiply.
+ *
+ * Each anchor comes from the rtclock afresh, so that the rates of the
+ * two cannot drift apart; if a new anchor is a little behind what the
+ * last reading extrapolated, readings on this cpu hold still until it
+ * catches up, so they never go backwards. Readings on different cpus
+ * agree to within a few cycles.
+ */
+uint64_t
+clock_monotonic_ns(void)
+{
+	struct cpu *c;
+	uint64_t ns;
+	int spl;
+
+	if (clock_nspercycle == 0) {
+		return 0;
+	}
+
+	spl = splhigh();
+	c = curcpu;
+	if (!c->c_clockset) {
+		/* a cpu that has not had a hardclock yet */
+		clock_anchor();
+	}
+	ns = c->c_clockns + (((uint64_t)(cpu_cycles() - c->c_clockcycles)
+			      * clock_nspercycle) >> CLOCK_SHIFT);
+	if (ns < c->c_clocklast) {
+		ns = c->c_clocklast;
+	}
+	c->c_clocklast = ns;
+	splx(spl);
+
+	return ns;
+}
+
+/*
+ * A number of cpu cycles as nanoseconds; 0 before calibration.
+ */
+uint64_t
+clock_cycles_ns(uint32_t cycles)
+{
+	return ((uint64_t)cycles * clock_nspercycle) >> CLOCK_SHIFT;
+}
+
+/*
+ * Compute the interval from time 1 to time 2.
+ */
+void
+getinterval(time_t s1, uint32_t ns1, time_t s2, uint32_t ns2,
+	    time_t *rs, uint32_t *rns)
+{
+	if (ns2 < ns1) {
+		ns2 += 1000000000;
+		s2--;
+	}
+
+	*rns = ns2 - ns1;
+	*rs = s2 - s1;
+}
+
+paddr_t
+timepage_paddr(void)
+{
+	KASSERT(timepage != NULL);
+	return KVADDR_TO_PADDR((vaddr_t)timepage);
 }
 
 /*
  * This is called once every every LT_GRANULARITY usec, on one processor,
- * by the timer code.
+ * by the timer code. Fire the timeouts that are due.
  */
 void
 timerclock(void)
 {
-	/* Broadcast on minibolt */
-	wchan_wakeall(minibolt);
-	/* Broadcast on lbolt if a second has elapsed */
-	if (--minicount <= 0) {
-	  minicount = MINI_PER_SECOND;
-	  wchan_wakeall(lbolt);
+	struct timeout *to;
+
+	spinlock_acquire(&timeout_lock);
+	timeout_ticks++;
+	while ((to = timeout_queue) != NULL &&
+	       !TICK_BEFORE(timeout_ticks, to->to_deadline)) {
+		timeout_queue = to->to_next;
+		to->to_pending = false;
+		to->to_fired = true;
+		wchan_wakethread(to->to_wchan, to->to_thread);
+	}
+	if (timeout_queue == NULL && timeout_ticking) {
+		timeout_ticking = false;
+		ltimer_timerclock_run(false);
+	}
+	spinlock_release(&timeout_lock);
+}
+
+/*
+ * Arm TO to wake curthread, sleeping on WC, TICKS ticks from now.
+ */
+void
+timeout_start(struct timeout *to, unsigned ticks, struct wchan *wc)
+{
+	struct timeout **p;
+
+	to->to_thread = curthread;
+	to->to_wchan = wc;
+	to->to_fired = false;
+
+	spinlock_acquire(&timeout_lock);
+	to->to_deadline = timeout_ticks + ticks;
+	if (ticks == 0) {
+		to->to_pending = false;
+		to->to_fired = true;
+		spinlock_release(&timeout_lock);
+		return;
+	}
+	/* Behind any with the same deadline, so they fire in order. */
+	for (p = &timeout_queue; *p != NULL; p = &(*p)->to_next) {
+		if (TICK_BEFORE(to->to_deadline, (*p)->to_deadline)) {
+			break;
+		}
+	}
+	to->to_next = *p;
+	*p = to;
+	to->to_pending = true;
+	if (!timeout_ticking) {
+		timeout_ticking = true;
+		ltimer_timerclock_run(true);
+	}
+	spinlock_release(&timeout_lock);
+}
+
+/*
+ * Disarm TO if it has not fired. Returns true if it had.
+ */
+bool
+timeout_stop(struct timeout *to)
+{
+	struct timeout **p;
+	bool fired;
+
+	spinlock_acquire(&timeout_lock);
+	if (to->to_pending) {
+		for (p = &timeout_queue; *p != to; p = &(*p)->to_next) {
+			KASSERT(*p != NULL);
+		}
+		*p = to->to_next;
+		to->to_pending = false;
 	}
+	fired = to->to_fired;
+	spinlock_release(&timeout_lock);
+	return fired;
 }
 
 /*
  * This is called HZ times a second (on each processor) by the timer
- * code.
+ * code, while the processor is busy.
+ *
+ * An idle processor has nothing to schedule, so the first tick that
+ * finds it idle sets c_tickless to have the timer stopped; it starts
+ * again when the processor has a thread to run (see thread_switch).
+ * The thread that wakes it comes by interprocessor interrupt, so
+ * nothing is missed while it sleeps.
+ *
+ * If nothing else is waiting for the processor, there is nothing to
+ * yield to. tl_count is read without the runqueue lock; if a thread
+ * arrives just after, it waits at most one more tick.
  */
 void
 hardclock(void)
 {
+	unsigned waiting;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
 	curcpu->c_hardclocks++;
+	rcu_quiescent();	/* readers run with interrupts off */
+	prof_tick();
+	klog_tick();
+	if (curcpu->c_isidle) {
+		curcpu->c_tickless = true;
+		return;
+	}
+	clock_anchor();
+	timepage_update();
+	waiting = curcpu->c_runqueue.tl_count;
+	if (waiting >= SCHEDSTAT_RQHIST) {
+		waiting = SCHEDSTAT_RQHIST - 1;
+	}
+	curcpu->c_rqhist[waiting]++;
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+	if (curcpu->c_runqueue.tl_count > 0 || curcpu->c_inbox != NULL) {
+		thread_yield();
+	}
 }
 
 /*
@@ -135,10 +427,8 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-  while (num_secs > 0) {
-    wchan_lock(lbolt);
-    wchan_sleep(lbolt);
-    num_secs--;
+  if (num_secs > 0) {
+    clocknap(num_secs * TICKS_PER_SECOND);
   }
 }
 
@@ -149,9 +439,24 @@ clocksleep(int num_secs)
 void
 clocknap(int num_ticks)
 {
-  while (num_ticks > 0) {
-    wchan_lock(minibolt);
-    wchan_sleep(minibolt);
-    num_ticks--;
+  struct timeout to;
+
+  if (num_ticks <= 0) {
+    return;
+  }
+
+  /*
+   * Nothing else wakes threads on clock_wchan, so one wchan_sleep is
+   * one deadline passed; but check, rather than rely on it.
+   */
+  timeout_start(&to, num_ticks, clock_wchan);
+  while (!to.to_fired) {
+    wchan_lock(clock_wchan);
+    if (to.to_fired) {
+      wchan_unlock(clock_wchan);
+      break;
+    }
+    wchan_sleep(clock_wchan);
   }
+  timeout_stop(&to);
 }
@@ -0,0 +1,175 @@
+/*
+ * Futexes. See futex.h for the interface.
+ *
+ * The word is read with copyin under the bucket's lock, which is a
+ * sleep lock because copyin may fault; a waker takes the same lock
+ * before looking for waiters. The waiter locks the wchan before
+ * letting go of the bucket, so a wake that comes in between has to
+ * wait in wchan_wakethread until the waiter is really asleep. A waiter
+ * is only ever woken by being taken off the list, so when it wakes up
+ * its record (on its own stack) is no longer in use.
+ *
+ * A process being ended (p_exiting) has its waiters woken by
+ * futex_wakeas; one that comes to wait after that sees p_exiting under
+ * the bucket lock and does not sleep.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <copyinout.h>
+#include <futex.h>
+
+#define FUTEX_NBUCKETS 64
+
+struct futex_waiter {
+	struct addrspace *fw_as;
+	userptr_t fw_uaddr;
+	struct thread *fw_thread;
+	bool fw_intr;			/* woken by futex_wakeas */
+	struct futex_waiter *fw_next;
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct wchan *fb_wchan;
+	struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_buckets[FUTEX_NBUCKETS];
+
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, userptr_t uaddr)
+{
+	vaddr_t key;
+
+	key = ((vaddr_t)uaddr >> 2) ^ ((vaddr_t)as >> 4);
+	key ^= key >> 12;
+	return &futex_buckets[key % FUTEX_NBUCKETS];
+}
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		futex_buckets[i].fb_lock = lock_create("futex");
+		futex_buckets[i].fb_wchan = wchan_create("futex");
+		if (futex_buckets[i].fb_lock == NULL ||
+		    futex_buckets[i].fb_wchan == NULL) {
+			panic("futex_bootstrap: out of memory\n");
+		}
+		futex_buckets[i].fb_waiters = NULL;
+	}
+}
+
+int
+futex_wait(struct addrspace *as, userptr_t uaddr, int val)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw;
+	int cur, result;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	fb = futex_hash(as, uaddr);
+	lock_acquire(fb->fb_lock);
+
+	/* Checked under the bucket lock, so futex_wakeas can't miss us. */
+	if (curproc->p_exiting) {
+		lock_release(fb->fb_lock);
+		return EINTR;
+	}
+
+	result = copyin(uaddr, &cur, sizeof(cur));
+	if (result == 0 && cur != val) {
+		result = EAGAIN;
+	}
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+
+	fw.fw_as = as;
+	fw.fw_uaddr = uaddr;
+	fw.fw_thread = curthread;
+	fw.fw_intr = false;
+	fw.fw_next = fb->fb_waiters;
+	fb->fb_waiters = &fw;
+
+	wchan_lock(fb->fb_wchan);
+	lock_release(fb->fb_lock);
+	wchan_sleep(fb->fb_wchan);
+
+	return fw.fw_intr ? EINTR : 0;
+}
+
+/*
+ * Take the waiters of AS that MATCH (sleeping on UADDR, or any of them
+ * if UADDR is NULL) off FB's list, up to N of them, and wake them.
+ * Bucket lock held.
+ */
+static
+unsigned
+futex_wakebucket(struct futex_bucket *fb, struct addrspace *as,
+		 userptr_t uaddr, unsigned n)
+{
+	struct futex_waiter **fwp, *fw;
+	unsigned woken;
+
+	KASSERT(lock_do_i_hold(fb->fb_lock));
+
+	woken = 0;
+	fwp = &fb->fb_waiters;
+	while (*fwp != NULL && woken < n) {
+		fw = *fwp;
+		if (fw->fw_as != as ||
+		    (uaddr != NULL && fw->fw_uaddr != uaddr)) {
+			fwp = &fw->fw_next;
+			continue;
+		}
+		*fwp = fw->fw_next;
+		fw->fw_intr = uaddr == NULL;
+		/* FW is gone once its thread runs; don't touch it after. */
+		wchan_wakethread(fb->fb_wchan, fw->fw_thread);
+		woken++;
+	}
+	return woken;
+}
+
+int
+futex_wake(struct addrspace *as, userptr_t uaddr, unsigned n, unsigned *ret)
+{
+	struct futex_bucket *fb;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	fb = futex_hash(as, uaddr);
+	lock_acquire(fb->fb_lock);
+	*ret = futex_wakebucket(fb, as, uaddr, n);
+	lock_release(fb->fb_lock);
+	return 0;
+}
+
+void
+futex_wakeas(struct addrspace *as)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		lock_acquire(futex_buckets[i].fb_lock);
+		futex_wakebucket(&futex_buckets[i], as, NULL, (unsigned)-1);
+		lock_release(futex_buckets[i].fb_lock);
+	}
+}
@@ -0,0 +1,140 @@
+/*
+ * Kernel statistics. See kstat.h.
+ *
+ * The registered counters are kstat_table, under kstat_lock, which
+ * only registering takes: a counter's slot, once set, never changes,
+ * so kstat_add looks at it without the lock. Each cpu's counts are
+ * an array of their own, written only by that cpu with interrupts
+ * off; readers add them up as they go, and may see a count a moment
+ * stale.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <platform/maxcpus.h>
+#include <kstat.h>
+
+static struct spinlock kstat_lock = SPINLOCK_INITIALIZER;
+static struct kstat *kstat_table[KSTAT_MAX];
+static unsigned kstat_num;
+
+static volatile uint32_t *kstat_counts[MAXCPUS];
+
+void
+kstat_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<cpu_count(); i++) {
+		kstat_counts[i] = kmalloc_aligned(KSTAT_MAX * sizeof(uint32_t),
+						  CACHELINE_SIZE);
+		if (kstat_counts[i] == NULL) {
+			panic("kstat_bootstrap: Out of memory\n");
+		}
+		bzero((void *)kstat_counts[i], KSTAT_MAX * sizeof(uint32_t));
+	}
+}
+
+void
+kstat_register(struct kstat *ks)
+{
+	spinlock_acquire(&kstat_lock);
+	if (ks->ks_slot == 0) {
+		if (kstat_num >= KSTAT_MAX) {
+			panic("kstat: no room for %s; raise KSTAT_MAX\n",
+			      ks->ks_name);
+		}
+		kstat_table[kstat_num++] = ks;
+		ks->ks_slot = kstat_num;
+	}
+	spinlock_release(&kstat_lock);
+}
+
+void
+kstat_add(struct kstat *ks, uint32_t n)
+{
+	volatile uint32_t *counts;
+	int spl;
+
+	if (ks->ks_slot == 0) {
+		kstat_register(ks);
+	}
+
+	spl = splhigh();
+	counts = kstat_counts[curcpu->c_number];
+	if (counts != NULL) {
+		counts[ks->ks_slot - 1] += n;
+	}
+	splx(spl);
+}
+
+uint64_t
+kstat_read(struct kstat *ks)
+{
+	uint64_t total = 0;
+	unsigned i;
+
+	if (ks->ks_slot == 0) {
+		return 0;
+	}
+	for (i=0; i<MAXCPUS; i++) {
+		if (kstat_counts[i] != NULL) {
+			total += kstat_counts[i][ks->ks_slot - 1];
+		}
+	}
+	return total;
+}
+
+void
+kstat_zero(struct kstat *ks)
+{
+	unsigned i;
+
+	if (ks->ks_slot == 0) {
+		return;
+	}
+	for (i=0; i<MAXCPUS; i++) {
+		if (kstat_counts[i] != NULL) {
+			kstat_counts[i][ks->ks_slot - 1] = 0;
+		}
+	}
+}
+
+int
+kstat_get(unsigned index, struct kstatinfo *ki)
+{
+	struct kstat *ks;
+	unsigned num;
+
+	spinlock_acquire(&kstat_lock);
+	num = kstat_num;
+	ks = index < num ? kstat_table[index] : NULL;
+	spinlock_release(&kstat_lock);
+
+	if (ks == NULL) {
+		return ENOENT;
+	}
+	bzero(ki, sizeof(*ki));
+	ki->ki_nstats = num;
+	snprintf(ki->ki_name, sizeof(ki->ki_name), "%s", ks->ks_name);
+	ki->ki_value = kstat_read(ks);
+	return 0;
+}
+
+void
+kstat_print(void)
+{
+	struct kstatinfo ki;
+	unsigned i;
+
+	kprintf("Kernel statistics:\n");
+	for (i=0; kstat_get(i, &ki) == 0; i++) {
+		kprintf("    %-24s %llu\n", ki.ki_name,
+			(unsigned long long)ki.ki_value);
+	}
+}
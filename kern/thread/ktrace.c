@@ -0,0 +1,159 @@
+/*
+ * Kernel event tracing. See ktrace.h for the interface.
+ *
+ * Each cpu's ring is written only by that cpu, with interrupts off, so
+ * writers need no lock. kt_head is the sequence number of the next
+ * record to be written; record S goes in slot S % KTRACE_NRECS. A
+ * writer marks the slot KTRACE_BUSY, fills it in, then stores its
+ * sequence number; a reader copies a slot and keeps the copy only if
+ * the slot held the sequence number it wanted both before and after,
+ * so a record overwritten while being read is dropped rather than torn.
+ * This relies on stores being seen in order, which System/161 does and
+ * volatile keeps the compiler to.
+ *
+ * kt_tail, the next record to read, is under ktrace_readlock, so that
+ * two readers do not both get the same records.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <platform/maxcpus.h>
+#include <ktrace.h>
+
+#define KTRACE_BUSY  0xffffffff
+#define KTRACE_BATCH 16		/* records copied out at a time */
+
+/* Each on its own cache line, since each is written by its own cpu. */
+struct ktrace_ring {
+	volatile struct ktrace_rec *kt_recs;
+	volatile uint32_t kt_head;
+	uint32_t kt_tail;
+} __ALIGNED(CACHELINE_SIZE);
+
+volatile bool ktrace_enabled;
+static struct ktrace_ring ktrace_rings[MAXCPUS];
+static struct lock *ktrace_readlock;
+
+void
+ktrace_bootstrap(void)
+{
+	struct ktrace_rec *recs;
+	unsigned i, j;
+
+	ktrace_readlock = lock_create("ktrace");
+	if (ktrace_readlock == NULL) {
+		panic("ktrace_bootstrap: Out of memory\n");
+	}
+	for (i = 0; i < cpu_count(); i++) {
+		recs = kmalloc(KTRACE_NRECS * sizeof(*recs));
+		if (recs == NULL) {
+			panic("ktrace_bootstrap: Out of memory\n");
+		}
+		for (j = 0; j < KTRACE_NRECS; j++) {
+			recs[j].kr_seq = KTRACE_BUSY;
+		}
+		ktrace_rings[i].kt_head = 0;
+		ktrace_rings[i].kt_tail = 0;
+		ktrace_rings[i].kt_recs = recs;
+	}
+}
+
+void
+ktrace_enable(bool on)
+{
+	ktrace_enabled = on;
+}
+
+void
+ktrace_record(uint32_t type, uint32_t a, uint32_t b)
+{
+	struct ktrace_ring *kt;
+	volatile struct ktrace_rec *r;
+	uint32_t seq;
+	int spl;
+
+	spl = splhigh();
+	kt = &ktrace_rings[curcpu->c_number];
+	if (kt->kt_recs != NULL) {
+		seq = kt->kt_head;
+		r = &kt->kt_recs[seq % KTRACE_NRECS];
+		r->kr_seq = KTRACE_BUSY;
+		r->kr_time = cpu_cycles();
+		r->kr_type = type;
+		r->kr_a = a;
+		r->kr_b = b;
+		r->kr_seq = seq;
+		kt->kt_head = seq + 1;
+	}
+	splx(spl);
+}
+
+/*
+ * Copy record SEQ of KT into *REC. Returns false if it has been, or is
+ * being, overwritten.
+ */
+static
+bool
+ktrace_get(struct ktrace_ring *kt, uint32_t seq, struct ktrace_rec *rec)
+{
+	volatile struct ktrace_rec *r;
+
+	r = &kt->kt_recs[seq % KTRACE_NRECS];
+	if (r->kr_seq != seq) {
+		return false;
+	}
+	rec->kr_time = r->kr_time;
+	rec->kr_type = r->kr_type;
+	rec->kr_a = r->kr_a;
+	rec->kr_b = r->kr_b;
+	rec->kr_seq = seq;
+	return r->kr_seq == seq;
+}
+
+int
+ktrace_read(unsigned cpu, userptr_t buf, unsigned n, unsigned *count)
+{
+	struct ktrace_rec recs[KTRACE_BATCH];
+	struct ktrace_ring *kt;
+	uint32_t head;
+	unsigned got;
+	int result;
+
+	if (cpu >= MAXCPUS || ktrace_rings[cpu].kt_recs == NULL) {
+		return EINVAL;
+	}
+	kt = &ktrace_rings[cpu];
+
+	result = 0;
+	*count = 0;
+	lock_acquire(ktrace_readlock);
+	head = kt->kt_head;
+	if (head - kt->kt_tail > KTRACE_NRECS) {
+		/* lost the oldest */
+		kt->kt_tail = head - KTRACE_NRECS;
+	}
+	while (*count < n && kt->kt_tail != head) {
+		got = 0;
+		while (got < KTRACE_BATCH && *count + got < n &&
+		       kt->kt_tail != head) {
+			if (ktrace_get(kt, kt->kt_tail, &recs[got])) {
+				got++;
+			}
+			kt->kt_tail++;
+		}
+		result = copyout(recs, buf, got * sizeof(recs[0]));
+		if (result) {
+			break;
+		}
+		buf += got * sizeof(recs[0]);
+		*count += got;
+	}
+	lock_release(ktrace_readlock);
+	return result;
+}
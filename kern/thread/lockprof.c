@@ -0,0 +1,267 @@
+/*
+ * Lock contention profiling. See lockprof.h.
+ *
+ * Entries are kept in an open-addressed table keyed on the call site
+ * for spinlocks and on the name for sleep locks. The table can't be
+ * covered by a spinlock, since every spinlock release comes here;
+ * instead it has a bare lock word of its own, taken with interrupts
+ * off, that no other lock is ever taken under.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <lockprof.h>
+
+#define LOCKPROF_NENTRIES	256	/* power of 2 */
+#define LOCKPROF_NAMELEN	24
+
+struct lockprof_entry {
+	vaddr_t le_site;		/* spinlocks; 0 for sleep locks */
+	char le_name[LOCKPROF_NAMELEN];	/* sleep locks; "" if unused */
+	unsigned le_acquires;
+	unsigned le_contended;
+	uint64_t le_wait;		/* cycles */
+	uint32_t le_maxhold;		/* cycles */
+};
+
+static volatile spinlock_data_t lockprof_word = SPINLOCK_DATA_INITIALIZER;
+static struct lockprof_entry lockprof_table[LOCKPROF_NENTRIES];
+static unsigned lockprof_nentries;
+static unsigned lockprof_lost;		/* acquisitions that did not fit */
+
+static
+int
+lockprof_lockword(void)
+{
+	int spl;
+
+	spl = splhigh();
+	while (spinlock_data_get(&lockprof_word) != 0 ||
+	       spinlock_data_testandset(&lockprof_word) != 0) {
+		/* spin */
+	}
+	return spl;
+}
+
+static
+void
+lockprof_unlockword(int spl)
+{
+	spinlock_data_set(&lockprof_word, 0);
+	splx(spl);
+}
+
+static
+unsigned
+lockprof_hash(vaddr_t site, const char *name)
+{
+	unsigned h;
+
+	if (name == NULL) {
+		return (site >> 2) & (LOCKPROF_NENTRIES - 1);
+	}
+	h = 0;
+	while (*name != 0) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h & (LOCKPROF_NENTRIES - 1);
+}
+
+/*
+ * Names are kept cut down to LOCKPROF_NAMELEN - 1 characters, so
+ * compare only that much.
+ */
+static
+bool
+lockprof_samename(const char *kept, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < LOCKPROF_NAMELEN - 1; i++) {
+		if (kept[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	return true;
+}
+
+static
+void
+lockprof_keepname(char *kept, const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < LOCKPROF_NAMELEN - 1 && name[i] != 0; i++) {
+		kept[i] = name[i];
+	}
+	kept[i] = 0;
+}
+
+static
+bool
+lockprof_unused(const struct lockprof_entry *le)
+{
+	return le->le_site == 0 && le->le_name[0] == 0;
+}
+
+/*
+ * Find the entry for SITE or NAME (whichever is used), making it if
+ * need be. Returns NULL if the table is full. Lock word held.
+ */
+static
+struct lockprof_entry *
+lockprof_getentry(vaddr_t site, const char *name)
+{
+	struct lockprof_entry *le;
+	unsigned i, n;
+
+	i = lockprof_hash(site, name);
+	for (n = 0; n < LOCKPROF_NENTRIES; n++) {
+		le = &lockprof_table[i];
+		if (name == NULL ? le->le_site == site :
+		    le->le_site == 0 && le->le_name[0] != 0 &&
+		    lockprof_samename(le->le_name, name)) {
+			return le;
+		}
+		if (lockprof_unused(le)) {
+			if (lockprof_nentries == LOCKPROF_NENTRIES - 1) {
+				/* keep one empty slot to end searches */
+				return NULL;
+			}
+			lockprof_nentries++;
+			if (name == NULL) {
+				le->le_site = site;
+			}
+			else {
+				lockprof_keepname(le->le_name, name);
+			}
+			return le;
+		}
+		i = (i + 1) & (LOCKPROF_NENTRIES - 1);
+	}
+	return NULL;
+}
+
+static
+void
+lockprof_record(vaddr_t site, const char *name, bool contended,
+		uint32_t wait, uint32_t hold)
+{
+	struct lockprof_entry *le;
+	int spl;
+
+	spl = lockprof_lockword();
+	le = lockprof_getentry(site, name);
+	if (le == NULL) {
+		lockprof_lost++;
+		lockprof_unlockword(spl);
+		return;
+	}
+	le->le_acquires++;
+	if (contended) {
+		le->le_contended++;
+		le->le_wait += wait;
+	}
+	if (hold > le->le_maxhold) {
+		le->le_maxhold = hold;
+	}
+	lockprof_unlockword(spl);
+}
+
+void
+lockprof_spinlock(vaddr_t site, bool contended, uint32_t wait, uint32_t hold)
+{
+	lockprof_record(site, NULL, contended, wait, hold);
+}
+
+void
+lockprof_lock(const char *name, bool contended, uint32_t wait, uint32_t hold)
+{
+	if (name[0] == 0) {
+		/* an empty name would look like an unused entry */
+		name = "?";
+	}
+	lockprof_record(0, name, contended, wait, hold);
+}
+
+void
+lockprof_print(unsigned n)
+{
+	struct lockprof_entry *copy, *le, *best;
+	unsigned i, shown, lost;
+	int spl;
+
+	/*
+	 * Print from a copy: kprintf takes spinlocks, whose releases
+	 * need the lock word.
+	 */
+	copy = kmalloc(sizeof(lockprof_table));
+	if (copy == NULL) {
+		kprintf("lockprof: out of memory\n");
+		return;
+	}
+	spl = lockprof_lockword();
+	memcpy(copy, lockprof_table, sizeof(lockprof_table));
+	lost = lockprof_lost;
+	lockprof_unlockword(spl);
+
+	kprintf("Lock profile (top %u by wait):\n", n);
+	kprintf("    %-23s %9s %9s %12s %10s\n", "lock", "acquires",
+		"contended", "wait", "maxhold");
+
+	for (shown = 0; shown < n; shown++) {
+		/* Selection by wait time; the table is small. */
+		best = NULL;
+		for (i = 0; i < LOCKPROF_NENTRIES; i++) {
+			le = &copy[i];
+			if (lockprof_unused(le)) {
+				continue;
+			}
+			if (best == NULL || le->le_wait > best->le_wait ||
+			    (le->le_wait == best->le_wait &&
+			     le->le_contended > best->le_contended)) {
+				best = le;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		if (best->le_site != 0) {
+			kprintf("    spin@0x%08lx         ",
+				(unsigned long)best->le_site);
+		}
+		else {
+			kprintf("    %-23s ", best->le_name);
+		}
+		kprintf("%9u %9u %12llu %10u\n", best->le_acquires,
+			best->le_contended,
+			(unsigned long long)best->le_wait,
+			(unsigned)best->le_maxhold);
+		/* mark it shown */
+		best->le_site = 0;
+		best->le_name[0] = 0;
+	}
+	if (lost > 0) {
+		kprintf("    %u acquisitions of locks that did not fit\n",
+			lost);
+	}
+
+	kfree(copy);
+}
+
+void
+lockprof_reset(void)
+{
+	int spl;
+
+	spl = lockprof_lockword();
+	bzero(lockprof_table, sizeof(lockprof_table));
+	lockprof_nentries = 0;
+	lockprof_lost = 0;
+	lockprof_unlockword(spl);
+}
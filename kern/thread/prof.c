@@ -0,0 +1,219 @@
+/*
+ * Sampling CPU profiler. See prof.h.
+ *
+ * Each cpu's samples are written only by that cpu, from hardclock,
+ * so taking one needs no lock. prof_running is what the other
+ * functions use to keep out of the way: the buffers are made, or
+ * emptied, before it is set, and read only once it is clear. A tick
+ * already under way as it is cleared can still land one sample.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <proc.h>
+#include <atomic.h>
+#include <platform/maxcpus.h>
+#include <prof.h>
+#include "opt-A2.h"
+
+struct prof_sample {
+	vaddr_t ps_pc;
+	pid_t ps_pid;
+	bool ps_user;
+};
+
+struct prof_cpu {
+	struct prof_sample *pc_samples;
+	unsigned pc_count;
+	unsigned pc_idle;
+	unsigned pc_dropped;
+} __ALIGNED(CACHELINE_SIZE);
+
+static struct prof_cpu prof_cpus[MAXCPUS];
+static volatile bool prof_running;
+
+int
+prof_start(void)
+{
+	struct prof_cpu *pc;
+	unsigned i;
+
+	prof_running = false;
+	membar_sync();
+
+	for (i=0; i<cpu_count(); i++) {
+		pc = &prof_cpus[i];
+		if (pc->pc_samples == NULL) {
+			pc->pc_samples = kmalloc(PROF_NSAMPLES *
+						 sizeof(struct prof_sample));
+			if (pc->pc_samples == NULL) {
+				return ENOMEM;
+			}
+		}
+		pc->pc_count = 0;
+		pc->pc_idle = 0;
+		pc->pc_dropped = 0;
+	}
+
+	membar_sync();
+	prof_running = true;
+	return 0;
+}
+
+void
+prof_stop(void)
+{
+	prof_running = false;
+	membar_sync();
+}
+
+/*
+ * Called with interrupts off, from the timer interrupt.
+ */
+void
+prof_tick(void)
+{
+	struct prof_cpu *pc;
+	struct prof_sample *ps;
+
+	if (!prof_running) {
+		return;
+	}
+
+	pc = &prof_cpus[curcpu->c_number];
+	if (curcpu->c_isidle) {
+		pc->pc_idle++;
+		return;
+	}
+	if (pc->pc_count >= PROF_NSAMPLES) {
+		pc->pc_dropped++;
+		return;
+	}
+	ps = &pc->pc_samples[pc->pc_count++];
+	ps->ps_pc = curcpu->c_intrpc;
+	ps->ps_user = curcpu->c_intruser;
+#if OPT_A2
+	ps->ps_pid = curthread->t_proc != NULL ? curthread->t_proc->pid : 0;
+#else
+	ps->ps_pid = 0;
+#endif
+}
+
+/*
+ * Order samples by process, then by mode (BYPID); or else by mode,
+ * then by process for user samples only, then by pc.
+ */
+static
+int
+prof_cmp(const struct prof_sample *a, const struct prof_sample *b,
+	 bool bypid)
+{
+	if (bypid) {
+		if (a->ps_pid != b->ps_pid) {
+			return a->ps_pid < b->ps_pid ? -1 : 1;
+		}
+		return (int)a->ps_user - (int)b->ps_user;
+	}
+	if (a->ps_user != b->ps_user) {
+		return a->ps_user ? 1 : -1;
+	}
+	if (a->ps_user && a->ps_pid != b->ps_pid) {
+		return a->ps_pid < b->ps_pid ? -1 : 1;
+	}
+	if (a->ps_pc != b->ps_pc) {
+		return a->ps_pc < b->ps_pc ? -1 : 1;
+	}
+	return 0;
+}
+
+/*
+ * Shell sort; there are at most a few tens of thousands of samples.
+ */
+static
+void
+prof_sort(struct prof_sample *ps, unsigned n, bool bypid)
+{
+	struct prof_sample tmp;
+	unsigned gap, i, j;
+
+	for (gap = 1; gap < n / 3; gap = gap * 3 + 1);
+	for (; gap > 0; gap /= 3) {
+		for (i=gap; i<n; i++) {
+			tmp = ps[i];
+			for (j=i; j>=gap &&
+				     prof_cmp(&ps[j-gap], &tmp, bypid) > 0; j-=gap) {
+				ps[j] = ps[j-gap];
+			}
+			ps[j] = tmp;
+		}
+	}
+}
+
+int
+prof_dump(void)
+{
+	struct prof_sample *all;
+	unsigned total = 0, idle = 0, dropped = 0;
+	unsigned i, j, n, kern, user;
+
+	if (prof_running) {
+		return EBUSY;
+	}
+
+	for (i=0; i<cpu_count(); i++) {
+		total += prof_cpus[i].pc_count;
+		idle += prof_cpus[i].pc_idle;
+		dropped += prof_cpus[i].pc_dropped;
+	}
+	kprintf("prof: %u samples, %u idle, %u dropped, on %u cpus\n",
+		total, idle, dropped, cpu_count());
+	if (total == 0) {
+		return 0;
+	}
+
+	all = kmalloc(total * sizeof(*all));
+	if (all == NULL) {
+		return ENOMEM;
+	}
+	n = 0;
+	for (i=0; i<cpu_count(); i++) {
+		for (j=0; j<prof_cpus[i].pc_count; j++) {
+			all[n++] = prof_cpus[i].pc_samples[j];
+		}
+	}
+
+	/* Per process. */
+	prof_sort(all, n, true);
+	for (i=0; i<n; i=j) {
+		kern = user = 0;
+		for (j=i; j<n && all[j].ps_pid == all[i].ps_pid; j++) {
+			if (all[j].ps_user) {
+				user++;
+			}
+			else {
+				kern++;
+			}
+		}
+		kprintf("prof pid %d kernel %u user %u\n",
+			all[i].ps_pid, kern, user);
+	}
+
+	/* Per pc. */
+	prof_sort(all, n, false);
+	for (i=0; i<n; i=j) {
+		for (j=i; j<n && prof_cmp(&all[i], &all[j], false) == 0; j++);
+		if (all[i].ps_user) {
+			kprintf("prof u %d 0x%08x %u\n", all[i].ps_pid,
+				all[i].ps_pc, j - i);
+		}
+		else {
+			kprintf("prof k 0x%08x %u\n", all[i].ps_pc, j - i);
+		}
+	}
+
+	kfree(all);
+	return 0;
+}
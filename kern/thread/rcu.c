@@ -0,0 +1,72 @@
+/*
+ * Read-copy-update. See rcu.h.
+ *
+ * c_rcugen is only written by its own cpu, with interrupts off. It
+ * starts at 0, before the cpu's first thread_switch, and skips 0 when
+ * it wraps, so 0 means the cpu has not got as far as running threads.
+ * A cpu like that, or one idle in thread_switch, has no reader in
+ * progress, nor has the writer's own cpu, whose other threads cannot be
+ * in the middle of one: a reader is never switched out.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <platform/maxcpus.h>
+#include <cpu.h>
+#include <current.h>
+#include <clock.h>
+#include <rcu.h>
+
+void
+rcu_quiescent(void)
+{
+	struct cpu *c = curcpu->c_self;
+
+	c->c_rcugen++;
+	if (c->c_rcugen == 0) {
+		c->c_rcugen = 1;
+	}
+}
+
+void
+rcu_synchronize(void)
+{
+	unsigned snap[MAXCPUS];	/* 0: that cpu is done */
+	struct cpu *c;
+	unsigned i, n, left;
+	int spl;
+
+	/* See that what was unpublished is, everywhere, before looking. */
+	membar_sync();
+
+	n = cpu_count();
+	KASSERT(n <= MAXCPUS);
+	left = 0;
+	spl = splhigh();
+	for (i=0; i<n; i++) {
+		c = cpu_get(i);
+		snap[i] = c->c_rcugen;
+		if (c == curcpu->c_self || c->c_isidle) {
+			snap[i] = 0;
+		}
+		if (snap[i] != 0) {
+			left++;
+		}
+	}
+	splx(spl);
+
+	while (left > 0) {
+		clocknap(1);
+		for (i=0; i<n; i++) {
+			c = cpu_get(i);
+			if (snap[i] != 0 &&
+			    (c->c_rcugen != snap[i] || c->c_isidle)) {
+				snap[i] = 0;
+				left--;
+			}
+		}
+	}
+
+	/* And that readers' loads are done before we free anything. */
+	membar_sync();
+}
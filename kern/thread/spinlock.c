@@ -36,6 +36,7 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>	/* for curcpu */
+#include <lockprof.h>
 
 /*
  * Spinlocks.
@@ -50,6 +51,22 @@ spinlock_init(struct spinlock *lk)
 {
 	spinlock_data_set(&lk->lk_lock, 0);
 	lk->lk_holder = NULL;
+	lk->lk_isticket = false;
+	spinlock_data_set(&lk->lk_ticket, 0);
+	spinlock_data_set(&lk->lk_serving, 0);
+#if OPT_LOCKPROF
+	lk->lk_contended = false;
+#endif
+}
+
+/*
+ * Initialize a ticket spinlock.
+ */
+void
+spinlock_init_ticket(struct spinlock *lk)
+{
+	spinlock_init(lk);
+	lk->lk_isticket = true;
 }
 
 /*
@@ -60,6 +77,8 @@ spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
 	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	KASSERT(spinlock_data_get(&lk->lk_ticket) ==
+		spinlock_data_get(&lk->lk_serving));
 }
 
 /*
@@ -73,8 +92,16 @@ void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket;
+#if OPT_LOCKPROF
+	uint32_t start;
+	bool contended = false;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
+#if OPT_LOCKPROF
+	start = cpu_cycles();
+#endif
 
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
@@ -87,27 +114,53 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
-	while (1) {
+	if (lk->lk_isticket) {
 		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
+		 * Take a ticket and wait for it to come up. Only the
+		 * holder writes lk_serving, so waiting is just reading.
 		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
+		ticket = spinlock_data_fetchinc(&lk->lk_ticket);
+		while (spinlock_data_get(&lk->lk_serving) != ticket) {
+#if OPT_LOCKPROF
+			contended = true;
+#endif
 		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
+	}
+	else {
+		while (1) {
+			/*
+			 * Do test-test-and-set, that is, read first before
+			 * doing test-and-set, to reduce bus contention.
+			 *
+			 * Test-and-set is a machine-level atomic operation
+			 * that writes 1 into the lock word and returns the
+			 * previous value. If that value was 0, the lock was
+			 * previously unheld and we now own it. If it was 1,
+			 * we don't.
+			 */
+			if (spinlock_data_get(&lk->lk_lock) != 0) {
+#if OPT_LOCKPROF
+				contended = true;
+#endif
+				continue;
+			}
+			if (spinlock_data_testandset(&lk->lk_lock) != 0) {
+#if OPT_LOCKPROF
+				contended = true;
+#endif
+				continue;
+			}
+			break;
 		}
-		break;
 	}
 
 	lk->lk_holder = mycpu;
+#if OPT_LOCKPROF
+	lk->lk_site = (vaddr_t)__builtin_return_address(0);
+	lk->lk_acquired = cpu_cycles();
+	lk->lk_wait = lk->lk_acquired - start;
+	lk->lk_contended = contended;
+#endif
 }
 
 /*
@@ -116,13 +169,36 @@ spinlock_acquire(struct spinlock *lk)
 void
 spinlock_release(struct spinlock *lk)
 {
+#if OPT_LOCKPROF
+	vaddr_t site;
+	uint32_t wait, hold;
+	bool contended;
+#endif
+
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKPROF
+	/* Take what we need before someone else gets the lock... */
+	site = lk->lk_site;
+	wait = lk->lk_wait;
+	contended = lk->lk_contended;
+	hold = cpu_cycles() - lk->lk_acquired;
+#endif
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	if (lk->lk_isticket) {
+		spinlock_data_set(&lk->lk_serving,
+				  spinlock_data_get(&lk->lk_serving) + 1);
+	}
+	else {
+		spinlock_data_set(&lk->lk_lock, 0);
+	}
+#if OPT_LOCKPROF
+	/* ...and record it after, with interrupts still off. */
+	lockprof_spinlock(site, contended, wait, hold);
+#endif
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -120,6 +120,8 @@ spllower(int oldspl, int newspl)
 	cur->t_iplhigh_count--;
 	if (cur->t_iplhigh_count == 0) {
 		cpu_irqon();
+		/* A safe point: interrupts could come in here anyway. */
+		thread_preempt();
 	}
 }
 
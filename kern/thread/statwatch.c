@@ -0,0 +1,185 @@
+/*
+ * Streaming counters to the console. See statwatch.h.
+ *
+ * statwatch_period is the seconds between lines, or 0 for none, and
+ * statwatch_thread tells whether the thread is there; both are under
+ * statwatch_lock. The thread only goes away once it finds the period
+ * 0, so a start right after a stop keeps the one that is there rather
+ * than making a second.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/kstat.h>
+#include <kern/iostat.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <threadlist.h>
+#include <clock.h>
+#include <kstat.h>
+#include <iostat.h>
+#include <statwatch.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <coremap.h>
+#endif
+
+static struct spinlock statwatch_lock = SPINLOCK_INITIALIZER;
+static unsigned statwatch_period;
+static bool statwatch_thread;
+
+/* The counters a line shows the change in. */
+struct statwatch_counts {
+	uint64_t sc_faults;
+	uint64_t sc_tlbfaults;
+	uint64_t sc_switches;
+	unsigned sc_reads, sc_writes;
+};
+
+/* The value of the kernel statistic called NAME; 0 if there is none. */
+static
+uint64_t
+statwatch_kstat(const char *name)
+{
+	struct kstatinfo ki;
+	unsigned i;
+
+	for (i=0; kstat_get(i, &ki) == 0; i++) {
+		if (!strcmp(ki.ki_name, name)) {
+			return ki.ki_value;
+		}
+	}
+	return 0;
+}
+
+static
+void
+statwatch_read(struct statwatch_counts *sc)
+{
+	struct iostatinfo is;
+	unsigned i;
+
+	sc->sc_faults = statwatch_kstat("vm.faults_zeroed") +
+		statwatch_kstat("vm.faults_disk");
+	sc->sc_tlbfaults = statwatch_kstat("vm.tlb_faults");
+	sc->sc_switches = statwatch_kstat("sched.switches");
+	sc->sc_reads = sc->sc_writes = 0;
+	for (i=0; iostat_get(i, &is) == 0; i++) {
+		sc->sc_reads += is.is_reads;
+		sc->sc_writes += is.is_writes;
+	}
+}
+
+/*
+ * Print a line: the seconds since the watch began, ELAPSED, the change
+ * from BEFORE to NOW, and the free frames and run queues as they are.
+ * The run queue lengths are read without their locks, which is near
+ * enough for a look.
+ */
+static
+void
+statwatch_print(time_t elapsed, const struct statwatch_counts *before,
+		const struct statwatch_counts *now)
+{
+	char rq[64];
+	size_t len = 0;
+	unsigned i;
+#if OPT_A3
+	struct coremap_stats cs;
+#endif
+
+	for (i=0; i<cpu_count() && len < sizeof(rq); i++) {
+		len += snprintf(rq + len, sizeof(rq) - len, "%s%u",
+				i == 0 ? "" : "/",
+				cpu_get(i)->c_runqueue.tl_count);
+	}
+#if OPT_A3
+	coremap_stats(&cs);
+#endif
+	kprintf("stat %llus flt %llu tlb %llu"
+#if OPT_A3
+		" free %u"
+#endif
+		" rq %s cs %llu io %ur/%uw\n",
+		(unsigned long long)elapsed,
+		(unsigned long long)(now->sc_faults - before->sc_faults),
+		(unsigned long long)(now->sc_tlbfaults - before->sc_tlbfaults),
+#if OPT_A3
+		cs.cs_free,
+#endif
+		rq,
+		(unsigned long long)(now->sc_switches - before->sc_switches),
+		now->sc_reads - before->sc_reads,
+		now->sc_writes - before->sc_writes);
+}
+
+static
+void
+statwatch(void *data1, unsigned long data2)
+{
+	struct statwatch_counts before, now;
+	time_t start, secs;
+	uint32_t nsecs;
+	unsigned period;
+
+	(void)data1;
+	(void)data2;
+
+	gettime(&start, &nsecs);
+	statwatch_read(&before);
+	while (1) {
+		spinlock_acquire(&statwatch_lock);
+		period = statwatch_period;
+		if (period == 0) {
+			statwatch_thread = false;
+			spinlock_release(&statwatch_lock);
+			break;
+		}
+		spinlock_release(&statwatch_lock);
+
+		clocksleep(period);
+
+		gettime(&secs, &nsecs);
+		statwatch_read(&now);
+		statwatch_print(secs - start, &before, &now);
+		before = now;
+	}
+	thread_exit();
+}
+
+int
+statwatch_start(unsigned secs)
+{
+	bool start;
+	int result;
+
+	KASSERT(secs > 0);
+
+	spinlock_acquire(&statwatch_lock);
+	statwatch_period = secs;
+	start = !statwatch_thread;
+	statwatch_thread = true;
+	spinlock_release(&statwatch_lock);
+
+	if (!start) {
+		return 0;
+	}
+	result = thread_fork("statwatch", NULL, statwatch, NULL, 0);
+	if (result) {
+		spinlock_acquire(&statwatch_lock);
+		statwatch_period = 0;
+		statwatch_thread = false;
+		spinlock_release(&statwatch_lock);
+	}
+	return result;
+}
+
+void
+statwatch_stop(void)
+{
+	spinlock_acquire(&statwatch_lock);
+	statwatch_period = 0;
+	spinlock_release(&statwatch_lock);
+}
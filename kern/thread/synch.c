@@ -33,12 +33,28 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <cpu.h>
 #include <synch.h>
+#include <clock.h>
+#include <kmem_cache.h>
+#include <lockprof.h>
+#include <ktrace.h>
+
+/* Caches for the objects themselves; they come and go a lot. */
+static struct kmem_cache sem_cache =
+        KMEM_CACHE_INITIALIZER("semaphore", sizeof(struct semaphore), NULL);
+static struct kmem_cache lock_cache =
+        KMEM_CACHE_INITIALIZER("lock", sizeof(struct lock), NULL);
+static struct kmem_cache cv_cache =
+        KMEM_CACHE_INITIALIZER("cv", sizeof(struct cv), NULL);
+static struct kmem_cache rwlock_cache =
+        KMEM_CACHE_INITIALIZER("rwlock", sizeof(struct rwlock), NULL);
 
 ////////////////////////////////////////////////////////////
 //
@@ -51,7 +67,7 @@ sem_create(const char *name, int initial_count)
 
         KASSERT(initial_count >= 0);
 
-        sem = kmalloc(sizeof(struct semaphore));
+        sem = kmem_cache_alloc(&sem_cache);
         if (sem == NULL)
         {
                 return NULL;
@@ -60,7 +76,7 @@ sem_create(const char *name, int initial_count)
         sem->sem_name = kstrdup(name);
         if (sem->sem_name == NULL)
         {
-                kfree(sem);
+                kmem_cache_free(&sem_cache, sem);
                 return NULL;
         }
 
@@ -68,7 +84,7 @@ sem_create(const char *name, int initial_count)
         if (sem->sem_wchan == NULL)
         {
                 kfree(sem->sem_name);
-                kfree(sem);
+                kmem_cache_free(&sem_cache, sem);
                 return NULL;
         }
 
@@ -86,7 +102,7 @@ void sem_destroy(struct semaphore *sem)
         spinlock_cleanup(&sem->sem_lock);
         wchan_destroy(sem->sem_wchan);
         kfree(sem->sem_name);
-        kfree(sem);
+        kmem_cache_free(&sem_cache, sem);
 }
 
 void P(struct semaphore *sem)
@@ -131,6 +147,48 @@ void P(struct semaphore *sem)
         spinlock_release(&sem->sem_lock);
 }
 
+/*
+ * As P, with a timeout; see the protocol in clock.h. Other threads
+ * may wake us too, so the count is rechecked after every sleep either
+ * way.
+ */
+int P_timed(struct semaphore *sem, unsigned ticks)
+{
+        struct timeout to;
+        int result;
+
+        KASSERT(sem != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        timeout_start(&to, ticks, sem->sem_wchan);
+        result = 0;
+
+        spinlock_acquire(&sem->sem_lock);
+        while (sem->sem_count == 0)
+        {
+                wchan_lock(sem->sem_wchan);
+                if (to.to_fired)
+                {
+                        wchan_unlock(sem->sem_wchan);
+                        result = ETIMEDOUT;
+                        break;
+                }
+                spinlock_release(&sem->sem_lock);
+                wchan_sleep(sem->sem_wchan);
+
+                spinlock_acquire(&sem->sem_lock);
+        }
+        if (result == 0)
+        {
+                KASSERT(sem->sem_count > 0);
+                sem->sem_count--;
+        }
+        spinlock_release(&sem->sem_lock);
+
+        timeout_stop(&to);
+        return result;
+}
+
 void V(struct semaphore *sem)
 {
         KASSERT(sem != NULL);
@@ -153,7 +211,7 @@ lock_create(const char *name)
 {
         struct lock *lock;
 
-        lock = kmalloc(sizeof(struct lock));
+        lock = kmem_cache_alloc(&lock_cache);
         if (lock == NULL)
         {
                 return NULL;
@@ -162,7 +220,7 @@ lock_create(const char *name)
         lock->lk_name = kstrdup(name);
         if (lock->lk_name == NULL)
         {
-                kfree(lock);
+                kmem_cache_free(&lock_cache, lock);
                 return NULL;
         }
 
@@ -170,17 +228,31 @@ lock_create(const char *name)
         if (lock->lk_wchan == NULL)
         {
                 kfree(lock->lk_name);
-                kfree(lock);
+                kmem_cache_free(&lock_cache, lock);
                 return NULL;
         }
 
         spinlock_init(&lock->lk_spin);
         lock->lk_owner = NULL;
         lock->lk_held = false;
+        lock->lk_handoff = false;
 
         return lock;
 }
 
+struct lock *
+lock_create_handoff(const char *name)
+{
+        struct lock *lock;
+
+        lock = lock_create(name);
+        if (lock != NULL)
+        {
+                lock->lk_handoff = true;
+        }
+        return lock;
+}
+
 void lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
@@ -188,17 +260,68 @@ void lock_destroy(struct lock *lock)
         spinlock_cleanup(&lock->lk_spin);
         wchan_destroy(lock->lk_wchan);
         kfree(lock->lk_name);
-        kfree(lock);
+        kmem_cache_free(&lock_cache, lock);
+}
+
+/*
+ * True if OWNER is on the cpu, and not ours. Looked at without any
+ * locks, so the answer may be stale by the time it is used, which only
+ * costs a little spinning or an unneeded sleep. OWNER may even have let
+ * go of the lock and exited; thread structures come from a kmem_cache
+ * in directly-mapped memory, so reading one that is gone is harmless.
+ */
+static
+bool
+lock_owner_running(struct thread *owner)
+{
+        struct cpu *c;
+
+        if (owner == NULL)
+        {
+                return false;
+        }
+        c = owner->t_cpu;
+        return c != NULL && c != curcpu->c_self &&
+                c->c_curthread == owner && owner->t_state == S_RUN;
 }
 
 void lock_acquire(struct lock *lock)
 {
+        unsigned spins;
+#if OPT_LOCKPROF
+        uint32_t start;
+        bool contended;
+#endif
+
         KASSERT(lock != NULL);
 
         spinlock_acquire(&lock->lk_spin);
-
-        while (lock->lk_held)
+#if OPT_LOCKPROF
+        start = cpu_cycles();
+        contended = lock->lk_held;
+#endif
+
+        /* With handoff, we may wake up owning it already. */
+        spins = 0;
+        while (lock->lk_held && lock->lk_owner != curthread)
         {
+                if (spins < LOCK_MAXSPIN && lock_owner_running(lock->lk_owner))
+                {
+                        /* Wait it out, without lk_spin, so it can release. */
+                        spinlock_release(&lock->lk_spin);
+                        while (spins < LOCK_MAXSPIN && lock->lk_held &&
+                               lock_owner_running(lock->lk_owner))
+                        {
+                                spins++;
+                        }
+                        spinlock_acquire(&lock->lk_spin);
+                        continue;
+                }
+
+                /* Whoever has it runs at least as well as we would. */
+                thread_lendprio(lock->lk_owner);
+
+                KTRACE(KT_LOCKWAIT, lock, 0);
                 wchan_lock(lock->lk_wchan);
                 spinlock_release(&lock->lk_spin);
                 wchan_sleep(lock->lk_wchan);
@@ -207,19 +330,59 @@ void lock_acquire(struct lock *lock)
 
         lock->lk_held = true;
         lock->lk_owner = curthread;
+        curthread->t_nlocks++;
+#if OPT_LOCKPROF
+        /* We may have slept and woken on another cpu; near enough. */
+        lock->lk_acquired = cpu_cycles();
+        lock->lk_wait = lock->lk_acquired - start;
+        lock->lk_contended = contended;
+#endif
         spinlock_release(&lock->lk_spin);
 }
 
 void lock_release(struct lock *lock)
 {
+#if OPT_LOCKPROF
+        uint32_t wait, hold;
+        bool contended;
+#endif
+
         KASSERT(lock != NULL);
         KASSERT(lock_do_i_hold(lock));
 
         spinlock_acquire(&lock->lk_spin);
-        lock->lk_held = false;
-        lock->lk_owner = NULL;
-        wchan_wakeone(lock->lk_wchan);
+#if OPT_LOCKPROF
+        wait = lock->lk_wait;
+        contended = lock->lk_contended;
+        hold = cpu_cycles() - lock->lk_acquired;
+#endif
+        if (lock->lk_handoff)
+        {
+                /*
+                 * Pass it on, still held. The new owner cannot look
+                 * until we let go of lk_spin, by which time it is
+                 * marked as theirs.
+                 */
+                lock->lk_owner = wchan_wakeone(lock->lk_wchan);
+                lock->lk_held = lock->lk_owner != NULL;
+        }
+        else
+        {
+                lock->lk_held = false;
+                lock->lk_owner = NULL;
+                wchan_wakeone(lock->lk_wchan);
+        }
         spinlock_release(&lock->lk_spin);
+
+        KASSERT(curthread->t_nlocks > 0);
+        curthread->t_nlocks--;
+        if (curthread->t_nlocks == 0)
+        {
+                thread_unlendprio();
+        }
+#if OPT_LOCKPROF
+        lockprof_lock(lock->lk_name, contended, wait, hold);
+#endif
 }
 
 bool lock_do_i_hold(struct lock *lock)
@@ -228,6 +391,29 @@ bool lock_do_i_hold(struct lock *lock)
         return lock->lk_owner == curthread;
 }
 
+bool lock_tryacquire(struct lock *lock)
+{
+        bool acquired;
+
+        KASSERT(lock != NULL);
+
+        spinlock_acquire(&lock->lk_spin);
+        acquired = !lock->lk_held;
+        if (acquired)
+        {
+                lock->lk_held = true;
+                lock->lk_owner = curthread;
+                curthread->t_nlocks++;
+#if OPT_LOCKPROF
+                lock->lk_acquired = cpu_cycles();
+                lock->lk_wait = 0;
+                lock->lk_contended = false;
+#endif
+        }
+        spinlock_release(&lock->lk_spin);
+        return acquired;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // CV
@@ -237,7 +423,7 @@ cv_create(const char *name)
 {
         struct cv *cv;
 
-        cv = kmalloc(sizeof(struct cv));
+        cv = kmem_cache_alloc(&cv_cache);
         if (cv == NULL)
         {
                 return NULL;
@@ -246,7 +432,7 @@ cv_create(const char *name)
         cv->cv_name = kstrdup(name);
         if (cv->cv_name == NULL)
         {
-                kfree(cv);
+                kmem_cache_free(&cv_cache, cv);
                 return NULL;
         }
 
@@ -254,7 +440,7 @@ cv_create(const char *name)
         if (cv->cv_wchan == NULL)
         {
                 kfree(cv->cv_name);
-                kfree(cv);
+                kmem_cache_free(&cv_cache, cv);
                 return NULL;
         }
 
@@ -268,7 +454,7 @@ void cv_destroy(struct cv *cv)
         wchan_destroy(cv->cv_wchan);
 
         kfree(cv->cv_name);
-        kfree(cv);
+        kmem_cache_free(&cv_cache, cv);
 }
 
 void cv_wait(struct cv *cv, struct lock *lock)
@@ -282,6 +468,36 @@ void cv_wait(struct cv *cv, struct lock *lock)
         lock_acquire(lock);
 }
 
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks)
+{
+        struct timeout to;
+        bool fired;
+
+        KASSERT(cv != NULL);
+        KASSERT(lock != NULL);
+
+        timeout_start(&to, ticks, cv->cv_wchan);
+
+        wchan_lock(cv->cv_wchan);
+        lock_release(lock);
+        if (to.to_fired)
+        {
+                wchan_unlock(cv->cv_wchan);
+        }
+        else
+        {
+                wchan_sleep(cv->cv_wchan);
+        }
+
+        /*
+         * If the deadline came, say so even if a signal came too; the
+         * caller rechecks its condition either way.
+         */
+        fired = timeout_stop(&to);
+        lock_acquire(lock);
+        return fired ? ETIMEDOUT : 0;
+}
+
 void cv_signal(struct cv *cv, struct lock *lock)
 {
         KASSERT(cv != NULL);
@@ -297,3 +513,140 @@ void cv_broadcast(struct cv *cv, struct lock *lock)
 
         (void)lock;
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rw;
+
+        rw = kmem_cache_alloc(&rwlock_cache);
+        if (rw == NULL)
+        {
+                return NULL;
+        }
+
+        rw->rw_name = kstrdup(name);
+        if (rw->rw_name == NULL)
+        {
+                kmem_cache_free(&rwlock_cache, rw);
+                return NULL;
+        }
+
+        rw->rw_readwchan = wchan_create(rw->rw_name);
+        if (rw->rw_readwchan == NULL)
+        {
+                kfree(rw->rw_name);
+                kmem_cache_free(&rwlock_cache, rw);
+                return NULL;
+        }
+
+        rw->rw_writewchan = wchan_create(rw->rw_name);
+        if (rw->rw_writewchan == NULL)
+        {
+                wchan_destroy(rw->rw_readwchan);
+                kfree(rw->rw_name);
+                kmem_cache_free(&rwlock_cache, rw);
+                return NULL;
+        }
+
+        spinlock_init(&rw->rw_spin);
+        rw->rw_readers = 0;
+        rw->rw_waitingwriters = 0;
+        rw->rw_writer = NULL;
+
+        return rw;
+}
+
+void rwlock_destroy(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rw->rw_readers == 0);
+        KASSERT(rw->rw_writer == NULL);
+
+        spinlock_cleanup(&rw->rw_spin);
+        wchan_destroy(rw->rw_writewchan);
+        wchan_destroy(rw->rw_readwchan);
+        kfree(rw->rw_name);
+        kmem_cache_free(&rwlock_cache, rw);
+}
+
+void rwlock_acquire_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+        spinlock_acquire(&rw->rw_spin);
+        /* Stay out while a writer has it or is waiting for it. */
+        while (rw->rw_writer != NULL || rw->rw_waitingwriters > 0)
+        {
+                wchan_lock(rw->rw_readwchan);
+                spinlock_release(&rw->rw_spin);
+                wchan_sleep(rw->rw_readwchan);
+                spinlock_acquire(&rw->rw_spin);
+        }
+        rw->rw_readers++;
+        spinlock_release(&rw->rw_spin);
+}
+
+void rwlock_release_read(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+
+        spinlock_acquire(&rw->rw_spin);
+        KASSERT(rw->rw_readers > 0);
+        rw->rw_readers--;
+        if (rw->rw_readers == 0 && rw->rw_waitingwriters > 0)
+        {
+                wchan_wakeone(rw->rw_writewchan);
+        }
+        spinlock_release(&rw->rw_spin);
+}
+
+void rwlock_acquire_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+        KASSERT(!rwlock_do_i_hold_write(rw));
+
+        spinlock_acquire(&rw->rw_spin);
+        rw->rw_waitingwriters++;
+        while (rw->rw_writer != NULL || rw->rw_readers > 0)
+        {
+                wchan_lock(rw->rw_writewchan);
+                spinlock_release(&rw->rw_spin);
+                wchan_sleep(rw->rw_writewchan);
+                spinlock_acquire(&rw->rw_spin);
+        }
+        rw->rw_waitingwriters--;
+        rw->rw_writer = curthread;
+        spinlock_release(&rw->rw_spin);
+}
+
+void rwlock_release_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        KASSERT(rwlock_do_i_hold_write(rw));
+
+        spinlock_acquire(&rw->rw_spin);
+        rw->rw_writer = NULL;
+        /* Next writer first; the readers get in once none are left. */
+        if (rw->rw_waitingwriters > 0)
+        {
+                wchan_wakeone(rw->rw_writewchan);
+        }
+        else
+        {
+                wchan_wakeall(rw->rw_readwchan);
+        }
+        spinlock_release(&rw->rw_spin);
+}
+
+bool rwlock_do_i_hold_write(struct rwlock *rw)
+{
+        KASSERT(rw != NULL);
+        return rw->rw_writer == curthread;
+}
@@ -35,8 +35,12 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/schedstat.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <array.h>
+#include <atomic.h>
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
@@ -46,12 +50,20 @@
 #include <threadprivate.h>
 #include <proc.h>
 #include <current.h>
+#include <rcu.h>
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <kmem_cache.h>
+#include <clock.h>
+#include <ktrace.h>
+#include <kstat.h>
+#include <upcall.h>
 
 #include "opt-synchprobs.h"
+#include "opt-A3.h"
+#include "opt-perf.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -68,12 +80,35 @@ struct wchan {
 DECLARRAY(cpu);
 DEFARRAY(cpu, /*no inline*/ );
 static struct cpuarray allcpus;
+unsigned cpu_ncpus;
 
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/*
+ * Destroyed threads each cpu keeps, stacks still attached, for
+ * thread_create to reuse.
+ */
+#define THREAD_SPARES 4
+
+/* Where thread and wait channel structures come from. */
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread), NULL);
+static struct kmem_cache wchan_cache =
+	KMEM_CACHE_INITIALIZER("wchan", sizeof(struct wchan), NULL);
+
+/* Context switches, over all cpus; preemptions are also counted apart. */
+static struct kstat sched_switches = KSTAT_INITIALIZER("sched.switches");
+static struct kstat sched_preemptions =
+	KSTAT_INITIALIZER("sched.preemptions");
+
 ////////////////////////////////////////////////////////////
 
+#if OPT_PERF
+/* Performance builds do without the stack checks below. */
+#define thread_checkstack_init(thread) ((void)(thread))
+#define thread_checkstack(thread) ((void)(thread))
+#else
 /*
  * Stick a magic number on the bottom end of the stack. This will
  * (sometimes) catch kernel stack overflows. Use thread_checkstack()
@@ -110,10 +145,61 @@ thread_checkstack(struct thread *thread)
 		KASSERT(((uint32_t*)thread->t_stack)[3] == THREAD_STACK_MAGIC);
 	}
 }
+#endif /* OPT_PERF */
+
+/*
+ * Take one of this cpu's spare threads, or return NULL if it has
+ * none. A spare has been cleaned up by thread_destroy all but its
+ * stack.
+ */
+static
+struct thread *
+thread_getspare(void)
+{
+	struct thread *thread;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_spares);
+	splx(spl);
+	return thread;
+}
+
+/*
+ * Keep THREAD, with its stack, as a spare for this cpu if there is
+ * room. Returns true if it was kept.
+ */
+static
+bool
+thread_putspare(struct thread *thread)
+{
+	bool kept;
+	int spl;
+
+	if (!CURCPU_EXISTS() || thread->t_stack == NULL) {
+		return false;
+	}
+	/* The stack is about to lose its magic numbers; check them first. */
+	thread_checkstack(thread);
+
+	spl = splhigh();
+	kept = curcpu->c_spares.tl_count < THREAD_SPARES;
+	if (kept) {
+		threadlist_addhead(&curcpu->c_spares, thread);
+	}
+	splx(spl);
+	return kept;
+}
 
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
+ *
+ * The thread may be a spare with a stack already; t_stack is NULL if
+ * not.
  */
 static
 struct thread *
@@ -123,15 +209,28 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = thread_getspare();
 	if (thread == NULL) {
-		return NULL;
+		thread = kmem_cache_alloc(&thread_cache);
+		if (thread == NULL) {
+			return NULL;
+		}
+		thread->t_stack = NULL;
 	}
 
-	thread->t_name = kstrdup(name);
-	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+	if (strlen(name) < sizeof(thread->t_namebuf)) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
+	}
+	else {
+		thread->t_name = kstrdup(name);
+		if (thread->t_name == NULL) {
+			if (thread->t_stack != NULL) {
+				kfree(thread->t_stack);
+			}
+			kmem_cache_free(&thread_cache, thread);
+			return NULL;
+		}
 	}
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
@@ -139,16 +238,43 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	arena_init(&thread->t_arena);
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Scheduler fields; new threads start at the top */
+	thread->t_priority = 0;
+	thread->t_usage = 0;
+	thread->t_runstart = 0;
+	thread->t_lentprio = SCHED_NPRIO;
+	thread->t_nice = 0;
+	thread->t_affinity = ~(uint32_t)0;
+	thread->t_group = NULL;
+
+	/* Scheduling statistics */
+	thread->t_runticks = 0;
+	thread->t_vswitches = 0;
+	thread->t_ivswitches = 0;
+	thread->t_wakeups = 0;
+	thread->t_wakelat = 0;
+	thread->t_maxwakelat = 0;
+	thread->t_wokeat = 0;
+	thread->t_waking = false;
+	thread->t_migrations = 0;
+	thread->t_lastcpu = NULL;
+	thread->t_inboxnext = NULL;
+	thread->t_bound = false;
+	thread->t_oublock = 0;
+	thread->t_upcall = NULL;
+	thread->t_jnest = 0;
+	thread->t_nlocks = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
 
 	return thread;
@@ -168,8 +294,9 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
-	c = kmalloc(sizeof(*c));
+	c = kmalloc_aligned(sizeof(*c), CACHELINE_SIZE);
 	if (c == NULL) {
 		panic("cpu_create: Out of memory\n");
 	}
@@ -179,11 +306,31 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_spares);
 	c->c_hardclocks = 0;
+	c->c_tickless = false;
+	c->c_idlecycles = 0;
+	c->c_clockset = false;
+	c->c_clocklast = 0;
+	c->c_intrpc = 0;
+	c->c_intruser = false;
+	c->c_preempt = false;
+	for (i=0; i<SCHEDSTAT_RQHIST; i++) {
+		c->c_rqhist[i] = 0;
+	}
+#if OPT_A3
+	c->c_pagecache_count = 0;
+#endif
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	spinlock_init_ticket(&c->c_runqueue_lock);
+
+	c->c_inbox = NULL;
+	c->c_inboxin = 0;
+	c->c_inboxout = 0;
+	c->c_curprio = 0;
+	c->c_rcugen = 0;
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -193,6 +340,7 @@ cpu_create(unsigned hardware_number)
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	cpu_ncpus = cpuarray_num(&allcpus);
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -214,9 +362,11 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
 		if (c->c_curthread->t_stack == NULL) {
-			panic("cpu_create: couldn't allocate stack");
+			c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+			if (c->c_curthread->t_stack == NULL) {
+				panic("cpu_create: couldn't allocate stack");
+			}
 		}
 		thread_checkstack_init(c->c_curthread);
 	}
@@ -227,6 +377,13 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+struct cpu *
+cpu_get(unsigned num)
+{
+	KASSERT(num < cpuarray_num(&allcpus));
+	return cpuarray_get(&allcpus, num);
+}
+
 /*
  * Destroy a thread.
  *
@@ -234,6 +391,9 @@ cpu_create(unsigned hardware_number)
  * Nor can it be called on a running thread.
  *
  * (Freeing the stack you're actually using to run is ... inadvisable.)
+ *
+ * The structure and stack may be kept as a spare (thread_putspare)
+ * instead of being freed.
  */
 static
 void
@@ -249,17 +409,27 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
-	threadlistnode_cleanup(&thread->t_listnode);
+	arena_cleanup(&thread->t_arena);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
-	kfree(thread);
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
+	}
+	thread->t_name = NULL;
+
+	/* Keep the rest for the next thread_create if we can. */
+	if (thread_putspare(thread)) {
+		return;
+	}
+
+	if (thread->t_stack != NULL) {
+		kfree(thread->t_stack);
+	}
+	threadlistnode_cleanup(&thread->t_listnode);
+	kmem_cache_free(&thread_cache, thread);
 }
 
 /*
@@ -387,8 +557,8 @@ thread_bootstrap(void)
  * New CPUs come here once MD initialization is finished. curthread
  * and curcpu should already be initialized.
  *
- * Other than clearing thread_start_cpus() to continue, we don't need
- * to do anything. The startup thread can just exit; we only need it
+ * Other than letting thread_wait_cpus() continue, we don't need to do
+ * anything. The startup thread can just exit; we only need it
  * to be able to get into thread_switch() properly.
  */
 void
@@ -407,18 +577,32 @@ cpu_hatch(unsigned software_number)
 }
 
 /*
- * Start up secondary cpus. Called from boot().
+ * Start up secondary cpus. Called from boot(). They are all let go at
+ * once and hatch side by side; boot() goes on with its own work
+ * meanwhile, and waits for them with thread_wait_cpus. Threads can be
+ * put on a cpu that has not hatched yet; it runs them once it has.
  */
 void
 thread_start_cpus(void)
 {
-	unsigned i;
-
 	kprintf("cpu0: %s\n", cpu_identify());
 
 	cpu_startup_sem = sem_create("cpu_hatch", 0);
+	if (cpu_startup_sem == NULL) {
+		panic("thread_start_cpus: sem_create failed\n");
+	}
 	mainbus_start_cpus();
-	
+}
+
+/*
+ * Wait for the cpus thread_start_cpus started to hatch.
+ */
+void
+thread_wait_cpus(void)
+{
+	unsigned i;
+
+	KASSERT(cpu_startup_sem != NULL);
 	for (i=0; i<cpuarray_num(&allcpus) - 1; i++) {
 		P(cpu_startup_sem);
 	}
@@ -426,10 +610,293 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * The priority T is scheduled at: its own, or better if a lock waiter
+ * has lent it one (see thread_lendprio).
+ */
+#define THREAD_PRIO(t) \
+	((t)->t_lentprio < (t)->t_priority ? (t)->t_lentprio : (t)->t_priority)
+
+/*
+ * The best and worst priorities T's nice value lets it have: PRIO_MAX
+ * keeps it at the bottom, PRIO_MIN at the top, and 0 leaves it free.
+ */
+#define SCHED_TOP(t) \
+	((t)->t_nice > 0 ? \
+	 (unsigned)(t)->t_nice * SCHED_NPRIO / (PRIO_MAX + 1) : 0)
+#define SCHED_BOTTOM(t) \
+	((t)->t_nice < 0 ? SCHED_NPRIO - 1 - \
+	 (unsigned)-(t)->t_nice * SCHED_NPRIO / (1 - PRIO_MIN) : \
+	 SCHED_NPRIO - 1)
+
+/* Whether T's affinity lets it run on C. */
+#define THREAD_CANRUN(t, c) (((t)->t_affinity >> (c)->c_number) & 1)
+
+/*
+ * Put T on C's run queue, behind the threads of its own priority and
+ * ahead of those of lower priority. C's runqueue lock held. Searching
+ * from the tail, so the common case of everything having the same
+ * priority costs nothing.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	struct thread *before;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	THREADLIST_FORALL_REV(before, c->c_runqueue) {
+		if (THREAD_PRIO(before) <= THREAD_PRIO(t)) {
+			threadlist_insertafter(&c->c_runqueue, before, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, t);
+}
+
+/*
+ * Whether T may be picked whatever its group: kernel threads, which
+ * are in none, and threads lent a priority, which hold a lock someone
+ * is waiting for.
+ */
+#define THREAD_UNGROUPED(t) \
+	((t)->t_group == NULL || (t)->t_lentprio < SCHED_NPRIO)
+
+/*
+ * Take the next thread to run off C's run queue: the first, in
+ * priority order, of the group there that has had the least of the
+ * cpu lately, or that is THREAD_UNGROUPED; NULL if it is empty. C's
+ * runqueue lock held, which keeps each queued thread's t_group. Two
+ * passes over the queue, which is short; with only one group there,
+ * or none, this is the queue's head.
+ */
+static
+struct thread *
+runqueue_pick(struct cpu *c)
+{
+	struct schedgroup *best = NULL;
+	struct thread *t;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	THREADLIST_FORALL(t, c->c_runqueue) {
+		if (t->t_group != NULL &&
+		    (best == NULL || t->t_group->sg_usage < best->sg_usage)) {
+			best = t->t_group;
+		}
+	}
+	THREADLIST_FORALL(t, c->c_runqueue) {
+		if (t->t_group == best || THREAD_UNGROUPED(t)) {
+			threadlist_remove(&c->c_runqueue, t);
+			return t;
+		}
+	}
+	/* only an empty queue leaves BEST NULL */
+	KASSERT(best == NULL);
+	return NULL;
+}
+
+/*
+ * Inboxes.
+ *
+ * A wakeup from another cpu does not take the target cpu's runqueue
+ * lock, which would make every waker contend with the scheduler over
+ * there; it pushes the thread onto the target's c_inbox instead, and
+ * the target moves everything in it to its run queue whenever it has
+ * the lock anyway (runqueue_drain, from thread_switch). Pushes race
+ * only with each other and with the swap that empties the whole list,
+ * so a compare-and-swap on the head is all it takes: nothing is ever
+ * taken off the inbox singly, and so there is no ABA problem.
+ */
+static
+void
+runqueue_post(struct cpu *c, struct thread *t)
+{
+	struct thread *old;
+
+	do {
+		old = c->c_inbox;
+		t->t_inboxnext = old;
+	} while (!atomic_cas_ptr((void *volatile *)&c->c_inbox, old, t));
+	atomic_inc(&c->c_inboxin);
+}
+
+/*
+ * Push a chain of N threads, FIRST to LAST linked through t_inboxnext
+ * and newest first, as that many runqueue_posts would have left them,
+ * with a single compare-and-swap.
+ */
+static
+void
+runqueue_postlist(struct cpu *c, struct thread *first, struct thread *last,
+		  unsigned n)
+{
+	struct thread *old;
+
+	do {
+		old = c->c_inbox;
+		last->t_inboxnext = old;
+	} while (!atomic_cas_ptr((void *volatile *)&c->c_inbox, old, first));
+	atomic_add(&c->c_inboxin, n);
+}
+
+/*
+ * Move everything in our inbox onto our run queue, oldest first so
+ * that wakeups keep their order. Our runqueue lock held.
+ */
+static
+void
+runqueue_drain(void)
+{
+	struct cpu *c = curcpu->c_self;
+	struct thread *list, *t, *rev;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	do {
+		list = c->c_inbox;
+		if (list == NULL) {
+			return;
+		}
+	} while (!atomic_cas_ptr((void *volatile *)&c->c_inbox, list, NULL));
+
+	rev = NULL;
+	while (list != NULL) {
+		t = list;
+		list = t->t_inboxnext;
+		t->t_inboxnext = rev;
+		rev = t;
+	}
+	while (rev != NULL) {
+		t = rev;
+		rev = t->t_inboxnext;
+		t->t_inboxnext = NULL;
+		runqueue_add(c, t);
+		c->c_inboxout++;
+	}
+}
+
+/*
+ * Placement.
+ *
+ * Choose the cpu a thread that is about to become runnable, at fork or
+ * wakeup, should go on, so that a burst of them spreads out at once
+ * rather than after thread_consider_migration gets around to it. A
+ * cpu's load is the threads on its runqueue plus one for the one it is
+ * running; the least loaded wins, and ties go to the cpu the thread
+ * was last on, whose cache may still hold its working set, so it stays
+ * put unless there is a real gain. The loads are read unlocked: this is
+ * only a hint, and the balancing behind it sorts out any misjudgement.
+ *
+ * A thread that went to sleep may still be curthread on its old cpu, if
+ * that cpu went idle in the middle of switching away from it (see
+ * thread_consider_migration), and must not then be moved. Checking
+ * under the old cpu's runqueue lock is enough: once c_curthread is
+ * something else, the switch is finished, and it cannot become the
+ * thread again until the thread is on that runqueue.
+ */
+
+#define THREAD_LOAD(c) ((c)->c_runqueue.tl_count + \
+			((c)->c_inboxin - (c)->c_inboxout) + \
+			((c)->c_isidle ? 0 : 1))
+
+static
+void
+thread_place(struct thread *target)
+{
+	struct cpu *old, *best, *c;
+	unsigned i, numcpus, load, bestload;
+	bool busy;
+
+	old = target->t_cpu;
+	if (target->t_bound || (old->c_isidle && THREAD_CANRUN(target, old))) {
+		return;
+	}
+
+	if (THREAD_CANRUN(target, old)) {
+		best = old;
+		bestload = THREAD_LOAD(old);
+	}
+	else {
+		best = NULL;
+		bestload = (unsigned)-1;
+	}
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus && bestload > 0; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!THREAD_CANRUN(target, c)) {
+			continue;
+		}
+		load = THREAD_LOAD(c);
+		if (load < bestload) {
+			best = c;
+			bestload = load;
+		}
+	}
+	KASSERT(best != NULL);
+	if (best == old) {
+		return;
+	}
+
+	spinlock_acquire(&old->c_runqueue_lock);
+	busy = old->c_curthread == target;
+	spinlock_release(&old->c_runqueue_lock);
+	if (!busy) {
+		target->t_cpu = best;
+	}
+}
+
+/*
+ * Send T, which was on our run queue but may not run on this cpu any
+ * more (see thread_setaffinity), to the least loaded cpu it may run
+ * on. It is not curthread, so nothing of it is still in use here. Our
+ * runqueue lock held.
+ */
+static
+void
+thread_rehome(struct thread *t)
+{
+	struct cpu *best, *c;
+	unsigned i, numcpus, load, bestload;
+
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+	KASSERT(t != curthread);
+
+	best = NULL;
+	bestload = (unsigned)-1;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!THREAD_CANRUN(t, c)) {
+			continue;
+		}
+		load = THREAD_LOAD(c);
+		if (load < bestload) {
+			best = c;
+			bestload = load;
+		}
+	}
+	KASSERT(best != NULL && best != curcpu->c_self);
+
+	t->t_cpu = best;
+	runqueue_post(best, t);
+	if (best->c_isidle) {
+		ipi_send(best, IPI_UNIDLE);
+	}
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too. 
+ * targetcpu might be curcpu; it might not be, too. Unless the caller
+ * already has its runqueue locked (which is thread_switch requeueing
+ * curthread), the thread is first placed on the best cpu for it, and if
+ * that is another cpu it goes in that cpu's inbox rather than straight
+ * onto its run queue.
+ *
+ * An idle cpu sets c_isidle before it drains its inbox, so either it
+ * finds the thread there or we see it idle and send it the IPI.
  */
 static
 void
@@ -438,9 +905,31 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	struct cpu *targetcpu;
 	bool isidle;
 
-	/* Lock the run queue of the target thread's cpu. */
+	if (!already_have_lock) {
+		thread_place(target);
+	}
+
 	targetcpu = target->t_cpu;
 
+	if (!already_have_lock) {
+		/* For the wakeup latency; see sched_switchin. */
+		target->t_wakeups++;
+		target->t_wokeat = cpu_cycles();
+		target->t_waking = true;
+
+		if (targetcpu != curcpu->c_self) {
+			runqueue_post(targetcpu, target);
+			if (targetcpu->c_isidle) {
+				ipi_send(targetcpu, IPI_UNIDLE);
+			}
+			else if (THREAD_PRIO(target) < targetcpu->c_curprio) {
+				ipi_send(targetcpu, IPI_PREEMPT);
+			}
+			return;
+		}
+	}
+
+	/* Lock the run queue of the target thread's cpu. */
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
@@ -450,7 +939,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -458,12 +947,94 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (!already_have_lock &&
+		 THREAD_PRIO(target) < THREAD_PRIO(curthread)) {
+		/* Better than us; see thread_preempt. */
+		curcpu->c_preempt = true;
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
 	}
 }
 
+/*
+ * Make all the threads on LIST runnable, as thread_make_runnable would
+ * one at a time, but a cpu at a time: those placed on another cpu go
+ * into its inbox with one compare-and-swap, those staying here go onto
+ * our run queue under one acquisition of its lock, and each cpu gets
+ * at most one IPI however many threads it got. Each cpu's threads keep
+ * their order from LIST, which ends up empty.
+ */
+static
+void
+thread_make_runnable_list(struct threadlist *list)
+{
+	struct threadlist group;
+	struct thread *t, *next, *first, *last;
+	struct cpu *c;
+	unsigned n, best;
+	bool isidle;
+
+	THREADLIST_FORALL(t, *list) {
+		thread_place(t);
+		/* For the wakeup latency; see sched_switchin. */
+		t->t_wakeups++;
+		t->t_wokeat = cpu_cycles();
+		t->t_waking = true;
+	}
+
+	threadlist_init(&group);
+	while (!threadlist_isempty(list)) {
+		/* Take out the first thread's cpu's share. */
+		c = list->tl_head.tln_next->tln_self->t_cpu;
+		best = SCHED_NPRIO;
+		for (t = list->tl_head.tln_next->tln_self; t != NULL; t = next) {
+			next = t->t_listnode.tln_next->tln_self;
+			if (t->t_cpu == c) {
+				threadlist_remove(list, t);
+				threadlist_addtail(&group, t);
+				if (THREAD_PRIO(t) < best) {
+					best = THREAD_PRIO(t);
+				}
+			}
+		}
+
+		if (c == curcpu->c_self) {
+			spinlock_acquire(&c->c_runqueue_lock);
+			isidle = c->c_isidle;
+			while ((t = threadlist_remhead(&group)) != NULL) {
+				runqueue_add(c, t);
+			}
+			spinlock_release(&c->c_runqueue_lock);
+			if (isidle) {
+				ipi_send(c, IPI_UNIDLE);
+			}
+			else if (best < THREAD_PRIO(curthread)) {
+				curcpu->c_preempt = true;
+			}
+			continue;
+		}
+
+		first = last = threadlist_remhead(&group);
+		first->t_inboxnext = NULL;
+		n = 1;
+		while ((t = threadlist_remhead(&group)) != NULL) {
+			t->t_inboxnext = first;
+			first = t;
+			n++;
+		}
+		runqueue_postlist(c, first, last, n);
+		if (c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+		}
+		else if (best < c->c_curprio) {
+			ipi_send(c, IPI_PREEMPT);
+		}
+	}
+	threadlist_cleanup(&group);
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -471,14 +1042,17 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
  * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * process is inherited from the caller. It will start on whichever CPU
+ * is least busy, preferring the caller's (see thread_place), unless
+ * BOUNDCPU is set, in which case it starts there and stays there.
  */
+static
 int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+thread_fork_common(const char *name,
+		   struct proc *proc,
+		   struct cpu *boundcpu,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2)
 {
 	struct thread *newthread;
 	int result;
@@ -492,11 +1066,13 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	/* Allocate a stack, unless it came with one */
 	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -505,7 +1081,13 @@ thread_fork(const char *name,
 	 */
 
 	/* Thread subsystem fields */
-	newthread->t_cpu = curthread->t_cpu;
+	if (boundcpu != NULL) {
+		newthread->t_cpu = boundcpu;
+		newthread->t_bound = true;
+	}
+	else {
+		newthread->t_cpu = curthread->t_cpu;
+	}
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -534,6 +1116,177 @@ thread_fork(const char *name,
 	return 0;
 }
 
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_common(name, proc, NULL, entrypoint, data1, data2);
+}
+
+int
+thread_fork_bound(const char *name,
+		  struct proc *proc,
+		  struct cpu *cpu,
+		  void (*entrypoint)(void *data1, unsigned long data2),
+		  void *data1, unsigned long data2)
+{
+	KASSERT(cpu != NULL);
+	return thread_fork_common(name, proc, cpu, entrypoint, data1, data2);
+}
+
+/*
+ * Work stealing.
+ *
+ * A cpu that runs out of threads, before it idles, looks for the
+ * busiest other runqueue and takes a thread from it, rather than
+ * waiting for that cpu to push work its way in
+ * thread_consider_migration. From the tail, so the lowest priority,
+ * and preferring a thread that has not been on the victim for
+ * THREAD_STEAL_COLD hardclocks, since one that has will still have its
+ * working set in that cpu's cache. A thread that has never run at all,
+ * as after a burst of thread_forks, is always cold. If every queued
+ * thread is hot, one is stolen only if the victim has at least
+ * THREAD_STEAL_HOTMIN waiting: it will get to a lone one soon enough.
+ *
+ * Called with interrupts off and no runqueue locks held, so as to be
+ * able to lock the victim's. Returns true if it put a thread on our
+ * runqueue.
+ */
+
+#define THREAD_STEAL_COLD	2
+#define THREAD_STEAL_HOTMIN	2
+
+static
+bool
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t, *stolen;
+	unsigned i, numcpus, best;
+
+	/* Find the busiest; unlocked, since it is only a hint. */
+	victim = NULL;
+	best = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || c->c_isidle) {
+			continue;
+		}
+		if (c->c_runqueue.tl_count > best) {
+			best = c->c_runqueue.tl_count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	stolen = NULL;
+	spinlock_acquire(&victim->c_runqueue_lock);
+	THREADLIST_FORALL_REV(t, victim->c_runqueue) {
+		/* Never its curthread; see thread_consider_migration. */
+		if (t == victim->c_curthread || t->t_bound ||
+		    !THREAD_CANRUN(t, curcpu)) {
+			continue;
+		}
+		if (victim->c_hardclocks - t->t_runstart >= THREAD_STEAL_COLD) {
+			stolen = t;
+			break;
+		}
+		if (stolen == NULL &&
+		    victim->c_runqueue.tl_count >= THREAD_STEAL_HOTMIN) {
+			/* Hot, but take it if nothing better turns up. */
+			stolen = t;
+		}
+	}
+	if (stolen != NULL) {
+		threadlist_remove(&victim->c_runqueue, stolen);
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+	if (stolen == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	stolen->t_cpu = curcpu->c_self;
+	runqueue_add(curcpu->c_self, stolen);
+	spinlock_release(&curcpu->c_runqueue_lock);
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      stolen->t_name, victim->c_number, curcpu->c_number);
+	return true;
+}
+
+/*
+ * Scheduler accounting, done at each context switch. See the comment
+ * above schedule() for the policy.
+ */
+
+/* Hardclocks a thread may use at priority P before it drops. */
+#define SCHED_ALLOTMENT(p)	((unsigned)SCHEDULE_HARDCLOCKS << (p))
+
+/* How often everything is put back at the top. */
+#define SCHED_BOOST_HARDCLOCKS	(25 * SCHEDULE_HARDCLOCKS)
+
+/*
+ * Charge CUR for the time since it was put on the cpu, as it leaves it
+ * for NEWSTATE, and adjust its priority. Runqueue lock held.
+ */
+static
+void
+sched_charge(struct thread *cur, threadstate_t newstate)
+{
+	unsigned ran;
+
+	ran = curcpu->c_hardclocks - cur->t_runstart;
+	cur->t_usage += ran;
+	cur->t_runticks += ran;
+	cur->t_runstart = curcpu->c_hardclocks;
+	if (cur->t_group != NULL && ran > 0) {
+		atomic_add(&cur->t_group->sg_usage, ran);
+	}
+
+	if (cur->t_usage >= SCHED_ALLOTMENT(cur->t_priority)) {
+		if (cur->t_priority < SCHED_BOTTOM(cur)) {
+			cur->t_priority++;
+		}
+		cur->t_usage = 0;
+	}
+	else if (newstate == S_SLEEP && cur->t_priority > SCHED_TOP(cur)) {
+		cur->t_priority--;
+		cur->t_usage = 0;
+	}
+}
+
+/*
+ * Statistics to keep as CUR comes onto the cpu: how long it waited
+ * since being made runnable, if it was, and whether it has moved. The
+ * cycle counters of different cpus are taken to agree, near enough.
+ * Runqueue lock held.
+ */
+static
+void
+sched_switchin(struct thread *cur)
+{
+	uint32_t lat;
+
+	if (cur->t_waking) {
+		cur->t_waking = false;
+		lat = cpu_cycles() - cur->t_wokeat;
+		cur->t_wakelat += lat;
+		if (lat > cur->t_maxwakelat) {
+			cur->t_maxwakelat = lat;
+		}
+	}
+	if (cur->t_lastcpu != NULL && cur->t_lastcpu != curcpu->c_self) {
+		cur->t_migrations++;
+	}
+	cur->t_lastcpu = curcpu->c_self;
+	curcpu->c_curprio = THREAD_PRIO(cur);
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -548,6 +1301,8 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc)
 {
 	struct thread *cur, *next;
+	uint32_t idlestart;
+	bool preempted;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -570,8 +1325,17 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
-	/* Lock the run queue. */
+	/* Lock the run queue, and take in what other cpus have posted. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
+	runqueue_drain();
+	rcu_quiescent();
+
+	/* Whatever asked for a switch (thread_preempt) gets one now. */
+	preempted = curcpu->c_preempt;
+	curcpu->c_preempt = false;
+
+	/* Charge it for the time it has had, before it goes anywhere. */
+	sched_charge(cur, newstate);
 
 	/* Micro-optimization: if nothing to do, just return */
 	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
@@ -580,6 +1344,19 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		return;
 	}
 
+	/*
+	 * A yield from an interrupt handler is the timer preempting us;
+	 * one asked for by thread_preempt is a wakeup doing it.
+	 */
+	if (newstate == S_READY && (cur->t_in_interrupt || preempted)) {
+		cur->t_ivswitches++;
+		kstat_inc(&sched_preemptions);
+	}
+	else {
+		cur->t_vswitches++;
+	}
+	kstat_inc(&sched_switches);
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -624,6 +1401,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * interrupt from another cpu posting a wakeup) and idling
 	 * *is* atomic with respect to re-enabling interrupts.
 	 *
+	 * Before idling, try to take a thread from a busier cpu
+	 * (thread_steal). That needs our runqueue unlocked too.
+	 *
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
@@ -632,15 +1412,36 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		runqueue_drain();
+		next = runqueue_pick(curcpu->c_self);
+		if (next != NULL && next != cur &&
+		    !THREAD_CANRUN(next, curcpu)) {
+			thread_rehome(next);
+			next = NULL;
+			continue;
+		}
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!thread_steal()) {
+				idlestart = cpu_cycles();
+				cpu_idle();
+				curcpu->c_idlecycles +=
+					cpu_cycles() - idlestart;
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	/* If hardclock stopped the tick while we were idle, restart it. */
+	if (curcpu->c_tickless) {
+		curcpu->c_tickless = false;
+		mainbus_hardclock_start();
+		/* nobody may have updated these for a while */
+		clock_anchor();
+		timepage_update();
+	}
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -651,6 +1452,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	curcpu->c_curthread = next;
 	curthread = next;
 
+	KTRACE(KT_SWITCH, cur, next);
+
 	/* do the switch (in assembler in switch.S) */
 	switchframe_switch(&cur->t_context, &next->t_context);
 
@@ -704,6 +1507,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Clear the wait channel and set the thread state. */
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
+	cur->t_runstart = curcpu->c_hardclocks;
+	sched_switchin(cur);
 
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -737,6 +1542,8 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clear the wait channel and set the thread state. */
 	cur->t_wchan_name = NULL;
 	cur->t_state = S_RUN;
+	cur->t_runstart = curcpu->c_hardclocks;
+	sched_switchin(cur);
 
 	/* Release the runqueue lock acquired in thread_switch. */
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -810,29 +1617,380 @@ thread_exit(void)
 
 /*
  * Yield the cpu to another process, but stay runnable.
+ *
+ * If there is nothing else to run here, the switch would only pick us
+ * again, so don't go into thread_switch at all. The check is made
+ * without the runqueue lock; a thread that is being made runnable here
+ * right now waits for the next hardclock, just as if it had arrived
+ * after thread_switch looked. Our time is not charged, but t_runstart
+ * is left alone, so the next real switch charges all of it.
  */
 void
 thread_yield(void)
 {
+	if (curcpu->c_runqueue.tl_count == 0 && curcpu->c_inbox == NULL) {
+		return;
+	}
 	thread_switch(S_READY, NULL);
 }
 
+/*
+ * Preemption by wakeups. Making a thread runnable that is better than
+ * the one running on its cpu sets that cpu's c_preempt, directly or
+ * by IPI_PREEMPT from another cpu, and the cpu switches at the first
+ * point it safely can, rather than at the next hardclock: when the
+ * interrupt it is in returns (mainbus_interrupt), or when the code it
+ * is running lowers the spl back to none (spllower), which for a
+ * wakeup done under a spinlock is as soon as that is released. Code
+ * running with interrupts on could have been preempted there by the
+ * timer anyway, so this makes no new places a thread can lose the
+ * cpu, only sooner ones.
+ *
+ * curcpu is read with interrupts on, so may be stale if we were
+ * preempted meanwhile; a switch that was not wanted any more costs
+ * no more than a yield with nothing better to run. thread_switch
+ * clears the flag whether or not it switches.
+ */
+void
+thread_preempt(void)
+{
+	if (curcpu->c_preempt && !curcpu->c_isidle) {
+		thread_switch(S_READY, NULL);
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Each thread has a priority
+ * from 0 (best) to SCHED_NPRIO-1, and each run queue is kept sorted by
+ * it (see runqueue_add), so the next thread to run is always one of
+ * the best waiting; threads of the same priority take turns, as
+ * before, every time hardclock() yields.
+ *
+ * Every thread starts at 0. How much cpu time a thread has used is
+ * counted in hardclocks, when it comes off the cpu (sched_charge):
+ * once it has had SCHED_ALLOTMENT of them at its current priority, it
+ * drops to the next one down. A thread that goes to sleep on a wait
+ * channel before its allotment is used up moves up one instead. Thus
+ * cpu-bound threads sink and threads that mostly wait on I/O float,
+ * and get the cpu as soon as they wake.
+ *
+ * A thread holding a sleep lock that a better thread is about to sleep
+ * on is lent the waiter's priority (thread_lendprio, from lock_acquire)
+ * and is queued by the better of the two until it has released every
+ * lock it holds, so a sunk thread cannot keep a lock from a thread
+ * that floats for longer than it would take to finish with it. Lent
+ * priority is not handed on down a chain of lock owners.
+ *
+ * A thread's nice value (thread_setnice) bounds this: a nice thread
+ * starts, floats up to, and is boosted back to no better than
+ * SCHED_TOP, and a thread with a negative one never sinks below
+ * SCHED_BOTTOM, so at PRIO_MIN it preempts everything else and at
+ * PRIO_MAX it only gets what the others leave.
+ *
+ * So that the sunk threads are not starved, every SCHED_BOOST_HARDCLOCKS
+ * schedule() puts everything on the cpu back at the top, or as near as
+ * its nice value lets it.
+ *
+ * Above all this, the cpu is shared out between process groups, not
+ * threads, so that a job tree of fifty processes gets no more of it
+ * than one of a single process. The hardclocks a thread runs are also
+ * charged to its process's group (struct schedgroup), and the next
+ * thread to run is the first on the queue whose group has had the
+ * least (runqueue_pick); priorities order the threads within a group.
+ * Kernel threads belong to no group and are picked as before, as are
+ * threads holding a lock that someone is waiting on, so that fair
+ * share cannot undo priority lending. Every boost, cpu 0 halves each
+ * group's count, so that what a group ran long ago counts for less.
  */
 
+/*
+ * All the scheduling groups, for the decay; adding to and taking off
+ * the list, and the reference counts, are under schedgroup_lock.
+ */
+static struct spinlock schedgroup_lock = SPINLOCK_INITIALIZER;
+static struct schedgroup *schedgroups;
+
+/* Halve each group's count; see above. */
+static
+void
+schedgroup_decay(void)
+{
+	struct schedgroup *g;
+	unsigned u;
+
+	spinlock_acquire(&schedgroup_lock);
+	for (g = schedgroups; g != NULL; g = g->sg_next) {
+		do {
+			u = g->sg_usage;
+		} while (!atomic_cas(&g->sg_usage, u, u / 2));
+	}
+	spinlock_release(&schedgroup_lock);
+}
+
 void
 schedule(void)
 {
+	struct threadlist boosted;
+	struct thread *t;
+
+	if (curcpu->c_hardclocks % SCHED_BOOST_HARDCLOCKS != 0) {
+		return;
+	}
+	if (curcpu->c_number == 0) {
+		schedgroup_decay();
+	}
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * Niced threads end up lower, so queue everything again;
+	 * runqueue_add keeps the rest in the order they were in.
 	 */
+	threadlist_init(&boosted);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	while ((t = threadlist_remhead(&curcpu->c_runqueue)) != NULL) {
+		t->t_priority = SCHED_TOP(t);
+		t->t_usage = 0;
+		threadlist_addtail(&boosted, t);
+	}
+	while ((t = threadlist_remhead(&boosted)) != NULL) {
+		runqueue_add(curcpu->c_self, t);
+	}
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = SCHED_TOP(curthread);
+		curthread->t_usage = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+	threadlist_cleanup(&boosted);
+}
+
+/*
+ * Lock the run queue of T's cpu and return the cpu. T's cpu can change
+ * while we are not holding its runqueue lock, so check again once we
+ * have it.
+ */
+static
+struct cpu *
+thread_lockcpu(struct thread *t)
+{
+	struct cpu *c;
+
+	while (1) {
+		c = t->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (t->t_cpu == c) {
+			return c;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+}
+
+/*
+ * Move T, whose priority just changed, to its new place in C's run
+ * queue, if it is in it. It is only if it is ready and not still in
+ * the cpu's inbox; in the inbox it is queued by the new priority when
+ * it comes out. The search is short, and only done when a priority is
+ * changed from outside. C's runqueue lock held.
+ */
+static
+void
+runqueue_requeue(struct cpu *c, struct thread *t)
+{
+	struct thread *q;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	if (t->t_state != S_READY) {
+		return;
+	}
+	THREADLIST_FORALL(q, c->c_runqueue) {
+		if (q == t) {
+			threadlist_remove(&c->c_runqueue, t);
+			runqueue_add(c, t);
+			return;
+		}
+	}
+}
+
+/*
+ * Priority inheritance; see above. Our own priority is read unlocked,
+ * which is good enough for a loan.
+ */
+void
+thread_lendprio(struct thread *t)
+{
+	struct cpu *c;
+	unsigned prio;
+
+	prio = THREAD_PRIO(curthread);
+
+	c = thread_lockcpu(t);
+	if (prio < THREAD_PRIO(t)) {
+		t->t_lentprio = prio;
+		runqueue_requeue(c, t);
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * We are running, so not on a run queue, and t_cpu is ours until we
+ * switch; splhigh keeps it so while we look.
+ */
+void
+thread_unlendprio(void)
+{
+	struct cpu *c;
+	int spl;
+
+	KASSERT(curthread->t_nlocks == 0);
+
+	if (curthread->t_lentprio == SCHED_NPRIO) {
+		return;
+	}
+	spl = splhigh();
+	c = curcpu->c_self;
+	spinlock_acquire(&c->c_runqueue_lock);
+	curthread->t_lentprio = SCHED_NPRIO;
+	spinlock_release(&c->c_runqueue_lock);
+	splx(spl);
+}
+
+/*
+ * Nice values; see above. T's priority is brought within the new
+ * bounds at once, rather than at the next boost.
+ */
+void
+thread_setnice(struct thread *t, int nice)
+{
+	struct cpu *c;
+
+	KASSERT(nice >= PRIO_MIN && nice <= PRIO_MAX);
+
+	c = thread_lockcpu(t);
+	t->t_nice = nice;
+	if (t->t_priority < SCHED_TOP(t)) {
+		t->t_priority = SCHED_TOP(t);
+	}
+	else if (t->t_priority > SCHED_BOTTOM(t)) {
+		t->t_priority = SCHED_BOTTOM(t);
+	}
+	runqueue_requeue(c, t);
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Affinity. Nothing is moved here: a thread on a run queue where it
+ * may no longer run is sent on by thread_rehome when it comes to the
+ * head of it, and one that is asleep or running is placed when it is
+ * next made runnable (thread_place). Migration and stealing leave a
+ * thread out of the cpus it may not run on.
+ */
+void
+thread_setaffinity(struct thread *t, uint32_t mask)
+{
+	struct cpu *c;
+
+	KASSERT((mask & thread_cpumask()) != 0);
+
+	c = thread_lockcpu(t);
+	t->t_affinity = mask;
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+uint32_t
+thread_cpumask(void)
+{
+	unsigned n = cpuarray_num(&allcpus);
+
+	return n >= 32 ? ~(uint32_t)0 : ((uint32_t)1 << n) - 1;
+}
+
+/*
+ * Scheduling groups; see above. A new group starts with the least any
+ * group now has, rather than 0, so that a process cannot get ahead of
+ * everyone by making itself a new group over and over. The new one is
+ * allocated first, as kmalloc may not be called holding a spinlock.
+ */
+struct schedgroup *
+schedgroup_get(pid_t id, bool create)
+{
+	struct schedgroup *g, *newg = NULL;
+	unsigned least = 0;
+
+	if (create) {
+		newg = kmalloc(sizeof(*newg));
+		if (newg == NULL) {
+			return NULL;
+		}
+	}
+
+	spinlock_acquire(&schedgroup_lock);
+	for (g = schedgroups; g != NULL; g = g->sg_next) {
+		if (g->sg_id == id) {
+			g->sg_refcount++;
+			spinlock_release(&schedgroup_lock);
+			if (newg != NULL) {
+				kfree(newg);
+			}
+			return g;
+		}
+		if (g == schedgroups || g->sg_usage < least) {
+			least = g->sg_usage;
+		}
+	}
+	if (newg != NULL) {
+		newg->sg_id = id;
+		newg->sg_refcount = 1;
+		newg->sg_usage = least;
+		newg->sg_next = schedgroups;
+		schedgroups = newg;
+	}
+	spinlock_release(&schedgroup_lock);
+	return newg;
+}
+
+void
+schedgroup_ref(struct schedgroup *g)
+{
+	spinlock_acquire(&schedgroup_lock);
+	KASSERT(g->sg_refcount > 0);
+	g->sg_refcount++;
+	spinlock_release(&schedgroup_lock);
+}
+
+void
+schedgroup_put(struct schedgroup *g)
+{
+	struct schedgroup **gp;
+
+	spinlock_acquire(&schedgroup_lock);
+	KASSERT(g->sg_refcount > 0);
+	if (--g->sg_refcount > 0) {
+		spinlock_release(&schedgroup_lock);
+		return;
+	}
+	for (gp = &schedgroups; *gp != g; gp = &(*gp)->sg_next) {
+		KASSERT(*gp != NULL);
+	}
+	*gp = g->sg_next;
+	spinlock_release(&schedgroup_lock);
+	kfree(g);
+}
+
+/*
+ * T's group is only read under its cpu's runqueue lock, so once this
+ * returns, nothing is left looking at the old one through T.
+ */
+void
+thread_setgroup(struct thread *t, struct schedgroup *g)
+{
+	struct cpu *c;
+
+	c = thread_lockcpu(t);
+	t->t_group = g;
+	spinlock_release(&c->c_runqueue_lock);
 }
 
 /*
@@ -858,7 +2016,7 @@ thread_consider_migration(void)
 	unsigned my_count, total_count, one_share, to_send;
 	unsigned i, numcpus;
 	struct cpu *c;
-	struct threadlist victims;
+	struct threadlist victims, kept;
 	struct thread *t;
 
 	my_count = total_count = 0;
@@ -878,14 +2036,29 @@ thread_consider_migration(void)
 		return;
 	}
 
+	/*
+	 * Take them from the tail, passing over bound threads, which go
+	 * back where they were.
+	 */
 	to_send = my_count - one_share;
 	threadlist_init(&victims);
+	threadlist_init(&kept);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	while (victims.tl_count < to_send &&
+	       (t = threadlist_remtail(&curcpu->c_runqueue)) != NULL) {
+		if (t->t_bound) {
+			threadlist_addhead(&kept, t);
+		}
+		else {
+			threadlist_addhead(&victims, t);
+		}
+	}
+	while ((t = threadlist_remhead(&kept)) != NULL) {
+		threadlist_addtail(&curcpu->c_runqueue, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
+	threadlist_cleanup(&kept);
+	to_send = victims.tl_count;
 
 	for (i=0; i < numcpus && to_send > 0; i++) {
 		c = cpuarray_get(&allcpus, i);
@@ -894,7 +2067,16 @@ thread_consider_migration(void)
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
 		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
+			/* The first one that may run there. */
+			THREADLIST_FORALL(t, victims) {
+				if (THREAD_CANRUN(t, c)) {
+					break;
+				}
+			}
+			if (t == NULL) {
+				break;
+			}
+			threadlist_remove(&victims, t);
 			/*
 			 * Ordinarily, curthread will not appear on
 			 * the run queue. However, it can under the
@@ -924,7 +2106,7 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -948,7 +2130,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -959,6 +2141,104 @@ thread_consider_migration(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Scheduling statistics.
+ *
+ * Each cpu's counts are only written by that cpu, and each thread's
+ * under its cpu's runqueue lock, which is what they are read under.
+ */
+
+#define SCHEDSTAT_TIME(cycles) \
+	((unsigned)((cycles) >> SCHEDSTAT_CYCLESHIFT))
+
+int
+thread_getschedstat(unsigned cpunum, struct schedstat *ss)
+{
+	struct thread *cur = curthread;
+	struct cpu *c;
+	unsigned i;
+
+	ss->ss_ncpus = cpuarray_num(&allcpus);
+	if (cpunum >= ss->ss_ncpus) {
+		return EINVAL;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	/* Including the hardclocks since it last came on the cpu. */
+	ss->ss_runticks = cur->t_runticks +
+		(curcpu->c_hardclocks - cur->t_runstart);
+	ss->ss_vswitches = cur->t_vswitches;
+	ss->ss_ivswitches = cur->t_ivswitches;
+	ss->ss_wakeups = cur->t_wakeups;
+	ss->ss_wakelat = SCHEDSTAT_TIME(cur->t_wakelat);
+	ss->ss_maxwakelat = SCHEDSTAT_TIME(cur->t_maxwakelat);
+	ss->ss_migrations = cur->t_migrations;
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	c = cpuarray_get(&allcpus, cpunum);
+	ss->ss_hardclocks = c->c_hardclocks;
+	ss->ss_idle = SCHEDSTAT_TIME(c->c_idlecycles);
+	for (i=0; i<SCHEDSTAT_RQHIST; i++) {
+		ss->ss_rqhist[i] = c->c_rqhist[i];
+	}
+	return 0;
+}
+
+static
+void
+thread_printschedstat(struct thread *t)
+{
+	kprintf("    %-16s %7u %7u %7u %7u %9u %9u %5u\n", t->t_name,
+		t->t_runticks, t->t_vswitches, t->t_ivswitches,
+		t->t_wakeups, SCHEDSTAT_TIME(t->t_wakelat),
+		SCHEDSTAT_TIME(t->t_maxwakelat), t->t_migrations);
+}
+
+/*
+ * Print every cpu's counts, and those of the threads on each cpu at
+ * the moment; the counts of threads that are asleep are not reachable
+ * from here.
+ */
+void
+thread_printschedstats(void)
+{
+	struct cpu *c;
+	struct thread *t;
+	unsigned i, j, numcpus;
+
+	kprintf("Scheduling statistics (times in units of %u cycles):\n",
+		1U << SCHEDSTAT_CYCLESHIFT);
+	kprintf("    %-4s %10s %10s  %s\n", "cpu", "hardclocks", "idle",
+		"hardclocks finding 0, 1, ... waiting");
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("    %-4u %10u %10u ", c->c_number, c->c_hardclocks,
+			SCHEDSTAT_TIME(c->c_idlecycles));
+		for (j=0; j<SCHEDSTAT_RQHIST; j++) {
+			kprintf(" %u", c->c_rqhist[j]);
+		}
+		kprintf("\n");
+	}
+
+	kprintf("    %-16s %7s %7s %7s %7s %9s %9s %5s\n", "thread",
+		"run", "vswtch", "ivswtch", "wakeups", "wakelat",
+		"maxlat", "migr");
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (!c->c_isidle) {
+			thread_printschedstat(c->c_curthread);
+		}
+		THREADLIST_FORALL(t, c->c_runqueue) {
+			thread_printschedstat(t);
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Wait channel functions
  */
@@ -976,7 +2256,7 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
-	wc = kmalloc(sizeof(*wc));
+	wc = kmem_cache_alloc(&wchan_cache);
 	if (wc == NULL) {
 		return NULL;
 	}
@@ -995,7 +2275,7 @@ wchan_destroy(struct wchan *wc)
 {
 	spinlock_cleanup(&wc->wc_lock);
 	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
+	kmem_cache_free(&wchan_cache, wc);
 }
 
 /*
@@ -1022,16 +2302,31 @@ wchan_unlock(struct wchan *wc)
 void
 wchan_sleep(struct wchan *wc)
 {
+#if OPT_A3
+	/* t_upcall is only changed by the thread, so it is the same after */
+	struct upcall *u = curthread->t_upcall;
+#endif
+
 	/* may not sleep in an interrupt handler */
 	KASSERT(!curthread->t_in_interrupt);
 
+#if OPT_A3
+	if (u != NULL) {
+		upcall_sleeping(u, true);
+	}
+#endif
 	thread_switch(S_SLEEP, wc);
+#if OPT_A3
+	if (u != NULL) {
+		upcall_sleeping(u, false);
+	}
+#endif
 }
 
 /*
  * Wake up one thread sleeping on a wait channel.
  */
-void
+struct thread *
 wchan_wakeone(struct wchan *wc)
 {
 	struct thread *target;
@@ -1047,10 +2342,36 @@ wchan_wakeone(struct wchan *wc)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return NULL;
 	}
 
 	thread_make_runnable(target, false);
+	return target;
+}
+
+/*
+ * Wake up one particular thread, if it is sleeping on a wait channel.
+ */
+void
+wchan_wakethread(struct wchan *wc, struct thread *t)
+{
+	struct thread *t2;
+	bool found;
+
+	found = false;
+	spinlock_acquire(&wc->wc_lock);
+	THREADLIST_FORALL(t2, wc->wc_threads) {
+		if (t2 == t) {
+			threadlist_remove(&wc->wc_threads, t);
+			found = true;
+			break;
+		}
+	}
+	spinlock_release(&wc->wc_lock);
+
+	if (found) {
+		thread_make_runnable(t, false);
+	}
 }
 
 /*
@@ -1079,13 +2400,10 @@ wchan_wakeall(struct wchan *wc)
 	spinlock_release(&wc->wc_lock);
 
 	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
+	 * Wake them a cpu at a time, for one lock op or inbox push and
+	 * at most one IPI per cpu rather than per thread.
 	 */
-	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
-	}
+	thread_make_runnable_list(&list);
 
 	threadlist_cleanup(&list);
 }
@@ -1112,6 +2430,28 @@ wchan_isempty(struct wchan *wc)
  * Machine-independent IPI handling
  */
 
+/*
+ * Mark IPI CODE pending on TARGET, whose IPI lock is held, and
+ * interrupt it unless something was already pending. In that case an
+ * interrupt has been sent and not yet handled: the handler clears the
+ * pending bits under the same lock only once it has acted on them, so
+ * it is bound to see the new one too.
+ */
+static
+void
+ipi_post(struct cpu *target, int code)
+{
+	bool first;
+
+	KASSERT(spinlock_do_i_hold(&target->c_ipi_lock));
+
+	first = target->c_ipi_pending == 0;
+	target->c_ipi_pending |= (uint32_t)1 << code;
+	if (first) {
+		mainbus_send_ipi(target);
+	}
+}
+
 /*
  * Send an IPI (inter-processor interrupt) to the specified CPU.
  */
@@ -1121,8 +2461,7 @@ ipi_send(struct cpu *target, int code)
 	KASSERT(code >= 0 && code < 32);
 
 	spinlock_acquire(&target->c_ipi_lock);
-	target->c_ipi_pending |= (uint32_t)1 << code;
-	mainbus_send_ipi(target);
+	ipi_post(target, code);
 	spinlock_release(&target->c_ipi_lock);
 }
 
@@ -1143,21 +2482,36 @@ ipi_broadcast(int code)
 void
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
-	int n;
+	ipi_tlbshootdown_multi(target, mapping, 1);
+}
+
+/*
+ * Once the list is full, or already TLBSHOOTDOWN_ALL because an
+ * earlier batch filled it, the rest are covered by flushing everything.
+ */
+void
+ipi_tlbshootdown_multi(struct cpu *target,
+		       const struct tlbshootdown *mappings, unsigned n)
+{
+	unsigned i;
+	int m;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
-	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		target->c_numshootdown = TLBSHOOTDOWN_ALL;
-	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+	for (i=0; i<n; i++) {
+		m = target->c_numshootdown;
+		if (m == TLBSHOOTDOWN_ALL) {
+			break;
+		}
+		if (m == TLBSHOOTDOWN_MAX) {
+			target->c_numshootdown = TLBSHOOTDOWN_ALL;
+			break;
+		}
+		target->c_shootdown[m] = mappings[i];
+		target->c_numshootdown = m+1;
 	}
 
-	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
-	mainbus_send_ipi(target);
+	ipi_post(target, IPI_TLBSHOOTDOWN);
 
 	spinlock_release(&target->c_ipi_lock);
 }
@@ -1192,6 +2546,10 @@ interprocessor_interrupt(void)
 		 * interrupt; don't need to do anything else.
 		 */
 	}
+	if (bits & (1U << IPI_PREEMPT)) {
+		/* mainbus_interrupt switches on the way out. */
+		curcpu->c_preempt = true;
+	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		if (curcpu->c_numshootdown == TLBSHOOTDOWN_ALL) {
 			vm_tlbshootdown_all();
@@ -0,0 +1,143 @@
+/*
+ * Worker notifications for user-level schedulers. See upcall.h.
+ *
+ * A process's struct upcall is made under p_tlock the first time it is
+ * asked for, and stays until the process is destroyed, so p_upcall
+ * and a worker's t_upcall can be used without a lock once set. Only a
+ * thread itself sets or reads its own t_upcall.
+ *
+ * The watcher checks the count under u_lock and locks the wchan before
+ * letting go of it, so a change that comes in between has to wait in
+ * wchan_wakeall until the watcher is really asleep (as in futex.c). A
+ * process being ended has p_exiting set before upcall_wakeexit takes
+ * u_lock, so a watcher either sees it or is woken.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <upcall.h>
+
+/*
+ * The current process's struct upcall, made if it has none yet; NULL
+ * if there is no memory for it.
+ */
+static
+struct upcall *
+upcall_get(void)
+{
+	struct proc *p = curproc;
+	struct upcall *u;
+
+	lock_acquire(p->p_tlock);
+	u = p->p_upcall;
+	if (u == NULL) {
+		u = kmalloc(sizeof(*u));
+		if (u != NULL) {
+			u->u_wchan = wchan_create("upcall");
+			if (u->u_wchan == NULL) {
+				kfree(u);
+				u = NULL;
+			}
+		}
+		if (u != NULL) {
+			spinlock_init(&u->u_lock);
+			u->u_blocked = 0;
+			p->p_upcall = u;
+		}
+	}
+	lock_release(p->p_tlock);
+	return u;
+}
+
+int
+upcall_register(bool on)
+{
+	struct upcall *u;
+
+	if (!on) {
+		curthread->t_upcall = NULL;
+		return 0;
+	}
+	u = upcall_get();
+	if (u == NULL) {
+		return ENOMEM;
+	}
+	curthread->t_upcall = u;
+	return 0;
+}
+
+int
+upcall_wait(unsigned blocked, unsigned *ret)
+{
+	struct proc *p = curproc;
+	struct upcall *u;
+
+	if (curthread->t_upcall != NULL) {
+		return EINVAL;
+	}
+	u = upcall_get();
+	if (u == NULL) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&u->u_lock);
+	while (u->u_blocked == blocked && !p->p_exiting) {
+		wchan_lock(u->u_wchan);
+		spinlock_release(&u->u_lock);
+		wchan_sleep(u->u_wchan);
+		spinlock_acquire(&u->u_lock);
+	}
+	*ret = u->u_blocked;
+	spinlock_release(&u->u_lock);
+	return p->p_exiting ? EINTR : 0;
+}
+
+/*
+ * The wchan being slept on is locked when ASLEEP; nothing is when not.
+ */
+void
+upcall_sleeping(struct upcall *u, bool asleep)
+{
+	spinlock_acquire(&u->u_lock);
+	if (asleep) {
+		u->u_blocked++;
+	}
+	else {
+		KASSERT(u->u_blocked > 0);
+		u->u_blocked--;
+	}
+	spinlock_release(&u->u_lock);
+	wchan_wakeall(u->u_wchan);
+}
+
+void
+upcall_wakeexit(struct proc *p)
+{
+	struct upcall *u = p->p_upcall;
+
+	KASSERT(p->p_exiting);
+
+	if (u == NULL) {
+		return;
+	}
+	/* Taking the lock orders this after a watcher's check. */
+	spinlock_acquire(&u->u_lock);
+	spinlock_release(&u->u_lock);
+	wchan_wakeall(u->u_wchan);
+}
+
+void
+upcall_destroy(struct upcall *u)
+{
+	KASSERT(u->u_blocked == 0);
+	wchan_destroy(u->u_wchan);
+	spinlock_cleanup(&u->u_lock);
+	kfree(u);
+}
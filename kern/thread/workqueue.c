@@ -0,0 +1,166 @@
+/*
+ * Work queues. See workqueue.h for the interface.
+ *
+ * Each cpu's queue is a ring of (func, arg) pairs under a spinlock,
+ * which is what makes it safe to fill from interrupt handlers; a queue
+ * is only ever filled by its own cpu, so the lock is only contended by
+ * that cpu's interrupts against its own worker. The worker takes
+ * everything queued in one go, runs it with the lock released, and
+ * sleeps on wq_wchan when there is nothing left; enqueue wakes it only
+ * if it is asleep.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <workqueue.h>
+
+struct workitem {
+	void (*wi_func)(void *arg);
+	void *wi_arg;
+};
+
+/* Each on its own cache line, since each is used by its own cpu. */
+struct workqueue {
+	struct spinlock wq_lock;
+	struct wchan *wq_wchan;		/* the worker sleeps here */
+	bool wq_sleeping;		/* ...and is doing so */
+	unsigned wq_head;		/* oldest item */
+	unsigned wq_count;
+	struct workitem wq_items[WORKQUEUE_SIZE];
+	unsigned wq_queued;		/* stats */
+	unsigned wq_full;
+	unsigned wq_batches;
+	unsigned wq_maxdepth;
+} __ALIGNED(CACHELINE_SIZE);
+
+/* Static, and zero is an unlocked spinlock, so usable before bootstrap. */
+static struct workqueue workqueues[MAXCPUS];
+
+static
+void
+workqueue_worker(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = data1;
+	struct workitem batch[WORKQUEUE_SIZE];
+	unsigned i, n;
+
+	(void)data2;
+
+	while (1) {
+		spinlock_acquire(&wq->wq_lock);
+		while (wq->wq_count == 0) {
+			/* As in P: bridge to the wchan lock before sleeping. */
+			wq->wq_sleeping = true;
+			wchan_lock(wq->wq_wchan);
+			spinlock_release(&wq->wq_lock);
+			wchan_sleep(wq->wq_wchan);
+			spinlock_acquire(&wq->wq_lock);
+		}
+		n = wq->wq_count;
+		for (i=0; i<n; i++) {
+			batch[i] = wq->wq_items[(wq->wq_head + i) %
+						WORKQUEUE_SIZE];
+		}
+		wq->wq_head = (wq->wq_head + n) % WORKQUEUE_SIZE;
+		wq->wq_count = 0;
+		wq->wq_batches++;
+		spinlock_release(&wq->wq_lock);
+
+		for (i=0; i<n; i++) {
+			batch[i].wi_func(batch[i].wi_arg);
+		}
+	}
+}
+
+void
+workqueue_bootstrap(void)
+{
+	struct workqueue *wq;
+	unsigned i, n;
+	int result;
+
+	n = cpu_count();
+	KASSERT(n <= MAXCPUS);
+	for (i=0; i<n; i++) {
+		wq = &workqueues[i];
+		wq->wq_wchan = wchan_create("workqueue");
+		if (wq->wq_wchan == NULL) {
+			panic("workqueue_bootstrap: wchan_create failed\n");
+		}
+		result = thread_fork_bound("workqueue", NULL, cpu_get(i),
+					   workqueue_worker, wq, 0);
+		if (result) {
+			panic("workqueue_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+}
+
+int
+workqueue_enqueue(void (*func)(void *arg), void *arg)
+{
+	struct workqueue *wq;
+	struct workitem *wi;
+	bool wake;
+	int spl;
+
+	KASSERT(func != NULL);
+
+	/* Don't get moved to another cpu between choosing and locking. */
+	spl = splhigh();
+	wq = &workqueues[CURCPU_EXISTS() ? curcpu->c_number : 0];
+
+	spinlock_acquire(&wq->wq_lock);
+	if (wq->wq_count == WORKQUEUE_SIZE) {
+		wq->wq_full++;
+		spinlock_release(&wq->wq_lock);
+		splx(spl);
+		return ENOSPC;
+	}
+	wi = &wq->wq_items[(wq->wq_head + wq->wq_count) % WORKQUEUE_SIZE];
+	wi->wi_func = func;
+	wi->wi_arg = arg;
+	wq->wq_count++;
+	wq->wq_queued++;
+	if (wq->wq_count > wq->wq_maxdepth) {
+		wq->wq_maxdepth = wq->wq_count;
+	}
+	wake = wq->wq_sleeping && wq->wq_wchan != NULL;
+	if (wake) {
+		wq->wq_sleeping = false;
+		/* Within wq_lock, so the worker is on the wchan by now. */
+		wchan_wakeone(wq->wq_wchan);
+	}
+	spinlock_release(&wq->wq_lock);
+	splx(spl);
+
+	return 0;
+}
+
+void
+workqueue_printstats(void)
+{
+	struct workqueue *wq;
+	unsigned i, n;
+
+	kprintf("Work queues:\n");
+	kprintf("    %-4s %8s %8s %8s %8s %8s\n", "cpu", "queued", "batches",
+		"maxdepth", "full", "pending");
+	n = cpu_count();
+	for (i=0; i<n; i++) {
+		wq = &workqueues[i];
+		spinlock_acquire(&wq->wq_lock);
+		kprintf("    %-4u %8u %8u %8u %8u %8u\n", i, wq->wq_queued,
+			wq->wq_batches, wq->wq_maxdepth, wq->wq_full,
+			wq->wq_count);
+		spinlock_release(&wq->wq_lock);
+	}
+}
@@ -0,0 +1,257 @@
+/*
+ * Block I/O requests. See bio.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <device.h>
+#include <bio.h>
+
+/*
+ * Threads in bio_await sleep on one channel, and each completion of a
+ * waited-for bio wakes them all to look at their own. There are only
+ * ever a few such threads at once: most I/O is started by the buffer
+ * cache's own threads, and each waits for one bio.
+ */
+static struct spinlock bio_waitlock = SPINLOCK_INITIALIZER;
+static struct wchan *bio_wchan;
+
+void
+bio_bootstrap(void)
+{
+	bio_wchan = wchan_create("bio");
+	if (bio_wchan == NULL) {
+		panic("bio_bootstrap: Out of memory\n");
+	}
+}
+
+void
+bio_init(struct bio *bio, enum uio_rw rw, uint32_t block, uint32_t nblocks,
+	 void *data)
+{
+	bio->bio_rw = rw;
+	bio->bio_block = block;
+	bio->bio_nblocks = nblocks;
+	bio->bio_data = data;
+	bio->bio_error = 0;
+	bio->bio_done = NULL;
+	bio->bio_arg = NULL;
+	bio->bio_next = NULL;
+	bio->bio_over = false;
+}
+
+int
+bio_submit(struct device *d, struct bio *bio)
+{
+	if (d->d_strategy == NULL) {
+		return ENOTSUP;
+	}
+	if (bio->bio_nblocks == 0 || bio->bio_block >= d->d_blocks ||
+	    bio->bio_nblocks > d->d_blocks - bio->bio_block) {
+		return EINVAL;
+	}
+	bio->bio_error = 0;
+	bio->bio_over = false;
+	bio->bio_next = NULL;
+	return d->d_strategy(d, bio);
+}
+
+void
+bio_finish(struct bio *bio, int err)
+{
+	bio->bio_error = err;
+	if (bio->bio_done != NULL) {
+		bio->bio_done(bio);
+	}
+}
+
+/*
+ * bio_done for bio_start.
+ */
+static
+void
+bio_waitdone(struct bio *bio)
+{
+	spinlock_acquire(&bio_waitlock);
+	bio->bio_over = true;
+	wchan_wakeall(bio_wchan);
+	spinlock_release(&bio_waitlock);
+}
+
+int
+bio_start(struct device *d, struct bio *bio)
+{
+	bio->bio_done = bio_waitdone;
+	return bio_submit(d, bio);
+}
+
+int
+bio_await(struct bio *bio)
+{
+	KASSERT(bio->bio_done == bio_waitdone);
+
+	spinlock_acquire(&bio_waitlock);
+	while (!bio->bio_over) {
+		wchan_lock(bio_wchan);
+		spinlock_release(&bio_waitlock);
+		wchan_sleep(bio_wchan);
+		spinlock_acquire(&bio_waitlock);
+	}
+	spinlock_release(&bio_waitlock);
+
+	return bio->bio_error;
+}
+
+int
+bio_wait(struct device *d, struct bio *bio)
+{
+	int result;
+
+	result = bio_start(d, bio);
+	if (result) {
+		return result;
+	}
+	return bio_await(bio);
+}
+
+/*
+ * The scheduling policy and the deadlines, in requests passed over.
+ */
+int bioq_policy = BIOQ_DEADLINE;
+unsigned bioq_readmax = 16;
+unsigned bioq_writemax = 64;
+
+void
+bioq_init(struct bioq *bq)
+{
+	bq->bq_first = bq->bq_last = NULL;
+	bq->bq_pos = 0;
+	bq->bq_taken = 0;
+}
+
+void
+bioq_add(struct bioq *bq, struct bio *bio)
+{
+	bio->bio_next = NULL;
+	bio->bio_seq = bq->bq_taken;
+	if (bq->bq_last == NULL) {
+		bq->bq_first = bio;
+	}
+	else {
+		bq->bq_last->bio_next = bio;
+	}
+	bq->bq_last = bio;
+}
+
+/*
+ * Whether BIO has been passed over too often under BIOQ_DEADLINE.
+ */
+static
+bool
+bioq_expired(struct bioq *bq, struct bio *bio)
+{
+	unsigned max;
+
+	max = bio->bio_rw == UIO_READ ? bioq_readmax : bioq_writemax;
+	return bq->bq_taken - bio->bio_seq > max;
+}
+
+/*
+ * Choose by C-LOOK. A queue is as long as the number of requests in
+ * flight at once, a few dozen at most, so a scan of it is cheap and
+ * keeps adding and taking simple. Ties go to the older request.
+ */
+static
+struct bio *
+bioq_clook(struct bioq *bq)
+{
+	struct bio *bio, *ahead = NULL, *lowest = NULL;
+
+	for (bio = bq->bq_first; bio != NULL; bio = bio->bio_next) {
+		if (bio->bio_block >= bq->bq_pos &&
+		    (ahead == NULL || bio->bio_block < ahead->bio_block)) {
+			ahead = bio;
+		}
+		if (lowest == NULL || bio->bio_block < lowest->bio_block) {
+			lowest = bio;
+		}
+	}
+	return ahead != NULL ? ahead : lowest;
+}
+
+struct bio *
+bioq_next(struct bioq *bq)
+{
+	struct bio *bio, *prev, *take;
+
+	if (bq->bq_first == NULL) {
+		return NULL;
+	}
+
+	take = bq->bq_first;
+	switch (bioq_policy) {
+	    case BIOQ_FIFO:
+		break;
+	    case BIOQ_DEADLINE:
+		/* the oldest is first in line; if it is due, take it */
+		if (bioq_expired(bq, take)) {
+			break;
+		}
+		take = bioq_clook(bq);
+		break;
+	    default:
+		take = bioq_clook(bq);
+		break;
+	}
+
+	/* unlink it */
+	prev = NULL;
+	for (bio = bq->bq_first; bio != take; bio = bio->bio_next) {
+		prev = bio;
+	}
+	if (prev == NULL) {
+		bq->bq_first = take->bio_next;
+	}
+	else {
+		prev->bio_next = take->bio_next;
+	}
+	if (bq->bq_last == take) {
+		bq->bq_last = prev;
+	}
+	take->bio_next = NULL;
+
+	bq->bq_pos = take->bio_block + take->bio_nblocks;
+	bq->bq_taken++;
+	return take;
+}
+
+int
+bioq_setpolicy(int policy, unsigned readmax, unsigned writemax)
+{
+	if (policy != BIOQ_FIFO && policy != BIOQ_CLOOK &&
+	    policy != BIOQ_DEADLINE) {
+		return EINVAL;
+	}
+	/* (read once per choice, so no lock is needed to change them) */
+	bioq_policy = policy;
+	if (readmax != 0) {
+		bioq_readmax = readmax;
+	}
+	if (writemax != 0) {
+		bioq_writemax = writemax;
+	}
+	return 0;
+}
+
+void
+bioq_print(void)
+{
+	static const char *const names[] = { "fifo", "clook", "deadline" };
+
+	kprintf("I/O scheduler: %s; reads wait for at most %u others, "
+		"writes %u\n", names[bioq_policy], bioq_readmax,
+		bioq_writemax);
+}
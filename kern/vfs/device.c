@@ -134,6 +134,21 @@ dev_ioctl(struct vnode *v, int op, userptr_t data)
 	return d->d_ioctl(d, op, data);
 }
 
+/*
+ * Called for poll(). Devices that never block have no d_poll.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct poller *poller)
+{
+	struct device *d = v->vn_data;
+
+	if (d->d_poll == NULL) {
+		return vnode_pollready(v, events, poller);
+	}
+	return d->d_poll(d, events, poller);
+}
+
 /*
  * Called for stat().
  * Set the type and the size (block devices only).
@@ -234,22 +249,28 @@ dev_tryseek(struct vnode *v, off_t pos)
  */
 static
 int
-null_fsync(struct vnode *v)
+null_fsync(struct vnode *v, bool datasync)
 {
 	(void)v;
+	(void)datasync;
 	return 0;
 }
 
 /*
- * For mmap. If you want this to do anything, you have to write it
- * yourself. Some devices may not make sense to map. Others do.
+ * For mmap. Block devices can be paged like files, a block at a time;
+ * character devices can't.
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v, bool writeable)
 {
-	(void)v;
-	return EUNIMP;
+	struct device *d = v->vn_data;
+
+	(void)writeable;
+	if (d->d_blocks == 0) {
+		return ENODEV;
+	}
+	return 0;
 }
 
 /*
@@ -423,6 +444,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	null_io,      /* getdirentry */
 	dev_write,
 	dev_ioctl,
+	dev_poll,
 	dev_stat,
 	dev_gettype,
 	dev_tryseek,
@@ -0,0 +1,154 @@
+/*
+ * Per-device I/O statistics. See iostat.h.
+ *
+ * The registered devices are iostat_table, under iostat_tablelock,
+ * which only registering and looking one up take; devices are never
+ * unregistered, so an iostat found there stays good.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <iostat.h>
+
+static struct spinlock iostat_tablelock = SPINLOCK_INITIALIZER;
+static struct iostat *iostat_table[IOSTAT_MAX];
+static unsigned iostat_num;
+
+void
+iostat_register(struct iostat *ios, const char *name)
+{
+	spinlock_init(&ios->ios_lock);
+	ios->ios_busysince = 0;
+	bzero(&ios->ios_info, sizeof(ios->ios_info));
+	snprintf(ios->ios_info.is_name, sizeof(ios->ios_info.is_name),
+		 "%s", name);
+
+	spinlock_acquire(&iostat_tablelock);
+	if (iostat_num >= IOSTAT_MAX) {
+		spinlock_release(&iostat_tablelock);
+		kprintf("iostat: no room for %s; raise IOSTAT_MAX\n", name);
+		return;
+	}
+	iostat_table[iostat_num++] = ios;
+	spinlock_release(&iostat_tablelock);
+}
+
+uint64_t
+iostat_start(struct iostat *ios)
+{
+	struct iostatinfo *is = &ios->ios_info;
+	uint64_t now;
+
+	now = clock_monotonic_ns();
+	spinlock_acquire(&ios->ios_lock);
+	if (is->is_inflight++ == 0) {
+		ios->ios_busysince = now;
+	}
+	if (is->is_inflight > is->is_maxinflight) {
+		is->is_maxinflight = is->is_inflight;
+	}
+	spinlock_release(&ios->ios_lock);
+	return now;
+}
+
+void
+iostat_done(struct iostat *ios, uint64_t start, int kind, size_t bytes,
+	    int err)
+{
+	struct iostatinfo *is = &ios->ios_info;
+	uint64_t now, us;
+	unsigned b;
+
+	now = clock_monotonic_ns();
+	us = (now - start) / 1000 >> IOSTAT_MINSHIFT;
+	for (b = 0; us > 1 && b < IOSTAT_NBUCKETS - 1; b++) {
+		us >>= 1;
+	}
+
+	spinlock_acquire(&ios->ios_lock);
+	KASSERT(is->is_inflight > 0);
+	if (--is->is_inflight == 0) {
+		is->is_busyns += now - ios->ios_busysince;
+	}
+	switch (kind) {
+	    case IOSTAT_READ:
+		is->is_reads++;
+		is->is_rbytes += bytes;
+		break;
+	    case IOSTAT_WRITE:
+		is->is_writes++;
+		is->is_wbytes += bytes;
+		break;
+	    default:
+		is->is_others++;
+		break;
+	}
+	if (err) {
+		is->is_errors++;
+	}
+	is->is_totalns += now - start;
+	is->is_hist[b]++;
+	spinlock_release(&ios->ios_lock);
+}
+
+int
+iostat_get(unsigned index, struct iostatinfo *is)
+{
+	struct iostat *ios;
+	unsigned num;
+	uint64_t now;
+
+	spinlock_acquire(&iostat_tablelock);
+	num = iostat_num;
+	ios = index < num ? iostat_table[index] : NULL;
+	spinlock_release(&iostat_tablelock);
+
+	if (ios == NULL) {
+		return ENOENT;
+	}
+	now = clock_monotonic_ns();
+	spinlock_acquire(&ios->ios_lock);
+	*is = ios->ios_info;
+	if (is->is_inflight > 0) {
+		/* Busy until now, so far. */
+		is->is_busyns += now - ios->ios_busysince;
+	}
+	spinlock_release(&ios->ios_lock);
+	is->is_ndevs = num;
+	return 0;
+}
+
+void
+iostat_print(void)
+{
+	struct iostatinfo is;
+	unsigned i, b;
+
+	kprintf("Device I/O (time in usec, by log2 bucket):\n");
+	kprintf("    %-8s %8s %8s %8s %10s %10s %6s %4s %8s\n", "name",
+		"reads", "writes", "other", "KB read", "KB written", "errors",
+		"max", "busy ms");
+	for (i = 0; iostat_get(i, &is) == 0; i++) {
+		kprintf("    %-8s %8u %8u %8u %10llu %10llu %6u %4u %8llu\n",
+			is.is_name, is.is_reads, is.is_writes, is.is_others,
+			(unsigned long long)(is.is_rbytes / 1024),
+			(unsigned long long)(is.is_wbytes / 1024),
+			is.is_errors, is.is_maxinflight,
+			(unsigned long long)(is.is_busyns / 1000000));
+		if (is.is_reads + is.is_writes + is.is_others == 0) {
+			continue;
+		}
+		kprintf("        ");
+		for (b = 0; b < IOSTAT_NBUCKETS; b++) {
+			if (is.is_hist[b] != 0) {
+				kprintf(" %s2^%u:%u", b == 0 ? "<" : "",
+					b + IOSTAT_MINSHIFT + (b == 0),
+					is.is_hist[b]);
+			}
+		}
+		kprintf("\n");
+	}
+}
@@ -0,0 +1,626 @@
+/*
+ * Pipes.
+ *
+ * The data goes around a single ring of PIPE_SIZE bytes. p_head is
+ * how many bytes have ever been written and p_tail how many have been
+ * read, so the ring holds p_head - p_tail of them. Readers take turns
+ * under p_rlock and writers under p_wlock, so there is one producer,
+ * which alone moves p_head, and one consumer, which alone moves
+ * p_tail, and neither needs a lock against the other to move data; a
+ * memory barrier between the data and the counter that publishes it
+ * is enough.
+ *
+ * A reader only sleeps when the ring is empty, and a writer only when
+ * it is full. A side about to sleep sets its p_?sleeping flag under
+ * p_lock and looks once more; the other side checks the flag after
+ * moving its counter, and only then takes p_lock to wake it. So a
+ * large write fills the ring with as few uiomoves as it takes and
+ * wakes the reader once per fill, not a byte at a time.
+ *
+ * Pollers go on p_rpq or p_wpq, which are woken at the same points as
+ * a sleeping reader or writer, but only if someone is on them.
+ *
+ * Each end goes away on its own; closing one wakes whoever is
+ * waiting on the other, so readers see end of file once the ring is
+ * empty and writers get EPIPE. The pipe is freed with the second end.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stattypes.h>
+#include <lib.h>
+#include <stat.h>
+#include <uio.h>
+#include <atomic.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+
+struct pipe {
+	char *p_buf;			/* the ring, PIPE_SIZE bytes */
+	volatile unsigned p_head;	/* bytes written; by the writer */
+	volatile unsigned p_tail;	/* bytes read; by the reader */
+	struct lock *p_rlock;		/* one reader at a time */
+	struct lock *p_wlock;		/* one writer at a time */
+
+	struct spinlock p_lock;		/* for the rest */
+	struct wchan *p_rwchan;		/* reader waiting for data */
+	struct wchan *p_wwchan;		/* writer waiting for room */
+	volatile bool p_rsleeping;
+	volatile bool p_wsleeping;
+	bool p_rclosed;
+	bool p_wclosed;
+	unsigned p_ends;		/* vnodes not yet reclaimed */
+	struct pollq p_rpq;		/* pollers of the read end */
+	struct pollq p_wpq;		/* pollers of the write end */
+
+	struct vnode p_rvnode;
+	struct vnode p_wvnode;
+};
+
+/*
+ * Whether the reader (READER) or the writer can go on: there is data,
+ * or room, or the other end is closed.
+ */
+static
+bool
+pipe_ready(struct pipe *p, bool reader)
+{
+	if (reader) {
+		return p->p_head != p->p_tail || p->p_wclosed;
+	}
+	return p->p_head - p->p_tail < PIPE_SIZE || p->p_rclosed;
+}
+
+/*
+ * Sleep until the reader (READER) or the writer might be able to go
+ * on. The caller checks again.
+ */
+static
+void
+pipe_sleep(struct pipe *p, bool reader)
+{
+	volatile bool *sleeping = reader ? &p->p_rsleeping : &p->p_wsleeping;
+	struct wchan *wc = reader ? p->p_rwchan : p->p_wwchan;
+
+	spinlock_acquire(&p->p_lock);
+	*sleeping = true;
+	membar_sync();
+	if (pipe_ready(p, reader)) {
+		*sleeping = false;
+		spinlock_release(&p->p_lock);
+		return;
+	}
+	wchan_lock(wc);
+	spinlock_release(&p->p_lock);
+	wchan_sleep(wc);
+}
+
+/*
+ * Wake the reader (READER) or the writer, if it is asleep, and that
+ * end's pollers. Call after moving a counter.
+ */
+static
+void
+pipe_wake(struct pipe *p, bool reader)
+{
+	volatile bool *sleeping = reader ? &p->p_rsleeping : &p->p_wsleeping;
+	struct wchan *wc = reader ? p->p_rwchan : p->p_wwchan;
+
+	pollq_wake(reader ? &p->p_rpq : &p->p_wpq);
+	membar_sync();
+	if (!*sleeping) {
+		return;
+	}
+	spinlock_acquire(&p->p_lock);
+	*sleeping = false;
+	wchan_wakeall(wc);
+	spinlock_release(&p->p_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Vnode operations
+
+static
+int
+pipe_eachopen(struct vnode *v, int openflags)
+{
+	(void)v;
+	(void)openflags;
+	return 0;
+}
+
+static
+int
+pipe_close(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	bool reader = (v == &p->p_rvnode);
+
+	spinlock_acquire(&p->p_lock);
+	if (reader) {
+		p->p_rclosed = true;
+		p->p_wsleeping = false;
+		wchan_wakeall(p->p_wwchan);
+	}
+	else {
+		p->p_wclosed = true;
+		p->p_rsleeping = false;
+		wchan_wakeall(p->p_rwchan);
+	}
+	spinlock_release(&p->p_lock);
+	pollq_wake(reader ? &p->p_wpq : &p->p_rpq);
+	return 0;
+}
+
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	bool last;
+
+	/* There is no way to look a pipe up, but keep the protocol */
+	if (!vnode_lastref(v)) {
+		return EBUSY;
+	}
+	VOP_CLEANUP(v);
+
+	spinlock_acquire(&p->p_lock);
+	last = --p->p_ends == 0;
+	spinlock_release(&p->p_lock);
+	if (!last) {
+		return 0;
+	}
+
+	wchan_destroy(p->p_rwchan);
+	wchan_destroy(p->p_wwchan);
+	pollq_cleanup(&p->p_rpq);
+	pollq_cleanup(&p->p_wpq);
+	spinlock_cleanup(&p->p_lock);
+	lock_destroy(p->p_rlock);
+	lock_destroy(p->p_wlock);
+	kfree(p->p_buf);
+	kfree(p);
+	return 0;
+}
+
+/*
+ * The N bytes of the ring from count POS on, as one piece or, where
+ * they wrap around, two, in IOV; returns how many.
+ */
+static
+unsigned
+pipe_pieces(struct pipe *p, unsigned pos, unsigned n, struct iovec *iov)
+{
+	unsigned off = pos % PIPE_SIZE;
+
+	iov[0].iov_kbase = p->p_buf + off;
+	if (n <= PIPE_SIZE - off) {
+		iov[0].iov_len = n;
+		return 1;
+	}
+	iov[0].iov_len = PIPE_SIZE - off;
+	iov[1].iov_kbase = p->p_buf;
+	iov[1].iov_len = n - iov[0].iov_len;
+	return 2;
+}
+
+/*
+ * Read what is in the ring, up to what was asked for, waiting only if
+ * there is nothing.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	struct iovec iov[2];
+	unsigned head, tail, n, npieces;
+	size_t resid;
+	int result;
+
+	if (v != &p->p_rvnode) {
+		return EBADF;
+	}
+
+	lock_acquire(p->p_rlock);
+	while (p->p_head == p->p_tail) {
+		if (p->p_wclosed) {
+			lock_release(p->p_rlock);
+			return 0;
+		}
+		pipe_sleep(p, true);
+	}
+
+	/* see the data written before p_head moved */
+	membar_sync();
+	head = p->p_head;
+	tail = p->p_tail;
+	n = head - tail;
+	if (n > uio->uio_resid) {
+		n = uio->uio_resid;
+	}
+	npieces = pipe_pieces(p, tail, n, iov);
+	resid = uio->uio_resid;
+	result = uiomove_iov(iov, npieces, uio);
+	tail += resid - uio->uio_resid;
+
+	/* and be done with it before giving the room back */
+	membar_sync();
+	p->p_tail = tail;
+	pipe_wake(p, false);
+	lock_release(p->p_rlock);
+	return result;
+}
+
+/*
+ * Write all of it, filling the ring as far as it goes each time round
+ * and waiting for room when it is full. If the read end goes away
+ * partway, what was written counts; if nothing was, it is EPIPE.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	struct iovec iov[2];
+	unsigned head, room, n, npieces;
+	size_t len, resid;
+	int result;
+
+	if (v != &p->p_wvnode) {
+		return EBADF;
+	}
+
+	len = uio->uio_resid;
+	result = 0;
+	lock_acquire(p->p_wlock);
+	while (uio->uio_resid > 0) {
+		if (p->p_rclosed) {
+			result = EPIPE;
+			break;
+		}
+		head = p->p_head;
+		room = PIPE_SIZE - (head - p->p_tail);
+		if (room == 0) {
+			pipe_sleep(p, false);
+			continue;
+		}
+
+		/* the reader is done with the room before we reuse it */
+		membar_sync();
+		n = room;
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		npieces = pipe_pieces(p, head, n, iov);
+		resid = uio->uio_resid;
+		result = uiomove_iov(iov, npieces, uio);
+		head += resid - uio->uio_resid;
+
+		/* the data is there before p_head says so */
+		membar_sync();
+		p->p_head = head;
+		pipe_wake(p, true);
+		if (result) {
+			break;
+		}
+	}
+	lock_release(p->p_wlock);
+
+	if (result == EPIPE && uio->uio_resid < len) {
+		result = 0;
+	}
+	return result;
+}
+
+/*
+ * The read end is ready with data in the ring, and hung up once the
+ * write end is gone; the write end is ready with room, and in error
+ * once the read end is gone.
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, struct poller *poller)
+{
+	struct pipe *p = v->vn_data;
+	bool reader = (v == &p->p_rvnode);
+	int ready = 0;
+
+	if (poller != NULL) {
+		poller_register(poller, reader ? &p->p_rpq : &p->p_wpq);
+	}
+
+	if (reader) {
+		if (p->p_head != p->p_tail) {
+			ready |= POLLIN;
+		}
+		if (p->p_wclosed) {
+			ready |= POLLHUP;
+		}
+		return ready & (events | POLLHUP);
+	}
+	if (p->p_head - p->p_tail < PIPE_SIZE) {
+		ready |= POLLOUT;
+	}
+	if (p->p_rclosed) {
+		ready |= POLLERR;
+	}
+	return ready & (events | POLLERR);
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static
+int
+pipe_stat(struct vnode *v, struct stat *st)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(st, sizeof(*st));
+	st->st_mode = _S_IFIFO;
+	st->st_nlink = 1;
+	st->st_size = p->p_head - p->p_tail;
+	st->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = _S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+static
+int
+pipe_fsync(struct vnode *v, bool datasync)
+{
+	(void)v;
+	(void)datasync;
+	return EINVAL;
+}
+
+static
+int
+pipe_mmap(struct vnode *v, bool writeable)
+{
+	(void)v;
+	(void)writeable;
+	return ENODEV;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * Operations that make no sense on a pipe.
+ */
+
+static
+int
+pipe_notdir_uio(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_notdir_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+		  struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_notdir_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_notdir_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_notdir_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_notdir_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_notdir_rename(struct vnode *v1, const char *n1,
+		   struct vnode *v2, const char *n2)
+{
+	(void)v1;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_notdir_lookup(struct vnode *v, char *path, struct vnode **result)
+{
+	(void)v;
+	(void)path;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_notdir_lookparent(struct vnode *v, char *path, struct vnode **result,
+		       char *buf, size_t len)
+{
+	(void)v;
+	(void)path;
+	(void)result;
+	(void)buf;
+	(void)len;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_inval_uio(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	pipe_eachopen,
+	pipe_close,
+	pipe_reclaim,
+	pipe_read,
+	pipe_inval_uio,		/* readlink */
+	pipe_notdir_uio,	/* getdirentry */
+	pipe_write,
+	pipe_ioctl,
+	pipe_poll,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_fsync,
+	pipe_mmap,
+	pipe_truncate,
+	pipe_notdir_uio,	/* namefile */
+	pipe_notdir_creat,
+	pipe_notdir_symlink,
+	pipe_notdir_mkdir,
+	pipe_notdir_link,
+	pipe_notdir_nameop,	/* remove */
+	pipe_notdir_nameop,	/* rmdir */
+	pipe_notdir_rename,
+	pipe_notdir_lookup,
+	pipe_notdir_lookparent,
+};
+
+////////////////////////////////////////////////////////////
+//
+// Creation
+
+int
+pipe_create(struct vnode **rvn, struct vnode **wvn)
+{
+	struct pipe *p;
+
+	p = kmalloc(sizeof(*p));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = kmalloc(PIPE_SIZE);
+	if (p->p_buf == NULL) {
+		goto fail;
+	}
+	p->p_rlock = lock_create("pipe read");
+	if (p->p_rlock == NULL) {
+		goto fail_buf;
+	}
+	p->p_wlock = lock_create("pipe write");
+	if (p->p_wlock == NULL) {
+		goto fail_rlock;
+	}
+	p->p_rwchan = wchan_create("pipe read");
+	if (p->p_rwchan == NULL) {
+		goto fail_wlock;
+	}
+	p->p_wwchan = wchan_create("pipe write");
+	if (p->p_wwchan == NULL) {
+		goto fail_rwchan;
+	}
+
+	p->p_head = p->p_tail = 0;
+	spinlock_init(&p->p_lock);
+	p->p_rsleeping = p->p_wsleeping = false;
+	p->p_rclosed = p->p_wclosed = false;
+	p->p_ends = 2;
+	pollq_init(&p->p_rpq);
+	pollq_init(&p->p_wpq);
+
+	VOP_INIT(&p->p_rvnode, &pipe_vnode_ops, NULL, p);
+	VOP_INIT(&p->p_wvnode, &pipe_vnode_ops, NULL, p);
+	VOP_INCOPEN(&p->p_rvnode);
+	VOP_INCOPEN(&p->p_wvnode);
+	*rvn = &p->p_rvnode;
+	*wvn = &p->p_wvnode;
+	return 0;
+
+fail_rwchan:
+	wchan_destroy(p->p_rwchan);
+fail_wlock:
+	lock_destroy(p->p_wlock);
+fail_rlock:
+	lock_destroy(p->p_rlock);
+fail_buf:
+	kfree(p->p_buf);
+fail:
+	kfree(p);
+	return ENOMEM;
+}
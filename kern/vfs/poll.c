@@ -0,0 +1,151 @@
+/*
+ * Poll wait queues. See poll.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <atomic.h>
+#include <arena.h>
+#include <clock.h>
+#include <current.h>
+#include <thread.h>
+#include <wchan.h>
+#include <poll.h>
+
+/*
+ * One registration of a poller on a pollq. It is on two lists: the
+ * pollq's, under pq_lock, and the poller's, which only its own thread
+ * touches.
+ */
+struct pollent {
+	struct poller *pe_poller;
+	struct pollq *pe_pq;
+	struct pollent *pe_qnext;
+	struct pollent *pe_plnext;
+};
+
+void
+pollq_init(struct pollq *pq)
+{
+	spinlock_init(&pq->pq_lock);
+	pq->pq_ents = NULL;
+}
+
+void
+pollq_cleanup(struct pollq *pq)
+{
+	KASSERT(pq->pq_ents == NULL);
+	spinlock_cleanup(&pq->pq_lock);
+}
+
+static
+void
+poller_wake(struct poller *pl)
+{
+	spinlock_acquire(&pl->pl_lock);
+	if (!pl->pl_woken) {
+		pl->pl_woken = true;
+		wchan_wakeall(pl->pl_wchan);
+	}
+	spinlock_release(&pl->pl_lock);
+}
+
+void
+pollq_wake(struct pollq *pq)
+{
+	struct pollent *pe;
+
+	/*
+	 * Pairs with the barrier in poller_register: either we see the
+	 * entry, or the poller sees whatever the caller just changed.
+	 */
+	membar_sync();
+	if (pq->pq_ents == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&pq->pq_lock);
+	for (pe = pq->pq_ents; pe != NULL; pe = pe->pe_qnext) {
+		poller_wake(pe->pe_poller);
+	}
+	spinlock_release(&pq->pq_lock);
+}
+
+int
+poller_init(struct poller *pl)
+{
+	pl->pl_wchan = wchan_create("poll");
+	if (pl->pl_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&pl->pl_lock);
+	pl->pl_woken = false;
+	pl->pl_ents = NULL;
+	pl->pl_nomem = false;
+	return 0;
+}
+
+void
+poller_cleanup(struct poller *pl)
+{
+	struct pollent *pe, **pp;
+	struct pollq *pq;
+
+	for (pe = pl->pl_ents; pe != NULL; pe = pe->pe_plnext) {
+		pq = pe->pe_pq;
+		spinlock_acquire(&pq->pq_lock);
+		for (pp = (struct pollent **)&pq->pq_ents; *pp != pe;
+		     pp = &(*pp)->pe_qnext) {
+			KASSERT(*pp != NULL);
+		}
+		*pp = pe->pe_qnext;
+		spinlock_release(&pq->pq_lock);
+	}
+	pl->pl_ents = NULL;
+	wchan_destroy(pl->pl_wchan);
+	spinlock_cleanup(&pl->pl_lock);
+}
+
+void
+poller_register(struct poller *pl, struct pollq *pq)
+{
+	struct pollent *pe;
+
+	pe = arena_alloc(&curthread->t_arena, sizeof(*pe));
+	if (pe == NULL) {
+		pl->pl_nomem = true;
+		return;
+	}
+	pe->pe_poller = pl;
+	pe->pe_pq = pq;
+	pe->pe_plnext = pl->pl_ents;
+	pl->pl_ents = pe;
+
+	spinlock_acquire(&pq->pq_lock);
+	pe->pe_qnext = pq->pq_ents;
+	pq->pq_ents = pe;
+	spinlock_release(&pq->pq_lock);
+
+	/* before the caller looks at the object; see pollq_wake */
+	membar_sync();
+}
+
+void
+poller_sleep(struct poller *pl, struct timeout *to)
+{
+	spinlock_acquire(&pl->pl_lock);
+	if (!pl->pl_woken) {
+		wchan_lock(pl->pl_wchan);
+		spinlock_release(&pl->pl_lock);
+		if (to != NULL && to->to_fired) {
+			wchan_unlock(pl->pl_wchan);
+		}
+		else {
+			wchan_sleep(pl->pl_wchan);
+		}
+		spinlock_acquire(&pl->pl_lock);
+	}
+	pl->pl_woken = false;
+	spinlock_release(&pl->pl_lock);
+}
@@ -0,0 +1,154 @@
+/*
+ * RAM disks. See ramdisk.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <vm.h>
+#include <vfs.h>
+#include <device.h>
+#include <ramdisk.h>
+
+struct ramdisk {
+	struct device rd_dev;
+	struct lock *rd_lock;		/* for rd_pages */
+	vaddr_t *rd_pages;		/* 0 for a page never written */
+	unsigned rd_npages;
+};
+
+static
+int
+ramdisk_open(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+	return 0;
+}
+
+static
+int
+ramdisk_close(struct device *d)
+{
+	(void)d;
+	return 0;
+}
+
+static
+int
+ramdisk_ioctl(struct device *d, int op, userptr_t data)
+{
+	(void)d;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+/*
+ * I/O function (d_io): a page at a time, getting a frame for each page
+ * written to for the first time. ENOSPC if there is no memory for it.
+ */
+static
+int
+ramdisk_io(struct device *d, struct uio *uio)
+{
+	struct ramdisk *rd = d->d_data;
+	uint32_t bsize = d->d_blocksize;
+	size_t pageoff, amt;
+	unsigned page;
+	vaddr_t kva;
+	int result = 0;
+
+	if (uio->uio_offset % bsize != 0 || uio->uio_resid % bsize != 0) {
+		return EINVAL;
+	}
+	if (uio->uio_offset / bsize + uio->uio_resid / bsize > d->d_blocks) {
+		return EINVAL;
+	}
+
+	lock_acquire(rd->rd_lock);
+	while (result == 0 && uio->uio_resid > 0) {
+		page = uio->uio_offset / PAGE_SIZE;
+		pageoff = uio->uio_offset % PAGE_SIZE;
+		amt = PAGE_SIZE - pageoff;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+		KASSERT(page < rd->rd_npages);
+
+		kva = rd->rd_pages[page];
+		if (kva == 0 && uio->uio_rw == UIO_READ) {
+			result = uiomovezeros(amt, uio);
+			continue;
+		}
+		if (kva == 0) {
+			kva = alloc_kpages(1);
+			if (kva == 0) {
+				result = ENOSPC;
+				break;
+			}
+			bzero((void *)kva, PAGE_SIZE);
+			rd->rd_pages[page] = kva;
+		}
+		result = uiomove((char *)kva + pageoff, amt, uio);
+	}
+	lock_release(rd->rd_lock);
+	return result;
+}
+
+int
+ramdisk_create(const char *name, uint32_t nblocks)
+{
+	struct ramdisk *rd;
+	unsigned i;
+	int result;
+
+	/* (with room to round the size up to whole pages) */
+	if (nblocks == 0 ||
+	    nblocks > ((uint32_t)-1 - PAGE_SIZE) / RAMDISK_BLOCKSIZE) {
+		return EINVAL;
+	}
+
+	rd = kmalloc(sizeof(*rd));
+	if (rd == NULL) {
+		return ENOMEM;
+	}
+	rd->rd_npages = (nblocks * RAMDISK_BLOCKSIZE + PAGE_SIZE - 1)
+		/ PAGE_SIZE;
+	rd->rd_pages = kmalloc(rd->rd_npages * sizeof(vaddr_t));
+	if (rd->rd_pages == NULL) {
+		kfree(rd);
+		return ENOMEM;
+	}
+	for (i=0; i<rd->rd_npages; i++) {
+		rd->rd_pages[i] = 0;
+	}
+	rd->rd_lock = lock_create(name);
+	if (rd->rd_lock == NULL) {
+		kfree(rd->rd_pages);
+		kfree(rd);
+		return ENOMEM;
+	}
+
+	rd->rd_dev.d_open = ramdisk_open;
+	rd->rd_dev.d_close = ramdisk_close;
+	rd->rd_dev.d_io = ramdisk_io;
+	rd->rd_dev.d_ioctl = ramdisk_ioctl;
+	rd->rd_dev.d_poll = NULL;
+	rd->rd_dev.d_strategy = NULL;
+	rd->rd_dev.d_blocks = nblocks;
+	rd->rd_dev.d_blocksize = RAMDISK_BLOCKSIZE;
+	rd->rd_dev.d_devnumber = 0; /* assigned by vfs_adddev */
+	rd->rd_dev.d_data = rd;
+
+	result = vfs_adddev(name, &rd->rd_dev, 1);
+	if (result) {
+		lock_destroy(rd->rd_lock);
+		kfree(rd->rd_pages);
+		kfree(rd);
+		return result;
+	}
+	return 0;
+}
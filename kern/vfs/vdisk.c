@@ -0,0 +1,327 @@
+/*
+ * Virtual disks striped or mirrored over real ones. See vdisk.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <bio.h>
+#include <vdisk.h>
+
+/*
+ * How many member bios one transfer has in progress at once, and how
+ * many blocks at a time are copied through a buffer for a uio that
+ * cannot be done in place.
+ */
+#define VDISK_NBIO	16
+#define VDISK_BOUNCE	16
+
+struct vdisk {
+	struct device vd_dev;
+	int vd_mode;			/* VDISK_STRIPE or VDISK_MIRROR */
+	uint32_t vd_unit;		/* blocks per chunk */
+	unsigned vd_ndisks;
+	struct device *vd_disks[VDISK_MAXDISKS];
+};
+
+/*
+ * A piece of a transfer, on member vp_disk.
+ */
+struct vdisk_piece {
+	struct bio vp_bio;
+	unsigned vp_disk;
+	bool vp_started;
+};
+
+static
+int
+vdisk_open(struct device *d, int openflags)
+{
+	(void)d;
+	(void)openflags;
+	return 0;
+}
+
+static
+int
+vdisk_close(struct device *d)
+{
+	(void)d;
+	return 0;
+}
+
+static
+int
+vdisk_ioctl(struct device *d, int op, userptr_t data)
+{
+	(void)d;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+/*
+ * Set up piece VP to move NBLOCKS from BLOCK of member DISK.
+ */
+static
+void
+vdisk_piece(struct vdisk_piece *vp, enum uio_rw rw, unsigned disk,
+	    uint32_t block, uint32_t nblocks, void *data)
+{
+	bio_init(&vp->vp_bio, rw, block, nblocks, data);
+	vp->vp_disk = disk;
+	vp->vp_started = false;
+}
+
+/*
+ * Start NP pieces, and wait for all of them; return the first error.
+ * A mirror read that fails is tried again on each other member in
+ * turn, one at a time, until one succeeds.
+ */
+static
+int
+vdisk_dopieces(struct vdisk *vd, struct vdisk_piece *vps, unsigned np)
+{
+	struct vdisk_piece *vp;
+	unsigned i, j;
+	int result, err = 0;
+
+	for (i=0; i<np; i++) {
+		vp = &vps[i];
+		result = bio_start(vd->vd_disks[vp->vp_disk], &vp->vp_bio);
+		if (result) {
+			vp->vp_bio.bio_error = result;
+		}
+		else {
+			vp->vp_started = true;
+		}
+	}
+
+	for (i=0; i<np; i++) {
+		vp = &vps[i];
+		result = vp->vp_started ? bio_await(&vp->vp_bio)
+			: vp->vp_bio.bio_error;
+		if (result && vd->vd_mode == VDISK_MIRROR &&
+		    vp->vp_bio.bio_rw == UIO_READ) {
+			for (j=1; result && j<vd->vd_ndisks; j++) {
+				vp->vp_disk = (vp->vp_disk + 1) % vd->vd_ndisks;
+				result = bio_wait(vd->vd_disks[vp->vp_disk],
+						  &vp->vp_bio);
+			}
+		}
+		if (result && err == 0) {
+			err = result;
+		}
+	}
+	return err;
+}
+
+/*
+ * Move NBLOCKS blocks from BLOCK on between the vdisk and the kernel
+ * buffer DATA, a batch of pieces at a time.
+ */
+static
+int
+vdisk_xfer(struct vdisk *vd, enum uio_rw rw, uint32_t block,
+	   uint32_t nblocks, char *data)
+{
+	struct vdisk_piece *vps;
+	uint32_t chunk, run, bsize = vd->vd_dev.d_blocksize;
+	unsigned np, per, i;
+	int result = 0;
+
+	vps = kmalloc(VDISK_NBIO * sizeof(*vps));
+	if (vps == NULL) {
+		return ENOMEM;
+	}
+
+	/* how many pieces one chunk takes */
+	per = (vd->vd_mode == VDISK_MIRROR && rw == UIO_WRITE) ?
+		vd->vd_ndisks : 1;
+
+	while (result == 0 && nblocks > 0) {
+		np = 0;
+		while (nblocks > 0 && np + per <= VDISK_NBIO) {
+			chunk = block / vd->vd_unit;
+			run = vd->vd_unit - block % vd->vd_unit;
+			if (run > nblocks) {
+				run = nblocks;
+			}
+
+			if (vd->vd_mode == VDISK_STRIPE) {
+				vdisk_piece(&vps[np++], rw,
+					    chunk % vd->vd_ndisks,
+					    (chunk / vd->vd_ndisks) *
+					    vd->vd_unit + block % vd->vd_unit,
+					    run, data);
+			}
+			else if (rw == UIO_WRITE) {
+				for (i=0; i<vd->vd_ndisks; i++) {
+					vdisk_piece(&vps[np++], rw, i,
+						    block, run, data);
+				}
+			}
+			else {
+				vdisk_piece(&vps[np++], rw,
+					    chunk % vd->vd_ndisks,
+					    block, run, data);
+			}
+
+			block += run;
+			nblocks -= run;
+			data += run * bsize;
+		}
+		result = vdisk_dopieces(vd, vps, np);
+	}
+
+	kfree(vps);
+	return result;
+}
+
+/*
+ * I/O function (d_io). A transfer to or from one kernel buffer is done
+ * in place, as in lhd_io; anything else goes through a buffer here.
+ */
+static
+int
+vdisk_io(struct device *d, struct uio *uio)
+{
+	struct vdisk *vd = d->d_data;
+	struct iovec *iov = uio->uio_iov;
+	uint32_t bsize = d->d_blocksize;
+	uint32_t block, nblocks, n;
+	char *buf;
+	int result;
+
+	if (uio->uio_offset % bsize != 0 || uio->uio_resid % bsize != 0) {
+		return EINVAL;
+	}
+	block = uio->uio_offset / bsize;
+	nblocks = uio->uio_resid / bsize;
+	if (block + nblocks > d->d_blocks) {
+		return EINVAL;
+	}
+	if (nblocks == 0) {
+		return 0;
+	}
+
+	if (uio->uio_segflg == UIO_SYSSPACE && uio->uio_iovcnt == 1 &&
+	    iov->iov_len == uio->uio_resid) {
+		result = vdisk_xfer(vd, uio->uio_rw, block, nblocks,
+				    iov->iov_kbase);
+		if (result == 0) {
+			iov->iov_kbase = (char *)iov->iov_kbase + uio->uio_resid;
+			iov->iov_len = 0;
+			uio->uio_offset += uio->uio_resid;
+			uio->uio_resid = 0;
+		}
+		return result;
+	}
+
+	buf = kmalloc(VDISK_BOUNCE * bsize);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+	result = 0;
+	while (result == 0 && nblocks > 0) {
+		n = nblocks < VDISK_BOUNCE ? nblocks : VDISK_BOUNCE;
+		if (uio->uio_rw == UIO_WRITE) {
+			result = uiomove(buf, n * bsize, uio);
+			if (result) {
+				break;
+			}
+		}
+		result = vdisk_xfer(vd, uio->uio_rw, block, n, buf);
+		if (result == 0 && uio->uio_rw == UIO_READ) {
+			result = uiomove(buf, n * bsize, uio);
+		}
+		block += n;
+		nblocks -= n;
+	}
+	kfree(buf);
+	return result;
+}
+
+int
+vdisk_create(const char *name, int mode, uint32_t unit,
+	     unsigned ndisks, char **disknames)
+{
+	struct vdisk *vd;
+	struct device *d;
+	uint32_t minblocks = 0;
+	unsigned i, claimed;
+	int result;
+
+	if (mode != VDISK_STRIPE && mode != VDISK_MIRROR) {
+		return EINVAL;
+	}
+	if (ndisks < 2 || ndisks > VDISK_MAXDISKS) {
+		return EINVAL;
+	}
+	if (unit == 0) {
+		unit = VDISK_DEFUNIT;
+	}
+
+	vd = kmalloc(sizeof(*vd));
+	if (vd == NULL) {
+		return ENOMEM;
+	}
+	vd->vd_mode = mode;
+	vd->vd_unit = unit;
+	vd->vd_ndisks = ndisks;
+
+	for (claimed=0; claimed<ndisks; claimed++) {
+		result = vfs_claimdev(disknames[claimed], &d);
+		if (result) {
+			goto fail;
+		}
+		vd->vd_disks[claimed] = d;
+		if (d->d_strategy == NULL ||
+		    d->d_blocksize != vd->vd_disks[0]->d_blocksize) {
+			claimed++;
+			result = EINVAL;
+			goto fail;
+		}
+		if (claimed == 0 || d->d_blocks < minblocks) {
+			minblocks = d->d_blocks;
+		}
+	}
+
+	if (mode == VDISK_STRIPE) {
+		minblocks -= minblocks % unit;
+		vd->vd_dev.d_blocks = minblocks * ndisks;
+	}
+	else {
+		vd->vd_dev.d_blocks = minblocks;
+	}
+	if (vd->vd_dev.d_blocks == 0) {
+		result = EINVAL;
+		goto fail;
+	}
+
+	vd->vd_dev.d_open = vdisk_open;
+	vd->vd_dev.d_close = vdisk_close;
+	vd->vd_dev.d_io = vdisk_io;
+	vd->vd_dev.d_ioctl = vdisk_ioctl;
+	vd->vd_dev.d_poll = NULL;
+	vd->vd_dev.d_strategy = NULL;
+	vd->vd_dev.d_blocksize = vd->vd_disks[0]->d_blocksize;
+	vd->vd_dev.d_devnumber = 0; /* assigned by vfs_adddev */
+	vd->vd_dev.d_data = vd;
+
+	result = vfs_adddev(name, &vd->vd_dev, 1);
+	if (result) {
+		goto fail;
+	}
+	return 0;
+
+ fail:
+	for (i=0; i<claimed; i++) {
+		vfs_releasedev(disknames[i]);
+	}
+	kfree(vd);
+	return result;
+}
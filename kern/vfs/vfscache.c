@@ -0,0 +1,339 @@
+/*
+ * Name lookup cache.
+ *
+ * vfs_lookupat remembers what VOP_LOOKUP said about a (starting
+ * directory, name) pair: the vnode it found, or that there was no such
+ * file. Looking the same name up again then finds the answer here
+ * without going to the filesystem. Each entry holds a reference to the
+ * directory and to the vnode found, so neither can be reclaimed while
+ * it is cached; there are VFS_NCACHE entries, reused least recently
+ * used first.
+ *
+ * vfspath.c calls vfs_ncpurge after each operation that changes a
+ * name in a directory. Filesystems are given whole remaining paths,
+ * so an entry whose name has more than one component (or is "..") may
+ * go through the directory changed; those are all dropped for the
+ * filesystem. A lookup that overlaps a change might bring back what was
+ * there before it, so each purge moves a generation number on, and a
+ * lookup only enters its answer if the number has not moved since it
+ * started.
+ *
+ * vfs_nclock covers everything here. It is held across VOP_DECREF,
+ * which may reclaim, so filesystems must not call in here.
+ *
+ * Each entry keeps the hash of its name, which vfs_lookupat works out
+ * once per lookup, so chains are searched comparing hashes and only
+ * matching names are compared a character at a time.
+ *
+ * When memory runs short, the older half of the entries are dropped
+ * (vfs_ncshrink), which lets their vnodes go too.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <shrink.h>
+
+#define VFS_NCACHE	128	/* entries */
+#define VFS_NCHASH	64	/* hash chains; a power of 2 */
+
+struct vfs_ncent {
+	struct vnode *nc_dir;		/* NULL if the entry is unused */
+	struct vnode *nc_vn;		/* NULL if there is no such file */
+	char *nc_name;
+	unsigned nc_hash;		/* vfs_namehash(nc_name) */
+	struct vfs_ncent *nc_hashnext;
+	struct vfs_ncent *nc_lrunext;
+	struct vfs_ncent *nc_lruprev;
+};
+
+static struct lock *vfs_nclock;
+static struct vfs_ncent vfs_ncents[VFS_NCACHE];
+static struct vfs_ncent *vfs_nchash[VFS_NCHASH];
+static struct vfs_ncent *vfs_nclru, *vfs_nclrutail;
+static unsigned vfs_ncgeneration;
+
+static void vfs_ncshrink(void *data);
+static struct shrinker vfs_ncshrinker =
+	SHRINKER_INITIALIZER("namecache", vfs_ncshrink, NULL);
+
+unsigned
+vfs_namehash(const char *name, size_t *lenret)
+{
+	const char *s;
+	unsigned h = 5381;
+
+	for (s = name; *s; s++) {
+		h = h * 33 + (unsigned char)*s;
+	}
+	*lenret = s - name;
+	return h;
+}
+
+static
+unsigned
+vfs_nchashfn(struct vnode *dir, unsigned hash)
+{
+	return ((uintptr_t)dir / sizeof(void *) * 31 + hash) &
+		(VFS_NCHASH - 1);
+}
+
+static
+void
+vfs_nclru_remove(struct vfs_ncent *nc)
+{
+	if (nc->nc_lruprev != NULL) {
+		nc->nc_lruprev->nc_lrunext = nc->nc_lrunext;
+	}
+	else {
+		vfs_nclru = nc->nc_lrunext;
+	}
+	if (nc->nc_lrunext != NULL) {
+		nc->nc_lrunext->nc_lruprev = nc->nc_lruprev;
+	}
+	else {
+		vfs_nclrutail = nc->nc_lruprev;
+	}
+	nc->nc_lrunext = nc->nc_lruprev = NULL;
+}
+
+static
+void
+vfs_nclru_append(struct vfs_ncent *nc)
+{
+	nc->nc_lrunext = NULL;
+	nc->nc_lruprev = vfs_nclrutail;
+	if (vfs_nclrutail != NULL) {
+		vfs_nclrutail->nc_lrunext = nc;
+	}
+	else {
+		vfs_nclru = nc;
+	}
+	vfs_nclrutail = nc;
+}
+
+/*
+ * Empty an entry, dropping its references. It stays on the LRU list.
+ */
+static
+void
+vfs_ncdrop(struct vfs_ncent *nc)
+{
+	struct vfs_ncent **pp;
+
+	KASSERT(nc->nc_dir != NULL);
+
+	pp = &vfs_nchash[vfs_nchashfn(nc->nc_dir, nc->nc_hash)];
+	while (*pp != nc) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->nc_hashnext;
+	}
+	*pp = nc->nc_hashnext;
+	nc->nc_hashnext = NULL;
+
+	VOP_DECREF(nc->nc_dir);
+	if (nc->nc_vn != NULL) {
+		VOP_DECREF(nc->nc_vn);
+	}
+	kfree(nc->nc_name);
+	nc->nc_dir = nc->nc_vn = NULL;
+	nc->nc_name = NULL;
+}
+
+void
+vfs_ncbootstrap(void)
+{
+	unsigned i;
+
+	vfs_nclock = lock_create("vfs_nclock");
+	if (vfs_nclock == NULL) {
+		panic("vfs: Could not create name cache lock\n");
+	}
+	for (i=0; i<VFS_NCACHE; i++) {
+		vfs_ncents[i].nc_dir = NULL;
+		vfs_ncents[i].nc_vn = NULL;
+		vfs_ncents[i].nc_name = NULL;
+		vfs_ncents[i].nc_hash = 0;
+		vfs_ncents[i].nc_hashnext = NULL;
+		vfs_nclru_append(&vfs_ncents[i]);
+	}
+	shrinker_register(&vfs_ncshrinker);
+}
+
+/*
+ * Shrinker: drop the least recently used half of the entries in use.
+ * Emptied entries stay where they are, at the front of the LRU list,
+ * to be reused first.
+ */
+static
+void
+vfs_ncshrink(void *data)
+{
+	struct vfs_ncent *nc;
+	unsigned i, used, drop;
+
+	(void)data;
+
+	lock_acquire(vfs_nclock);
+	used = 0;
+	for (i=0; i<VFS_NCACHE; i++) {
+		if (vfs_ncents[i].nc_dir != NULL) {
+			used++;
+		}
+	}
+	drop = (used + 1) / 2;
+	for (nc = vfs_nclru; nc != NULL && drop > 0; nc = nc->nc_lrunext) {
+		if (nc->nc_dir != NULL) {
+			vfs_ncdrop(nc);
+			drop--;
+		}
+	}
+	lock_release(vfs_nclock);
+}
+
+bool
+vfs_nclookup(struct vnode *dir, const char *name, unsigned hash,
+	     struct vnode **ret)
+{
+	struct vfs_ncent *nc;
+
+	lock_acquire(vfs_nclock);
+	for (nc = vfs_nchash[vfs_nchashfn(dir, hash)]; nc != NULL;
+	     nc = nc->nc_hashnext) {
+		if (nc->nc_hash == hash && nc->nc_dir == dir &&
+		    !strcmp(nc->nc_name, name)) {
+			break;
+		}
+	}
+	if (nc == NULL) {
+		lock_release(vfs_nclock);
+		return false;
+	}
+
+	vfs_nclru_remove(nc);
+	vfs_nclru_append(nc);
+	*ret = nc->nc_vn;
+	if (*ret != NULL) {
+		VOP_INCREF(*ret);
+	}
+	lock_release(vfs_nclock);
+	return true;
+}
+
+unsigned
+vfs_ncgen(void)
+{
+	unsigned gen;
+
+	lock_acquire(vfs_nclock);
+	gen = vfs_ncgeneration;
+	lock_release(vfs_nclock);
+	return gen;
+}
+
+void
+vfs_ncenter(struct vnode *dir, const char *name, unsigned hash,
+	    struct vnode *vn, unsigned gen)
+{
+	struct vfs_ncent *nc;
+	unsigned h = vfs_nchashfn(dir, hash);
+	char *copy;
+
+	copy = kstrdup(name);
+	if (copy == NULL) {
+		/* it is only a cache */
+		return;
+	}
+
+	lock_acquire(vfs_nclock);
+	if (gen != vfs_ncgeneration) {
+		lock_release(vfs_nclock);
+		kfree(copy);
+		return;
+	}
+	for (nc = vfs_nchash[h]; nc != NULL; nc = nc->nc_hashnext) {
+		if (nc->nc_hash == hash && nc->nc_dir == dir &&
+		    !strcmp(nc->nc_name, name)) {
+			/* someone else got here first */
+			lock_release(vfs_nclock);
+			kfree(copy);
+			return;
+		}
+	}
+
+	nc = vfs_nclru;
+	KASSERT(nc != NULL);
+	if (nc->nc_dir != NULL) {
+		vfs_ncdrop(nc);
+	}
+	vfs_nclru_remove(nc);
+	vfs_nclru_append(nc);
+
+	VOP_INCREF(dir);
+	nc->nc_dir = dir;
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	nc->nc_vn = vn;
+	nc->nc_name = copy;
+	nc->nc_hash = hash;
+	nc->nc_hashnext = vfs_nchash[h];
+	vfs_nchash[h] = nc;
+	lock_release(vfs_nclock);
+}
+
+/*
+ * Whether an entry's name may go through directories on the way.
+ */
+static
+bool
+vfs_ncindirect(const char *name)
+{
+	return strchr(name, '/') != NULL || !strcmp(name, "..");
+}
+
+void
+vfs_ncpurge(struct vnode *dir, const char *name)
+{
+	struct vfs_ncent *nc;
+	unsigned i, hash;
+	size_t len;
+
+	hash = vfs_namehash(name, &len);
+
+	lock_acquire(vfs_nclock);
+	vfs_ncgeneration++;
+	for (i=0; i<VFS_NCACHE; i++) {
+		nc = &vfs_ncents[i];
+		if (nc->nc_dir == NULL) {
+			continue;
+		}
+		if ((nc->nc_hash == hash && nc->nc_dir == dir &&
+		     !strcmp(nc->nc_name, name)) ||
+		    (nc->nc_dir->vn_fs == dir->vn_fs &&
+		     vfs_ncindirect(nc->nc_name))) {
+			vfs_ncdrop(nc);
+		}
+	}
+	lock_release(vfs_nclock);
+}
+
+void
+vfs_ncpurgefs(struct fs *fs)
+{
+	struct vfs_ncent *nc;
+	unsigned i;
+
+	lock_acquire(vfs_nclock);
+	vfs_ncgeneration++;
+	for (i=0; i<VFS_NCACHE; i++) {
+		nc = &vfs_ncents[i];
+		if (nc->nc_dir != NULL && nc->nc_dir->vn_fs == fs) {
+			vfs_ncdrop(nc);
+		}
+	}
+	lock_release(vfs_nclock);
+}
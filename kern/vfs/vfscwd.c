@@ -49,8 +49,12 @@ int
 vfs_getcurdir(struct vnode **ret)
 {
 	int rv = 0;
+	bool single = curproc_single();
 
-	spinlock_acquire(&curproc->p_lock);
+	/* With one thread, nothing can change p_cwd meanwhile. */
+	if (!single) {
+		spinlock_acquire(&curproc->p_lock);
+	}
 	if (curproc->p_cwd!=NULL) {
 		VOP_INCREF(curproc->p_cwd);
 		*ret = curproc->p_cwd;
@@ -58,7 +62,9 @@ vfs_getcurdir(struct vnode **ret)
 	else {
 		rv = ENOENT;
 	}
-	spinlock_release(&curproc->p_lock);
+	if (!single) {
+		spinlock_release(&curproc->p_lock);
+	}
 
 	return rv;
 }
@@ -160,9 +166,7 @@ vfs_getcwd(struct uio *uio)
 
 	name = FSOP_GETVOLNAME(cwd->vn_fs);
 	if (name==NULL) {
-		vfs_biglock_acquire();
 		name = vfs_getdevname(cwd->vn_fs);
-		vfs_biglock_release();
 	}
 	KASSERT(name != NULL);
 
@@ -39,10 +39,15 @@
 #include <lib.h>
 #include <array.h>
 #include <synch.h>
+#include <thread.h>
+#include <current.h>
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <pagecache.h>
+#include <bio.h>
+#include <rcu.h>
 
 /*
  * Structure for a single named device.
@@ -60,6 +65,21 @@
  * kd_fs      - Filesystem object mounted on, or associated with, this
  *              device. NULL if there is no filesystem. 
  *
+ * kd_claimed - Set when the device has been taken over by another
+ *              (see vfs_claimdev), after which it cannot be mounted.
+ *
+ * kd_lazymount, kd_lazydata - Set by vfs_mountlazy: how to mount the
+ *              device the first time kd_name is looked up with
+ *              nothing mounted. NULL otherwise.
+ *
+ * kd_hash, kd_rawhash - vfs_namehash of kd_name and kd_rawname.
+ *
+ * kd_root    - The root of kd_fs, with a reference, once kd_name has
+ *              been looked up with it mounted; so that later lookups
+ *              of kd_name can have it from vfs_getcachedroot without
+ *              the biglock. Dropped before unmounting. Published with
+ *              rcu_assign.
+ *
  * A filesystem can be associated with a device without having been
  * mounted if the device was created that way. In this case,
  * kd_rawname is NULL (prohibiting mount/unmount), and, as there is
@@ -69,7 +89,8 @@
  * Referencing kd_name, or the filesystem volume name, on a device
  * with a filesystem mounted returns the root of the filesystem.
  * Referencing kd_name on a mountable device with no filesystem
- * returns ENXIO. Referencing kd_name on a device that is not
+ * returns ENXIO, unless a lazy mount is pending, which is then done.
+ * Referencing kd_name on a device that is not
  * mountable and has no filesystem, or kd_rawname on a mountable
  * device, returns the device itself.
  */
@@ -80,6 +101,12 @@ struct knowndev {
 	struct device *kd_device;
 	struct vnode *kd_vnode;
 	struct fs *kd_fs;
+	bool kd_claimed;
+	int (*kd_lazymount)(void *data, struct device *, struct fs **ret);
+	void *kd_lazydata;
+	unsigned kd_hash;
+	unsigned kd_rawhash;
+	struct vnode *kd_root;
 };
 
 DECLARRAY(knowndev);
@@ -87,10 +114,26 @@ DEFARRAY(knowndev, /*no inline*/);
 
 static struct knowndevarray *knowndevs;
 
-/* The big lock for all FS ops. Remove for filesystem assignment. */
+/*
+ * A copy of knowndevs for vfs_getdevname, which reads it under
+ * rcu_read_lock instead of the biglock. Devices are only ever added,
+ * and each add publishes a new copy and frees the old one after
+ * rcu_synchronize; the knowndevs themselves are never freed.
+ */
+struct knowndevtab {
+	unsigned kt_num;
+	struct knowndev *kt_devs[];
+};
+static struct knowndevtab *knowndevtab;
+
+/* The lock for knowndevs and the bootfs; see vfs.h. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
 
+static int domount(struct knowndev *kd, void *data,
+		   int (*mountfunc)(void *data, struct device *,
+				    struct fs **ret));
+
 
 /*
  * Setup function
@@ -109,6 +152,9 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	vfs_ncbootstrap();
+	bio_bootstrap();
+
 	devnull_create();
 }
 
@@ -145,30 +191,123 @@ vfs_biglock_do_i_hold(void)
 	return lock_do_i_hold(vfs_biglock);
 }
 
+/*
+ * One filesystem's part of vfs_sync, on a thread of its own.
+ */
+struct vfs_syncjob {
+	struct fs *sj_fs;
+	struct semaphore *sj_done;	/* V'd when it is over */
+};
+
+static
+void
+vfs_syncthread(void *data1, unsigned long data2)
+{
+	struct vfs_syncjob *sj = data1;
+
+	(void)data2;
+	/*result =*/ FSOP_SYNC(sj->sj_fs);
+	V(sj->sj_done);
+}
+
 /*
  * Global sync function - call FSOP_SYNC on all devices.
+ *
+ * Each filesystem is synced on a kernel thread of its own, so that
+ * with several disks the time taken is that of the slowest rather
+ * than the sum; vfs_biglock, held throughout, keeps them all mounted
+ * until every one is done. One that cannot have a thread is synced
+ * here instead, as is everything from panic, where interrupts are off
+ * and no other thread will run.
  */
 int
 vfs_sync(void)
 {
 	struct knowndev *dev;
-	unsigned i, num;
+	struct vfs_syncjob *jobs = NULL;
+	struct semaphore *done = NULL;
+	unsigned i, num, nthreads;
 
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
+	if (curthread->t_curspl == 0 && num > 1) {
+		jobs = kmalloc(num * sizeof(*jobs));
+		done = sem_create("vfs_sync", 0);
+		if (jobs == NULL || done == NULL) {
+			kfree(jobs);
+			jobs = NULL;
+		}
+	}
+
+	nthreads = 0;
 	for (i=0; i<num; i++) {
 		dev = knowndevarray_get(knowndevs, i);
-		if (dev->kd_fs != NULL) {
-			/*result =*/ FSOP_SYNC(dev->kd_fs);
+		if (dev->kd_fs == NULL) {
+			continue;
 		}
+		if (jobs != NULL) {
+			jobs[nthreads].sj_fs = dev->kd_fs;
+			jobs[nthreads].sj_done = done;
+			if (thread_fork("vfs_sync", NULL, vfs_syncthread,
+					&jobs[nthreads], 0) == 0) {
+				nthreads++;
+				continue;
+			}
+		}
+		/*result =*/ FSOP_SYNC(dev->kd_fs);
+	}
+
+	for (i=0; i<nthreads; i++) {
+		P(done);
+	}
+	if (done != NULL) {
+		sem_destroy(done);
 	}
+	kfree(jobs);
 
 	vfs_biglock_release();
 
 	return 0;
 }
 
+/*
+ * Keep another reference to ROOT, the root of KD's filesystem, as
+ * kd_root, if there is none yet.
+ */
+static
+void
+cacheroot(struct knowndev *kd, struct vnode *root)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (kd->kd_root == NULL) {
+		VOP_INCREF(root);
+		rcu_assign(kd->kd_root, root);
+	}
+}
+
+/*
+ * Let go of kd_root, before unmounting KD. Lookups that got it from
+ * vfs_getcachedroot just before have their own references, and keep
+ * the filesystem busy as if they had got it from vfs_getroot.
+ */
+static
+void
+dropcachedroot(struct knowndev *kd)
+{
+	struct vnode *root;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	root = kd->kd_root;
+	if (root != NULL) {
+		rcu_assign(kd->kd_root, NULL);
+		rcu_synchronize();
+		VOP_DECREF(root);
+	}
+}
+
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.
@@ -178,6 +317,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 {
 	struct knowndev *kd;
 	unsigned i, num;
+	int err;
 
 	KASSERT(vfs_biglock_do_i_hold());
 
@@ -191,7 +331,10 @@ vfs_getroot(const char *devname, struct vnode **result)
 		 * return the root of the filesystem.
 		 *
 		 * If it has no mounted filesystem, it's mountable,
-		 * and DEVNAME names the device, return ENXIO.
+		 * and DEVNAME names the device, mount it now if that
+		 * was put off, and otherwise return ENXIO. (A volume
+		 * name is not known until then, so only the device
+		 * name will do.)
 		 */
 
 		if (kd->kd_fs!=NULL) {
@@ -201,13 +344,27 @@ vfs_getroot(const char *devname, struct vnode **result)
 			if (!strcmp(kd->kd_name, devname) ||
 			    (volname!=NULL && !strcmp(volname, devname))) {
 				*result = FSOP_GETROOT(kd->kd_fs);
+				cacheroot(kd, *result);
 				return 0;
 			}
 		}
 		else {
 			if (kd->kd_rawname!=NULL &&
 			    !strcmp(kd->kd_name, devname)) {
-				return ENXIO;
+				if (kd->kd_lazymount == NULL) {
+					return ENXIO;
+				}
+				err = domount(kd, kd->kd_lazydata,
+					      kd->kd_lazymount);
+				if (err) {
+					/* Just the once. */
+					kd->kd_lazymount = NULL;
+					kd->kd_lazydata = NULL;
+					return err;
+				}
+				*result = FSOP_GETROOT(kd->kd_fs);
+				cacheroot(kd, *result);
+				return 0;
 			}
 		}
 
@@ -250,22 +407,73 @@ vfs_getroot(const char *devname, struct vnode **result)
 	return ENODEV;
 }
 
+/*
+ * The common cases of vfs_getroot, done under rcu_read_lock: DEVNAME is
+ * the name of a device whose root is cached, or of a device without a
+ * filesystem, or the raw name of one. Anything else (volume names,
+ * lazy mounts, errors) returns false, for the caller to try
+ * vfs_getroot.
+ */
+bool
+vfs_getcachedroot(const char *devname, struct vnode **result)
+{
+	struct knowndevtab *kt;
+	struct knowndev *kd;
+	struct vnode *vn = NULL;
+	unsigned i, hash;
+	size_t len;
+
+	hash = vfs_namehash(devname, &len);
+
+	rcu_read_lock();
+	kt = rcu_deref(knowndevtab);
+	for (i=0; kt != NULL && i<kt->kt_num; i++) {
+		kd = kt->kt_devs[i];
+
+		if (kd->kd_hash == hash && !strcmp(kd->kd_name, devname)) {
+			vn = rcu_deref(kd->kd_root);
+			if (vn == NULL && kd->kd_rawname == NULL &&
+			    kd->kd_fs == NULL) {
+				vn = kd->kd_vnode;
+			}
+			break;
+		}
+		if (kd->kd_rawname != NULL && kd->kd_rawhash == hash &&
+		    !strcmp(kd->kd_rawname, devname)) {
+			vn = kd->kd_vnode;
+			break;
+		}
+	}
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	rcu_read_unlock();
+
+	if (vn == NULL) {
+		return false;
+	}
+	*result = vn;
+	return true;
+}
+
 /*
  * Given a filesystem, hand back the name of the device it's mounted on.
+ * Needs no lock.
  */
 const char *
 vfs_getdevname(struct fs *fs)
 {
+	struct knowndevtab *kt;
 	struct knowndev *kd;
-	unsigned i, num;
+	const char *name = NULL;
+	unsigned i;
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
-
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+	rcu_read_lock();
+	kt = rcu_deref(knowndevtab);
+	for (i=0; kt != NULL && i<kt->kt_num; i++) {
+		kd = kt->kt_devs[i];
 
 		if (kd->kd_fs == fs) {
 			/*
@@ -274,11 +482,13 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
+	rcu_read_unlock();
 
-	return NULL;
+	return name;
 }
 
 /*
@@ -373,9 +583,11 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 {
 	char *name=NULL, *rawname=NULL;
 	struct knowndev *kd=NULL;
+	struct knowndevtab *kt=NULL, *oldkt;
 	struct vnode *vnode=NULL;
 	const char *volname=NULL;
-	unsigned index;
+	unsigned index, i;
+	size_t len;
 	int result;
 
 	vfs_biglock_acquire();
@@ -401,30 +613,59 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		goto nomem;
 	}
 
+	kt = kmalloc(sizeof(struct knowndevtab) +
+		     (knowndevarray_num(knowndevs) + 1) * sizeof(kd));
+	if (kt==NULL) {
+		goto nomem;
+	}
+
 	kd->kd_name = name;
 	kd->kd_rawname = rawname;
 	kd->kd_device = dev;
 	kd->kd_vnode = vnode;
 	kd->kd_fs = fs;
+	kd->kd_claimed = false;
+	kd->kd_lazymount = NULL;
+	kd->kd_lazydata = NULL;
+	kd->kd_hash = vfs_namehash(name, &len);
+	kd->kd_rawhash = rawname != NULL ? vfs_namehash(rawname, &len) : 0;
+	kd->kd_root = NULL;
 
 	if (fs!=NULL) {
 		volname = FSOP_GETVOLNAME(fs);
 	}
 
 	if (badnames(name, rawname, volname)) {
+		kfree(kt);
 		vfs_biglock_release();
 		return EEXIST;
 	}
 
 	result = knowndevarray_add(knowndevs, kd, &index);
+	if (result) {
+		kfree(kt);
+		vfs_biglock_release();
+		return result;
+	}
 
-	if (result == 0 && dev != NULL) {
+	if (dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
 		dev->d_devnumber = index+1;
 	}
 
+	kt->kt_num = knowndevarray_num(knowndevs);
+	for (i=0; i<kt->kt_num; i++) {
+		kt->kt_devs[i] = knowndevarray_get(knowndevs, i);
+	}
+	oldkt = knowndevtab;
+	rcu_assign(knowndevtab, kt);
+	if (oldkt != NULL) {
+		rcu_synchronize();
+		kfree(oldkt);
+	}
+
 	vfs_biglock_release();
-	return result;
+	return 0;
 
  nomem:
 
@@ -440,6 +681,9 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	if (kd) {
 		kfree(kd);
 	}
+	if (kt) {
+		kfree(kt);
+	}
 	
 	vfs_biglock_release();
 	return ENOMEM;
@@ -500,18 +744,14 @@ findmount(const char *devname, struct knowndev **result)
 }
 
 /*
- * Mount a filesystem. Once we've found the device, call MOUNTFUNC to
- * set up the filesystem and hand back a struct fs.
- *
- * The DATA argument is passed through unchanged to MOUNTFUNC.
+ * Take over the mountable device DEVNAME for use by another device
+ * built on it, such as a vdisk. It must not have a filesystem mounted,
+ * and can have none mounted from now on.
  */
 int
-vfs_mount(const char *devname, void *data,
-	  int (*mountfunc)(void *data, struct device *, struct fs **ret))
+vfs_claimdev(const char *devname, struct device **ret)
 {
-	const char *volname;
 	struct knowndev *kd;
-	struct fs *fs;
 	int result;
 
 	vfs_biglock_acquire();
@@ -521,30 +761,121 @@ vfs_mount(const char *devname, void *data,
 		vfs_biglock_release();
 		return result;
 	}
-
-	if (kd->kd_fs != NULL) {
+	if (kd->kd_fs != NULL || kd->kd_claimed) {
 		vfs_biglock_release();
 		return EBUSY;
 	}
+	KASSERT(kd->kd_device != NULL);
+
+	kd->kd_claimed = true;
+	*ret = kd->kd_device;
+
+	vfs_biglock_release();
+	return 0;
+}
+
+void
+vfs_releasedev(const char *devname)
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+	result = findmount(devname, &kd);
+	KASSERT(result == 0);
+	KASSERT(kd->kd_claimed);
+	kd->kd_claimed = false;
+	vfs_biglock_release();
+}
+
+/*
+ * Mount a filesystem on KD with MOUNTFUNC. Any lazy mount pending on
+ * it is superseded. Should already hold the biglock.
+ */
+static
+int
+domount(struct knowndev *kd, void *data,
+	int (*mountfunc)(void *data, struct device *, struct fs **ret))
+{
+	const char *volname;
+	struct fs *fs;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (kd->kd_fs != NULL || kd->kd_claimed) {
+		return EBUSY;
+	}
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
 	result = mountfunc(data, kd->kd_device, &fs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	KASSERT(fs != NULL);
 
 	kd->kd_fs = fs;
+	kd->kd_lazymount = NULL;
+	kd->kd_lazydata = NULL;
 
 	volname = FSOP_GETVOLNAME(fs);
 	kprintf("vfs: Mounted %s: on %s\n",
 		volname ? volname : kd->kd_name, kd->kd_name);
+	return 0;
+}
+
+/*
+ * Mount a filesystem. Once we've found the device, call MOUNTFUNC to
+ * set up the filesystem and hand back a struct fs.
+ *
+ * The DATA argument is passed through unchanged to MOUNTFUNC.
+ */
+int
+vfs_mount(const char *devname, void *data,
+	  int (*mountfunc)(void *data, struct device *, struct fs **ret))
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+
+	result = findmount(devname, &kd);
+	if (result == 0) {
+		result = domount(kd, data, mountfunc);
+	}
 
 	vfs_biglock_release();
-	return 0;
+	return result;
+}
+
+/*
+ * Arrange for vfs_mount(DEVNAME, DATA, MOUNTFUNC) to happen when
+ * DEVNAME is first used, rather than now; see vfs_getroot. Reading
+ * the disk is put off until something wants it, which at boot may be
+ * never.
+ */
+int
+vfs_mountlazy(const char *devname, void *data,
+	      int (*mountfunc)(void *data, struct device *, struct fs **ret))
+{
+	struct knowndev *kd;
+	int result;
+
+	vfs_biglock_acquire();
+
+	result = findmount(devname, &kd);
+	if (result == 0 && (kd->kd_fs != NULL || kd->kd_claimed)) {
+		result = EBUSY;
+	}
+	if (result == 0) {
+		kd->kd_lazymount = mountfunc;
+		kd->kd_lazydata = data;
+	}
+
+	vfs_biglock_release();
+	return result;
 }
 
 /*
@@ -571,6 +902,11 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* Let go of the vnodes the caches hold */
+	dropcachedroot(kd);
+	vfs_ncpurgefs(kd->kd_fs);
+	pagecache_purgefs(kd->kd_fs);
+
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto fail;
@@ -619,6 +955,10 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		dropcachedroot(dev);
+		vfs_ncpurgefs(dev->kd_fs);
+		pagecache_purgefs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
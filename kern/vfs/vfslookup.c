@@ -39,11 +39,18 @@
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include <rcu.h>
 
+/*
+ * Changed under the biglock, and read under rcu_read_lock only (see
+ * getdevice), since every name beginning with a slash starts at it.
+ */
 static struct vnode *bootfs_vnode = NULL;
 
 /*
- * Helper function for actually changing bootfs_vnode.
+ * Helper function for actually changing bootfs_vnode. Waits for the
+ * lookups that might still be looking at the old one before dropping
+ * its reference.
  */
 static
 void
@@ -51,10 +58,13 @@ change_bootfs(struct vnode *newvn)
 {
 	struct vnode *oldvn;
 
+	KASSERT(vfs_biglock_do_i_hold());
+
 	oldvn = bootfs_vnode;
-	bootfs_vnode = newvn;
+	rcu_assign(bootfs_vnode, newvn);
 
 	if (oldvn != NULL) {
+		rcu_synchronize();
 		VOP_DECREF(oldvn);
 	}
 }
@@ -123,18 +133,24 @@ vfs_clearbootfs(void)
 /*
  * Common code to pull the device name, if any, off the front of a
  * path and choose the vnode to begin the name lookup relative to.
+ *
+ * Relative names begin at DIR, or at the current directory if DIR is
+ * NULL. Those, which are most names, need nothing but a reference to
+ * the directory, and names with a leading slash nothing but one to
+ * bootfs_vnode, which is got without locking. Names with a device
+ * usually find its root cached (vfs_getcachedroot) and need no lock
+ * either; otherwise they, and names with a leading colon, take the
+ * biglock to look at the device list.
  */
-
 static
 int
-getdevice(char *path, char **subpath, struct vnode **startvn)
+getdevice(struct vnode *dir, char *path, char **subpath,
+	  struct vnode **startvn)
 {
-	int slash=-1, colon=-1, i;
 	struct vnode *vn;
+	int slash=-1, colon=-1, i;
 	int result;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/*
 	 * Locate the first colon or slash.
 	 */
@@ -155,10 +171,15 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 		 * No colon before a slash, so no device name
 		 * specified, and the slash isn't leading or is also
 		 * absent, so this is a relative path or just a bare
-		 * filename. Start from the current directory, and
-		 * use the whole thing as the subpath.
+		 * filename. Start from the current directory (or
+		 * DIR), and use the whole thing as the subpath.
 		 */
 		*subpath = path;
+		if (dir != NULL) {
+			VOP_INCREF(dir);
+			*startvn = dir;
+			return 0;
+		}
 		return vfs_getcurdir(startvn);
 	}
 
@@ -170,13 +191,14 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 			colon++;
 		}
 		*subpath = &path[colon+1];
-		
-		result = vfs_getroot(path, startvn);
-		if (result) {
-			return result;
-		}
 
-		return 0;
+		if (vfs_getcachedroot(path, startvn)) {
+			return 0;
+		}
+		vfs_biglock_acquire();
+		result = vfs_getroot(path, startvn);
+		vfs_biglock_release();
+		return result;
 	}
 
 	/*
@@ -188,17 +210,24 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	KASSERT(colon==0 || slash==0);
 
 	if (path[0]=='/') {
-		if (bootfs_vnode==NULL) {
+		rcu_read_lock();
+		vn = rcu_deref(bootfs_vnode);
+		if (vn != NULL) {
+			VOP_INCREF(vn);
+		}
+		rcu_read_unlock();
+		if (vn == NULL) {
 			return ENOENT;
 		}
-		VOP_INCREF(bootfs_vnode);
-		*startvn = bootfs_vnode;
+		*startvn = vn;
 	}
 	else {
 		KASSERT(path[0]==':');
 
+		vfs_biglock_acquire();
 		result = vfs_getcurdir(&vn);
 		if (result) {
+			vfs_biglock_release();
 			return result;
 		}
 
@@ -209,6 +238,7 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 		KASSERT(vn->vn_fs!=NULL);
 
 		*startvn = FSOP_GETROOT(vn->vn_fs);
+		vfs_biglock_release();
 
 		VOP_DECREF(vn);
 	}
@@ -231,15 +261,19 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 int
 vfs_lookparent(char *path, struct vnode **retval,
 	       char *buf, size_t buflen)
+{
+	return vfs_lookparentat(NULL, path, retval, buf, buflen);
+}
+
+int
+vfs_lookparentat(struct vnode *dir, char *path, struct vnode **retval,
+		 char *buf, size_t buflen)
 {
 	struct vnode *startvn;
 	int result;
 
-	vfs_biglock_acquire();
-
-	result = getdevice(path, &path, &startvn);
+	result = getdevice(dir, path, &path, &startvn);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -256,34 +290,57 @@ vfs_lookparent(char *path, struct vnode **retval,
 	}
 
 	VOP_DECREF(startvn);
-
-	vfs_biglock_release();
 	return result;
 }
 
 int
 vfs_lookup(char *path, struct vnode **retval)
+{
+	return vfs_lookupat(NULL, path, retval);
+}
+
+int
+vfs_lookupat(struct vnode *dir, char *path, struct vnode **retval)
 {
 	struct vnode *startvn;
+	char name[NAME_MAX+1];
+	bool cacheable;
+	unsigned gen, hash;
+	size_t len;
 	int result;
 
-	vfs_biglock_acquire();
-
-	result = getdevice(path, &path, &startvn);
+	result = getdevice(dir, path, &path, &startvn);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	if (strlen(path)==0) {
+	/* One pass over the rest, for its length and cache hash */
+	hash = vfs_namehash(path, &len);
+	if (len==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
+	/* Try the name cache (see vfscache.c) */
+	if (vfs_nclookup(startvn, path, hash, retval)) {
+		VOP_DECREF(startvn);
+		return *retval == NULL ? ENOENT : 0;
+	}
+
+	/* VOP_LOOKUP may destroy the path, so keep a copy to enter */
+	cacheable = len < sizeof(name);
+	if (cacheable) {
+		memcpy(name, path, len+1);
+	}
+	gen = vfs_ncgen();
+
 	result = VOP_LOOKUP(startvn, path, retval);
 
+	if (cacheable && (result == 0 || result == ENOENT)) {
+		vfs_ncenter(startvn, name, hash,
+			    result == 0 ? *retval : NULL, gen);
+	}
+
 	VOP_DECREF(startvn);
-	vfs_biglock_release();
 	return result;
 }
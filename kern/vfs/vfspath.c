@@ -43,6 +43,14 @@
 /* Does most of the work for open(). */
 int
 vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
+{
+	return vfs_openat(NULL, path, openflags, mode, ret);
+}
+
+/* And for openat(), with relative names starting at DIR if not NULL. */
+int
+vfs_openat(struct vnode *dir, char *path, int openflags, mode_t mode,
+	   struct vnode **ret)
 {
 	int how;
 	int result;
@@ -65,20 +73,23 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 
 	if (openflags & O_CREAT) {
 		char name[NAME_MAX+1];
-		struct vnode *dir;
+		struct vnode *parent;
 		int excl = (openflags & O_EXCL)!=0;
 		
-		result = vfs_lookparent(path, &dir, name, sizeof(name));
+		result = vfs_lookparentat(dir, path, &parent, name, sizeof(name));
 		if (result) {
 			return result;
 		}
 
-		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		result = VOP_CREAT(parent, name, excl, mode, &vn);
+		if (result == 0) {
+			vfs_ncpurge(parent, name);
+		}
 
-		VOP_DECREF(dir);
+		VOP_DECREF(parent);
 	}
 	else {
-		result = vfs_lookup(path, &vn);
+		result = vfs_lookupat(dir, path, &vn);
 	}
 
 	if (result) {
@@ -150,6 +161,9 @@ vfs_remove(char *path)
 	}
 
 	result = VOP_REMOVE(dir, name);
+	if (result == 0) {
+		vfs_ncpurge(dir, name);
+	}
 	VOP_DECREF(dir);
 
 	return result;
@@ -183,6 +197,10 @@ vfs_rename(char *oldpath, char *newpath)
 	}
 
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	if (result == 0) {
+		vfs_ncpurge(olddir, oldname);
+		vfs_ncpurge(newdir, newname);
+	}
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -217,6 +235,9 @@ vfs_link(char *oldpath, char *newpath)
 	}
 
 	result = VOP_LINK(newdir, newname, oldfile);
+	if (result == 0) {
+		vfs_ncpurge(newdir, newname);
+	}
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -244,6 +265,9 @@ vfs_symlink(const char *contents, char *path)
 	}
 
 	result = VOP_SYMLINK(newdir, newname, contents);
+	if (result == 0) {
+		vfs_ncpurge(newdir, newname);
+	}
 	VOP_DECREF(newdir);
 
 	return result;
@@ -290,6 +314,9 @@ vfs_mkdir(char *path, mode_t mode)
 	}
 
 	result = VOP_MKDIR(parent, name, mode);
+	if (result == 0) {
+		vfs_ncpurge(parent, name);
+	}
 
 	VOP_DECREF(parent);
 
@@ -312,6 +339,9 @@ vfs_rmdir(char *path)
 	}
 
 	result = VOP_RMDIR(parent, name);
+	if (result == 0) {
+		vfs_ncpurge(parent, name);
+	}
 
 	VOP_DECREF(parent);
 
@@ -33,9 +33,11 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <atomic.h>
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <kern/poll.h>
 
 /*
  * Initialize an abstract vnode.
@@ -51,6 +53,8 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	vn->vn_ops = ops;
 	vn->vn_refcount = 1;
 	vn->vn_opencount = 0;
+	vn->vn_cachedpages = 0;
+	vn->vn_execcached = false;
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
 	return 0;
@@ -65,6 +69,8 @@ vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount==1);
 	KASSERT(vn->vn_opencount==0);
+	KASSERT(vn->vn_cachedpages==0);
+	KASSERT(!vn->vn_execcached);
 
 	vn->vn_ops = NULL;
 	vn->vn_refcount = 0;
@@ -83,11 +89,7 @@ vnode_incref(struct vnode *vn)
 {
 	KASSERT(vn != NULL);
 
-	vfs_biglock_acquire();
-
-	vn->vn_refcount++;
-
-	vfs_biglock_release();
+	atomic_inc(&vn->vn_refcount);
 }
 
 /*
@@ -98,26 +100,46 @@ vnode_incref(struct vnode *vn)
 void
 vnode_decref(struct vnode *vn)
 {
+	unsigned count;
 	int result;
 
 	KASSERT(vn != NULL);
 
-	vfs_biglock_acquire();
-
-	KASSERT(vn->vn_refcount>0);
-	if (vn->vn_refcount>1) {
-		vn->vn_refcount--;
-	}
-	else {
-		result = VOP_RECLAIM(vn);
-		if (result != 0 && result != EBUSY) {
-			// XXX: lame.
-			kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
-				strerror(result));
+	/* Don't decrement the last one; it goes to VOP_RECLAIM. */
+	do {
+		count = vn->vn_refcount;
+		KASSERT(count > 0);
+		if (count == 1) {
+			result = VOP_RECLAIM(vn);
+			if (result != 0 && result != EBUSY) {
+				// XXX: lame.
+				kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
+					strerror(result));
+			}
+			return;
 		}
-	}
+	} while (!atomic_cas(&vn->vn_refcount, count, count - 1));
+}
+
+/*
+ * Check, from VOP_RECLAIM, that nobody has taken a reference since
+ * vnode_decref decided to reclaim; if someone has, drop the one handed
+ * to VOP_RECLAIM. The caller holds the lock new references are made
+ * under, so a count of one stays one.
+ */
+bool
+vnode_lastref(struct vnode *vn)
+{
+	unsigned count;
 
-	vfs_biglock_release();
+	do {
+		count = vn->vn_refcount;
+		KASSERT(count > 0);
+		if (count == 1) {
+			return true;
+		}
+	} while (!atomic_cas(&vn->vn_refcount, count, count - 1));
+	return false;
 }
 
 /*
@@ -129,9 +151,7 @@ vnode_incopen(struct vnode *vn)
 {
 	KASSERT(vn != NULL);
 
-	vfs_biglock_acquire();
-	vn->vn_opencount++;
-	vfs_biglock_release();
+	atomic_inc(&vn->vn_opencount);
 }
 
 /*
@@ -141,20 +161,21 @@ vnode_incopen(struct vnode *vn)
 void
 vnode_decopen(struct vnode *vn)
 {
+	unsigned count;
 	int result;
 
 	KASSERT(vn != NULL);
 
-	vfs_biglock_acquire();
-
-	KASSERT(vn->vn_opencount>0);
-	vn->vn_opencount--;
-
-	if (vn->vn_opencount > 0) {
-		vfs_biglock_release();
+	count = atomic_add(&vn->vn_opencount, -1);
+	KASSERT(count > 0);
+	if (count != 1) {
 		return;
 	}
 
+	/*
+	 * Someone may open it again before this is done; VOP_CLOSE
+	 * only writes things back, so that does no harm.
+	 */
 	result = VOP_CLOSE(vn);
 	if (result) {
 		// XXX: also lame.
@@ -162,8 +183,17 @@ vnode_decopen(struct vnode *vn)
 		// doesn't get reached...
 		kprintf("vfs: Warning: VOP_CLOSE: %s\n", strerror(result));
 	}
+}
 
-	vfs_biglock_release();
+/*
+ * vop_poll for objects that never block.
+ */
+int
+vnode_pollready(struct vnode *v, int events, struct poller *poller)
+{
+	(void)v;
+	(void)poller;
+	return events & (POLLIN | POLLOUT);
 }
 
 /*
@@ -173,7 +203,7 @@ vnode_decopen(struct vnode *vn)
 void
 vnode_check(struct vnode *v, const char *opstr)
 {
-	vfs_biglock_acquire();
+	int refcount, opencount;
 
 	if (v == NULL) {
 		panic("vnode_check: vop_%s: null vnode\n", opstr);
@@ -202,26 +232,27 @@ vnode_check(struct vnode *v, const char *opstr)
 		panic("vnode_check: vop_%s: deadbeef fs pointer\n", opstr);
 	}
 
-	if (v->vn_refcount < 0) {
+	refcount = v->vn_refcount;
+	opencount = v->vn_opencount;
+
+	if (refcount < 0) {
 		panic("vnode_check: vop_%s: negative refcount %d\n", opstr,
-		      v->vn_refcount);
+		      refcount);
 	}
-	else if (v->vn_refcount == 0 && strcmp(opstr, "reclaim")) {
+	else if (refcount == 0 && strcmp(opstr, "reclaim")) {
 		panic("vnode_check: vop_%s: zero refcount\n", opstr);
 	}
-	else if (v->vn_refcount > 0x100000) {
+	else if (refcount > 0x100000) {
 		kprintf("vnode_check: vop_%s: warning: large refcount %d\n", 
-			opstr, v->vn_refcount);
+			opstr, refcount);
 	}
 
-	if (v->vn_opencount < 0) {
+	if (opencount < 0) {
 		panic("vnode_check: vop_%s: negative opencount %d\n", opstr,
-		      v->vn_opencount);
+		      opencount);
 	}
-	else if (v->vn_opencount > 0x100000) {
+	else if (opencount > 0x100000) {
 		kprintf("vnode_check: vop_%s: warning: large opencount %d\n", 
-			opstr, v->vn_opencount);
+			opstr, opencount);
 	}
-
-	vfs_biglock_release();
 }
@@ -0,0 +1,1834 @@
+/*
+ * Address spaces for the paging VM.
+ *
+ * An address space is a list of regions, sorted by address, plus a
+ * two-level page table. Finding the region for an address is a binary
+ * search, after a check of the one found last time (as_lasthit), which
+ * is almost always the one a fault wants.
+ * Nothing is allocated up front: as_fault fills each page in on first
+ * touch, either with zeros or with the matching bytes of the ELF file
+ * the region was loaded from. A fault that has to read a page from a
+ * file reads the next few untouched pages of the file with it, in one
+ * VOP_READ, if memory allows. The MIPS-specific side (TLB handling,
+ * as_activate) is in arch/mips/vm/dumbvm.c.
+ *
+ * The heap is another region, right after the last one loaded from
+ * the ELF file, which as_sbrk grows and shrinks. It does not exist
+ * while it is empty.
+ *
+ * The stack region starts out a few pages long and grows down when
+ * something faults just below it, up to VM_STACKPAGES; the bottom page
+ * of that range is a guard page and never grows into the stack.
+ *
+ * as_copy does not copy anything: resident pages are shared between
+ * the two address spaces and marked PTE_COW in both, and the first
+ * write to such a page from either side gets it a private copy.
+ *
+ * Pages of read-only file regions (ELF text, read-only mmaps) come
+ * from the page cache when some process has read them already, and are
+ * mapped copy-on-write like pages shared by as_copy; so they can never
+ * actually be written, and are not evicted while in use. A page read in
+ * for such a region goes into the cache.
+ *
+ * A read of a page that has never been touched and has nothing from
+ * the ELF file in it maps the shared zero page, copy-on-write, so that
+ * sparse reads of BSS, heap and stack cost no memory. Pages that are
+ * written get a frame from the coremap's pool of pre-zeroed frames.
+ *
+ * mmap adds regions of its own, either anonymous or backed by a file
+ * like an ELF segment. Pages of a MAP_SHARED file mapping are mapped
+ * read-only until written, so that PTE_DIRTY says which ones have to
+ * go back to the file. That happens when the region is unmapped or the
+ * address space destroyed; in between, dirty pages are evicted to swap
+ * like any others and clean ones are simply dropped. There is no page
+ * cache, so two processes mapping the same file do not see each
+ * other's changes until they reach the file (which drops the cached
+ * pages they change).
+ *
+ * shmat adds a region for a shared memory segment, whose pages are
+ * the segment's frames, mapped writeable by everyone attached and
+ * never copied; as_copy shares the attachment rather than the pages.
+ * Those frames are never handed to coremap_set_owner, so they stay
+ * put until the segment goes away.
+ *
+ * When memory runs out the coremap evicts pages through as_evict.
+ * as_lock serializes that against faults, as_copy and as_destroy on
+ * the same address space. The coremap's ager marks private pages
+ * PTE_AGED through as_age; as_resolve clears the bit again when one is
+ * touched, and as_age counts the pages it finds cleared toward the
+ * working set reported by as_wss.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/timepage.h>
+#include <lib.h>
+#include <array.h>
+#include <uio.h>
+#include <stat.h>
+#include <proc.h>
+#include <synch.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <pagecache.h>
+#include <shm.h>
+#include <uw-vmstats.h>
+
+/*
+ * Where as_mmap starts looking for room, going down, and the most the
+ * heap may grow to: the time page, just below the stack's guard page.
+ */
+#define VM_MMAPTOP TIMEPAGE_VADDR
+#if TIMEPAGE_VADDR != USERSTACK - (VM_STACKPAGES + 1) * PAGE_SIZE
+#error "The time page is not right below the stack"
+#endif
+
+/*
+ * Most pages after a file-backed page read in on a fault that are read
+ * along with it (see as_readahead). 0 turns readahead off.
+ */
+#define AS_READAHEAD 7
+
+static int as_sync_region(struct addrspace *as, struct region *rg);
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as;
+
+	as = kmalloc(sizeof(struct addrspace));
+	if (as == NULL) {
+		return NULL;
+	}
+
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_regions = array_create();
+	if (as->as_regions == NULL) {
+		lock_destroy(as->as_lock);
+		kfree(as);
+		return NULL;
+	}
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		array_destroy(as->as_regions);
+		lock_destroy(as->as_lock);
+		kfree(as);
+		return NULL;
+	}
+	as->as_lasthit = NULL;
+	as->as_nextfault = 0;
+	as->as_prefill = 0;
+	as->as_tlbloads = 0;
+	as->as_tlbpages = 0;
+	as->as_tlbreach = 0;
+	as->as_heapbase = 0;
+	as->as_brk = 0;
+	as->as_rss = 0;
+	as->as_minflt = 0;
+	as->as_majflt = 0;
+	as->as_wsgen = coremap_agegen();
+	as->as_wscur = 0;
+	as->as_wsprev = 0;
+
+	return as;
+}
+
+/*
+ * Free a region, once nothing maps it any more.
+ */
+static
+void
+as_free_region(struct region *rg)
+{
+	if (rg->rg_vnode != NULL) {
+		VOP_DECREF(rg->rg_vnode);
+	}
+	if (rg->rg_shm != NULL) {
+		shm_detach(rg->rg_shm);
+	}
+	kfree(rg);
+}
+
+void
+as_destroy(struct addrspace *as)
+{
+	struct region *rg;
+	unsigned i;
+	int result;
+
+	DEBUG(DB_VM, "addrspace %p: %u TLB loads, %u pages mapped, "
+	      "reach %u pages (%u KB)\n", as, as->as_tlbloads,
+	      as->as_tlbpages, as->as_tlbreach,
+	      as->as_tlbreach * PAGE_SIZE / 1024);
+
+	vm_tlbshootdown_as(as);
+
+	/* Wait out any eviction in progress, and keep new ones off. */
+	lock_acquire(as->as_lock);
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_shared) {
+			result = as_sync_region(as, rg);
+			if (result) {
+				kprintf("vm: lost changes to a shared mapping: "
+					"%s\n", strerror(result));
+			}
+		}
+	}
+	pt_destroy(as->as_pt);
+	lock_release(as->as_lock);
+	lock_destroy(as->as_lock);
+
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		as_free_region(array_get(as->as_regions, i));
+	}
+	array_setsize(as->as_regions, 0);
+	array_destroy(as->as_regions);
+
+	kfree(as);
+}
+
+/*
+ * The index of the first region that starts at or above VADDR, or the
+ * number of regions if none does.
+ */
+static
+unsigned
+as_region_index(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	unsigned lo, hi, mid;
+
+	lo = 0;
+	hi = array_num(as->as_regions);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		rg = array_get(as->as_regions, mid);
+		if (rg->rg_vbase < vaddr) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/*
+ * Find the region containing VADDR, or NULL if there isn't one. as_lock
+ * held, or AS still private to its maker, since as_lasthit changes.
+ */
+static
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	unsigned i;
+
+	rg = as->as_lasthit;
+	if (rg != NULL && vaddr >= rg->rg_vbase &&
+	    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+		return rg;
+	}
+
+	/* The last region starting at or below VADDR is the only one. */
+	i = as_region_index(as, vaddr + 1);
+	if (i == 0) {
+		return NULL;
+	}
+	rg = array_get(as->as_regions, i - 1);
+	if (vaddr >= rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+		return NULL;
+	}
+	as->as_lasthit = rg;
+	return rg;
+}
+
+/*
+ * Find the region containing VADDR like as_find_region, but if VADDR
+ * is below the stack, within VM_STACKPAGES of USERSTACK and above the
+ * guard page, grow the stack down to cover it first. Pages are still
+ * only allocated when touched. as_lock held, since the coremap may be
+ * looking at the stack region to evict from it.
+ */
+static
+struct region *
+as_find_or_grow(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	unsigned n;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	rg = as_find_region(as, vaddr);
+	if (rg != NULL ||
+	    vaddr >= USERSTACK ||
+	    vaddr < USERSTACK - (VM_STACKPAGES - 1) * PAGE_SIZE) {
+		return rg;
+	}
+
+	/* Nothing goes above the stack, so it is the last region. */
+	n = array_num(as->as_regions);
+	if (n == 0) {
+		return NULL;
+	}
+	rg = array_get(as->as_regions, n - 1);
+	if (!rg->rg_stack || vaddr >= rg->rg_vbase) {
+		return NULL;
+	}
+
+	vaddr &= PAGE_FRAME;
+	rg->rg_npages += (rg->rg_vbase - vaddr) / PAGE_SIZE;
+	rg->rg_vbase = vaddr;
+	return rg;
+}
+
+/*
+ * Add a region of NPAGES pages at VADDR, in its place in the sorted
+ * array, handing it back in RET if RET is not NULL.
+ */
+static
+int
+as_add_region(struct addrspace *as, vaddr_t vaddr, size_t npages,
+	      bool writeable, struct region **ret)
+{
+	struct region *rg;
+	unsigned i, j;
+	int result;
+
+	if (npages == 0) {
+		return EINVAL;
+	}
+	if (vaddr >= USERSPACETOP ||
+	    npages > (USERSPACETOP - vaddr) / PAGE_SIZE) {
+		return EFAULT;
+	}
+
+	/* Only the neighbours on either side could overlap it. */
+	i = as_region_index(as, vaddr);
+	if (i > 0) {
+		rg = array_get(as->as_regions, i - 1);
+		if (vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			kprintf("vm: Warning: overlapping regions\n");
+			return EINVAL;
+		}
+	}
+	if (i < array_num(as->as_regions)) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vbase < vaddr + npages * PAGE_SIZE) {
+			kprintf("vm: Warning: overlapping regions\n");
+			return EINVAL;
+		}
+	}
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_vbase = vaddr;
+	rg->rg_npages = npages;
+	rg->rg_writeable = writeable;
+	rg->rg_fvaddr = vaddr;
+	rg->rg_foffset = 0;
+	rg->rg_filesize = 0;
+	rg->rg_vnode = NULL;
+	rg->rg_shared = false;
+	rg->rg_mmap = false;
+	rg->rg_stack = false;
+	rg->rg_heap = false;
+	rg->rg_shm = NULL;
+
+	result = array_add(as->as_regions, rg, NULL);
+	if (result) {
+		kfree(rg);
+		return result;
+	}
+	for (j = array_num(as->as_regions) - 1; j > i; j--) {
+		array_set(as->as_regions, j, array_get(as->as_regions, j - 1));
+	}
+	array_set(as->as_regions, i, rg);
+	if (ret != NULL) {
+		*ret = rg;
+	}
+	return 0;
+}
+
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	/* MIPS cannot map a page write-only or execute-only. */
+	(void)readable;
+	(void)executable;
+
+	if (sz == 0) {
+		/* Empty segment; nothing to map. */
+		return 0;
+	}
+	return as_add_region(as, vaddr, sz / PAGE_SIZE, writeable != 0, NULL);
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+	/* Nothing to do: pages are allocated when first touched. */
+	(void)as;
+	return 0;
+}
+
+int
+as_load_segment(struct addrspace *as, struct vnode *v,
+		off_t offset, vaddr_t vaddr,
+		size_t memsize, size_t filesize)
+{
+	struct region *rg;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL ||
+	    vaddr + memsize > rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+		return ENOEXEC;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+	      (unsigned long)filesize, (unsigned long)vaddr);
+
+	rg->rg_fvaddr = vaddr;
+	rg->rg_foffset = offset;
+	rg->rg_filesize = filesize;
+
+	if (rg->rg_vnode == NULL) {
+		VOP_INCREF(v);
+		rg->rg_vnode = v;
+	}
+	KASSERT(rg->rg_vnode == v);
+	return 0;
+}
+
+int
+as_complete_load(struct addrspace *as)
+{
+	struct region *rg;
+	vaddr_t end;
+	unsigned i;
+
+	/* The heap starts out empty, just past the end of the program. */
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (end > as->as_heapbase) {
+			as->as_heapbase = end;
+		}
+	}
+	as->as_brk = as->as_heapbase;
+	return 0;
+}
+
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	struct region *rg;
+	int result;
+
+	result = as_add_region(as, USERSTACK - VM_STACKINIT * PAGE_SIZE,
+			       VM_STACKINIT, true, &rg);
+	if (result) {
+		return result;
+	}
+	rg->rg_stack = true;
+
+	*stackptr = USERSTACK;
+	return 0;
+}
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *new;
+	struct region *oldrg, *newrg;
+	pte_t *oldpte, *newpte;
+	paddr_t paddr;
+	vaddr_t va;
+	unsigned i, j;
+	int result;
+
+	new = as_create();
+	if (new == NULL) {
+		return ENOMEM;
+	}
+	new->as_heapbase = old->as_heapbase;
+	new->as_brk = old->as_brk;
+
+	/*
+	 * Nobody else can see NEW yet, but the coremap may try to evict
+	 * its pages as soon as they are owned.
+	 */
+	lock_acquire(old->as_lock);
+	lock_acquire(new->as_lock);
+
+	for (i = 0; i < array_num(old->as_regions); i++) {
+		oldrg = array_get(old->as_regions, i);
+		result = as_add_region(new, oldrg->rg_vbase, oldrg->rg_npages,
+				       oldrg->rg_writeable, &newrg);
+		if (result) {
+			goto fail;
+		}
+		newrg->rg_fvaddr = oldrg->rg_fvaddr;
+		newrg->rg_foffset = oldrg->rg_foffset;
+		newrg->rg_filesize = oldrg->rg_filesize;
+		newrg->rg_shared = oldrg->rg_shared;
+		newrg->rg_mmap = oldrg->rg_mmap;
+		newrg->rg_stack = oldrg->rg_stack;
+		newrg->rg_heap = oldrg->rg_heap;
+		if (oldrg->rg_vnode != NULL) {
+			VOP_INCREF(oldrg->rg_vnode);
+			newrg->rg_vnode = oldrg->rg_vnode;
+		}
+		if (oldrg->rg_shm != NULL) {
+			shm_incref(oldrg->rg_shm);
+			newrg->rg_shm = oldrg->rg_shm;
+		}
+
+		/* Share the pages that are resident; the rest stay lazy. */
+		for (j = 0; j < oldrg->rg_npages; j++) {
+			va = oldrg->rg_vbase + j * PAGE_SIZE;
+			oldpte = pt_lookup(old->as_pt, va, false);
+			if (oldpte == NULL ||
+			    (*oldpte & (PTE_VALID | PTE_SWAPPED)) == 0) {
+				continue;
+			}
+			if ((*oldpte & PTE_VALID) &&
+			    (*oldpte & PTE_FRAME) == coremap_zeropage()) {
+				/* The child can find it again itself. */
+				continue;
+			}
+			newpte = pt_lookup(new->as_pt, va, true);
+			if (newpte == NULL) {
+				result = ENOMEM;
+				goto fail;
+			}
+			if ((*oldpte & PTE_VALID) && oldrg->rg_shm != NULL) {
+				/* The same frame, still writeable by both. */
+				coremap_incref(*oldpte & PTE_FRAME);
+				*newpte = *oldpte;
+				new->as_rss++;
+				continue;
+			}
+			if (*oldpte & PTE_VALID) {
+				coremap_incref(*oldpte & PTE_FRAME);
+				*oldpte = (*oldpte | PTE_COW) & ~(pte_t)PTE_WRITE;
+				*newpte = *oldpte;
+				new->as_rss++;
+				continue;
+			}
+
+			/* Swapped out; the child gets its own copy now. */
+			paddr = coremap_alloc(1);
+			if (paddr == 0) {
+				result = ENOMEM;
+				goto fail;
+			}
+			result = swap_read(PTE_SLOT(*oldpte), paddr);
+			if (result) {
+				coremap_free(paddr);
+				goto fail;
+			}
+			*newpte = paddr | PTE_VALID | (*oldpte & PTE_DIRTY);
+			new->as_rss++;
+			if (newrg->rg_writeable &&
+			    (!newrg->rg_shared || (*newpte & PTE_DIRTY))) {
+				*newpte |= PTE_WRITE;
+			}
+			coremap_set_owner(paddr, new, va);
+		}
+	}
+
+	lock_release(new->as_lock);
+	lock_release(old->as_lock);
+
+	/*
+	 * The old address space may have writeable TLB entries for
+	 * pages that are now copy-on-write, on any cpu it has run on.
+	 */
+	vm_tlbshootdown_as(old);
+	if (old == curproc_getas()) {
+		as_activate();
+	}
+
+	*ret = new;
+	return 0;
+
+fail:
+	lock_release(new->as_lock);
+	lock_release(old->as_lock);
+	as_destroy(new);
+	return result;
+}
+
+/*
+ * True if some of the page at VADDR in RG comes from the backing file.
+ * Sets *START and *END to the part that does.
+ */
+static
+bool
+as_file_range(struct region *rg, vaddr_t vaddr, vaddr_t *start, vaddr_t *end)
+{
+	*start = vaddr;
+	if (*start < rg->rg_fvaddr) {
+		*start = rg->rg_fvaddr;
+	}
+	*end = vaddr + PAGE_SIZE;
+	if (*end > rg->rg_fvaddr + rg->rg_filesize) {
+		*end = rg->rg_fvaddr + rg->rg_filesize;
+	}
+	return *start < *end;
+}
+
+/*
+ * Whether the page at VADDR in RG is shared through the page cache,
+ * and if so, the page of the file it is (*OFFSET) and how many bytes
+ * of it come from the file (*LEN). Pages of read-only file regions
+ * are, as long as they start at a page boundary of the file.
+ */
+static
+bool
+as_cachekey(struct region *rg, vaddr_t vaddr, off_t *offset, size_t *len)
+{
+	vaddr_t start, end;
+
+	if (rg->rg_vnode == NULL || rg->rg_writeable ||
+	    !as_file_range(rg, vaddr, &start, &end) || start != vaddr) {
+		return false;
+	}
+	*offset = rg->rg_foffset + (vaddr - rg->rg_fvaddr);
+	*len = end - start;
+	return *offset % PAGE_SIZE == 0;
+}
+
+/*
+ * Fill in a freshly allocated frame for the page at VADDR in RG, which
+ * has at least some file bytes in it: read those, and zero the rest.
+ * *WHOLE is set to false if the file turned out to be short of them.
+ */
+static
+int
+as_fill_page(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	     paddr_t paddr, bool *whole)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t start, end;
+	char *kva;
+	int result;
+
+	if (!as_file_range(rg, vaddr, &start, &end)) {
+		panic("as_fill_page: 0x%x has no file bytes\n", vaddr);
+	}
+
+	kva = (char *)PADDR_TO_KVADDR(paddr);
+	bzero(kva, start - vaddr);
+	bzero(kva + (end - vaddr), vaddr + PAGE_SIZE - end);
+
+	(void)as;
+	KASSERT(rg->rg_vnode != NULL);
+	*whole = true;
+	uio_kinit(&iov, &ku, kva + (start - vaddr), end - start,
+		  rg->rg_foffset + (start - rg->rg_fvaddr), UIO_READ);
+	result = VOP_READ(rg->rg_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0 && rg->rg_mmap) {
+		/* The file has shrunk since it was mapped. */
+		bzero(kva + (end - vaddr) - ku.uio_resid, ku.uio_resid);
+		*whole = false;
+	}
+	else if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+/*
+ * Give the page whose entry is PTE a frame of its own, copying the
+ * shared one.
+ */
+static
+int
+as_unshare_page(pte_t *pte)
+{
+	paddr_t oldpaddr, newpaddr;
+
+	KASSERT(*pte & PTE_VALID);
+	KASSERT(*pte & PTE_COW);
+
+	oldpaddr = *pte & PTE_FRAME;
+	if (oldpaddr == coremap_zeropage()) {
+		newpaddr = coremap_alloc_zeroed();
+		if (newpaddr == 0) {
+			return ENOMEM;
+		}
+	}
+	else {
+		newpaddr = coremap_alloc(1);
+		if (newpaddr == 0) {
+			return ENOMEM;
+		}
+		memmove((void *)PADDR_TO_KVADDR(newpaddr),
+			(const void *)PADDR_TO_KVADDR(oldpaddr), PAGE_SIZE);
+	}
+	*pte = newpaddr | PTE_VALID;
+	coremap_free(oldpaddr);
+	return 0;
+}
+
+/*
+ * Enter the frame PADDR, just filled in from the file, in PTE as the
+ * page at VADDR in RG; or, if the page goes in the page cache, offer
+ * it to that and enter whichever frame the cache hands back,
+ * copy-on-write.
+ */
+static
+void
+as_enter_filled(struct region *rg, vaddr_t vaddr, pte_t *pte, paddr_t paddr)
+{
+	paddr_t shared;
+	off_t offset;
+	size_t len;
+
+	*pte = paddr | PTE_VALID;
+	if (as_cachekey(rg, vaddr, &offset, &len) &&
+	    pagecache_insert(rg->rg_vnode, offset, len, paddr, &shared)) {
+		if (shared != paddr) {
+			coremap_free(paddr);
+		}
+		*pte = shared | PTE_VALID | PTE_COW;
+	}
+}
+
+/*
+ * For the resident page at VADDR in RG, with entry PTE, touched by a
+ * fault of type FAULTTYPE: if its frame is not shared, decide whether
+ * it may be written, and make it evictable. as_lock held.
+ */
+static
+void
+as_enter_private(struct addrspace *as, struct region *rg, int faulttype,
+		 vaddr_t vaddr, pte_t *pte)
+{
+	if (*pte & PTE_COW) {
+		return;
+	}
+	if (rg->rg_shm != NULL) {
+		/* The segment's frame; never evicted or moved. */
+		if (rg->rg_writeable) {
+			*pte |= PTE_WRITE;
+		}
+		return;
+	}
+	if (rg->rg_writeable && !rg->rg_shared) {
+		*pte |= PTE_WRITE;
+	}
+	else if (rg->rg_writeable && faulttype != VM_FAULT_READ) {
+		/* Only let it be written once it counts as dirty. */
+		*pte |= PTE_WRITE | PTE_DIRTY;
+	}
+	coremap_set_owner(*pte & PTE_FRAME, as, vaddr);
+}
+
+/*
+ * After a fault has read the page at VADDR in RG from its file, read
+ * in up to AS_READAHEAD of the following pages too, as long as they
+ * are untouched and come from the file, with a single VOP_READ into
+ * frames of their own. Where a run of them reaches a page that is in
+ * the page cache, that is mapped instead and the run ends there. This is only a guess at what will be touched
+ * next, so it is given up quietly if memory is short or the read
+ * fails, and is not counted in the vmstats; the pages count as TLB
+ * reloads when they are touched. as_lock held.
+ */
+static
+void
+as_readahead(struct addrspace *as, struct region *rg, vaddr_t vaddr)
+{
+#if AS_READAHEAD > 0
+	struct iovec iov[AS_READAHEAD];
+	paddr_t paddr[AS_READAHEAD], cached;
+	pte_t *pte[AS_READAHEAD], *cachedpte;
+	struct uio ku;
+	vaddr_t va, start, end;
+	off_t offset;
+	size_t len;
+	unsigned n, k;
+	char *kva;
+	int result;
+
+	ku.uio_resid = 0;
+	cachedpte = NULL;
+	for (n = 0; n < AS_READAHEAD; n++) {
+		va = vaddr + (n + 1) * PAGE_SIZE;
+		if (va >= rg->rg_vbase + rg->rg_npages * PAGE_SIZE ||
+		    !as_file_range(rg, va, &start, &end)) {
+			break;
+		}
+		pte[n] = pt_lookup(as->as_pt, va, true);
+		if (pte[n] == NULL || *pte[n] != 0) {
+			break;
+		}
+		if (as_cachekey(rg, va, &offset, &len) &&
+		    pagecache_lookup(rg->rg_vnode, offset, len, &cached)) {
+			cachedpte = pte[n];
+			break;
+		}
+		paddr[n] = coremap_tryalloc();
+		if (paddr[n] == 0) {
+			break;
+		}
+
+		/* Every page after the first one starts at its base. */
+		KASSERT(n == 0 || start == va);
+		kva = (char *)PADDR_TO_KVADDR(paddr[n]);
+		bzero(kva + (end - va), va + PAGE_SIZE - end);
+		iov[n].iov_kbase = kva + (start - va);
+		iov[n].iov_len = end - start;
+		if (n == 0) {
+			ku.uio_offset = rg->rg_foffset +
+				(start - rg->rg_fvaddr);
+		}
+		ku.uio_resid += end - start;
+	}
+	if (cachedpte != NULL) {
+		*cachedpte = cached | PTE_VALID | PTE_COW;
+		as->as_rss++;
+	}
+	if (n == 0) {
+		return;
+	}
+
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_READ;
+	ku.uio_space = NULL;
+	ku.uio_direct = false;
+	result = VOP_READ(rg->rg_vnode, &ku);
+	if (result || ku.uio_resid != 0) {
+		/* Leave it to the faults, which will report it. */
+		for (k = 0; k < n; k++) {
+			coremap_free(paddr[k]);
+		}
+		return;
+	}
+
+	for (k = 0; k < n; k++) {
+		va = vaddr + (k + 1) * PAGE_SIZE;
+		as_enter_filled(rg, va, pte[k], paddr[k]);
+		as_enter_private(as, rg, VM_FAULT_READ, va, pte[k]);
+		as->as_rss++;
+	}
+#else
+	(void)as;
+	(void)rg;
+	(void)vaddr;
+#endif
+}
+
+/*
+ * After a fault has read the page at VADDR in RG back from swap slot
+ * SLOT on the disk, read in up to SWAP_CLUSTER - 1 of the following
+ * pages too, as long as they went out with it: that is, as long as
+ * they are in the slots after SLOT. They are mapped like those of
+ * as_readahead, and the same goes for the rest: memory is only taken
+ * if it is plentiful, and nothing is counted. as_lock held.
+ */
+static
+void
+as_swapahead(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	     unsigned slot)
+{
+	paddr_t paddr[SWAP_CLUSTER - 1];
+	pte_t *pte[SWAP_CLUSTER - 1];
+	vaddr_t va;
+	unsigned n, k;
+
+	for (n = 0; n < SWAP_CLUSTER - 1; n++) {
+		va = vaddr + (n + 1) * PAGE_SIZE;
+		if (va >= rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			break;
+		}
+		pte[n] = pt_lookup(as->as_pt, va, false);
+		if (pte[n] == NULL || (*pte[n] & ~(pte_t)PTE_DIRTY) !=
+		    PTE_MKSWAP(slot + n + 1)) {
+			break;
+		}
+		paddr[n] = coremap_tryalloc();
+		if (paddr[n] == 0) {
+			break;
+		}
+	}
+	if (n == 0) {
+		return;
+	}
+
+	if (swap_read_run(slot + 1, paddr, n)) {
+		/* Leave it to the faults, which will report it. */
+		for (k = 0; k < n; k++) {
+			coremap_free(paddr[k]);
+		}
+		return;
+	}
+	for (k = 0; k < n; k++) {
+		swap_free(slot + k + 1);
+		*pte[k] = paddr[k] | PTE_VALID | (*pte[k] & PTE_DIRTY);
+		as_enter_private(as, rg, VM_FAULT_READ,
+				 vaddr + (k + 1) * PAGE_SIZE, pte[k]);
+		as->as_rss++;
+	}
+}
+
+/* Flags for as_resolve. */
+#define AS_SHAREZERO  0x1	/* reads may get the shared zero page */
+#define AS_OVERWRITE  0x2	/* caller overwrites the whole page */
+#define AS_NOSTATS    0x4	/* not a TLB fault; leave vmstats alone */
+
+/*
+ * Count STAT for as_resolve, in the vmstats and as a minor or major
+ * fault of AS, unless FLAGS says not to.
+ */
+static
+void
+as_count(struct addrspace *as, int flags, unsigned stat)
+{
+	if (flags & AS_NOSTATS) {
+		return;
+	}
+	vmstats_inc(stat);
+	if (stat == VMSTAT_PAGE_FAULT_DISK) {
+		as->as_majflt++;
+	}
+	else if (stat == VMSTAT_TLB_RELOAD || stat == VMSTAT_PAGE_FAULT_ZERO) {
+		as->as_minflt++;
+	}
+}
+
+/*
+ * Make the page at VADDR in RG resident for a fault of type FAULTTYPE,
+ * given its page table entry PTE, and hand back its frame and whether
+ * it may be mapped writeable. With AS_SHAREZERO, a read of an untouched
+ * page with nothing from the file in it gets the shared zero page.
+ * With AS_OVERWRITE (a write), the old contents are not read in or
+ * copied at all, and the caller must fill the whole frame before
+ * letting go of as_lock. as_lock held.
+ */
+static
+int
+as_resolve(struct addrspace *as, struct region *rg, int faulttype,
+	   vaddr_t vaddr, pte_t *pte, int flags,
+	   paddr_t *ret_paddr, bool *ret_writeable)
+{
+	paddr_t paddr, zero;
+	vaddr_t start, end;
+	off_t offset;
+	size_t len;
+	bool wasvalid, whole, fresh, ondisk;
+	unsigned slot;
+	int result;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT((flags & AS_OVERWRITE) == 0 || faulttype != VM_FAULT_READ);
+
+	wasvalid = (*pte & PTE_VALID) != 0;
+	if (wasvalid) {
+		/* In use after all; as_enter_private marks it CME_REF. */
+		*pte &= ~(pte_t)PTE_AGED;
+		/*
+		 * The coremap keeps its own reference to the zero page,
+		 * so this never claims it.
+		 */
+		if ((*pte & PTE_COW) &&
+		    coremap_refcount(*pte & PTE_FRAME) == 1) {
+			/* Everyone else has let go already. */
+			*pte &= ~(pte_t)PTE_COW;
+		}
+		if (faulttype != VM_FAULT_READ && (*pte & PTE_COW) &&
+		    (flags & AS_OVERWRITE)) {
+			paddr = coremap_alloc(1);
+			if (paddr == 0) {
+				return ENOMEM;
+			}
+			coremap_free(*pte & PTE_FRAME);
+			*pte = paddr | PTE_VALID | (*pte & PTE_DIRTY);
+		}
+		else if (faulttype != VM_FAULT_READ && (*pte & PTE_COW)) {
+			result = as_unshare_page(pte);
+			if (result) {
+				return result;
+			}
+		}
+		if (faulttype != VM_FAULT_READONLY) {
+			/* Resident already; it just fell out of the TLB. */
+			as_count(as, flags, VMSTAT_TLB_RELOAD);
+		}
+	}
+	else if (rg->rg_shm != NULL) {
+		/* Untouched by us; maybe not by the other attachers either. */
+		result = shm_getpage(rg->rg_shm,
+				     (vaddr - rg->rg_vbase) / PAGE_SIZE,
+				     &paddr, &fresh);
+		if (result) {
+			return result;
+		}
+		*pte = paddr | PTE_VALID;
+		as_count(as, flags, fresh ? VMSTAT_PAGE_FAULT_ZERO
+				   : VMSTAT_TLB_RELOAD);
+	}
+	else if (flags & AS_OVERWRITE) {
+		paddr = coremap_alloc(1);
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		if (*pte & PTE_SWAPPED) {
+			swap_free(PTE_SLOT(*pte));
+		}
+		*pte = paddr | PTE_VALID;
+	}
+	else if (*pte & PTE_SWAPPED) {
+		paddr = coremap_alloc(1);
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		slot = PTE_SLOT(*pte);
+		ondisk = swap_ondisk(slot);
+		result = swap_read(slot, paddr);
+		if (result) {
+			coremap_free(paddr);
+			return result;
+		}
+		swap_free(slot);
+		*pte = paddr | PTE_VALID | (*pte & PTE_DIRTY);
+		if (ondisk) {
+			as_count(as, flags, VMSTAT_PAGE_FAULT_DISK);
+			as_count(as, flags, VMSTAT_SWAP_FILE_READ);
+			as_swapahead(as, rg, vaddr, slot);
+		}
+		else {
+			/* Only decompressed, out of the pool. */
+			as_count(as, flags, VMSTAT_TLB_RELOAD);
+		}
+	}
+	else if (as_cachekey(rg, vaddr, &offset, &len) &&
+		 pagecache_lookup(rg->rg_vnode, offset, len, &paddr)) {
+		/* Somebody read it in already; no I/O, just a mapping. */
+		*pte = paddr | PTE_VALID | PTE_COW;
+		as_count(as, flags, VMSTAT_TLB_RELOAD);
+	}
+	else if (as_file_range(rg, vaddr, &start, &end)) {
+		paddr = coremap_alloc(1);
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		result = as_fill_page(as, rg, vaddr, paddr, &whole);
+		if (result) {
+			coremap_free(paddr);
+			return result;
+		}
+		if (whole) {
+			as_enter_filled(rg, vaddr, pte, paddr);
+		}
+		else {
+			*pte = paddr | PTE_VALID;
+		}
+		as_count(as, flags, VMSTAT_PAGE_FAULT_DISK);
+		if (!rg->rg_mmap) {
+			as_count(as, flags, VMSTAT_ELF_FILE_READ);
+		}
+		as_readahead(as, rg, vaddr);
+	}
+	else {
+		zero = coremap_zeropage();
+		if ((flags & AS_SHAREZERO) && faulttype == VM_FAULT_READ &&
+		    coremap_tryincref(zero)) {
+			*pte = zero | PTE_VALID | PTE_COW;
+		}
+		else {
+			paddr = coremap_alloc_zeroed();
+			if (paddr == 0) {
+				return ENOMEM;
+			}
+			*pte = paddr | PTE_VALID;
+		}
+		as_count(as, flags, VMSTAT_PAGE_FAULT_ZERO);
+	}
+
+	as_enter_private(as, rg, faulttype, vaddr, pte);
+	if (!wasvalid) {
+		as->as_rss++;
+	}
+	*ret_paddr = *pte & PTE_FRAME;
+	*ret_writeable = (*pte & PTE_WRITE) != 0;
+	return 0;
+}
+
+int
+as_fault(struct addrspace *as, int faulttype, vaddr_t vaddr,
+	 paddr_t *ret_paddr, bool *ret_writeable)
+{
+	struct region *rg;
+	pte_t *pte;
+	int result;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	lock_acquire(as->as_lock);
+
+	rg = as_find_or_grow(as, vaddr);
+	if (rg == NULL ||
+	    (faulttype != VM_FAULT_READ && !rg->rg_writeable)) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, vaddr, true);
+	if (pte == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	result = as_resolve(as, rg, faulttype, vaddr, pte, AS_SHAREZERO,
+			    ret_paddr, ret_writeable);
+	if (result) {
+		lock_release(as->as_lock);
+		return result;
+	}
+
+	/* Success: the caller loads the mapping and releases as_lock. */
+	return 0;
+}
+
+int
+as_prefault(struct addrspace *as, vaddr_t faultvaddr, vaddr_t vaddr,
+	    paddr_t *ret_paddr, bool *ret_writeable)
+{
+	struct region *rg;
+	pte_t *pte;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL || rg != as_find_region(as, faultvaddr)) {
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, vaddr, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+	if (*pte & PTE_VALID) {
+		/* The refill handler will take care of it. */
+		return EEXIST;
+	}
+
+	/*
+	 * Sequential runs of untouched pages are usually being written,
+	 * so don't hand out the zero page just to copy it straight away.
+	 */
+	return as_resolve(as, rg, VM_FAULT_READ, vaddr, pte, 0,
+			  ret_paddr, ret_writeable);
+}
+
+int
+as_copypage(struct addrspace *as, vaddr_t uaddr, void *kbuf, size_t len,
+	    bool touser)
+{
+	struct region *rg;
+	pte_t *pte, oldpte;
+	paddr_t paddr;
+	bool writeable;
+	char *kva;
+	int flags, result;
+
+	KASSERT(len > 0 && len <= PAGE_SIZE);
+	KASSERT((uaddr & PAGE_FRAME) == ((uaddr + len - 1) & PAGE_FRAME));
+
+	flags = AS_NOSTATS;
+	if (touser && len == PAGE_SIZE) {
+		flags |= AS_OVERWRITE;
+	}
+	else if (!touser) {
+		flags |= AS_SHAREZERO;
+	}
+
+	lock_acquire(as->as_lock);
+	rg = as_find_or_grow(as, uaddr & PAGE_FRAME);
+	if (rg == NULL || (touser && !rg->rg_writeable)) {
+		lock_release(as->as_lock);
+		return EFAULT;
+	}
+	pte = pt_lookup(as->as_pt, uaddr & PAGE_FRAME, true);
+	if (pte == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+	oldpte = *pte;
+	result = as_resolve(as, rg, touser ? VM_FAULT_WRITE : VM_FAULT_READ,
+			    uaddr & PAGE_FRAME, pte, flags, &paddr, &writeable);
+	if (result) {
+		lock_release(as->as_lock);
+		return result;
+	}
+
+	kva = (char *)PADDR_TO_KVADDR(paddr) + (uaddr & ~(vaddr_t)PAGE_FRAME);
+	if (touser) {
+		memmove(kva, kbuf, len);
+	}
+	else {
+		memmove(kbuf, kva, len);
+	}
+
+	if ((oldpte & PTE_VALID) && (oldpte & PTE_FRAME) != paddr) {
+		/* Copied on write; the TLB may still have the old frame. */
+		vm_tlbshootdown_page(as, uaddr & PAGE_FRAME);
+	}
+	lock_release(as->as_lock);
+	return 0;
+}
+
+int
+as_prefill(struct addrspace *as, unsigned maxpages)
+{
+	struct region *rg;
+	pte_t *pte;
+	paddr_t paddr;
+	vaddr_t va, end;
+	bool writeable;
+	unsigned i, n;
+	int result;
+
+	lock_acquire(as->as_lock);
+
+	n = 0;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vnode != NULL && rg->rg_filesize > 0) {
+			end = ROUNDUP(rg->rg_fvaddr + rg->rg_filesize,
+				      PAGE_SIZE);
+			n += (end - (rg->rg_fvaddr & PAGE_FRAME)) / PAGE_SIZE;
+		}
+	}
+	if (n > maxpages) {
+		lock_release(as->as_lock);
+		return E2BIG;
+	}
+
+	result = 0;
+	for (i = 0; i < array_num(as->as_regions) && result == 0; i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vnode == NULL) {
+			continue;
+		}
+		end = rg->rg_fvaddr + rg->rg_filesize;
+		for (va = rg->rg_fvaddr & PAGE_FRAME; va < end;
+		     va += PAGE_SIZE) {
+			pte = pt_lookup(as->as_pt, va, true);
+			if (pte == NULL) {
+				result = ENOMEM;
+				break;
+			}
+			if (*pte & PTE_VALID) {
+				/* Read ahead with an earlier page. */
+				continue;
+			}
+			result = as_resolve(as, rg, VM_FAULT_READ, va, pte,
+					    AS_NOSTATS, &paddr, &writeable);
+			if (result) {
+				break;
+			}
+		}
+	}
+
+	lock_release(as->as_lock);
+	return result;
+}
+
+bool
+as_evict_next(struct addrspace *as, vaddr_t vaddr, paddr_t *ret_paddr)
+{
+	struct region *rg;
+	pte_t *pte;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL || vaddr + PAGE_SIZE >= rg->rg_vbase +
+	    rg->rg_npages * PAGE_SIZE) {
+		return false;
+	}
+	pte = pt_lookup(as->as_pt, vaddr + PAGE_SIZE, false);
+	if (pte == NULL || (*pte & (PTE_VALID | PTE_COW)) != PTE_VALID ||
+	    rg->rg_shm != NULL) {
+		return false;
+	}
+	*ret_paddr = *pte & PTE_FRAME;
+	return true;
+}
+
+int
+as_evict(struct addrspace *as, const vaddr_t *vaddrs, const paddr_t *paddrs,
+	 unsigned n)
+{
+	struct region *rg;
+	pte_t *pte[SWAP_CLUSTER], oldpte[SWAP_CLUSTER];
+	paddr_t wpaddrs[SWAP_CLUSTER];
+	unsigned i, nwrite, slot;
+	int result;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT(n >= 1 && n <= SWAP_CLUSTER);
+
+	rg = as_find_region(as, vaddrs[0]);
+	KASSERT(rg != NULL);
+
+	nwrite = 0;
+	for (i = 0; i < n; i++) {
+		KASSERT(i == 0 || vaddrs[i] == vaddrs[i - 1] + PAGE_SIZE);
+		KASSERT(vaddrs[i] < rg->rg_vbase + rg->rg_npages * PAGE_SIZE);
+		pte[i] = pt_lookup(as->as_pt, vaddrs[i], false);
+		KASSERT(pte[i] != NULL);
+		KASSERT((*pte[i] & (PTE_VALID | PTE_COW)) == PTE_VALID);
+		KASSERT((*pte[i] & PTE_FRAME) == paddrs[i]);
+		oldpte[i] = *pte[i];
+		/*
+		 * Pages never written since they were filled in can just
+		 * be filled in again; the rest go to swap.
+		 */
+		if (rg->rg_writeable &&
+		    (!rg->rg_shared || (*pte[i] & PTE_DIRTY))) {
+			wpaddrs[nwrite++] = paddrs[i];
+		}
+	}
+
+	slot = 0;
+	if (nwrite > 0) {
+		/* In a row, so that they go out and come back together. */
+		result = swap_alloc_run(nwrite, &slot);
+		if (result) {
+			return result;
+		}
+	}
+
+	/*
+	 * Unmap them before writing them out so that nobody can change
+	 * them underneath us. A fault on one meanwhile waits for as_lock.
+	 */
+	for (i = 0; i < n; i++) {
+		*pte[i] = 0;
+	}
+	vm_tlbshootdown_pages(as, vaddrs, n);
+
+	if (nwrite > 0) {
+		result = swap_write_run(slot, wpaddrs, nwrite);
+		if (result) {
+			for (i = 0; i < nwrite; i++) {
+				swap_free(slot + i);
+			}
+			for (i = 0; i < n; i++) {
+				*pte[i] = oldpte[i];
+			}
+			return result;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (rg->rg_writeable &&
+		    (!rg->rg_shared || (oldpte[i] & PTE_DIRTY))) {
+			*pte[i] = PTE_MKSWAP(slot) | (oldpte[i] & PTE_DIRTY);
+			slot++;
+		}
+	}
+	as->as_rss -= n;
+	return 0;
+}
+
+void
+as_migrate(struct addrspace *as, vaddr_t vaddr, paddr_t oldpaddr,
+	   paddr_t newpaddr)
+{
+	pte_t *pte, oldpte;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & (PTE_VALID | PTE_COW)) == PTE_VALID);
+	KASSERT((*pte & PTE_FRAME) == oldpaddr);
+
+	/* As in as_evict, nobody may write it while it is copied. */
+	oldpte = *pte;
+	*pte = 0;
+	vm_tlbshootdown_page(as, vaddr);
+
+	memmove((void *)PADDR_TO_KVADDR(newpaddr),
+		(const void *)PADDR_TO_KVADDR(oldpaddr), PAGE_SIZE);
+	*pte = newpaddr | (oldpte & ~(pte_t)PTE_FRAME);
+}
+
+/*
+ * Start a new working set count if the ager has begun another sweep
+ * since AS last counted one. as_lock held.
+ */
+static
+void
+as_wsroll(struct addrspace *as, unsigned gen)
+{
+	if (as->as_wsgen == gen) {
+		return;
+	}
+	/* A count from further back than the last sweep is out of date. */
+	as->as_wsprev = as->as_wsgen + 1 == gen ? as->as_wscur : 0;
+	as->as_wscur = 0;
+	as->as_wsgen = gen;
+}
+
+bool
+as_age(struct addrspace *as, vaddr_t vaddr, paddr_t paddr)
+{
+	pte_t *pte;
+	bool used;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & (PTE_VALID | PTE_COW)) == PTE_VALID);
+	KASSERT((*pte & PTE_FRAME) == paddr);
+
+	as_wsroll(as, coremap_agegen());
+	used = (*pte & PTE_AGED) == 0;
+	if (used) {
+		as->as_wscur++;
+		*pte |= PTE_AGED;
+	}
+	return used;
+}
+
+unsigned
+as_wss(struct addrspace *as)
+{
+	unsigned gen = coremap_agegen();
+
+	/* Unlocked: a snapshot, like as_rss. */
+	if (as->as_wsgen == gen) {
+		return as->as_wsprev;
+	}
+	if (as->as_wsgen + 1 == gen) {
+		return as->as_wscur;
+	}
+	return 0;
+}
+
+/*
+ * Release the frames and swap slots of the NPAGES pages at VBASE,
+ * leaving them untouched. The caller flushes the TLB. as_lock held.
+ */
+static
+void
+as_free_pages(struct addrspace *as, vaddr_t vbase, size_t npages)
+{
+	vaddr_t va;
+	pte_t *pte;
+	size_t j;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	for (j = 0; j < npages; j++) {
+		va = vbase + j * PAGE_SIZE;
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL) {
+			continue;
+		}
+		if (*pte & PTE_VALID) {
+			coremap_free(*pte & PTE_FRAME);
+			as->as_rss--;
+		}
+		else if (*pte & PTE_SWAPPED) {
+			swap_free(PTE_SLOT(*pte));
+		}
+		*pte = 0;
+	}
+}
+
+/*
+ * Write the dirty pages of the shared file mapping RG back to its
+ * file. Each page is copied into a frame of our own first, since the
+ * writes may allocate memory, and the page could be evicted while
+ * we write from it. as_lock held.
+ */
+static
+int
+as_sync_region(struct addrspace *as, struct region *rg)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t va, start, end;
+	paddr_t buf;
+	pte_t *pte;
+	char *kva;
+	size_t j;
+	int result;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+	KASSERT(rg->rg_shared && rg->rg_vnode != NULL);
+
+	buf = coremap_alloc(1);
+	if (buf == 0) {
+		return ENOMEM;
+	}
+	kva = (char *)PADDR_TO_KVADDR(buf);
+
+	result = 0;
+	for (j = 0; j < rg->rg_npages && result == 0; j++) {
+		va = rg->rg_vbase + j * PAGE_SIZE;
+		if (!as_file_range(rg, va, &start, &end)) {
+			continue;
+		}
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL || (*pte & PTE_DIRTY) == 0) {
+			continue;
+		}
+		if (*pte & PTE_VALID) {
+			memmove(kva, (const void *)PADDR_TO_KVADDR(*pte & PTE_FRAME),
+				PAGE_SIZE);
+		}
+		else {
+			KASSERT(*pte & PTE_SWAPPED);
+			result = swap_read(PTE_SLOT(*pte), buf);
+			if (result) {
+				break;
+			}
+		}
+
+		/* Only the part that came from the file goes back. */
+		uio_kinit(&iov, &ku, kva + (start - va), end - start,
+			  rg->rg_foffset + (start - rg->rg_fvaddr), UIO_WRITE);
+		result = VOP_WRITE(rg->rg_vnode, &ku);
+		if (result == 0) {
+			*pte &= ~(pte_t)PTE_DIRTY;
+		}
+	}
+
+	coremap_free(buf);
+	return result;
+}
+
+/*
+ * Take out region I, dropping its pages, and free it once no TLB can
+ * map it any more. Called with as_lock held, which it releases.
+ */
+static
+void
+as_remove_region(struct addrspace *as, unsigned i)
+{
+	struct region *rg;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	rg = array_get(as->as_regions, i);
+	as_free_pages(as, rg->rg_vbase, rg->rg_npages);
+	array_remove(as->as_regions, i);
+	as->as_lasthit = NULL;
+	lock_release(as->as_lock);
+
+	/*
+	 * Other threads of the process may be running on other cpus;
+	 * vm_tlbshootdown_as waits until they have dropped the stale
+	 * TLB entries too.
+	 */
+	vm_tlbshootdown_as(as);
+	as_activate();
+
+	as_free_region(rg);
+}
+
+/*
+ * Find NPAGES of unused address space for as_mmap or as_shmat,
+ * starting at a multiple of ALIGN, as high up under the stack as
+ * possible.
+ */
+static
+int
+as_find_gap(struct addrspace *as, size_t npages, vaddr_t align,
+	    vaddr_t *ret)
+{
+	struct region *rg;
+	vaddr_t base;
+	unsigned i;
+
+	if (npages >= VM_MMAPTOP / PAGE_SIZE) {
+		return ENOMEM;
+	}
+	base = (VM_MMAPTOP - npages * PAGE_SIZE) & ~(align - 1);
+
+	/* Down through the regions, which are sorted, from the top. */
+	for (i = array_num(as->as_regions); i-- > 0; ) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vbase >= base + npages * PAGE_SIZE) {
+			/* Above it. */
+			continue;
+		}
+		if (rg->rg_vbase + rg->rg_npages * PAGE_SIZE <= base) {
+			/* Below it, and so is everything else. */
+			break;
+		}
+		/* In the way; try just below it. */
+		if (rg->rg_vbase < (npages + 1) * PAGE_SIZE ||
+		    ((rg->rg_vbase - npages * PAGE_SIZE) & ~(align - 1)) == 0) {
+			return ENOMEM;
+		}
+		base = (rg->rg_vbase - npages * PAGE_SIZE) & ~(align - 1);
+	}
+
+	*ret = base;
+	return 0;
+}
+
+int
+as_mmap(struct addrspace *as, size_t len, vaddr_t align, bool writeable,
+	struct vnode *v, off_t offset, bool shared, vaddr_t *ret)
+{
+	struct region *rg;
+	struct stat st;
+	size_t npages, filesize;
+	vaddr_t base;
+	int result;
+
+	if (len == 0 || (offset & ~(off_t)PAGE_FRAME) != 0 || offset < 0) {
+		return EINVAL;
+	}
+	if (len > VM_MMAPTOP) {
+		return ENOMEM;
+	}
+	if (align < PAGE_SIZE) {
+		align = PAGE_SIZE;
+	}
+	KASSERT((align & (align - 1)) == 0);
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+
+	filesize = 0;
+	if (v != NULL) {
+		result = VOP_MMAP(v, writeable && shared);
+		if (result) {
+			return result;
+		}
+		result = VOP_STAT(v, &st);
+		if (result) {
+			return result;
+		}
+		if (st.st_size > offset) {
+			filesize = st.st_size - offset < (off_t)len ?
+				st.st_size - offset : len;
+		}
+	}
+
+	/* Regions only change under as_lock, for the evictor's sake. */
+	lock_acquire(as->as_lock);
+	result = as_find_gap(as, npages, align, &base);
+	if (result == 0) {
+		result = as_add_region(as, base, npages, writeable, &rg);
+	}
+	if (result) {
+		lock_release(as->as_lock);
+		return result;
+	}
+	rg->rg_mmap = true;
+	if (v != NULL) {
+		VOP_INCREF(v);
+		rg->rg_vnode = v;
+		rg->rg_foffset = offset;
+		rg->rg_filesize = filesize;
+		rg->rg_shared = shared && writeable;
+	}
+	lock_release(as->as_lock);
+
+	*ret = base;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg;
+	unsigned i;
+	int result;
+
+	if ((vaddr & ~(vaddr_t)PAGE_FRAME) != 0 || len == 0 ||
+	    len > USERSPACETOP) {
+		return EINVAL;
+	}
+
+	rg = NULL;
+	lock_acquire(as->as_lock);
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vbase == vaddr) {
+			break;
+		}
+	}
+	if (rg == NULL || i == array_num(as->as_regions) || !rg->rg_mmap ||
+	    rg->rg_npages != DIVROUNDUP(len, PAGE_SIZE)) {
+		/* Only whole mappings can be unmapped. */
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+
+	if (rg->rg_shared) {
+		result = as_sync_region(as, rg);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+	}
+
+	as_remove_region(as, i);
+	return 0;
+}
+
+int
+as_shmat(struct addrspace *as, struct shmseg *seg, bool writeable,
+	 vaddr_t *ret)
+{
+	struct region *rg;
+	size_t npages;
+	vaddr_t base;
+	int result;
+
+	npages = shm_npages(seg);
+	lock_acquire(as->as_lock);
+	result = as_find_gap(as, npages, PAGE_SIZE, &base);
+	if (result == 0) {
+		result = as_add_region(as, base, npages, writeable, &rg);
+	}
+	if (result) {
+		lock_release(as->as_lock);
+		return result;
+	}
+	rg->rg_shm = seg;
+	lock_release(as->as_lock);
+
+	*ret = base;
+	return 0;
+}
+
+int
+as_shmdt(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	unsigned i;
+
+	lock_acquire(as->as_lock);
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vbase == vaddr && rg->rg_shm != NULL) {
+			as_remove_region(as, i);
+			return 0;
+		}
+	}
+	lock_release(as->as_lock);
+	return EINVAL;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *ret)
+{
+	struct region *rg, *heap, *dead;
+	vaddr_t oldbrk, newbrk, oldend, newend;
+	unsigned i, heapi;
+	int result;
+
+	lock_acquire(as->as_lock);
+	oldbrk = as->as_brk;
+	/* The heap may not go past VM_MMAPTOP, into the stack's space. */
+	if (amount < 0 ? -(vaddr_t)amount > oldbrk - as->as_heapbase
+		       : (vaddr_t)amount > VM_MMAPTOP - oldbrk) {
+		lock_release(as->as_lock);
+		return amount < 0 ? EINVAL : ENOMEM;
+	}
+	newbrk = oldbrk + amount;
+	oldend = ROUNDUP(oldbrk, PAGE_SIZE);
+	newend = ROUNDUP(newbrk, PAGE_SIZE);
+
+	heap = NULL;
+	heapi = 0;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_heap) {
+			heap = rg;
+			heapi = i;
+		}
+		else if (newend > oldend && rg->rg_vbase < newend &&
+			 oldend < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			/* Would grow into the stack or an mmap. */
+			lock_release(as->as_lock);
+			return ENOMEM;
+		}
+	}
+	KASSERT(heap != NULL || oldend == as->as_heapbase);
+
+	if (newend > oldend && heap == NULL) {
+		result = as_add_region(as, as->as_heapbase,
+				       (newend - as->as_heapbase) / PAGE_SIZE,
+				       true, &heap);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+		heap->rg_heap = true;
+	}
+	else if (newend > oldend) {
+		heap->rg_npages = (newend - as->as_heapbase) / PAGE_SIZE;
+	}
+	dead = NULL;
+	if (newend < oldend) {
+		as_free_pages(as, newend, (oldend - newend) / PAGE_SIZE);
+		heap->rg_npages = (newend - as->as_heapbase) / PAGE_SIZE;
+		if (heap->rg_npages == 0) {
+			array_remove(as->as_regions, heapi);
+			as->as_lasthit = NULL;
+			dead = heap;
+		}
+	}
+	as->as_brk = newbrk;
+	lock_release(as->as_lock);
+
+	if (newend < oldend) {
+		/* As in as_munmap, on every cpu running AS. */
+		vm_tlbshootdown_as(as);
+		as_activate();
+	}
+	if (dead != NULL) {
+		as_free_region(dead);
+	}
+
+	*ret = oldbrk;
+	return 0;
+}
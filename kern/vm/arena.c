@@ -0,0 +1,105 @@
+/*
+ * Arenas. See arena.h for the interface.
+ *
+ * A chunk is a struct arena_chunk header followed by its memory. The
+ * chunks of an arena are linked from newest to oldest; only the newest
+ * has room left that anyone will use, since a request that does not
+ * fit starts a new chunk rather than going back to an older one.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <arena.h>
+
+struct arena_chunk {
+	struct arena_chunk *ac_prev;	/* next older chunk */
+	size_t ac_size;			/* bytes after the header */
+};
+
+/* Everything is handed out in multiples of this, for alignment. */
+#define ARENA_ALIGN 8
+
+#define ARENA_HDR ROUNDUP(sizeof(struct arena_chunk), ARENA_ALIGN)
+
+/* Room in a page-sized chunk. */
+#define ARENA_CHUNKROOM (PAGE_SIZE - ARENA_HDR)
+
+void
+arena_init(struct arena *a)
+{
+	a->a_chunk = NULL;
+	a->a_used = 0;
+	a->a_spare = NULL;
+}
+
+void
+arena_cleanup(struct arena *a)
+{
+	struct arena_mark empty;
+
+	empty.am_chunk = NULL;
+	empty.am_used = 0;
+	arena_release(a, &empty);
+	kfree(a->a_spare);
+	a->a_spare = NULL;
+}
+
+void *
+arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_chunk *ac;
+	size_t room;
+	void *ret;
+
+	size = ROUNDUP(size, ARENA_ALIGN);
+
+	if (a->a_chunk == NULL || a->a_chunk->ac_size - a->a_used < size) {
+		if (size <= ARENA_CHUNKROOM && a->a_spare != NULL) {
+			ac = a->a_spare;
+			a->a_spare = NULL;
+		}
+		else {
+			room = size > ARENA_CHUNKROOM ? size : ARENA_CHUNKROOM;
+			ac = kmalloc(ARENA_HDR + room);
+			if (ac == NULL) {
+				return NULL;
+			}
+			ac->ac_size = room;
+		}
+		ac->ac_prev = a->a_chunk;
+		a->a_chunk = ac;
+		a->a_used = 0;
+	}
+
+	ret = (char *)a->a_chunk + ARENA_HDR + a->a_used;
+	a->a_used += size;
+	return ret;
+}
+
+void
+arena_mark(struct arena *a, struct arena_mark *mark)
+{
+	mark->am_chunk = a->a_chunk;
+	mark->am_used = a->a_used;
+}
+
+void
+arena_release(struct arena *a, const struct arena_mark *mark)
+{
+	struct arena_chunk *ac;
+
+	while (a->a_chunk != mark->am_chunk) {
+		KASSERT(a->a_chunk != NULL);
+		ac = a->a_chunk;
+		a->a_chunk = ac->ac_prev;
+		if (a->a_spare == NULL && ac->ac_size == ARENA_CHUNKROOM) {
+			a->a_spare = ac;
+		}
+		else {
+			kfree(ac);
+		}
+	}
+	KASSERT(a->a_chunk == NULL || mark->am_used <= a->a_used);
+	a->a_used = mark->am_used;
+}
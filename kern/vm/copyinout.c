@@ -84,6 +84,12 @@
  * To make use of this code, in addition to tm_badfaultfunc the
  * thread_machdep structure should contain a jmp_buf called
  * "tm_copyjmp".
+ *
+ * The copies themselves move a word at a time wherever source and
+ * destination are aligned alike, which is the usual case for both
+ * buffers and strings; only the unaligned ends go by bytes. A 32-bit
+ * word never straddles a page, so reading a whole word of a string
+ * whose end is in it cannot fault where the bytewise loop would not.
  */
 
 /*
@@ -142,12 +148,56 @@ copycheck(const_userptr_t userptr, size_t len, size_t *stoplen)
 	return 0;
 }
 
+/*
+ * Block copy for copyin and copyout. Unlike memcpy, which only goes by
+ * words when both pointers and the length are all word-aligned, this
+ * copies the unaligned head and tail by bytes and the middle by words,
+ * four at a time, as long as SRC and DEST are aligned alike.
+ */
+static
+void
+copyblock(void *dest, const void *src, size_t len)
+{
+	char *d = dest;
+	const char *s = src;
+	uint32_t *dw;
+	const uint32_t *sw;
+
+	if (((uintptr_t)d ^ (uintptr_t)s) % sizeof(uint32_t) == 0) {
+		while (len > 0 && (uintptr_t)d % sizeof(uint32_t) != 0) {
+			*d++ = *s++;
+			len--;
+		}
+		dw = (uint32_t *)d;
+		sw = (const uint32_t *)s;
+		while (len >= 4 * sizeof(uint32_t)) {
+			dw[0] = sw[0];
+			dw[1] = sw[1];
+			dw[2] = sw[2];
+			dw[3] = sw[3];
+			dw += 4;
+			sw += 4;
+			len -= 4 * sizeof(uint32_t);
+		}
+		while (len >= sizeof(uint32_t)) {
+			*dw++ = *sw++;
+			len -= sizeof(uint32_t);
+		}
+		d = (char *)dw;
+		s = (const char *)sw;
+	}
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
+	}
+}
+
 /*
  * copyin
  *
  * Copy a block of memory of length LEN from user-level address USERSRC 
- * to kernel address DEST. We can use memcpy because it's protected by
- * the tm_badfaultfunc/copyfail logic.
+ * to kernel address DEST. We can use copyblock because it's protected
+ * by the tm_badfaultfunc/copyfail logic.
  */
 int
 copyin(const_userptr_t usersrc, void *dest, size_t len)
@@ -172,7 +222,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy(dest, (const void *)usersrc, len);
+	copyblock(dest, (const void *)usersrc, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -182,7 +232,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
  * copyout
  *
  * Copy a block of memory of length LEN from kernel address SRC to
- * user-level address USERDEST. We can use memcpy because it's
+ * user-level address USERDEST. We can use copyblock because it's
  * protected by the tm_badfaultfunc/copyfail logic.
  */
 int
@@ -208,7 +258,7 @@ copyout(const void *src, userptr_t userdest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy((void *)userdest, src, len);
+	copyblock((void *)userdest, src, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -230,14 +280,43 @@ copyout(const void *src, userptr_t userdest, size_t len)
  * userspace. Thus in the latter case we return EFAULT, not 
  * ENAMETOOLONG.
  */
+/* Nonzero if some byte of the word W is zero. */
+#define HASZERO(w) (((w) - 0x01010101U) & ~(w) & 0x80808080U)
+
 static
 int
 copystr(char *dest, const char *src, size_t maxlen, size_t stoplen,
 	size_t *gotlen)
 {
 	size_t i;
+	uint32_t w;
+
+	i = 0;
+	if (((uintptr_t)dest ^ (uintptr_t)src) % sizeof(uint32_t) == 0) {
+		/* Bytes up to alignment, then whole words without a 0. */
+		for (; i<maxlen && i<stoplen &&
+			     (uintptr_t)(src+i) % sizeof(uint32_t) != 0; i++) {
+			dest[i] = src[i];
+			if (src[i] == 0) {
+				if (gotlen != NULL) {
+					*gotlen = i+1;
+				}
+				return 0;
+			}
+		}
+		while (i + sizeof(uint32_t) <= maxlen &&
+		       i + sizeof(uint32_t) <= stoplen) {
+			w = *(const uint32_t *)(src+i);
+			if (HASZERO(w)) {
+				break;
+			}
+			*(uint32_t *)(dest+i) = w;
+			i += sizeof(uint32_t);
+		}
+	}
 
-	for (i=0; i<maxlen && i<stoplen; i++) {
+	/* The rest, including the word with the terminator, by bytes. */
+	for (; i<maxlen && i<stoplen; i++) {
 		dest[i] = src[i];
 		if (src[i] == 0) {
 			if (gotlen != NULL) {
@@ -319,3 +398,51 @@ copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *actual)
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return result;
 }
+
+/*
+ * copyinptrs
+ *
+ * Copy a null-terminated array of user pointers, such as execv's argv,
+ * from user-level address USERSRC to DEST, which has room for MAX
+ * entries, all under a single tm_badfaultfunc/copyfail guard. The
+ * null entry is copied too. COUNT gets the number of entries before
+ * it. Fails with E2BIG if there is no null in the first MAX entries.
+ */
+int
+copyinptrs(const_userptr_t usersrc, userptr_t *dest, size_t max,
+	   size_t *count)
+{
+	const userptr_t *src;
+	size_t i, stoplen;
+	int result;
+
+	if ((vaddr_t)usersrc % sizeof(userptr_t) != 0) {
+		return EFAULT;
+	}
+	result = copycheck(usersrc, max * sizeof(userptr_t), &stoplen);
+	if (result) {
+		return result;
+	}
+	stoplen /= sizeof(userptr_t);
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	src = (const userptr_t *)usersrc;
+	for (i=0; i<max && i<stoplen; i++) {
+		dest[i] = src[i];
+		if (src[i] == NULL) {
+			curthread->t_machdep.tm_badfaultfunc = NULL;
+			*count = i;
+			return 0;
+		}
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return stoplen < max ? EFAULT : E2BIG;
+}
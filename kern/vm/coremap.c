@@ -0,0 +1,1458 @@
+/*
+ * Physical frame allocator. See coremap.h for the interface.
+ *
+ * The coremap itself lives in the first few pages of the memory handed
+ * to us by ram_getsize. Frame numbers are relative to the first page
+ * after the coremap, so buddy blocks are naturally aligned on frame
+ * numbers and the buddy of block B of order K is B ^ (1 << K).
+ *
+ * Each free block is represented by its first frame, which carries
+ * CME_FREE and the block order and is linked onto freelists[order].
+ * The remaining frames of a free block carry no flags. Each allocated
+ * run is represented by its first frame, which carries CME_HEAD and
+ * the run length.
+ *
+ * Single frames are also cached per cpu in struct cpu's c_pagecache,
+ * so the common alloc_kpages(1)/free_kpages pair does not touch
+ * coremap_lock at all. A cache is refilled from and drained to the
+ * buddy lists CM_PCPU_BATCH frames at a time under one acquisition of
+ * coremap_lock. Frames sitting in a cache carry CME_CACHED. A cache is
+ * only touched by its own cpu with interrupts off, which also keeps
+ * the thread from migrating while it looks at curcpu.
+ *
+ * Single-frame runs may be shared between address spaces for
+ * copy-on-write; the head entry counts the owners and coremap_free
+ * only releases the frame when the last one lets go. Reference counts
+ * above one are only changed with coremap_lock held. A count of one
+ * belongs to the caller alone and nobody else can raise it.
+ *
+ * A user page that is mapped by exactly one address space records that
+ * address space and its virtual address (coremap_set_owner), which is
+ * what makes it a candidate for eviction. When coremap_alloc runs out
+ * of single frames it sweeps a clock hand over the owned frames, giving
+ * each one that has been faulted on since the last sweep (CME_REF) a
+ * second chance, and has as_evict push the first cold one out to swap.
+ * The owner's as_lock is taken with lock_tryacquire under coremap_lock
+ * so that the owner can neither be destroyed nor change the mapping
+ * while the frame is written out; an owner that is busy is skipped.
+ * The cold pages that follow the victim in its region go out with it,
+ * in one write to slots in a row, and their frames are freed; so a
+ * program that runs through its memory in order is swapped in runs.
+ *
+ * One frame is zeroed at boot and kept forever as the shared zero page
+ * (coremap_zeropage); the coremap holds a reference to it itself, so
+ * no mapping of it ever sees a count of one. A kernel thread, the
+ * zeroer, keeps a small pool of further zeroed frames for
+ * coremap_alloc_zeroed, so that the zero-fill fault path usually gets
+ * its page without the bzero. It sleeps whenever the pool is full or
+ * free memory is down to CM_ZEROPOOL_RESERVE frames, never evicts
+ * anything, and yields after every frame so it only soaks up time
+ * nobody else wants. When memory runs out, the pool is given back
+ * before anything is evicted.
+ *
+ * Whenever taking frames off the buddy lists leaves fewer than
+ * cm_lowat free, the page reclaim thread is woken to have the kernel's
+ * caches give some back (see shrink.h), before it comes to evicting.
+ * A run of several frames that is not free in one piece is made so by
+ * moving the user pages in the way to frames elsewhere (as_migrate),
+ * picking the block that needs the fewest moves; an allocation that
+ * cannot sleep for that has the reclaim thread do it for the next one
+ * instead, as its compaction shrinker. Frames set aside for a block
+ * being cleared are CME_COMPACT.
+ *
+ * An allocation that may sleep and still finds nothing goes to the OOM
+ * handler (see oom.h), which has a process killed and lets it try
+ * again a while.
+ *
+ * CME_REF on its own only records the fault that brought a page in,
+ * since the refill handler loads resident pages without vm_fault
+ * seeing them. So every CM_AGE_SECS another thread, the ager, sweeps
+ * the owned frames and marks each page PTE_AGED (as_age), dropping it
+ * from the TLB; the next touch then faults, which sets CME_REF again.
+ * A page that is not aged when the ager comes round has been touched
+ * since the last sweep, and counts toward its address space's working
+ * set. Owners are locked the same way as for eviction, and the pages
+ * of one owner that sit together are aged under one acquisition and
+ * one TLB shootdown. Each full sweep is one generation (cm_agegen).
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <wchan.h>
+#include <clock.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <shrink.h>
+#include <oom.h>
+
+#define CM_NONE  ((uint32_t)0xffffffff)
+
+#define CME_FREE  0x01		/* first frame of a free block */
+#define CME_HEAD  0x02		/* first frame of an allocated run */
+#define CME_CACHED 0x04		/* sitting in a per-cpu page cache */
+#define CME_REF   0x08		/* faulted on since the clock last passed */
+#define CME_BUSY  0x10		/* being evicted */
+#define CME_USER  0x20		/* mapped into user space, for coremap_stats */
+#define CME_COMPACT 0x40	/* set aside for a block being compacted */
+
+/* Frames moved between a per-cpu cache and the buddy lists at once. */
+#define CM_PCPU_BATCH (CPU_PAGECACHE_MAX / 2)
+
+/* Victims cm_evict tries before giving up (e.g. when swap is full). */
+#define CM_EVICT_TRIES 8
+
+/* Zeroed frames the zeroer keeps ready, and free frames it leaves. */
+#define CM_ZEROPOOL_MAX 32
+#define CM_ZEROPOOL_RESERVE (2 * CM_PCPU_BATCH)
+
+/* Free frames below which caches are asked to shrink: 1/CM_LOWAT_DIV. */
+#define CM_LOWAT_DIV 16
+
+/* Seconds between the ager's sweeps; pages it ages and frames it looks
+ * at under one acquisition of coremap_lock. */
+#define CM_AGE_SECS 1
+#define CM_AGE_BATCH 32
+#define CM_AGE_SCAN 256
+
+struct coremap_entry {
+	uint32_t cme_next;		/* free list links (frame numbers) */
+	uint32_t cme_prev;
+	uint32_t cme_npages;		/* run length, if CME_HEAD */
+	uint8_t cme_order;		/* block order, if CME_FREE */
+	uint8_t cme_flags;
+	uint16_t cme_refcount;		/* owners, if CME_HEAD */
+	struct addrspace *cme_as;	/* sole user mapping, if any */
+	vaddr_t cme_vaddr;		/* where cme_as maps it */
+};
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+static struct coremap_entry *coremap;
+static uint32_t cm_nframes;		/* number of managed frames */
+static paddr_t cm_base;			/* physical address of frame 0 */
+static uint32_t freelists[CM_MAXORDER + 1];
+static uint32_t cm_nfree;		/* free frames, for sanity checks */
+static uint32_t cm_clock;		/* eviction clock hand */
+static uint32_t cm_lowat;		/* wake the reclaim thread below */
+static bool cm_ready = false;
+
+static paddr_t cm_zeropage;		/* shared zero page */
+static paddr_t cm_zeropool[CM_ZEROPOOL_MAX];	/* zeroed frames */
+static unsigned cm_zeropool_count;
+static struct wchan *cm_zeroer_wchan;	/* zeroer sleeps here */
+
+static volatile unsigned cm_agegen;	/* the ager's completed sweeps */
+
+static volatile unsigned cm_wantorder;	/* for the compaction shrinker */
+static void cm_compact_shrink(void *data);
+static struct shrinker cm_compact_shrinker =
+	SHRINKER_INITIALIZER("compact", cm_compact_shrink, NULL);
+
+////////////////////////////////////////////////////////////
+//
+// Free lists
+
+static
+void
+freelist_push(uint32_t frame, unsigned order)
+{
+	struct coremap_entry *cme = &coremap[frame];
+
+	KASSERT(order <= CM_MAXORDER);
+	KASSERT((frame & ((1U << order) - 1)) == 0);
+
+	cme->cme_flags = CME_FREE;
+	cme->cme_order = order;
+	cme->cme_prev = CM_NONE;
+	cme->cme_next = freelists[order];
+	if (freelists[order] != CM_NONE) {
+		coremap[freelists[order]].cme_prev = frame;
+	}
+	freelists[order] = frame;
+}
+
+static
+void
+freelist_remove(uint32_t frame)
+{
+	struct coremap_entry *cme = &coremap[frame];
+
+	KASSERT(cme->cme_flags & CME_FREE);
+
+	if (cme->cme_prev != CM_NONE) {
+		coremap[cme->cme_prev].cme_next = cme->cme_next;
+	}
+	else {
+		KASSERT(freelists[cme->cme_order] == frame);
+		freelists[cme->cme_order] = cme->cme_next;
+	}
+	if (cme->cme_next != CM_NONE) {
+		coremap[cme->cme_next].cme_prev = cme->cme_prev;
+	}
+	cme->cme_flags = 0;
+	cme->cme_next = cme->cme_prev = CM_NONE;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Buddy operations (coremap_lock held)
+
+/*
+ * Return a naturally aligned block to the free lists, merging it with
+ * its buddy for as long as the buddy is also free and of the same size.
+ */
+static
+void
+buddy_free(uint32_t frame, unsigned order)
+{
+	uint32_t buddy;
+
+	while (order < CM_MAXORDER) {
+		buddy = frame ^ (1U << order);
+		if (buddy >= cm_nframes ||
+		    (coremap[buddy].cme_flags & CME_FREE) == 0 ||
+		    coremap[buddy].cme_order != order) {
+			break;
+		}
+		freelist_remove(buddy);
+		if (buddy < frame) {
+			coremap[frame].cme_flags = 0;
+			frame = buddy;
+		}
+		order++;
+	}
+	freelist_push(frame, order);
+}
+
+/*
+ * Free an arbitrary run of frames by splitting it into the largest
+ * naturally aligned blocks that fit.
+ */
+static
+void
+buddy_free_range(uint32_t frame, uint32_t npages)
+{
+	unsigned order;
+
+	cm_nfree += npages;
+	while (npages > 0) {
+		order = 0;
+		while (order < CM_MAXORDER &&
+		       (frame & (1U << order)) == 0 &&
+		       (2U << order) <= npages) {
+			order++;
+		}
+		buddy_free(frame, order);
+		frame += 1U << order;
+		npages -= 1U << order;
+	}
+}
+
+/*
+ * Take a block of exactly ORDER off the free lists, splitting a larger
+ * block if needed. Returns CM_NONE if nothing big enough is free.
+ */
+static
+uint32_t
+buddy_alloc(unsigned order)
+{
+	unsigned j;
+	uint32_t frame;
+
+	for (j = order; j <= CM_MAXORDER; j++) {
+		if (freelists[j] != CM_NONE) {
+			break;
+		}
+	}
+	if (j > CM_MAXORDER) {
+		return CM_NONE;
+	}
+
+	frame = freelists[j];
+	freelist_remove(frame);
+
+	/* Split off upper halves until the block is the right size. */
+	while (j > order) {
+		j--;
+		freelist_push(frame + (1U << j), j);
+	}
+	return frame;
+}
+
+/*
+ * Allocate a run of NPAGES frames out of a block of ORDER, giving the
+ * unused tail back. Returns 0 if nothing big enough is free.
+ */
+static
+paddr_t
+buddy_alloc_run(unsigned long npages, unsigned order)
+{
+	uint32_t frame;
+
+	frame = buddy_alloc(order);
+	if (frame == CM_NONE) {
+		return 0;
+	}
+	cm_nfree -= 1U << order;
+
+	coremap[frame].cme_flags = CME_HEAD;
+	coremap[frame].cme_npages = npages;
+	coremap[frame].cme_refcount = 1;
+
+	if (npages < (1UL << order)) {
+		buddy_free_range(frame + npages, (1U << order) - npages);
+	}
+	return cm_base + frame * PAGE_SIZE;
+}
+
+/*
+ * Find the free block containing FRAME. Returns its first frame, or
+ * CM_NONE if FRAME is not on the free lists.
+ */
+static
+uint32_t
+buddy_find(uint32_t frame)
+{
+	unsigned order;
+	uint32_t head;
+
+	for (order = 0; order <= CM_MAXORDER; order++) {
+		head = frame & ~((1U << order) - 1);
+		if ((coremap[head].cme_flags & CME_FREE) &&
+		    coremap[head].cme_order >= order) {
+			return head;
+		}
+	}
+	return CM_NONE;
+}
+
+/*
+ * Take the frames [FRAME, FRAME+NPAGES) off the free lists, giving back
+ * the rest of each block they are carved from. Returns false, changing
+ * nothing, unless all of them are free.
+ */
+static
+bool
+buddy_claim_range(uint32_t frame, uint32_t npages)
+{
+	uint32_t f, head, end, stop;
+
+	stop = frame + npages;
+	if (stop > cm_nframes) {
+		return false;
+	}
+	for (f = frame; f < stop; f = end) {
+		head = buddy_find(f);
+		if (head == CM_NONE) {
+			return false;
+		}
+		end = head + (1U << coremap[head].cme_order);
+	}
+
+	for (f = frame; f < stop; f = end) {
+		head = buddy_find(f);
+		end = head + (1U << coremap[head].cme_order);
+		freelist_remove(head);
+		cm_nfree -= end - head;
+		if (head < f) {
+			buddy_free_range(head, f - head);
+		}
+		if (end > stop) {
+			buddy_free_range(stop, end - stop);
+		}
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Per-cpu page caches (interrupts off)
+
+/*
+ * Move up to CM_PCPU_BATCH single frames from the buddy lists into
+ * this cpu's cache. Returns the number of frames moved.
+ */
+static
+unsigned
+pcpu_refill(struct cpu *c)
+{
+	uint32_t frame;
+	unsigned n;
+	bool low;
+
+	spinlock_acquire(&coremap_lock);
+	for (n = 0; n < CM_PCPU_BATCH; n++) {
+		frame = buddy_alloc(0);
+		if (frame == CM_NONE) {
+			break;
+		}
+		cm_nfree--;
+		coremap[frame].cme_flags = CME_CACHED;
+		c->c_pagecache[c->c_pagecache_count++] =
+			cm_base + frame * PAGE_SIZE;
+	}
+	low = cm_nfree < cm_lowat;
+	spinlock_release(&coremap_lock);
+
+	if (low) {
+		shrink_wake();
+	}
+	return n;
+}
+
+/*
+ * Give up to COUNT frames from this cpu's cache back to the buddy
+ * lists.
+ */
+static
+void
+pcpu_drain(struct cpu *c, unsigned count)
+{
+	uint32_t frame;
+
+	spinlock_acquire(&coremap_lock);
+	while (count > 0 && c->c_pagecache_count > 0) {
+		frame = (c->c_pagecache[--c->c_pagecache_count] - cm_base)
+			/ PAGE_SIZE;
+		KASSERT(coremap[frame].cme_flags == CME_CACHED);
+		coremap[frame].cme_flags = 0;
+		buddy_free_range(frame, 1);
+		count--;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+static
+paddr_t
+pcpu_alloc(void)
+{
+	struct cpu *c;
+	paddr_t paddr;
+	uint32_t frame;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	if (c->c_pagecache_count == 0 && pcpu_refill(c) == 0) {
+		splx(spl);
+		return 0;
+	}
+	paddr = c->c_pagecache[--c->c_pagecache_count];
+	splx(spl);
+
+	frame = (paddr - cm_base) / PAGE_SIZE;
+	KASSERT(coremap[frame].cme_flags == CME_CACHED);
+	coremap[frame].cme_flags = CME_HEAD;
+	coremap[frame].cme_npages = 1;
+	coremap[frame].cme_refcount = 1;
+	return paddr;
+}
+
+static
+void
+pcpu_free(paddr_t paddr)
+{
+	struct cpu *c;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	if (c->c_pagecache_count == CPU_PAGECACHE_MAX) {
+		pcpu_drain(c, CM_PCPU_BATCH);
+	}
+	c->c_pagecache[c->c_pagecache_count++] = paddr;
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Eviction
+
+/*
+ * True if the current thread may sleep, and so may wait for a page to
+ * be written to swap.
+ */
+static
+bool
+cm_cansleep(void)
+{
+	return curthread != NULL && !curthread->t_in_interrupt &&
+		curthread->t_iplhigh_count == 0;
+}
+
+/*
+ * Advance the clock hand to the next frame that can be evicted, lock
+ * its owner and mark it CME_BUSY. *OWNLOCK is set if the owner's lock
+ * was already held by us (because we are faulting on that address
+ * space ourselves). Returns CM_NONE if two full sweeps find nothing.
+ */
+static
+uint32_t
+cm_pick_victim(bool *ownlock)
+{
+	struct coremap_entry *cme;
+	uint32_t frame, n;
+
+	spinlock_acquire(&coremap_lock);
+	for (n = 0; n < 2 * cm_nframes; n++) {
+		frame = cm_clock;
+		cm_clock = (cm_clock + 1) % cm_nframes;
+
+		cme = &coremap[frame];
+		if ((cme->cme_flags & (CME_HEAD | CME_BUSY)) != CME_HEAD ||
+		    cme->cme_as == NULL || cme->cme_refcount != 1) {
+			continue;
+		}
+		if (cme->cme_flags & CME_REF) {
+			/* Second chance. */
+			cme->cme_flags &= ~CME_REF;
+			continue;
+		}
+		KASSERT(cme->cme_npages == 1);
+
+		*ownlock = lock_do_i_hold(cme->cme_as->as_lock);
+		if (!*ownlock && !lock_tryacquire(cme->cme_as->as_lock)) {
+			continue;
+		}
+		cme->cme_flags |= CME_BUSY;
+		spinlock_release(&coremap_lock);
+		return frame;
+	}
+	spinlock_release(&coremap_lock);
+	return CM_NONE;
+}
+
+/*
+ * True if FRAME holds a user page that could be moved: one that
+ * cm_pick_victim could evict, apart from CME_REF. coremap_lock held.
+ */
+static
+bool
+cm_movable(uint32_t frame)
+{
+	struct coremap_entry *cme = &coremap[frame];
+
+	return (cme->cme_flags & (CME_HEAD | CME_BUSY)) == CME_HEAD &&
+		cme->cme_as != NULL && cme->cme_refcount == 1 &&
+		cme->cme_npages == 1;
+}
+
+/*
+ * Add to the victim VADDRS[0] in FRAMES[0] the pages after it that
+ * could go to swap with it, up to SWAP_CLUSTER in all: those that
+ * as_evict_next allows that are also cold, with nobody else on them.
+ * Marks them CME_BUSY. The owner's as_lock held. Returns how many
+ * pages there are now, the victim included.
+ */
+static
+unsigned
+cm_cluster(struct addrspace *as, vaddr_t *vaddrs, paddr_t *paddrs,
+	   uint32_t *frames)
+{
+	struct coremap_entry *cme;
+	unsigned n;
+
+	for (n = 1; n < SWAP_CLUSTER; n++) {
+		if (!as_evict_next(as, vaddrs[n - 1], &paddrs[n]) ||
+		    !coremap_owns(paddrs[n])) {
+			break;
+		}
+		vaddrs[n] = vaddrs[n - 1] + PAGE_SIZE;
+		frames[n] = (paddrs[n] - cm_base) / PAGE_SIZE;
+
+		spinlock_acquire(&coremap_lock);
+		cme = &coremap[frames[n]];
+		if (!cm_movable(frames[n]) || (cme->cme_flags & CME_REF) ||
+		    cme->cme_as != as || cme->cme_vaddr != vaddrs[n]) {
+			spinlock_release(&coremap_lock);
+			break;
+		}
+		cme->cme_flags |= CME_BUSY;
+		spinlock_release(&coremap_lock);
+	}
+	return n;
+}
+
+/*
+ * Put the N pages in FRAMES back the way they were before cm_cluster
+ * or cm_pick_victim, or, if they have been EVICTED, forget their
+ * owner.
+ */
+static
+void
+cm_unbusy(const uint32_t *frames, unsigned n, bool evicted)
+{
+	struct coremap_entry *cme;
+	unsigned i;
+
+	spinlock_acquire(&coremap_lock);
+	for (i = 0; i < n; i++) {
+		cme = &coremap[frames[i]];
+		cme->cme_flags &= ~CME_BUSY;
+		if (evicted) {
+			cme->cme_as = NULL;
+			cme->cme_vaddr = 0;
+		}
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Push some user page out to swap and hand its frame to the caller as
+ * a fresh single-frame allocation, along with any pages after it that
+ * can go with it (see cm_cluster), whose frames are freed. Returns 0
+ * if nothing could be evicted.
+ */
+static
+paddr_t
+cm_evict(void)
+{
+	vaddr_t vaddrs[SWAP_CLUSTER];
+	paddr_t paddrs[SWAP_CLUSTER];
+	uint32_t frames[SWAP_CLUSTER];
+	struct addrspace *as;
+	unsigned tries, n, i;
+	bool ownlock;
+	int result;
+
+	for (tries = 0; tries < CM_EVICT_TRIES; tries++) {
+		frames[0] = cm_pick_victim(&ownlock);
+		if (frames[0] == CM_NONE) {
+			return 0;
+		}
+		as = coremap[frames[0]].cme_as;
+		vaddrs[0] = coremap[frames[0]].cme_vaddr;
+		paddrs[0] = cm_base + frames[0] * PAGE_SIZE;
+
+		n = cm_cluster(as, vaddrs, paddrs, frames);
+		result = as_evict(as, vaddrs, paddrs, n);
+		if (result && n > 1) {
+			/* Perhaps only no run of slots that long; try alone. */
+			cm_unbusy(frames + 1, n - 1, false);
+			n = 1;
+			result = as_evict(as, vaddrs, paddrs, 1);
+		}
+		cm_unbusy(frames, n, result == 0);
+
+		if (!ownlock) {
+			lock_release(as->as_lock);
+		}
+		if (result == 0) {
+			for (i = 1; i < n; i++) {
+				coremap_free(paddrs[i]);
+			}
+			return paddrs[0];
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Compaction
+
+/*
+ * Find the naturally aligned block of 2^ORDER frames that could be
+ * made free with the fewest pages moved: all of it free or movable.
+ * Returns its first frame, or CM_NONE. coremap_lock held.
+ */
+static
+uint32_t
+cm_compact_pick(unsigned order)
+{
+	uint32_t base, f, end, best = CM_NONE;
+	unsigned moves, bestmoves = 0;
+
+	for (base = 0; base + (1U << order) <= cm_nframes;
+	     base += 1U << order) {
+		end = base + (1U << order);
+		moves = 0;
+		for (f = base; f < end; ) {
+			if (coremap[f].cme_flags & CME_FREE) {
+				f += 1U << coremap[f].cme_order;
+			}
+			else if (cm_movable(f)) {
+				moves++;
+				f++;
+			}
+			else {
+				break;
+			}
+		}
+		if (f >= end && (best == CM_NONE || moves < bestmoves)) {
+			best = base;
+			bestmoves = moves;
+		}
+	}
+	return best;
+}
+
+/*
+ * Set aside the free frames in [BASE, END), so that the pages moved
+ * out of the block do not land in it. coremap_lock held.
+ */
+static
+void
+cm_compact_claimfree(uint32_t base, uint32_t end)
+{
+	uint32_t f, i, n;
+
+	for (f = base; f < end; f += n) {
+		if ((coremap[f].cme_flags & CME_FREE) == 0) {
+			n = 1;
+			continue;
+		}
+		n = 1U << coremap[f].cme_order;
+		KASSERT(f + n <= end);
+		freelist_remove(f);
+		cm_nfree -= n;
+		for (i = f; i < f + n; i++) {
+			coremap[i].cme_flags = CME_COMPACT;
+		}
+	}
+}
+
+/*
+ * Move the user page in FRAME to a free frame (outside the block
+ * being compacted, whose free frames are set aside already) and set
+ * FRAME aside too. Returns false if it is not there to move any more,
+ * or its owner is busy, or there is no frame to move it to.
+ */
+static
+bool
+cm_compact_move(uint32_t frame)
+{
+	struct coremap_entry *cme = &coremap[frame];
+	struct addrspace *as;
+	vaddr_t vaddr;
+	uint32_t to;
+	bool ownlock;
+
+	spinlock_acquire(&coremap_lock);
+	if (cme->cme_flags & CME_COMPACT) {
+		spinlock_release(&coremap_lock);
+		return true;
+	}
+	if (!cm_movable(frame)) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	as = cme->cme_as;
+	ownlock = lock_do_i_hold(as->as_lock);
+	if (!ownlock && !lock_tryacquire(as->as_lock)) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	to = buddy_alloc(0);
+	if (to == CM_NONE) {
+		spinlock_release(&coremap_lock);
+		if (!ownlock) {
+			lock_release(as->as_lock);
+		}
+		return false;
+	}
+	cm_nfree--;
+	cme->cme_flags |= CME_BUSY;
+	vaddr = cme->cme_vaddr;
+	spinlock_release(&coremap_lock);
+
+	as_migrate(as, vaddr, cm_base + frame * PAGE_SIZE,
+		   cm_base + to * PAGE_SIZE);
+
+	spinlock_acquire(&coremap_lock);
+	coremap[to].cme_flags = CME_HEAD | CME_USER |
+		(cme->cme_flags & CME_REF);
+	coremap[to].cme_npages = 1;
+	coremap[to].cme_refcount = 1;
+	coremap[to].cme_as = as;
+	coremap[to].cme_vaddr = vaddr;
+	cme->cme_flags = CME_COMPACT;
+	cme->cme_npages = 0;
+	cme->cme_refcount = 0;
+	cme->cme_as = NULL;
+	cme->cme_vaddr = 0;
+	spinlock_release(&coremap_lock);
+
+	if (!ownlock) {
+		lock_release(as->as_lock);
+	}
+	return true;
+}
+
+/*
+ * Allocate a run of NPAGES frames out of a block of ORDER that is not
+ * free yet, by moving the user pages in it elsewhere. Returns 0 if no
+ * block can be cleared. The caller must be able to sleep.
+ */
+static
+paddr_t
+cm_compact(unsigned long npages, unsigned order)
+{
+	uint32_t base, end, f;
+	paddr_t paddr;
+	bool ok = true;
+
+	spinlock_acquire(&coremap_lock);
+	paddr = buddy_alloc_run(npages, order);
+	if (paddr != 0) {
+		/* Somebody freed enough in the meantime. */
+		spinlock_release(&coremap_lock);
+		return paddr;
+	}
+	base = cm_compact_pick(order);
+	if (base == CM_NONE) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+	end = base + (1U << order);
+	cm_compact_claimfree(base, end);
+	spinlock_release(&coremap_lock);
+
+	for (f = base; f < end && ok; f++) {
+		ok = cm_compact_move(f);
+	}
+
+	spinlock_acquire(&coremap_lock);
+	if (!ok) {
+		/* Give back what was set aside; the moves stand. */
+		for (f = base; f < end; f++) {
+			if (coremap[f].cme_flags == CME_COMPACT) {
+				coremap[f].cme_flags = 0;
+				buddy_free_range(f, 1);
+			}
+		}
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+	for (f = base; f < end; f++) {
+		KASSERT(coremap[f].cme_flags == CME_COMPACT);
+		coremap[f].cme_flags = 0;
+	}
+	coremap[base].cme_flags = CME_HEAD;
+	coremap[base].cme_npages = npages;
+	coremap[base].cme_refcount = 1;
+	if (npages < (1UL << order)) {
+		buddy_free_range(base + npages, (1U << order) - npages);
+	}
+	spinlock_release(&coremap_lock);
+	return cm_base + base * PAGE_SIZE;
+}
+
+/*
+ * Shrinker: if an allocation that could not sleep found no run big
+ * enough, clear a block of that size for the next one.
+ */
+static
+void
+cm_compact_shrink(void *data)
+{
+	unsigned order, j;
+	paddr_t paddr;
+
+	(void)data;
+
+	order = cm_wantorder;
+	cm_wantorder = 0;
+	if (order == 0) {
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	for (j = order; j <= CM_MAXORDER && freelists[j] == CM_NONE; j++);
+	spinlock_release(&coremap_lock);
+	if (j <= CM_MAXORDER) {
+		/* Something came free in the meantime. */
+		return;
+	}
+
+	paddr = cm_compact(1UL << order, order);
+	if (paddr != 0) {
+		coremap_free(paddr);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Page aging
+
+/*
+ * Age a run of the pages from *FRAMEP on: the first one whose owner
+ * can be locked, and those after it with the same owner, up to
+ * CM_AGE_BATCH of them that were in use. Frames cm_movable turns down
+ * (free, shared, kernel, or busy being evicted or moved) are passed
+ * over. Moves *FRAMEP past what it looked at. Returns false once the
+ * sweep has reached the end of the coremap.
+ */
+static
+bool
+cm_age_run(uint32_t *framep)
+{
+	vaddr_t vaddrs[CM_AGE_BATCH];
+	struct coremap_entry *cme;
+	struct addrspace *as;
+	uint32_t frame, scanned;
+	unsigned n;
+
+	as = NULL;
+	n = 0;
+	spinlock_acquire(&coremap_lock);
+	for (frame = *framep, scanned = 0;
+	     frame < cm_nframes && n < CM_AGE_BATCH && scanned < CM_AGE_SCAN;
+	     frame++, scanned++) {
+		if (!cm_movable(frame)) {
+			continue;
+		}
+		cme = &coremap[frame];
+		if (as == NULL) {
+			if (!lock_tryacquire(cme->cme_as->as_lock)) {
+				/* Busy; catch it next sweep. */
+				continue;
+			}
+			as = cme->cme_as;
+		}
+		else if (cme->cme_as != as) {
+			break;
+		}
+		if (as_age(as, cme->cme_vaddr, cm_base + frame * PAGE_SIZE)) {
+			/* Only a page in use can be in a TLB. */
+			vaddrs[n++] = cme->cme_vaddr;
+		}
+	}
+	spinlock_release(&coremap_lock);
+	*framep = frame;
+
+	if (as != NULL) {
+		if (n > 0) {
+			vm_tlbshootdown_pages(as, vaddrs, n);
+		}
+		lock_release(as->as_lock);
+	}
+	return frame < cm_nframes;
+}
+
+/*
+ * The ager thread: sweep memory every CM_AGE_SECS.
+ */
+static
+void
+cm_ager(void *data1, unsigned long data2)
+{
+	uint32_t frame;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		clocksleep(CM_AGE_SECS);
+		frame = 0;
+		while (cm_age_run(&frame)) {
+			thread_yield();
+		}
+		cm_agegen++;
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Zeroed frames
+
+/*
+ * Take a frame out of the zeroed pool. Returns 0 if it is empty.
+ */
+static
+paddr_t
+cm_zeropool_take(void)
+{
+	paddr_t paddr;
+
+	paddr = 0;
+	spinlock_acquire(&coremap_lock);
+	if (cm_zeropool_count > 0) {
+		paddr = cm_zeropool[--cm_zeropool_count];
+	}
+	spinlock_release(&coremap_lock);
+	return paddr;
+}
+
+/*
+ * The zeroer thread: keep the zeroed pool full out of memory nobody
+ * is using.
+ */
+static
+void
+cm_zeroer(void *data1, unsigned long data2)
+{
+	paddr_t paddr;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		spinlock_acquire(&coremap_lock);
+		while (cm_zeropool_count == CM_ZEROPOOL_MAX ||
+		       cm_nfree <= CM_ZEROPOOL_RESERVE) {
+			wchan_lock(cm_zeroer_wchan);
+			spinlock_release(&coremap_lock);
+			wchan_sleep(cm_zeroer_wchan);
+			spinlock_acquire(&coremap_lock);
+		}
+		paddr = buddy_alloc_run(1, 0);
+		spinlock_release(&coremap_lock);
+		KASSERT(paddr != 0);
+
+		bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+
+		/* Only we fill the pool, so there is still room. */
+		spinlock_acquire(&coremap_lock);
+		KASSERT(cm_zeropool_count < CM_ZEROPOOL_MAX);
+		cm_zeropool[cm_zeropool_count++] = paddr;
+		spinlock_release(&coremap_lock);
+
+		thread_yield();
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	uint32_t npages, tablepages, i;
+
+	KASSERT(!cm_ready);
+
+	ram_getsize(&lo, &hi);
+	KASSERT(lo != 0);
+	KASSERT(hi > lo);
+
+	/* The coremap occupies the bottom of the memory it describes. */
+	npages = (hi - lo) / PAGE_SIZE;
+	tablepages = DIVROUNDUP(npages * sizeof(struct coremap_entry),
+				PAGE_SIZE);
+	KASSERT(tablepages < npages);
+
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(lo);
+	cm_base = lo + tablepages * PAGE_SIZE;
+	cm_nframes = npages - tablepages;
+	cm_lowat = cm_nframes / CM_LOWAT_DIV;
+	if (cm_lowat < CM_ZEROPOOL_RESERVE) {
+		cm_lowat = CM_ZEROPOOL_RESERVE;
+	}
+
+	for (i = 0; i <= CM_MAXORDER; i++) {
+		freelists[i] = CM_NONE;
+	}
+	for (i = 0; i < cm_nframes; i++) {
+		coremap[i].cme_next = CM_NONE;
+		coremap[i].cme_prev = CM_NONE;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_order = 0;
+		coremap[i].cme_flags = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	cm_nfree = 0;
+	buddy_free_range(0, cm_nframes);
+	cm_zeropage = buddy_alloc_run(1, 0);
+	cm_zeropool_count = 0;
+	cm_ready = true;
+	spinlock_release(&coremap_lock);
+
+	KASSERT(cm_zeropage != 0);
+	bzero((void *)PADDR_TO_KVADDR(cm_zeropage), PAGE_SIZE);
+
+	shrinker_register(&cm_compact_shrinker);
+
+	kprintf("coremap: %u frames (%u pages of coremap)\n",
+		cm_nframes, tablepages);
+}
+
+void
+coremap_start_zeroer(void)
+{
+	int result;
+
+	KASSERT(cm_ready);
+	KASSERT(cm_zeroer_wchan == NULL);
+
+	cm_zeroer_wchan = wchan_create("zeroer");
+	if (cm_zeroer_wchan == NULL) {
+		panic("coremap: Out of memory creating zeroer\n");
+	}
+	result = thread_fork("zeroer", NULL, cm_zeroer, NULL, 0);
+	if (result) {
+		panic("coremap: thread_fork zeroer: %s\n", strerror(result));
+	}
+}
+
+void
+coremap_start_ager(void)
+{
+	int result;
+
+	KASSERT(cm_ready);
+
+	result = thread_fork("pageager", NULL, cm_ager, NULL, 0);
+	if (result) {
+		panic("coremap: thread_fork pageager: %s\n", strerror(result));
+	}
+}
+
+unsigned
+coremap_agegen(void)
+{
+	return cm_agegen;
+}
+
+bool
+coremap_ready(void)
+{
+	return cm_ready;
+}
+
+bool
+coremap_owns(paddr_t paddr)
+{
+	return cm_ready && paddr >= cm_base &&
+		paddr < cm_base + cm_nframes * PAGE_SIZE;
+}
+
+/*
+ * One try at coremap_alloc.
+ */
+static
+paddr_t
+cm_alloc(unsigned long npages)
+{
+	unsigned order;
+	paddr_t paddr;
+	bool low;
+	int spl;
+
+	if (npages == 1) {
+		paddr = pcpu_alloc();
+		if (paddr == 0) {
+			paddr = cm_zeropool_take();
+		}
+		if (paddr == 0 && swap_ready() && cm_cansleep()) {
+			paddr = cm_evict();
+		}
+		return paddr;
+	}
+	order = 0;
+	while ((1UL << order) < npages) {
+		order++;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	paddr = buddy_alloc_run(npages, order);
+	low = cm_nfree < cm_lowat;
+	spinlock_release(&coremap_lock);
+
+	if (low) {
+		shrink_wake();
+	}
+	if (paddr == 0) {
+		/*
+		 * Our own cached frames may be what stands between
+		 * this request and a buddy merge; give them back and
+		 * try once more.
+		 */
+		spl = splhigh();
+		pcpu_drain(curcpu->c_self, CPU_PAGECACHE_MAX);
+		splx(spl);
+
+		spinlock_acquire(&coremap_lock);
+		paddr = buddy_alloc_run(npages, order);
+		spinlock_release(&coremap_lock);
+	}
+	if (paddr == 0 && cm_cansleep()) {
+		paddr = cm_compact(npages, order);
+	}
+	else if (paddr == 0) {
+		/* Have the reclaim thread make room for next time. */
+		if (order > cm_wantorder) {
+			cm_wantorder = order;
+		}
+		shrink_wake();
+	}
+	return paddr;
+}
+
+paddr_t
+coremap_alloc(unsigned long npages)
+{
+	paddr_t paddr;
+	unsigned tries;
+
+	KASSERT(cm_ready);
+	KASSERT(npages > 0);
+
+	if (npages > (1UL << CM_MAXORDER)) {
+		return 0;
+	}
+	for (tries = 0; ; tries++) {
+		paddr = cm_alloc(npages);
+		if (paddr != 0 || !cm_cansleep() || !oom_wait(tries)) {
+			return paddr;
+		}
+	}
+}
+
+paddr_t
+coremap_tryalloc(void)
+{
+	bool plenty;
+
+	KASSERT(cm_ready);
+
+	/* Leave the same reserve the zeroer does. */
+	spinlock_acquire(&coremap_lock);
+	plenty = cm_nfree > CM_ZEROPOOL_RESERVE;
+	spinlock_release(&coremap_lock);
+
+	return plenty ? pcpu_alloc() : 0;
+}
+
+paddr_t
+coremap_alloc_zeroed(void)
+{
+	paddr_t paddr;
+
+	KASSERT(cm_ready);
+
+	/*
+	 * Poke the zeroer even if the pool was empty: it may have gone
+	 * to sleep for want of free memory that has come back since.
+	 */
+	paddr = cm_zeropool_take();
+	if (cm_zeroer_wchan != NULL) {
+		wchan_wakeone(cm_zeroer_wchan);
+	}
+	if (paddr != 0) {
+		return paddr;
+	}
+	paddr = coremap_alloc(1);
+	if (paddr != 0) {
+		bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+	}
+	return paddr;
+}
+
+paddr_t
+coremap_zeropage(void)
+{
+	KASSERT(cm_ready);
+	return cm_zeropage;
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	uint32_t frame, npages;
+	bool shared;
+
+	KASSERT(coremap_owns(paddr));
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	frame = (paddr - cm_base) / PAGE_SIZE;
+
+	/*
+	 * The run belongs to the caller, so its head entry can be
+	 * examined without the lock.
+	 */
+	if ((coremap[frame].cme_flags & CME_HEAD) == 0) {
+		panic("coremap_free: 0x%x is not an allocated run\n", paddr);
+	}
+	if (coremap[frame].cme_refcount > 1) {
+		spinlock_acquire(&coremap_lock);
+		KASSERT(coremap[frame].cme_refcount > 0);
+		shared = --coremap[frame].cme_refcount > 0;
+		spinlock_release(&coremap_lock);
+		if (shared) {
+			return;
+		}
+	}
+	coremap[frame].cme_refcount = 0;
+	if (coremap[frame].cme_as != NULL) {
+		spinlock_acquire(&coremap_lock);
+		KASSERT((coremap[frame].cme_flags & CME_BUSY) == 0);
+		coremap[frame].cme_as = NULL;
+		coremap[frame].cme_vaddr = 0;
+		spinlock_release(&coremap_lock);
+	}
+	npages = coremap[frame].cme_npages;
+	coremap[frame].cme_npages = 0;
+
+	if (npages == 1) {
+		coremap[frame].cme_flags = CME_CACHED;
+		pcpu_free(paddr);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	coremap[frame].cme_flags = 0;
+	buddy_free_range(frame, npages);
+	KASSERT(cm_nfree <= cm_nframes);
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_grow(paddr_t paddr, unsigned long npages)
+{
+	uint32_t frame, oldnpages;
+	bool ok;
+
+	KASSERT(coremap_owns(paddr));
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	frame = (paddr - cm_base) / PAGE_SIZE;
+
+	/* As in coremap_free, the head entry is the caller's. */
+	KASSERT(coremap[frame].cme_flags & CME_HEAD);
+	KASSERT(coremap[frame].cme_refcount == 1);
+	oldnpages = coremap[frame].cme_npages;
+	if (npages <= oldnpages) {
+		return true;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	ok = buddy_claim_range(frame + oldnpages, npages - oldnpages);
+	if (ok) {
+		coremap[frame].cme_npages = npages;
+	}
+	spinlock_release(&coremap_lock);
+	return ok;
+}
+
+void
+coremap_incref(paddr_t paddr)
+{
+	if (!coremap_tryincref(paddr)) {
+		panic("coremap_incref: 0x%x has too many owners\n", paddr);
+	}
+}
+
+bool
+coremap_tryincref(paddr_t paddr)
+{
+	uint32_t frame;
+
+	KASSERT(coremap_owns(paddr));
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	frame = (paddr - cm_base) / PAGE_SIZE;
+	KASSERT(coremap[frame].cme_flags & CME_HEAD);
+	KASSERT(coremap[frame].cme_npages == 1);
+
+	spinlock_acquire(&coremap_lock);
+	if (coremap[frame].cme_refcount == CM_MAXREFS) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	coremap[frame].cme_refcount++;
+	coremap[frame].cme_flags |= CME_USER;
+	/* Shared frames are not evicted. */
+	coremap[frame].cme_as = NULL;
+	coremap[frame].cme_vaddr = 0;
+	spinlock_release(&coremap_lock);
+	return true;
+}
+
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	uint32_t frame;
+	unsigned count;
+
+	KASSERT(coremap_owns(paddr));
+
+	frame = (paddr - cm_base) / PAGE_SIZE;
+	KASSERT(coremap[frame].cme_flags & CME_HEAD);
+
+	spinlock_acquire(&coremap_lock);
+	count = coremap[frame].cme_refcount;
+	spinlock_release(&coremap_lock);
+	return count;
+}
+
+void
+coremap_set_owner(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t frame;
+
+	KASSERT(coremap_owns(paddr));
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	frame = (paddr - cm_base) / PAGE_SIZE;
+	KASSERT(coremap[frame].cme_flags & CME_HEAD);
+	KASSERT(coremap[frame].cme_npages == 1);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap[frame].cme_refcount == 1);
+	coremap[frame].cme_as = as;
+	coremap[frame].cme_vaddr = vaddr;
+	coremap[frame].cme_flags |= CME_REF | CME_USER;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_stats(struct coremap_stats *cs)
+{
+	uint32_t frame;
+	unsigned len;
+	uint8_t flags;
+
+	KASSERT(cm_ready);
+
+	cs->cs_total = cm_nframes;
+	cs->cs_free = 0;
+	cs->cs_user = 0;
+	cs->cs_kernel = 0;
+
+	spinlock_acquire(&coremap_lock);
+	for (frame = 0; frame < cm_nframes; frame += len) {
+		flags = coremap[frame].cme_flags;
+		if (flags & CME_FREE) {
+			len = 1U << coremap[frame].cme_order;
+			cs->cs_free += len;
+		}
+		else if (flags & CME_HEAD) {
+			len = coremap[frame].cme_npages;
+			if (flags & CME_USER) {
+				cs->cs_user += len;
+			}
+			else {
+				cs->cs_kernel += len;
+			}
+		}
+		else {
+			/* Sitting in a per-cpu cache. */
+			len = 1;
+			if (flags & CME_CACHED) {
+				cs->cs_free++;
+			}
+			else {
+				cs->cs_kernel++;
+			}
+		}
+	}
+	/* The zeroed pool is allocated, but as good as free. */
+	cs->cs_zeroed = cm_zeropool_count;
+	cs->cs_kernel -= cm_zeropool_count;
+	cs->cs_free += cm_zeropool_count;
+	spinlock_release(&coremap_lock);
+}
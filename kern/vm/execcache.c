@@ -0,0 +1,328 @@
+/*
+ * The exec cache. See execcache.h.
+ *
+ * The table, each image's fields but ei_as (which never changes), the
+ * dead list and each vnode's vn_execcached are covered by
+ * execcache_lock. vn_execcached is looked at without it first, so that
+ * writes to files that were never run do not take it.
+ *
+ * Destroying a template takes its as_lock, and drops references to
+ * frames, swap slots and its vnode. That is safe with filesystem locks
+ * held: once a template is in the table its as_lock is only taken by
+ * as_copy, the coremap (which only ever drops its clean pages) and
+ * the ager, none of which goes to a filesystem; and whoever calls
+ * execcache_forget holds a reference to the vnode too, so the last one
+ * is never dropped there.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <stat.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <kstat.h>
+#include <shrink.h>
+#include <execcache.h>
+
+struct execimage {
+	struct vnode *ei_vnode;
+	off_t ei_size;			/* of the file, when loaded */
+	vaddr_t ei_entry;
+	struct addrspace *ei_as;	/* the template */
+	unsigned ei_lastuse;		/* execcache_clock, when last copied */
+	unsigned ei_copying;		/* copies being made of it */
+	bool ei_gone;			/* out of the table */
+	struct execimage *ei_next;	/* on execcache_dead */
+};
+
+static struct spinlock execcache_lock = SPINLOCK_INITIALIZER;
+static struct execimage *execcache_table[EXECCACHE_SIZE];
+static struct execimage *execcache_dead;	/* to be destroyed */
+static unsigned execcache_clock;
+
+static struct kstat execcache_hits = KSTAT_INITIALIZER("exec.cachehits");
+static struct kstat execcache_misses = KSTAT_INITIALIZER("exec.cachemisses");
+static struct kstat execcache_uncached = KSTAT_INITIALIZER("exec.uncached");
+
+static void execcache_shrink(void *data);
+static struct shrinker execcache_shrinker =
+	SHRINKER_INITIALIZER("execcache", execcache_shrink, NULL);
+
+void
+execcache_bootstrap(void)
+{
+	shrinker_register(&execcache_shrinker);
+}
+
+/*
+ * Put EI, which is not in the table any more, on the dead list, unless
+ * somebody is still making a copy of it. execcache_lock held.
+ */
+static
+void
+execcache_drop(struct execimage *ei)
+{
+	KASSERT(spinlock_do_i_hold(&execcache_lock));
+	KASSERT(ei->ei_gone);
+
+	if (ei->ei_copying > 0) {
+		/* The last copier drops it. */
+		return;
+	}
+	ei->ei_next = execcache_dead;
+	execcache_dead = ei;
+}
+
+/*
+ * Take the image in slot I out of the table. execcache_lock held.
+ */
+static
+void
+execcache_remove(unsigned i)
+{
+	struct execimage *ei = execcache_table[i];
+
+	KASSERT(spinlock_do_i_hold(&execcache_lock));
+
+	execcache_table[i] = NULL;
+	ei->ei_gone = true;
+	ei->ei_vnode->vn_execcached = false;
+	execcache_drop(ei);
+}
+
+/*
+ * Destroy whatever is on the dead list. execcache_lock not held.
+ */
+static
+void
+execcache_reap(void)
+{
+	struct execimage *ei;
+
+	while (1) {
+		spinlock_acquire(&execcache_lock);
+		ei = execcache_dead;
+		if (ei != NULL) {
+			execcache_dead = ei->ei_next;
+		}
+		spinlock_release(&execcache_lock);
+		if (ei == NULL) {
+			break;
+		}
+		as_destroy(ei->ei_as);
+		VOP_DECREF(ei->ei_vnode);
+		kfree(ei);
+	}
+}
+
+/*
+ * The slot for a new image of V: that of an older one of V, which
+ * another exec may have put there meanwhile or which is out of date;
+ * else a free one; else that of the least recently used.
+ * execcache_lock held.
+ */
+static
+unsigned
+execcache_slot(struct vnode *v)
+{
+	unsigned i, victim;
+
+	for (i = 0; i < EXECCACHE_SIZE; i++) {
+		if (execcache_table[i] != NULL &&
+		    execcache_table[i]->ei_vnode == v) {
+			return i;
+		}
+	}
+	victim = 0;
+	for (i = 0; i < EXECCACHE_SIZE; i++) {
+		if (execcache_table[i] == NULL) {
+			return i;
+		}
+		if (execcache_table[i]->ei_lastuse <
+		    execcache_table[victim]->ei_lastuse) {
+			victim = i;
+		}
+	}
+	return victim;
+}
+
+/*
+ * Put the new image EI in the table.
+ */
+static
+void
+execcache_add(struct execimage *ei)
+{
+	unsigned i;
+
+	spinlock_acquire(&execcache_lock);
+	i = execcache_slot(ei->ei_vnode);
+	if (execcache_table[i] != NULL) {
+		execcache_remove(i);
+	}
+	ei->ei_lastuse = ++execcache_clock;
+	execcache_table[i] = ei;
+	ei->ei_vnode->vn_execcached = true;
+	spinlock_release(&execcache_lock);
+}
+
+/*
+ * Make a new image of V, SIZE bytes long, and hand back a copy of it
+ * in *RET; or, if the program is too big to keep or memory is short,
+ * the address space it was loaded into.
+ */
+static
+int
+execcache_build(struct vnode *v, off_t size, struct addrspace **ret,
+		vaddr_t *entrypoint)
+{
+	struct execimage *ei;
+	struct addrspace *as;
+	int result;
+
+	as = as_create();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	result = load_elf_as(as, v, entrypoint);
+	if (result) {
+		as_destroy(as);
+		return result;
+	}
+
+	ei = NULL;
+	if (as_prefill(as, EXECCACHE_MAXPAGES) == 0) {
+		ei = kmalloc(sizeof(*ei));
+	}
+	if (ei == NULL || as_copy(as, ret) != 0) {
+		/* Run it as it is, without keeping it. */
+		kfree(ei);
+		kstat_inc(&execcache_uncached);
+		*ret = as;
+		return 0;
+	}
+
+	VOP_INCREF(v);
+	ei->ei_vnode = v;
+	ei->ei_size = size;
+	ei->ei_entry = *entrypoint;
+	ei->ei_as = as;
+	ei->ei_copying = 0;
+	ei->ei_gone = false;
+	ei->ei_next = NULL;
+	execcache_add(ei);
+	return 0;
+}
+
+int
+execcache_load(struct vnode *v, struct addrspace **ret, vaddr_t *entrypoint)
+{
+	struct execimage *ei;
+	struct stat st;
+	unsigned i;
+	int result;
+
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+
+	spinlock_acquire(&execcache_lock);
+	ei = NULL;
+	for (i = 0; i < EXECCACHE_SIZE; i++) {
+		if (execcache_table[i] != NULL &&
+		    execcache_table[i]->ei_vnode == v &&
+		    execcache_table[i]->ei_size == st.st_size) {
+			ei = execcache_table[i];
+			ei->ei_copying++;
+			ei->ei_lastuse = ++execcache_clock;
+			break;
+		}
+	}
+	spinlock_release(&execcache_lock);
+
+	if (ei == NULL) {
+		kstat_inc(&execcache_misses);
+		result = execcache_build(v, st.st_size, ret, entrypoint);
+		execcache_reap();
+		return result;
+	}
+
+	result = as_copy(ei->ei_as, ret);
+	*entrypoint = ei->ei_entry;
+
+	spinlock_acquire(&execcache_lock);
+	ei->ei_copying--;
+	if (ei->ei_gone) {
+		execcache_drop(ei);
+	}
+	spinlock_release(&execcache_lock);
+	execcache_reap();
+
+	if (result) {
+		return result;
+	}
+	kstat_inc(&execcache_hits);
+	return 0;
+}
+
+void
+execcache_forget(struct vnode *v)
+{
+	unsigned i;
+
+	if (!v->vn_execcached) {
+		return;
+	}
+
+	spinlock_acquire(&execcache_lock);
+	for (i = 0; i < EXECCACHE_SIZE; i++) {
+		if (execcache_table[i] != NULL &&
+		    execcache_table[i]->ei_vnode == v) {
+			execcache_remove(i);
+		}
+	}
+	spinlock_release(&execcache_lock);
+	execcache_reap();
+}
+
+void
+execcache_forgetfs(struct fs *fs)
+{
+	unsigned i;
+
+	spinlock_acquire(&execcache_lock);
+	for (i = 0; i < EXECCACHE_SIZE; i++) {
+		if (execcache_table[i] != NULL &&
+		    execcache_table[i]->ei_vnode->vn_fs == fs) {
+			execcache_remove(i);
+		}
+	}
+	spinlock_release(&execcache_lock);
+	execcache_reap();
+}
+
+/*
+ * Shrinker: let go of every template. Each holds all of its program's
+ * file pages, and the page cache keeps the text of those still being
+ * run anyway.
+ */
+static
+void
+execcache_shrink(void *data)
+{
+	unsigned i;
+
+	(void)data;
+
+	spinlock_acquire(&execcache_lock);
+	for (i = 0; i < EXECCACHE_SIZE; i++) {
+		if (execcache_table[i] != NULL) {
+			execcache_remove(i);
+		}
+	}
+	spinlock_release(&execcache_lock);
+	execcache_reap();
+}
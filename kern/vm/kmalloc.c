@@ -31,12 +31,31 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <vm.h>
+#include "opt-kmallocprof.h"
+#include "opt-perf.h"
+
+#if OPT_KMALLOCPROF
+#include <kmallocprof.h>
 
 /*
- * Kernel malloc.
+ * Charge blocks to whoever called the public function we are in. The
+ * record of a block must go before the block itself does, since
+ * another cpu may get the same address straight back.
  */
+#define KPROF_SITE ((vaddr_t)__builtin_return_address(0))
+#define KPROF_ALLOC(ptr, sz) \
+	((ptr) != NULL ? kmallocprof_alloc(KPROF_SITE, (ptr), (sz)) : (void)0)
+#define KPROF_FREE(ptr) kmallocprof_free(ptr)
+#else
+#define KPROF_ALLOC(ptr, sz) ((void)(ptr), (void)(sz))
+#define KPROF_FREE(ptr) ((void)(ptr))
+#endif
 
+/*
+ * Kernel malloc.
+ */
 
+#if !OPT_PERF
 static
 void
 fill_deadbeef(void *vptr, size_t len)
@@ -48,6 +67,7 @@ fill_deadbeef(void *vptr, size_t len)
 		ptr[i] = 0xdeadbeef;
 	}
 }
+#endif
 
 ////////////////////////////////////////////////////////////
 //
@@ -103,7 +123,8 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
-	struct pageref *next_all;
+	struct pageref *prev_samesize;
+	struct pageref *next_hash;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -118,84 +139,149 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
- *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
- *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
- *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * Pagerefs come in pages of NPAGEREFS (204 with 4k pages, enough to
+ * manage 800K of kernel heap each). The first page of them is in the
+ * kernel BSS, so that kmalloc works before there is anywhere to get
+ * pages from; further pages are taken with alloc_kpages as the heap
+ * grows, and never given back. Unused pagerefs are kept on a free
+ * list linked through next_samesize, so getting and releasing one
+ * takes constant time. All of this is under pageref_spinlock.
  */
 
 #define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
 static struct pageref pagerefs[NPAGEREFS];
+static bool pagerefs_added;
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static uint32_t pagerefs_inuse[INUSE_WORDS];
+static struct pageref *pagerefs_free;
+static unsigned npagerefs;	/* all there are, for checksubpages */
+
+static
+void
+addpagerefs(struct pageref *prs, unsigned n)
+{
+	unsigned i;
+
+	for (i=0; i<n; i++) {
+		prs[i].next_samesize = pagerefs_free;
+		pagerefs_free = &prs[i];
+	}
+	npagerefs += n;
+}
 
 static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	uint32_t k;
+	struct pageref *p;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
-			/* full */
-			continue;
-		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
-			}
-		}
-		KASSERT(0);
+	if (!pagerefs_added) {
+		addpagerefs(pagerefs, NPAGEREFS);
+		pagerefs_added = true;
 	}
 
-	/* ran out */
-	return NULL;
+	p = pagerefs_free;
+	if (p == NULL) {
+		/* ran out; the caller adds another page */
+		return NULL;
+	}
+	pagerefs_free = p->next_samesize;
+	return p;
 }
 
 static
 void
 freepageref(struct pageref *p)
 {
-	size_t i, j;
-	uint32_t k;
-
-	j = p-pagerefs;
-	KASSERT(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
-	i = j/32;
-	k = ((uint32_t)1) << (j%32);
-	KASSERT((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	p->next_samesize = pagerefs_free;
+	pagerefs_free = p;
 }
 
 ////////////////////////////////////////
 
+/*
+ * The pages in use for each size are on a doubly linked list, so a
+ * page can be taken off in constant time once it is all free. Every
+ * page in use is also in a hash table keyed on its address, so kfree
+ * can go from a pointer to its pageref without looking at every page
+ * in the heap.
+ */
+
+#define PR_HASHSIZE 1024
+#define PR_HASH(va) (((va) / PAGE_SIZE) % PR_HASHSIZE)
+
 static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+static struct pageref *prhash[PR_HASHSIZE];
+
+/*
+ * Allocations too big for the subpage allocator are runs of whole
+ * pages from alloc_kpages. Each gets a pageref too, of block type
+ * BIGBLOCK and with the length of the run in nfree, and goes in the
+ * hash like any other page, so kfree and krealloc find it the same
+ * way. They are also on biglist, linked through next_samesize and
+ * prev_samesize, for kheap_printstats. All this is covered by
+ * pageref_spinlock.
+ */
+
+#define BIGBLOCK NSIZES
+
+static struct pageref *biglist;
+static unsigned bigpages;	/* pages on biglist, for stats */
 
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Locking is per block size: sizelocks[i] covers sizebases[i] and the
+ * pages on it, so allocations and frees of different sizes do not get
+ * in each other's way. pageref_spinlock covers the hash table and the
+ * pool of unused pagerefs; it is taken (briefly) with a size lock held,
+ * never the other way around.
+ *
+ * kfree looks its page up in the hash before it knows which size lock
+ * to take. That is safe because the block being freed keeps its page
+ * from going away, so the pageref found cannot be reused meanwhile.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static struct spinlock sizelocks[NSIZES] = {
+	SPINLOCK_INITIALIZER, SPINLOCK_INITIALIZER,
+	SPINLOCK_INITIALIZER, SPINLOCK_INITIALIZER,
+	SPINLOCK_INITIALIZER, SPINLOCK_INITIALIZER,
+	SPINLOCK_INITIALIZER, SPINLOCK_INITIALIZER,
+};
+static struct spinlock pageref_spinlock = SPINLOCK_INITIALIZER;
+
+////////////////////////////////////////
+
+/*
+ * Get a pageref, adding another page of them if need be. Called with
+ * no locks held; returns with pageref_spinlock held, unless out of
+ * memory, in which case it returns NULL.
+ */
+static
+struct pageref *
+getpageref(void)
+{
+	struct pageref *pr;
+	vaddr_t prrefs;
+
+	spinlock_acquire(&pageref_spinlock);
+	pr = allocpageref();
+	if (pr==NULL) {
+		/*
+		 * Get another page of pagerefs without the lock, as
+		 * alloc_kpages may come back here.
+		 */
+		spinlock_release(&pageref_spinlock);
+		prrefs = alloc_kpages(1);
+		if (prrefs==0) {
+			return NULL;
+		}
+		spinlock_acquire(&pageref_spinlock);
+		addpagerefs((struct pageref *)prrefs, NPAGEREFS);
+		pr = allocpageref();
+		KASSERT(pr != NULL);
+	}
+	return pr;
+}
 
 ////////////////////////////////////////
 
@@ -216,7 +302,7 @@ checksubpage(struct pageref *pr)
 	int blktype;
 	int nfree=0;
 
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(spinlock_do_i_hold(&sizelocks[PR_BLOCKTYPE(pr)]));
 
 	if (pr->freelist_offset == INVALID_OFFSET) {
 		KASSERT(pr->nfree==0);
@@ -247,34 +333,33 @@ checksubpage(struct pageref *pr)
 #endif
 
 #ifdef SLOWER
+static struct pageref *lookup_pageref(vaddr_t addr);
+
+/*
+ * Check the pages of one size; the others may be changing under us.
+ */
 static
 void
-checksubpages(void)
+checksubpages(int blktype)
 {
 	struct pageref *pr;
-	int i;
-	unsigned sc=0, ac=0;
+	unsigned sc=0;
 
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
-
-	for (i=0; i<NSIZES; i++) {
-		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
-			checksubpage(pr);
-			KASSERT(sc < NPAGEREFS);
-			sc++;
-		}
-	}
+	KASSERT(spinlock_do_i_hold(&sizelocks[blktype]));
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
 		checksubpage(pr);
-		KASSERT(ac < NPAGEREFS);
-		ac++;
-	}
+		KASSERT(sc < npagerefs);
+		sc++;
 
-	KASSERT(sc==ac);
+		spinlock_acquire(&pageref_spinlock);
+		KASSERT(lookup_pageref(PR_PAGEADDR(pr)) == pr);
+		spinlock_release(&pageref_spinlock);
+	}
 }
 #else
-#define checksubpages() 
+#define checksubpages(blktype) ((void)(blktype))
 #endif
 
 ////////////////////////////////////////
@@ -290,7 +375,7 @@ dumpsubpage(struct pageref *pr)
 	uint32_t freemap[PAGE_SIZE / (SMALLEST_SUBPAGE_SIZE*32)];
 
 	checksubpage(pr);
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(spinlock_do_i_hold(&sizelocks[PR_BLOCKTYPE(pr)]));
 
 	/* clear freemap[] */
 	for (i=0; i<sizeof(freemap)/sizeof(freemap[0]); i++) {
@@ -334,21 +419,53 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	unsigned i, npages, nfree;
 
 	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<NSIZES; i++) {
+		spinlock_acquire(&sizelocks[i]);
+	}
 
 	kprintf("Subpage allocator status:\n");
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		dumpsubpage(pr);
+	for (i=0; i<NSIZES; i++) {
+		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+			dumpsubpage(pr);
+		}
+	}
+
+	/* Free blocks are memory the heap holds but cannot use elsewhere. */
+	kprintf("Fragmentation:\n");
+	for (i=0; i<NSIZES; i++) {
+		npages = nfree = 0;
+		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+			npages++;
+			nfree += pr->nfree;
+		}
+		kprintf("size %-4lu %4u pages, %5u/%-5u blocks free\n",
+			(unsigned long)sizes[i], npages, nfree,
+			npages * (unsigned)(PAGE_SIZE / sizes[i]));
 	}
 
-	spinlock_release(&kmalloc_spinlock);
+	spinlock_acquire(&pageref_spinlock);
+	kprintf("Large allocations: %u pages\n", bigpages);
+	for (pr = biglist; pr != NULL; pr = pr->next_samesize) {
+		kprintf("at 0x%08lx: %u pages\n",
+			(unsigned long)PR_PAGEADDR(pr), (unsigned)pr->nfree);
+	}
+	spinlock_release(&pageref_spinlock);
+
+	for (i=NSIZES; i-- > 0; ) {
+		spinlock_release(&sizelocks[i]);
+	}
 }
 
 ////////////////////////////////////////
 
+/*
+ * Take a page that has become free off its lists and give back its
+ * pageref. The size lock for BLKTYPE held.
+ */
 static
 void
 remove_lists(struct pageref *pr, int blktype)
@@ -356,22 +473,50 @@ remove_lists(struct pageref *pr, int blktype)
 	struct pageref **guy;
 
 	KASSERT(blktype>=0 && blktype<NSIZES);
+	KASSERT(spinlock_do_i_hold(&sizelocks[blktype]));
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
+	if (pr->prev_samesize != NULL) {
+		pr->prev_samesize->next_samesize = pr->next_samesize;
+	}
+	else {
+		KASSERT(sizebases[blktype] == pr);
+		sizebases[blktype] = pr->next_samesize;
+	}
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr->prev_samesize;
+	}
+
+	spinlock_acquire(&pageref_spinlock);
+	guy = &prhash[PR_HASH(PR_PAGEADDR(pr))];
+	for (; *guy; guy = &(*guy)->next_hash) {
 		if (*guy == pr) {
-			*guy = pr->next_samesize;
+			*guy = pr->next_hash;
 			break;
 		}
 	}
+	freepageref(pr);
+	spinlock_release(&pageref_spinlock);
+}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
+/*
+ * Find the pageref for the page containing ADDR, or NULL if ADDR is
+ * not on one of our pages. pageref_spinlock held.
+ */
+static
+struct pageref *
+lookup_pageref(vaddr_t addr)
+{
+	struct pageref *pr;
+	vaddr_t page = addr & PAGE_FRAME;
+
+	KASSERT(spinlock_do_i_hold(&pageref_spinlock));
+
+	for (pr = prhash[PR_HASH(page)]; pr != NULL; pr = pr->next_hash) {
+		if (PR_PAGEADDR(pr) == page) {
+			return pr;
 		}
 	}
+	return NULL;
 }
 
 static
@@ -409,9 +554,9 @@ subpage_kmalloc(size_t sz)
 	blktype = blocktype(sz);
 	sz = sizes[blktype];
 
-	spinlock_acquire(&kmalloc_spinlock);
+	spinlock_acquire(&sizelocks[blktype]);
 
-	checksubpages();
+	checksubpages(blktype);
 
 	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
 
@@ -443,9 +588,9 @@ subpage_kmalloc(size_t sz)
 				pr->freelist_offset = INVALID_OFFSET;
 			}
 
-			checksubpages();
+			checksubpages(blktype);
 
-			spinlock_release(&kmalloc_spinlock);
+			spinlock_release(&sizelocks[blktype]);
 			return retptr;
 		}
 	}
@@ -459,27 +604,30 @@ subpage_kmalloc(size_t sz)
 	 * Note that this means things can change behind our back...
 	 */
 
-	spinlock_release(&kmalloc_spinlock);
+	spinlock_release(&sizelocks[blktype]);
 	prpage = alloc_kpages(1);
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
 		return NULL;
 	}
-	spinlock_acquire(&kmalloc_spinlock);
 
-	pr = allocpageref();
+	pr = getpageref();
 	if (pr==NULL) {
-		/* Couldn't allocate accounting space for the new page. */
-		spinlock_release(&kmalloc_spinlock);
+		/* Couldn't allocate accounting space for the page. */
 		free_kpages(prpage);
-		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
+		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
 		return NULL;
 	}
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
 	pr->nfree = PAGE_SIZE / sizes[blktype];
 
+	/* Nobody can look for it until we hand out a block from it. */
+	pr->next_hash = prhash[PR_HASH(prpage)];
+	prhash[PR_HASH(prpage)] = pr;
+	spinlock_release(&pageref_spinlock);
+
 	/*
 	 * Note: fl is volatile because the MIPS toolchain we were
 	 * using in spring 2001 attempted to optimize this loop and
@@ -498,12 +646,14 @@ subpage_kmalloc(size_t sz)
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
+	spinlock_acquire(&sizelocks[blktype]);
+	pr->prev_samesize = NULL;
 	pr->next_samesize = sizebases[blktype];
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr;
+	}
 	sizebases[blktype] = pr;
 
-	pr->next_all = allbase;
-	allbase = pr;
-
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
@@ -522,28 +672,25 @@ subpage_kfree(void *ptr)
 
 	ptraddr = (vaddr_t)ptr;
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
+	spinlock_acquire(&pageref_spinlock);
+	pr = lookup_pageref(ptraddr);
+	spinlock_release(&pageref_spinlock);
+	if (pr==NULL || PR_BLOCKTYPE(pr) == BIGBLOCK) {
+		/* Not on any of our subpage pages */
+		return -1;
+	}
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
 
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
+	/* check for corruption */
+	KASSERT(blktype>=0 && blktype<NSIZES);
 
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
+	spinlock_acquire(&sizelocks[blktype]);
 
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
+	checksubpages(blktype);
+	checksubpage(pr);
+	KASSERT(PR_PAGEADDR(pr) == prpage);
 
 	offset = ptraddr - prpage;
 
@@ -554,9 +701,11 @@ subpage_kfree(void *ptr)
 
 	/*
 	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
+	 * uses of dangling pointers. (Not in performance builds.)
 	 */
+#if !OPT_PERF
 	fill_deadbeef(ptr, sizes[blktype]);
+#endif
 
 	/*
 	 * We probably ought to check for free twice by seeing if the block
@@ -577,19 +726,18 @@ subpage_kfree(void *ptr)
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
+		/* Call free_kpages without the size lock. */
+		spinlock_release(&sizelocks[blktype]);
 		free_kpages(prpage);
 	}
 	else {
-		spinlock_release(&kmalloc_spinlock);
+		spinlock_release(&sizelocks[blktype]);
 	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
-	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
-	spinlock_release(&kmalloc_spinlock);
+	spinlock_acquire(&sizelocks[blktype]);
+	checksubpages(blktype);
+	spinlock_release(&sizelocks[blktype]);
 #endif
 
 	return 0;
@@ -597,38 +745,234 @@ subpage_kfree(void *ptr)
 
 //
 ////////////////////////////////////////////////////////////
+//
+// Large allocations
 
+static
 void *
-kmalloc(size_t sz)
+bigpage_kmalloc(size_t sz)
 {
-	if (sz>=LARGEST_SUBPAGE_SIZE) {
-		unsigned long npages;
-		vaddr_t address;
+	struct pageref *pr;
+	unsigned long npages;
+	vaddr_t address;
+
+	/* Round up to a whole number of pages. */
+	npages = DIVROUNDUP(sz, PAGE_SIZE);
+	KASSERT(npages < INVALID_OFFSET);
+	address = alloc_kpages(npages);
+	if (address==0) {
+		return NULL;
+	}
 
-		/* Round up to a whole number of pages. */
-		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
-		if (address==0) {
-			return NULL;
-		}
+	pr = getpageref();
+	if (pr==NULL) {
+		free_kpages(address);
+		return NULL;
+	}
+	pr->pageaddr_and_blocktype = MKPAB(address, BIGBLOCK);
+	pr->freelist_offset = INVALID_OFFSET;
+	pr->nfree = npages;
+
+	pr->next_hash = prhash[PR_HASH(address)];
+	prhash[PR_HASH(address)] = pr;
 
-		return (void *)address;
+	pr->prev_samesize = NULL;
+	pr->next_samesize = biglist;
+	if (biglist != NULL) {
+		biglist->prev_samesize = pr;
+	}
+	biglist = pr;
+	bigpages += npages;
+
+	spinlock_release(&pageref_spinlock);
+	return (void *)address;
+}
+
+static
+void
+bigpage_kfree(void *ptr)
+{
+	struct pageref *pr, **guy;
+	vaddr_t address = (vaddr_t)ptr;
+
+	spinlock_acquire(&pageref_spinlock);
+	pr = lookup_pageref(address);
+	if (pr==NULL || PR_BLOCKTYPE(pr) != BIGBLOCK ||
+	    PR_PAGEADDR(pr) != address) {
+		panic("kfree: free of invalid addr %p\n", ptr);
+	}
+
+	for (guy = &prhash[PR_HASH(address)]; *guy != pr;
+	     guy = &(*guy)->next_hash) {
+		KASSERT(*guy != NULL);
+	}
+	*guy = pr->next_hash;
+
+	if (pr->prev_samesize != NULL) {
+		pr->prev_samesize->next_samesize = pr->next_samesize;
+	}
+	else {
+		KASSERT(biglist == pr);
+		biglist = pr->next_samesize;
+	}
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr->prev_samesize;
+	}
+	bigpages -= pr->nfree;
+	freepageref(pr);
+
+	spinlock_release(&pageref_spinlock);
+	free_kpages(address);
+}
+
+//
+////////////////////////////////////////////////////////////
+
+static
+void *
+doalloc(size_t sz)
+{
+	if (sz>=LARGEST_SUBPAGE_SIZE) {
+		return bigpage_kmalloc(sz);
 	}
 
 	return subpage_kmalloc(sz);
 }
 
+static
 void
-kfree(void *ptr)
+dofree(void *ptr)
+{
+	/*
+	 * Try subpage first; if that fails, it's a big allocation.
+	 */
+	if (subpage_kfree(ptr)) {
+		bigpage_kfree(ptr);
+	}
+}
+
+void *
+kmalloc(size_t sz)
+{
+	void *ptr;
+
+	ptr = doalloc(sz);
+	KPROF_ALLOC(ptr, sz);
+	return ptr;
+}
+
+void *
+kmalloc_aligned(size_t sz, size_t align)
 {
+	void *ptr;
+
+	KASSERT(align > 0 && (align & (align - 1)) == 0);
+	KASSERT(align <= PAGE_SIZE);
+
 	/*
-	 * Try subpage first; if that fails, assume it's a big allocation.
+	 * Subpage blocks are powers of two in size and sit at multiples
+	 * of their size within the page, and large blocks are whole
+	 * pages, so any block of at least ALIGN bytes is aligned to it.
 	 */
+	ptr = doalloc(sz > align ? ROUNDUP(sz, align) : align);
+	KASSERT(((vaddr_t)ptr & (align - 1)) == 0);
+	KPROF_ALLOC(ptr, sz);
+	return ptr;
+}
+
+void
+kfree(void *ptr)
+{
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
-		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
-		free_kpages((vaddr_t)ptr);
 	}
+	KPROF_FREE(ptr);
+	dofree(ptr);
+}
+
+/*
+ * Find the pageref of the kmalloc'd block PTR, with the size it really
+ * has. As in kfree, the block keeps its pageref alive; and only the
+ * block's owner, who is the caller, changes a large one's length.
+ */
+static
+struct pageref *
+blockinfo(void *ptr, size_t *size_ret)
+{
+	struct pageref *pr;
+
+	spinlock_acquire(&pageref_spinlock);
+	pr = lookup_pageref((vaddr_t)ptr);
+	spinlock_release(&pageref_spinlock);
+	if (pr==NULL) {
+		panic("kmalloc: invalid addr %p\n", ptr);
+	}
+	if (PR_BLOCKTYPE(pr) == BIGBLOCK) {
+		KASSERT(PR_PAGEADDR(pr) == (vaddr_t)ptr);
+		*size_ret = pr->nfree * PAGE_SIZE;
+	}
+	else {
+		*size_ret = sizes[PR_BLOCKTYPE(pr)];
+	}
+	return pr;
+}
+
+size_t
+ksize(void *ptr)
+{
+	size_t size;
+
+	if (ptr == NULL) {
+		return 0;
+	}
+	blockinfo(ptr, &size);
+	return size;
+}
+
+void *
+krealloc(void *ptr, size_t sz)
+{
+	struct pageref *pr;
+	size_t oldsz;
+	unsigned long npages;
+	void *newptr;
+
+	if (ptr == NULL) {
+		newptr = doalloc(sz);
+		KPROF_ALLOC(newptr, sz);
+		return newptr;
+	}
+
+	pr = blockinfo(ptr, &oldsz);
+	if (sz <= oldsz) {
+		/* Fits in the bucket or run it already has. */
+		KPROF_FREE(ptr);
+		KPROF_ALLOC(ptr, sz);
+		return ptr;
+	}
+
+	if (PR_BLOCKTYPE(pr) == BIGBLOCK) {
+		npages = DIVROUNDUP(sz, PAGE_SIZE);
+		if (npages < INVALID_OFFSET &&
+		    grow_kpages((vaddr_t)ptr, npages)) {
+			spinlock_acquire(&pageref_spinlock);
+			bigpages += npages - pr->nfree;
+			pr->nfree = npages;
+			spinlock_release(&pageref_spinlock);
+			KPROF_FREE(ptr);
+			KPROF_ALLOC(ptr, sz);
+			return ptr;
+		}
+	}
+
+	newptr = doalloc(sz);
+	if (newptr == NULL) {
+		return NULL;
+	}
+	memcpy(newptr, ptr, oldsz);
+	KPROF_FREE(ptr);
+	KPROF_ALLOC(newptr, sz);
+	dofree(ptr);
+	return newptr;
 }
 
@@ -0,0 +1,272 @@
+/*
+ * Kernel heap profiling. See kmallocprof.h.
+ *
+ * Sites are kept in an open-addressed table keyed on the return
+ * address. Live blocks each have a record, from a fixed pool, hashed
+ * on the block's address, saying which site made it and how big it
+ * is. One spinlock covers everything; it is only ever taken by itself.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <kmallocprof.h>
+
+#define KPROF_NSITES	512	/* power of 2 */
+#define KPROF_NBLOCKS	4096
+#define KPROF_NHASH	1024	/* power of 2 */
+
+struct kprof_site {
+	vaddr_t ks_site;		/* 0 if unused */
+	unsigned ks_allocs;
+	unsigned ks_frees;
+	unsigned ks_untracked;		/* allocations with no block record */
+	size_t ks_live;			/* bytes */
+	size_t ks_peak;
+	unsigned ks_oldcount;		/* for kmallocprof_printlive */
+	size_t ks_oldbytes;
+};
+
+struct kprof_block {
+	void *kb_ptr;
+	size_t kb_size;
+	struct kprof_site *kb_site;	/* NULL if not in use */
+	unsigned kb_epoch;
+	struct kprof_block *kb_next;	/* hash chain or free list */
+};
+
+#define KPROF_SITEHASH(site)	(((site) >> 2) & (KPROF_NSITES - 1))
+#define KPROF_BLOCKHASH(ptr)	(((vaddr_t)(ptr) >> 4) & (KPROF_NHASH - 1))
+
+static struct spinlock kprof_lock = SPINLOCK_INITIALIZER;
+static struct kprof_site kprof_sites[KPROF_NSITES];
+static unsigned kprof_nsites;
+static unsigned kprof_lostsites;	/* allocations from sites not in the table */
+static struct kprof_block kprof_blocks[KPROF_NBLOCKS];
+static struct kprof_block *kprof_hash[KPROF_NHASH];
+static struct kprof_block *kprof_free;
+static unsigned kprof_nused;		/* pool entries ever handed out */
+static bool kprof_shown[KPROF_NSITES];	/* for kmallocprof_print */
+static unsigned kprof_epoch;
+
+/*
+ * Find SITE's entry, making it if need be. Returns NULL if the table
+ * is full. kprof_lock held.
+ */
+static
+struct kprof_site *
+kprof_getsite(vaddr_t site)
+{
+	unsigned i, n;
+
+	i = KPROF_SITEHASH(site);
+	for (n = 0; n < KPROF_NSITES; n++) {
+		if (kprof_sites[i].ks_site == site) {
+			return &kprof_sites[i];
+		}
+		if (kprof_sites[i].ks_site == 0) {
+			if (kprof_nsites == KPROF_NSITES - 1) {
+				/* keep one empty slot to end searches */
+				return NULL;
+			}
+			kprof_nsites++;
+			kprof_sites[i].ks_site = site;
+			return &kprof_sites[i];
+		}
+		i = (i + 1) & (KPROF_NSITES - 1);
+	}
+	return NULL;
+}
+
+static
+struct kprof_block *
+kprof_getblock(void)
+{
+	struct kprof_block *kb;
+
+	if (kprof_free != NULL) {
+		kb = kprof_free;
+		kprof_free = kb->kb_next;
+		return kb;
+	}
+	if (kprof_nused < KPROF_NBLOCKS) {
+		return &kprof_blocks[kprof_nused++];
+	}
+	return NULL;
+}
+
+void
+kmallocprof_alloc(vaddr_t site, void *ptr, size_t size)
+{
+	struct kprof_site *ks;
+	struct kprof_block *kb;
+	unsigned h;
+
+	spinlock_acquire(&kprof_lock);
+	ks = kprof_getsite(site);
+	if (ks == NULL) {
+		kprof_lostsites++;
+		spinlock_release(&kprof_lock);
+		return;
+	}
+	ks->ks_allocs++;
+
+	kb = kprof_getblock();
+	if (kb == NULL) {
+		ks->ks_untracked++;
+		spinlock_release(&kprof_lock);
+		return;
+	}
+	kb->kb_ptr = ptr;
+	kb->kb_size = size;
+	kb->kb_site = ks;
+	kb->kb_epoch = kprof_epoch;
+	h = KPROF_BLOCKHASH(ptr);
+	kb->kb_next = kprof_hash[h];
+	kprof_hash[h] = kb;
+
+	ks->ks_live += size;
+	if (ks->ks_live > ks->ks_peak) {
+		ks->ks_peak = ks->ks_live;
+	}
+	spinlock_release(&kprof_lock);
+}
+
+void
+kmallocprof_free(void *ptr)
+{
+	struct kprof_block **p, *kb;
+
+	spinlock_acquire(&kprof_lock);
+	for (p = &kprof_hash[KPROF_BLOCKHASH(ptr)]; *p != NULL;
+	     p = &(*p)->kb_next) {
+		if ((*p)->kb_ptr == ptr) {
+			break;
+		}
+	}
+	kb = *p;
+	if (kb != NULL) {
+		*p = kb->kb_next;
+		kb->kb_site->ks_frees++;
+		KASSERT(kb->kb_site->ks_live >= kb->kb_size);
+		kb->kb_site->ks_live -= kb->kb_size;
+		kb->kb_site = NULL;
+		kb->kb_next = kprof_free;
+		kprof_free = kb;
+	}
+	spinlock_release(&kprof_lock);
+}
+
+void
+kmallocprof_print(void)
+{
+	struct kprof_site *ks, *best;
+	unsigned i, n;
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kprof_lock);
+
+	kprintf("kmalloc profile (%u sites):\n", kprof_nsites);
+	kprintf("    %-10s %8s %8s %8s %9s %9s\n", "site", "allocs",
+		"frees", "untrkd", "live", "peak");
+
+	for (i = 0; i < KPROF_NSITES; i++) {
+		kprof_shown[i] = false;
+	}
+	for (n = 0; n < kprof_nsites; n++) {
+		/* Selection by live bytes, then peak; the table is small. */
+		best = NULL;
+		for (i = 0; i < KPROF_NSITES; i++) {
+			ks = &kprof_sites[i];
+			if (ks->ks_site == 0 || kprof_shown[i]) {
+				continue;
+			}
+			if (best == NULL || ks->ks_live > best->ks_live ||
+			    (ks->ks_live == best->ks_live &&
+			     ks->ks_peak > best->ks_peak)) {
+				best = ks;
+			}
+		}
+		KASSERT(best != NULL);
+		kprof_shown[best - kprof_sites] = true;
+		kprintf("    0x%08lx %8u %8u %8u %9lu %9lu\n",
+			(unsigned long)best->ks_site, best->ks_allocs,
+			best->ks_frees, best->ks_untracked,
+			(unsigned long)best->ks_live,
+			(unsigned long)best->ks_peak);
+	}
+	if (kprof_lostsites > 0) {
+		kprintf("    %u allocations from sites that did not fit\n",
+			kprof_lostsites);
+	}
+
+	spinlock_release(&kprof_lock);
+}
+
+unsigned
+kmallocprof_newepoch(void)
+{
+	unsigned ret;
+
+	spinlock_acquire(&kprof_lock);
+	ret = ++kprof_epoch;
+	spinlock_release(&kprof_lock);
+	return ret;
+}
+
+unsigned
+kmallocprof_curepoch(void)
+{
+	return kprof_epoch;
+}
+
+void
+kmallocprof_printlive(unsigned from)
+{
+	struct kprof_block *kb;
+	struct kprof_site *ks;
+	unsigned i, count;
+	size_t bytes;
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kprof_lock);
+
+	if (from >= kprof_epoch) {
+		kprintf("No finished epochs from %u (now %u)\n", from,
+			kprof_epoch);
+		spinlock_release(&kprof_lock);
+		return;
+	}
+
+	for (i = 0; i < KPROF_NSITES; i++) {
+		kprof_sites[i].ks_oldcount = 0;
+		kprof_sites[i].ks_oldbytes = 0;
+	}
+	count = 0;
+	bytes = 0;
+	for (i = 0; i < kprof_nused; i++) {
+		kb = &kprof_blocks[i];
+		if (kb->kb_site == NULL || kb->kb_epoch < from ||
+		    kb->kb_epoch >= kprof_epoch) {
+			continue;
+		}
+		kb->kb_site->ks_oldcount++;
+		kb->kb_site->ks_oldbytes += kb->kb_size;
+		count++;
+		bytes += kb->kb_size;
+	}
+
+	kprintf("Live from epochs %u-%u (now %u): %u blocks, %lu bytes\n",
+		from, kprof_epoch - 1, kprof_epoch, count,
+		(unsigned long)bytes);
+	for (i = 0; i < KPROF_NSITES; i++) {
+		ks = &kprof_sites[i];
+		if (ks->ks_oldcount > 0) {
+			kprintf("    0x%08lx %8u blocks %9lu bytes\n",
+				(unsigned long)ks->ks_site, ks->ks_oldcount,
+				(unsigned long)ks->ks_oldbytes);
+		}
+	}
+
+	spinlock_release(&kprof_lock);
+}
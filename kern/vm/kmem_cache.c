@@ -0,0 +1,389 @@
+/*
+ * Object caches. See kmem_cache.h for the interface.
+ *
+ * A slab is one page from alloc_kpages: a struct kmem_slab at the
+ * start, then as many objects as fit. Being page-aligned, the slab an
+ * object belongs to is found by masking its address. The free objects
+ * of a slab are linked through a word at the end of each object (which
+ * kc_size has room for), so the link does not disturb what the
+ * constructor set up. Slabs with free objects are on the cache's
+ * kc_partial list; full ones are on no list at all.
+ *
+ * One completely free slab is kept per cache so that an object going
+ * back and forth does not make the page go back and forth with it;
+ * any more than that go back to the VM system, and that one too when
+ * memory runs short (kmem_cache_shrink).
+ *
+ * A cpu's magazine is only ever touched by that cpu, with interrupts
+ * off; holding kc_lock (a spinlock) counts.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <shrink.h>
+#include <kmem_cache.h>
+
+struct kmem_slab {
+	struct kmem_slab *ks_next;	/* on kc_partial */
+	struct kmem_slab *ks_prev;
+	struct kmem_cache *ks_cache;
+	void *ks_free;			/* free objects */
+	unsigned ks_nfree;
+};
+
+#define KMEM_SLABHDR	KMEM_ROUNDUP(sizeof(struct kmem_slab))
+#define KMEM_SLAB(obj)	((struct kmem_slab *)((vaddr_t)(obj) & PAGE_FRAME))
+#define KMEM_LINK(kc, obj) \
+	(*(void **)((char *)(obj) + (kc)->kc_size - sizeof(void *)))
+
+/* Every cache that has made a slab, for kmem_cache_printstats. */
+static struct spinlock kmem_listlock = SPINLOCK_INITIALIZER;
+static struct kmem_cache *kmem_caches;
+
+static void kmem_cache_shrink(void *data);
+static struct shrinker kmem_shrinker =
+	SHRINKER_INITIALIZER("kmem_cache", kmem_cache_shrink, NULL);
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size, void (*ctor)(void *obj))
+{
+	struct kmem_cache *kc;
+	unsigned i;
+
+	kc = kmalloc_aligned(sizeof(*kc), CACHELINE_SIZE);
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = name;
+	kc->kc_size = KMEM_ROUNDUP(size + sizeof(void *));
+	kc->kc_ctor = ctor;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_partial = NULL;
+	kc->kc_perslab = 0;
+	kc->kc_nslabs = 0;
+	kc->kc_nempty = 0;
+	kc->kc_inuse = 0;
+	kc->kc_slaballocs = 0;
+	kc->kc_next = NULL;
+	for (i = 0; i < MAXCPUS; i++) {
+		kc->kc_mags[i].km_count = 0;
+		kc->kc_mags[i].km_allocs = 0;
+		kc->kc_mags[i].km_frees = 0;
+	}
+	return kc;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Slabs
+
+static
+void
+kmem_slab_link(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	ks->ks_prev = NULL;
+	ks->ks_next = kc->kc_partial;
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks;
+	}
+	kc->kc_partial = ks;
+}
+
+static
+void
+kmem_slab_unlink(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	if (ks->ks_prev != NULL) {
+		ks->ks_prev->ks_next = ks->ks_next;
+	}
+	else {
+		KASSERT(kc->kc_partial == ks);
+		kc->kc_partial = ks->ks_next;
+	}
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks->ks_prev;
+	}
+}
+
+/*
+ * Make a new slab for KC, constructing its objects. Called without
+ * kc_lock, since alloc_kpages may sleep.
+ */
+static
+struct kmem_slab *
+kmem_slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	vaddr_t page;
+	char *obj;
+	unsigned i, n;
+
+	n = (PAGE_SIZE - KMEM_SLABHDR) / kc->kc_size;
+	KASSERT(n > 0);
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+	ks = (struct kmem_slab *)page;
+	ks->ks_cache = kc;
+	ks->ks_free = NULL;
+	ks->ks_nfree = 0;
+	for (i = 0; i < n; i++) {
+		obj = (char *)page + KMEM_SLABHDR + i * kc->kc_size;
+		if (kc->kc_ctor != NULL) {
+			kc->kc_ctor(obj);
+		}
+		KMEM_LINK(kc, obj) = ks->ks_free;
+		ks->ks_free = obj;
+		ks->ks_nfree++;
+	}
+	return ks;
+}
+
+/*
+ * Take an object from the slabs of KC, or return NULL if they are all
+ * full. kc_lock held.
+ */
+static
+void *
+kmem_slab_get(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	void *obj;
+
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	ks = kc->kc_partial;
+	if (ks == NULL) {
+		return NULL;
+	}
+	if (ks->ks_nfree == kc->kc_perslab) {
+		kc->kc_nempty--;
+	}
+	obj = ks->ks_free;
+	ks->ks_free = KMEM_LINK(kc, obj);
+	ks->ks_nfree--;
+	if (ks->ks_nfree == 0) {
+		kmem_slab_unlink(kc, ks);
+	}
+	kc->kc_inuse++;
+	return obj;
+}
+
+/*
+ * Put OBJ back in its slab. If that leaves a second completely free
+ * slab, take it out of the cache and return it for the caller to give
+ * back to the VM system once kc_lock is released. kc_lock held.
+ */
+static
+struct kmem_slab *
+kmem_slab_put(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks;
+
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+	ks = KMEM_SLAB(obj);
+	KASSERT(ks->ks_cache == kc);
+
+	if (ks->ks_nfree == 0) {
+		kmem_slab_link(kc, ks);
+	}
+	KMEM_LINK(kc, obj) = ks->ks_free;
+	ks->ks_free = obj;
+	ks->ks_nfree++;
+	kc->kc_inuse--;
+
+	if (ks->ks_nfree < kc->kc_perslab) {
+		return NULL;
+	}
+	if (kc->kc_nempty == 0) {
+		kc->kc_nempty++;
+		return NULL;
+	}
+	kmem_slab_unlink(kc, ks);
+	kc->kc_nslabs--;
+	return ks;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Allocation
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_magazine *mag;
+	struct kmem_slab *ks;
+	void *obj;
+	int spl;
+
+	if (CURCPU_EXISTS()) {
+		spl = splhigh();
+		mag = &kc->kc_mags[curcpu->c_number];
+		if (mag->km_count > 0) {
+			obj = mag->km_objs[--mag->km_count];
+			mag->km_allocs++;
+			splx(spl);
+			return obj;
+		}
+		splx(spl);
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_slaballocs++;
+	obj = kmem_slab_get(kc);
+	if (obj != NULL && CURCPU_EXISTS()) {
+		/* Fill half our magazine while we have the lock. */
+		mag = &kc->kc_mags[curcpu->c_number];
+		while (mag->km_count < KMEM_MAGSIZE / 2) {
+			mag->km_objs[mag->km_count] = kmem_slab_get(kc);
+			if (mag->km_objs[mag->km_count] == NULL) {
+				break;
+			}
+			mag->km_count++;
+		}
+	}
+	spinlock_release(&kc->kc_lock);
+	if (obj != NULL) {
+		return obj;
+	}
+
+	ks = kmem_slab_create(kc);
+	if (ks == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_perslab == 0) {
+		/* First slab; now it has stats worth showing. */
+		kc->kc_perslab = ks->ks_nfree;
+		spinlock_acquire(&kmem_listlock);
+		kc->kc_next = kmem_caches;
+		kmem_caches = kc;
+		spinlock_release(&kmem_listlock);
+	}
+	kc->kc_nslabs++;
+	kc->kc_nempty++;
+	kmem_slab_link(kc, ks);
+	obj = kmem_slab_get(kc);
+	spinlock_release(&kc->kc_lock);
+
+	KASSERT(obj != NULL);
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_magazine *mag;
+	struct kmem_slab *dead;
+	int spl;
+
+	KASSERT(obj != NULL);
+
+	if (CURCPU_EXISTS()) {
+		spl = splhigh();
+		mag = &kc->kc_mags[curcpu->c_number];
+		if (mag->km_count < KMEM_MAGSIZE) {
+			mag->km_objs[mag->km_count++] = obj;
+			mag->km_frees++;
+			splx(spl);
+			return;
+		}
+		splx(spl);
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	dead = kmem_slab_put(kc, obj);
+	if (CURCPU_EXISTS()) {
+		/* Our magazine is full; empty half of it too. */
+		mag = &kc->kc_mags[curcpu->c_number];
+		while (dead == NULL && mag->km_count > KMEM_MAGSIZE / 2) {
+			dead = kmem_slab_put(kc, mag->km_objs[--mag->km_count]);
+		}
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (dead != NULL) {
+		free_kpages((vaddr_t)dead);
+	}
+}
+
+/*
+ * Shrinker: give back the free slab each cache keeps. Caches are never
+ * taken off kmem_caches, and only go on at the head, so the list can
+ * be walked without kmem_listlock once its head has been read; that
+ * lock cannot be held while taking kc_lock, which comes first.
+ */
+static
+void
+kmem_cache_shrink(void *data)
+{
+	struct kmem_cache *kc;
+	struct kmem_slab *ks;
+
+	(void)data;
+
+	spinlock_acquire(&kmem_listlock);
+	kc = kmem_caches;
+	spinlock_release(&kmem_listlock);
+
+	for (; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		ks = NULL;
+		if (kc->kc_nempty > 0) {
+			for (ks = kc->kc_partial; ks->ks_nfree < kc->kc_perslab;
+			     ks = ks->ks_next) {
+				KASSERT(ks->ks_next != NULL);
+			}
+			kmem_slab_unlink(kc, ks);
+			kc->kc_nslabs--;
+			kc->kc_nempty--;
+		}
+		spinlock_release(&kc->kc_lock);
+
+		if (ks != NULL) {
+			free_kpages((vaddr_t)ks);
+		}
+	}
+}
+
+void
+kmem_cache_bootstrap(void)
+{
+	shrinker_register(&kmem_shrinker);
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+	unsigned i, allocs, frees, cached;
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kmem_listlock);
+
+	kprintf("Object caches:\n");
+	kprintf("    %-12s %5s %6s %6s %6s %9s %9s %9s\n", "name", "size",
+		"slabs", "inuse", "cached", "magalloc", "magfree", "slaballoc");
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		allocs = frees = cached = 0;
+		for (i = 0; i < MAXCPUS; i++) {
+			allocs += kc->kc_mags[i].km_allocs;
+			frees += kc->kc_mags[i].km_frees;
+			cached += kc->kc_mags[i].km_count;
+		}
+		kprintf("    %-12s %5u %6u %6u %6u %9u %9u %9u\n", kc->kc_name,
+			(unsigned)kc->kc_size, kc->kc_nslabs,
+			kc->kc_inuse - cached, cached, allocs, frees,
+			kc->kc_slaballocs);
+	}
+
+	spinlock_release(&kmem_listlock);
+}
@@ -0,0 +1,38 @@
+/*
+ * Running out of memory. See oom.h.
+ *
+ * The caller may hold locks, its own as_lock at least, so this never
+ * waits for anything in particular: it naps and lets the caller look
+ * again. The victim's threads may need those same locks to get out,
+ * which is why the naps are counted.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <current.h>
+#include <proc.h>
+#include <shrink.h>
+#include <oom.h>
+
+bool
+oom_wait(unsigned tries)
+{
+	pid_t victim;
+
+	if (tries >= OOM_TRIES) {
+		return false;
+	}
+	shrink_wake();
+
+	victim = proc_oomvictim(tries > 0 && tries % OOM_PATIENCE == 0);
+	if (victim == 0) {
+		/* Kernel memory only; nobody to blame. */
+		return false;
+	}
+	if (curproc != NULL && curproc->pid == victim) {
+		return false;
+	}
+	clocknap(1);
+	return true;
+}
@@ -0,0 +1,388 @@
+/*
+ * The page cache. See pagecache.h for details.
+ *
+ * Cached pages are in a hash table by (vnode, offset), and on a list
+ * from the least recently looked up to the most, for the shrinker.
+ * pagecache_lock covers both, the pages' fields, and each vnode's
+ * vn_cachedpages. It is taken with some as_lock or some filesystem's
+ * vnode lock held, so it is never held while getting either, nor
+ * while dropping a frame or vnode reference: pages that are let go of
+ * are unhooked under the lock and freed after it.
+ *
+ * vn_cachedpages is looked at without the lock first, so that reads
+ * and writes of files with nothing cached never take it.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <shrink.h>
+#include <pagecache.h>
+#include <execcache.h>
+
+#define PC_NHASH 512	/* power of two */
+
+struct pcpage {
+	struct vnode *pp_vnode;
+	off_t pp_offset;		/* page-aligned */
+	size_t pp_len;			/* bytes from the file */
+	paddr_t pp_paddr;
+	struct pcpage *pp_hashnext;
+	struct pcpage *pp_lruprev;
+	struct pcpage *pp_lrunext;
+};
+
+static struct lock *pagecache_lock;
+static struct pcpage *pagecache_hash[PC_NHASH];
+static struct pcpage *pagecache_lru;		/* oldest */
+static struct pcpage *pagecache_lrutail;	/* newest */
+
+static void pagecache_shrink(void *data);
+static struct shrinker pagecache_shrinker =
+	SHRINKER_INITIALIZER("pagecache", pagecache_shrink, NULL);
+
+void
+pagecache_bootstrap(void)
+{
+	pagecache_lock = lock_create("pagecache");
+	if (pagecache_lock == NULL) {
+		panic("pagecache_bootstrap: Out of memory\n");
+	}
+	shrinker_register(&pagecache_shrinker);
+}
+
+static
+unsigned
+pagecache_hashfn(struct vnode *v, off_t offset)
+{
+	return ((uintptr_t)v / sizeof(void *) * 31 +
+		(unsigned)(offset / PAGE_SIZE)) & (PC_NHASH - 1);
+}
+
+static
+void
+pagecache_lru_remove(struct pcpage *pp)
+{
+	if (pp->pp_lruprev != NULL) {
+		pp->pp_lruprev->pp_lrunext = pp->pp_lrunext;
+	}
+	else {
+		pagecache_lru = pp->pp_lrunext;
+	}
+	if (pp->pp_lrunext != NULL) {
+		pp->pp_lrunext->pp_lruprev = pp->pp_lruprev;
+	}
+	else {
+		pagecache_lrutail = pp->pp_lruprev;
+	}
+	pp->pp_lrunext = pp->pp_lruprev = NULL;
+}
+
+static
+void
+pagecache_lru_addtail(struct pcpage *pp)
+{
+	pp->pp_lrunext = NULL;
+	pp->pp_lruprev = pagecache_lrutail;
+	if (pagecache_lrutail != NULL) {
+		pagecache_lrutail->pp_lrunext = pp;
+	}
+	else {
+		pagecache_lru = pp;
+	}
+	pagecache_lrutail = pp;
+}
+
+/*
+ * The page of V at OFFSET, or NULL. Lock held.
+ */
+static
+struct pcpage *
+pagecache_find(struct vnode *v, off_t offset)
+{
+	struct pcpage *pp;
+
+	KASSERT(lock_do_i_hold(pagecache_lock));
+
+	pp = pagecache_hash[pagecache_hashfn(v, offset)];
+	for (; pp != NULL; pp = pp->pp_hashnext) {
+		if (pp->pp_vnode == v && pp->pp_offset == offset) {
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take PP out of the cache and put it on *FREELIST, chained through
+ * pp_hashnext, for pagecache_free. Lock held.
+ */
+static
+void
+pagecache_unhook(struct pcpage *pp, struct pcpage **freelist)
+{
+	struct pcpage **ppp;
+
+	KASSERT(lock_do_i_hold(pagecache_lock));
+
+	ppp = &pagecache_hash[pagecache_hashfn(pp->pp_vnode, pp->pp_offset)];
+	while (*ppp != pp) {
+		KASSERT(*ppp != NULL);
+		ppp = &(*ppp)->pp_hashnext;
+	}
+	*ppp = pp->pp_hashnext;
+	pagecache_lru_remove(pp);
+	KASSERT(pp->pp_vnode->vn_cachedpages > 0);
+	pp->pp_vnode->vn_cachedpages--;
+
+	pp->pp_hashnext = *freelist;
+	*freelist = pp;
+}
+
+/*
+ * Drop the references of the pages on FREELIST and free them. Lock
+ * not held.
+ */
+static
+void
+pagecache_free(struct pcpage *freelist)
+{
+	struct pcpage *pp;
+
+	KASSERT(!lock_do_i_hold(pagecache_lock));
+
+	while (freelist != NULL) {
+		pp = freelist;
+		freelist = pp->pp_hashnext;
+		coremap_free(pp->pp_paddr);
+		VOP_DECREF(pp->pp_vnode);
+		kfree(pp);
+	}
+}
+
+bool
+pagecache_lookup(struct vnode *v, off_t offset, size_t len, paddr_t *ret)
+{
+	struct pcpage *pp;
+	bool found;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	if (v->vn_cachedpages == 0) {
+		return false;
+	}
+
+	lock_acquire(pagecache_lock);
+	pp = pagecache_find(v, offset);
+	found = pp != NULL && pp->pp_len == len &&
+		coremap_tryincref(pp->pp_paddr);
+	if (found) {
+		*ret = pp->pp_paddr;
+		pagecache_lru_remove(pp);
+		pagecache_lru_addtail(pp);
+	}
+	lock_release(pagecache_lock);
+	return found;
+}
+
+bool
+pagecache_insert(struct vnode *v, off_t offset, size_t len, paddr_t paddr,
+		 paddr_t *ret)
+{
+	struct pcpage *pp, *newpp;
+	unsigned h;
+	bool shared;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+	KASSERT(len > 0 && len <= PAGE_SIZE);
+
+	newpp = kmalloc(sizeof(*newpp));
+	if (newpp == NULL) {
+		return false;
+	}
+
+	lock_acquire(pagecache_lock);
+	pp = pagecache_find(v, offset);
+	if (pp != NULL) {
+		/* Somebody read it in at the same time. */
+		shared = pp->pp_len == len && coremap_tryincref(pp->pp_paddr);
+		*ret = pp->pp_paddr;
+	}
+	else {
+		coremap_incref(paddr);
+		VOP_INCREF(v);
+		newpp->pp_vnode = v;
+		newpp->pp_offset = offset;
+		newpp->pp_len = len;
+		newpp->pp_paddr = paddr;
+		h = pagecache_hashfn(v, offset);
+		newpp->pp_hashnext = pagecache_hash[h];
+		pagecache_hash[h] = newpp;
+		pagecache_lru_addtail(newpp);
+		v->vn_cachedpages++;
+		newpp = NULL;
+		shared = true;
+		*ret = paddr;
+	}
+	lock_release(pagecache_lock);
+
+	if (newpp != NULL) {
+		kfree(newpp);
+	}
+	return shared;
+}
+
+int
+pagecache_read(struct vnode *v, struct uio *uio)
+{
+	struct pcpage *pp;
+	paddr_t paddr;
+	off_t offset;
+	size_t len, amt;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	while (uio->uio_resid > 0 && v->vn_cachedpages > 0) {
+		offset = uio->uio_offset - uio->uio_offset % PAGE_SIZE;
+
+		lock_acquire(pagecache_lock);
+		pp = pagecache_find(v, offset);
+		if (pp == NULL || uio->uio_offset >= offset + pp->pp_len ||
+		    !coremap_tryincref(pp->pp_paddr)) {
+			lock_release(pagecache_lock);
+			break;
+		}
+		paddr = pp->pp_paddr;
+		len = pp->pp_len;
+		lock_release(pagecache_lock);
+
+		/* The frame stays put while we hold a reference. */
+		amt = offset + len - uio->uio_offset;
+		if (amt > uio->uio_resid) {
+			amt = uio->uio_resid;
+		}
+		result = uiomove((char *)PADDR_TO_KVADDR(paddr) +
+				 (uio->uio_offset - offset), amt, uio);
+		coremap_free(paddr);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+void
+pagecache_invalidate(struct vnode *v, off_t start, off_t end)
+{
+	struct pcpage *pp, *next, *freelist = NULL;
+	off_t offset;
+
+	execcache_forget(v);
+	if (v->vn_cachedpages == 0 || start >= end) {
+		return;
+	}
+	start -= start % PAGE_SIZE;
+
+	lock_acquire(pagecache_lock);
+	if ((end - start) / PAGE_SIZE <= v->vn_cachedpages) {
+		for (offset = start; offset < end; offset += PAGE_SIZE) {
+			pp = pagecache_find(v, offset);
+			if (pp != NULL) {
+				pagecache_unhook(pp, &freelist);
+			}
+		}
+	}
+	else {
+		/* A long range over a few pages; look at the pages. */
+		for (pp = pagecache_lru; pp != NULL; pp = next) {
+			next = pp->pp_lrunext;
+			if (pp->pp_vnode == v && pp->pp_offset < end &&
+			    pp->pp_offset + (off_t)pp->pp_len > start) {
+				pagecache_unhook(pp, &freelist);
+			}
+		}
+	}
+	lock_release(pagecache_lock);
+
+	pagecache_free(freelist);
+}
+
+void
+pagecache_purge(struct vnode *v)
+{
+	struct pcpage *pp, *next, *freelist = NULL;
+
+	execcache_forget(v);
+	if (v->vn_cachedpages == 0) {
+		return;
+	}
+
+	lock_acquire(pagecache_lock);
+	for (pp = pagecache_lru; pp != NULL && v->vn_cachedpages > 0;
+	     pp = next) {
+		next = pp->pp_lrunext;
+		if (pp->pp_vnode == v) {
+			pagecache_unhook(pp, &freelist);
+		}
+	}
+	lock_release(pagecache_lock);
+
+	pagecache_free(freelist);
+}
+
+void
+pagecache_purgefs(struct fs *fs)
+{
+	struct pcpage *pp, *next, *freelist = NULL;
+
+	execcache_forgetfs(fs);
+
+	lock_acquire(pagecache_lock);
+	for (pp = pagecache_lru; pp != NULL; pp = next) {
+		next = pp->pp_lrunext;
+		if (pp->pp_vnode->vn_fs == fs) {
+			pagecache_unhook(pp, &freelist);
+		}
+	}
+	lock_release(pagecache_lock);
+
+	pagecache_free(freelist);
+}
+
+/*
+ * Shrinker: let go of the oldest half of the pages nobody maps (whose
+ * frame only the cache refers to). Those that are mapped would not
+ * come free anyway.
+ */
+static
+void
+pagecache_shrink(void *data)
+{
+	struct pcpage *pp, *next, *freelist = NULL;
+	unsigned unmapped = 0, n = 0;
+
+	(void)data;
+
+	lock_acquire(pagecache_lock);
+	for (pp = pagecache_lru; pp != NULL; pp = pp->pp_lrunext) {
+		if (coremap_refcount(pp->pp_paddr) == 1) {
+			unmapped++;
+		}
+	}
+	for (pp = pagecache_lru; pp != NULL && n < (unmapped + 1) / 2;
+	     pp = next) {
+		next = pp->pp_lrunext;
+		if (coremap_refcount(pp->pp_paddr) == 1) {
+			pagecache_unhook(pp, &freelist);
+			n++;
+		}
+	}
+	lock_release(pagecache_lock);
+
+	pagecache_free(freelist);
+}
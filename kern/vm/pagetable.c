@@ -0,0 +1,75 @@
+/*
+ * Two-level user page tables. See pagetable.h for details.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < PT_ENTRIES; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i, j;
+	pte_t *l2;
+
+	KASSERT(pt != NULL);
+
+	for (i = 0; i < PT_ENTRIES; i++) {
+		l2 = pt->pt_dir[i];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_ENTRIES; j++) {
+			if (l2[j] & PTE_VALID) {
+				coremap_free(l2[j] & PTE_FRAME);
+			}
+			else if (l2[j] & PTE_SWAPPED) {
+				swap_free(PTE_SLOT(l2[j]));
+			}
+		}
+		kfree(l2);
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	pte_t *l2;
+	unsigned i;
+
+	l2 = pt->pt_dir[PT_L1_INDEX(vaddr)];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = kmalloc(PT_ENTRIES * sizeof(pte_t));
+		if (l2 == NULL) {
+			return NULL;
+		}
+		for (i = 0; i < PT_ENTRIES; i++) {
+			l2[i] = 0;
+		}
+		pt->pt_dir[PT_L1_INDEX(vaddr)] = l2;
+	}
+	return &l2[PT_L2_INDEX(vaddr)];
+}
@@ -0,0 +1,301 @@
+/*
+ * Shared memory segments. See shm.h.
+ *
+ * Segments live in a fixed table of SHMMNI slots. A segment's id is
+ * its slot plus SHMMNI times a count of the segments made so far, so
+ * that an id left over from a removed segment does not find whatever
+ * is in its slot now.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/shm.h>
+#include <lib.h>
+#include <synch.h>
+#include <vm.h>
+#include <coremap.h>
+#include <shm.h>
+
+/* Ids go up to SHM_MAXGEN * SHMMNI, and so stay positive. */
+#define SHM_MAXGEN (0x7fffffff / SHMMNI)
+
+struct shmseg {
+	int ss_id;
+	int ss_key;
+	size_t ss_size;			/* as asked for */
+	size_t ss_npages;
+	paddr_t *ss_pages;		/* 0 until first touched */
+	unsigned ss_resident;		/* pages that are not 0 */
+	struct lock *ss_lock;		/* for ss_pages; see shm.h */
+	unsigned ss_nattch;		/* shm_lock */
+	bool ss_removed;		/* shm_lock */
+};
+
+static struct lock *shm_lock;
+static struct shmseg *shm_table[SHMMNI];
+static unsigned shm_made;		/* segments ever made, for the ids */
+
+void
+shm_bootstrap(void)
+{
+	shm_lock = lock_create("shm");
+	if (shm_lock == NULL) {
+		panic("shm_bootstrap: Out of memory\n");
+	}
+}
+
+/*
+ * Free SEG, which is out of the table and has nothing attached.
+ */
+static
+void
+shm_destroy(struct shmseg *seg)
+{
+	size_t i;
+
+	KASSERT(seg->ss_removed && seg->ss_nattch == 0);
+
+	for (i = 0; i < seg->ss_npages; i++) {
+		if (seg->ss_pages[i] != 0) {
+			coremap_free(seg->ss_pages[i]);
+		}
+	}
+	lock_destroy(seg->ss_lock);
+	kfree(seg->ss_pages);
+	kfree(seg);
+}
+
+/*
+ * The segment with id ID, or NULL. shm_lock held.
+ */
+static
+struct shmseg *
+shm_lookup(int id)
+{
+	struct shmseg *seg;
+
+	KASSERT(lock_do_i_hold(shm_lock));
+
+	if (id < 0) {
+		return NULL;
+	}
+	seg = shm_table[id % SHMMNI];
+	if (seg == NULL || seg->ss_id != id) {
+		return NULL;
+	}
+	return seg;
+}
+
+/*
+ * Make a segment of SIZE bytes for KEY in a free slot. shm_lock held.
+ */
+static
+int
+shm_create(int key, size_t size, struct shmseg **ret)
+{
+	struct shmseg *seg;
+	unsigned slot;
+
+	KASSERT(lock_do_i_hold(shm_lock));
+
+	if (size == 0 || size > SHMMAX) {
+		return EINVAL;
+	}
+	for (slot = 0; slot < SHMMNI; slot++) {
+		if (shm_table[slot] == NULL) {
+			break;
+		}
+	}
+	if (slot == SHMMNI) {
+		return ENOSPC;
+	}
+
+	seg = kmalloc(sizeof(*seg));
+	if (seg == NULL) {
+		return ENOMEM;
+	}
+	seg->ss_npages = DIVROUNDUP(size, PAGE_SIZE);
+	seg->ss_pages = kmalloc(seg->ss_npages * sizeof(paddr_t));
+	if (seg->ss_pages == NULL) {
+		kfree(seg);
+		return ENOMEM;
+	}
+	seg->ss_lock = lock_create("shmseg");
+	if (seg->ss_lock == NULL) {
+		kfree(seg->ss_pages);
+		kfree(seg);
+		return ENOMEM;
+	}
+	bzero(seg->ss_pages, seg->ss_npages * sizeof(paddr_t));
+	seg->ss_key = key;
+	seg->ss_size = size;
+	seg->ss_resident = 0;
+	seg->ss_nattch = 0;
+	seg->ss_removed = false;
+
+	seg->ss_id = (shm_made % SHM_MAXGEN) * SHMMNI + slot;
+	shm_made++;
+	shm_table[slot] = seg;
+
+	*ret = seg;
+	return 0;
+}
+
+int
+shm_get(int key, size_t size, int flags, int *ret)
+{
+	struct shmseg *seg;
+	unsigned i;
+	int result;
+
+	lock_acquire(shm_lock);
+	seg = NULL;
+	if (key != IPC_PRIVATE) {
+		for (i = 0; i < SHMMNI; i++) {
+			if (shm_table[i] != NULL &&
+			    shm_table[i]->ss_key == key) {
+				seg = shm_table[i];
+				break;
+			}
+		}
+	}
+
+	if (seg != NULL) {
+		if ((flags & IPC_CREAT) && (flags & IPC_EXCL)) {
+			result = EEXIST;
+		}
+		else if (size > seg->ss_size) {
+			result = EINVAL;
+		}
+		else {
+			result = 0;
+		}
+	}
+	else if (key != IPC_PRIVATE && (flags & IPC_CREAT) == 0) {
+		result = ENOENT;
+	}
+	else {
+		result = shm_create(key, size, &seg);
+	}
+
+	if (result == 0) {
+		*ret = seg->ss_id;
+	}
+	lock_release(shm_lock);
+	return result;
+}
+
+int
+shm_attach(int id, struct shmseg **ret)
+{
+	struct shmseg *seg;
+
+	lock_acquire(shm_lock);
+	seg = shm_lookup(id);
+	if (seg == NULL) {
+		lock_release(shm_lock);
+		return EINVAL;
+	}
+	seg->ss_nattch++;
+	lock_release(shm_lock);
+
+	*ret = seg;
+	return 0;
+}
+
+void
+shm_incref(struct shmseg *seg)
+{
+	lock_acquire(shm_lock);
+	KASSERT(seg->ss_nattch > 0);
+	seg->ss_nattch++;
+	lock_release(shm_lock);
+}
+
+void
+shm_detach(struct shmseg *seg)
+{
+	bool dead;
+
+	lock_acquire(shm_lock);
+	KASSERT(seg->ss_nattch > 0);
+	seg->ss_nattch--;
+	dead = seg->ss_removed && seg->ss_nattch == 0;
+	lock_release(shm_lock);
+
+	if (dead) {
+		shm_destroy(seg);
+	}
+}
+
+size_t
+shm_npages(struct shmseg *seg)
+{
+	return seg->ss_npages;
+}
+
+int
+shm_getpage(struct shmseg *seg, size_t index, paddr_t *ret, bool *fresh)
+{
+	paddr_t paddr;
+
+	KASSERT(index < seg->ss_npages);
+
+	lock_acquire(seg->ss_lock);
+	paddr = seg->ss_pages[index];
+	*fresh = paddr == 0;
+	if (paddr == 0) {
+		paddr = coremap_alloc_zeroed();
+		if (paddr == 0) {
+			lock_release(seg->ss_lock);
+			return ENOMEM;
+		}
+		seg->ss_pages[index] = paddr;
+		seg->ss_resident++;
+	}
+	if (!coremap_tryincref(paddr)) {
+		/* CM_MAXREFS mappings of it already. */
+		lock_release(seg->ss_lock);
+		return ENOMEM;
+	}
+	lock_release(seg->ss_lock);
+
+	*ret = paddr;
+	return 0;
+}
+
+int
+shm_ctl(int id, int cmd, struct shmid_ds *ds)
+{
+	struct shmseg *seg;
+	bool dead;
+
+	if (cmd != IPC_RMID && cmd != IPC_STAT) {
+		return EINVAL;
+	}
+
+	lock_acquire(shm_lock);
+	seg = shm_lookup(id);
+	if (seg == NULL) {
+		lock_release(shm_lock);
+		return EINVAL;
+	}
+	dead = false;
+	if (cmd == IPC_STAT) {
+		ds->shm_key = seg->ss_key;
+		ds->shm_segsz = seg->ss_size;
+		ds->shm_nattch = seg->ss_nattch;
+		ds->shm_resident = seg->ss_resident;
+	}
+	else {
+		shm_table[id % SHMMNI] = NULL;
+		seg->ss_removed = true;
+		dead = seg->ss_nattch == 0;
+	}
+	lock_release(shm_lock);
+
+	if (dead) {
+		shm_destroy(seg);
+	}
+	return 0;
+}
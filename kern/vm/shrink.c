@@ -0,0 +1,125 @@
+/*
+ * Giving memory back from kernel caches. See shrink.h.
+ *
+ * shrink_lock (a sleep lock) covers the list of shrinkers and is held
+ * across each round of calls, so that a shrinker is never called
+ * after shrinker_unregister returns. shrink_wakelock, a spinlock,
+ * covers only shrink_pending, which is all shrink_wake touches, so the
+ * frame allocator can call it from anywhere.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <thread.h>
+#include <shrink.h>
+
+static struct lock *shrink_lock;
+static struct shrinker *shrinkers;	/* under shrink_lock */
+
+static struct spinlock shrink_wakelock = SPINLOCK_INITIALIZER;
+static struct wchan *shrink_wchan;	/* the reclaim thread sleeps here */
+static bool shrink_pending;		/* shrink_wake since the last round */
+
+/*
+ * The page reclaim thread: one round of shrinkers per wakeup.
+ */
+static
+void
+shrink_thread(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		spinlock_acquire(&shrink_wakelock);
+		while (!shrink_pending) {
+			wchan_lock(shrink_wchan);
+			spinlock_release(&shrink_wakelock);
+			wchan_sleep(shrink_wchan);
+			spinlock_acquire(&shrink_wakelock);
+		}
+		shrink_pending = false;
+		spinlock_release(&shrink_wakelock);
+
+		shrink_now();
+	}
+}
+
+void
+shrink_bootstrap(void)
+{
+	int result;
+
+	shrink_lock = lock_create("shrink");
+	shrink_wchan = wchan_create("shrink");
+	if (shrink_lock == NULL || shrink_wchan == NULL) {
+		panic("shrink: Out of memory\n");
+	}
+	result = thread_fork("pagereclaim", NULL, shrink_thread, NULL, 0);
+	if (result) {
+		panic("shrink: thread_fork: %s\n", strerror(result));
+	}
+}
+
+/*
+ * Shrinkers are called in the order they were registered, so a cache
+ * that pins objects of another (the name cache pins vnodes) gives
+ * them up first if it was made first.
+ */
+void
+shrinker_register(struct shrinker *sh)
+{
+	struct shrinker **pp;
+
+	KASSERT(shrink_lock != NULL);
+
+	lock_acquire(shrink_lock);
+	for (pp = &shrinkers; *pp != NULL; pp = &(*pp)->sh_next);
+	sh->sh_next = NULL;
+	*pp = sh;
+	lock_release(shrink_lock);
+}
+
+void
+shrinker_unregister(struct shrinker *sh)
+{
+	struct shrinker **pp;
+
+	lock_acquire(shrink_lock);
+	for (pp = &shrinkers; *pp != sh; pp = &(*pp)->sh_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = sh->sh_next;
+	sh->sh_next = NULL;
+	lock_release(shrink_lock);
+}
+
+void
+shrink_wake(void)
+{
+	if (shrink_wchan == NULL) {
+		/* too early */
+		return;
+	}
+	spinlock_acquire(&shrink_wakelock);
+	if (!shrink_pending) {
+		shrink_pending = true;
+		wchan_wakeone(shrink_wchan);
+	}
+	spinlock_release(&shrink_wakelock);
+}
+
+void
+shrink_now(void)
+{
+	struct shrinker *sh;
+
+	lock_acquire(shrink_lock);
+	for (sh = shrinkers; sh != NULL; sh = sh->sh_next) {
+		sh->sh_shrink(sh->sh_data);
+	}
+	lock_release(shrink_lock);
+}
@@ -0,0 +1,370 @@
+/*
+ * Swap space. See swap.h for the interface.
+ *
+ * The compressed tier is one run of kernel pages, the pool, cut into
+ * SWAP_ZCHUNK-byte chunks handed out in runs from a bitmap. A slot
+ * whose page is in the pool records its first chunk and compressed
+ * length; one with a length of 0 is on the disk. Compressing goes
+ * through a buffer and hash table kept here, under swap_zlock; the
+ * bitmaps and the slot records are under swap_lock. Reading or
+ * freeing a slot needs no more than that, since only the owner of the
+ * slot does either and nobody else touches its chunks meanwhile.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <kstat.h>
+#include <lz.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+
+/* Bytes in a chunk of the pool, and most a compressed page may take. */
+#define SWAP_ZCHUNK	128
+#define SWAP_ZMAXLEN	(PAGE_SIZE * 3 / 4)
+
+/* Pool pages: 1/SWAP_ZPOOL_DIV of memory, but chunk numbers are 16 bits. */
+#define SWAP_ZPOOL_DIV	16
+#define SWAP_ZPOOL_MAX	(0xffff / (PAGE_SIZE / SWAP_ZCHUNK))
+
+struct swapzent {
+	uint16_t ze_first;		/* first chunk in the pool */
+	uint16_t ze_len;		/* compressed length; 0 if on disk */
+};
+
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+static struct vnode *swap_vnode;
+static struct bitmap *swap_map;		/* one bit per slot */
+static unsigned swap_nslots;
+
+static struct swapzent *swap_zents;	/* one per slot */
+static char *swap_zpool;
+static struct bitmap *swap_zmap;	/* one bit per chunk */
+static struct lock *swap_zlock;		/* for swap_zbuf and swap_zwork */
+static char swap_zbuf[SWAP_ZMAXLEN];
+static uint16_t swap_zwork[LZ_WORKSIZE / sizeof(uint16_t)];
+
+static struct kstat swap_zstores = KSTAT_INITIALIZER("swap.zstores");
+static struct kstat swap_zloads = KSTAT_INITIALIZER("swap.zloads");
+static struct kstat swap_zrejects = KSTAT_INITIALIZER("swap.zrejects");
+static struct kstat swap_zfull = KSTAT_INITIALIZER("swap.zfull");
+
+/*
+ * Set up the compressed pool in front of the disk.
+ */
+static
+void
+swap_zbootstrap(void)
+{
+	struct coremap_stats cs;
+	unsigned npages, i;
+
+	coremap_stats(&cs);
+	npages = cs.cs_total / SWAP_ZPOOL_DIV;
+	if (npages > SWAP_ZPOOL_MAX) {
+		npages = SWAP_ZPOOL_MAX;
+	}
+	if (npages == 0) {
+		return;
+	}
+
+	swap_zents = kmalloc(swap_nslots * sizeof(struct swapzent));
+	swap_zpool = (char *)alloc_kpages(npages);
+	swap_zmap = bitmap_create(npages * (PAGE_SIZE / SWAP_ZCHUNK));
+	swap_zlock = lock_create("swapz");
+	if (swap_zents == NULL || swap_zpool == NULL || swap_zmap == NULL ||
+	    swap_zlock == NULL) {
+		panic("swap: Out of memory for the compressed pool\n");
+	}
+	for (i = 0; i < swap_nslots; i++) {
+		swap_zents[i].ze_first = 0;
+		swap_zents[i].ze_len = 0;
+	}
+
+	kprintf("swap: %uK compressed pool in memory\n",
+		npages * PAGE_SIZE / 1024);
+}
+
+/*
+ * Try to keep the page at PADDR in the pool instead of writing it to
+ * slot SLOT. Returns false if it does not compress well enough or
+ * the pool has no room.
+ */
+static
+bool
+swap_zstore(unsigned slot, paddr_t paddr)
+{
+	unsigned first;
+	size_t len;
+	int result;
+
+	if (swap_zpool == NULL) {
+		return false;
+	}
+
+	lock_acquire(swap_zlock);
+	len = lz_compress((const void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+			  swap_zbuf, sizeof(swap_zbuf), swap_zwork);
+	if (len == 0) {
+		lock_release(swap_zlock);
+		kstat_inc(&swap_zrejects);
+		return false;
+	}
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc_run(swap_zmap, DIVROUNDUP(len, SWAP_ZCHUNK),
+				  &first);
+	spinlock_release(&swap_lock);
+	if (result) {
+		lock_release(swap_zlock);
+		kstat_inc(&swap_zfull);
+		return false;
+	}
+	memcpy(swap_zpool + first * SWAP_ZCHUNK, swap_zbuf, len);
+	lock_release(swap_zlock);
+
+	spinlock_acquire(&swap_lock);
+	swap_zents[slot].ze_first = first;
+	swap_zents[slot].ze_len = len;
+	spinlock_release(&swap_lock);
+
+	kstat_inc(&swap_zstores);
+	return true;
+}
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	int result;
+
+	KASSERT(swap_vnode == NULL);
+
+	/* vfs_open may scribble on its argument. */
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: %s: stat: %s\n", SWAP_DEVICE, strerror(result));
+	}
+	swap_nslots = st.st_size / PAGE_SIZE;
+
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: Could not create slot bitmap\n");
+	}
+
+	kprintf("swap: %u slots on %s\n", swap_nslots, SWAP_DEVICE);
+	swap_zbootstrap();
+}
+
+bool
+swap_ready(void)
+{
+	return swap_map != NULL;
+}
+
+int
+swap_alloc(unsigned *ret_slot)
+{
+	return swap_alloc_run(1, ret_slot);
+}
+
+int
+swap_alloc_run(unsigned n, unsigned *ret_first)
+{
+	int result;
+
+	KASSERT(n >= 1 && n <= SWAP_CLUSTER);
+
+	if (swap_map == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc_run(swap_map, n, ret_first);
+	spinlock_release(&swap_lock);
+	return result;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	if (swap_zents != NULL && swap_zents[slot].ze_len != 0) {
+		bitmap_unmark_run(swap_zmap, swap_zents[slot].ze_first,
+				  DIVROUNDUP(swap_zents[slot].ze_len,
+					     SWAP_ZCHUNK));
+		swap_zents[slot].ze_len = 0;
+	}
+	spinlock_release(&swap_lock);
+}
+
+bool
+swap_ondisk(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	return swap_zents == NULL || swap_zents[slot].ze_len == 0;
+}
+
+/*
+ * Move the N pages of the slots from FIRST on to or from the frames at
+ * PADDRS, in one request to the disk.
+ */
+static
+int
+swap_io(unsigned first, const paddr_t *paddrs, unsigned n, enum uio_rw rw)
+{
+	struct iovec iov[SWAP_CLUSTER];
+	struct uio ku;
+	unsigned i;
+	int result;
+
+	KASSERT(n >= 1 && n <= SWAP_CLUSTER);
+	KASSERT(first + n <= swap_nslots);
+
+	for (i = 0; i < n; i++) {
+		KASSERT((paddrs[i] & PAGE_FRAME) == paddrs[i]);
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(paddrs[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = (off_t)first * PAGE_SIZE;
+	ku.uio_resid = n * PAGE_SIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = rw;
+	ku.uio_space = NULL;
+	ku.uio_direct = false;
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vnode, &ku);
+	}
+	else {
+		result = VOP_WRITE(swap_vnode, &ku);
+	}
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		kprintf("swap: short %s on slots %u-%u\n",
+			rw == UIO_READ ? "read" : "write", first, first + n - 1);
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * Decompress slot SLOT, which is in the pool, into the frame at PADDR.
+ */
+static
+int
+swap_zload(unsigned slot, paddr_t paddr)
+{
+	size_t len;
+	int result;
+
+	result = lz_decompress(swap_zpool +
+			       swap_zents[slot].ze_first * SWAP_ZCHUNK,
+			       swap_zents[slot].ze_len,
+			       (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE, &len);
+	if (result || len != PAGE_SIZE) {
+		kprintf("swap: slot %u is corrupt in the pool\n", slot);
+		return EIO;
+	}
+	kstat_inc(&swap_zloads);
+	return 0;
+}
+
+int
+swap_read_run(unsigned first, const paddr_t *paddrs, unsigned n)
+{
+	unsigned i, j;
+	int result;
+
+	i = 0;
+	while (i < n) {
+		if (!swap_ondisk(first + i)) {
+			result = swap_zload(first + i, paddrs[i]);
+			if (result) {
+				return result;
+			}
+			i++;
+			continue;
+		}
+		/* One read for the run of them on the disk. */
+		for (j = i + 1; j < n && swap_ondisk(first + j); j++);
+		result = swap_io(first + i, &paddrs[i], j - i, UIO_READ);
+		if (result) {
+			return result;
+		}
+		i = j;
+	}
+	return 0;
+}
+
+int
+swap_write_run(unsigned first, const paddr_t *paddrs, unsigned n)
+{
+	unsigned i, j, k;
+	int result;
+
+	for (i = 0; i < n; i++) {
+		KASSERT(swap_ondisk(first + i));
+	}
+
+	i = 0;
+	while (i < n) {
+		if (swap_zstore(first + i, paddrs[i])) {
+			i++;
+			continue;
+		}
+		/* Up to the next one the pool takes, all go to the disk. */
+		for (j = i + 1; j < n && !swap_zstore(first + j, paddrs[j]);
+		     j++);
+		result = swap_io(first + i, &paddrs[i], j - i, UIO_WRITE);
+		if (result) {
+			return result;
+		}
+		for (k = i; k < j; k++) {
+			vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+		}
+		/* Slot J, if any, went to the pool. */
+		i = j + 1;
+	}
+	return 0;
+}
+
+int
+swap_read(unsigned slot, paddr_t paddr)
+{
+	return swap_read_run(slot, &paddr, 1);
+}
+
+int
+swap_write(unsigned slot, paddr_t paddr)
+{
+	return swap_write_run(slot, &paddr, 1);
+}
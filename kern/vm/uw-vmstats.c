@@ -2,24 +2,29 @@
 
 /* belongs in kern/vm/uw-vmstats.c */
 
-/* NOTE !!!!!! WARNING !!!!!
- * All of the functions whose names begin with '_'
- * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
- * All of the functions whose names do not begin
- * with '_' ensure atomicity locally.
+/* The counts are kept as kernel statistics (see kstat.h), per cpu,
+ * so counting takes no lock. The functions whose names begin with '_'
+ * are the same as those without, and are kept for existing callers.
  */
 
 #include <types.h>
 #include <lib.h>
-#include <synch.h>
-#include <spl.h>
+#include <kstat.h>
 #include <uw-vmstats.h>
 
 /* Counters for tracking statistics */
-static unsigned int stats_counts[VMSTAT_COUNT];
-
-struct spinlock stats_lock = SPINLOCK_INITIALIZER;
+static struct kstat stats_counts[VMSTAT_COUNT] = {
+ /*  0 */ KSTAT_INITIALIZER("vm.tlb_faults"),
+ /*  1 */ KSTAT_INITIALIZER("vm.tlb_faults_free"),
+ /*  2 */ KSTAT_INITIALIZER("vm.tlb_faults_replace"),
+ /*  3 */ KSTAT_INITIALIZER("vm.tlb_invalidations"),
+ /*  4 */ KSTAT_INITIALIZER("vm.tlb_reloads"),
+ /*  5 */ KSTAT_INITIALIZER("vm.faults_zeroed"),
+ /*  6 */ KSTAT_INITIALIZER("vm.faults_disk"),
+ /*  7 */ KSTAT_INITIALIZER("vm.faults_elf"),
+ /*  8 */ KSTAT_INITIALIZER("vm.faults_swapfile"),
+ /*  9 */ KSTAT_INITIALIZER("vm.swapfile_writes"),
+};
 
 /* Strings used in printing out the statistics */
 static const char *stats_names[] = {
@@ -37,38 +42,32 @@ static const char *stats_names[] = {
 
 
 /* ---------------------------------------------------------------------- */
-/* Assumes vmstat_init has already been called */
 void
 vmstats_inc(unsigned int index)
 {
-    spinlock_acquire(&stats_lock);
-      _vmstats_inc(index);
-    spinlock_release(&stats_lock);
+  KASSERT(index < VMSTAT_COUNT);
+  kstat_inc(&stats_counts[index]);
 }
 
 /* ---------------------------------------------------------------------- */
 void
 vmstats_init(void)
 {
-  /* Although the spinlock is initialized at declaration time we do it here
-   * again in case we want use/reset these stats repeatedly without shutting down the kernel.
-   */
-  spinlock_init(&stats_lock);
-
-  spinlock_acquire(&stats_lock);
-    _vmstats_init();
-  spinlock_release(&stats_lock);
+  _vmstats_init();
 }
 
 /* ---------------------------------------------------------------------- */
 void
 _vmstats_inc(unsigned int index)
 {
-  KASSERT(index < VMSTAT_COUNT);
-  stats_counts[index]++;
+  vmstats_inc(index);
 }
 
 /* ---------------------------------------------------------------------- */
+/* Registers the counters, so they are listed even before they count
+ * anything, and zeroes them, so they can be used repeatedly without
+ * shutting down the kernel.
+ */
 void
 _vmstats_init(void)
 {
@@ -81,21 +80,22 @@ _vmstats_init(void)
   }
 
   for (i=0; i<VMSTAT_COUNT; i++) {
-    stats_counts[i] = 0;
+    kstat_register(&stats_counts[i]);
+    kstat_zero(&stats_counts[i]);
   }
 
 }
 
 /* ---------------------------------------------------------------------- */
 /* Assumes vmstat_init has already been called */
-/* NOTE: We do not grab the spinlock here because kprintf may block
- * and we can't block while holding a spinlock.
- * Just use this when there is only one thread remaining.
+/* The counts are read as they stand; for totals that add up, use
+ * this when there is only one thread remaining.
  */
 
 void
 vmstats_print(void)
 {
+  unsigned int counts[VMSTAT_COUNT];
   int i = 0;
   int free_plus_replace = 0;
   int disk_plus_zeroed_plus_reload = 0;
@@ -103,17 +103,21 @@ vmstats_print(void)
   int elf_plus_swap_reads = 0;
   int disk_reads = 0;
 
+  for (i=0; i<VMSTAT_COUNT; i++) {
+    counts[i] = kstat_read(&stats_counts[i]);
+  }
+
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
-    kprintf("VMSTAT %25s = %10d\n", stats_names[i], stats_counts[i]);
+    kprintf("VMSTAT %25s = %10d\n", stats_names[i], counts[i]);
   }
 
-  tlb_faults = stats_counts[VMSTAT_TLB_FAULT];
-  free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
-  disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
-    stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
-  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
-  disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
+  tlb_faults = counts[VMSTAT_TLB_FAULT];
+  free_plus_replace = counts[VMSTAT_TLB_FAULT_FREE] + counts[VMSTAT_TLB_FAULT_REPLACE];
+  disk_plus_zeroed_plus_reload = counts[VMSTAT_PAGE_FAULT_DISK] +
+    counts[VMSTAT_PAGE_FAULT_ZERO] + counts[VMSTAT_TLB_RELOAD];
+  elf_plus_swap_reads = counts[VMSTAT_ELF_FILE_READ] + counts[VMSTAT_SWAP_FILE_READ];
+  disk_reads = counts[VMSTAT_PAGE_FAULT_DISK];
 
   kprintf("VMSTAT TLB Faults with Free + TLB Faults with Replace = %d\n", free_plus_replace);
   if (tlb_faults != free_plus_replace) {
@@ -10,6 +10,7 @@
 #   KTOP=../..			# top of the kernel tree
 #   TOP=$(KTOP)/..		# top of the whole tree
 #   KDEBUG=-g			# debug vs. optimize
+#   KFLAVOUR=debug		# debug, opt, or perf (see conf/PERF)
 #   CONFNAME=GENERIC		# name of the kernel config file
 #   .include "$(TOP)/mk/os161.config.mk"
 #   .include "files.mk"
@@ -101,7 +102,7 @@ all: includelinks .WAIT $(KERNEL)
 # By immemorial tradition, "size" is run on the kernel after it's linked.
 #
 $(KERNEL):
-	$(KTOP)/conf/newvers.sh $(CONFNAME)
+	$(KTOP)/conf/newvers.sh $(CONFNAME) $(KFLAVOUR)
 	$(CC) $(KCFLAGS) -c vers.c
 	$(LD) $(KLDFLAGS) $(OBJS) vers.o -o $(KERNEL)
 	$(SIZE) $(KERNEL)
@@ -0,0 +1,76 @@
+/*
+ * dirops - directory operation rates.
+ *
+ * Usage: dirops [files]
+ *
+ * Creates the given number of empty files (default 200) in a fresh
+ * directory, looks each one up with stat, and removes them all, and
+ * reports how many of each were done per second.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include "../lib/benchutil.h"
+
+#define DEFFILES 200
+#define DIR "dirops.tmp"
+
+static
+const char *
+name(unsigned i)
+{
+	static char buf[32];
+
+	snprintf(buf, sizeof(buf), DIR "/f%u", i);
+	return buf;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct stat st;
+	bench_ns_t start;
+	unsigned n, i;
+	int fd;
+
+	n = bench_count(argc, argv, DEFFILES);
+
+	if (mkdir(DIR, 0775) < 0) {
+		err(1, "%s", DIR);
+	}
+
+	start = bench_now();
+	for (i=0; i<n; i++) {
+		fd = open(name(i), O_WRONLY|O_CREAT|O_EXCL, 0664);
+		if (fd < 0) {
+			err(1, "%s", name(i));
+		}
+		close(fd);
+	}
+	bench_report("dirops", "create", n, bench_now() - start, "files");
+
+	start = bench_now();
+	for (i=0; i<n; i++) {
+		if (stat(name(i), &st) < 0) {
+			err(1, "%s: stat", name(i));
+		}
+	}
+	bench_report("dirops", "lookup", n, bench_now() - start, "files");
+
+	start = bench_now();
+	for (i=0; i<n; i++) {
+		if (remove(name(i)) < 0) {
+			err(1, "%s: remove", name(i));
+		}
+	}
+	bench_report("dirops", "remove", n, bench_now() - start, "files");
+
+	if (rmdir(DIR) < 0) {
+		err(1, "%s: rmdir", DIR);
+	}
+	return 0;
+}
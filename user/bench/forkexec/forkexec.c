@@ -0,0 +1,63 @@
+/*
+ * forkexec - the cost of running a program.
+ *
+ * Usage: forkexec [runs]
+ *
+ * Runs /bin/true over and over, first with fork and execv, then with
+ * spawn, which does not copy the parent first, waiting for each.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <err.h>
+#include "../lib/benchutil.h"
+
+#define DEFRUNS 100
+#define PROG "/bin/true"
+
+int
+main(int argc, char *argv[])
+{
+	char *args[2];
+	bench_ns_t start, end;
+	unsigned n, i;
+	pid_t pid;
+	int status;
+
+	n = bench_count(argc, argv, DEFRUNS);
+	args[0] = (char *)PROG;
+	args[1] = NULL;
+
+	start = bench_now();
+	for (i=0; i<n; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			execv(PROG, args);
+			warn("%s", PROG);
+			_exit(1);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	end = bench_now();
+	bench_report("forkexec", "fork+execv", n, end - start, "runs");
+
+	start = bench_now();
+	for (i=0; i<n; i++) {
+		pid = spawn(PROG, args);
+		if (pid < 0) {
+			err(1, "spawn");
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	end = bench_now();
+	bench_report("forkexec", "spawn", n, end - start, "runs");
+
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * forkexit - the cost of making a process and getting rid of it.
+ *
+ * Usage: forkexit [forks]
+ *
+ * The parent forks, the child exits at once, and the parent waits for
+ * it, one after another.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <err.h>
+#include "../lib/benchutil.h"
+
+#define DEFFORKS 200
+
+int
+main(int argc, char *argv[])
+{
+	bench_ns_t start, end;
+	unsigned n, i;
+	pid_t pid;
+	int status;
+
+	n = bench_count(argc, argv, DEFFORKS);
+
+	start = bench_now();
+	for (i=0; i<n; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+	end = bench_now();
+	bench_report("forkexit", "fork+exit+waitpid", n, end - start, "forks");
+
+	return 0;
+}
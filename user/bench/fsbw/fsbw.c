@@ -0,0 +1,103 @@
+/*
+ * fsbw - file read and write bandwidth.
+ *
+ * Usage: fsbw [kilobytes] [file]
+ *
+ * Writes a file of the given size (default 1024K) a block at a time,
+ * fsyncs it, reads it back a block at a time, then reads and writes
+ * the same number of blocks at random places in it. Each is reported
+ * in bytes per second; the file is removed at the end.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include "../lib/benchutil.h"
+
+#define DEFKB 1024
+#define BLOCK 4096
+#define DEFFILE "fsbw.tmp"
+
+static char buf[BLOCK];
+
+static
+void
+doblock(int fd, unsigned block, int rd)
+{
+	int r;
+
+	if (lseek(fd, (off_t)block * BLOCK, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	r = rd ? read(fd, buf, BLOCK) : write(fd, buf, BLOCK);
+	if (r < 0) {
+		err(1, rd ? "read" : "write");
+	}
+	if (r != BLOCK) {
+		errx(1, "%s: short count %d", rd ? "read" : "write", r);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *file = DEFFILE;
+	bench_ns_t start;
+	unsigned nblocks, i;
+	unsigned long long bytes;
+	int fd;
+
+	nblocks = bench_count(argc, argv, DEFKB) * 1024 / BLOCK;
+	if (nblocks == 0) {
+		nblocks = 1;
+	}
+	if (argc > 2) {
+		file = argv[2];
+	}
+	bytes = (unsigned long long)nblocks * BLOCK;
+	memset(buf, 'x', sizeof(buf));
+	srandom(1);
+
+	fd = open(file, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+
+	start = bench_now();
+	for (i=0; i<nblocks; i++) {
+		doblock(fd, i, 0);
+	}
+	if (fsync(fd) < 0) {
+		err(1, "fsync");
+	}
+	bench_report("fsbw", "seqwrite", bytes, bench_now() - start, "bytes");
+
+	start = bench_now();
+	for (i=0; i<nblocks; i++) {
+		doblock(fd, i, 1);
+	}
+	bench_report("fsbw", "seqread", bytes, bench_now() - start, "bytes");
+
+	start = bench_now();
+	for (i=0; i<nblocks; i++) {
+		doblock(fd, random() % nblocks, 1);
+	}
+	bench_report("fsbw", "randread", bytes, bench_now() - start, "bytes");
+
+	start = bench_now();
+	for (i=0; i<nblocks; i++) {
+		doblock(fd, random() % nblocks, 0);
+	}
+	if (fsync(fd) < 0) {
+		err(1, "fsync");
+	}
+	bench_report("fsbw", "randwrite", bytes, bench_now() - start, "bytes");
+
+	close(fd);
+	if (remove(file) < 0) {
+		err(1, "%s: remove", file);
+	}
+	return 0;
+}
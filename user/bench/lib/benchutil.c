@@ -0,0 +1,57 @@
+/*
+ * Timing and reporting for the benchmarks. See benchutil.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include "benchutil.h"
+
+bench_ns_t
+bench_now(void)
+{
+	return clock_monotonic();
+}
+
+unsigned
+bench_count(int argc, char **argv, unsigned def)
+{
+	int n;
+
+	if (argc < 2) {
+		return def;
+	}
+	n = atoi(argv[1]);
+	if (n <= 0) {
+		errx(1, "Usage: %s [count]", argv[0]);
+	}
+	return n;
+}
+
+/*
+ * How many cpus there are, once.
+ */
+static
+unsigned
+bench_ncpus(void)
+{
+	static unsigned ncpus;
+	struct schedstat ss;
+
+	if (ncpus == 0) {
+		ncpus = getschedstat(0, &ss) == 0 ? ss.ss_ncpus : 1;
+	}
+	return ncpus;
+}
+
+void
+bench_report(const char *bench, const char *test,
+	     unsigned long long count, bench_ns_t ns, const char *unit)
+{
+	if (ns == 0) {
+		ns = 1;
+	}
+	printf("%s,%s,%u,%llu,%llu,%llu,%s\n", bench, test, bench_ncpus(),
+	       count, ns, count * 1000000000ULL / ns, unit);
+}
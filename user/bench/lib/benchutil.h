@@ -0,0 +1,32 @@
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+/*
+ * Timing for the programs in user/bench.
+ *
+ * Each program measures one or more things and prints a line for
+ * each, all in one CSV format so runs on different sys161 setups can
+ * be collected together:
+ *
+ *     bench,test,ncpus,count,ns,rate,unit
+ *
+ * e.g. "forkexit,fork+exit+waitpid,2,200,85000000,2352,forks": COUNT
+ * of UNIT took NS nanoseconds in all, which is RATE per second, on a
+ * machine with NCPUS cpus.
+ *
+ * Functions:
+ *     bench_now    - nanoseconds since boot, from clock_monotonic.
+ *     bench_count  - argv[1] as a count, or DEFAULT if there is none.
+ *     bench_report - print a result line.
+ */
+
+#include <sys/types.h>
+
+typedef unsigned long long bench_ns_t;
+
+bench_ns_t bench_now(void);
+unsigned bench_count(int argc, char **argv, unsigned def);
+void bench_report(const char *bench, const char *test,
+		  unsigned long long count, bench_ns_t ns, const char *unit);
+
+#endif /* BENCHUTIL_H */
@@ -0,0 +1,38 @@
+/*
+ * nullsys - the cost of a system call that does nothing much.
+ *
+ * Usage: nullsys [calls]
+ *
+ * Times getpid, and for comparison the clock reading every other
+ * benchmark uses, which is a system call too.
+ */
+
+#include <unistd.h>
+#include "../lib/benchutil.h"
+
+#define DEFCALLS 100000
+
+int
+main(int argc, char *argv[])
+{
+	bench_ns_t start, end;
+	unsigned n, i;
+
+	n = bench_count(argc, argv, DEFCALLS);
+
+	start = bench_now();
+	for (i=0; i<n; i++) {
+		getpid();
+	}
+	end = bench_now();
+	bench_report("nullsys", "getpid", n, end - start, "calls");
+
+	start = bench_now();
+	for (i=0; i<n; i++) {
+		bench_now();
+	}
+	end = bench_now();
+	bench_report("nullsys", "clock_monotonic", n, end - start, "calls");
+
+	return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * pagefault - how fast new memory can be faulted in.
+ *
+ * Usage: pagefault [pages]
+ *
+ * Grows the heap by PAGES pages and writes one word in each, so each
+ * write takes a fault for a fresh zero-filled page; then reads them
+ * all again, which should take none, for comparison. The heap is
+ * given back and the whole thing done ROUNDS times.
+ */
+
+#include <unistd.h>
+#include <err.h>
+#include "../lib/benchutil.h"
+
+#define DEFPAGES 256
+#define ROUNDS 4
+#define PAGE 4096
+
+int
+main(int argc, char *argv[])
+{
+	bench_ns_t touch = 0, reread = 0, start;
+	volatile char *base;
+	unsigned n, i, r;
+	int sum = 0;
+
+	n = bench_count(argc, argv, DEFPAGES);
+
+	for (r=0; r<ROUNDS; r++) {
+		base = sbrk(n * PAGE);
+		if (base == (void *)-1) {
+			err(1, "sbrk");
+		}
+
+		start = bench_now();
+		for (i=0; i<n; i++) {
+			base[i * PAGE] = 1;
+		}
+		touch += bench_now() - start;
+
+		start = bench_now();
+		for (i=0; i<n; i++) {
+			sum += base[i * PAGE];
+		}
+		reread += bench_now() - start;
+
+		if (sbrk(-(int)(n * PAGE)) == (void *)-1) {
+			err(1, "sbrk");
+		}
+	}
+	if (sum != (int)(n * ROUNDS)) {
+		errx(1, "Read back %d, not %u", sum, n * ROUNDS);
+	}
+
+	bench_report("pagefault", "zero-fill", n * ROUNDS, touch, "faults");
+	bench_report("pagefault", "resident", n * ROUNDS, reread, "pages");
+
+	return 0;
+}
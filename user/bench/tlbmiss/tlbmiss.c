@@ -0,0 +1,57 @@
+/*
+ * tlbmiss - the cost of a TLB miss on a page that is resident.
+ *
+ * Usage: tlbmiss [touches]
+ *
+ * Touches one word in each of NPAGES pages in turn, more pages than
+ * the TLB has entries, so each touch evicts some page still to come
+ * and (most) touches miss. The pages are faulted in first, so the
+ * misses are refills, not page faults. For comparison, then touches
+ * one page over and over, which should hit every time.
+ */
+
+#include <unistd.h>
+#include <err.h>
+#include "../lib/benchutil.h"
+
+#define DEFTOUCHES 100000
+#define NPAGES 256		/* four times the sys161 TLB */
+#define PAGE 4096
+
+int
+main(int argc, char *argv[])
+{
+	bench_ns_t start, end;
+	volatile char *base;
+	unsigned n, i;
+	int sum = 0;
+
+	n = bench_count(argc, argv, DEFTOUCHES);
+
+	base = sbrk(NPAGES * PAGE);
+	if (base == (void *)-1) {
+		err(1, "sbrk");
+	}
+	for (i=0; i<NPAGES; i++) {
+		base[i * PAGE] = 1;
+	}
+
+	start = bench_now();
+	for (i=0; i<n; i++) {
+		sum += base[(i % NPAGES) * PAGE];
+	}
+	end = bench_now();
+	bench_report("tlbmiss", "miss", n, end - start, "touches");
+
+	start = bench_now();
+	for (i=0; i<n; i++) {
+		sum += base[0];
+	}
+	end = bench_now();
+	bench_report("tlbmiss", "hit", n, end - start, "touches");
+
+	if (sum != (int)(2 * n)) {
+		errx(1, "Read back %d, not %u", sum, 2 * n);
+	}
+	return 0;
+}
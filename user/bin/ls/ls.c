@@ -85,24 +85,20 @@ basename(const char *path)
 }
 
 /*
- * Utility function to check if a name refers to a directory.
+ * Utility function to check if a name refers to a directory. NAME is
+ * looked up in the directory open on DIRFD (or the current directory
+ * for AT_FDCWD); PATH is the whole thing, for messages.
  */
 static
 int
-isdir(const char *path)
+isdir(int dirfd, const char *name, const char *path)
 {
 	struct stat buf;
-	int fd;
 
-	/* Assume stat() may not be implemented; use fstat */
-	fd = open(path, O_RDONLY);
-	if (fd<0) {
+	/* (no need to open it just to look) */
+	if (fstatat(dirfd, name, &buf)<0) {
 		err(1, "%s", path);
 	}
-	if (fstat(fd, &buf)<0) {
-		err(1, "%s: fstat", path);
-	}
-	close(fd);
 
 	return S_ISDIR(buf.st_mode);
 }
@@ -127,28 +123,21 @@ printheader(const char *file)
 }
 
 /*
- * Show a single file.
+ * Show a single file, NAME in DIRFD as for isdir.
  * We don't do the neat multicolumn listing that Unix ls does.
  */
 static
 void
-print(const char *path)
+print(int dirfd, const char *name, const char *path)
 {
 	struct stat statbuf;
 	const char *file;
 	int typech;
 
 	if (lopt || sopt) {
-		int fd;
-
-		fd = open(path, O_RDONLY);
-		if (fd<0) {
+		if (fstatat(dirfd, name, &statbuf)<0) {
 			err(1, "%s", path);
 		}
-		if (fstat(fd, &statbuf)<0) {
-			err(1, "%s: fstat", path);
-		}
-		close(fd);
 	}
 
 	file = basename(path);
@@ -185,6 +174,49 @@ print(const char *path)
 	printf("%s\n", file);
 }
 
+/*
+ * The names in a directory, read with getdirentries a bufferful at a
+ * time and handed out one at a time by nextname.
+ */
+struct dirnames {
+	int fd;
+	char buf[1024];
+	int len, pos;
+};
+
+static
+void
+opennames(struct dirnames *dn, const char *path)
+{
+	dn->fd = open(path, O_RDONLY);
+	if (dn->fd<0) {
+		err(1, "%s", path);
+	}
+	dn->len = dn->pos = 0;
+}
+
+/* Returns the next name, or NULL at the end of the directory. */
+static
+const char *
+nextname(struct dirnames *dn, const char *path)
+{
+	const char *name;
+
+	if (dn->pos >= dn->len) {
+		dn->len = getdirentries(dn->fd, dn->buf, sizeof(dn->buf));
+		if (dn->len<0) {
+			err(1, "%s: getdirentries", path);
+		}
+		dn->pos = 0;
+		if (dn->len==0) {
+			return NULL;
+		}
+	}
+	name = dn->buf + dn->pos;
+	dn->pos += strlen(name) + 1;
+	return name;
+}
+
 /*
  * List a directory.
  */
@@ -192,10 +224,9 @@ static
 void
 listdir(const char *path, int showheader)
 {
-	int fd;
-	char buf[1024];
+	struct dirnames dn;
+	const char *name;
 	char newpath[1024];
-	int len;
 
 	if (showheader) {
 		printheader(path);
@@ -204,70 +235,56 @@ listdir(const char *path, int showheader)
 	/*
 	 * Open it.
 	 */
-	fd = open(path, O_RDONLY);
-	if (fd<0) {
-		err(1, "%s", path);
-	}
+	opennames(&dn, path);
 
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
-
+	while ((name = nextname(&dn, path)) != NULL) {
 		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+		snprintf(newpath, sizeof(newpath), "%s/%s", path, name);
 
-		if (aopt || buf[0]!='.') {
+		if (aopt || name[0]!='.') {
 			/* Print it */
-			print(newpath);
+			print(dn.fd, name, newpath);
 		}
 	}
-	if (len<0) {
-		err(1, "%s: getdirentry", path);
-	}
 
 	/* Done */
-	close(fd);
+	close(dn.fd);
 }
 
 static
 void
 recursedir(const char *path)
 {
-	int fd;
-	char buf[1024];
+	struct dirnames dn;
+	const char *name;
 	char newpath[1024];
-	int len;
 
 	/*
 	 * Open it.
 	 */
-	fd = open(path, O_RDONLY);
-	if (fd<0) {
-		err(1, "%s", path);
-	}
+	opennames(&dn, path);
 
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
-
+	while ((name = nextname(&dn, path)) != NULL) {
 		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+		snprintf(newpath, sizeof(newpath), "%s/%s", path, name);
 
-		if (!aopt && buf[0]=='.') {
+		if (!aopt && name[0]=='.') {
 			/* skip this one */
 			continue;
 		}
 
-		if (!strcmp(buf, ".") || !strcmp(buf, "..")) {
+		if (!strcmp(name, ".") || !strcmp(name, "..")) {
 			/* always skip these */
 			continue;
 		}
 
-		if (!isdir(newpath)) {
+		if (!isdir(dn.fd, name, newpath)) {
 			continue;
 		}
 
@@ -276,25 +293,22 @@ recursedir(const char *path)
 			recursedir(newpath);
 		}
 	}
-	if (len<0) {
-		err(1, "%s", path);
-	}
 
-	close(fd);
+	close(dn.fd);
 }
 
 static
 void
 listitem(const char *path, int showheader)
 {
-	if (!dopt && isdir(path)) {
+	if (!dopt && isdir(AT_FDCWD, path, path)) {
 		listdir(path, showheader || Ropt);
 		if (Ropt) {
 			recursedir(path);
 		}
 	}
 	else {
-		print(path);
+		print(AT_FDCWD, path, path);
 	}
 }
 
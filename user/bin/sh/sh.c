@@ -33,6 +33,11 @@
  * Usage:
  *     sh
  *     sh -c command
+ *
+ * A command is a program and its arguments, or several joined with |
+ * into a pipeline, each one's output going to the next one's input.
+ * A trailing & runs it in the background; background jobs are
+ * reported as they finish.
  */
 
 #include <sys/types.h>
@@ -62,6 +67,18 @@
 #define CMDLINE_MAX ARG_MAX
 #endif
 
+#ifndef OPEN_MAX
+/* not on all unixes either */
+#define OPEN_MAX 64
+#endif
+
+/* most programs in one pipeline */
+#define MAXPIPE 16
+
+/* where the shell keeps its own stdin and stdout during a pipeline */
+#define SAVED_STDIN  (OPEN_MAX - 1)
+#define SAVED_STDOUT (OPEN_MAX - 2)
+
 /* set to nonzero if __time syscall seems to work */
 static int timing = 0;
 
@@ -71,21 +88,21 @@ static pid_t bgpids[MAXBG];
 
 /*
  * can_bg
- * just checks for an open slot.
+ * just checks for N open slots.
  */
 static
 int
-can_bg(void)
+can_bg(int n)
 {
 	int i;
 	
-	for (i = 0; i < MAXBG; i++) {
+	for (i = 0; i < MAXBG && n > 0; i++) {
 		if (bgpids[i] == 0) {
-			return 1;
+			n--;
 		}
 	}
 	
-	return 0;
+	return n == 0;
 }
 
 /* 
@@ -292,22 +309,144 @@ static struct {
 	{ NULL, NULL }
 };
 
+/*
+ * launch
+ * starts the program ARGS with the shell's current stdin and stdout,
+ * returning its pid. on failure, returns -1 with the status to report
+ * in *FAILSTATUS.
+ */
+static
+pid_t
+launch(char **args, int *failstatus)
+{
+	pid_t pid;
+
+#ifndef HOST
+	/*
+	 * spawn saves copying our address space only to throw the copy
+	 * away; fall back on fork and execv if the kernel lacks it.
+	 */
+	pid = spawn(args[0], args);
+	if (pid < 0 && errno != ENOSYS) {
+		warn("%s", args[0]);
+		*failstatus = _MKWAIT_EXIT(1);
+		return -1;
+	}
+#else
+	pid = -1;
+#endif
+
+	if (pid < 0) {
+		pid = fork();
+		switch (pid) {
+		    case -1:
+			/* error */
+			warn("fork");
+			*failstatus = _MKWAIT_EXIT(255);
+			return -1;
+		    case 0:
+			/* child */
+			execv(args[0], args);
+			warn("%s", args[0]);
+			/*
+			 * Use _exit() instead of exit() in the child
+			 * process to avoid calling atexit() functions,
+			 * which would cause hostcompat (if present) to
+			 * reset the tty state and mess up our input
+			 * handling.
+			 */
+			_exit(1);
+		    default:
+			break;
+		}
+	}
+	return pid;
+}
+
+/*
+ * runpipeline
+ * starts the NSTAGES programs in STAGES, each one's stdout a pipe to
+ * the next one's stdin, and puts their pids in PIDS. the pipes are
+ * set up in the shell's own stdin and stdout around each launch, so
+ * that spawn, which has no way to be told otherwise, passes them on;
+ * the shell's own are kept meanwhile at SAVED_STDIN and SAVED_STDOUT.
+ * returns how many were started; if not all, *FAILSTATUS says why.
+ */
+static
+int
+runpipeline(char **stages[], int nstages, pid_t *pids, int *failstatus)
+{
+	int fds[2], readfd = -1;
+	int i;
+
+	if (nstages == 1) {
+		pids[0] = launch(stages[0], failstatus);
+		return pids[0] < 0 ? 0 : 1;
+	}
+
+	if (dup2(STDIN_FILENO, SAVED_STDIN) < 0 ||
+	    dup2(STDOUT_FILENO, SAVED_STDOUT) < 0) {
+		warn("dup2");
+		*failstatus = _MKWAIT_EXIT(255);
+		return 0;
+	}
+
+	for (i=0; i<nstages; i++) {
+		if (readfd >= 0) {
+			dup2(readfd, STDIN_FILENO);
+			close(readfd);
+			readfd = -1;
+		}
+		if (i < nstages-1) {
+			if (pipe(fds) < 0) {
+				warn("pipe");
+				*failstatus = _MKWAIT_EXIT(255);
+				break;
+			}
+			dup2(fds[1], STDOUT_FILENO);
+			close(fds[1]);
+			readfd = fds[0];
+		}
+		else {
+			dup2(SAVED_STDOUT, STDOUT_FILENO);
+		}
+
+		pids[i] = launch(stages[i], failstatus);
+		if (pids[i] < 0) {
+			break;
+		}
+	}
+
+	/* put ours back; this also lets go of the last pipe's ends */
+	if (readfd >= 0) {
+		close(readfd);
+	}
+	dup2(SAVED_STDIN, STDIN_FILENO);
+	dup2(SAVED_STDOUT, STDOUT_FILENO);
+	close(SAVED_STDIN);
+	close(SAVED_STDOUT);
+	return i;
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
- * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * otherwise, it's a standard command, or a pipeline of them split at
+ * each '|'.  check for the '&', try to background the job if possible,
+ * otherwise just run it and wait on it; a pipeline's status is its
+ * last program's.
  */
 static
 int
 docommand(char *buf)
 {
 	char *args[NARG_MAX + 1];
-	int nargs, i;
+	char **stages[MAXPIPE];
+	pid_t pids[MAXPIPE];
+	int nargs, nstages, nstarted, i;
 	char *s;
-	pid_t pid;
-	int status;
+	int status, failstatus;
 	int bg=0;
 	time_t startsecs, endsecs;
 	unsigned long startnsecs, endnsecs;
@@ -339,54 +478,65 @@ docommand(char *buf)
 
 	if (nargs > 0 && !strcmp(args[nargs-1], "&")) {
 		/* background */
-		if (!can_bg()) {
-			printf("%s: Too many background jobs; wait for "
-			       "some to finish before starting more\n",
-			       args[0]);
-			return -1;
-		}
 		nargs--;
 		args[nargs] = NULL;
 		bg = 1;
 	}
 
+	/* split it into programs at each | */
+	nstages = 0;
+	stages[nstages++] = args;
+	for (i=0; i<nargs; i++) {
+		if (strcmp(args[i], "|")) {
+			continue;
+		}
+		if (nstages >= MAXPIPE) {
+			printf("%s: Too many programs in one pipeline\n",
+			       args[0]);
+			return 1;
+		}
+		args[i] = NULL;
+		stages[nstages++] = &args[i+1];
+	}
+	for (i=0; i<nstages; i++) {
+		if (stages[i][0] == NULL) {
+			printf("Missing command in pipeline\n");
+			return 1;
+		}
+	}
+
+	if (bg && !can_bg(nstages)) {
+		printf("%s: Too many background jobs; wait for "
+		       "some to finish before starting more\n",
+		       args[0]);
+		return -1;
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			return _MKWAIT_EXIT(255);
-		case 0:
-			/* child */
-			execv(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
-			break;
-	}
+	nstarted = runpipeline(stages, nstages, pids, &failstatus);
 
 	/* parent */
 	if (bg) {
 		/* background this command */
-		remember_bg(pid);
-		printf("[%d] %s ... &\n", pid, args[0]);
-		return 0;
+		for (i=0; i<nstarted; i++) {
+			remember_bg(pids[i]);
+			printf("[%d] %s ... &\n", pids[i], stages[i][0]);
+		}
+		return nstarted < nstages ? failstatus : 0;
 	}
 
-	if (waitpid(pid, &status, 0) < 0) {
-		warn("waitpid");
-		status = -1;
+	status = 0;
+	for (i=0; i<nstarted; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			status = -1;
+		}
+	}
+	if (nstarted < nstages) {
+		status = failstatus;
 	}
 
 	if (timing) {
@@ -413,6 +563,10 @@ docommand(char *buf)
  *
  * if there's an invalid character or a backspace when there's nothing 
  * in the buffer, putchars an alert (bell).
+ *
+ * if stdin is the OS/161 console, its cooked mode does all that for us
+ * and hands over the whole line in one read. it goes back to raw mode
+ * afterwards, which is what the programs we run expect.
  */
 static
 void
@@ -421,6 +575,23 @@ getcmd(char *buf, size_t len)
 	size_t pos = 0;
 	int done=0, ch;
 
+#ifdef IOCTL_CONCOOKED
+	ssize_t n;
+
+	if (ioctl(STDIN_FILENO, IOCTL_CONCOOKED, NULL) == 0) {
+		n = read(STDIN_FILENO, buf, len-1);
+		ioctl(STDIN_FILENO, IOCTL_CONRAW, NULL);
+		if (n < 0) {
+			n = 0;
+		}
+		if (n > 0 && buf[n-1] == '\n') {
+			n--;
+		}
+		buf[n] = 0;
+		return;
+	}
+#endif
+
 	/*
 	 * In the absence of a <ctype.h>, assume input is 7-bit ASCII.
 	 */
@@ -0,0 +1,31 @@
+#ifndef _GREEN_H_
+#define _GREEN_H_
+
+/*
+ * libgreen: many threads of the program's own ("greens") run on a few
+ * kernel threads ("workers"), switching among themselves without
+ * entering the kernel. Link with -lgreen.
+ *
+ * green_run starts NWORKERS workers, the caller being one of them,
+ * runs FUNC(ARG) as the first green, and returns once every green has
+ * finished. When a green blocks in the kernel, its worker goes with
+ * it; the library hears of it through upcall_wait and runs another
+ * worker meanwhile, so the others keep going, and lets the extra one
+ * go idle again once the first comes back.
+ *
+ * green_spawn starts another green; green_yield lets the next one run;
+ * green_exit ends the calling green (as returning from its function
+ * does). These are only for greens to call. Greens are not preempted:
+ * one that never yields or blocks keeps its worker to itself.
+ *
+ * Each green has a stack of UTHREAD_STACKSIZE, like a thread's.
+ */
+
+#include <unistd.h>
+
+int green_run(unsigned nworkers, void (*func)(void *), void *arg);
+int green_spawn(void (*func)(void *), void *arg);
+void green_yield(void);
+__DEAD void green_exit(void);
+
+#endif /* _GREEN_H_ */
@@ -41,6 +41,66 @@
 /* Constant returned by a bunch of stdio functions on error */
 #define EOF (-1)
 
+/*
+ * Streams, for output. Each one collects what is written to it in a
+ * buffer and passes it on to its file handle with one write(): when
+ * the buffer fills, and for a line-buffered stream also at the end of
+ * each line; or at fflush, fclose, a fork, or exit (not _exit). stdout
+ * is line-buffered, stderr unbuffered, files from fopen and fdopen
+ * fully buffered; setvbuf changes that.
+ *
+ * Reading is not buffered: getchar reads standard input directly,
+ * after flushing stdout so a prompt shows first.
+ */
+#define BUFSIZ 1024
+
+#define _IOFBF 0	/* fully buffered */
+#define _IOLBF 1	/* line buffered */
+#define _IONBF 2	/* unbuffered */
+
+typedef struct __file FILE;
+
+/* (for libc internal use only) */
+struct __file {
+	int f_fd;		/* file handle */
+	int f_mode;		/* _IOFBF, _IOLBF, or _IONBF */
+	int f_error;		/* a write failed */
+	int f_mybuf;		/* f_buf is to be freed by fclose */
+	char *f_buf;		/* f_size bytes, f_len of them in use */
+	size_t f_size;
+	size_t f_len;
+	FILE *f_next;		/* all streams, for fflush(NULL) */
+};
+
+extern FILE *stdout;
+extern FILE *stderr;
+
+FILE *fopen(const char *path, const char *mode);	/* "w" or "a" */
+FILE *fdopen(int fd, const char *mode);
+int fclose(FILE *f);
+int fflush(FILE *f);			/* all streams if NULL */
+int setvbuf(FILE *f, char *buf, int mode, size_t size);
+int fileno(FILE *f);
+int ferror(FILE *f);
+
+int fputc(int c, FILE *f);
+int putc(int c, FILE *f);
+int fputs(const char *s, FILE *f);
+size_t fwrite(const void *data, size_t size, size_t n, FILE *f);
+int fprintf(FILE *f, const char *fmt, ...);
+int vfprintf(FILE *f, const char *fmt, __va_list ap);
+
+/*
+ * Streams are shared by the threads of a process, and locked, once
+ * there is more than one thread, for the length of each call.
+ * (for libc internal use only)
+ */
+extern FILE *__stdio_list;
+void __stdio_lock(void);
+void __stdio_unlock(void);
+int __stdio_write(FILE *f, const char *data, size_t len);
+int __stdio_flush(FILE *f);
+
 /*
  * The actual guts of printf
  * (for libc internal use only)
@@ -70,4 +70,7 @@ char *setstate(char *);
 void *malloc(size_t size);
 void free(void *ptr);
 
+/* Give back a thread's cached blocks (for libc internal use only) */
+void __malloc_threadexit(void);
+
 #endif /* _STDLIB_H_ */
@@ -71,6 +71,8 @@
 int fstat(int filehandle, struct stat *buf);
 int stat(const char *path, struct stat *buf);
 int lstat(const char *path, struct stat *buf);
+/* stat of a relative path from the directory open on dirfd (or AT_FDCWD) */
+int fstatat(int dirfd, const char *path, struct stat *buf);
 
 /* 
  * The second argument to mkdir is the mode for the new directory.
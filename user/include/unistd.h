@@ -37,11 +37,24 @@
  * kernel includes. This way user-level code doesn't need to know
  * about the kern/ headers.
  */
+#include <kern/aio.h>
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
+#include <kern/iovec.h>
+#include <kern/ktrace.h>
+#include <kern/iostat.h>
+#include <kern/kstat.h>
+#include <kern/mman.h>
+#include <kern/poll.h>
+#include <kern/memstat.h>
+#include <kern/schedstat.h>
+#include <kern/syscallstat.h>
+#include <kern/syscallbatch.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
+#include <kern/shm.h>
 #include <kern/time.h>
+#include <kern/resource.h>	/* needs struct timeval */
 #include <kern/unistd.h>
 #include <kern/wait.h>
 
@@ -125,6 +138,8 @@ int waitpid(pid_t pid, int *returncode, int flags);
  * security and permissions, you can ignore it.
  */
 int open(const char *filename, int flags, ...);
+/* open, with relative names starting at the directory open on dirfd */
+int openat(int dirfd, const char *filename, int flags, ...);
 int read(int filehandle, void *buf, size_t size);
 int write(int filehandle, const void *buf, size_t size);
 int close(int filehandle);
@@ -138,6 +153,7 @@ int getpid(void);
 int ioctl(int filehandle, int code, void *buf);
 off_t lseek(int filehandle, off_t pos, int code);
 int fsync(int filehandle);
+int fdatasync(int filehandle);	/* data, size and blocks only */
 int ftruncate(int filehandle, off_t size);
 int remove(const char *filename);
 int rename(const char *oldfile, const char *newfile);
@@ -147,11 +163,114 @@ int chdir(const char *path);
 
 /* Optional. */
 void *sbrk(int change);
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+#define MAP_FAILED ((void *)-1)		/* what mmap returns on error */
+int shmget(int key, size_t size, int flags);	/* IPC_CREAT, IPC_EXCL */
+void *shmat(int shmid, const void *shmaddr, int flags); /* shmaddr NULL */
+int shmdt(const void *shmaddr);
+int shmctl(int shmid, int cmd, struct shmid_ds *buf);	/* IPC_RMID, IPC_STAT */
+int getmemstat(pid_t pid, struct memstat *ms);	/* pid 0 for yourself */
+int getschedstat(unsigned cpu, struct schedstat *ss);
+int getkstat(unsigned index, struct kstatinfo *ki);
+int getiostat(unsigned index, struct iostatinfo *is);
+int getrusage(int who, struct rusage *ru);	/* RUSAGE_SELF or _CHILDREN */
+int setpriority(int which, pid_t who, int prio);	/* PRIO_PROCESS only */
+int getpriority(int which, pid_t who);		/* who 0 for yourself */
+pid_t getpgid(pid_t pid);			/* pid 0 for yourself */
+int setpgid(pid_t pid, pid_t pgid);		/* pgid 0 for pid's own */
+int sched_setaffinity(pid_t pid, unsigned mask);	/* bit N for cpu N */
+int sched_getaffinity(pid_t pid, unsigned *mask);
+int getsyscallstat(int callno, struct syscallstat *ss);
+int syscall_batch(struct syscall_rec *recs, unsigned n, int flags);
+int ktrace(int op, unsigned cpu, struct ktrace_rec *buf, unsigned n);
+
+/*
+ * fork and execv in one: start prog with args in a new child process
+ * and return its pid, without copying this process's memory first.
+ */
+pid_t spawn(const char *prog, char *const *args);
+
+/*
+ * Threads sharing this process's memory. thread_create returns the new
+ * thread's id; thread_join waits for it to finish and gets what its
+ * function returned (or passed to thread_exit). The process ends when
+ * its last thread does, or when any thread calls _exit.
+ */
+int thread_create(void *(*func)(void *), void *arg);
+int thread_join(int tid, void **retval);
+__DEAD void thread_exit(void *retval);
+int __thread_create(void (*start)(void *(*)(void *), void *),
+		    void *(*func)(void *), void *arg);
+
+/*
+ * Sleep while *addr is still val (failing with EAGAIN if it isn't), and
+ * wake up to n threads sleeping on addr, returning how many. For
+ * building locks that only enter the kernel when contended.
+ */
+int futex_wait(volatile int *addr, int val);
+int futex_wake(volatile int *addr, int n);
+
+/*
+ * For user-level schedulers that run many threads of their own on a
+ * few of these. upcall_register(1) makes the calling thread one of the
+ * scheduler's workers (0 undoes it); upcall_wait(n) sleeps while n of
+ * the workers are blocked in the kernel and returns how many are now,
+ * so that a watcher thread can start another worker when one blocks.
+ * The watcher must not be a worker itself. See libgreen (green.h).
+ */
+int upcall_register(int on);
+int upcall_wait(unsigned n);
+
+/*
+ * (for libc internal use only)
+ * A lock made of a futex word, 0 when free, and whether there is more
+ * than one thread yet (and so anything to lock against).
+ */
+void __futex_lock(volatile int *lk);
+void __futex_unlock(volatile int *lk);
+extern int __isthreaded;
 int getdirentry(int filehandle, char *buf, size_t buflen);
+/*
+ * Read as many of the next names in a directory as fit in buf, each
+ * followed by a NUL. Returns how many bytes that is, 0 at the end.
+ */
+int getdirentries(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
+int readv(int filehandle, const struct iovec *iov, int iovcnt);
+int writev(int filehandle, const struct iovec *iov, int iovcnt);
+int pread(int filehandle, void *buf, size_t size, off_t pos);
+int pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+/*
+ * Copy up to len bytes from fromhandle to tohandle, at and moving both
+ * their offsets, within the kernel. Returns how many were copied, 0 at
+ * end of file.
+ */
+int copy_file_range(int fromhandle, int tohandle, size_t len);
+/*
+ * Wait until one of the nfds files in fds is ready for the events
+ * asked of it, or timeout milliseconds pass (negative: forever).
+ * Returns how many have revents set.
+ */
+int poll(struct pollfd *fds, unsigned nfds, int timeout);
+/*
+ * Asynchronous I/O through the rings in kern/aio.h. aio_setup names
+ * the process's rings, once. aio_enter starts what has been submitted
+ * and waits until min_complete completions are waiting or nothing is
+ * in progress; it returns how many submissions it took.
+ */
+int aio_setup(struct aio_rings *rings);
+int aio_enter(unsigned min_complete);
 int pipe(int filehandles[2]);
+
+/*
+ * clock_monotonic is the kernel's cycle-counter clock: nanoseconds
+ * since boot, never going backwards, precise to a few cycles. For
+ * timing things; it has nothing to do with the time of day.
+ */
+off_t clock_monotonic(void);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
@@ -162,6 +281,8 @@ int __getcwd(char *buf, size_t buflen);
  */
 
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
-time_t time(time_t *seconds);			/* calls __time */
+time_t time(time_t *seconds);			/* calls __timepage */
+time_t __timepage(time_t *seconds, unsigned long *nanoseconds);
+						/* __time to 1/HZ, no syscall */
 
 #endif /* _UNISTD_H_ */
@@ -0,0 +1,125 @@
+/*
+ * Opening and closing streams. See stdio.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ * The open flags for MODE: "w" or "a", with "b" allowed after, which
+ * means nothing here. Streams only write, so nothing else will do.
+ */
+static
+int
+stdio_modeflags(const char *mode)
+{
+	int flags;
+
+	switch (mode[0]) {
+	    case 'w':
+		flags = O_WRONLY | O_CREAT | O_TRUNC;
+		break;
+	    case 'a':
+		flags = O_WRONLY | O_CREAT | O_APPEND;
+		break;
+	    default:
+		return -1;
+	}
+	if (mode[1] != '\0' && (mode[1] != 'b' || mode[2] != '\0')) {
+		return -1;
+	}
+	return flags;
+}
+
+FILE *
+fdopen(int fd, const char *mode)
+{
+	FILE *f;
+
+	if (stdio_modeflags(mode) < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	f = malloc(sizeof(*f));
+	if (f == NULL) {
+		return NULL;
+	}
+	f->f_buf = malloc(BUFSIZ);
+	if (f->f_buf == NULL) {
+		free(f);
+		return NULL;
+	}
+	f->f_fd = fd;
+	f->f_mode = _IOFBF;
+	f->f_error = 0;
+	f->f_mybuf = 1;
+	f->f_size = BUFSIZ;
+	f->f_len = 0;
+
+	__stdio_lock();
+	f->f_next = __stdio_list;
+	__stdio_list = f;
+	__stdio_unlock();
+
+	return f;
+}
+
+FILE *
+fopen(const char *path, const char *mode)
+{
+	FILE *f;
+	int flags, fd, err;
+
+	flags = stdio_modeflags(mode);
+	if (flags < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	fd = open(path, flags, 0664);
+	if (fd < 0) {
+		return NULL;
+	}
+	f = fdopen(fd, mode);
+	if (f == NULL) {
+		err = errno;
+		close(fd);
+		errno = err;
+	}
+	return f;
+}
+
+/*
+ * Flush F and close its file handle. The standard streams can be
+ * closed too, but are not freed.
+ */
+int
+fclose(FILE *f)
+{
+	FILE **p;
+	int result;
+
+	__stdio_lock();
+	result = __stdio_flush(f);
+	for (p = &__stdio_list; *p != NULL; p = &(*p)->f_next) {
+		if (*p == f) {
+			*p = f->f_next;
+			break;
+		}
+	}
+	__stdio_unlock();
+
+	if (close(f->f_fd) < 0) {
+		result = EOF;
+	}
+	if (f != stdout && f != stderr) {
+		if (f->f_mybuf) {
+			free(f->f_buf);
+		}
+		free(f);
+	}
+	return result;
+}
@@ -0,0 +1,49 @@
+/*
+ * Writing characters and strings to streams. See stdio.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+int
+fputc(int c, FILE *f)
+{
+	char ch = c;
+	int result;
+
+	__stdio_lock();
+	result = __stdio_write(f, &ch, 1);
+	__stdio_unlock();
+	return result ? EOF : (unsigned char)ch;
+}
+
+int
+putc(int c, FILE *f)
+{
+	return fputc(c, f);
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+	int result;
+
+	__stdio_lock();
+	result = __stdio_write(f, s, strlen(s));
+	__stdio_unlock();
+	return result ? EOF : 0;
+}
+
+size_t
+fwrite(const void *data, size_t size, size_t n, FILE *f)
+{
+	int result;
+
+	if (size == 0 || n == 0) {
+		return 0;
+	}
+	__stdio_lock();
+	result = __stdio_write(f, data, size * n);
+	__stdio_unlock();
+	return result ? 0 : n;
+}
@@ -41,6 +41,9 @@ getchar(void)
 	char ch;
 	int len;
 
+	/* Show what has been written so far, like a prompt, first. */
+	fflush(stdout);
+
 	len = read(STDIN_FILENO, &ch, 1);
 	if (len<=0) {
 		/* end of file or error */
@@ -36,18 +36,16 @@
 
 
 /*
- * Function passed to __vprintf to do the actual output.
+ * Function passed to __vprintf to do the actual output: into the
+ * stream's buffer.
  */
 static
 void
 __printf_send(void *mydata, const char *data, size_t len)
 {
-	unsigned i;
-	(void)mydata;  /* not needed */
+	FILE *f = mydata;
 
-	for (i=0; i<len; i++) {
-		putchar(data[i]);
-	}
+	__stdio_write(f, data, len);
 }
 
 /* printf: hand off to vprintf */
@@ -62,9 +60,50 @@ printf(const char *fmt, ...)
 	return chars;
 }
 
-/* vprintf: call __vprintf to do the work. */
+/* vprintf: hand off to vfprintf */
 int
 vprintf(const char *fmt, va_list ap)
 {
-	return __vprintf(__printf_send, NULL, fmt, ap);
+	return vfprintf(stdout, fmt, ap);
+}
+
+/* fprintf: hand off to vfprintf */
+int
+fprintf(FILE *f, const char *fmt, ...)
+{
+	int chars;
+	va_list ap;
+	va_start(ap, fmt);
+	chars = vfprintf(f, fmt, ap);
+	va_end(ap);
+	return chars;
+}
+
+/*
+ * vfprintf: call __vprintf to do the work. __vprintf hands over the
+ * output in many small pieces; for an unbuffered stream, collect them
+ * in a buffer here, so that it still takes only one write or so.
+ */
+int
+vfprintf(FILE *f, const char *fmt, va_list ap)
+{
+	char buf[BUFSIZ];
+	int chars;
+
+	__stdio_lock();
+	if (f->f_mode == _IONBF) {
+		f->f_mode = _IOFBF;
+		f->f_buf = buf;
+		f->f_size = sizeof(buf);
+		chars = __vprintf(__printf_send, f, fmt, ap);
+		__stdio_flush(f);
+		f->f_mode = _IONBF;
+		f->f_buf = NULL;
+		f->f_size = 0;
+	}
+	else {
+		chars = __vprintf(__printf_send, f, fmt, ap);
+	}
+	__stdio_unlock();
+	return chars;
 }
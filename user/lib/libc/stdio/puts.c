@@ -28,6 +28,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 /*
  * C standard I/O function - print a string and a newline.
@@ -36,7 +37,14 @@
 int
 puts(const char *s)
 {
-	__puts(s);
-	putchar('\n');
-	return 0;
+	int result;
+
+	/* (in one go, so the line is written all at once) */
+	__stdio_lock();
+	result = __stdio_write(stdout, s, strlen(s));
+	if (result == 0) {
+		result = __stdio_write(stdout, "\n", 1);
+	}
+	__stdio_unlock();
+	return result ? EOF : 0;
 }
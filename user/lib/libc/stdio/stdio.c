@@ -0,0 +1,200 @@
+/*
+ * Output streams: the standard ones, the buffering, and the lock.
+ * See stdio.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+static char stdout_buf[BUFSIZ];
+
+static FILE stderr_file = {
+	STDERR_FILENO, _IONBF, 0, 0, NULL, 0, 0, NULL
+};
+static FILE stdout_file = {
+	STDOUT_FILENO, _IOLBF, 0, 0, stdout_buf, BUFSIZ, 0, &stderr_file
+};
+
+FILE *stdout = &stdout_file;
+FILE *stderr = &stderr_file;
+
+/* Every stream; fopen and fclose keep it, locked. */
+FILE *__stdio_list = &stdout_file;
+
+/* The lock for all streams; only needed once there are threads. */
+static volatile int stdio_lockword;
+
+void
+__stdio_lock(void)
+{
+	if (__isthreaded) {
+		__futex_lock(&stdio_lockword);
+	}
+}
+
+void
+__stdio_unlock(void)
+{
+	if (__isthreaded) {
+		__futex_unlock(&stdio_lockword);
+	}
+}
+
+/*
+ * Write all of DATA to F's file handle. On failure, note it in F.
+ */
+static
+int
+stdio_rawwrite(FILE *f, const char *data, size_t len)
+{
+	int r;
+
+	while (len > 0) {
+		r = write(f->f_fd, data, len);
+		if (r <= 0) {
+			f->f_error = 1;
+			return EOF;
+		}
+		data += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/*
+ * Pass on what F's buffer holds. Locked. What could not be written is
+ * dropped, so one failure cannot wedge the stream.
+ */
+int
+__stdio_flush(FILE *f)
+{
+	size_t len;
+
+	len = f->f_len;
+	f->f_len = 0;
+	return stdio_rawwrite(f, f->f_buf, len);
+}
+
+/*
+ * Add DATA to F, passing it on as F's buffering calls for. Locked.
+ */
+int
+__stdio_write(FILE *f, const char *data, size_t len)
+{
+	size_t n, i;
+	int newline = 0;
+
+	if (f->f_mode == _IONBF || f->f_buf == NULL) {
+		return stdio_rawwrite(f, data, len);
+	}
+
+	/* No use copying what fills the buffer by itself. */
+	if (len >= f->f_size) {
+		if (__stdio_flush(f)) {
+			return EOF;
+		}
+		return stdio_rawwrite(f, data, len);
+	}
+
+	if (f->f_mode == _IOLBF) {
+		for (i=0; i<len && !newline; i++) {
+			newline = (data[i] == '\n');
+		}
+	}
+
+	while (len > 0) {
+		n = f->f_size - f->f_len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(f->f_buf + f->f_len, data, n);
+		f->f_len += n;
+		data += n;
+		len -= n;
+		if (f->f_len == f->f_size && __stdio_flush(f)) {
+			return EOF;
+		}
+	}
+
+	if (newline && f->f_len > 0) {
+		return __stdio_flush(f);
+	}
+	return 0;
+}
+
+int
+fflush(FILE *f)
+{
+	int result = 0;
+
+	__stdio_lock();
+	if (f != NULL) {
+		result = __stdio_flush(f);
+	}
+	else {
+		for (f = __stdio_list; f != NULL; f = f->f_next) {
+			if (f->f_len > 0 && __stdio_flush(f)) {
+				result = EOF;
+			}
+		}
+	}
+	__stdio_unlock();
+	return result;
+}
+
+/*
+ * Change F's buffering, to BUF (SIZE bytes), or if it is NULL, a
+ * buffer of SIZE bytes found here. Flushes what F had.
+ */
+int
+setvbuf(FILE *f, char *buf, int mode, size_t size)
+{
+	char *oldbuf;
+	int mine;
+
+	if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) {
+		errno = EINVAL;
+		return EOF;
+	}
+	if (mode != _IONBF && size == 0) {
+		errno = EINVAL;
+		return EOF;
+	}
+	if (mode != _IONBF && buf == NULL) {
+		buf = malloc(size);
+		if (buf == NULL) {
+			return EOF;
+		}
+		mine = 1;
+	}
+	else {
+		mine = 0;
+	}
+
+	__stdio_lock();
+	__stdio_flush(f);
+	oldbuf = f->f_mybuf ? f->f_buf : NULL;
+	f->f_mode = mode;
+	f->f_buf = mode == _IONBF ? NULL : buf;
+	f->f_size = mode == _IONBF ? 0 : size;
+	f->f_mybuf = mode == _IONBF ? 0 : mine;
+	__stdio_unlock();
+
+	free(oldbuf);
+	return 0;
+}
+
+int
+fileno(FILE *f)
+{
+	return f->f_fd;
+}
+
+int
+ferror(FILE *f)
+{
+	return f->f_error;
+}
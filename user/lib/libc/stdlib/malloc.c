@@ -34,12 +34,39 @@
  * easy to follow. It performs abysmally if the heap becomes larger than
  * physical memory. To get (much) better out-of-core performance, port
  * the kernel's malloc. :-)
+ *
+ * Small blocks, up to MSMALLMAX bytes, are kept apart: a free one goes
+ * on the free list for its size (a multiple of MBLOCKSIZE) rather than
+ * back into the heap, and malloc takes one from the list, so neither
+ * walks the heap. When a list is empty, one heap block of about
+ * MCARVESIZE bytes is found first-fit and cut up into blocks of that
+ * size for it. From the heap's point of view those blocks stay in use
+ * (they are never merged); mh_listed says which of them are on a list.
+ *
+ * A large free block that ends up at the top of the heap, MTRIMSIZE or
+ * more of it, is handed back to the system with sbrk.
+ *
+ * Once the process has more than one thread, the heap and the lists
+ * above are locked (__malloc_lockword), and each thread also keeps
+ * small blocks of its own: up to MTCACHEMAX of each size on lists in
+ * its struct mtcache. A thread allocates from and frees to those
+ * without locking, and moves MTCACHEMOVE at a time between them and
+ * the shared lists when they run dry or overflow. A thread's cache is
+ * at the bottom of its stack (see UTHREAD_STACKSIZE); the main
+ * thread's is __malloc_maincache. When a thread exits its cache goes
+ * back to the shared lists.
+ *
+ * A block in a thread's cache is only ever touched by that thread,
+ * which only changes the second word of its header (mh_listed); the
+ * first, mh_prevblock, may be changed at the same time under the lock
+ * when the block below is split or merged.
  */
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <err.h>
 #include <stdint.h>  // for uintptr_t on non-OS/161 platforms
+#include <kern/timepage.h>
 
 #undef MALLOCDEBUG
 
@@ -60,6 +87,8 @@
  * mh_nextblock is the upwards offset to the next header.
  *
  * mh_pad is unused.
+ * mh_listed is 1 if the block is a small one on a free list (mh_inuse
+ * is then 1 too).
  * mh_inuse is 1 if the block is in use, 0 if it is free.
  * mh_magic* should always be a fixed value.
  *
@@ -81,7 +110,8 @@ struct mheader {
 	unsigned mh_pad:1;
 	unsigned mh_magic1:2;
 
-	unsigned mh_nextblock:29;
+	unsigned mh_nextblock:28;
+	unsigned mh_listed:1;
 	unsigned mh_inuse:1;
 	unsigned mh_magic2:2;
 
@@ -97,7 +127,8 @@ struct mheader {
 	unsigned mh_pad:1;
 	unsigned mh_magic1:3;
 
-	unsigned mh_nextblock:62;
+	unsigned mh_nextblock:61;
+	unsigned mh_listed:1;
 	unsigned mh_inuse:1;
 	unsigned mh_magic2:3;
 
@@ -133,6 +164,39 @@ struct mheader {
 
 #define M_MKFIELD(off)	((off)>>MBLOCKSHIFT)
 
+/*
+ * Small blocks: the largest, and the free lists, one per size, linked
+ * through the first word of each block's data (M_LINK). MCARVESIZE is
+ * about how much is cut up at once for a list.
+ */
+#define MSMALLMAX	256
+#define MNCLASSES	(MSMALLMAX / MBLOCKSIZE)
+#define MCARVESIZE	4096
+#define M_CLASS(size)	((size) / MBLOCKSIZE - 1)
+#define M_LINK(mh)	(*(struct mheader **)M_DATA(mh))
+
+static struct mheader *__malloc_small[MNCLASSES];
+
+/* A thread's own small blocks. */
+#define MTCACHEMAX	32
+#define MTCACHEMOVE	16
+
+struct mtcache {
+	struct mheader *mt_list[MNCLASSES];
+	unsigned mt_count[MNCLASSES];
+};
+
+static struct mtcache __malloc_maincache;
+
+/* The lock for everything else. */
+static volatile int __malloc_lockword;
+
+#define MLOCK()   do { if (__isthreaded) __futex_lock(&__malloc_lockword); } while (0)
+#define MUNLOCK() do { if (__isthreaded) __futex_unlock(&__malloc_lockword); } while (0)
+
+/* Free space at the top of the heap worth giving back. */
+#define MTRIMSIZE	(32*1024)
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -241,6 +305,7 @@ __malloc_dump(void)
 		      (unsigned long) i + MBLOCKSIZE,
 		      (unsigned long) M_SIZE(mh),
 		      (unsigned long) (i+M_NEXTOFF(mh)),
+		      mh->mh_listed ? "LISTED" :
 		      mh->mh_inuse ? "INUSE" : "FREE");
 	}
 	if (i!=__heaptop) {
@@ -318,6 +383,7 @@ __malloc_split(struct mheader *mh, size_t size)
 	mhnew->mh_pad = 0;
 	mhnew->mh_magic1 = MMAGIC;
 	mhnew->mh_nextblock = M_MKFIELD(oldsize - size);
+	mhnew->mh_listed = 0;
 	mhnew->mh_inuse = 0;
 	mhnew->mh_magic2 = MMAGIC;
 
@@ -327,33 +393,17 @@ __malloc_split(struct mheader *mh, size_t size)
 }
 
 /*
- * malloc itself.
+ * Allocate from the heap itself, by first fit. size is a multiple of
+ * MBLOCKSIZE.
  */
+static
 void *
-malloc(size_t size)
+__malloc_firstfit(size_t size)
 {
 	struct mheader *mh;
 	uintptr_t i;
 	size_t rightprevblock;
 
-	if (__heapbase==0) {
-		__malloc_init();
-	}
-	if (__heapbase==0 || __heaptop==0 || __heapbase > __heaptop) {
-		warnx("malloc: Internal error - local data corrupt");
-		errx(1, "malloc: heapbase 0x%lx; heaptop 0x%lx", 
-		     (unsigned long) __heapbase, (unsigned long) __heaptop);
-	}
-
-#ifdef MALLOCDEBUG
-	warnx("malloc: about to allocate %lu (0x%lx) bytes", 
-	      (unsigned long) size, (unsigned long) size);
-	__malloc_dump();
-#endif
-
-	/* Round size up to an integral number of blocks. */
-	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
-
 	/*
 	 * First-fit search algorithm for available blocks.
 	 * Check to make sure the next/previous sizes all agree.
@@ -417,6 +467,7 @@ malloc(size_t size)
 	mh->mh_magic1 = MMAGIC;
 	mh->mh_magic2 = MMAGIC;
 	mh->mh_pad = 0;
+	mh->mh_listed = 0;
 	mh->mh_inuse = 1;
 	mh->mh_nextblock = M_MKFIELD(size + MBLOCKSIZE);
 
@@ -427,6 +478,213 @@ malloc(size_t size)
 	return M_DATA(mh);
 }
 
+/*
+ * Refill the free list for small blocks of SIZE: get one heap block
+ * and cut it into as many of them as fit in MCARVESIZE.
+ */
+static
+int
+__malloc_carve(size_t size)
+{
+	struct mheader *mh;
+	unsigned n, k;
+	void *x;
+
+	n = MCARVESIZE / (size + MBLOCKSIZE);
+	x = __malloc_firstfit(n*(size + MBLOCKSIZE) - MBLOCKSIZE);
+	if (x == NULL) {
+		return -1;
+	}
+	mh = ((struct mheader *)x)-1;
+
+	for (k=0; k<n; k++) {
+		if (k < n-1) {
+			__malloc_split(mh, size);
+		}
+		mh->mh_inuse = 1;
+		mh->mh_listed = 1;
+		M_LINK(mh) = __malloc_small[M_CLASS(size)];
+		__malloc_small[M_CLASS(size)] = mh;
+		mh = M_NEXT(mh);
+	}
+	return 0;
+}
+
+/*
+ * Set up the heap if need be, and check it. Locked.
+ */
+static
+void
+__malloc_check(void)
+{
+	if (__heapbase==0) {
+		__malloc_init();
+	}
+	if (__heapbase==0 || __heaptop==0 || __heapbase > __heaptop) {
+		warnx("malloc: Internal error - local data corrupt");
+		errx(1, "malloc: heapbase 0x%lx; heaptop 0x%lx", 
+		     (unsigned long) __heapbase, (unsigned long) __heaptop);
+	}
+}
+
+/*
+ * Take the first block off the list at *LIST, for blocks of SIZE.
+ */
+static
+struct mheader *
+__malloc_pop(struct mheader **list, size_t size)
+{
+	struct mheader *mh = *list;
+
+	if (!M_OK(mh) || !mh->mh_listed) {
+		errx(1, "malloc: Heap corrupt; free list for %lu bytes "
+		     "has bad block at %p", (unsigned long) size, mh);
+	}
+	*list = M_LINK(mh);
+	return mh;
+}
+
+/*
+ * Take a small block of SIZE from the shared lists. Locked.
+ */
+static
+struct mheader *
+__malloc_getsmall(size_t size)
+{
+	if (__malloc_small[M_CLASS(size)] == NULL && __malloc_carve(size)) {
+		return NULL;
+	}
+	return __malloc_pop(&__malloc_small[M_CLASS(size)], size);
+}
+
+/*
+ * The calling thread's cache.
+ */
+static
+struct mtcache *
+__malloc_mycache(void)
+{
+	char here;
+
+	/* The main thread's stack is the one above the time page. */
+	if ((uintptr_t)&here > TIMEPAGE_VADDR) {
+		return &__malloc_maincache;
+	}
+	return (struct mtcache *)
+		((uintptr_t)&here & ~(uintptr_t)(UTHREAD_STACKSIZE - 1));
+}
+
+/*
+ * Move up to N blocks from the head of TC's list for class C to the
+ * shared list. Locked.
+ */
+static
+void
+__malloc_tcdrain(struct mtcache *tc, unsigned c, unsigned n)
+{
+	struct mheader *mh;
+
+	while (n > 0 && tc->mt_list[c] != NULL) {
+		mh = tc->mt_list[c];
+		tc->mt_list[c] = M_LINK(mh);
+		tc->mt_count[c]--;
+		M_LINK(mh) = __malloc_small[c];
+		__malloc_small[c] = mh;
+		n--;
+	}
+}
+
+/*
+ * A small block of SIZE from this thread's cache, which is refilled
+ * from the shared lists if it is empty.
+ */
+static
+void *
+__malloc_cached(size_t size)
+{
+	struct mtcache *tc = __malloc_mycache();
+	unsigned c = M_CLASS(size), n;
+	struct mheader *mh;
+
+	if (tc->mt_list[c] == NULL) {
+		MLOCK();
+		__malloc_check();
+		for (n=0; n<MTCACHEMOVE; n++) {
+			mh = __malloc_getsmall(size);
+			if (mh == NULL) {
+				break;
+			}
+			M_LINK(mh) = tc->mt_list[c];
+			tc->mt_list[c] = mh;
+			tc->mt_count[c]++;
+		}
+		MUNLOCK();
+		if (tc->mt_list[c] == NULL) {
+			return NULL;
+		}
+	}
+
+	mh = __malloc_pop(&tc->mt_list[c], size);
+	tc->mt_count[c]--;
+	mh->mh_listed = 0;
+	return M_DATA(mh);
+}
+
+void
+__malloc_threadexit(void)
+{
+	struct mtcache *tc = __malloc_mycache();
+	unsigned c;
+
+	MLOCK();
+	for (c=0; c<MNCLASSES; c++) {
+		__malloc_tcdrain(tc, c, tc->mt_count[c]);
+	}
+	MUNLOCK();
+}
+
+/*
+ * malloc itself.
+ */
+void *
+malloc(size_t size)
+{
+	struct mheader *mh;
+	void *x;
+
+	/* Round size up to an integral number of blocks. */
+	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
+	if (size == 0) {
+		size = MBLOCKSIZE;
+	}
+
+	if (size <= MSMALLMAX && __isthreaded) {
+		return __malloc_cached(size);
+	}
+
+	MLOCK();
+	__malloc_check();
+
+#ifdef MALLOCDEBUG
+	warnx("malloc: about to allocate %lu (0x%lx) bytes", 
+	      (unsigned long) size, (unsigned long) size);
+	__malloc_dump();
+#endif
+
+	if (size > MSMALLMAX) {
+		x = __malloc_firstfit(size);
+	}
+	else {
+		mh = __malloc_getsmall(size);
+		if (mh != NULL) {
+			mh->mh_listed = 0;
+		}
+		x = mh == NULL ? NULL : M_DATA(mh);
+	}
+	MUNLOCK();
+	return x;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -475,6 +733,30 @@ __malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
 	__malloc_deadbeef(mhnext, sizeof(struct mheader));
 }
 
+/*
+ * If MH, free, is at the top of the heap and big enough to be worth
+ * it, give it back to the system.
+ */
+static
+void
+__malloc_trim(struct mheader *mh)
+{
+	size_t size;
+
+	if (mh->mh_inuse || M_NEXT(mh) != (struct mheader *)__heaptop) {
+		return;
+	}
+	size = M_NEXTOFF(mh);
+	if (size < MTRIMSIZE) {
+		return;
+	}
+	if (sbrk(-(intptr_t)size) == (void *)-1) {
+		/* no matter; keep it */
+		return;
+	}
+	__heaptop -= size;
+}
+
 /*
  * The actual free() implementation.
  */
@@ -482,6 +764,8 @@ void
 free(void *x)
 {
 	struct mheader *mh, *mhnext, *mhprev;
+	struct mtcache *tc;
+	unsigned c;
 
 	if (x==NULL) {
 		/* safest practice */
@@ -510,10 +794,34 @@ free(void *x)
 		errx(1, "free: Invalid pointer %p freed (corrupt header)", x);
 	}
 
-	if (!mh->mh_inuse) {
+	if (!mh->mh_inuse || mh->mh_listed) {
 		errx(1, "free: Invalid pointer %p freed (already free)", x);
 	}
 
+	/* a small one goes back on this thread's list, or the shared one */
+	if (M_SIZE(mh) <= MSMALLMAX) {
+		c = M_CLASS(M_SIZE(mh));
+		__malloc_deadbeef(M_DATA(mh), M_SIZE(mh));
+		mh->mh_listed = 1;
+		if (__isthreaded) {
+			tc = __malloc_mycache();
+			M_LINK(mh) = tc->mt_list[c];
+			tc->mt_list[c] = mh;
+			if (++tc->mt_count[c] > MTCACHEMAX) {
+				MLOCK();
+				__malloc_tcdrain(tc, c, MTCACHEMOVE);
+				MUNLOCK();
+			}
+		}
+		else {
+			M_LINK(mh) = __malloc_small[c];
+			__malloc_small[c] = mh;
+		}
+		return;
+	}
+
+	MLOCK();
+
 	/* mark it free */
 	mh->mh_inuse = 0;
 
@@ -530,8 +838,14 @@ free(void *x)
 	if (mh != (struct mheader *)__heapbase) {
 		mhprev = M_PREV(mh);
 		__malloc_trymerge(mhprev, mh);
+		if (!mhprev->mh_inuse) {
+			mh = mhprev;
+		}
 	}
 
+	__malloc_trim(mh);
+	MUNLOCK();
+
 #ifdef MALLOCDEBUG
 	warnx("free: freed %p", x);
 	__malloc_dump();
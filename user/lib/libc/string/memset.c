@@ -27,6 +27,7 @@
  * SUCH DAMAGE.
  */
 
+#include <stdint.h>
 #include <string.h>
 
 /*
@@ -36,11 +37,40 @@
 void *
 memset(void *ptr, int ch, size_t len)
 {
-	char *p = ptr;
-	size_t i;
-	
-	for (i=0; i<len; i++) {
-		p[i] = ch;
+	unsigned char *p = ptr;
+	unsigned long *lp, pat;
+
+	/* As in bzero, with CH in each byte of the words written. */
+
+	if (len >= 2 * sizeof(long)) {
+		pat = (~0UL / 0xff) * (unsigned char)ch;
+		while ((uintptr_t)p % sizeof(long) != 0) {
+			*p++ = ch;
+			len--;
+		}
+		lp = (unsigned long *)p;
+		while (len >= 8 * sizeof(long)) {
+			lp[0] = pat;
+			lp[1] = pat;
+			lp[2] = pat;
+			lp[3] = pat;
+			lp[4] = pat;
+			lp[5] = pat;
+			lp[6] = pat;
+			lp[7] = pat;
+			lp += 8;
+			len -= 8 * sizeof(long);
+		}
+		while (len >= sizeof(long)) {
+			*lp++ = pat;
+			len -= sizeof(long);
+		}
+		p = (unsigned char *)lp;
+	}
+
+	while (len > 0) {
+		*p++ = ch;
+		len--;
 	}
 
 	return ptr;
@@ -5,6 +5,10 @@
 #
 # Parses the kernel's syscalls.h into the body of syscalls.S
 #
+# A call that libc wraps in C gets its stub named with __ in front,
+# for the wrapper to call; those are listed in WRAPPED.
+#
+WRAPPED="fork thread_exit"
 
 # tabs to spaces, just in case
 tr '\t' ' ' |\
@@ -19,8 +23,10 @@ awk '
 	# print the name of the call and the number.
 	print $2, $3;
     }
-' | awk '{
+' | awk -v wrapped="$WRAPPED" '
+    BEGIN { n = split(wrapped, w, " "); for (i=1; i<=n; i++) wrap[w[i]]=1; }
+    {
 	# output something simple that will work in syscalls.S.
-	printf "SYSCALL(%s, %s)\n", $1, $2;
+	printf "SYSCALL(%s%s, %s)\n", ($1 in wrap) ? "__" : "", $1, $2;
 }'
     
@@ -0,0 +1,50 @@
+/*
+ * __futex_lock and __futex_unlock: a lock that only enters the kernel
+ * when it is contended. The word is 0 free, 1 held, 2 held and maybe
+ * wanted by a thread sleeping in futex_wait, which the holder wakes
+ * when it lets go.
+ */
+
+#include <unistd.h>
+
+/*
+ * Atomically store V in *P and return what was there, using LL/SC.
+ */
+static
+int
+futexlock_swap(volatile int *p, int v)
+{
+	int old, ok;
+
+	do {
+		ok = v;
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   old = *p */
+			"sc %1, 0(%2);"		/*   *p = ok; ok = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (old), "+r" (ok) : "r" (p) : "memory");
+	} while (ok == 0);
+	return old;
+}
+
+void
+__futex_lock(volatile int *lk)
+{
+	if (futexlock_swap(lk, 1) == 0) {
+		return;
+	}
+	while (futexlock_swap(lk, 2) != 0) {
+		futex_wait(lk, 2);
+	}
+}
+
+void
+__futex_unlock(volatile int *lk)
+{
+	if (futexlock_swap(lk, 0) == 2) {
+		futex_wake(lk, 1);
+	}
+}
@@ -0,0 +1,43 @@
+/*
+ * thread_create: start a thread in this process.
+ *
+ * The kernel starts the new thread at thread_start, with the user's
+ * function and argument, on a stack of its own; thread_start calls the
+ * function and passes what it returns to thread_exit, which thread_join
+ * hands back.
+ *
+ * thread_exit wraps the system call, so that the thread's malloc cache
+ * is given back before its stack, where the cache lives, goes away.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Set by thread_create. Until then there is only one thread, and
+ * nothing for stdio or malloc to lock against.
+ */
+int __isthreaded;
+
+__DEAD void __thread_exit(void *retval);
+
+static
+void
+thread_start(void *(*func)(void *), void *arg)
+{
+	thread_exit(func(arg));
+}
+
+int
+thread_create(void *(*func)(void *), void *arg)
+{
+	__isthreaded = 1;
+	return __thread_create(thread_start, func, arg);
+}
+
+void
+thread_exit(void *retval)
+{
+	__malloc_threadexit();
+	__thread_exit(retval);
+}
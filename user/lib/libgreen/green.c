@@ -0,0 +1,451 @@
+/*
+ * libgreen: greens on workers, with upcall_wait saying when a worker
+ * blocks in the kernel. See green.h.
+ *
+ * Each green's stack is a UTHREAD_STACKSIZE slot aligned to its size,
+ * cut from a chunk got with mmap, so that malloc finds the green's own
+ * cache at the bottom of it just as it would a thread's; the struct
+ * green sits at the top. The slots of finished greens are kept for new
+ * ones.
+ *
+ * A worker runs greens from the one queue until none are left. It goes
+ * idle ("parks") when the queue is empty, or when more workers are
+ * running than were asked for because one that was blocked has come
+ * back. Before parking it stops being a worker as far as the kernel is
+ * concerned, so that its sleep is not counted as blocking. The watcher
+ * thread, which is not a worker, waits for the number of blocked
+ * workers to change, and wakes or starts a worker to stand in for each
+ * that blocks while there is work queued.
+ *
+ * Everything here is under one lock. A green that gives up its worker
+ * is only put back on the queue, or its slot freed, by the worker once
+ * it has switched away from it, so no other worker can pick it up while
+ * its registers are still being saved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <green.h>
+
+#define GREEN_MAXWORKERS	32
+#define GREEN_CHUNK		16	/* slots to get from mmap at a time */
+#define GREEN_NREGS		11	/* sp, ra, s0-s8; see greenswitch.S */
+
+struct worker;
+
+struct green {
+	uint32_t g_regs[GREEN_NREGS];
+	struct green *g_next;		/* on the queue or the free list */
+	struct worker *g_worker;	/* running it now */
+	void (*g_func)(void *);
+	void *g_arg;
+	int g_done;
+};
+
+/* Where struct green is, down from the top of its slot. */
+#define GREEN_TOP	((sizeof(struct green) + 7) & ~(size_t)7)
+
+struct worker {
+	uint32_t w_regs[GREEN_NREGS];	/* its own context, between greens */
+	int w_tid;			/* 0 for green_run's caller */
+	volatile int w_wake;		/* set to unpark it */
+	struct worker *w_nextparked;
+};
+
+void green_switch(uint32_t *save, uint32_t *load);
+void green_start(void);
+void green_entry(struct green *g);
+
+static void green_addworker(struct worker *w);
+
+static volatile int green_lockword;
+static struct green *green_head, *green_tail;	/* the run queue */
+static struct green *green_free;		/* slots to reuse */
+static unsigned green_live;			/* greens not finished */
+
+static struct worker green_workers[GREEN_MAXWORKERS];
+static unsigned green_nstarted;			/* of green_workers */
+static struct worker *green_parked;
+static int green_nworkers;			/* asked for */
+static int green_active;			/* not parked; maybe blocked */
+static int green_blocked;			/* as upcall_wait last said */
+static volatile int green_starting;		/* thread_creates under way */
+static int green_watching;
+
+#define GLOCK()   __futex_lock(&green_lockword)
+#define GUNLOCK() __futex_unlock(&green_lockword)
+
+////////////////////////////////////////////////////////////
+
+/*
+ * The green calling, found from where its stack is.
+ */
+static
+struct green *
+green_self(void)
+{
+	char here;
+	uintptr_t base;
+
+	base = (uintptr_t)&here & ~(uintptr_t)(UTHREAD_STACKSIZE - 1);
+	return (struct green *)(base + UTHREAD_STACKSIZE - GREEN_TOP);
+}
+
+/*
+ * A slot for a new green. The mapping is a slot bigger than it needs to
+ * be, so that GREEN_CHUNK aligned slots fit in it wherever it lands;
+ * its pages are only touched, and so only take memory, as the stacks
+ * grow into them. Locked.
+ */
+static
+struct green *
+green_slot(void)
+{
+	struct green *g;
+	uintptr_t p;
+	unsigned i;
+
+	if (green_free == NULL) {
+		p = (uintptr_t)mmap(NULL, (GREEN_CHUNK + 1) * UTHREAD_STACKSIZE,
+				    PROT_READ | PROT_WRITE,
+				    MAP_ANON | MAP_PRIVATE, -1, 0);
+		if ((void *)p == MAP_FAILED) {
+			return NULL;
+		}
+		p = (p + UTHREAD_STACKSIZE - 1) &
+			~(uintptr_t)(UTHREAD_STACKSIZE - 1);
+		for (i = 0; i < GREEN_CHUNK; i++) {
+			g = (struct green *)
+				(p + (i + 1) * UTHREAD_STACKSIZE - GREEN_TOP);
+			g->g_next = green_free;
+			green_free = g;
+		}
+	}
+	g = green_free;
+	green_free = g->g_next;
+	return g;
+}
+
+/*
+ * If there is work queued and fewer workers running than asked for,
+ * get another going: unpark one, or, if none is parked, reserve one to
+ * start and hand it back in *STARTP for the caller to start with
+ * green_addworker once unlocked. Returns 0 if there was nothing to do.
+ * Locked.
+ */
+static
+int
+green_wakeone(struct worker **startp)
+{
+	struct worker *w;
+
+	*startp = NULL;
+	if (green_head == NULL ||
+	    green_active - green_blocked >= green_nworkers) {
+		return 0;
+	}
+	w = green_parked;
+	if (w != NULL) {
+		green_parked = w->w_nextparked;
+		w->w_wake = 1;
+		futex_wake(&w->w_wake, 1);
+	}
+	else if (green_nstarted < GREEN_MAXWORKERS) {
+		w = &green_workers[green_nstarted++];
+		w->w_tid = 0;
+		w->w_wake = 0;
+		green_starting++;
+		*startp = w;
+	}
+	else {
+		return 0;
+	}
+	green_active++;
+	return 1;
+}
+
+/*
+ * Unpark every worker, when the last green has finished. Locked.
+ */
+static
+void
+green_wakeall(void)
+{
+	struct worker *w;
+
+	while ((w = green_parked) != NULL) {
+		green_parked = w->w_nextparked;
+		green_active++;
+		w->w_wake = 1;
+		futex_wake(&w->w_wake, 1);
+	}
+}
+
+/*
+ * Put G on the end of the queue. Returns a worker to start, as
+ * green_wakeone does. Locked.
+ */
+static
+struct worker *
+green_enqueue(struct green *g)
+{
+	struct worker *start;
+
+	g->g_next = NULL;
+	if (green_tail == NULL) {
+		green_head = g;
+	}
+	else {
+		green_tail->g_next = g;
+	}
+	green_tail = g;
+	green_wakeone(&start);
+	return start;
+}
+
+/*
+ * Park W until something sets w_wake. Called locked; unlocks while
+ * asleep.
+ */
+static
+void
+green_park(struct worker *w)
+{
+	w->w_nextparked = green_parked;
+	green_parked = w;
+	green_active--;
+	GUNLOCK();
+
+	upcall_register(0);
+	while (w->w_wake == 0) {
+		futex_wait(&w->w_wake, 0);
+	}
+	w->w_wake = 0;
+	upcall_register(1);
+
+	GLOCK();
+}
+
+/*
+ * Run greens on W until none are left.
+ */
+static
+void
+green_work(struct worker *w)
+{
+	struct worker *start;
+	struct green *g;
+
+	upcall_register(1);
+	GLOCK();
+	while (green_live > 0) {
+		if (green_head == NULL ||
+		    green_active - green_blocked > green_nworkers) {
+			green_park(w);
+			continue;
+		}
+		g = green_head;
+		green_head = g->g_next;
+		if (green_head == NULL) {
+			green_tail = NULL;
+		}
+		GUNLOCK();
+
+		g->g_worker = w;
+		green_switch(w->w_regs, g->g_regs);
+
+		start = NULL;
+		GLOCK();
+		if (g->g_done) {
+			g->g_next = green_free;
+			green_free = g;
+			if (--green_live == 0) {
+				green_wakeall();
+			}
+		}
+		else {
+			start = green_enqueue(g);
+		}
+		if (start != NULL) {
+			GUNLOCK();
+			green_addworker(start);
+			GLOCK();
+		}
+	}
+	GUNLOCK();
+	upcall_register(0);
+}
+
+static
+void *
+green_worker(void *w)
+{
+	green_work(w);
+	return NULL;
+}
+
+/*
+ * Start the thread for W, reserved by green_wakeone or green_run.
+ */
+static
+void
+green_addworker(struct worker *w)
+{
+	int tid;
+
+	tid = thread_create(green_worker, w);
+	GLOCK();
+	w->w_tid = tid;
+	if (tid < 0) {
+		green_active--;
+	}
+	green_starting--;
+	GUNLOCK();
+	futex_wake(&green_starting, 1);
+}
+
+/*
+ * The watcher: whenever the number of blocked workers changes, record
+ * it, and start a worker for each that has blocked if there is work
+ * for it. upcall_wait fails when the process is exiting.
+ */
+static
+void *
+green_watch(void *unused)
+{
+	struct worker *start;
+	int n = 0;
+
+	(void)unused;
+	while ((n = upcall_wait(n)) >= 0) {
+		GLOCK();
+		green_blocked = n;
+		while (green_wakeone(&start)) {
+			if (start != NULL) {
+				GUNLOCK();
+				green_addworker(start);
+				GLOCK();
+			}
+		}
+		GUNLOCK();
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////
+
+void
+green_entry(struct green *g)
+{
+	g->g_func(g->g_arg);
+	green_exit();
+}
+
+int
+green_spawn(void (*func)(void *), void *arg)
+{
+	struct worker *start;
+	struct green *g;
+
+	GLOCK();
+	g = green_slot();
+	if (g == NULL) {
+		GUNLOCK();
+		return -1;
+	}
+	memset(g->g_regs, 0, sizeof(g->g_regs));
+	/* Start below the struct, leaving the o32 argument save area. */
+	g->g_regs[0] = (uint32_t)(uintptr_t)g - 16;
+	g->g_regs[1] = (uint32_t)(uintptr_t)green_start;
+	g->g_regs[2] = (uint32_t)(uintptr_t)g;
+	g->g_worker = NULL;
+	g->g_func = func;
+	g->g_arg = arg;
+	g->g_done = 0;
+	green_live++;
+	start = green_enqueue(g);
+	GUNLOCK();
+
+	if (start != NULL) {
+		green_addworker(start);
+	}
+	return 0;
+}
+
+void
+green_yield(void)
+{
+	struct green *g = green_self();
+
+	green_switch(g->g_regs, g->g_worker->w_regs);
+}
+
+void
+green_exit(void)
+{
+	struct green *g = green_self();
+
+	/* Give back the malloc cache before the slot is reused. */
+	__malloc_threadexit();
+	g->g_done = 1;
+	green_switch(g->g_regs, g->g_worker->w_regs);
+	for (;;) {
+		/* Nothing switches back to a finished green. */
+		abort();
+	}
+}
+
+int
+green_run(unsigned nworkers, void (*func)(void *), void *arg)
+{
+	struct worker *w;
+	unsigned i;
+	int n;
+
+	if (nworkers == 0 || nworkers > GREEN_MAXWORKERS) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!green_watching) {
+		if (thread_create(green_watch, NULL) < 0) {
+			return -1;
+		}
+		green_watching = 1;
+	}
+
+	/* Count the workers as running already, so spawning starts none. */
+	GLOCK();
+	green_nworkers = nworkers;
+	green_active = nworkers;
+	green_nstarted = 1;
+	GUNLOCK();
+	if (green_spawn(func, arg) < 0) {
+		return -1;
+	}
+	for (i = 1; i < nworkers; i++) {
+		GLOCK();
+		w = &green_workers[green_nstarted++];
+		w->w_tid = 0;
+		w->w_wake = 0;
+		green_starting++;
+		GUNLOCK();
+		green_addworker(w);
+	}
+
+	green_work(&green_workers[0]);
+
+	/* No more can start now; wait for any still being started. */
+	while ((n = green_starting) != 0) {
+		futex_wait(&green_starting, n);
+	}
+	for (i = 1; i < green_nstarted; i++) {
+		if (green_workers[i].w_tid > 0) {
+			thread_join(green_workers[i].w_tid, NULL);
+		}
+	}
+	green_nstarted = 0;
+	return 0;
+}
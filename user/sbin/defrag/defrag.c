@@ -0,0 +1,102 @@
+/*
+ * defrag - move the blocks of SFS files into runs, while mounted.
+ * Usage: defrag file-or-directory...
+ *
+ * Each file named, and each file under each directory named, is
+ * defragmented in turn by the filesystem (IOCTL_SFSDEFRAG), which may
+ * go on being used meanwhile. Prints how many blocks were moved for
+ * each file that needed it. dumpsfs -f shows which files need it.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+static unsigned long totalmoved;
+static int failed;
+
+static
+void
+defragfile(const char *path)
+{
+	uint32_t moved = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		warn("%s", path);
+		failed = 1;
+		return;
+	}
+	if (ioctl(fd, IOCTL_SFSDEFRAG, &moved) < 0) {
+		warn("%s", path);
+		failed = 1;
+	}
+	else if (moved > 0) {
+		printf("%s: %u blocks moved\n", path, moved);
+		totalmoved += moved;
+	}
+	close(fd);
+}
+
+static
+void
+defrag(const char *path)
+{
+	struct stat st;
+	char name[NAME_MAX+1];
+	char sub[PATH_MAX];
+	int fd, len;
+
+	if (stat(path, &st) < 0) {
+		warn("%s", path);
+		failed = 1;
+		return;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		defragfile(path);
+		return;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		warn("%s", path);
+		failed = 1;
+		return;
+	}
+	while ((len = getdirentry(fd, name, sizeof(name) - 1)) > 0) {
+		name[len] = 0;
+		if (!strcmp(name, ".") || !strcmp(name, "..")) {
+			continue;
+		}
+		snprintf(sub, sizeof(sub), "%s/%s", path, name);
+		defrag(sub);
+	}
+	if (len < 0) {
+		warn("%s", path);
+		failed = 1;
+	}
+	close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i;
+
+	if (argc < 2) {
+		errx(1, "Usage: defrag file-or-directory...");
+	}
+	for (i = 1; i < argc; i++) {
+		defrag(argv[i]);
+	}
+	printf("%lu blocks moved\n", totalmoved);
+	return failed;
+}
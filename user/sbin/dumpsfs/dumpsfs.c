@@ -56,6 +56,12 @@
 
 #include "disk.h"
 
+/* Buckets of the free run histogram: runs of 1, 2-3, 4-7, and so on */
+#define NRUNBUCKETS 16
+
+/* What the fragmentation report has found */
+static uint32_t frag_files, frag_fragmented, frag_blocks, frag_extents;
+
 static
 uint32_t
 dumpsb(void)
@@ -68,6 +74,11 @@ dumpsb(void)
 	sp.sp_volname[sizeof(sp.sp_volname)-1] = 0;
 	printf("Volume name: %-40s  %u blocks\n", sp.sp_volname, 
 	       SWAPL(sp.sp_nblocks));
+	printf("Version: %u\n", SWAPL(sp.sp_version));
+	if (SWAPL(sp.sp_jblocks) > 0) {
+		printf("Journal: %u blocks at %u\n", SWAPL(sp.sp_jblocks),
+		       SWAPL(sp.sp_jstart));
+	}
 
 	return SWAPL(sp.sp_nblocks);
 }
@@ -154,21 +165,265 @@ dumpbits(uint32_t fsblocks)
 	printf("\n");
 }
 
+////////////////////////////////////////////////////////////
+// fragmentation report (-f)
+
+/*
+ * Call FN with DATA on each data block under BLOCK, an indirect block
+ * LEVELS deep (or for 0 a data block itself), in file order, while
+ * *LEFT, the blocks of the file still to go, is not 0. Holes count
+ * towards *LEFT but are not passed to FN.
+ */
+static
+void
+walkblocks(uint32_t block, unsigned levels, uint32_t *left,
+	   void (*fn)(uint32_t, void *), void *data)
+{
+	uint32_t ib[SFS_DBPERIDB];
+	uint32_t span;
+	unsigned i;
+
+	if (*left == 0) {
+		return;
+	}
+	if (block == 0) {
+		for (span = 1, i = 0; i < levels; i++) {
+			span *= SFS_DBPERIDB;
+		}
+		*left -= span < *left ? span : *left;
+		return;
+	}
+	if (levels == 0) {
+		fn(block, data);
+		(*left)--;
+		return;
+	}
+	diskread(ib, block);
+	for (i=0; i<SFS_DBPERIDB && *left > 0; i++) {
+		walkblocks(SWAPL(ib[i]), levels-1, left, fn, data);
+	}
+}
+
+/*
+ * Call FN with DATA on each data block of the file SFI, in order.
+ */
+static
+void
+fileblocks(const struct sfs_inode *sfi, void (*fn)(uint32_t, void *),
+	   void *data)
+{
+	uint32_t left;
+	unsigned i;
+
+	if (SWAPL(sfi->sfi_flags) & SFS_INODE_INLINE) {
+		/* the data is in the inode */
+		return;
+	}
+	left = (SWAPL(sfi->sfi_size) + SFS_BLOCKSIZE - 1) / SFS_BLOCKSIZE;
+	for (i=0; i<SFS_NDIRECT; i++) {
+		walkblocks(SWAPL(sfi->sfi_direct[i]), 0, &left, fn, data);
+	}
+	walkblocks(SWAPL(sfi->sfi_indirect), 1, &left, fn, data);
+	walkblocks(SWAPL(sfi->sfi_dindirect), 2, &left, fn, data);
+	walkblocks(SWAPL(sfi->sfi_tindirect), 3, &left, fn, data);
+}
+
+/*
+ * Counting a file's extents: runs of blocks next to each other on
+ * disk, in the order the file has them.
+ */
+struct extents {
+	uint32_t ex_last;
+	uint32_t ex_nblocks;
+	uint32_t ex_nextents;
+};
+
+static
+void
+countextent(uint32_t block, void *data)
+{
+	struct extents *ex = data;
+
+	if (ex->ex_nblocks == 0 || block != ex->ex_last + 1) {
+		ex->ex_nextents++;
+	}
+	ex->ex_last = block;
+	ex->ex_nblocks++;
+}
+
+static
+void
+fragfile(const struct sfs_inode *sfi, const char *path)
+{
+	struct extents ex;
+
+	ex.ex_nblocks = ex.ex_nextents = 0;
+	fileblocks(sfi, countextent, &ex);
+
+	frag_files++;
+	frag_blocks += ex.ex_nblocks;
+	frag_extents += ex.ex_nextents;
+	if (ex.ex_nextents > 1) {
+		frag_fragmented++;
+		printf("    %6u blocks in %5u extents: %s\n",
+		       ex.ex_nblocks, ex.ex_nextents, path);
+	}
+}
+
+static void fragdir(uint32_t ino, const char *path);
+
+/* Which directory fragdirblock is going through */
+struct dirwalk {
+	const char *dw_path;
+};
+
+static
+void
+fragdirblock(uint32_t block, void *data)
+{
+	struct dirwalk *dw = data;
+	struct sfs_dir sds[SFS_BLOCKSIZE/sizeof(struct sfs_dir)];
+	struct sfs_inode sfi;
+	char path[1024];
+	unsigned i;
+	uint32_t ino;
+
+	diskread(&sds, block);
+	for (i=0; i<SFS_BLOCKSIZE/sizeof(struct sfs_dir); i++) {
+		ino = SWAPL(sds[i].sfd_ino);
+		sds[i].sfd_name[SFS_NAMELEN-1] = 0;
+		if (ino == SFS_NOINO || !strcmp(sds[i].sfd_name, ".") ||
+		    !strcmp(sds[i].sfd_name, "..")) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dw->dw_path,
+			 sds[i].sfd_name);
+		diskread(&sfi, ino);
+		if (SWAPS(sfi.sfi_type) == SFS_TYPE_DIR) {
+			fragdir(ino, path);
+		}
+		else {
+			fragfile(&sfi, path);
+		}
+	}
+}
+
+/*
+ * Report on each file under the directory INO, at PATH. A file with
+ * more than one name is counted under each.
+ */
+static
+void
+fragdir(uint32_t ino, const char *path)
+{
+	struct sfs_inode sfi;
+	struct dirwalk dw;
+
+	diskread(&sfi, ino);
+	dw.dw_path = path;
+	fileblocks(&sfi, fragdirblock, &dw);
+}
+
+/*
+ * Histogram the runs of free blocks in the freemap, by log2 of their
+ * length.
+ */
+static
+void
+fragfree(uint32_t fsblocks)
+{
+	uint32_t runs[NRUNBUCKETS], runblocks[NRUNBUCKETS];
+	unsigned char data[SFS_BLOCKSIZE];
+	uint32_t block, len, total, longest;
+	unsigned b;
+
+	for (b=0; b<NRUNBUCKETS; b++) {
+		runs[b] = runblocks[b] = 0;
+	}
+	len = total = longest = 0;
+	for (block=0; block<=fsblocks; block++) {
+		if (block % SFS_BLOCKBITS == 0 && block < fsblocks) {
+			diskread(data, SFS_MAP_LOCATION + block/SFS_BLOCKBITS);
+		}
+		if (block < fsblocks &&
+		    (data[(block % SFS_BLOCKBITS)/8] & (1 << (block%8))) == 0) {
+			len++;
+			continue;
+		}
+		if (len == 0) {
+			continue;
+		}
+		for (b=0; b<NRUNBUCKETS-1 && (len >> (b+1)) != 0; b++) {
+			/* nothing */
+		}
+		runs[b]++;
+		runblocks[b] += len;
+		total += len;
+		if (len > longest) {
+			longest = len;
+		}
+		len = 0;
+	}
+
+	printf("Free space: %u blocks, longest run %u\n", total, longest);
+	for (b=0; b<NRUNBUCKETS; b++) {
+		if (runs[b] == 0) {
+			continue;
+		}
+		if (b == NRUNBUCKETS-1) {
+			printf("    %6u and up: ", 1U << b);
+		}
+		else {
+			printf("    %6u-%-6u: ", 1U << b, (2U << b) - 1);
+		}
+		printf("%6u runs, %8u blocks (%u%%)\n", runs[b], runblocks[b],
+		       runblocks[b] * 100 / total);
+	}
+}
+
+static
+void
+fragreport(uint32_t fsblocks)
+{
+	printf("Fragmented files:\n");
+	fragdir(SFS_ROOT_LOCATION, "");
+	printf("%u files, %u blocks in %u extents; %u fragmented",
+	       frag_files, frag_blocks, frag_extents, frag_fragmented);
+	if (frag_extents > 0) {
+		printf("; %u.%u blocks per extent",
+		       frag_blocks / frag_extents,
+		       frag_blocks * 10 / frag_extents % 10);
+	}
+	printf("\n");
+	fragfree(fsblocks);
+}
+
 int
 main(int argc, char **argv)
 {
 	uint32_t nblocks;
+	int frag = 0;
 
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
+	if (argc==3 && !strcmp(argv[1], "-f")) {
+		frag = 1;
+		argc--;
+		argv++;
+	}
 	if (argc!=2) {
-		errx(1, "Usage: dumpsfs device/diskfile");
+		errx(1, "Usage: dumpsfs [-f] device/diskfile");
 	}
 
 	opendisk(argv[1]);
 	nblocks = dumpsb();
+	if (frag) {
+		fragreport(nblocks);
+		closedisk();
+		return 0;
+	}
 	dumpbits(nblocks);
 	dumpdir(SFS_ROOT_LOCATION);
 
@@ -0,0 +1,149 @@
+/*
+ * iostat - what the storage devices have done.
+ * Usage: iostat [prog [args...]]
+ *
+ * On its own, prints each device's counts since boot: requests, data
+ * moved, errors, the most requests it has had at once, the mean time
+ * a request took, and how long it was busy, then the times by log2
+ * bucket in microseconds. With a program, runs it and prints what the
+ * devices did meanwhile instead, with how busy each was as a share of
+ * the time the program took: a device near 100% is what the program
+ * was waiting for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define MaxDevs 16
+
+static struct iostatinfo before[MaxDevs], after[MaxDevs];
+
+/*
+ * Get every device's counts into IS; returns how many there are.
+ */
+static
+unsigned
+snapshot(struct iostatinfo *is)
+{
+	unsigned i;
+
+	for (i = 0; i < MaxDevs; i++) {
+		if (getiostat(i, &is[i]) < 0) {
+			if (errno == ENOENT) {
+				break;
+			}
+			err(1, "getiostat");
+		}
+	}
+	return i;
+}
+
+/*
+ * Take the counts in B off those in A.
+ */
+static
+void
+subtract(struct iostatinfo *a, const struct iostatinfo *b)
+{
+	unsigned i;
+
+	a->is_reads -= b->is_reads;
+	a->is_writes -= b->is_writes;
+	a->is_others -= b->is_others;
+	a->is_errors -= b->is_errors;
+	a->is_rbytes -= b->is_rbytes;
+	a->is_wbytes -= b->is_wbytes;
+	a->is_busyns -= b->is_busyns;
+	a->is_totalns -= b->is_totalns;
+	for (i = 0; i < IOSTAT_NBUCKETS; i++) {
+		a->is_hist[i] -= b->is_hist[i];
+	}
+}
+
+/*
+ * Print the counts in IS; with ELAPSED (nanoseconds) not 0, how busy
+ * the device was over that time too.
+ */
+static
+void
+show(const struct iostatinfo *is, unsigned long long elapsed)
+{
+	unsigned n, b;
+
+	n = is->is_reads + is->is_writes + is->is_others;
+	printf("%-8s %8u %8u %8u %10llu %10llu %6u %4u %8llu %8llu",
+	       is->is_name, is->is_reads, is->is_writes, is->is_others,
+	       is->is_rbytes / 1024, is->is_wbytes / 1024, is->is_errors,
+	       is->is_maxinflight,
+	       n ? is->is_totalns / n / 1000 : 0ULL,
+	       is->is_busyns / 1000000);
+	if (elapsed > 0) {
+		printf(" %4llu%%", is->is_busyns * 100 / elapsed);
+	}
+	printf("\n");
+	if (n == 0) {
+		return;
+	}
+	printf("        ");
+	for (b = 0; b < IOSTAT_NBUCKETS; b++) {
+		if (is->is_hist[b] != 0) {
+			printf(" %s2^%u:%u", b == 0 ? "<" : "",
+			       b + IOSTAT_MINSHIFT + (b == 0), is->is_hist[b]);
+		}
+	}
+	printf("\n");
+}
+
+static
+void
+header(int busy)
+{
+	printf("%-8s %8s %8s %8s %10s %10s %6s %4s %8s %8s%s\n", "device",
+	       "reads", "writes", "other", "KB read", "KB written", "errors",
+	       "max", "mean us", "busy ms", busy ? "  busy" : "");
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned n, i;
+	off_t start, elapsed;
+	pid_t pid;
+	int status;
+
+	if (argc < 2) {
+		n = snapshot(after);
+		header(0);
+		for (i = 0; i < n; i++) {
+			show(&after[i], 0);
+		}
+		return 0;
+	}
+
+	snapshot(before);
+	start = clock_monotonic();
+	pid = spawn(argv[1], argv + 1);
+	if (pid < 0) {
+		err(1, "%s", argv[1]);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	elapsed = clock_monotonic() - start;
+	n = snapshot(after);
+
+	printf("%s: %llu ms\n", argv[1], (unsigned long long)elapsed / 1000000);
+	header(1);
+	for (i = 0; i < n; i++) {
+		/* A device that turned up meanwhile started at zero. */
+		if (i < before[0].is_ndevs) {
+			subtract(&after[i], &before[i]);
+		}
+		show(&after[i], elapsed > 0 ? (unsigned long long)elapsed : 1);
+	}
+	return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * ktrace - control and read the kernel's event trace.
+ * Usage: ktrace on | off | dump
+ *
+ * dump prints, in order for each cpu, the records it has made since
+ * they were last read, noting where some were lost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define BATCH 64
+
+static const char *const typenames[] = {
+	"?", "switch", "syscall", "sysret", "fault", "diskio", "lockwait",
+};
+
+static
+void
+dump(void)
+{
+	struct ktrace_rec recs[BATCH];
+	unsigned cpu, i;
+	unsigned next;
+	int n, started;
+
+	for (cpu = 0; ; cpu++) {
+		started = 0;
+		next = 0;
+		while ((n = ktrace(KTRACE_READ, cpu, recs, BATCH)) > 0) {
+			for (i = 0; i < (unsigned)n; i++) {
+				if (started && recs[i].kr_seq != next) {
+					printf("cpu%u: %u lost\n", cpu,
+					       recs[i].kr_seq - next);
+				}
+				started = 1;
+				next = recs[i].kr_seq + 1;
+				printf("cpu%u %8u %10u %-8s 0x%08x 0x%08x\n",
+				       cpu, recs[i].kr_seq, recs[i].kr_time,
+				       recs[i].kr_type < sizeof(typenames) /
+				       sizeof(typenames[0]) ?
+				       typenames[recs[i].kr_type] : "?",
+				       recs[i].kr_a, recs[i].kr_b);
+			}
+		}
+		if (n < 0) {
+			if (errno == EINVAL && cpu > 0) {
+				/* ran out of cpus */
+				return;
+			}
+			err(1, "ktrace");
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		errx(1, "Usage: ktrace on | off | dump");
+	}
+	if (!strcmp(argv[1], "on")) {
+		if (ktrace(KTRACE_ON, 0, NULL, 0) < 0) {
+			err(1, "ktrace");
+		}
+	}
+	else if (!strcmp(argv[1], "off")) {
+		if (ktrace(KTRACE_OFF, 0, NULL, 0) < 0) {
+			err(1, "ktrace");
+		}
+	}
+	else if (!strcmp(argv[1], "dump")) {
+		dump();
+	}
+	else {
+		errx(1, "Usage: ktrace on | off | dump");
+	}
+	return 0;
+}
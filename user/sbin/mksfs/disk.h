@@ -35,4 +35,8 @@ uint32_t diskblocks(void);
 void diskwrite(const void *data, uint32_t block);
 void diskread(void *data, uint32_t block);
 
+/* N consecutive blocks at once */
+void diskwriten(const void *data, uint32_t block, uint32_t n);
+void diskreadn(void *data, uint32_t block, uint32_t n);
+
 void closedisk(void);
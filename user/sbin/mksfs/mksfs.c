@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
@@ -55,7 +56,22 @@
 
 #include "disk.h"
 
-#define MAXBITBLOCKS 32
+/*
+ * The journal goes right after the bitmap. It needs room for a commit
+ * of every buffer in the kernel's cache plus every bitmap block; this
+ * is that with plenty to spare. Volumes too small to give it up to a
+ * quarter of their space go without.
+ */
+#define JOURNALBLOCKS(bitblocks) (256 + 2*(bitblocks))
+
+static
+uint32_t
+journalblocks(uint32_t fsblocks)
+{
+	uint32_t jblocks = JOURNALBLOCKS(SFS_BITBLOCKS(fsblocks));
+
+	return fsblocks >= 4*jblocks ? jblocks : 0;
+}
 
 static
 void
@@ -80,7 +96,10 @@ writesuper(const char *volname, uint32_t nblocks)
 
 	sp.sp_magic = SWAPL(SFS_MAGIC);
 	sp.sp_nblocks = SWAPL(nblocks);
+	sp.sp_version = SWAPL(SFS_VERSION);
 	strcpy(sp.sp_volname, volname);
+	sp.sp_jstart = SWAPL(SFS_MAP_LOCATION + SFS_BITBLOCKS(nblocks));
+	sp.sp_jblocks = SWAPL(journalblocks(nblocks));
 
 	diskwrite(&sp, SFS_SB_LOCATION);
 }
@@ -100,7 +119,33 @@ writerootdir(void)
 	diskwrite(&sfi, SFS_ROOT_LOCATION);
 }
 
-static char bitbuf[MAXBITBLOCKS*SFS_BLOCKSIZE];
+/*
+ * Write an empty journal: a header with nothing in it.
+ */
+static
+void
+writejournal(uint32_t fsblocks)
+{
+	union {
+		struct sfs_jheader jh;
+		char block[SFS_BLOCKSIZE];
+	} u;
+
+	if (journalblocks(fsblocks) == 0) {
+		return;
+	}
+
+	bzero((void *)&u, sizeof(u));
+	u.jh.jh_magic = SWAPL(SFS_JMAGIC);
+	u.jh.jh_seq = SWAPL(0);
+	u.jh.jh_nblocks = SWAPL(0);
+	u.jh.jh_checksum = SWAPL(0);
+
+	diskwrite(&u, SFS_MAP_LOCATION + SFS_BITBLOCKS(fsblocks));
+}
+
+/* The whole freemap, sized for the volume in writebitmap */
+static char *bitbuf;
 
 static
 void
@@ -120,27 +165,30 @@ writebitmap(uint32_t fsblocks)
 
 	uint32_t nbits = SFS_BITMAPSIZE(fsblocks);
 	uint32_t nblocks = SFS_BITBLOCKS(fsblocks);
-	char *ptr;
+	uint32_t jblocks = journalblocks(fsblocks);
 	uint32_t i;
 
-	if (nblocks > MAXBITBLOCKS) {
-		errx(1, "Filesystem too large "
-		     "- increase MAXBITBLOCKS and recompile");
+	bitbuf = malloc(nblocks * SFS_BLOCKSIZE);
+	if (bitbuf == NULL) {
+		errx(1, "Out of memory for %u bitmap blocks", nblocks);
 	}
+	bzero(bitbuf, nblocks * SFS_BLOCKSIZE);
 
 	doallocbit(SFS_SB_LOCATION);
 	doallocbit(SFS_ROOT_LOCATION);
 	for (i=0; i<nblocks; i++) {
 		doallocbit(SFS_MAP_LOCATION+i);
 	}
+	for (i=0; i<jblocks; i++) {
+		doallocbit(SFS_MAP_LOCATION+nblocks+i);
+	}
 	for (i=fsblocks; i<nbits; i++) {
 		doallocbit(i);
 	}
 
-	for (i=0; i<nblocks; i++) {
-		ptr = bitbuf + i*SFS_BLOCKSIZE;
-		diskwrite(ptr, SFS_MAP_LOCATION+i);
-	}
+	/* it is contiguous on disk: write it all at once */
+	diskwriten(bitbuf, SFS_MAP_LOCATION, nblocks);
+	free(bitbuf);
 }
 
 int
@@ -188,6 +236,7 @@ main(int argc, char **argv)
 	writesuper(volname, size);
 	writerootdir();
 	writebitmap(size);
+	writejournal(size);
 
 	closedisk();
 
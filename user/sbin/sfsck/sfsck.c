@@ -66,6 +66,10 @@
 
 static int badness=0;
 
+/* -p: report progress on large volumes */
+static int showprogress=0;
+#define PROGRESS_EVERY 1024
+
 static
 void
 setbadness(int code)
@@ -83,6 +87,9 @@ swapsb(struct sfs_super *sp)
 {
 	sp->sp_magic = SWAPL(sp->sp_magic);
 	sp->sp_nblocks = SWAPL(sp->sp_nblocks);
+	sp->sp_version = SWAPL(sp->sp_version);
+	sp->sp_jstart = SWAPL(sp->sp_jstart);
+	sp->sp_jblocks = SWAPL(sp->sp_jblocks);
 }
 
 static
@@ -94,7 +101,13 @@ swapinode(struct sfs_inode *sfi)
 	sfi->sfi_size = SWAPL(sfi->sfi_size);
 	sfi->sfi_type = SWAPS(sfi->sfi_type);
 	sfi->sfi_linkcount = SWAPS(sfi->sfi_linkcount);
+	sfi->sfi_flags = SWAPL(sfi->sfi_flags);
 
+	/*
+	 * For an inode with SFS_INODE_INLINE these words are file data,
+	 * not block numbers; swapping them is harmless, as swapping back
+	 * before writing restores them.
+	 */
 	for (i=0; i<SFS_NDIRECT; i++) {
 		sfi->sfi_direct[i] = SWAPL(sfi->sfi_direct[i]);
 	}
@@ -172,6 +185,7 @@ domalloc(size_t len)
 typedef enum {
 	B_SUPERBLOCK,	/* Block that is the superblock */
 	B_BITBLOCK,	/* Block used by free-block bitmap */
+	B_JOURNAL,	/* Block of the journal */
 	B_INODE,	/* Block that is an inode */
 	B_IBLOCK,	/* Indirect (or doubly-indirect etc.) block */
 	B_DIRDATA,	/* Data block of a directory */
@@ -210,6 +224,7 @@ blockusagestr(blockusage_t how, uint32_t howdesc)
 	switch (how) {
 	    case B_SUPERBLOCK: return "superblock";
 	    case B_BITBLOCK: return "bitmap block";
+	    case B_JOURNAL: return "journal block";
 	    case B_INODE: return "inode";
 	    case B_IBLOCK: 
 		snprintf(rv, sizeof(rv), "indirect block of inode %lu", 
@@ -303,12 +318,16 @@ static
 void
 check_bitmap(void)
 {
-	uint8_t bits[SFS_BLOCKSIZE], *found, *tofree, tmp;
+	uint8_t *map, *bits, *found, *tofree, tmp;
 	uint32_t alloccount=0, freecount=0, i, j;
 	int bchanged;
 
+	/* it is contiguous on disk: read it all at once */
+	map = domalloc(bitblocks * SFS_BLOCKSIZE);
+	diskreadn(map, SFS_MAP_LOCATION, bitblocks);
+
 	for (i=0; i<bitblocks; i++) {
-		diskread(bits, SFS_MAP_LOCATION+i);
+		bits = map + i*SFS_BLOCKSIZE;
 		swapbits(bits);
 		found = bitmapdata + i*SFS_BLOCKSIZE;
 		tofree = tofreedata + i*SFS_BLOCKSIZE;
@@ -358,6 +377,7 @@ check_bitmap(void)
 			diskwrite(bits, SFS_MAP_LOCATION+i);
 		}
 	}
+	free(map);
 
 	if (alloccount > 0) {
 		warnx("%lu blocks erroneously shown free in bitmap (fixed)",
@@ -373,38 +393,92 @@ check_bitmap(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * What we remember about each inode reached, so that nothing is read
+ * twice: a directory seen again is a crosslink, a file seen again is
+ * another link to it and needs neither reading nor checking again,
+ * and the link counts found are compared at the end against the ones
+ * read the first time, with no pass back over the inodes. Kept in an
+ * array, found by a hash of the inode number.
+ */
 struct inodememory {
 	uint32_t ino;
 	uint32_t linkcount;	/* files only; 0 for dirs */
+	uint32_t disklinks;	/* sfi_linkcount on disk, files only */
+	int next;		/* next in hash chain, or -1 */
 };
 
+#define INOHASHSIZE 4096
+
 static struct inodememory *inodes = NULL;
 static int ninodes=0, maxinodes=0;
+static int inohash[INOHASHSIZE];
+
+static
+void
+inohash_init(void)
+{
+	int i;
+
+	for (i=0; i<INOHASHSIZE; i++) {
+		inohash[i] = -1;
+	}
+}
+
+static
+struct inodememory *
+findmemory(uint32_t ino)
+{
+	int i;
+
+	for (i = inohash[ino % INOHASHSIZE]; i >= 0; i = inodes[i].next) {
+		if (inodes[i].ino==ino) {
+			return &inodes[i];
+		}
+	}
+	return NULL;
+}
 
 static
 void
-addmemory(uint32_t ino, uint32_t linkcount)
+addmemory(uint32_t ino, uint32_t linkcount, uint32_t disklinks)
 {
 	assert(ninodes <= maxinodes);
 	if (ninodes == maxinodes) {
-#ifdef NO_REALLOC
 		int newmax = (maxinodes+1)*2;
+#ifdef NO_REALLOC
 		void *p = domalloc(newmax * sizeof(struct inodememory));
 		if (inodes) {
-			memcpy(p, inodes, ninodes);
+			memcpy(p, inodes, ninodes * sizeof(struct inodememory));
 			free(inodes);
 		}
 		inodes = p;
 #else
-		maxinodes = (maxinodes+1)*2;
-		inodes = realloc(inodes, maxinodes * sizeof(uint32_t));
+		inodes = realloc(inodes, newmax * sizeof(struct inodememory));
 		if (inodes==NULL) {
 			errx(EXIT_FATAL, "Out of memory");
 		}
 #endif
+		maxinodes = newmax;
 	}
 	inodes[ninodes].ino = ino;
 	inodes[ninodes].linkcount = linkcount;
+	inodes[ninodes].disklinks = disklinks;
+	inodes[ninodes].next = inohash[ino % INOHASHSIZE];
+	inohash[ino % INOHASHSIZE] = ninodes;
+	ninodes++;
+}
+
+/*
+ * Say how far the scan has got, every PROGRESS_EVERY inodes, if asked.
+ */
+static
+void
+progress(void)
+{
+	if (showprogress && ninodes % PROGRESS_EVERY == 0) {
+		warnx("%d inodes checked", ninodes);
+	}
 }
 
 /* returns nonzero if directory already remembered */
@@ -412,39 +486,55 @@ static
 int
 remember_dir(uint32_t ino, const char *pathsofar)
 {
-	int i;
+	struct inodememory *im;
 
 	/* don't use this for now */
 	(void)pathsofar;
 
-	for (i=0; i<ninodes; i++) {
-		if (inodes[i].ino==ino) {
-			assert(inodes[i].linkcount==0);
-			return 1;
-		}
+	im = findmemory(ino);
+	if (im != NULL) {
+		assert(im->linkcount==0);
+		return 1;
 	}
 
-	addmemory(ino, 0);
+	addmemory(ino, 0, 0);
 
 	return 0;
 }
 
+/*
+ * Count a link to file INO, whose inode, SFI, the caller has checked.
+ */
 static
 void
-observe_filelink(uint32_t ino)
+observe_filelink(uint32_t ino, const struct sfs_inode *sfi)
 {
-	int i;
-	for (i=0; i<ninodes; i++) {
-		if (inodes[i].ino==ino) {
-			assert(inodes[i].linkcount>0);
-			inodes[i].linkcount++;
-			return;
-		}
-	}
+	assert(findmemory(ino) == NULL);
 	bitmap_mark(ino, B_INODE, ino);
-	addmemory(ino, 1);
+	addmemory(ino, 1, sfi->sfi_linkcount);
 }
 
+/*
+ * If INO is a file already seen, count another link to it and return
+ * nonzero; the caller need not look at it again.
+ */
+static
+int
+observe_filerelink(uint32_t ino)
+{
+	struct inodememory *im;
+
+	im = findmemory(ino);
+	if (im == NULL || im->linkcount == 0) {
+		return 0;
+	}
+	im->linkcount++;
+	return 1;
+}
+
+/*
+ * Fix the link counts that are wrong. Only those inodes are read.
+ */
 static
 void
 adjust_filelinks(void)
@@ -457,20 +547,21 @@ adjust_filelinks(void)
 			/* directory */
 			continue;
 		}
+		count_files++;
+		if (inodes[i].disklinks == inodes[i].linkcount) {
+			continue;
+		}
 		diskread(&sfi, inodes[i].ino);
 		swapinode(&sfi);
 		assert(sfi.sfi_type == SFS_TYPE_FILE);
-		if (sfi.sfi_linkcount != inodes[i].linkcount) {
-			warnx("File %lu link count %lu should be %lu (fixed)",
-			      (unsigned long) inodes[i].ino,
-			      (unsigned long) sfi.sfi_linkcount,
-			      (unsigned long) inodes[i].linkcount);
-			sfi.sfi_linkcount = inodes[i].linkcount;
-			setbadness(EXIT_RECOV);
-			swapinode(&sfi);
-			diskwrite(&sfi, inodes[i].ino);
-		}
-		count_files++;
+		warnx("File %lu link count %lu should be %lu (fixed)",
+		      (unsigned long) inodes[i].ino,
+		      (unsigned long) sfi.sfi_linkcount,
+		      (unsigned long) inodes[i].linkcount);
+		sfi.sfi_linkcount = inodes[i].linkcount;
+		setbadness(EXIT_RECOV);
+		swapinode(&sfi);
+		diskwrite(&sfi, inodes[i].ino);
 	}
 }
 
@@ -508,6 +599,98 @@ checkbadstring(char *buf)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Add N words at WORDS, in disk order, to SUM as the journal checksum
+ * in kern/sfs.h does.
+ */
+static
+uint32_t
+journal_sum(uint32_t sum, const uint32_t *words, uint32_t n)
+{
+	uint32_t i;
+
+	for (i=0; i<n; i++) {
+		sum = ((sum << 1) | (sum >> 31)) + SWAPL(words[i]);
+	}
+	return sum;
+}
+
+/*
+ * Replay the record in the journal, if there is a whole one, as the
+ * kernel would at mount, so that what gets checked is what would be
+ * mounted; then leave the journal empty, so that a replay after the
+ * check cannot undo its fixes.
+ */
+static
+void
+check_journal(uint32_t jstart, uint32_t jblocks)
+{
+	struct sfs_jheader *jh;
+	uint32_t *list, hdrblocks, n, i, sum;
+	uint32_t block[SFS_BLOCKSIZE / sizeof(uint32_t)];
+	int whole;
+
+	jh = domalloc(SFS_JHDRBLOCKS(jblocks) * SFS_BLOCKSIZE);
+	list = (uint32_t *)(jh + 1);
+	diskread(jh, jstart);
+
+	if (SWAPL(jh->jh_magic) != SFS_JMAGIC) {
+		warnx("Journal header is bad (fixed)");
+		setbadness(EXIT_RECOV);
+		jh->jh_seq = SWAPL(0);
+		goto clear;
+	}
+	n = SWAPL(jh->jh_nblocks);
+	if (n == 0) {
+		free(jh);
+		return;
+	}
+
+	hdrblocks = SFS_JHDRBLOCKS(n);
+	whole = n < jblocks && hdrblocks + n <= jblocks;
+	for (i=1; whole && i<hdrblocks; i++) {
+		diskread((char *)jh + i*SFS_BLOCKSIZE, jstart + i);
+	}
+	for (i=0; whole && i<n; i++) {
+		uint32_t b = SWAPL(list[i]);
+		if (b == SFS_SB_LOCATION || b >= nblocks ||
+		    (b >= jstart && b < jstart + jblocks)) {
+			whole = 0;
+		}
+	}
+	if (whole) {
+		sum = journal_sum(0, &jh->jh_seq, 2);
+		sum = journal_sum(sum, list, n);
+		for (i=0; i<n; i++) {
+			diskread(block, jstart + hdrblocks + i);
+			sum = journal_sum(sum, block,
+					  SFS_BLOCKSIZE / sizeof(uint32_t));
+		}
+		whole = sum == SWAPL(jh->jh_checksum);
+	}
+
+	if (whole) {
+		for (i=0; i<n; i++) {
+			diskread(block, jstart + hdrblocks + i);
+			diskwrite(block, SWAPL(list[i]));
+		}
+		warnx("Replayed %lu blocks from the journal",
+		      (unsigned long) n);
+	}
+	else {
+		warnx("Incomplete journal record discarded");
+	}
+	setbadness(EXIT_RECOV);
+
+ clear:
+	jh->jh_magic = SWAPL(SFS_JMAGIC);
+	jh->jh_nblocks = SWAPL(0);
+	jh->jh_checksum = SWAPL(0);
+	memset(list, 0, SFS_BLOCKSIZE - sizeof(*jh));
+	diskwrite(jh, jstart);
+	free(jh);
+}
+
 static
 void
 check_sb(void)
@@ -521,6 +704,10 @@ check_sb(void)
 	if (sp.sp_magic != SFS_MAGIC) {
 		errx(EXIT_UNRECOV, "Not an sfs filesystem");
 	}
+	if (sp.sp_version > SFS_VERSION) {
+		errx(EXIT_UNRECOV, "Filesystem version %u is newer than %u",
+		     sp.sp_version, SFS_VERSION);
+	}
 
 	assert(nblocks==0);
 	assert(bitblocks==0);
@@ -554,6 +741,23 @@ check_sb(void)
 	for (i=0; i<bitblocks; i++) {
 		bitmap_mark(SFS_MAP_LOCATION+i, B_BITBLOCK, i);
 	}
+
+	if (sp.sp_version < 2 || sp.sp_jblocks == 0) {
+		return;
+	}
+	if (sp.sp_jstart < SFS_MAP_LOCATION + bitblocks ||
+	    sp.sp_jblocks < 2 || sp.sp_jblocks > nblocks ||
+	    sp.sp_jstart > nblocks - sp.sp_jblocks) {
+		warnx("Journal at %lu (%lu blocks) is out of place "
+		      "(NOT FIXED)", (unsigned long) sp.sp_jstart,
+		      (unsigned long) sp.sp_jblocks);
+		setbadness(EXIT_UNRECOV);
+		return;
+	}
+	check_journal(sp.sp_jstart, sp.sp_jblocks);
+	for (i=0; i<sp.sp_jblocks; i++) {
+		bitmap_mark(sp.sp_jstart+i, B_JOURNAL, i);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -640,6 +844,29 @@ check_inode_blocks(uint32_t ino, struct sfs_inode *sfi, int isdir)
 
 	badcount = 0;
 
+	if (sfi->sfi_flags & SFS_INODE_INLINE) {
+		if (isdir) {
+			/* the kernel never does this; the data is lost */
+			warnx("Directory inode %lu: inline data (discarded)",
+			      (unsigned long) ino);
+			memset(SFS_INLINEDATA(sfi), 0, SFS_INLINESIZE);
+			sfi->sfi_flags &= ~SFS_INODE_INLINE;
+			sfi->sfi_size = 0;
+			setbadness(EXIT_RECOV);
+			return 1;
+		}
+		if (sfi->sfi_size > SFS_INLINESIZE) {
+			warnx("Inode %lu: inline size %lu too large "
+			      "(truncated)", (unsigned long) ino,
+			      (unsigned long) sfi->sfi_size);
+			sfi->sfi_size = SFS_INLINESIZE;
+			setbadness(EXIT_RECOV);
+			return 1;
+		}
+		/* no blocks to account for */
+		return 0;
+	}
+
 	size = SFS_ROUNDUP(sfi->sfi_size, SFS_BLOCKSIZE);
 	nblocks = size/SFS_BLOCKSIZE;
 
@@ -986,6 +1213,7 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 
 	bitmap_mark(ino, B_INODE, ino);
 	count_dirs++;
+	progress();
 
 	if (sfi.sfi_size % sizeof(struct sfs_dir) != 0) {
 		setbadness(EXIT_RECOV);
@@ -1142,6 +1370,11 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 			char path[strlen(pathsofar)+SFS_NAMELEN+1];
 			struct sfs_inode subsfi;
 
+			if (observe_filerelink(direntries[i].sfd_ino)) {
+				/* another link to a file already checked */
+				continue;
+			}
+
 			diskread(&subsfi, direntries[i].sfd_ino);
 			swapinode(&subsfi);
 			snprintf(path, sizeof(path), "%s/%s", 
@@ -1155,7 +1388,9 @@ check_dir(uint32_t ino, uint32_t parentino, const char *pathsofar)
 					diskwrite(&subsfi, 
 						  direntries[i].sfd_ino);
 				}
-				observe_filelink(direntries[i].sfd_ino);
+				observe_filelink(direntries[i].sfd_ino,
+						 &subsfi);
+				progress();
 				break;
 			    case SFS_TYPE_DIR:
 				if (check_dir(direntries[i].sfd_ino,
@@ -1247,8 +1482,13 @@ main(int argc, char **argv)
 	hostcompat_init(argc, argv);
 #endif
 
+	if (argc==3 && !strcmp(argv[1], "-p")) {
+		showprogress = 1;
+		argc--;
+		argv++;
+	}
 	if (argc!=2) {
-		errx(EXIT_USAGE, "Usage: sfsck device/diskfile");
+		errx(EXIT_USAGE, "Usage: sfsck [-p] device/diskfile");
 	}
 
 	assert(sizeof(struct sfs_super)==SFS_BLOCKSIZE);
@@ -1256,9 +1496,19 @@ main(int argc, char **argv)
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_dir) == 0);
 
 	opendisk(argv[1]);
+	inohash_init();
 
+	if (showprogress) {
+		warnx("Checking superblock");
+	}
 	check_sb();
+	if (showprogress) {
+		warnx("Checking directories and files");
+	}
 	check_root_dir();
+	if (showprogress) {
+		warnx("Checking freemap (%d inodes)", ninodes);
+	}
 	check_bitmap();
 	adjust_filelinks();
 
@@ -34,6 +34,12 @@
  * because of various limitations of OS/161 it is massively
  * inefficient. But that's ok; the goal is to stress the VM and buffer
  * cache.
+ *
+ * With -t, it instead sorts in memory with threads, to measure how
+ * the scheduler and VM let computation scale: the keys are sorted by
+ * merge sort, whose halves are tasks that idle threads steal from
+ * the busy ones, with 1, 2, ... up to the -t number of threads (by
+ * default one per cpu), and the rate is reported for each.
  */
 
 #include <sys/types.h>
@@ -66,6 +72,7 @@ static int workspace[WORKNUM];
 static const char *progname;
 
 static int numprocs = 4;
+static int numthreads = -1;	/* -1: not threaded; 0: one per cpu */
 static int numkeys = 10000;
 static long randomseed = 15432753;
 
@@ -1040,6 +1047,304 @@ validate(void)
 	}
 }
 
+////////////////////////////////////////////////////////////
+// threaded mode
+
+#ifndef HOST
+
+/*
+ * Ranges of up to TCUTOFF keys are sorted with sortints; larger ones
+ * are split in two, the second half offered to other threads as a
+ * task, and the halves merged when both are done.
+ */
+#define TCUTOFF      4096
+#define TMAXTHREADS  32
+#define TDEPTH       64
+
+struct ttask {
+	int tt_lo, tt_hi;
+	volatile int tt_done;
+};
+
+/*
+ * Each thread's tasks not yet started, oldest first. The thread
+ * itself adds and takes at the end; others steal from the front.
+ */
+struct tdeque {
+	volatile int td_lock;
+	volatile unsigned td_head, td_tail;
+	struct ttask *td_tasks[TDEPTH];
+};
+
+static int *tkeys, *ttmp;
+static struct tdeque tdeques[TMAXTHREADS];
+static int tcount;
+static volatile int tfinished;
+
+static
+int
+tpush(int self, struct ttask *tt)
+{
+	struct tdeque *td = &tdeques[self];
+	int ok;
+
+	__futex_lock(&td->td_lock);
+	ok = td->td_tail < TDEPTH;
+	if (ok) {
+		td->td_tasks[td->td_tail++] = tt;
+	}
+	__futex_unlock(&td->td_lock);
+	return ok;
+}
+
+/*
+ * Take back TT, if nobody has stolen it.
+ */
+static
+int
+tpop(int self, struct ttask *tt)
+{
+	struct tdeque *td = &tdeques[self];
+	int ok;
+
+	__futex_lock(&td->td_lock);
+	ok = td->td_tail > td->td_head && td->td_tasks[td->td_tail-1] == tt;
+	if (ok) {
+		td->td_tail--;
+		if (td->td_tail == td->td_head) {
+			td->td_head = td->td_tail = 0;
+		}
+	}
+	__futex_unlock(&td->td_lock);
+	return ok;
+}
+
+/*
+ * Steal the oldest task of some other thread, looking at each in turn.
+ */
+static
+struct ttask *
+tsteal(int self)
+{
+	struct tdeque *td;
+	struct ttask *tt;
+	int i;
+
+	for (i=1; i<tcount; i++) {
+		td = &tdeques[(self + i) % tcount];
+		if (td->td_tail == td->td_head) {
+			/* (looked at unlocked, to keep off a busy lock) */
+			continue;
+		}
+		tt = NULL;
+		__futex_lock(&td->td_lock);
+		if (td->td_tail > td->td_head) {
+			tt = td->td_tasks[td->td_head++];
+			if (td->td_tail == td->td_head) {
+				td->td_head = td->td_tail = 0;
+			}
+		}
+		__futex_unlock(&td->td_lock);
+		if (tt != NULL) {
+			return tt;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+tmerge(int lo, int mid, int hi)
+{
+	int i, j, k;
+
+	i = lo;
+	j = mid;
+	for (k=lo; k<hi; k++) {
+		if (j >= hi || (i < mid && tkeys[i] <= tkeys[j])) {
+			ttmp[k] = tkeys[i++];
+		}
+		else {
+			ttmp[k] = tkeys[j++];
+		}
+	}
+	memcpy(&tkeys[lo], &ttmp[lo], (hi - lo) * sizeof(int));
+}
+
+static void tsortrange(int self, int lo, int hi);
+
+static
+void
+truntask(int self, struct ttask *tt)
+{
+	tsortrange(self, tt->tt_lo, tt->tt_hi);
+	tt->tt_done = 1;
+	futex_wake(&tt->tt_done, 1);
+}
+
+/*
+ * Sort keys LO to HI. If the second half is stolen, steal work
+ * from others while it is being done, and sleep if there is none.
+ */
+static
+void
+tsortrange(int self, int lo, int hi)
+{
+	struct ttask half, *tt;
+	int mid;
+
+	if (hi - lo <= TCUTOFF) {
+		sortints(&tkeys[lo], hi - lo);
+		return;
+	}
+
+	mid = lo + (hi - lo) / 2;
+	half.tt_lo = mid;
+	half.tt_hi = hi;
+	half.tt_done = 0;
+	if (!tpush(self, &half)) {
+		tsortrange(self, lo, mid);
+		tsortrange(self, mid, hi);
+		tmerge(lo, mid, hi);
+		return;
+	}
+
+	tsortrange(self, lo, mid);
+
+	if (tpop(self, &half)) {
+		tsortrange(self, mid, hi);
+	}
+	else {
+		while (!half.tt_done) {
+			tt = tsteal(self);
+			if (tt != NULL) {
+				truntask(self, tt);
+			}
+			else {
+				futex_wait(&half.tt_done, 0);
+			}
+		}
+	}
+	tmerge(lo, mid, hi);
+}
+
+static
+void *
+tworker(void *arg)
+{
+	int self = (int)arg;
+	struct ttask *tt;
+
+	while (!tfinished) {
+		tt = tsteal(self);
+		if (tt != NULL) {
+			truntask(self, tt);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Sort the keys with NTHREADS threads, check them, and return the
+ * nanoseconds the sort took.
+ */
+static
+off_t
+tsort(int nthreads)
+{
+	int tids[TMAXTHREADS];
+	unsigned long want, got;
+	off_t start, end;
+	int i, value;
+
+	srandom(randomseed);
+	want = 0;
+	for (i=0; i<numkeys; i++) {
+		value = random();
+		tkeys[i] = value;
+		want += value;
+	}
+
+	tcount = nthreads;
+	tfinished = 0;
+	for (i=1; i<nthreads; i++) {
+		tids[i] = thread_create(tworker, (void *)i);
+		if (tids[i] < 0) {
+			complain("thread_create");
+			exit(1);
+		}
+	}
+
+	start = clock_monotonic();
+	tsortrange(0, 0, numkeys);
+	end = clock_monotonic();
+
+	tfinished = 1;
+	for (i=1; i<nthreads; i++) {
+		if (thread_join(tids[i], NULL) < 0) {
+			complain("thread_join");
+			exit(1);
+		}
+	}
+
+	got = 0;
+	for (i=0; i<numkeys; i++) {
+		if (i > 0 && tkeys[i] < tkeys[i-1]) {
+			complainx("Threaded sort: key %d out of order", i);
+			exit(1);
+		}
+		got += tkeys[i];
+	}
+	if (got != want) {
+		complainx("Threaded sort: keys changed");
+		exit(1);
+	}
+	return end - start;
+}
+
+static
+void
+threaded(void)
+{
+	struct schedstat ss;
+	off_t ns;
+	int n;
+
+	if (numthreads == 0) {
+		if (getschedstat(0, &ss) < 0) {
+			complain("getschedstat");
+			exit(1);
+		}
+		numthreads = ss.ss_ncpus;
+	}
+	if (numthreads < 1 || numthreads > TMAXTHREADS) {
+		complainx("Between 1 and %d threads, please", TMAXTHREADS);
+		exit(1);
+	}
+
+	tkeys = malloc(numkeys * sizeof(int));
+	ttmp = malloc(numkeys * sizeof(int));
+	if (tkeys == NULL || ttmp == NULL) {
+		complainx("Out of memory for %d keys", numkeys);
+		exit(1);
+	}
+
+	for (n=1; n<=numthreads; n++) {
+		ns = tsort(n);
+		if (ns < 1) {
+			ns = 1;
+		}
+		complainx("%d threads: %d keys in %llu us, %llu keys/sec",
+			  n, numkeys, (unsigned long long)(ns / 1000),
+			  (unsigned long long)numkeys * 1000000000ULL / ns);
+	}
+
+	free(tkeys);
+	free(ttmp);
+}
+
+#endif /* HOST */
+
 ////////////////////////////////////////////////////////////
 
 static
@@ -1085,7 +1390,8 @@ static
 void
 usage(void)
 {
-	complain("Usage: %s [-p procs] [-k keys] [-s seed] [-r]", progname);
+	complain("Usage: %s [-p procs] [-k keys] [-s seed] [-r] [-t threads]",
+		 progname);
 	exit(1);
 }
 
@@ -1106,6 +1412,7 @@ doargs(int argc, char *argv[])
 		    case 'k': arg = 1; break;
 		    case 's': arg = 1; break;
 		    case 'r': arg = 0; break;
+		    case 't': arg = 1; break;
 		    default: usage(); return;
 		}
 		if (arg) {
@@ -1123,6 +1430,7 @@ doargs(int argc, char *argv[])
 			}
 			switch (ch) {
 			    case 'p': numprocs = val; break;
+			    case 't': numthreads = val; break;
 			    case 'k': numkeys = val; break;
 			    case 's': randomseed = val; break;
 			    default: assert(0); break;
@@ -1145,6 +1453,17 @@ main(int argc, char *argv[])
 	doargs(argc, argv);
 	correctsize = (off_t) (numkeys*sizeof(int));
 
+	if (numthreads >= 0) {
+#ifndef HOST
+		threaded();
+		complainx("Succeeded.");
+		return 0;
+#else
+		complainx("No threaded mode on the host");
+		exit(1);
+#endif
+	}
+
 	setdir();
 
 	genkeys();
@@ -0,0 +1,133 @@
+/*
+ * aiotest.c
+ *
+ *	Exercises aio_setup and aio_enter: a batch of writes and then
+ *	reads of a file, all in flight at once, completing with the right
+ *	tags and byte counts, and a bad request failing on its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define FileName "AIOTEST"
+#define NREQ 16
+#define BLOCK 512
+
+static struct aio_rings rings;
+static char bufs[NREQ][BLOCK];
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+static
+void
+submit(int op, int fd, void *buf, size_t len, off_t offset, unsigned tag)
+{
+	struct aio_sqe *sqe;
+
+	sqe = &rings.ar_sq[rings.ar_sqtail % AIO_RINGSIZE];
+	sqe->sqe_op = op;
+	sqe->sqe_fd = fd;
+	sqe->sqe_buf = buf;
+	sqe->sqe_len = len;
+	sqe->sqe_offset = offset;
+	sqe->sqe_tag = tag;
+	rings.ar_sqtail++;
+}
+
+/*
+ * Submit what is queued and collect N completions, checking each has
+ * a distinct tag below N and a result of WANT.
+ */
+static
+void
+run(unsigned n, int want)
+{
+	struct aio_cqe *cqe;
+	unsigned seen[NREQ];
+	unsigned i;
+
+	memset(seen, 0, sizeof(seen));
+	if (aio_enter(n) != (int)n) {
+		fail("aio_enter did not take everything");
+	}
+	for (i = 0; i < n; i++) {
+		while (rings.ar_cqhead == rings.ar_cqtail) {
+			if (aio_enter(1) < 0) {
+				fail("aio_enter while waiting");
+			}
+		}
+		cqe = &rings.ar_cq[rings.ar_cqhead % AIO_RINGSIZE];
+		if (cqe->cqe_tag >= n || seen[cqe->cqe_tag]) {
+			fail("bad or repeated completion tag");
+		}
+		if (cqe->cqe_result != want) {
+			printf("tag %u: result %d, wanted %d\n",
+			       cqe->cqe_tag, cqe->cqe_result, want);
+			fail("wrong completion result");
+		}
+		seen[cqe->cqe_tag] = 1;
+		rings.ar_cqhead++;
+	}
+}
+
+int
+main()
+{
+	unsigned i;
+	int fd;
+
+	fd = open(FileName, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("open");
+	}
+	if (aio_setup(&rings) < 0) {
+		fail("aio_setup");
+	}
+	if (aio_setup(&rings) >= 0 || errno != EBUSY) {
+		fail("second aio_setup did not fail with EBUSY");
+	}
+
+	/* each block is filled with its own number */
+	for (i = 0; i < NREQ; i++) {
+		memset(bufs[i], 'A' + i, BLOCK);
+		submit(AIO_WRITE, fd, bufs[i], BLOCK, i * BLOCK, i);
+	}
+	run(NREQ, BLOCK);
+
+	memset(bufs, 0, sizeof(bufs));
+	for (i = 0; i < NREQ; i++) {
+		submit(AIO_READ, fd, bufs[NREQ - 1 - i], BLOCK, i * BLOCK, i);
+	}
+	run(NREQ, BLOCK);
+	for (i = 0; i < NREQ; i++) {
+		if (bufs[NREQ - 1 - i][0] != 'A' + (int)i ||
+		    bufs[NREQ - 1 - i][BLOCK - 1] != 'A' + (int)i) {
+			fail("read back the wrong data");
+		}
+	}
+
+	/* a bad op and a bad descriptor each fail alone */
+	submit(AIO_READ + AIO_WRITE, fd, bufs[0], BLOCK, 0, 0);
+	run(1, -EINVAL);
+	submit(AIO_READ, -1, bufs[0], BLOCK, 0, 0);
+	run(1, -EBADF);
+
+	/* nothing in flight: does not wait */
+	if (aio_enter(1) != 0) {
+		fail("aio_enter with nothing submitted");
+	}
+
+	close(fd);
+	printf("Passed aiotest test.\n");
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * batchtest.c
+ *
+ *	Exercises syscall_batch: a batch of getpids gets the right
+ *	answers and is counted as the calls it made; writes, an lseek
+ *	(which returns 64 bits) and a pread (which takes an argument
+ *	from the stack) work in a batch; calls that cannot be batched
+ *	fail on their own while the rest go ahead, unless the batch is
+ *	to stop at the first failure; and bad batches are refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <kern/syscall.h>
+
+#define NGetpid	32
+#define Untouched	12345
+
+static struct syscall_rec recs[SYSCALLBATCH_MAX + 1];
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+static
+void
+setrec(struct syscall_rec *r, int callno, unsigned a0, unsigned a1,
+       unsigned a2, unsigned a3)
+{
+	memset(r, 0, sizeof(*r));
+	r->sr_callno = callno;
+	r->sr_err = Untouched;
+	r->sr_args[0] = a0;
+	r->sr_args[1] = a1;
+	r->sr_args[2] = a2;
+	r->sr_args[3] = a3;
+}
+
+static
+void
+testgetpid(void)
+{
+	struct syscallstat before, after;
+	pid_t me = getpid();
+	int i;
+
+	if (getsyscallstat(SYS_getpid, &before) != 0) {
+		fail("getsyscallstat");
+	}
+	for (i = 0; i < NGetpid; i++) {
+		setrec(&recs[i], SYS_getpid, 0, 0, 0, 0);
+	}
+	if (syscall_batch(recs, NGetpid, 0) != NGetpid) {
+		fail("syscall_batch of getpids");
+	}
+	for (i = 0; i < NGetpid; i++) {
+		if (recs[i].sr_err != 0 || recs[i].sr_retval != me) {
+			printf("Test failed! getpid %d: error %d, got %d\n",
+			       i, recs[i].sr_err, recs[i].sr_retval);
+			exit(1);
+		}
+	}
+	if (getsyscallstat(SYS_getpid, &after) != 0) {
+		fail("getsyscallstat");
+	}
+	if (after.ss_calls - before.ss_calls != NGetpid) {
+		printf("Test failed! %u getpids counted, wanted %u\n",
+		       after.ss_calls - before.ss_calls, NGetpid);
+		exit(1);
+	}
+	printf("stage [1] done\n");
+}
+
+static
+void
+testfile(void)
+{
+	char buf[32];
+	int fd;
+
+	fd = open("BATCHFILE", O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("open");
+	}
+	setrec(&recs[0], SYS_write, fd, (unsigned)"abcde", 5, 0);
+	setrec(&recs[1], SYS_write, fd, (unsigned)"fghij", 5, 0);
+	/* lseek(fd, (off_t)2, SEEK_SET): the offset in a2/a3 */
+	setrec(&recs[2], SYS_lseek, fd, 0, 0, 2);
+	recs[2].sr_args[4] = SEEK_SET;
+	setrec(&recs[3], SYS_read, fd, (unsigned)buf, 3, 0);
+	/* pread(fd, buf+3, 4, (off_t)6): the offset at sp+16 */
+	setrec(&recs[4], SYS_pread, fd, (unsigned)buf + 3, 4, 0);
+	recs[4].sr_args[4] = 0;
+	recs[4].sr_args[5] = 6;
+	if (syscall_batch(recs, 5, SYSCALLBATCH_STOP) != 5) {
+		fail("syscall_batch of file calls");
+	}
+	if (recs[0].sr_err || recs[0].sr_retval != 5 ||
+	    recs[1].sr_err || recs[1].sr_retval != 5) {
+		fail("batched write");
+	}
+	if (recs[2].sr_err || recs[2].sr_retval64 != 2) {
+		printf("Test failed! batched lseek: error %d, offset %d\n",
+		       recs[2].sr_err, (int)recs[2].sr_retval64);
+		exit(1);
+	}
+	if (recs[3].sr_err || recs[3].sr_retval != 3 ||
+	    recs[4].sr_err || recs[4].sr_retval != 4) {
+		fail("batched read and pread");
+	}
+	buf[7] = 0;
+	if (strcmp(buf, "cdeghij") != 0) {
+		printf("Test failed! read back %s\n", buf);
+		exit(1);
+	}
+	close(fd);
+	remove("BATCHFILE");
+	printf("stage [2] done\n");
+}
+
+static
+void
+testerrors(void)
+{
+	int i;
+
+	setrec(&recs[0], SYS_getpid, 0, 0, 0, 0);
+	setrec(&recs[1], 9999, 0, 0, 0, 0);
+	setrec(&recs[2], SYS_fork, 0, 0, 0, 0);
+	setrec(&recs[3], SYS__exit, 1, 0, 0, 0);
+	setrec(&recs[4], SYS_syscall_batch, (unsigned)recs, 1, 0, 0);
+	setrec(&recs[5], SYS_close, 99, 0, 0, 0);
+	setrec(&recs[6], SYS_getpid, 0, 0, 0, 0);
+	if (syscall_batch(recs, 7, 0) != 7) {
+		fail("syscall_batch with failures");
+	}
+	if (recs[0].sr_err != 0 || recs[1].sr_err != ENOSYS ||
+	    recs[2].sr_err != EINVAL || recs[3].sr_err != EINVAL ||
+	    recs[4].sr_err != EINVAL || recs[5].sr_err != EBADF ||
+	    recs[6].sr_err != 0) {
+		printf("Test failed! Errors:");
+		for (i = 0; i < 7; i++) {
+			printf(" %d", recs[i].sr_err);
+		}
+		printf("\n");
+		exit(1);
+	}
+	printf("stage [3] done\n");
+
+	for (i = 0; i < 4; i++) {
+		setrec(&recs[i], SYS_getpid, 0, 0, 0, 0);
+	}
+	recs[1].sr_callno = SYS_close;
+	recs[1].sr_args[0] = 99;
+	if (syscall_batch(recs, 4, SYSCALLBATCH_STOP) != 2) {
+		fail("syscall_batch did not stop");
+	}
+	if (recs[1].sr_err != EBADF || recs[2].sr_err != Untouched) {
+		fail("syscall_batch wrote past the stop");
+	}
+	printf("stage [4] done\n");
+
+	if (syscall_batch(recs, 0, 0) != -1 || errno != EINVAL) {
+		fail("empty batch worked");
+	}
+	if (syscall_batch(recs, SYSCALLBATCH_MAX + 1, 0) != -1 ||
+	    errno != EINVAL) {
+		fail("oversize batch worked");
+	}
+	if (syscall_batch(recs, 1, 0x100) != -1 || errno != EINVAL) {
+		fail("bad flags worked");
+	}
+	if (syscall_batch((struct syscall_rec *)0x40000000, 1, 0) != -1 ||
+	    errno != EFAULT) {
+		fail("batch at a bad address worked");
+	}
+	printf("stage [5] done\n");
+}
+
+int
+main()
+{
+	testgetpid();
+	testfile();
+	testerrors();
+	printf("Passed batchtest test.\n");
+	return 0;
+}
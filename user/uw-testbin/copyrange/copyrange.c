@@ -0,0 +1,83 @@
+/*
+ * copyrange.c
+ *
+ *	Exercises copy_file_range: copies a file bigger than the
+ *	kernel's buffer in pieces, checks the copy and both offsets,
+ *	and checks the bad cases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define FromName "CPRFROM"
+#define ToName "CPRTO"
+#define SIZE 10000
+
+static char data[SIZE], back[SIZE];
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+int
+main()
+{
+	int from, to, i, n;
+
+	for (i = 0; i < SIZE; i++) {
+		data[i] = 'a' + i % 26;
+	}
+	from = open(FromName, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	to = open(ToName, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (from < 0 || to < 0) {
+		fail("open");
+	}
+	if (write(from, data, SIZE) != SIZE) {
+		fail("write");
+	}
+
+	lseek(from, 100, SEEK_SET);
+	if (copy_file_range(from, to, 5000) != 5000) {
+		fail("copy_file_range");
+	}
+	n = copy_file_range(from, to, 1000000);
+	if (n != SIZE - 5100) {
+		fail("copy_file_range to the end");
+	}
+	if (copy_file_range(from, to, 10) != 0) {
+		fail("copy_file_range at the end");
+	}
+	if (lseek(from, 0, SEEK_CUR) != SIZE ||
+	    lseek(to, 0, SEEK_CUR) != SIZE - 100) {
+		fail("offsets");
+	}
+
+	lseek(to, 0, SEEK_SET);
+	if (read(to, back, SIZE) != SIZE - 100 ||
+	    memcmp(back, data + 100, SIZE - 100) != 0) {
+		fail("the copy is wrong");
+	}
+
+	if (copy_file_range(from, from, 10) >= 0 || errno != EINVAL) {
+		fail("copying a file onto itself worked");
+	}
+	if (copy_file_range(from, 99, 10) >= 0 || errno != EBADF) {
+		fail("copying to a bad descriptor worked");
+	}
+	if (copy_file_range(STDOUT_FILENO, to, 10) >= 0 || errno != EBADF) {
+		fail("copying from stdout worked");
+	}
+	close(from);
+	close(to);
+
+	printf("Passed copyrange test.\n");
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * defragtest.c
+ *
+ *	Exercises IOCTL_SFSDEFRAG: two files written a block at a time
+ *	by turns end up interleaved on disk, so defragmenting one moves
+ *	blocks; its contents are the same afterwards; and defragmenting
+ *	it again moves none. Run on an SFS volume.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define BlockSize	512
+#define NBlocks		200
+
+static char buf[BlockSize];
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+static
+void
+fill(unsigned block, char which)
+{
+	unsigned i;
+
+	for (i = 0; i < BlockSize; i++) {
+		buf[i] = which + (block + i) % 7;
+	}
+}
+
+static
+uint32_t
+defrag(int fd)
+{
+	uint32_t moved;
+
+	if (ioctl(fd, IOCTL_SFSDEFRAG, &moved) < 0) {
+		fail("ioctl");
+	}
+	return moved;
+}
+
+int
+main()
+{
+	char want[BlockSize];
+	uint32_t moved;
+	unsigned b;
+	int fa, fb;
+
+	fa = open("DEFRAGA", O_RDWR | O_CREAT | O_TRUNC, 0664);
+	fb = open("DEFRAGB", O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fa < 0 || fb < 0) {
+		fail("open");
+	}
+	for (b = 0; b < NBlocks; b++) {
+		fill(b, 'a');
+		if (write(fa, buf, BlockSize) != BlockSize) {
+			fail("write");
+		}
+		fill(b, 'A');
+		if (write(fb, buf, BlockSize) != BlockSize) {
+			fail("write");
+		}
+	}
+	printf("stage [1] done\n");
+
+	moved = defrag(fa);
+	if (moved == 0) {
+		fail("nothing was moved");
+	}
+	printf("%u blocks moved\n", moved);
+	printf("stage [2] done\n");
+
+	if (lseek(fa, 0, SEEK_SET) != 0) {
+		fail("lseek");
+	}
+	for (b = 0; b < NBlocks; b++) {
+		fill(b, 'a');
+		memcpy(want, buf, BlockSize);
+		if (read(fa, buf, BlockSize) != BlockSize) {
+			fail("read");
+		}
+		if (memcmp(buf, want, BlockSize) != 0) {
+			printf("Test failed! block %u changed\n", b);
+			exit(1);
+		}
+	}
+	printf("stage [3] done\n");
+
+	moved = defrag(fa);
+	if (moved != 0) {
+		printf("Test failed! %u moved the second time\n", moved);
+		exit(1);
+	}
+	close(fa);
+	close(fb);
+	remove("DEFRAGA");
+	remove("DEFRAGB");
+	printf("Passed defragtest test.\n");
+	return 0;
+}
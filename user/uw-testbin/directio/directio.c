@@ -0,0 +1,101 @@
+/*
+ * directio.c
+ *
+ *	Exercises O_DIRECT: a file written the usual way, and not yet
+ *	synced, reads back the same through a descriptor open with
+ *	O_DIRECT; one written partly through O_DIRECT, not on block
+ *	boundaries, reads back the same the usual way; and both agree
+ *	once the file is opened again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define FileSize	(64 * 1024 + 100)
+#define PatchOff	1000
+#define PatchSize	20000
+
+static char want[FileSize], got[FileSize];
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+/*
+ * Read the whole file open on FD from the start, and check it is what
+ * WANT says.
+ */
+static
+void
+check(int fd, const char *how)
+{
+	size_t i;
+
+	memset(got, 0, sizeof(got));
+	if (lseek(fd, 0, SEEK_SET) != 0 ||
+	    read(fd, got, sizeof(got)) != sizeof(got)) {
+		fail("read");
+	}
+	for (i = 0; i < sizeof(got); i++) {
+		if (got[i] != want[i]) {
+			printf("Test failed! %s: byte %u is %d, not %d\n",
+			       how, (unsigned)i, got[i], want[i]);
+			exit(1);
+		}
+	}
+}
+
+int
+main()
+{
+	int fd, dfd;
+	size_t i;
+
+	for (i = 0; i < sizeof(want); i++) {
+		want[i] = 'a' + i % 23;
+	}
+	fd = open("DIRECTFILE", O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("open");
+	}
+	if (write(fd, want, sizeof(want)) != sizeof(want)) {
+		fail("write");
+	}
+	dfd = open("DIRECTFILE", O_RDWR | O_DIRECT);
+	if (dfd < 0) {
+		fail("open with O_DIRECT");
+	}
+	check(dfd, "cached writes, direct read");
+	printf("stage [1] done\n");
+
+	for (i = PatchOff; i < PatchOff + PatchSize; i++) {
+		want[i] = 'A' + i % 19;
+	}
+	if (lseek(dfd, PatchOff, SEEK_SET) != PatchOff ||
+	    write(dfd, want + PatchOff, PatchSize) != PatchSize) {
+		fail("direct write");
+	}
+	check(fd, "direct write, cached read");
+	check(dfd, "direct write, direct read");
+	printf("stage [2] done\n");
+
+	close(dfd);
+	close(fd);
+	fd = open("DIRECTFILE", O_RDONLY);
+	if (fd < 0) {
+		fail("open again");
+	}
+	check(fd, "opened again");
+	close(fd);
+	remove("DIRECTFILE");
+	printf("Passed directio test.\n");
+	return 0;
+}
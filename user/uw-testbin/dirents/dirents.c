@@ -0,0 +1,141 @@
+/*
+ * dirents.c
+ *
+ *	Exercises getdirentries: reading a directory many names at a
+ *	time, through a buffer small enough that the names have to be
+ *	split over calls, finds each of them once and agrees with
+ *	getdirentry; a buffer too small for the next name fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define NFILES 40
+#define NameFmt "DIRENT%02d"
+
+static int seen[NFILES];
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+/*
+ * Note NAME if it is one of ours.
+ */
+static
+void
+see(const char *name)
+{
+	int n;
+
+	if (strlen(name) < 6 || memcmp(name, "DIRENT", 6) != 0) {
+		return;
+	}
+	n = atoi(name + 6);
+	if (n < 0 || n >= NFILES) {
+		fail("strange name");
+	}
+	seen[n]++;
+}
+
+/*
+ * Read the directory with getdirentries through a buffer of LEN
+ * bytes; returns how many names there were in all.
+ */
+static
+int
+readall(size_t len)
+{
+	char buf[256];
+	int fd, got, i, total;
+
+	fd = open(".", O_RDONLY);
+	if (fd < 0) {
+		fail("open of .");
+	}
+	total = 0;
+	while ((got = getdirentries(fd, buf, len)) > 0) {
+		if (buf[got - 1] != 0) {
+			fail("last name not terminated");
+		}
+		for (i = 0; i < got; i += strlen(buf + i) + 1) {
+			see(buf + i);
+			total++;
+		}
+	}
+	if (got < 0) {
+		fail("getdirentries");
+	}
+	close(fd);
+	return total;
+}
+
+int
+main()
+{
+	char name[32];
+	char buf[4];
+	int fd, i, n, total;
+
+	for (i = 0; i < NFILES; i++) {
+		snprintf(name, sizeof(name), NameFmt, i);
+		fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+		if (fd < 0) {
+			fail("create");
+		}
+		close(fd);
+	}
+
+	/* one name at a time, as a count to check against */
+	fd = open(".", O_RDONLY);
+	if (fd < 0) {
+		fail("open of .");
+	}
+	total = 0;
+	while ((n = getdirentry(fd, name, sizeof(name) - 1)) > 0) {
+		total++;
+	}
+	if (n < 0) {
+		fail("getdirentry");
+	}
+
+	close(fd);
+
+	/* a buffer too small for a name */
+	fd = open(".", O_RDONLY);
+	if (fd < 0) {
+		fail("open of .");
+	}
+	if (getdirentries(fd, buf, 1) >= 0 || errno != EINVAL) {
+		fail("getdirentries into 1 byte did not fail with EINVAL");
+	}
+	close(fd);
+
+	/* in a few names per call, and in as many as fit */
+	if (readall(32) != total || readall(sizeof(name) * 8) != total) {
+		fail("getdirentries and getdirentry disagree on the count");
+	}
+	for (i = 0; i < NFILES; i++) {
+		if (seen[i] != 2) {
+			printf(NameFmt " seen %d times, not 2\n", i, seen[i]);
+			fail("names lost or repeated");
+		}
+	}
+
+	for (i = 0; i < NFILES; i++) {
+		snprintf(name, sizeof(name), NameFmt, i);
+		if (remove(name) < 0) {
+			fail("remove");
+		}
+	}
+	printf("Passed dirents test.\n");
+	return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * fileshare.c
+ *
+ *	Exercises the file table: open gives out the lowest free
+ *	descriptor, dup2 and fork share the open file and so its
+ *	offset, and lseek moves it for everyone sharing it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define FileName "FILESHARE"
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+int
+main()
+{
+	int fd, fd2, status;
+	char buf[4];
+	pid_t pid;
+
+	fd = open(FileName, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("open");
+	}
+	if (fd != 3) {
+		fail("open did not give out the lowest free descriptor");
+	}
+
+	/* The child's write moves our offset too. */
+	pid = fork();
+	if (pid < 0) {
+		fail("fork");
+	}
+	if (pid == 0) {
+		if (write(fd, "ab", 2) != 2) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid || status != 0) {
+		fail("child could not write");
+	}
+	if (write(fd, "cd", 2) != 2) {
+		fail("write");
+	}
+	if (lseek(fd, 0, SEEK_CUR) != 4) {
+		fail("offset not shared with the child");
+	}
+
+	fd2 = 10;
+	if (dup2(fd, fd2) != fd2) {
+		fail("dup2");
+	}
+	if (lseek(fd2, 0, SEEK_SET) != 0) {
+		fail("lseek");
+	}
+	if (read(fd, buf, 4) != 4 || buf[0] != 'a' || buf[3] != 'd') {
+		fail("read back through the other descriptor");
+	}
+	if (lseek(fd2, -1, SEEK_END) != 3) {
+		fail("lseek from the end");
+	}
+	if (lseek(fd, -5, SEEK_CUR) >= 0 || errno != EINVAL) {
+		fail("lseek before the start worked");
+	}
+	if (lseek(STDOUT_FILENO, 0, SEEK_SET) >= 0 || errno != ESPIPE) {
+		fail("lseek on the console worked");
+	}
+
+	if (close(fd) != 0 || close(fd2) != 0) {
+		fail("close");
+	}
+	if (close(fd) == 0 || errno != EBADF) {
+		fail("second close worked");
+	}
+	if (read(100, buf, 1) >= 0 || errno != EBADF) {
+		fail("read of a bad descriptor worked");
+	}
+	if (write(STDIN_FILENO, buf, 1) >= 0 || errno != EBADF) {
+		fail("write to stdin worked");
+	}
+
+	printf("Passed fileshare test.\n");
+	return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * fsynctest.c
+ *
+ *	Exercises fsync and fdatasync: several processes write and sync
+ *	files of their own at once, each reading back what it wrote;
+ *	fdatasync after overwriting a file in place leaves its size
+ *	alone; and neither works on a bad descriptor or a pipe.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define NProcs	4
+#define NRounds	16
+#define BufSize	512
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+/*
+ * Child N: append NRounds blocks to its file, syncing after each
+ * (alternately fsync and fdatasync), then check them.
+ */
+static
+void
+child(int n)
+{
+	char name[16], buf[BufSize], back[BufSize];
+	int fd, i;
+
+	snprintf(name, sizeof(name), "FSYNC%d", n);
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("create");
+	}
+	for (i = 0; i < NRounds; i++) {
+		memset(buf, 'a' + (n * NRounds + i) % 26, sizeof(buf));
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			fail("write");
+		}
+		if ((i % 2 ? fdatasync(fd) : fsync(fd)) != 0) {
+			fail(i % 2 ? "fdatasync" : "fsync");
+		}
+	}
+	if (lseek(fd, 0, SEEK_SET) != 0) {
+		fail("lseek");
+	}
+	for (i = 0; i < NRounds; i++) {
+		memset(buf, 'a' + (n * NRounds + i) % 26, sizeof(buf));
+		if (read(fd, back, sizeof(back)) != sizeof(back) ||
+		    memcmp(buf, back, sizeof(buf)) != 0) {
+			printf("Test failed! %s block %d read back wrong\n",
+			       name, i);
+			_exit(1);
+		}
+	}
+	close(fd);
+	remove(name);
+	_exit(0);
+}
+
+static
+void
+testconcurrent(void)
+{
+	pid_t pids[NProcs];
+	int i, status, bad = 0;
+
+	for (i = 0; i < NProcs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			fail("fork");
+		}
+		if (pids[i] == 0) {
+			child(i);
+		}
+	}
+	for (i = 0; i < NProcs; i++) {
+		if (waitpid(pids[i], &status, 0) != pids[i]) {
+			fail("waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			bad++;
+		}
+	}
+	if (bad) {
+		printf("Test failed! %d of %d writers\n", bad, NProcs);
+		exit(1);
+	}
+}
+
+static
+void
+testoverwrite(void)
+{
+	char buf[BufSize];
+	struct stat st;
+	int fd;
+
+	fd = open("FSYNCOW", O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("create");
+	}
+	memset(buf, 'x', sizeof(buf));
+	if (write(fd, buf, sizeof(buf)) != sizeof(buf) || fsync(fd) != 0) {
+		fail("write and fsync");
+	}
+	memset(buf, 'y', sizeof(buf) / 2);
+	if (lseek(fd, 0, SEEK_SET) != 0 ||
+	    write(fd, buf, sizeof(buf) / 2) != sizeof(buf) / 2) {
+		fail("overwrite");
+	}
+	if (fdatasync(fd) != 0) {
+		fail("fdatasync");
+	}
+	if (fstat(fd, &st) != 0) {
+		fail("fstat");
+	}
+	if (st.st_size != sizeof(buf)) {
+		printf("Test failed! size %d after overwrite, wanted %d\n",
+		       (int)st.st_size, (int)sizeof(buf));
+		exit(1);
+	}
+	close(fd);
+	remove("FSYNCOW");
+}
+
+static
+void
+testbad(void)
+{
+	int fds[2];
+
+	if (fsync(-1) == 0 || errno != EBADF) {
+		fail("fsync(-1) worked");
+	}
+	if (fdatasync(99) == 0 || errno != EBADF) {
+		fail("fdatasync(99) worked");
+	}
+	if (pipe(fds) != 0) {
+		fail("pipe");
+	}
+	if (fdatasync(fds[0]) == 0 || errno != EINVAL) {
+		fail("fdatasync on a pipe worked");
+	}
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int
+main()
+{
+	testconcurrent();
+	testoverwrite();
+	testbad();
+	printf("Passed fsynctest test.\n");
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * futex.c
+ *
+ *	Exercises futex_wait and futex_wake: waiting on a word that has
+ *	already changed must fail at once, waking nobody must wake
+ *	nobody, and two threads must be able to pass a turn back and
+ *	forth through a shared word, sleeping in between, without
+ *	losing a wakeup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define Rounds	500
+
+static volatile int turn;	/* 0: main's go, 1: the other thread's */
+static volatile int word;
+
+static
+void
+waitturn(int me)
+{
+	int t;
+
+	while ((t = turn) != me) {
+		if (futex_wait(&turn, t) != 0 && errno != EAGAIN) {
+			printf("Test failed! futex_wait: errno %d\n", errno);
+			exit(1);
+		}
+	}
+}
+
+static
+void
+giveturn(int to)
+{
+	turn = to;
+	if (futex_wake(&turn, 1) < 0) {
+		printf("Test failed! futex_wake: errno %d\n", errno);
+		exit(1);
+	}
+}
+
+static
+void *
+partner(void *arg)
+{
+	unsigned i;
+
+	(void)arg;
+	for (i = 0; i < Rounds; i++) {
+		waitturn(1);
+		giveturn(0);
+	}
+	return NULL;
+}
+
+int
+main()
+{
+	unsigned i;
+	int tid;
+
+	printf("Starting the futex program\n");
+
+	word = 1;
+	if (futex_wait(&word, 0) == 0 || errno != EAGAIN) {
+		printf("Test failed! futex_wait on a changed word slept\n");
+		exit(1);
+	}
+	if (futex_wake(&word, 1) != 0) {
+		printf("Test failed! futex_wake woke someone\n");
+		exit(1);
+	}
+
+	turn = 0;
+	tid = thread_create(partner, NULL);
+	if (tid < 0) {
+		printf("Test failed! thread_create: errno %d\n", errno);
+		exit(1);
+	}
+	for (i = 0; i < Rounds; i++) {
+		waitturn(0);
+		giveturn(1);
+	}
+	waitturn(0);
+	if (thread_join(tid, NULL) != 0) {
+		printf("Test failed! thread_join: errno %d\n", errno);
+		exit(1);
+	}
+
+	printf("%u round trips\n", Rounds);
+	printf("Passed futex test.\n");
+	exit(0);
+}
@@ -0,0 +1,146 @@
+/*
+ * greentest.c
+ *
+ *	Exercises libgreen: many greens yielding to each other on two
+ *	workers all run to the end, with memory from malloc; and, on one
+ *	worker, a green blocked reading a pipe does not stop the green
+ *	that is to write to it from running, because a worker is started
+ *	to stand in for the blocked one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <green.h>
+
+#define NGreens		40
+#define NYields		50
+
+static int counts[NGreens];
+static volatile int lockword;
+static int finished;
+static int fds[2];
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+static
+void
+yielder(void *arg)
+{
+	int which = (int)arg, i;
+	char *p;
+
+	for (i = 0; i < NYields; i++) {
+		p = malloc(32);
+		if (p == NULL) {
+			fail("malloc");
+		}
+		memset(p, which, 32);
+		green_yield();
+		if (p[31] != (char)which) {
+			fail("memory changed under a green");
+		}
+		free(p);
+		counts[which]++;
+	}
+	__futex_lock(&lockword);
+	finished++;
+	__futex_unlock(&lockword);
+}
+
+static
+void
+spawner(void *unused)
+{
+	int i;
+
+	(void)unused;
+	for (i = 0; i < NGreens; i++) {
+		if (green_spawn(yielder, (void *)i) < 0) {
+			fail("green_spawn");
+		}
+	}
+}
+
+static
+void
+reader(void *unused)
+{
+	char c;
+
+	(void)unused;
+	if (read(fds[0], &c, 1) != 1 || c != 'g') {
+		fail("read");
+	}
+	finished++;
+}
+
+static
+void
+writer(void *unused)
+{
+	(void)unused;
+	green_yield();
+	if (write(fds[1], "g", 1) != 1) {
+		fail("write");
+	}
+}
+
+static
+void
+piper(void *unused)
+{
+	(void)unused;
+	/* The reader runs and blocks first, holding the only worker. */
+	if (green_spawn(reader, NULL) < 0 || green_spawn(writer, NULL) < 0) {
+		fail("green_spawn");
+	}
+}
+
+int
+main()
+{
+	int i;
+
+	if (green_run(2, spawner, NULL) < 0) {
+		fail("green_run");
+	}
+	if (finished != NGreens) {
+		printf("Test failed! %d of %d greens finished\n",
+		       finished, NGreens);
+		exit(1);
+	}
+	for (i = 0; i < NGreens; i++) {
+		if (counts[i] != NYields) {
+			printf("Test failed! green %d yielded %d times\n",
+			       i, counts[i]);
+			exit(1);
+		}
+	}
+	printf("stage [1] done\n");
+
+	if (pipe(fds) < 0) {
+		fail("pipe");
+	}
+	finished = 0;
+	if (green_run(1, piper, NULL) < 0) {
+		fail("green_run");
+	}
+	if (finished != 1) {
+		fail("the reader did not finish");
+	}
+	close(fds[0]);
+	close(fds[1]);
+	printf("stage [2] done\n");
+
+	printf("Passed greentest test.\n");
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * iostat.c
+ *
+ *	Exercises getiostat: writing a file out, syncing it, and reading
+ *	it back adds to the requests some device has done; each device's
+ *	histogram adds up to its requests and nothing is left in flight;
+ *	and asking past the last device fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define MaxDevs		16
+#define FileSize	(64 * 1024)
+
+static struct iostatinfo before[MaxDevs], after[MaxDevs];
+static char buf[FileSize];
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+static
+unsigned
+snapshot(struct iostatinfo *is)
+{
+	unsigned i;
+
+	for (i = 0; i < MaxDevs; i++) {
+		if (getiostat(i, &is[i]) < 0) {
+			if (errno != ENOENT) {
+				fail("getiostat");
+			}
+			break;
+		}
+	}
+	if (i == 0) {
+		fail("no devices");
+	}
+	if (i < MaxDevs && is[0].is_ndevs != i) {
+		printf("Test failed! %u devices, but is_ndevs is %u\n",
+		       i, is[0].is_ndevs);
+		exit(1);
+	}
+	return i;
+}
+
+static
+unsigned
+requests(const struct iostatinfo *is)
+{
+	return is->is_reads + is->is_writes + is->is_others;
+}
+
+int
+main()
+{
+	struct iostatinfo is;
+	unsigned n, i, b, sum, more;
+	int fd;
+
+	n = snapshot(before);
+
+	memset(buf, 'i', sizeof(buf));
+	fd = open("IOSTATFILE", O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("open");
+	}
+	if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+		fail("write");
+	}
+	if (fsync(fd) < 0) {
+		fail("fsync");
+	}
+	if (lseek(fd, 0, SEEK_SET) != 0 ||
+	    read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+		fail("read");
+	}
+	close(fd);
+	remove("IOSTATFILE");
+	printf("stage [1] done\n");
+
+	if (snapshot(after) != n) {
+		fail("device count changed");
+	}
+	more = 0;
+	for (i = 0; i < n; i++) {
+		if (strcmp(before[i].is_name, after[i].is_name) != 0) {
+			fail("device names changed");
+		}
+		if (requests(&after[i]) < requests(&before[i]) ||
+		    after[i].is_wbytes < before[i].is_wbytes ||
+		    after[i].is_busyns < before[i].is_busyns) {
+			printf("Test failed! %s went backwards\n",
+			       after[i].is_name);
+			exit(1);
+		}
+		more += requests(&after[i]) - requests(&before[i]);
+		sum = 0;
+		for (b = 0; b < IOSTAT_NBUCKETS; b++) {
+			sum += after[i].is_hist[b];
+		}
+		if (sum != requests(&after[i])) {
+			printf("Test failed! %s: %u in the histogram, %u "
+			       "requests\n", after[i].is_name, sum,
+			       requests(&after[i]));
+			exit(1);
+		}
+		if (after[i].is_maxinflight < after[i].is_inflight) {
+			fail("in flight more than the most ever");
+		}
+		printf("%-8s reads %u writes %u other %u\n",
+		       after[i].is_name, after[i].is_reads,
+		       after[i].is_writes, after[i].is_others);
+	}
+	if (more == 0) {
+		fail("file I/O was not counted");
+	}
+	printf("stage [2] done\n");
+
+	if (getiostat(n + 1000, &is) == 0 || errno != ENOENT) {
+		fail("getiostat past the end worked");
+	}
+	printf("Passed iostat test.\n");
+	return 0;
+}
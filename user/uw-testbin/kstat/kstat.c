@@ -0,0 +1,75 @@
+/*
+ * kstat.c
+ *
+ *	Exercises getkstat: finds the context switch counter by name and
+ *	checks that waiting for a child counts some, checks that reading
+ *	past the last counter fails, and then prints every counter.
+ */
+
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define Children	10
+
+static
+int
+find(const char *name, struct kstatinfo *ki)
+{
+	unsigned i;
+
+	for (i = 0; getkstat(i, ki) == 0; i++) {
+		if (!strcmp(ki->ki_name, name)) {
+			return 0;
+		}
+	}
+	if (errno != ENOENT) {
+		printf("Test failed! getkstat(%u): errno %d\n", i, errno);
+		exit(1);
+	}
+	return -1;
+}
+
+int
+main()
+{
+	struct kstatinfo before, after, ki;
+	unsigned i;
+	pid_t pid;
+
+	if (find("sched.switches", &before) != 0) {
+		printf("Test failed! no sched.switches\n");
+		exit(1);
+	}
+	for (i = 0; i < Children; i++) {
+		pid = fork();
+		if (pid < 0) {
+			printf("Test failed! fork: errno %d\n", errno);
+			exit(1);
+		}
+		if (pid == 0) {
+			_exit(0);
+		}
+		waitpid(pid, NULL, 0);
+	}
+	find("sched.switches", &after);
+	if (after.ki_value <= before.ki_value) {
+		printf("Test failed! no context switches counted\n");
+		exit(1);
+	}
+
+	if (getkstat(after.ki_nstats + 1000, &ki) == 0 || errno != ENOENT) {
+		printf("Test failed! getkstat past the end worked\n");
+		exit(1);
+	}
+
+	for (i = 0; getkstat(i, &ki) == 0; i++) {
+		printf("%-24s %llu\n", ki.ki_name, ki.ki_value);
+	}
+
+	printf("Passed kstat test.\n");
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * memstat.c
+ *
+ *	Exercises getmemstat: checks that the system-wide page counts
+ *	add up, that touching memory raises our resident set and fault
+ *	counts, that a child can be looked at but a stranger can't, and
+ *	that pages kept in use for a few seconds show in the working set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#define PageSize	4096
+#define NumPages	32
+#define BusySecs	3	/* enough for the page ager to sweep twice */
+
+static char buf[NumPages * PageSize];
+
+static
+void
+show(const char *what, const struct memstat *ms)
+{
+	printf("%s: %u/%u pages free, %u user, %u kernel; "
+	       "rss %u, working set %u, %u minor and %u major faults\n",
+	       what, ms->ms_free, ms->ms_total, ms->ms_user, ms->ms_kernel,
+	       ms->ms_rss, ms->ms_wss, ms->ms_minflt, ms->ms_majflt);
+}
+
+int
+main()
+{
+	struct memstat before, after;
+	time_t start;
+	pid_t pid;
+	int i, status;
+
+	printf("Starting the memstat program\n");
+
+	if (getmemstat(0, &before) != 0) {
+		printf("Test failed! getmemstat: errno %d\n", errno);
+		return 1;
+	}
+	show("before", &before);
+	if (before.ms_pagesize != PageSize ||
+	    before.ms_free + before.ms_user + before.ms_kernel !=
+	    before.ms_total) {
+		printf("Test failed! System page counts don't add up\n");
+		return 1;
+	}
+	printf("stage [1] done\n");
+
+	for (i = 0; i < NumPages * PageSize; i += PageSize) {
+		buf[i] = 1;
+	}
+	if (getmemstat(getpid(), &after) != 0) {
+		printf("Test failed! getmemstat: errno %d\n", errno);
+		return 1;
+	}
+	show("after", &after);
+	if (after.ms_rss < before.ms_rss + NumPages ||
+	    after.ms_minflt < before.ms_minflt + NumPages) {
+		printf("Test failed! Touching %d pages didn't show\n",
+		       NumPages);
+		return 1;
+	}
+	printf("stage [2] done\n");
+
+	pid = fork();
+	if (pid < 0) {
+		printf("Test failed! fork: errno %d\n", errno);
+		return 1;
+	}
+	if (pid == 0) {
+		/* Wait to be looked at. */
+		for (i = 0; i < 100000; i++) {
+			buf[0] = (char)i;
+		}
+		_exit(0);
+	}
+	if (getmemstat(pid, &after) != 0) {
+		printf("Test failed! getmemstat of child: errno %d\n", errno);
+		return 1;
+	}
+	show("child", &after);
+	if (getmemstat(pid + 1000, &after) == 0 || errno != ESRCH) {
+		printf("Test failed! getmemstat of a stranger worked\n");
+		return 1;
+	}
+	if (waitpid(pid, &status, 0) != pid) {
+		printf("Test failed! waitpid: errno %d\n", errno);
+		return 1;
+	}
+	printf("stage [3] done\n");
+
+	/* Some pages may be skipped while we hold our own lock faulting. */
+	start = time(NULL);
+	while (time(NULL) < start + BusySecs) {
+		for (i = 0; i < NumPages * PageSize; i += PageSize) {
+			buf[i]++;
+		}
+	}
+	if (getmemstat(0, &after) != 0) {
+		printf("Test failed! getmemstat: errno %d\n", errno);
+		return 1;
+	}
+	show("busy", &after);
+	if (after.ms_wss < NumPages / 2 || after.ms_wss > after.ms_rss) {
+		printf("Test failed! Working set of %u pages while using %d\n",
+		       after.ms_wss, NumPages);
+		return 1;
+	}
+	printf("stage [4] done\n");
+
+	printf("SUCCESS\n");
+	return 0;
+}
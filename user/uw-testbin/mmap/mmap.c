@@ -0,0 +1,75 @@
+/*
+ * mmap.c
+ *
+ *	Exercises mmap and munmap: maps some anonymous memory, fills it
+ *	in and checks it, and makes sure that bad requests are refused.
+ *
+ *	There is no open() yet, so file mappings can only be tried on
+ *	the console, which cannot be mapped.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define PageSize	4096
+#define NumPages	64
+
+int
+main()
+{
+	char *p;
+	int i;
+
+	printf("Starting the mmap program\n");
+
+	p = mmap(NULL, NumPages * PageSize, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		printf("Test failed! mmap: errno %d\n", errno);
+		return 1;
+	}
+
+	/* untouched pages must read as zero */
+	for (i = 0; i < NumPages * PageSize; i += PageSize) {
+		if (p[i] != 0) {
+			printf("Test failed! Page at %d not zero\n", i);
+			return 1;
+		}
+	}
+	for (i = 0; i < NumPages * PageSize; i++) {
+		p[i] = (char)(i / PageSize);
+	}
+	for (i = 0; i < NumPages * PageSize; i++) {
+		if (p[i] != (char)(i / PageSize)) {
+			printf("Test failed! Unexpected value at %d\n", i);
+			return 1;
+		}
+	}
+	printf("stage [1] done\n");
+
+	if (munmap(p, PageSize) == 0) {
+		printf("Test failed! Partial munmap succeeded\n");
+		return 1;
+	}
+	if (munmap(p, NumPages * PageSize) != 0) {
+		printf("Test failed! munmap: errno %d\n", errno);
+		return 1;
+	}
+	printf("stage [2] done\n");
+
+	if (mmap(NULL, PageSize, PROT_READ, MAP_PRIVATE, STDOUT_FILENO, 0)
+	    != MAP_FAILED) {
+		printf("Test failed! Mapped the console\n");
+		return 1;
+	}
+	if (mmap(NULL, PageSize, PROT_READ, MAP_SHARED | MAP_PRIVATE | MAP_ANON,
+		 -1, 0) != MAP_FAILED) {
+		printf("Test failed! Bad flags accepted\n");
+		return 1;
+	}
+	printf("stage [3] done\n");
+
+	printf("SUCCESS\n");
+	return 0;
+}
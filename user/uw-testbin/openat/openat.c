@@ -0,0 +1,66 @@
+/*
+ * openat.c
+ *
+ *	Exercises openat: names relative to an open directory and to
+ *	AT_FDCWD, creating through a directory descriptor, and the
+ *	errors for a descriptor that is not open or not a directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define FileName "OPENAT"
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+int
+main()
+{
+	char buf[5];
+	int dirfd, fd;
+
+	dirfd = open(".", O_RDONLY);
+	if (dirfd < 0) {
+		fail("open of .");
+	}
+
+	fd = openat(dirfd, FileName, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("openat with O_CREAT");
+	}
+	if (write(fd, "abcd", 4) != 4) {
+		fail("write");
+	}
+	close(fd);
+
+	/* the same file, by its name from the current directory */
+	fd = openat(AT_FDCWD, FileName, O_RDONLY);
+	if (fd < 0) {
+		fail("openat with AT_FDCWD");
+	}
+	if (read(fd, buf, 5) != 4 || memcmp(buf, "abcd", 4) != 0) {
+		fail("read back the wrong thing");
+	}
+
+	if (openat(fd, "x", O_RDONLY) >= 0 || errno != ENOTDIR) {
+		fail("openat relative to a file did not fail with ENOTDIR");
+	}
+	close(fd);
+	if (openat(fd, FileName, O_RDONLY) >= 0 || errno != EBADF) {
+		fail("openat on a closed descriptor did not fail with EBADF");
+	}
+
+	close(dirfd);
+	printf("Passed openat test.\n");
+	return 0;
+}
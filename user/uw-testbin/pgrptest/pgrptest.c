@@ -0,0 +1,113 @@
+/*
+ * pgrptest.c
+ *
+ *	Exercises setpgid/getpgid: a process can lead a group of its
+ *	own, a child starts in its parent's, a parent can move its child
+ *	out and back, a group that has gone cannot be joined, and a
+ *	negative group is refused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+static
+void
+fail(const char *what)
+{
+	printf("Test failed! %s: errno %d\n", what, errno);
+	exit(1);
+}
+
+static
+pid_t
+group_of(pid_t pid)
+{
+	pid_t pgid;
+
+	pgid = getpgid(pid);
+	if (pgid < 0) {
+		fail("getpgid");
+	}
+	return pgid;
+}
+
+int
+main()
+{
+	pid_t me, pid, pgid;
+	int fds[2], status;
+
+	me = getpid();
+	if (setpgid(0, 0) != 0) {
+		fail("setpgid");
+	}
+	if (group_of(0) != me || group_of(me) != me) {
+		printf("Test failed! group %d, wanted %d\n", group_of(0), me);
+		exit(1);
+	}
+	printf("stage [1] done\n");
+
+	/* the child says what group it started in before we move it */
+	if (pipe(fds) != 0) {
+		fail("pipe");
+	}
+	pid = fork();
+	if (pid < 0) {
+		fail("fork");
+	}
+	if (pid == 0) {
+		pgid = group_of(0);
+		_exit(write(fds[1], &pgid, sizeof(pgid)) == sizeof(pgid) ?
+		      0 : 1);
+	}
+	if (read(fds[0], &pgid, sizeof(pgid)) != sizeof(pgid)) {
+		fail("read");
+	}
+	if (pgid != me) {
+		printf("Test failed! child started in group %d, not %d\n",
+		       pgid, me);
+		exit(1);
+	}
+	if (group_of(pid) != me) {
+		printf("Test failed! child's group %d, wanted %d\n",
+		       group_of(pid), me);
+		exit(1);
+	}
+	if (setpgid(pid, pid) != 0 || group_of(pid) != pid) {
+		fail("moving the child to a group of its own");
+	}
+	if (setpgid(pid, me) != 0 || group_of(pid) != me) {
+		fail("moving the child back");
+	}
+	if (setpgid(pid, 0) != 0 || group_of(pid) != pid) {
+		fail("setpgid with pgid 0");
+	}
+	if (waitpid(pid, &status, 0) != pid) {
+		fail("waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		printf("Test failed! child could not write its group\n");
+		exit(1);
+	}
+	close(fds[0]);
+	close(fds[1]);
+	printf("stage [2] done\n");
+
+	/* the child's own group went with it */
+	if (setpgid(0, pid) == 0 || errno != EPERM) {
+		printf("Test failed! joined a group that has gone\n");
+		exit(1);
+	}
+	if (setpgid(0, -1) == 0 || errno != EINVAL) {
+		printf("Test failed! setpgid to -1 worked\n");
+		exit(1);
+	}
+	if (group_of(0) != me) {
+		printf("Test failed! failed setpgid moved us\n");
+		exit(1);
+	}
+	printf("Passed pgrptest test.\n");
+	return 0;
+}
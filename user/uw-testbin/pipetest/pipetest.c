@@ -0,0 +1,106 @@
+/*
+ * pipetest.c
+ *
+ *	Exercises pipe: a child writes several ringfuls through a pipe
+ *	in big and small writes, the parent reads it all back in
+ *	other sizes and checks it, then gets end of file once the
+ *	child is gone. Writing with the read end closed is EPIPE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#define TOTAL 50000
+
+static char buf[TOTAL];
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+int
+main()
+{
+	int fds[2], i, n, got, status;
+	pid_t pid;
+	char c;
+
+	if (pipe(fds) < 0) {
+		fail("pipe");
+	}
+	if (fds[0] < 0 || fds[1] < 0 || fds[0] == fds[1]) {
+		fail("pipe gave bad descriptors");
+	}
+	if (lseek(fds[0], 0, SEEK_SET) >= 0 || errno != ESPIPE) {
+		fail("lseek on a pipe worked");
+	}
+	if (write(fds[0], "x", 1) >= 0 || errno != EBADF) {
+		fail("writing the read end worked");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		fail("fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		for (i = 0; i < TOTAL; i++) {
+			buf[i] = i % 251;
+		}
+		/* one big write, then the rest a byte at a time */
+		if (write(fds[1], buf, TOTAL - 100) != TOTAL - 100) {
+			fail("big write");
+		}
+		for (i = TOTAL - 100; i < TOTAL; i++) {
+			if (write(fds[1], &buf[i], 1) != 1) {
+				fail("small write");
+			}
+		}
+		_exit(0);
+	}
+
+	close(fds[1]);
+	got = 0;
+	while ((n = read(fds[0], buf + got, got % 2 ? 7 : 3000)) > 0) {
+		got += n;
+		if (got > TOTAL) {
+			fail("read too much");
+		}
+	}
+	if (n < 0) {
+		fail("read");
+	}
+	if (got != TOTAL) {
+		fail("read too little");
+	}
+	for (i = 0; i < TOTAL; i++) {
+		if (buf[i] != (char)(i % 251)) {
+			fail("read the wrong thing");
+		}
+	}
+	if (waitpid(pid, &status, 0) != pid || status != 0) {
+		fail("child");
+	}
+	close(fds[0]);
+
+	if (pipe(fds) < 0) {
+		fail("second pipe");
+	}
+	close(fds[0]);
+	c = 'x';
+	if (write(fds[1], &c, 1) >= 0 || errno != EPIPE) {
+		fail("writing with no reader worked");
+	}
+	close(fds[1]);
+
+	printf("Passed pipetest test.\n");
+	return 0;
+}
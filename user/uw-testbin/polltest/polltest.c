@@ -0,0 +1,92 @@
+/*
+ * polltest.c
+ *
+ *	Exercises poll on pipes: what is ready right away, timing out,
+ *	being woken by a child writing, end of file and bad descriptors.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+int
+main()
+{
+	struct pollfd pfd[3];
+	int fds[2], status;
+	pid_t pid;
+	char c;
+
+	if (pipe(fds) < 0) {
+		fail("pipe");
+	}
+
+	/* empty: the read end is not ready, the write end is */
+	pfd[0].fd = fds[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = fds[1];
+	pfd[1].events = POLLOUT;
+	pfd[2].fd = -1;
+	pfd[2].events = POLLIN;
+	if (poll(pfd, 3, 0) != 1) {
+		fail("poll of an empty pipe");
+	}
+	if (pfd[0].revents != 0 || pfd[1].revents != POLLOUT ||
+	    pfd[2].revents != 0) {
+		fail("wrong revents for an empty pipe");
+	}
+	if (poll(pfd, 1, 50) != 0 || pfd[0].revents != 0) {
+		fail("poll did not time out");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		fail("fork");
+	}
+	if (pid == 0) {
+		c = 'x';
+		if (write(fds[1], &c, 1) != 1) {
+			fail("child write");
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+
+	if (poll(pfd, 1, -1) != 1 || pfd[0].revents != POLLIN) {
+		fail("poll was not woken by the write");
+	}
+	if (read(fds[0], &c, 1) != 1 || c != 'x') {
+		fail("read");
+	}
+	if (waitpid(pid, &status, 0) != pid || status != 0) {
+		fail("child");
+	}
+
+	/* the writer is gone */
+	if (poll(pfd, 1, -1) != 1 || pfd[0].revents != POLLHUP) {
+		fail("no POLLHUP");
+	}
+
+	pfd[1].fd = 99;
+	if (poll(&pfd[1], 1, 0) != 1 || pfd[1].revents != POLLNVAL) {
+		fail("no POLLNVAL");
+	}
+	if (poll((struct pollfd *)0x40000000, 1, 0) >= 0 || errno != EFAULT) {
+		fail("poll of a bad pointer worked");
+	}
+	close(fds[0]);
+
+	printf("Passed polltest test.\n");
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * prw.c
+ *
+ *	Exercises pread and pwrite: they go at the position they are
+ *	given, and leave the descriptor's offset where it was, even for
+ *	a child sharing the open file and reading at the same time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#define FileName "PRW"
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+int
+main()
+{
+	static const char data[] = "0123456789abcdef";
+	char buf[4];
+	int fd, i, status;
+	pid_t pid;
+
+	fd = open(FileName, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("open");
+	}
+	if (write(fd, data, 16) != 16) {
+		fail("write");
+	}
+	if (lseek(fd, 2, SEEK_SET) != 2) {
+		fail("lseek");
+	}
+
+	if (pwrite(fd, "XY", 2, 10) != 2) {
+		fail("pwrite");
+	}
+	if (pread(fd, buf, 4, 9) != 4 || memcmp(buf, "9XYc", 4) != 0) {
+		fail("pread read the wrong thing");
+	}
+	if (lseek(fd, 0, SEEK_CUR) != 2) {
+		fail("pread or pwrite moved the offset");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		fail("fork");
+	}
+	for (i = 0; i < 100; i++) {
+		if (pread(fd, buf, 2, pid == 0 ? 4 : 12) != 2 ||
+		    memcmp(buf, pid == 0 ? "45" : "cd", 2) != 0) {
+			fail("pread beside the other process");
+		}
+	}
+	if (pid == 0) {
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid || status != 0) {
+		fail("child");
+	}
+	if (lseek(fd, 0, SEEK_CUR) != 2) {
+		fail("the offset moved");
+	}
+
+	if (pread(fd, buf, 4, -1) >= 0 || errno != EINVAL) {
+		fail("pread at a negative position worked");
+	}
+	if (pread(fd, buf, 4, 16) != 0) {
+		fail("pread at the end");
+	}
+	close(fd);
+
+	if (pwrite(STDOUT_FILENO, "x\n", 2, 0) >= 0 || errno != ESPIPE) {
+		fail("pwrite to the console worked");
+	}
+
+	printf("Passed prw test.\n");
+	return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * rusage.c
+ *
+ *	Exercises getrusage: has a child touch some pages, write some
+ *	output and spin for a while, and checks that once it has been
+ *	waited for its usage shows up as ours under RUSAGE_CHILDREN
+ *	and not under RUSAGE_SELF.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define Pages	16
+#define PageSize 4096
+#define Spins	2000000
+
+static char pages[Pages * PageSize];
+
+static
+void
+get(int who, struct rusage *ru)
+{
+	if (getrusage(who, ru) != 0) {
+		printf("Test failed! getrusage(%d): errno %d\n", who, errno);
+		exit(1);
+	}
+}
+
+int
+main()
+{
+	struct rusage self, kids;
+	volatile unsigned spin;
+	unsigned i;
+	pid_t pid;
+	int status;
+
+	get(RUSAGE_CHILDREN, &kids);
+	if (kids.ru_minflt != 0 || kids.ru_utime.tv_sec != 0 ||
+	    kids.ru_utime.tv_usec != 0) {
+		printf("Test failed! usage for children before any exited\n");
+		exit(1);
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		printf("Test failed! fork: errno %d\n", errno);
+		exit(1);
+	}
+	if (pid == 0) {
+		for (i = 0; i < Pages; i++) {
+			pages[i * PageSize] = 1;
+		}
+		for (spin = 0; spin < Spins; spin++) {
+		}
+		printf("child done\n");
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid) {
+		printf("Test failed! waitpid: errno %d\n", errno);
+		exit(1);
+	}
+
+	get(RUSAGE_SELF, &self);
+	get(RUSAGE_CHILDREN, &kids);
+	if (kids.ru_minflt + kids.ru_majflt < Pages) {
+		printf("Test failed! child had %u faults, wanted %u\n",
+		       (unsigned)(kids.ru_minflt + kids.ru_majflt), Pages);
+		exit(1);
+	}
+	if (kids.ru_oublock == 0) {
+		printf("Test failed! child's output was not counted\n");
+		exit(1);
+	}
+	if (self.ru_nvcsw == 0) {
+		printf("Test failed! waiting was not a context switch\n");
+		exit(1);
+	}
+
+	if (getrusage(5, &self) == 0 || errno != EINVAL) {
+		printf("Test failed! getrusage(5) worked\n");
+		exit(1);
+	}
+
+	printf("child: %d.%06d s, %u+%u faults, %u switches; "
+	       "self: %d.%06d s\n",
+	       (int)kids.ru_utime.tv_sec, (int)kids.ru_utime.tv_usec,
+	       (unsigned)kids.ru_minflt, (unsigned)kids.ru_majflt,
+	       (unsigned)(kids.ru_nvcsw + kids.ru_nivcsw),
+	       (int)self.ru_utime.tv_sec, (int)self.ru_utime.tv_usec);
+	printf("Passed rusage test.\n");
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * rwv.c
+ *
+ *	Exercises readv and writev: writes a header and a payload with
+ *	one writev, reads them back split differently with one readv,
+ *	and checks the bad cases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define FileName "RWV"
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+int
+main()
+{
+	static const char hdr[] = "HDR:", payload[] = "payload\n";
+	char a[6], b[32];
+	struct iovec iov[3];
+	int fd, n;
+
+	fd = open(FileName, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("open");
+	}
+
+	iov[0].iov_base = (void *)hdr;
+	iov[0].iov_len = 4;
+	iov[1].iov_base = NULL;		/* empty ones are skipped */
+	iov[1].iov_len = 0;
+	iov[2].iov_base = (void *)payload;
+	iov[2].iov_len = 8;
+	if (writev(fd, iov, 3) != 12) {
+		fail("writev");
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	iov[0].iov_base = a;
+	iov[0].iov_len = sizeof(a);
+	iov[1].iov_base = b;
+	iov[1].iov_len = sizeof(b);
+	n = readv(fd, iov, 2);
+	if (n != 12) {
+		fail("readv");
+	}
+	if (memcmp(a, "HDR:pa", 6) != 0 || memcmp(b, "yload\n", 6) != 0) {
+		fail("readv read the wrong thing");
+	}
+
+	if (writev(fd, iov, 0) >= 0 || errno != EINVAL) {
+		fail("writev of nothing worked");
+	}
+	lseek(fd, 0, SEEK_SET);
+	iov[0].iov_base = (void *)0x40000000;
+	if (readv(fd, iov, 1) >= 0 || errno != EFAULT) {
+		fail("readv into a bad buffer worked");
+	}
+	if (readv(fd, (struct iovec *)0x40000000, 1) >= 0 || errno != EFAULT) {
+		fail("readv of a bad iovec array worked");
+	}
+	close(fd);
+
+	iov[0].iov_base = (void *)hdr;
+	iov[0].iov_len = 4;
+	iov[1].iov_base = (void *)payload;
+	iov[1].iov_len = 8;
+	if (writev(STDOUT_FILENO, iov, 2) != 12) {
+		fail("writev to the console");
+	}
+
+	printf("Passed rwv test.\n");
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * schedctl.c
+ *
+ *	Exercises setpriority/getpriority and sched_setaffinity/
+ *	sched_getaffinity: nice values are clamped and inherited by
+ *	fork, masks naming no cpu are refused, and a process pinned to
+ *	one cpu stops migrating while it spins.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define Spins	2000000
+
+static
+void
+fail(const char *what)
+{
+	printf("Test failed! %s: errno %d\n", what, errno);
+	exit(1);
+}
+
+static
+int
+nice_of(pid_t pid)
+{
+	int prio;
+
+	errno = 0;
+	prio = getpriority(PRIO_PROCESS, pid);
+	if (prio == -1 && errno != 0) {
+		fail("getpriority");
+	}
+	return prio;
+}
+
+static
+unsigned
+migrations(void)
+{
+	struct schedstat ss;
+
+	if (getschedstat(0, &ss) != 0) {
+		fail("getschedstat");
+	}
+	return ss.ss_migrations;
+}
+
+static
+void
+testnice(void)
+{
+	pid_t pid;
+	int status;
+
+	if (nice_of(0) != 0) {
+		printf("Test failed! started at nice %d\n", nice_of(0));
+		exit(1);
+	}
+	if (setpriority(PRIO_PROCESS, 0, 10) != 0) {
+		fail("setpriority");
+	}
+	if (nice_of(0) != 10) {
+		printf("Test failed! nice %d, wanted 10\n", nice_of(0));
+		exit(1);
+	}
+	if (setpriority(PRIO_PROCESS, 0, 1000) != 0 ||
+	    nice_of(0) != PRIO_MAX) {
+		printf("Test failed! nice 1000 not clamped\n");
+		exit(1);
+	}
+	if (setpriority(PRIO_PGRP, 0, 0) == 0 || errno != EINVAL) {
+		printf("Test failed! setpriority(PRIO_PGRP) worked\n");
+		exit(1);
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		fail("fork");
+	}
+	if (pid == 0) {
+		_exit(nice_of(0) == PRIO_MAX ? 0 : 1);
+	}
+	if (nice_of(pid) != PRIO_MAX) {
+		printf("Test failed! child's nice seen as %d\n", nice_of(pid));
+		exit(1);
+	}
+	if (waitpid(pid, &status, 0) != pid) {
+		fail("waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		printf("Test failed! child did not inherit nice\n");
+		exit(1);
+	}
+
+	if (setpriority(PRIO_PROCESS, 0, 0) != 0) {
+		fail("setpriority");
+	}
+}
+
+static
+void
+testaffinity(void)
+{
+	struct schedstat ss;
+	unsigned all, mask, before;
+	volatile unsigned spin;
+
+	if (getschedstat(0, &ss) != 0) {
+		fail("getschedstat");
+	}
+	all = ss.ss_ncpus >= 32 ? ~0U : (1U << ss.ss_ncpus) - 1;
+
+	if (sched_getaffinity(0, &mask) != 0) {
+		fail("sched_getaffinity");
+	}
+	if ((mask & all) != all) {
+		printf("Test failed! started with mask 0x%x\n", mask);
+		exit(1);
+	}
+	if (sched_setaffinity(0, 0) == 0 || errno != EINVAL) {
+		printf("Test failed! empty mask accepted\n");
+		exit(1);
+	}
+	if (ss.ss_ncpus < 32 &&
+	    (sched_setaffinity(0, ~all) == 0 || errno != EINVAL)) {
+		printf("Test failed! mask of no real cpu accepted\n");
+		exit(1);
+	}
+
+	/* Pin to the last cpu, which is not where most things start. */
+	mask = 1U << (ss.ss_ncpus - 1);
+	if (sched_setaffinity(0, mask) != 0) {
+		fail("sched_setaffinity");
+	}
+	if (sched_getaffinity(0, &mask) != 0 ||
+	    mask != 1U << (ss.ss_ncpus - 1)) {
+		printf("Test failed! mask read back as 0x%x\n", mask);
+		exit(1);
+	}
+	before = migrations();
+	for (spin = 0; spin < Spins; spin++) {
+	}
+	if (migrations() != before) {
+		printf("Test failed! pinned process migrated %u times\n",
+		       migrations() - before);
+		exit(1);
+	}
+
+	if (sched_setaffinity(0, all) != 0) {
+		fail("sched_setaffinity");
+	}
+	printf("%u cpus; pinned to cpu %u while spinning\n",
+	       ss.ss_ncpus, ss.ss_ncpus - 1);
+}
+
+int
+main()
+{
+	testnice();
+	testaffinity();
+	printf("Passed schedctl test.\n");
+	return 0;
+}
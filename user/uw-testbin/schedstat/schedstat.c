@@ -0,0 +1,99 @@
+/*
+ * schedstat.c
+ *
+ *	Exercises getschedstat: checks that every cpu can be asked about
+ *	and one past the last can't, that spinning adds to our run time,
+ *	and that waiting for a child counts as giving up the cpu.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#define SpinLoops	2000000
+
+static
+void
+show(const char *what, const struct schedstat *ss)
+{
+	printf("%s: ran %u, %u voluntary and %u involuntary switches, "
+	       "%u wakeups (latency %u, max %u), %u migrations\n", what,
+	       ss->ss_runticks, ss->ss_vswitches, ss->ss_ivswitches,
+	       ss->ss_wakeups, ss->ss_wakelat, ss->ss_maxwakelat,
+	       ss->ss_migrations);
+}
+
+int
+main()
+{
+	struct schedstat before, after, cpu;
+	volatile unsigned spin;
+	unsigned i, j;
+	pid_t pid;
+	int status;
+
+	printf("Starting the schedstat program\n");
+
+	if (getschedstat(0, &before) != 0) {
+		printf("Test failed! getschedstat: errno %d\n", errno);
+		exit(1);
+	}
+	show("start", &before);
+
+	for (i = 0; i < before.ss_ncpus; i++) {
+		if (getschedstat(i, &cpu) != 0) {
+			printf("Test failed! getschedstat of cpu %u: "
+			       "errno %d\n", i, errno);
+			exit(1);
+		}
+		printf("cpu %u: %u hardclocks, idle %u, waiting:", i,
+		       cpu.ss_hardclocks, cpu.ss_idle);
+		for (j = 0; j < SCHEDSTAT_RQHIST; j++) {
+			printf(" %u", cpu.ss_rqhist[j]);
+		}
+		printf("\n");
+	}
+	if (getschedstat(before.ss_ncpus, &cpu) == 0 || errno != EINVAL) {
+		printf("Test failed! getschedstat of cpu %u worked\n",
+		       before.ss_ncpus);
+		exit(1);
+	}
+
+	for (spin = 0; spin < SpinLoops; spin++) {
+		/* nothing */
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		printf("Test failed! fork: errno %d\n", errno);
+		exit(1);
+	}
+	if (pid == 0) {
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		printf("Test failed! waitpid: errno %d\n", errno);
+		exit(1);
+	}
+
+	if (getschedstat(0, &after) != 0) {
+		printf("Test failed! getschedstat: errno %d\n", errno);
+		exit(1);
+	}
+	show("end", &after);
+
+	if (after.ss_runticks <= before.ss_runticks) {
+		printf("Test failed! spinning did not add to run time\n");
+		exit(1);
+	}
+	if (after.ss_vswitches + after.ss_ivswitches <=
+	    before.ss_vswitches + before.ss_ivswitches) {
+		printf("Test failed! no switches counted\n");
+		exit(1);
+	}
+
+	printf("Passed schedstat test.\n");
+	exit(0);
+}
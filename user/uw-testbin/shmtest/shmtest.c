@@ -0,0 +1,229 @@
+/*
+ * shmtest.c
+ *
+ *	Exercises shared memory segments: children that inherit an
+ *	attachment across fork each fill in part of a segment, and the
+ *	parent sees all of it; two attachments in one process see each
+ *	other's stores; a read-only attachment reads the same data; and
+ *	keys, IPC_STAT, IPC_RMID and bad requests behave.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define PageSize	4096
+#define NPages		64
+#define NProcs		4
+#define Key		0x5348
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+static
+int
+value(int i)
+{
+	return i * 7 + 3;
+}
+
+/*
+ * Children fill in their share of one segment each, through the
+ * attachment they got from fork.
+ */
+static
+void
+testfork(void)
+{
+	pid_t pids[NProcs];
+	int *p, *q;
+	int id, i, n, status, per;
+
+	id = shmget(IPC_PRIVATE, NPages * PageSize, 0600);
+	if (id < 0) {
+		fail("shmget");
+	}
+	p = shmat(id, NULL, 0);
+	if (p == (void *)-1) {
+		fail("shmat");
+	}
+	per = NPages * PageSize / sizeof(int) / NProcs;
+
+	for (n = 0; n < NProcs; n++) {
+		pids[n] = fork();
+		if (pids[n] < 0) {
+			fail("fork");
+		}
+		if (pids[n] == 0) {
+			for (i = n * per; i < (n + 1) * per; i++) {
+				p[i] = value(i);
+			}
+			_exit(0);
+		}
+	}
+	for (n = 0; n < NProcs; n++) {
+		if (waitpid(pids[n], &status, 0) != pids[n]) {
+			fail("waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			printf("Test failed! Child %d\n", n);
+			exit(1);
+		}
+	}
+	for (i = 0; i < NProcs * per; i++) {
+		if (p[i] != value(i)) {
+			printf("Test failed! Word %d is %d, wanted %d\n",
+			       i, p[i], value(i));
+			exit(1);
+		}
+	}
+	printf("stage [1] done\n");
+
+	/* A second attachment is the same memory. */
+	q = shmat(id, NULL, 0);
+	if (q == (void *)-1 || q == p) {
+		fail("second shmat");
+	}
+	q[5] = -1;
+	if (p[5] != -1) {
+		printf("Test failed! Store through one attachment not seen\n");
+		exit(1);
+	}
+	if (shmdt(q) != 0) {
+		fail("shmdt");
+	}
+	q = shmat(id, NULL, SHM_RDONLY);
+	if (q == (void *)-1) {
+		fail("read-only shmat");
+	}
+	if (q[6] != value(6) || q[5] != -1) {
+		printf("Test failed! Read-only attachment reads wrong\n");
+		exit(1);
+	}
+	if (shmdt(q) != 0 || shmdt(p) != 0) {
+		fail("shmdt");
+	}
+	if (shmctl(id, IPC_RMID, NULL) != 0) {
+		fail("IPC_RMID");
+	}
+	printf("stage [2] done\n");
+}
+
+/*
+ * Keys, and what happens around IPC_RMID.
+ */
+static
+void
+testkeys(void)
+{
+	struct shmid_ds ds;
+	int id, id2;
+	char *p;
+
+	id = shmget(Key, PageSize, IPC_CREAT | IPC_EXCL | 0600);
+	if (id < 0) {
+		fail("shmget with IPC_CREAT");
+	}
+	if (shmget(Key, PageSize, IPC_CREAT | IPC_EXCL | 0600) >= 0 ||
+	    errno != EEXIST) {
+		fail("second IPC_EXCL shmget worked");
+	}
+	id2 = shmget(Key, 10, 0);
+	if (id2 != id) {
+		fail("shmget by key");
+	}
+	if (shmget(Key, 2 * PageSize, 0) >= 0 || errno != EINVAL) {
+		fail("shmget bigger than the segment worked");
+	}
+	if (shmget(Key + 1, PageSize, 0) >= 0 || errno != ENOENT) {
+		fail("shmget of a missing key worked");
+	}
+
+	p = shmat(id, NULL, 0);
+	if (p == (void *)-1) {
+		fail("shmat");
+	}
+	p[0] = 'x';
+	if (shmctl(id, IPC_STAT, &ds) != 0) {
+		fail("IPC_STAT");
+	}
+	if (ds.shm_key != Key || ds.shm_segsz != PageSize ||
+	    ds.shm_nattch != 1 || ds.shm_resident != 1) {
+		printf("Test failed! IPC_STAT: key %d size %u attached %u "
+		       "resident %u\n", ds.shm_key, ds.shm_segsz,
+		       ds.shm_nattch, ds.shm_resident);
+		exit(1);
+	}
+
+	/* Removed, it stays mapped, but nobody new can find it. */
+	if (shmctl(id, IPC_RMID, NULL) != 0) {
+		fail("IPC_RMID");
+	}
+	if (p[0] != 'x') {
+		printf("Test failed! Segment changed after IPC_RMID\n");
+		exit(1);
+	}
+	if (shmat(id, NULL, 0) != (void *)-1 || errno != EINVAL) {
+		fail("shmat after IPC_RMID worked");
+	}
+	if (shmget(Key, PageSize, 0) >= 0 || errno != ENOENT) {
+		fail("key still there after IPC_RMID");
+	}
+	if (shmdt(p) != 0) {
+		fail("shmdt");
+	}
+	printf("stage [3] done\n");
+}
+
+static
+void
+testbad(void)
+{
+	char c;
+	int id;
+
+	if (shmget(IPC_PRIVATE, 0, 0) >= 0 || errno != EINVAL) {
+		fail("zero-size shmget worked");
+	}
+	if (shmget(IPC_PRIVATE, SHMMAX + 1, 0) >= 0 || errno != EINVAL) {
+		fail("oversize shmget worked");
+	}
+	if (shmat(-1, NULL, 0) != (void *)-1 || errno != EINVAL) {
+		fail("shmat of a bad id worked");
+	}
+	if (shmdt(&c) == 0 || errno != EINVAL) {
+		fail("shmdt of the stack worked");
+	}
+	id = shmget(IPC_PRIVATE, PageSize, 0);
+	if (id < 0) {
+		fail("shmget");
+	}
+	if (shmat(id, &c, 0) != (void *)-1 || errno != EINVAL) {
+		fail("shmat at an address worked");
+	}
+	if (shmctl(id, 99, NULL) == 0 || errno != EINVAL) {
+		fail("bad shmctl worked");
+	}
+	if (shmctl(id, IPC_RMID, NULL) != 0) {
+		fail("IPC_RMID");
+	}
+	printf("stage [4] done\n");
+}
+
+int
+main()
+{
+	testfork();
+	testkeys();
+	testbad();
+	printf("Passed shmtest test.\n");
+	return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * spawn.c
+ *
+ *	Exercises spawn: a child must get its arguments and be waitable
+ *	for its exit status, and a program that cannot be run must fail
+ *	the spawn itself. Then times spawn against fork and execv for
+ *	starting (and waiting for) a trivial child.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define Self	"/uw-testbin/spawn"
+#define Rounds	20
+
+static char *childargs[] = { (char *)"spawn", (char *)"child", NULL, NULL };
+
+static
+void
+waitfor(pid_t pid, int code)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) != pid) {
+		printf("Test failed! waitpid: errno %d\n", errno);
+		exit(1);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != code) {
+		printf("Test failed! child status %d, wanted exit %d\n",
+		       status, code);
+		exit(1);
+	}
+}
+
+static
+pid_t
+forkexec(void)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		execv(Self, childargs);
+		_exit(99);
+	}
+	return pid;
+}
+
+/*
+ * Usec to start and wait for ROUNDS children, one way or the other.
+ */
+static
+unsigned long
+timeit(int usespawn)
+{
+	time_t s1, s2;
+	unsigned long ns1, ns2;
+	pid_t pid;
+	int i;
+
+	childargs[2] = (char *)"0";
+	__time(&s1, &ns1);
+	for (i=0; i<Rounds; i++) {
+		pid = usespawn ? spawn(Self, childargs) : forkexec();
+		if (pid < 0) {
+			printf("Test failed! errno %d\n", errno);
+			exit(1);
+		}
+		waitfor(pid, 0);
+	}
+	__time(&s2, &ns2);
+	return (s2 - s1) * 1000000 + ns2 / 1000 - ns1 / 1000;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long us;
+	pid_t pid;
+
+	if (argc == 3 && strcmp(argv[1], "child") == 0) {
+		return atoi(argv[2]);
+	}
+
+	childargs[2] = (char *)"7";
+	pid = spawn(Self, childargs);
+	if (pid < 0) {
+		printf("Test failed! spawn: errno %d\n", errno);
+		exit(1);
+	}
+	waitfor(pid, 7);
+
+	if (spawn("/nosuchprogram", childargs) >= 0 || errno != ENOENT) {
+		printf("Test failed! spawn of a missing program: errno %d\n",
+		       errno);
+		exit(1);
+	}
+
+	us = timeit(1);
+	printf("spawn:        %lu us per child\n", us / Rounds);
+	us = timeit(0);
+	printf("fork + execv: %lu us per child\n", us / Rounds);
+
+	printf("Passed spawn test.\n");
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * statat.c
+ *
+ *	Exercises fstatat, stat and fstat: a file written through one
+ *	name shows the same size and type by each of them, a directory
+ *	shows as one, and a name that is not there fails with ENOENT.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define FileName "STATAT"
+
+static
+void
+fail(const char *msg)
+{
+	printf("Test failed! %s (errno %d)\n", msg, errno);
+	exit(1);
+}
+
+int
+main()
+{
+	struct stat st1, st2, st3;
+	int dirfd, fd;
+
+	fd = open(FileName, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("create");
+	}
+	if (write(fd, "0123456789", 10) != 10) {
+		fail("write");
+	}
+	if (fstat(fd, &st1) < 0) {
+		fail("fstat");
+	}
+	close(fd);
+
+	dirfd = open(".", O_RDONLY);
+	if (dirfd < 0) {
+		fail("open of .");
+	}
+	if (fstatat(dirfd, FileName, &st2) < 0) {
+		fail("fstatat");
+	}
+	if (stat(FileName, &st3) < 0) {
+		fail("stat");
+	}
+	if (!S_ISREG(st1.st_mode) || st1.st_size != 10 ||
+	    st2.st_size != 10 || st3.st_size != 10 ||
+	    st2.st_mode != st1.st_mode || st3.st_mode != st1.st_mode ||
+	    st2.st_nlink != st1.st_nlink || st3.st_nlink != st1.st_nlink) {
+		fail("the three stats disagree");
+	}
+
+	if (fstat(dirfd, &st1) < 0 || !S_ISDIR(st1.st_mode)) {
+		fail("fstat of . is not a directory");
+	}
+	if (fstatat(dirfd, "STATAT.none", &st2) >= 0 || errno != ENOENT) {
+		fail("fstatat of a missing name did not fail with ENOENT");
+	}
+	close(dirfd);
+
+	remove(FileName);
+	printf("Passed statat test.\n");
+	return 0;
+}
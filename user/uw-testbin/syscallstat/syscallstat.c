@@ -0,0 +1,80 @@
+/*
+ * syscallstat.c
+ *
+ *	Exercises getsyscallstat: makes some getpid calls and some
+ *	failing waitpid calls and checks that they are counted, checks
+ *	that numbers with no system call behind them fail, and then
+ *	prints the counts of every call that has been made.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <kern/syscall.h>
+
+#define Calls	100
+
+static
+void
+get(int callno, struct syscallstat *ss)
+{
+	if (getsyscallstat(callno, ss) != 0) {
+		printf("Test failed! getsyscallstat(%d): errno %d\n",
+		       callno, errno);
+		exit(1);
+	}
+}
+
+int
+main()
+{
+	struct syscallstat before, after, ss;
+	unsigned i, b, n;
+	int callno;
+
+	get(SYS_getpid, &before);
+	for (i = 0; i < Calls; i++) {
+		getpid();
+	}
+	get(SYS_getpid, &after);
+	if (after.ss_calls - before.ss_calls < Calls) {
+		printf("Test failed! %u getpid calls counted, wanted %u\n",
+		       after.ss_calls - before.ss_calls, Calls);
+		exit(1);
+	}
+
+	get(SYS_waitpid, &before);
+	for (i = 0; i < Calls; i++) {
+		waitpid(-5, NULL, 0);
+	}
+	get(SYS_waitpid, &after);
+	if (after.ss_errors - before.ss_errors < Calls) {
+		printf("Test failed! %u waitpid errors counted, wanted %u\n",
+		       after.ss_errors - before.ss_errors, Calls);
+		exit(1);
+	}
+
+	if (getsyscallstat(after.ss_nsyscalls, &ss) == 0 || errno != ENOSYS) {
+		printf("Test failed! getsyscallstat past the end worked\n");
+		exit(1);
+	}
+
+	for (callno = 0; callno < (int)after.ss_nsyscalls; callno++) {
+		if (getsyscallstat(callno, &ss) != 0 || ss.ss_calls == 0) {
+			continue;
+		}
+		printf("%-16s %8u calls %6u errors:", ss.ss_name,
+		       ss.ss_calls, ss.ss_errors);
+		for (b = 0; b < SYSCALLSTAT_NBUCKETS; b++) {
+			n = ss.ss_hist[b];
+			if (n != 0) {
+				printf(" 2^%u:%u", b + SYSCALLSTAT_MINSHIFT, n);
+			}
+		}
+		printf("\n");
+	}
+
+	printf("Passed syscallstat test.\n");
+	return 0;
+}
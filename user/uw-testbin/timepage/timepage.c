@@ -0,0 +1,91 @@
+/*
+ * timepage.c
+ *
+ *	Exercises the time page: checks that __timepage agrees with
+ *	__time to within a second and never goes backwards, times a run
+ *	of each, and checks that writing to the page kills the writer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <kern/timepage.h>
+
+#define Calls	10000
+
+/* Nanoseconds from S1/NS1 to S2/NS2, which had better fit. */
+static
+unsigned long
+elapsed(time_t s1, unsigned long ns1, time_t s2, unsigned long ns2)
+{
+	return (unsigned long)(s2 - s1) * 1000000000 + ns2 - ns1;
+}
+
+int
+main()
+{
+	time_t s, ps, s1, s2, last;
+	unsigned long ns, pns, ns1, ns2, lastns;
+	unsigned i;
+	pid_t pid;
+	int status;
+
+	__time(&s, &ns);
+	__timepage(&ps, &pns);
+	if (ps > s || s - ps > 1) {
+		printf("Test failed! time page says %d, clock says %d\n",
+		       (int)ps, (int)s);
+		exit(1);
+	}
+	if (time(NULL) < ps) {
+		printf("Test failed! time() is behind the time page\n");
+		exit(1);
+	}
+
+	last = ps;
+	lastns = pns;
+	__time(&s1, &ns1);
+	for (i = 0; i < Calls; i++) {
+		__timepage(&ps, &pns);
+		if (ps < last || (ps == last && pns < lastns)) {
+			printf("Test failed! time page went backwards\n");
+			exit(1);
+		}
+		last = ps;
+		lastns = pns;
+	}
+	__time(&s2, &ns2);
+	printf("%u __timepage calls: %lu ns each\n", Calls,
+	       elapsed(s1, ns1, s2, ns2) / Calls);
+
+	__time(&s1, &ns1);
+	for (i = 0; i < Calls; i++) {
+		__time(&s, &ns);
+	}
+	__time(&s2, &ns2);
+	printf("%u __time calls: %lu ns each\n", Calls,
+	       elapsed(s1, ns1, s2, ns2) / Calls);
+
+	pid = fork();
+	if (pid < 0) {
+		printf("Test failed! fork: errno %d\n", errno);
+		exit(1);
+	}
+	if (pid == 0) {
+		*(volatile unsigned *)TIMEPAGE_VADDR = 0;
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid) {
+		printf("Test failed! waitpid: errno %d\n", errno);
+		exit(1);
+	}
+	if (!WIFSIGNALED(status)) {
+		printf("Test failed! writing the time page worked\n");
+		exit(1);
+	}
+
+	printf("Passed timepage test.\n");
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * uthreads.c
+ *
+ *	Exercises thread_create and thread_join: some threads each sum
+ *	their share of an array in shared memory and hand back the
+ *	result, which must add up to the whole; a thread that writes a
+ *	global must be seen to have done so; and joining a thread twice,
+ *	or one that doesn't exist, must fail.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define NThreads	4
+#define NValues		4096
+
+static unsigned values[NValues];
+static volatile unsigned touched;
+
+static
+void *
+sum(void *arg)
+{
+	unsigned part = (unsigned)arg;
+	unsigned i, total;
+
+	total = 0;
+	for (i = part; i < NValues; i += NThreads) {
+		total += values[i];
+	}
+	touched |= 1U << part;
+	return (void *)total;
+}
+
+int
+main()
+{
+	int tids[NThreads];
+	unsigned i, total, expect;
+	void *ret;
+
+	printf("Starting the uthreads program\n");
+
+	expect = 0;
+	for (i = 0; i < NValues; i++) {
+		values[i] = i * 7 + 1;
+		expect += values[i];
+	}
+
+	for (i = 0; i < NThreads; i++) {
+		tids[i] = thread_create(sum, (void *)i);
+		if (tids[i] < 0) {
+			printf("Test failed! thread_create: errno %d\n", errno);
+			exit(1);
+		}
+	}
+
+	total = 0;
+	for (i = 0; i < NThreads; i++) {
+		if (thread_join(tids[i], &ret) != 0) {
+			printf("Test failed! thread_join of %d: errno %d\n",
+			       tids[i], errno);
+			exit(1);
+		}
+		total += (unsigned)ret;
+	}
+	if (total != expect) {
+		printf("Test failed! sum %u, expected %u\n", total, expect);
+		exit(1);
+	}
+	if (touched != (1U << NThreads) - 1) {
+		printf("Test failed! threads touched 0x%x\n", touched);
+		exit(1);
+	}
+	if (thread_join(tids[0], &ret) == 0 || errno != ESRCH) {
+		printf("Test failed! joined thread %d twice\n", tids[0]);
+		exit(1);
+	}
+
+	printf("%u threads summed %u values to %u\n", NThreads, NValues, total);
+	printf("Passed uthreads test.\n");
+	exit(0);
+}
@@ -0,0 +1,83 @@
+/*
+ * waitany.c
+ *
+ *	Exercises waitpid with WAIT_ANY and WNOHANG: WNOHANG must not
+ *	block while the children are still running, waiting for any
+ *	child must collect each of them exactly once with its own exit
+ *	code, and once they are all collected there must be no child
+ *	left to wait for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define NChildren	6
+
+int
+main(void)
+{
+	pid_t pids[NChildren], pid;
+	int seen[NChildren];
+	int i, status;
+
+	for (i=0; i<NChildren; i++) {
+		seen[i] = 0;
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			printf("Test failed! fork: errno %d\n", errno);
+			exit(1);
+		}
+		if (pids[i] == 0) {
+			/* give the parent time to poll */
+			volatile int j;
+			for (j=0; j<200000 * (i + 1); j++);
+			_exit(i + 10);
+		}
+	}
+
+	pid = waitpid(WAIT_ANY, &status, WNOHANG);
+	if (pid < 0) {
+		printf("Test failed! waitpid WNOHANG: errno %d\n", errno);
+		exit(1);
+	}
+	printf("First WNOHANG poll returned %d\n", pid);
+	if (pid > 0) {
+		for (i=0; i<NChildren && pids[i] != pid; i++);
+		if (i == NChildren || WEXITSTATUS(status) != i + 10) {
+			printf("Test failed! pid %d status %d\n", pid, status);
+			exit(1);
+		}
+		seen[i]++;
+	}
+
+	while ((pid = waitpid(WAIT_ANY, &status, 0)) > 0) {
+		for (i=0; i<NChildren && pids[i] != pid; i++);
+		if (i == NChildren || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != i + 10) {
+			printf("Test failed! pid %d status %d\n", pid, status);
+			exit(1);
+		}
+		seen[i]++;
+	}
+	if (errno != ECHILD) {
+		printf("Test failed! last waitpid: errno %d\n", errno);
+		exit(1);
+	}
+
+	for (i=0; i<NChildren; i++) {
+		if (seen[i] != 1) {
+			printf("Test failed! child %d collected %d times\n",
+			       i, seen[i]);
+			exit(1);
+		}
+	}
+	if (waitpid(pids[0], &status, WNOHANG) >= 0 || errno != ESRCH) {
+		printf("Test failed! collected child still waitable\n");
+		exit(1);
+	}
+
+	printf("Passed waitany test.\n");
+	return 0;
+}